@@ -40,7 +40,8 @@ local_cflags_for_slang += -DRS_VERSION=$(RS_VERSION)
 static_libraries_needed_by_slang := \
 	libLLVMBitWriter_2_9 \
 	libLLVMBitWriter_2_9_func \
-	libLLVMBitWriter_3_2
+	libLLVMBitWriter_3_2 \
+	libLLVMBitWriter_common
 
 # Static library libslang for host
 # ========================================================
@@ -73,7 +74,10 @@ LOCAL_SRC_FILES :=	\
 	slang_utils.cpp	\
 	slang_backend.cpp	\
 	slang_pragma_recorder.cpp	\
-	slang_diagnostic_buffer.cpp
+	slang_diagnostic_buffer.cpp	\
+	slang_header_cache.cpp	\
+	slang_execution_profile.cpp	\
+	slang_time_report.cpp
 
 LOCAL_C_INCLUDES += frameworks/compile/libbcc/include
 
@@ -145,6 +149,10 @@ LOCAL_STATIC_LIBRARIES :=	\
 LOCAL_SHARED_LIBRARIES := \
 	libLLVM
 
+ifneq ($(HOST_OS),windows)
+  LOCAL_LDLIBS := -ldl -lpthread
+endif
+
 include $(CLANG_HOST_BUILD_MK)
 include $(BUILD_HOST_EXECUTABLE)
 
@@ -179,13 +187,16 @@ RS_SPEC_TABLES :=	\
 	RSDataTypeEnums.inc	\
 	RSDataElementEnums.inc	\
 	RSMatrixTypeEnums.inc	\
-	RSObjectTypeEnums.inc
+	RSObjectTypeEnums.inc	\
+	RSSpecificTypeHash.inc
 
 LOCAL_SRC_FILES :=	\
 	llvm-rs-cc.cpp	\
 	slang_rs.cpp	\
 	slang_rs_ast_replace.cpp	\
 	slang_rs_check_ast.cpp	\
+	slang_rs_element_at.cpp \
+	slang_rs_compile_cache.cpp	\
 	slang_rs_context.cpp	\
 	slang_rs_pragma_handler.cpp	\
 	slang_rs_backend.cpp	\
@@ -195,15 +206,22 @@ LOCAL_SRC_FILES :=	\
 	slang_rs_export_var.cpp	\
 	slang_rs_export_func.cpp	\
 	slang_rs_export_foreach.cpp \
+	slang_rs_export_reduce.cpp \
+	slang_rs_export_usage.cpp \
+	slang_rs_metadata_spec_encoder.cpp \
 	slang_rs_object_ref_count.cpp	\
+	slang_rs_odr_database.cpp \
 	slang_rs_reflection.cpp \
 	slang_rs_reflection_base.cpp \
 	slang_rs_reflection_cpp.cpp \
+	slang_rs_reflection_manifest.cpp \
 	slang_rs_reflect_utils.cpp \
+	slang_rs_server.cpp \
 	strip_unknown_attributes.cpp
 
 LOCAL_STATIC_LIBRARIES :=	\
 	libslang \
+	librslib \
 	$(static_libraries_needed_by_slang)
 
 LOCAL_SHARED_LIBRARIES := \
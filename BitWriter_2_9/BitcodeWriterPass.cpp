@@ -21,12 +21,13 @@ using namespace llvm;
 namespace {
   class WriteBitcodePass : public ModulePass {
     raw_ostream &OS; // raw_ostream to print on
+    llvm_legacy::BitcodeSizeReport *Report;
 
     bool expandCaseRange(Function &F);
   public:
     static char ID; // Pass identification, replacement for typeid
-    explicit WriteBitcodePass(raw_ostream &o)
-      : ModulePass(ID), OS(o) {}
+    WriteBitcodePass(raw_ostream &o, llvm_legacy::BitcodeSizeReport *R)
+      : ModulePass(ID), OS(o), Report(R) {}
 
     const char *getPassName() const { return "Bitcode Writer"; }
 
@@ -36,7 +37,7 @@ namespace {
         if (!F->isDeclaration())
           Changed |= expandCaseRange(*F);
 
-      llvm_2_9::WriteBitcodeToFile(&M, OS);
+      llvm_2_9::WriteBitcodeToFile(&M, OS, Report);
       return Changed;
     }
   };
@@ -95,6 +96,8 @@ bool WriteBitcodePass::expandCaseRange(Function &F) {
 
 /// createBitcodeWriterPass - Create and return a pass that writes the module
 /// to the specified ostream.
-llvm::ModulePass *llvm_2_9::createBitcodeWriterPass(llvm::raw_ostream &Str) {
-  return new WriteBitcodePass(Str);
+llvm::ModulePass *
+llvm_2_9::createBitcodeWriterPass(llvm::raw_ostream &Str,
+                                  llvm_legacy::BitcodeSizeReport *Report) {
+  return new WriteBitcodePass(Str, Report);
 }
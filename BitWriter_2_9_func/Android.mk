@@ -5,8 +5,7 @@ include $(LLVM_ROOT_PATH)/llvm.mk
 
 bitcode_writer_2_9_func_SRC_FILES :=	\
 	BitcodeWriter.cpp	\
-	BitcodeWriterPass.cpp	\
-	ValueEnumerator.cpp
+	BitcodeWriterPass.cpp
 
 # For the host
 # =====================================================
@@ -13,6 +13,8 @@
 
 #include "ReaderWriter_2_9_func.h"
 #include "legacy_bitcode.h"
+#include "BitWriter_common/BitcodeEncoding.h"
+#include "BitWriter_common/BitcodeSizeReport.h"
 #include "ValueEnumerator.h"
 #include "llvm/ADT/Triple.h"
 #include "llvm/Bitcode/BitstreamWriter.h"
@@ -32,6 +34,8 @@
 #include <map>
 using namespace llvm;
 
+typedef llvm_legacy::BitcodeSizeReport SizeReport;
+
 /// These are manifest constants used by the bitcode writer. They do not need to
 /// be kept in sync with the reader, but need to be consistent within this file.
 enum {
@@ -60,101 +64,6 @@ enum {
 };
 
 
-static unsigned GetEncodedCastOpcode(unsigned Opcode) {
-  switch (Opcode) {
-  default: llvm_unreachable("Unknown cast instruction!");
-  case Instruction::Trunc   : return bitc::CAST_TRUNC;
-  case Instruction::ZExt    : return bitc::CAST_ZEXT;
-  case Instruction::SExt    : return bitc::CAST_SEXT;
-  case Instruction::FPToUI  : return bitc::CAST_FPTOUI;
-  case Instruction::FPToSI  : return bitc::CAST_FPTOSI;
-  case Instruction::UIToFP  : return bitc::CAST_UITOFP;
-  case Instruction::SIToFP  : return bitc::CAST_SITOFP;
-  case Instruction::FPTrunc : return bitc::CAST_FPTRUNC;
-  case Instruction::FPExt   : return bitc::CAST_FPEXT;
-  case Instruction::PtrToInt: return bitc::CAST_PTRTOINT;
-  case Instruction::IntToPtr: return bitc::CAST_INTTOPTR;
-  case Instruction::BitCast : return bitc::CAST_BITCAST;
-  }
-}
-
-static unsigned GetEncodedBinaryOpcode(unsigned Opcode) {
-  switch (Opcode) {
-  default: llvm_unreachable("Unknown binary instruction!");
-  case Instruction::Add:
-  case Instruction::FAdd: return bitc::BINOP_ADD;
-  case Instruction::Sub:
-  case Instruction::FSub: return bitc::BINOP_SUB;
-  case Instruction::Mul:
-  case Instruction::FMul: return bitc::BINOP_MUL;
-  case Instruction::UDiv: return bitc::BINOP_UDIV;
-  case Instruction::FDiv:
-  case Instruction::SDiv: return bitc::BINOP_SDIV;
-  case Instruction::URem: return bitc::BINOP_UREM;
-  case Instruction::FRem:
-  case Instruction::SRem: return bitc::BINOP_SREM;
-  case Instruction::Shl:  return bitc::BINOP_SHL;
-  case Instruction::LShr: return bitc::BINOP_LSHR;
-  case Instruction::AShr: return bitc::BINOP_ASHR;
-  case Instruction::And:  return bitc::BINOP_AND;
-  case Instruction::Or:   return bitc::BINOP_OR;
-  case Instruction::Xor:  return bitc::BINOP_XOR;
-  }
-}
-
-static unsigned GetEncodedRMWOperation(AtomicRMWInst::BinOp Op) {
-  switch (Op) {
-  default: llvm_unreachable("Unknown RMW operation!");
-  case AtomicRMWInst::Xchg: return bitc::RMW_XCHG;
-  case AtomicRMWInst::Add: return bitc::RMW_ADD;
-  case AtomicRMWInst::Sub: return bitc::RMW_SUB;
-  case AtomicRMWInst::And: return bitc::RMW_AND;
-  case AtomicRMWInst::Nand: return bitc::RMW_NAND;
-  case AtomicRMWInst::Or: return bitc::RMW_OR;
-  case AtomicRMWInst::Xor: return bitc::RMW_XOR;
-  case AtomicRMWInst::Max: return bitc::RMW_MAX;
-  case AtomicRMWInst::Min: return bitc::RMW_MIN;
-  case AtomicRMWInst::UMax: return bitc::RMW_UMAX;
-  case AtomicRMWInst::UMin: return bitc::RMW_UMIN;
-  }
-}
-
-static unsigned GetEncodedOrdering(AtomicOrdering Ordering) {
-  switch (Ordering) {
-  default: llvm_unreachable("Unknown atomic ordering");
-  case NotAtomic: return bitc::ORDERING_NOTATOMIC;
-  case Unordered: return bitc::ORDERING_UNORDERED;
-  case Monotonic: return bitc::ORDERING_MONOTONIC;
-  case Acquire: return bitc::ORDERING_ACQUIRE;
-  case Release: return bitc::ORDERING_RELEASE;
-  case AcquireRelease: return bitc::ORDERING_ACQREL;
-  case SequentiallyConsistent: return bitc::ORDERING_SEQCST;
-  }
-}
-
-static unsigned GetEncodedSynchScope(SynchronizationScope SynchScope) {
-  switch (SynchScope) {
-  default: llvm_unreachable("Unknown synchronization scope");
-  case SingleThread: return bitc::SYNCHSCOPE_SINGLETHREAD;
-  case CrossThread: return bitc::SYNCHSCOPE_CROSSTHREAD;
-  }
-}
-
-static void WriteStringRecord(unsigned Code, StringRef Str,
-                              unsigned AbbrevToUse, BitstreamWriter &Stream) {
-  SmallVector<unsigned, 64> Vals;
-
-  // Code: [strchar x N]
-  for (unsigned i = 0, e = Str.size(); i != e; ++i) {
-    if (AbbrevToUse && !BitCodeAbbrevOp::isChar6(Str[i]))
-      AbbrevToUse = 0;
-    Vals.push_back(Str[i]);
-  }
-
-  // Emit the finished record.
-  Stream.EmitRecord(Code, Vals, AbbrevToUse);
-}
-
 // Emit information about parameter attributes.
 static void WriteAttributeTable(const llvm_2_9_func::ValueEnumerator &VE,
                                 BitstreamWriter &Stream) {
@@ -341,37 +250,6 @@ static void WriteTypeTable(const llvm_2_9_func::ValueEnumerator &VE,
   Stream.ExitBlock();
 }
 
-static unsigned getEncodedLinkage(const GlobalValue *GV) {
-  switch (GV->getLinkage()) {
-  case GlobalValue::ExternalLinkage:                 return 0;
-  case GlobalValue::WeakAnyLinkage:                  return 1;
-  case GlobalValue::AppendingLinkage:                return 2;
-  case GlobalValue::InternalLinkage:                 return 3;
-  case GlobalValue::LinkOnceAnyLinkage:              return 4;
-  case GlobalValue::DLLImportLinkage:                return 5;
-  case GlobalValue::DLLExportLinkage:                return 6;
-  case GlobalValue::ExternalWeakLinkage:             return 7;
-  case GlobalValue::CommonLinkage:                   return 8;
-  case GlobalValue::PrivateLinkage:                  return 9;
-  case GlobalValue::WeakODRLinkage:                  return 10;
-  case GlobalValue::LinkOnceODRLinkage:              return 11;
-  case GlobalValue::AvailableExternallyLinkage:      return 12;
-  case GlobalValue::LinkerPrivateLinkage:            return 13;
-  case GlobalValue::LinkerPrivateWeakLinkage:        return 14;
-  case GlobalValue::LinkOnceODRAutoHideLinkage:      return 15;
-  }
-  llvm_unreachable("Invalid linkage");
-}
-
-static unsigned getEncodedVisibility(const GlobalValue *GV) {
-  switch (GV->getVisibility()) {
-  default: llvm_unreachable("Invalid visibility!");
-  case GlobalValue::DefaultVisibility:   return 0;
-  case GlobalValue::HiddenVisibility:    return 1;
-  case GlobalValue::ProtectedVisibility: return 2;
-  }
-}
-
 // Emit top-level description of module, including target triple, inline asm,
 // descriptors for global variables, and function prototype info.
 static void WriteModuleInfo(const Module *M,
@@ -558,7 +436,8 @@ static void WriteMDNode(const MDNode *N,
 
 static void WriteModuleMetadata(const Module *M,
                                 const llvm_2_9_func::ValueEnumerator &VE,
-                                BitstreamWriter &Stream) {
+                                BitstreamWriter &Stream,
+                                SizeReport *Report) {
   const llvm_2_9_func::ValueEnumerator::ValueList &Vals = VE.getMDValues();
   bool StartedMetadataBlock = false;
   unsigned MDSAbbrev = 0;
@@ -571,6 +450,7 @@ static void WriteModuleMetadata(const Module *M,
           Stream.EnterSubblock(bitc::METADATA_BLOCK_ID, 3);
           StartedMetadataBlock = true;
         }
+        SizeReport::Region Size(Report, N, Stream);
         WriteMDNode(N, VE, Stream, Record);
       }
     } else if (const MDString *MDS = dyn_cast<MDString>(Vals[i].first)) {
@@ -586,6 +466,8 @@ static void WriteModuleMetadata(const Module *M,
         StartedMetadataBlock = true;
       }
 
+      SizeReport::Region Size(Report, MDS, Stream);
+
       // Code: [strchar x N]
       Record.append(MDS->begin(), MDS->end());
 
@@ -604,6 +486,8 @@ static void WriteModuleMetadata(const Module *M,
       StartedMetadataBlock = true;
     }
 
+    SizeReport::Region Size(Report, NMD, Stream);
+
     // Write name.
     StringRef Str = NMD->getName();
     for (unsigned i = 0, e = Str.size(); i != e; ++i)
@@ -1595,7 +1479,8 @@ static void WriteBlockInfo(const llvm_2_9_func::ValueEnumerator &VE,
 
 
 /// WriteModule - Emit the specified module to the bitstream.
-static void WriteModule(const Module *M, BitstreamWriter &Stream) {
+static void WriteModule(const Module *M, BitstreamWriter &Stream,
+                        SizeReport *Report) {
   Stream.EnterSubblock(bitc::MODULE_BLOCK_ID, 3);
 
   // Emit the version number if it is non-zero.
@@ -1606,37 +1491,64 @@ static void WriteModule(const Module *M, BitstreamWriter &Stream) {
   }
 
   // Analyze the module, enumerating globals, functions, etc.
-  llvm_2_9_func::ValueEnumerator VE(M);
+  llvm_2_9_func::ValueEnumerator VE(M,
+                                   /* ExpandDataSequentials = */true);
 
   // Emit blockinfo, which defines the standard abbreviations etc.
-  WriteBlockInfo(VE, Stream);
+  {
+    SizeReport::Region Size(Report, SizeReport::BlockInfo, Stream);
+    WriteBlockInfo(VE, Stream);
+  }
 
   // Emit information about parameter attributes.
-  WriteAttributeTable(VE, Stream);
+  {
+    SizeReport::Region Size(Report, SizeReport::Attributes, Stream);
+    WriteAttributeTable(VE, Stream);
+  }
 
   // Emit information describing all of the types in the module.
-  WriteTypeTable(VE, Stream);
+  {
+    SizeReport::Region Size(Report, SizeReport::Types, Stream);
+    WriteTypeTable(VE, Stream);
+  }
 
   // Emit top-level description of module, including target triple, inline asm,
   // descriptors for global variables, and function prototype info.
-  WriteModuleInfo(M, VE, Stream);
+  {
+    SizeReport::Region Size(Report, SizeReport::Globals, Stream);
+    WriteModuleInfo(M, VE, Stream);
+  }
 
   // Emit constants.
-  WriteModuleConstants(VE, Stream);
+  {
+    SizeReport::Region Size(Report, SizeReport::Constants, Stream);
+    WriteModuleConstants(VE, Stream);
+  }
 
   // Emit metadata.
-  WriteModuleMetadata(M, VE, Stream);
+  {
+    SizeReport::Region Size(Report, SizeReport::Metadata, Stream);
+    WriteModuleMetadata(M, VE, Stream, Report);
+  }
 
   // Emit function bodies.
   for (Module::const_iterator F = M->begin(), E = M->end(); F != E; ++F)
-    if (!F->isDeclaration())
+    if (!F->isDeclaration()) {
+      SizeReport::Region Size(Report, *F, Stream);
       WriteFunction(*F, VE, Stream);
+    }
 
   // Emit metadata.
-  WriteModuleMetadataStore(M, Stream);
+  {
+    SizeReport::Region Size(Report, SizeReport::MetadataKinds, Stream);
+    WriteModuleMetadataStore(M, Stream);
+  }
 
   // Emit names for globals/functions etc.
-  WriteValueSymbolTable(M->getValueSymbolTable(), VE, Stream);
+  {
+    SizeReport::Region Size(Report, SizeReport::SymbolTable, Stream);
+    WriteValueSymbolTable(M->getValueSymbolTable(), VE, Stream);
+  }
 
   Stream.ExitBlock();
 }
@@ -1716,7 +1628,8 @@ static void EmitDarwinBCHeaderAndTrailer(SmallVectorImpl<char> &Buffer,
 
 /// WriteBitcodeToFile - Write the specified module to the specified output
 /// stream.
-void llvm_2_9_func::WriteBitcodeToFile(const Module *M, raw_ostream &Out) {
+void llvm_2_9_func::WriteBitcodeToFile(const Module *M, raw_ostream &Out,
+                                       SizeReport *Report) {
   SmallVector<char, 1024> Buffer;
   Buffer.reserve(256*1024);
 
@@ -1739,12 +1652,17 @@ void llvm_2_9_func::WriteBitcodeToFile(const Module *M, raw_ostream &Out) {
     Stream.Emit(0xD, 4);
 
     // Emit the module.
-    WriteModule(M, Stream);
+    if (Report)
+      Report->classifyMetadata(M);
+    WriteModule(M, Stream, Report);
   }
 
   if (TT.isOSDarwin())
     EmitDarwinBCHeaderAndTrailer(Buffer, TT);
 
+  if (Report)
+    Report->setTotalBytes(Buffer.size());
+
   // Write the generated bitstream to "Out".
   Out.write((char*)&Buffer.front(), Buffer.size());
 }
@@ -13,6 +13,8 @@
 
 #include "ReaderWriter_3_2.h"
 #include "legacy_bitcode.h"
+#include "BitWriter_common/BitcodeEncoding.h"
+#include "BitWriter_common/BitcodeSizeReport.h"
 #include "ValueEnumerator.h"
 #include "llvm/ADT/Triple.h"
 #include "llvm/Bitcode/BitstreamWriter.h"
@@ -33,6 +35,8 @@
 #include <map>
 using namespace llvm;
 
+typedef llvm_legacy::BitcodeSizeReport SizeReport;
+
 static bool EnablePreserveUseListOrdering = false;
 
 /// These are manifest constants used by the bitcode writer. They do not need to
@@ -65,101 +69,6 @@ enum {
   SWITCH_INST_MAGIC = 0x4B5 // May 2012 => 1205 => Hex
 };
 
-static unsigned GetEncodedCastOpcode(unsigned Opcode) {
-  switch (Opcode) {
-  default: llvm_unreachable("Unknown cast instruction!");
-  case Instruction::Trunc   : return bitc::CAST_TRUNC;
-  case Instruction::ZExt    : return bitc::CAST_ZEXT;
-  case Instruction::SExt    : return bitc::CAST_SEXT;
-  case Instruction::FPToUI  : return bitc::CAST_FPTOUI;
-  case Instruction::FPToSI  : return bitc::CAST_FPTOSI;
-  case Instruction::UIToFP  : return bitc::CAST_UITOFP;
-  case Instruction::SIToFP  : return bitc::CAST_SITOFP;
-  case Instruction::FPTrunc : return bitc::CAST_FPTRUNC;
-  case Instruction::FPExt   : return bitc::CAST_FPEXT;
-  case Instruction::PtrToInt: return bitc::CAST_PTRTOINT;
-  case Instruction::IntToPtr: return bitc::CAST_INTTOPTR;
-  case Instruction::BitCast : return bitc::CAST_BITCAST;
-  }
-}
-
-static unsigned GetEncodedBinaryOpcode(unsigned Opcode) {
-  switch (Opcode) {
-  default: llvm_unreachable("Unknown binary instruction!");
-  case Instruction::Add:
-  case Instruction::FAdd: return bitc::BINOP_ADD;
-  case Instruction::Sub:
-  case Instruction::FSub: return bitc::BINOP_SUB;
-  case Instruction::Mul:
-  case Instruction::FMul: return bitc::BINOP_MUL;
-  case Instruction::UDiv: return bitc::BINOP_UDIV;
-  case Instruction::FDiv:
-  case Instruction::SDiv: return bitc::BINOP_SDIV;
-  case Instruction::URem: return bitc::BINOP_UREM;
-  case Instruction::FRem:
-  case Instruction::SRem: return bitc::BINOP_SREM;
-  case Instruction::Shl:  return bitc::BINOP_SHL;
-  case Instruction::LShr: return bitc::BINOP_LSHR;
-  case Instruction::AShr: return bitc::BINOP_ASHR;
-  case Instruction::And:  return bitc::BINOP_AND;
-  case Instruction::Or:   return bitc::BINOP_OR;
-  case Instruction::Xor:  return bitc::BINOP_XOR;
-  }
-}
-
-static unsigned GetEncodedRMWOperation(AtomicRMWInst::BinOp Op) {
-  switch (Op) {
-  default: llvm_unreachable("Unknown RMW operation!");
-  case AtomicRMWInst::Xchg: return bitc::RMW_XCHG;
-  case AtomicRMWInst::Add: return bitc::RMW_ADD;
-  case AtomicRMWInst::Sub: return bitc::RMW_SUB;
-  case AtomicRMWInst::And: return bitc::RMW_AND;
-  case AtomicRMWInst::Nand: return bitc::RMW_NAND;
-  case AtomicRMWInst::Or: return bitc::RMW_OR;
-  case AtomicRMWInst::Xor: return bitc::RMW_XOR;
-  case AtomicRMWInst::Max: return bitc::RMW_MAX;
-  case AtomicRMWInst::Min: return bitc::RMW_MIN;
-  case AtomicRMWInst::UMax: return bitc::RMW_UMAX;
-  case AtomicRMWInst::UMin: return bitc::RMW_UMIN;
-  }
-}
-
-static unsigned GetEncodedOrdering(AtomicOrdering Ordering) {
-  switch (Ordering) {
-  case NotAtomic: return bitc::ORDERING_NOTATOMIC;
-  case Unordered: return bitc::ORDERING_UNORDERED;
-  case Monotonic: return bitc::ORDERING_MONOTONIC;
-  case Acquire: return bitc::ORDERING_ACQUIRE;
-  case Release: return bitc::ORDERING_RELEASE;
-  case AcquireRelease: return bitc::ORDERING_ACQREL;
-  case SequentiallyConsistent: return bitc::ORDERING_SEQCST;
-  }
-  llvm_unreachable("Invalid ordering");
-}
-
-static unsigned GetEncodedSynchScope(SynchronizationScope SynchScope) {
-  switch (SynchScope) {
-  case SingleThread: return bitc::SYNCHSCOPE_SINGLETHREAD;
-  case CrossThread: return bitc::SYNCHSCOPE_CROSSTHREAD;
-  }
-  llvm_unreachable("Invalid synch scope");
-}
-
-static void WriteStringRecord(unsigned Code, StringRef Str,
-                              unsigned AbbrevToUse, BitstreamWriter &Stream) {
-  SmallVector<unsigned, 64> Vals;
-
-  // Code: [strchar x N]
-  for (unsigned i = 0, e = Str.size(); i != e; ++i) {
-    if (AbbrevToUse && !BitCodeAbbrevOp::isChar6(Str[i]))
-      AbbrevToUse = 0;
-    Vals.push_back(Str[i]);
-  }
-
-  // Emit the finished record.
-  Stream.EmitRecord(Code, Vals, AbbrevToUse);
-}
-
 // Emit information about parameter attributes.
 static void WriteAttributeTable(const llvm_3_2::ValueEnumerator &VE,
                                 BitstreamWriter &Stream) {
@@ -346,37 +255,6 @@ static void WriteTypeTable(const llvm_3_2::ValueEnumerator &VE,
   Stream.ExitBlock();
 }
 
-static unsigned getEncodedLinkage(const GlobalValue *GV) {
-  switch (GV->getLinkage()) {
-  case GlobalValue::ExternalLinkage:                 return 0;
-  case GlobalValue::WeakAnyLinkage:                  return 1;
-  case GlobalValue::AppendingLinkage:                return 2;
-  case GlobalValue::InternalLinkage:                 return 3;
-  case GlobalValue::LinkOnceAnyLinkage:              return 4;
-  case GlobalValue::DLLImportLinkage:                return 5;
-  case GlobalValue::DLLExportLinkage:                return 6;
-  case GlobalValue::ExternalWeakLinkage:             return 7;
-  case GlobalValue::CommonLinkage:                   return 8;
-  case GlobalValue::PrivateLinkage:                  return 9;
-  case GlobalValue::WeakODRLinkage:                  return 10;
-  case GlobalValue::LinkOnceODRLinkage:              return 11;
-  case GlobalValue::AvailableExternallyLinkage:      return 12;
-  case GlobalValue::LinkerPrivateLinkage:            return 13;
-  case GlobalValue::LinkerPrivateWeakLinkage:        return 14;
-  case GlobalValue::LinkOnceODRAutoHideLinkage:      return 15;
-  }
-  llvm_unreachable("Invalid linkage");
-}
-
-static unsigned getEncodedVisibility(const GlobalValue *GV) {
-  switch (GV->getVisibility()) {
-  case GlobalValue::DefaultVisibility:   return 0;
-  case GlobalValue::HiddenVisibility:    return 1;
-  case GlobalValue::ProtectedVisibility: return 2;
-  }
-  llvm_unreachable("Invalid visibility");
-}
-
 static unsigned getEncodedThreadLocalMode(const GlobalVariable *GV) {
   switch (GV->getThreadLocalMode()) {
     case GlobalVariable::NotThreadLocal:         return 0;
@@ -574,7 +452,8 @@ static uint64_t GetOptimizationFlags(const Value *V) {
 static void WriteMDNode(const MDNode *N,
                         const llvm_3_2::ValueEnumerator &VE,
                         BitstreamWriter &Stream,
-                        SmallVector<uint64_t, 64> &Record) {
+                        SmallVector<uint64_t, 64> &Record,
+                        unsigned AbbrevToUse = 0) {
   for (unsigned i = 0, e = N->getNumOperands(); i != e; ++i) {
     if (N->getOperand(i)) {
       Record.push_back(VE.getTypeID(N->getOperand(i)->getType()));
@@ -586,45 +465,98 @@ static void WriteMDNode(const MDNode *N,
   }
   unsigned MDCode = N->isFunctionLocal() ? bitc::METADATA_FN_NODE :
                                            bitc::METADATA_NODE;
-  Stream.EmitRecord(MDCode, Record, 0);
+  Stream.EmitRecord(MDCode, Record, AbbrevToUse);
   Record.clear();
 }
 
+namespace {
+/// The abbreviations of the module-level METADATA_BLOCK. The reflection
+/// metadata of RenderScript (#rs_export_* etc.) is a large number of small
+/// nodes of MDStrings, most of which are identifiers and numbers, so these
+/// are tuned for that.
+struct ModuleMetadataAbbrevs {
+  unsigned String8;
+  unsigned String6;
+  unsigned Name;
+  unsigned Node;
+};
+} // end anonymous namespace
+
+static void EnterModuleMetadataBlock(BitstreamWriter &Stream,
+                                     ModuleMetadataAbbrevs &Abbrevs) {
+  Stream.EnterSubblock(bitc::METADATA_BLOCK_ID, 3);
+
+  // Abbrev for METADATA_STRING.
+  BitCodeAbbrev *Abbv = new BitCodeAbbrev();
+  Abbv->Add(BitCodeAbbrevOp(bitc::METADATA_STRING));
+  Abbv->Add(BitCodeAbbrevOp(BitCodeAbbrevOp::Array));
+  Abbv->Add(BitCodeAbbrevOp(BitCodeAbbrevOp::Fixed, 8));
+  Abbrevs.String8 = Stream.EmitAbbrev(Abbv);
+
+  // Abbrev for METADATA_STRING of char6 characters only.
+  Abbv = new BitCodeAbbrev();
+  Abbv->Add(BitCodeAbbrevOp(bitc::METADATA_STRING));
+  Abbv->Add(BitCodeAbbrevOp(BitCodeAbbrevOp::Array));
+  Abbv->Add(BitCodeAbbrevOp(BitCodeAbbrevOp::Char6));
+  Abbrevs.String6 = Stream.EmitAbbrev(Abbv);
+
+  // Abbrev for METADATA_NAME.
+  Abbv = new BitCodeAbbrev();
+  Abbv->Add(BitCodeAbbrevOp(bitc::METADATA_NAME));
+  Abbv->Add(BitCodeAbbrevOp(BitCodeAbbrevOp::Array));
+  Abbv->Add(BitCodeAbbrevOp(BitCodeAbbrevOp::Fixed, 8));
+  Abbrevs.Name = Stream.EmitAbbrev(Abbv);
+
+  // Abbrev for METADATA_NODE. The type and value IDs are mostly small, since
+  // the nodes mostly refer to metadata.
+  Abbv = new BitCodeAbbrev();
+  Abbv->Add(BitCodeAbbrevOp(bitc::METADATA_NODE));
+  Abbv->Add(BitCodeAbbrevOp(BitCodeAbbrevOp::Array));
+  Abbv->Add(BitCodeAbbrevOp(BitCodeAbbrevOp::VBR, 6));
+  Abbrevs.Node = Stream.EmitAbbrev(Abbv);
+}
+
 static void WriteModuleMetadata(const Module *M,
                                 const llvm_3_2::ValueEnumerator &VE,
-                                BitstreamWriter &Stream) {
+                                BitstreamWriter &Stream,
+                                SizeReport *Report) {
   const llvm_3_2::ValueEnumerator::ValueList &Vals = VE.getMDValues();
   bool StartedMetadataBlock = false;
-  unsigned MDSAbbrev = 0;
+  ModuleMetadataAbbrevs Abbrevs;
   SmallVector<uint64_t, 64> Record;
   for (unsigned i = 0, e = Vals.size(); i != e; ++i) {
 
     if (const MDNode *N = dyn_cast<MDNode>(Vals[i].first)) {
       if (!N->isFunctionLocal() || !N->getFunction()) {
         if (!StartedMetadataBlock) {
-          Stream.EnterSubblock(bitc::METADATA_BLOCK_ID, 3);
+          EnterModuleMetadataBlock(Stream, Abbrevs);
           StartedMetadataBlock = true;
         }
-        WriteMDNode(N, VE, Stream, Record);
+        SizeReport::Region Size(Report, N, Stream);
+        // The abbreviation is of METADATA_NODE, a function-local node without
+        // a function is written unabbreviated as METADATA_FN_NODE.
+        WriteMDNode(N, VE, Stream, Record,
+                    N->isFunctionLocal() ? 0 : Abbrevs.Node);
       }
     } else if (const MDString *MDS = dyn_cast<MDString>(Vals[i].first)) {
       if (!StartedMetadataBlock)  {
-        Stream.EnterSubblock(bitc::METADATA_BLOCK_ID, 3);
-
-        // Abbrev for METADATA_STRING.
-        BitCodeAbbrev *Abbv = new BitCodeAbbrev();
-        Abbv->Add(BitCodeAbbrevOp(bitc::METADATA_STRING));
-        Abbv->Add(BitCodeAbbrevOp(BitCodeAbbrevOp::Array));
-        Abbv->Add(BitCodeAbbrevOp(BitCodeAbbrevOp::Fixed, 8));
-        MDSAbbrev = Stream.EmitAbbrev(Abbv);
+        EnterModuleMetadataBlock(Stream, Abbrevs);
         StartedMetadataBlock = true;
       }
 
+      SizeReport::Region Size(Report, MDS, Stream);
+
       // Code: [strchar x N]
-      Record.append(MDS->begin(), MDS->end());
+      bool isChar6 = true;
+      for (MDString::iterator I = MDS->begin(), E = MDS->end(); I != E; ++I) {
+        Record.push_back(static_cast<unsigned char>(*I));
+        if (isChar6)
+          isChar6 = BitCodeAbbrevOp::isChar6(*I);
+      }
 
       // Emit the finished record.
-      Stream.EmitRecord(bitc::METADATA_STRING, Record, MDSAbbrev);
+      Stream.EmitRecord(bitc::METADATA_STRING, Record,
+                        isChar6 ? Abbrevs.String6 : Abbrevs.String8);
       Record.clear();
     }
   }
@@ -634,15 +566,17 @@ static void WriteModuleMetadata(const Module *M,
        E = M->named_metadata_end(); I != E; ++I) {
     const NamedMDNode *NMD = I;
     if (!StartedMetadataBlock)  {
-      Stream.EnterSubblock(bitc::METADATA_BLOCK_ID, 3);
+      EnterModuleMetadataBlock(Stream, Abbrevs);
       StartedMetadataBlock = true;
     }
 
+    SizeReport::Region Size(Report, NMD, Stream);
+
     // Write name.
     StringRef Str = NMD->getName();
     for (unsigned i = 0, e = Str.size(); i != e; ++i)
-      Record.push_back(Str[i]);
-    Stream.EmitRecord(bitc::METADATA_NAME, Record, 0/*TODO*/);
+      Record.push_back(static_cast<unsigned char>(Str[i]));
+    Stream.EmitRecord(bitc::METADATA_NAME, Record, Abbrevs.Name);
     Record.clear();
 
     // Write named metadata operands.
@@ -768,6 +702,28 @@ static void EmitAPInt(SmallVectorImpl<uint64_t> &Vals,
   }
 }
 
+/// Returns the number of bits V takes as an unabbreviated (VBR6) operand.
+static unsigned GetVBR6Size(uint64_t V) {
+  unsigned Bits = 6;
+  while (V >>= 5)
+    Bits += 6;
+  return Bits;
+}
+
+/// Returns the abbreviation for CST_CODE_DATA records of Width bit elements,
+/// emitting it to the current block first if it's not there yet.
+static unsigned GetDataAbbrev(BitstreamWriter &Stream, unsigned Width,
+                              unsigned &DataAbbrev) {
+  if (DataAbbrev == 0) {
+    BitCodeAbbrev *Abbv = new BitCodeAbbrev();
+    Abbv->Add(BitCodeAbbrevOp(bitc::CST_CODE_DATA));
+    Abbv->Add(BitCodeAbbrevOp(BitCodeAbbrevOp::Array));
+    Abbv->Add(BitCodeAbbrevOp(BitCodeAbbrevOp::Fixed, Width));
+    DataAbbrev = Stream.EmitAbbrev(Abbv);
+  }
+  return DataAbbrev;
+}
+
 static void WriteConstants(unsigned FirstVal, unsigned LastVal,
                            const llvm_3_2::ValueEnumerator &VE,
                            BitstreamWriter &Stream, bool isGlobal) {
@@ -779,6 +735,9 @@ static void WriteConstants(unsigned FirstVal, unsigned LastVal,
   unsigned String8Abbrev = 0;
   unsigned CString7Abbrev = 0;
   unsigned CString6Abbrev = 0;
+  // The abbrevs for CST_CODE_DATA of 8, 16 and 32 bit elements, emitted on
+  // first use, since most modules don't have large data arrays.
+  unsigned DataAbbrevs[3] = { 0, 0, 0 };
   // If this is a constant pool for the module, emit module-specific abbrevs.
   if (isGlobal) {
     // Abbrev for CST_CODE_AGGREGATE.
@@ -920,6 +879,19 @@ static void WriteConstants(unsigned FirstVal, unsigned LastVal,
           Record.push_back(I);
         }
       }
+
+      // Fixed-width elements are denser than VBR6 for all but arrays of
+      // small numbers (the reader can't handle fixed fields wider than 32
+      // bits, so 64-bit elements always stay VBR).
+      unsigned Width = EltTy->getPrimitiveSizeInBits();
+      if (isGlobal && (Width == 8 || Width == 16 || Width == 32)) {
+        uint64_t VBRBits = 0;
+        for (unsigned i = 0, e = Record.size(); i != e; ++i)
+          VBRBits += GetVBR6Size(Record[i]);
+        if (VBRBits > uint64_t(Record.size()) * Width)
+          AbbrevToUse = GetDataAbbrev(Stream, Width,
+                                      DataAbbrevs[Log2_32(Width) - 3]);
+      }
     } else if (isa<ConstantArray>(C) || isa<ConstantStruct>(C) ||
                isa<ConstantVector>(C)) {
       Code = bitc::CST_CODE_AGGREGATE;
@@ -1750,7 +1722,8 @@ static void WriteModuleUseLists(const Module *M, llvm_3_2::ValueEnumerator &VE,
 }
 
 /// WriteModule - Emit the specified module to the bitstream.
-static void WriteModule(const Module *M, BitstreamWriter &Stream) {
+static void WriteModule(const Module *M, BitstreamWriter &Stream,
+                        SizeReport *Report) {
   Stream.EnterSubblock(bitc::MODULE_BLOCK_ID, 3);
 
   // Emit the version number if it is non-zero.
@@ -1761,41 +1734,69 @@ static void WriteModule(const Module *M, BitstreamWriter &Stream) {
   }
 
   // Analyze the module, enumerating globals, functions, etc.
-  llvm_3_2::ValueEnumerator VE(M);
+  llvm_3_2::ValueEnumerator VE(M, /* ExpandDataSequentials = */false);
 
   // Emit blockinfo, which defines the standard abbreviations etc.
-  WriteBlockInfo(VE, Stream);
+  {
+    SizeReport::Region Size(Report, SizeReport::BlockInfo, Stream);
+    WriteBlockInfo(VE, Stream);
+  }
 
   // Emit information about parameter attributes.
-  WriteAttributeTable(VE, Stream);
+  {
+    SizeReport::Region Size(Report, SizeReport::Attributes, Stream);
+    WriteAttributeTable(VE, Stream);
+  }
 
   // Emit information describing all of the types in the module.
-  WriteTypeTable(VE, Stream);
+  {
+    SizeReport::Region Size(Report, SizeReport::Types, Stream);
+    WriteTypeTable(VE, Stream);
+  }
 
   // Emit top-level description of module, including target triple, inline asm,
   // descriptors for global variables, and function prototype info.
-  WriteModuleInfo(M, VE, Stream);
+  {
+    SizeReport::Region Size(Report, SizeReport::Globals, Stream);
+    WriteModuleInfo(M, VE, Stream);
+  }
 
   // Emit constants.
-  WriteModuleConstants(VE, Stream);
+  {
+    SizeReport::Region Size(Report, SizeReport::Constants, Stream);
+    WriteModuleConstants(VE, Stream);
+  }
 
   // Emit metadata.
-  WriteModuleMetadata(M, VE, Stream);
+  {
+    SizeReport::Region Size(Report, SizeReport::Metadata, Stream);
+    WriteModuleMetadata(M, VE, Stream, Report);
+  }
 
   // Emit metadata.
-  WriteModuleMetadataStore(M, Stream);
+  {
+    SizeReport::Region Size(Report, SizeReport::MetadataKinds, Stream);
+    WriteModuleMetadataStore(M, Stream);
+  }
 
   // Emit names for globals/functions etc.
-  WriteValueSymbolTable(M->getValueSymbolTable(), VE, Stream);
+  {
+    SizeReport::Region Size(Report, SizeReport::SymbolTable, Stream);
+    WriteValueSymbolTable(M->getValueSymbolTable(), VE, Stream);
+  }
 
   // Emit use-lists.
-  if (EnablePreserveUseListOrdering)
+  if (EnablePreserveUseListOrdering) {
+    SizeReport::Region Size(Report, SizeReport::UseLists, Stream);
     WriteModuleUseLists(M, VE, Stream);
+  }
 
   // Emit function bodies.
   for (Module::const_iterator F = M->begin(), E = M->end(); F != E; ++F)
-    if (!F->isDeclaration())
+    if (!F->isDeclaration()) {
+      SizeReport::Region Size(Report, *F, Stream);
       WriteFunction(*F, VE, Stream);
+    }
 
   Stream.ExitBlock();
 }
@@ -1875,7 +1876,8 @@ static void EmitDarwinBCHeaderAndTrailer(SmallVectorImpl<char> &Buffer,
 
 /// WriteBitcodeToFile - Write the specified module to the specified output
 /// stream.
-void llvm_3_2::WriteBitcodeToFile(const Module *M, raw_ostream &Out) {
+void llvm_3_2::WriteBitcodeToFile(const Module *M, raw_ostream &Out,
+                                  SizeReport *Report) {
   SmallVector<char, 1024> Buffer;
   Buffer.reserve(256*1024);
 
@@ -1898,12 +1900,17 @@ void llvm_3_2::WriteBitcodeToFile(const Module *M, raw_ostream &Out) {
     Stream.Emit(0xD, 4);
 
     // Emit the module.
-    WriteModule(M, Stream);
+    if (Report)
+      Report->classifyMetadata(M);
+    WriteModule(M, Stream, Report);
   }
 
   if (TT.isOSDarwin())
     EmitDarwinBCHeaderAndTrailer(Buffer, TT);
 
+  if (Report)
+    Report->setTotalBytes(Buffer.size());
+
   // Write the generated bitstream to "Out".
   Out.write((char*)&Buffer.front(), Buffer.size());
 }
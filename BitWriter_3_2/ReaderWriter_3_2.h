@@ -25,6 +25,10 @@ namespace llvm {
   class raw_ostream;
 }  // End llvm namespace
 
+namespace llvm_legacy {
+  class BitcodeSizeReport;
+}
+
 namespace llvm_3_2 {
   /// getLazyBitcodeModule - Read the header of the specified bitcode buffer
   /// and prepare for lazy deserialization of function bodies.  If successful,
@@ -52,12 +56,16 @@ namespace llvm_3_2 {
 
   /// WriteBitcodeToFile - Write the specified module to the specified
   /// raw output stream.  For streams where it matters, the given stream
-  /// should be in "binary" mode.
-  void WriteBitcodeToFile(const llvm::Module *M, llvm::raw_ostream &Out);
+  /// should be in "binary" mode.  If Report is non-null, the size of each
+  /// part of the bitcode is added to it.
+  void WriteBitcodeToFile(const llvm::Module *M, llvm::raw_ostream &Out,
+                          llvm_legacy::BitcodeSizeReport *Report = 0);
 
   /// createBitcodeWriterPass - Create and return a pass that writes the module
-  /// to the specified ostream.
-  llvm::ModulePass *createBitcodeWriterPass(llvm::raw_ostream &Str);
+  /// to the specified ostream (and its sizes to Report, if non-null).
+  llvm::ModulePass *
+  createBitcodeWriterPass(llvm::raw_ostream &Str,
+                          llvm_legacy::BitcodeSizeReport *Report = 0);
 
 
   /// isBitcodeWrapper - Return true if the given bytes are the magic bytes
@@ -0,0 +1,155 @@
+//===-- BitcodeEncoding.h - Version-independent record encodings -*- C++ -*-=//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// The encodings of opcodes, linkages and other enumerations which are the same
+// in all the bitcode versions written by slang, shared by the writers of
+// BitWriter_2_9, BitWriter_2_9_func and BitWriter_3_2.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef BITWRITER_COMMON_BITCODE_ENCODING_H
+#define BITWRITER_COMMON_BITCODE_ENCODING_H
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Bitcode/BitstreamWriter.h"
+#include "llvm/Bitcode/LLVMBitCodes.h"
+#include "llvm/IR/GlobalValue.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Support/ErrorHandling.h"
+
+static inline unsigned GetEncodedCastOpcode(unsigned Opcode) {
+  switch (Opcode) {
+  default: llvm_unreachable("Unknown cast instruction!");
+  case llvm::Instruction::Trunc   : return llvm::bitc::CAST_TRUNC;
+  case llvm::Instruction::ZExt    : return llvm::bitc::CAST_ZEXT;
+  case llvm::Instruction::SExt    : return llvm::bitc::CAST_SEXT;
+  case llvm::Instruction::FPToUI  : return llvm::bitc::CAST_FPTOUI;
+  case llvm::Instruction::FPToSI  : return llvm::bitc::CAST_FPTOSI;
+  case llvm::Instruction::UIToFP  : return llvm::bitc::CAST_UITOFP;
+  case llvm::Instruction::SIToFP  : return llvm::bitc::CAST_SITOFP;
+  case llvm::Instruction::FPTrunc : return llvm::bitc::CAST_FPTRUNC;
+  case llvm::Instruction::FPExt   : return llvm::bitc::CAST_FPEXT;
+  case llvm::Instruction::PtrToInt: return llvm::bitc::CAST_PTRTOINT;
+  case llvm::Instruction::IntToPtr: return llvm::bitc::CAST_INTTOPTR;
+  case llvm::Instruction::BitCast : return llvm::bitc::CAST_BITCAST;
+  }
+}
+
+static inline unsigned GetEncodedBinaryOpcode(unsigned Opcode) {
+  switch (Opcode) {
+  default: llvm_unreachable("Unknown binary instruction!");
+  case llvm::Instruction::Add:
+  case llvm::Instruction::FAdd: return llvm::bitc::BINOP_ADD;
+  case llvm::Instruction::Sub:
+  case llvm::Instruction::FSub: return llvm::bitc::BINOP_SUB;
+  case llvm::Instruction::Mul:
+  case llvm::Instruction::FMul: return llvm::bitc::BINOP_MUL;
+  case llvm::Instruction::UDiv: return llvm::bitc::BINOP_UDIV;
+  case llvm::Instruction::FDiv:
+  case llvm::Instruction::SDiv: return llvm::bitc::BINOP_SDIV;
+  case llvm::Instruction::URem: return llvm::bitc::BINOP_UREM;
+  case llvm::Instruction::FRem:
+  case llvm::Instruction::SRem: return llvm::bitc::BINOP_SREM;
+  case llvm::Instruction::Shl:  return llvm::bitc::BINOP_SHL;
+  case llvm::Instruction::LShr: return llvm::bitc::BINOP_LSHR;
+  case llvm::Instruction::AShr: return llvm::bitc::BINOP_ASHR;
+  case llvm::Instruction::And:  return llvm::bitc::BINOP_AND;
+  case llvm::Instruction::Or:   return llvm::bitc::BINOP_OR;
+  case llvm::Instruction::Xor:  return llvm::bitc::BINOP_XOR;
+  }
+}
+
+static inline unsigned GetEncodedRMWOperation(llvm::AtomicRMWInst::BinOp Op) {
+  switch (Op) {
+  default: llvm_unreachable("Unknown RMW operation!");
+  case llvm::AtomicRMWInst::Xchg: return llvm::bitc::RMW_XCHG;
+  case llvm::AtomicRMWInst::Add: return llvm::bitc::RMW_ADD;
+  case llvm::AtomicRMWInst::Sub: return llvm::bitc::RMW_SUB;
+  case llvm::AtomicRMWInst::And: return llvm::bitc::RMW_AND;
+  case llvm::AtomicRMWInst::Nand: return llvm::bitc::RMW_NAND;
+  case llvm::AtomicRMWInst::Or: return llvm::bitc::RMW_OR;
+  case llvm::AtomicRMWInst::Xor: return llvm::bitc::RMW_XOR;
+  case llvm::AtomicRMWInst::Max: return llvm::bitc::RMW_MAX;
+  case llvm::AtomicRMWInst::Min: return llvm::bitc::RMW_MIN;
+  case llvm::AtomicRMWInst::UMax: return llvm::bitc::RMW_UMAX;
+  case llvm::AtomicRMWInst::UMin: return llvm::bitc::RMW_UMIN;
+  }
+}
+
+static inline unsigned GetEncodedOrdering(llvm::AtomicOrdering Ordering) {
+  switch (Ordering) {
+  case llvm::NotAtomic: return llvm::bitc::ORDERING_NOTATOMIC;
+  case llvm::Unordered: return llvm::bitc::ORDERING_UNORDERED;
+  case llvm::Monotonic: return llvm::bitc::ORDERING_MONOTONIC;
+  case llvm::Acquire: return llvm::bitc::ORDERING_ACQUIRE;
+  case llvm::Release: return llvm::bitc::ORDERING_RELEASE;
+  case llvm::AcquireRelease: return llvm::bitc::ORDERING_ACQREL;
+  case llvm::SequentiallyConsistent: return llvm::bitc::ORDERING_SEQCST;
+  }
+  llvm_unreachable("Invalid ordering");
+}
+
+static inline unsigned
+GetEncodedSynchScope(llvm::SynchronizationScope SynchScope) {
+  switch (SynchScope) {
+  case llvm::SingleThread: return llvm::bitc::SYNCHSCOPE_SINGLETHREAD;
+  case llvm::CrossThread: return llvm::bitc::SYNCHSCOPE_CROSSTHREAD;
+  }
+  llvm_unreachable("Invalid synch scope");
+}
+
+static inline void WriteStringRecord(unsigned Code, llvm::StringRef Str,
+                                     unsigned AbbrevToUse,
+                                     llvm::BitstreamWriter &Stream) {
+  llvm::SmallVector<unsigned, 64> Vals;
+
+  // Code: [strchar x N]
+  for (unsigned i = 0, e = Str.size(); i != e; ++i) {
+    if (AbbrevToUse && !llvm::BitCodeAbbrevOp::isChar6(Str[i]))
+      AbbrevToUse = 0;
+    Vals.push_back(Str[i]);
+  }
+
+  // Emit the finished record.
+  Stream.EmitRecord(Code, Vals, AbbrevToUse);
+}
+
+static inline unsigned getEncodedLinkage(const llvm::GlobalValue *GV) {
+  switch (GV->getLinkage()) {
+  case llvm::GlobalValue::ExternalLinkage:                 return 0;
+  case llvm::GlobalValue::WeakAnyLinkage:                  return 1;
+  case llvm::GlobalValue::AppendingLinkage:                return 2;
+  case llvm::GlobalValue::InternalLinkage:                 return 3;
+  case llvm::GlobalValue::LinkOnceAnyLinkage:              return 4;
+  case llvm::GlobalValue::DLLImportLinkage:                return 5;
+  case llvm::GlobalValue::DLLExportLinkage:                return 6;
+  case llvm::GlobalValue::ExternalWeakLinkage:             return 7;
+  case llvm::GlobalValue::CommonLinkage:                   return 8;
+  case llvm::GlobalValue::PrivateLinkage:                  return 9;
+  case llvm::GlobalValue::WeakODRLinkage:                  return 10;
+  case llvm::GlobalValue::LinkOnceODRLinkage:              return 11;
+  case llvm::GlobalValue::AvailableExternallyLinkage:      return 12;
+  case llvm::GlobalValue::LinkerPrivateLinkage:            return 13;
+  case llvm::GlobalValue::LinkerPrivateWeakLinkage:        return 14;
+  case llvm::GlobalValue::LinkOnceODRAutoHideLinkage:      return 15;
+  }
+  llvm_unreachable("Invalid linkage");
+}
+
+static inline unsigned getEncodedVisibility(const llvm::GlobalValue *GV) {
+  switch (GV->getVisibility()) {
+  case llvm::GlobalValue::DefaultVisibility:   return 0;
+  case llvm::GlobalValue::HiddenVisibility:    return 1;
+  case llvm::GlobalValue::ProtectedVisibility: return 2;
+  }
+  llvm_unreachable("Invalid visibility");
+}
+
+#endif
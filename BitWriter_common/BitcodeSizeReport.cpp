@@ -0,0 +1,194 @@
+//===-- BitcodeSizeReport.cpp - Size of the parts of a bitcode file -------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements the BitcodeSizeReport class.
+//
+//===----------------------------------------------------------------------===//
+
+#include "BitcodeSizeReport.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Metadata.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/raw_ostream.h"
+using namespace llvm;
+
+namespace llvm_legacy {
+
+static const char *const SectionNames[BitcodeSizeReport::NumSections] = {
+  "blockinfo",
+  "attributes",
+  "types",
+  "globals",
+  "constants",
+  "metadata",
+  "metadata_kinds",
+  "symbol_table",
+  "use_lists"
+};
+
+static const char *const MetadataKindNames[BitcodeSizeReport::MD_Other] = {
+  "rs",
+  "pragma",
+  "debug"
+};
+
+static uint64_t BitsToBytes(uint64_t Bits) {
+  return (Bits + 4) / 8;
+}
+
+static void PrintJSONString(raw_ostream &OS, StringRef Str) {
+  OS << '"';
+  for (unsigned i = 0, e = Str.size(); i != e; ++i) {
+    unsigned char C = Str[i];
+    if (C == '"' || C == '\\')
+      OS << '\\' << C;
+    else if (C < 0x20)
+      OS << format("\\u%04x", C);
+    else
+      OS << C;
+  }
+  OS << '"';
+}
+
+BitcodeSizeReport::Region::Region(BitcodeSizeReport *Report, Section S,
+                                  const BitstreamWriter &Stream)
+  : Stream(Stream), Counter(0), Start(Stream.GetCurrentBitNo()) {
+  if (Report)
+    Counter = &Report->SectionBits[S];
+}
+
+BitcodeSizeReport::Region::Region(BitcodeSizeReport *Report, const Value *MD,
+                                  const BitstreamWriter &Stream)
+  : Stream(Stream), Counter(0), Start(Stream.GetCurrentBitNo()) {
+  if (Report)
+    Counter = &Report->MetadataBits[Report->getMetadataKind(MD)];
+}
+
+BitcodeSizeReport::Region::Region(BitcodeSizeReport *Report,
+                                  const NamedMDNode *NMD,
+                                  const BitstreamWriter &Stream)
+  : Stream(Stream), Counter(0), Start(Stream.GetCurrentBitNo()) {
+  if (Report)
+    Counter = &Report->MetadataBits[getMetadataKind(NMD)];
+}
+
+BitcodeSizeReport::Region::Region(BitcodeSizeReport *Report,
+                                  const Function &F,
+                                  const BitstreamWriter &Stream)
+  : Stream(Stream), Counter(0), Start(Stream.GetCurrentBitNo()) {
+  if (Report) {
+    Report->FunctionBits.push_back(std::make_pair(F.getName().str(), 0));
+    Counter = &Report->FunctionBits.back().second;
+  }
+}
+
+BitcodeSizeReport::Region::~Region() {
+  if (Counter)
+    *Counter += Stream.GetCurrentBitNo() - Start;
+}
+
+BitcodeSizeReport::BitcodeSizeReport() : TotalBytes(0), WrapperBytes(0) {
+  for (unsigned i = 0; i != NumSections; ++i)
+    SectionBits[i] = 0;
+  for (unsigned i = 0; i != NumMetadataKinds; ++i)
+    MetadataBits[i] = 0;
+}
+
+BitcodeSizeReport::MetadataKind
+BitcodeSizeReport::getMetadataKind(const NamedMDNode *NMD) {
+  StringRef Name = NMD->getName();
+  if (Name.startswith("#rs_"))
+    return MD_RS;
+  if (Name.startswith("#pragma"))
+    return MD_Pragma;
+  if (Name.startswith("llvm.dbg."))
+    return MD_Debug;
+  return MD_Other;
+}
+
+void BitcodeSizeReport::classifyMetadata(const Module *M) {
+  SmallVector<const MDNode*, 32> Worklist;
+
+  // Named metadata which comes first wins for the nodes shared by several.
+  for (Module::const_named_metadata_iterator I = M->named_metadata_begin(),
+       E = M->named_metadata_end(); I != E; ++I) {
+    MetadataKind Kind = getMetadataKind(I);
+    for (unsigned i = 0, e = I->getNumOperands(); i != e; ++i)
+      if (MetadataKinds.insert(std::make_pair(I->getOperand(i), Kind)).second)
+        Worklist.push_back(I->getOperand(i));
+
+    while (!Worklist.empty()) {
+      const MDNode *N = Worklist.pop_back_val();
+      for (unsigned i = 0, e = N->getNumOperands(); i != e; ++i) {
+        Value *Op = N->getOperand(i);
+        if (!Op || !(isa<MDNode>(Op) || isa<MDString>(Op)))
+          continue;
+        if (MetadataKinds.insert(std::make_pair(Op, Kind)).second)
+          if (const MDNode *OpN = dyn_cast<MDNode>(Op))
+            Worklist.push_back(OpN);
+      }
+    }
+  }
+}
+
+BitcodeSizeReport::MetadataKind
+BitcodeSizeReport::getMetadataKind(const Value *MD) const {
+  MetadataKindMap::const_iterator I = MetadataKinds.find(MD);
+  return (I != MetadataKinds.end()) ? I->second : MD_Other;
+}
+
+void BitcodeSizeReport::printJSON(raw_ostream &OS) const {
+  uint64_t OtherBits = TotalBytes * 8;
+  for (unsigned i = 0; i != NumSections; ++i)
+    OtherBits -= SectionBits[i];
+  uint64_t FunctionsBits = 0;
+  for (unsigned i = 0, e = FunctionBits.size(); i != e; ++i)
+    FunctionsBits += FunctionBits[i].second;
+  OtherBits -= FunctionsBits;
+
+  OS << "{\n"
+     << "  \"total\": " << (TotalBytes + WrapperBytes) << ",\n"
+     << "  \"wrapper\": " << WrapperBytes << ",\n";
+
+  for (unsigned i = 0; i != NumSections; ++i) {
+    OS << "  \"" << SectionNames[i] << "\": ";
+    if (i != Metadata) {
+      OS << BitsToBytes(SectionBits[i]) << ",\n";
+      continue;
+    }
+
+    // The block overhead (abbreviations etc.) counts as other metadata.
+    uint64_t OtherMDBits = SectionBits[Metadata];
+    OS << "{\n"
+       << "    \"total\": " << BitsToBytes(SectionBits[Metadata]) << ",\n";
+    for (unsigned k = 0; k != MD_Other; ++k) {
+      OS << "    \"" << MetadataKindNames[k] << "\": "
+         << BitsToBytes(MetadataBits[k]) << ",\n";
+      OtherMDBits -= MetadataBits[k];
+    }
+    OS << "    \"other\": " << BitsToBytes(OtherMDBits) << "\n"
+       << "  },\n";
+  }
+
+  OS << "  \"functions\": " << BitsToBytes(FunctionsBits) << ",\n"
+     << "  \"function_bodies\": {";
+  for (unsigned i = 0, e = FunctionBits.size(); i != e; ++i) {
+    OS << ((i == 0) ? "\n    " : ",\n    ");
+    PrintJSONString(OS, FunctionBits[i].first);
+    OS << ": " << BitsToBytes(FunctionBits[i].second);
+  }
+  OS << (FunctionBits.empty() ? "},\n" : "\n  },\n")
+     << "  \"other\": " << BitsToBytes(OtherBits) << "\n"
+     << "}\n";
+}
+
+}  // end llvm_legacy namespace
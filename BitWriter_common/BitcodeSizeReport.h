@@ -0,0 +1,119 @@
+//===-- BitcodeSizeReport.h - Size of the parts of a bitcode file -*- C++ -*-=//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This class accounts for the bits each block (and the metadata and functions
+// in them) takes in a bitcode file, as written by any of the writers.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef BITWRITER_COMMON_BITCODE_SIZE_REPORT_H
+#define BITWRITER_COMMON_BITCODE_SIZE_REPORT_H
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/Bitcode/BitstreamWriter.h"
+#include <deque>
+#include <string>
+#include <utility>
+
+namespace llvm {
+
+class Function;
+class Module;
+class NamedMDNode;
+class Value;
+class raw_ostream;
+
+}  // end llvm namespace
+
+namespace llvm_legacy {
+
+class BitcodeSizeReport {
+public:
+  /// The top-level blocks of the module. The bits of the module which are in
+  /// none of them (the file header, the records of the module block etc.)
+  /// count as "other".
+  enum Section {
+    BlockInfo,
+    Attributes,
+    Types,
+    Globals,
+    Constants,
+    Metadata,
+    MetadataKinds,
+    SymbolTable,
+    UseLists,
+    NumSections
+  };
+
+  /// What the module-level metadata belongs to, by the named metadata it's
+  /// (first) reachable from.
+  enum MetadataKind {
+    MD_RS,      // #rs_* (the info for the reflection and the runtime)
+    MD_Pragma,  // #pragma
+    MD_Debug,   // llvm.dbg.*
+    MD_Other,
+    NumMetadataKinds
+  };
+
+  /// Charges the bits written to a stream until the end of the scope to a
+  /// section, a kind of metadata or a function. Does nothing if the report
+  /// is NULL.
+  class Region {
+    const llvm::BitstreamWriter &Stream;
+    uint64_t *Counter;
+    uint64_t Start;
+
+  public:
+    Region(BitcodeSizeReport *Report, Section S,
+           const llvm::BitstreamWriter &Stream);
+    Region(BitcodeSizeReport *Report, const llvm::Value *MD,
+           const llvm::BitstreamWriter &Stream);
+    Region(BitcodeSizeReport *Report, const llvm::NamedMDNode *NMD,
+           const llvm::BitstreamWriter &Stream);
+    Region(BitcodeSizeReport *Report, const llvm::Function &F,
+           const llvm::BitstreamWriter &Stream);
+    ~Region();
+  };
+
+private:
+  uint64_t SectionBits[NumSections];
+  uint64_t MetadataBits[NumMetadataKinds];
+  // The bodies in the order they're written. A deque, such that the counter
+  // of a Region stays valid while the next function is added.
+  std::deque<std::pair<std::string, uint64_t> > FunctionBits;
+
+  typedef llvm::DenseMap<const llvm::Value*, MetadataKind> MetadataKindMap;
+  MetadataKindMap MetadataKinds;
+
+  uint64_t TotalBytes;
+  uint64_t WrapperBytes;
+
+public:
+  BitcodeSizeReport();
+
+  /// classifyMetadata - Figure out the kind of each metadata value of M. Must
+  /// be called before M is written.
+  void classifyMetadata(const llvm::Module *M);
+
+  MetadataKind getMetadataKind(const llvm::Value *MD) const;
+  static MetadataKind getMetadataKind(const llvm::NamedMDNode *NMD);
+
+  /// The size of the whole bitcode file (including the header for Darwin).
+  void setTotalBytes(uint64_t Bytes) { TotalBytes = Bytes; }
+
+  /// The size of the wrapper written in front of the bitcode file, if any.
+  void setWrapperBytes(uint64_t Bytes) { WrapperBytes = Bytes; }
+
+  /// printJSON - Write the sizes (in bytes) as a JSON object.
+  void printJSON(llvm::raw_ostream &OS) const;
+};
+
+}  // end llvm_legacy namespace
+
+#endif
@@ -24,14 +24,35 @@
 #include <algorithm>
 using namespace llvm;
 
-namespace llvm_2_9 {
+namespace llvm_legacy {
 
 static bool isIntOrIntVectorValue(const std::pair<const Value*, unsigned> &V) {
   return V.first->getType()->isIntOrIntVectorTy();
 }
 
 /// ValueEnumerator - Enumerate module-level information.
-ValueEnumerator::ValueEnumerator(const Module *M) {
+ValueEnumerator::ValueEnumerator(const Module *M, bool ExpandDataSequentials)
+    : ExpandDataSequentials(ExpandDataSequentials) {
+  // Size the value table for the global values and the constants of their
+  // initializers, the elements of constant data arrays included when they're
+  // expanded. These make up most of the module-level values of large scripts.
+  unsigned NumValues = 0;
+  for (Module::const_global_iterator I = M->global_begin(),
+         E = M->global_end(); I != E; ++I) {
+    ++NumValues;
+    if (!I->hasInitializer())
+      continue;
+    const Constant *Init = I->getInitializer();
+    const ConstantDataSequential *CDS = dyn_cast<ConstantDataSequential>(Init);
+    if ((CDS != NULL) && ExpandDataSequentials)
+      NumValues += CDS->getNumElements() + 1;
+    else
+      NumValues += Init->getNumOperands() + 1;
+  }
+  NumValues += M->size() + M->alias_size();
+  Values.reserve(NumValues);
+  ValueMap.resize(NumValues * 4 / 3 + 1);
+
   // Enumerate the global variables.
   for (Module::const_global_iterator I = M->global_begin(),
          E = M->global_end(); I != E; ++I)
@@ -172,27 +193,53 @@ void ValueEnumerator::print(raw_ostream &OS, const ValueMapType &Map,
 
 // Optimize constant ordering.
 namespace {
-  struct CstSortPredicate {
-    ValueEnumerator &VE;
-    explicit CstSortPredicate(ValueEnumerator &ve) : VE(ve) {}
+  struct CstFrequencyPredicate {
     bool operator()(const std::pair<const Value*, unsigned> &LHS,
-                    const std::pair<const Value*, unsigned> &RHS) {
-      // Sort by plane.
-      if (LHS.first->getType() != RHS.first->getType())
-        return VE.getTypeID(LHS.first->getType()) <
-               VE.getTypeID(RHS.first->getType());
-      // Then by frequency.
+                    const std::pair<const Value*, unsigned> &RHS) const {
       return LHS.second > RHS.second;
     }
   };
 }
 
 /// OptimizeConstants - Reorder constant pool for denser encoding.
+///
+/// The constants are ordered by type plane, then by decreasing frequency, and
+/// otherwise keep the order they were enumerated in (as a stable sort by plane
+/// and frequency would). The planes are formed by a counting sort on the type
+/// IDs, so only a plane whose frequencies are not already in order (most
+/// constants are used once) needs sorting.
 void ValueEnumerator::OptimizeConstants(unsigned CstStart, unsigned CstEnd) {
   if (CstStart == CstEnd || CstStart+1 == CstEnd) return;
 
-  CstSortPredicate P(*this);
-  std::stable_sort(Values.begin()+CstStart, Values.begin()+CstEnd, P);
+  // PlaneEnd[T+1] counts the constants of type ID T, then (after the prefix
+  // sum) is where the plane of T starts, and (after the distribution) ends.
+  unsigned NumCsts = CstEnd - CstStart;
+  SmallVector<unsigned, 64> CstTypeIDs(NumCsts);
+  std::vector<unsigned> PlaneEnd(Types.size() + 1, 0);
+  for (unsigned i = 0; i != NumCsts; ++i) {
+    CstTypeIDs[i] = getTypeID(Values[CstStart+i].first->getType());
+    ++PlaneEnd[CstTypeIDs[i]+1];
+  }
+  for (unsigned i = 1, e = PlaneEnd.size(); i != e; ++i)
+    PlaneEnd[i] += PlaneEnd[i-1];
+
+  ValueList Sorted(NumCsts);
+  for (unsigned i = 0; i != NumCsts; ++i)
+    Sorted[PlaneEnd[CstTypeIDs[i]]++] = Values[CstStart+i];
+
+  CstFrequencyPredicate P;
+  for (unsigned Start = 0; Start != NumCsts; ) {
+    Type *PlaneTy = Sorted[Start].first->getType();
+    unsigned End = Start + 1;
+    bool InOrder = true;
+    for (; End != NumCsts && Sorted[End].first->getType() == PlaneTy; ++End)
+      if (P(Sorted[End], Sorted[End-1]))
+        InOrder = false;
+    if (!InOrder)
+      std::stable_sort(Sorted.begin()+Start, Sorted.begin()+End, P);
+    Start = End;
+  }
+  std::copy(Sorted.begin(), Sorted.end(), Values.begin()+CstStart);
 
   // Ensure that integer and vector of integer constants are at the start of the
   // constant pool.  This is important so that GEP structure indices come before
@@ -344,10 +391,12 @@ void ValueEnumerator::EnumerateValue(const Value *V) {
       ValueMap[V] = Values.size();
       return;
     } else if (const ConstantDataSequential *CDS =
-               dyn_cast<ConstantDataSequential>(C)) {
+               ExpandDataSequentials ? dyn_cast<ConstantDataSequential>(C)
+                                     : NULL) {
       // For our legacy handling of the new ConstantDataSequential type, we
       // need to enumerate the individual elements, as well as mark the
-      // outer constant as used.
+      // outer constant as used. A CST_CODE_DATA record holds the elements
+      // itself, so they aren't values in the 3.2 format.
       for (unsigned i = 0, e = CDS->getNumElements(); i != e; ++i)
         EnumerateValue(CDS->getElementAsConstant(i));
       Values.push_back(std::make_pair(V, 1U));
@@ -457,6 +506,14 @@ void ValueEnumerator::incorporateFunction(const Function &F) {
   NumModuleValues = Values.size();
   NumModuleMDValues = MDValues.size();
 
+  // Make room for the arguments, the instructions and (about as many) local
+  // constants.
+  unsigned NumInsts = 0;
+  for (Function::const_iterator BB = F.begin(), E = F.end(); BB != E; ++BB)
+    NumInsts += BB->size();
+  Values.reserve(Values.size() + F.arg_size() + 2 * NumInsts);
+  BasicBlocks.reserve(F.size());
+
   // Adding function arguments to the value table.
   for (Function::const_arg_iterator I = F.arg_begin(), E = F.arg_end();
        I != E; ++I)
@@ -550,4 +607,4 @@ unsigned ValueEnumerator::getGlobalBasicBlockID(const BasicBlock *BB) const {
   return getGlobalBasicBlockID(BB);
 }
 
-} // end llvm_2_9 namespace
+}  // end llvm_legacy namespace
@@ -50,6 +50,12 @@ $(intermediates)/RSObjectTypeEnums.inc: $(RS_SPEC_GEN)
 	$(call generate-rs-spec-inc,rs-object-type-enums)
 endif
 
+ifneq ($(findstring RSSpecificTypeHash.inc,$(RS_SPEC_TABLES)),)
+LOCAL_GENERATED_SOURCES += $(intermediates)/RSSpecificTypeHash.inc
+$(intermediates)/RSSpecificTypeHash.inc: $(RS_SPEC_GEN)
+	$(call generate-rs-spec-inc,rs-specific-type-hash)
+endif
+
 ifneq ($(findstring RSDataElementEnums.inc,$(RS_SPEC_TABLES)),)
 LOCAL_GENERATED_SOURCES += $(intermediates)/RSDataElementEnums.inc
 $(intermediates)/RSDataElementEnums.inc: $(RS_SPEC_GEN)
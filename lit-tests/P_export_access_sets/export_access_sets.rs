@@ -0,0 +1,34 @@
+// RUN: %Slang -O 0 -export-access-sets %s
+// RUN: %rs-filecheck-wrapper %s
+// CHECK: !#rs_export_access = !{!{{[0-9]+}}, !{{[0-9]+}}, !{{[0-9]+}}}
+// CHECK: metadata !{metadata !"scale", metadata !"1", metadata !{{[0-9]+}}, metadata !{{[0-9]+}}}
+// CHECK: metadata !{metadata !"gain", metadata !"offset"}
+// CHECK: metadata !{metadata !"tick", metadata !"1", metadata !{{[0-9]+}}, metadata !{{[0-9]+}}}
+// CHECK: metadata !{metadata !"*history", metadata !"frames", metadata !"history"}
+// CHECK: metadata !{metadata !"*history", metadata !"frames"}
+// CHECK: metadata !{metadata !"debug", metadata !"0", metadata !{{[0-9]+}}, metadata !{{[0-9]+}}}
+
+#pragma version(1)
+#pragma rs java_package_name(export_access_sets)
+
+float gain;
+float4 offset = {0.f, 0.f, 0.f, 1.f};
+int frames;
+int *history;
+
+static void record(int *slot, int value) {
+  *slot = value;
+}
+
+float4 __attribute__((kernel)) scale(float4 in) {
+  return in * gain + offset;
+}
+
+void tick() {
+  frames++;
+  record(&history[frames & 15], frames);
+}
+
+void debug() {
+  rsDebug("frames", frames);
+}
@@ -0,0 +1,40 @@
+// RUN: %Slang -O 0 -export-usage %S/export_usage.manifest %s
+// RUN: %rs-filecheck-wrapper %s
+// CHECK: @gain = global float
+// CHECK: @bias = internal global float
+// CHECK: @unused_count = internal global i32
+// CHECK: define internal float @root(
+// CHECK: define float @clamped(
+// CHECK: define void @reset(
+// CHECK: define internal void @count(
+// CHECK: !#rs_export_var = !{!{{[0-9]+}}}
+// CHECK: !#rs_export_func = !{!{{[0-9]+}}}
+// CHECK: !#rs_export_foreach_name = !{!{{[0-9]+}}, !{{[0-9]+}}}
+
+#pragma version(1)
+#pragma rs java_package_name(export_usage)
+
+float gain;
+float bias;
+int unused_count;
+
+static float apply(float in) {
+  return in * gain + bias;
+}
+
+float __attribute__((kernel)) root(float in) {
+  return apply(in);
+}
+
+float __attribute__((kernel)) clamped(float in) {
+  return fmin(fmax(apply(in), 0.f), 1.f);
+}
+
+void reset() {
+  gain = 1.f;
+  bias = 0.f;
+}
+
+void count() {
+  unused_count++;
+}
@@ -0,0 +1,65 @@
+// RUN: %Slang %s
+// RUN: %rs-filecheck-wrapper %s
+// CHECK: define {{.*}} @brighten_threshold(
+// CHECK-NOT: call {{.*}} @brighten(
+// CHECK-NOT: call {{.*}} @threshold(
+// CHECK: ret
+// CHECK: define {{.*}} @toFloat_scale_toUchar(
+// CHECK-NOT: call {{.*}} @toFloat(
+// CHECK-NOT: call {{.*}} @scale(
+// CHECK-NOT: call {{.*}} @toUchar(
+// CHECK: ret
+// CHECK: define {{.*}} @toFloat3_dim3(
+// CHECK-NOT: call {{.*}} @toFloat3(
+// CHECK-NOT: call {{.*}} @dim3(
+// CHECK: ret <3 x float>
+// CHECK: define {{.*}} @pick2_swap2(
+// CHECK-NOT: call {{.*}} @pick2(
+// CHECK-NOT: call {{.*}} @swap2(
+// CHECK: ret <2 x i8>
+
+#pragma version(1)
+#pragma rs java_package_name(fuse)
+
+float gain = 1.5f;
+
+#pragma rs fuse(brighten, threshold)
+#pragma rs fuse(toFloat, scale, toUchar)
+#pragma rs fuse(toFloat3, dim3)
+#pragma rs fuse(pick2, swap2)
+
+uchar4 __attribute__((kernel)) brighten(uchar4 in) {
+  return convert_uchar4(clamp(convert_float4(in) * gain, 0.f, 255.f));
+}
+
+uchar4 __attribute__((kernel)) threshold(uchar4 in, uint32_t x) {
+  return (x & 1) ? in : (uchar4){0, 0, 0, 255};
+}
+
+float4 __attribute__((kernel)) toFloat(uchar4 in) {
+  return convert_float4(in);
+}
+
+float4 __attribute__((kernel)) scale(float4 in, uint32_t x, uint32_t y) {
+  return in * (float)(x + y);
+}
+
+uchar4 __attribute__((kernel)) toUchar(float4 in) {
+  return convert_uchar4(clamp(in, 0.f, 255.f));
+}
+
+float3 __attribute__((kernel)) toFloat3(uchar4 in) {
+  return convert_float3(in.xyz);
+}
+
+float3 __attribute__((kernel)) dim3(float3 in) {
+  return in * gain;
+}
+
+uchar2 __attribute__((kernel)) pick2(uchar4 in) {
+  return in.xy;
+}
+
+uchar2 __attribute__((kernel)) swap2(uchar2 in) {
+  return in.yx;
+}
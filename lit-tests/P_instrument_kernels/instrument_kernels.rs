@@ -0,0 +1,33 @@
+// RUN: %Slang -O 0 -instrument-kernels %s
+// RUN: %rs-filecheck-wrapper %s
+// CHECK: @.rs.profile_counters = global i64* null
+// CHECK: define float @scale(
+// CHECK: call i64 @_Z13rsUptimeNanosv()
+// CHECK: getelementptr inbounds i64* {{.*}}, i32 0
+// CHECK: atomicrmw add i64* {{.*}}, i64 1 monotonic
+// CHECK: getelementptr inbounds i64* {{.*}}, i32 1
+// CHECK: atomicrmw add
+// CHECK: ret float
+// CHECK: define void @setGain(
+// CHECK: call i64 @_Z13rsUptimeNanosv()
+// CHECK: getelementptr inbounds i64* {{.*}}, i32 2
+// CHECK: atomicrmw add i64* {{.*}}, i64 1 monotonic
+// CHECK: getelementptr inbounds i64* {{.*}}, i32 3
+// CHECK: atomicrmw add
+// CHECK: ret void
+// CHECK: metadata !{metadata !".rs.profile_counters", metadata !"*long"}
+
+#pragma version(1)
+#pragma rs java_package_name(instrument_kernels)
+
+float gain;
+
+float __attribute__((kernel)) scale(float in) {
+  if (in < 0.f)
+    return 0.f;
+  return in * gain;
+}
+
+void setGain(float g) {
+  gain = g;
+}
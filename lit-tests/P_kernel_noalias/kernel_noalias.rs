@@ -0,0 +1,28 @@
+// RUN: %Slang -target-api 19 -O 0 %s
+// RUN: %rs-filecheck-wrapper %s
+// CHECK: define void @root(<4 x float>* noalias readonly %in, <4 x float>* noalias %out, i32 %x)
+// CHECK: define void @halve(float* noalias readonly %in, float* noalias %out)
+// CHECK: define void @copy(float* %in, float* %out)
+
+#pragma version(1)
+#pragma rs java_package_name(kernel_noalias)
+
+float scale;
+float cell;
+
+void root(const float4 *in, float4 *out, uint32_t x) {
+  *out = *in * scale + (float)x;
+}
+
+void halve(const float *in, float *out) {
+  *out = *in * 0.5f;
+}
+
+// Called by the script itself, with overlapping cells
+void copy(const float *in, float *out) {
+  *out = *in;
+}
+
+void copyInPlace() {
+  copy(&cell, &cell);
+}
@@ -0,0 +1,17 @@
+// RUN: %Slang -target-api 18 -O 0 %s
+// RUN: %rs-filecheck-wrapper %s
+// CHECK: define void @root(<4 x float>* noalias %in, <4 x float>* noalias %out, i32 %x)
+// CHECK: define void @halve(float* noalias %in, float* noalias %out)
+
+#pragma version(1)
+#pragma rs java_package_name(kernel_noalias_jb)
+
+float scale;
+
+void root(const float4 *in, float4 *out, uint32_t x) {
+  *out = *in * scale + (float)x;
+}
+
+void halve(const float *in, float *out) {
+  *out = *in * 0.5f;
+}
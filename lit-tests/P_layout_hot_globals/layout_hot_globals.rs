@@ -0,0 +1,23 @@
+// RUN: %Slang -O 0 -layout-hot-globals %s
+// RUN: %rs-filecheck-wrapper %s
+// CHECK: @gain = global float 0.000000e+00, align 64
+// CHECK: @offset = global <4 x float> <{{.*}}>, align 64
+// CHECK: @frames = {{.*}}global i32 0, align 4
+// CHECK: @table = {{.*}}global [256 x float] zeroinitializer, align 4
+
+#pragma version(1)
+#pragma rs java_package_name(layout_hot_globals)
+
+float table[256];
+float gain;
+float4 offset = {0.f, 0.f, 0.f, 1.f};
+int frames;
+
+float4 __attribute__((kernel)) root(float4 in) {
+  return in * gain + offset;
+}
+
+void tick() {
+  frames++;
+  table[frames & 255] = gain;
+}
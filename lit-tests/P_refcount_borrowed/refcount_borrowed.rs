@@ -0,0 +1,47 @@
+// RUN: %Slang -O 0 %s
+// RUN: %rs-filecheck-wrapper %s
+// CHECK: define void @borrowed(
+// CHECK-NOT: rsSetObject
+// CHECK-NOT: rsClearObject
+// CHECK: ret void
+// CHECK: define void @addressTaken(
+// CHECK: call void @_Z13rsClearObject
+// CHECK: ret void
+// CHECK: define void @writesThroughPointer(
+// CHECK: call void @_Z13rsClearObject
+// CHECK: ret void
+
+#pragma version(1)
+#pragma rs java_package_name(foo)
+
+rs_allocation gIn;
+rs_allocation gOut;
+
+int gCount;
+
+static rs_allocation *gTarget;
+
+// Only a copy of gIn, no rsSetObject/rsClearObject is needed.
+void borrowed() {
+    rs_allocation in = gIn;
+    gCount = rsAllocationGetDimX(in);
+}
+
+// gIn is modified through the pointer to it while the local is alive.
+void addressTaken() {
+    rs_allocation in = gIn;
+    rs_allocation *p = &gIn;
+    *p = gOut;
+    gCount = rsAllocationGetDimX(in);
+}
+
+// gTarget may hold the address of gIn, taken in another function.
+void writesThroughPointer() {
+    rs_allocation in = gIn;
+    *gTarget = gOut;
+    gCount = rsAllocationGetDimX(in);
+}
+
+void setTarget() {
+    gTarget = &gIn;
+}
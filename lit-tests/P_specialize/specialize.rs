@@ -0,0 +1,31 @@
+// RUN: %Slang -target-api 18 -O 0 %s
+// RUN: %rs-filecheck-wrapper %s
+// CHECK: define float @blur(
+// CHECK: load {{.*}} @radius
+// CHECK: ret float
+// CHECK: define float @blur.specialized(
+// CHECK-NOT: call {{.*}} @weight(
+// CHECK-NOT: load {{.*}} @radius
+// CHECK-NOT: load {{.*}} @scale
+// CHECK: ret float
+// CHECK: !#rs_export_foreach_name = !{
+// CHECK: metadata !{metadata !"blur.specialized"}
+
+#pragma version(1)
+#pragma rs java_package_name(specialize)
+
+int radius;
+float scale;
+
+#pragma rs specialize(radius = 3, scale = 1.5)
+
+static float weight(int i) {
+  return scale / (float) (radius + i);
+}
+
+float __attribute__((kernel)) blur(float in, uint32_t x) {
+  float sum = 0.f;
+  for (int i = -radius; i <= radius; i++)
+    sum += in * weight(i + radius);
+  return sum;
+}
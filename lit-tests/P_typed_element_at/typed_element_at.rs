@@ -0,0 +1,33 @@
+// RUN: %Slang -O 0 %s
+// RUN: %rs-filecheck-wrapper %s
+// CHECK: define <4 x float> @gather(
+// CHECK: call i32 @{{.*}}rsGetElementAt_int{{.*}}(
+// CHECK: call {{.*}}@{{.*}}rsGetElementAt{{[^_]}}
+// CHECK: call <4 x float> @{{.*}}rsGetElementAt_float4{{.*}}(
+// CHECK: ret <4 x float>
+// CHECK: define void @scatter(
+// CHECK: call void @{{.*}}rsSetElementAt_uchar4{{.*}}(
+// CHECK: call {{.*}}@{{.*}}rsGetElementAt{{[^_]}}
+// CHECK: ret void
+
+#pragma version(1)
+#pragma rs java_package_name(foo)
+
+rs_allocation table;
+rs_allocation image;
+rs_allocation out;
+
+// The cells read as rvalues go through the typed accessors, the pointer kept
+// in cell through the untyped one.
+float4 __attribute__((kernel)) gather(uint32_t x) {
+  int offset = *(const int *) rsGetElementAt(table, x);
+  const float4 *cell = (const float4 *) rsGetElementAt(image, x + offset);
+  return *cell + *(const float4 *) rsGetElementAt(image, x, 0);
+}
+
+// The cell written through its address stays untyped.
+void __attribute__((kernel)) scatter(uchar in, uint32_t x) {
+  uchar4 v = {in, in, in, 255};
+  rsSetElementAt(out, &v, x);
+  *(uchar *) rsGetElementAt(out, x) = in;
+}
@@ -0,0 +1,19 @@
+// RUN: %Slang -reflect-var-batch %s
+// RUN: %rs-filecheck-wrapper %s
+// CHECK: define void @.rs.set_vars_batch(
+// CHECK-NOT: @frame
+// CHECK: @gain
+// CHECK-NOT: @frame
+// CHECK: ret void
+
+#pragma version(1)
+#pragma rs java_package_name(var_batch)
+
+float gain;
+
+struct frame {
+    float scale;
+    rs_allocation src;
+} frame;
+
+struct frame frames[2];
@@ -0,0 +1,37 @@
+// RUN: %Slang -target-api 18 -O 0 -widen-kernels %s
+// RUN: %rs-filecheck-wrapper %s
+// CHECK: define void @brighten.widened({{.*}}* %in, {{.*}}* %out, i32 %x, i32 %y)
+// CHECK-NOT: call {{.*}} @brighten(
+// CHECK: ret void
+// CHECK: define void @invert.widened({{.*}}* %in, {{.*}}* %out, i32 %x, i32 %y)
+// CHECK-NOT: call {{.*}} @invert(
+// CHECK: ret void
+// CHECK-NOT: define {{.*}} @add.widened(
+// CHECK: !#rs_export_foreach_widened = !{!{{[0-9]+}}, !{{[0-9]+}}}
+// CHECK: metadata !{metadata !"brighten", metadata !"4"}
+// CHECK: metadata !{metadata !"invert", metadata !"8"}
+
+#pragma version(1)
+#pragma rs java_package_name(widen_kernels)
+
+float gain;
+
+static float4 scale(float4 v) {
+  return v * gain;
+}
+
+float4 __attribute__((kernel)) brighten(float4 in) {
+  return scale(in) + 0.1f;
+}
+
+uchar4 __attribute__((kernel)) invert(uchar4 in, uint32_t x) {
+  uchar4 out = (uchar4) 255 - in;
+  out.a = (uchar) x;
+  return out;
+}
+
+// Not widened: it reads another allocation
+rs_allocation other;
+float4 __attribute__((kernel)) add(float4 in, uint32_t x, uint32_t y) {
+  return in + *(const float4 *) rsGetElementAt(other, x, y);
+}
@@ -0,0 +1,17 @@
+// RUN: %Slang -O 3 -opt-profile kernel %s
+// RUN: %rs-filecheck-wrapper %s
+// CHECK: define void @root(
+// CHECK-NOT: call float @scale(
+
+#pragma version(1)
+#pragma rs java_package_name(foo)
+
+float gain;
+
+static float scale(float f) {
+  return f * gain + 1.f;
+}
+
+void root(const float *in, float *out) {
+  *out = scale(*in) - scale(*in * 2.f);
+}
@@ -0,0 +1,19 @@
+// RUN: %Slang -O 0 -link-rslib %s
+// RUN: %rs-filecheck-wrapper %s
+// CHECK: define void @root(
+// CHECK: call <3 x float> @_Z4powiDv3_fi(
+// CHECK: define internal <3 x float> @_Z4powiDv3_fi(
+// CHECK-NOT: define {{.*}}@foo(
+// CHECK-NOT: define {{.*}}@test4(
+// CHECK-NOT: define {{.*}}@convert1_uchar3(
+
+#pragma version(1)
+#pragma rs java_package_name(foo)
+
+// Implemented by rslib.bc, linked in (and internalized) as only the script
+// calls it. The other helpers of rslib.bc are left out.
+extern float3 __attribute__((overloadable)) powi(float3 f, int exp);
+
+void root(const float3 *in, float3 *out) {
+  *out = powi(*in, 3);
+}
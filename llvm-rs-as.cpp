@@ -12,6 +12,12 @@
 //   llvm-as [options]      - Read LLVM asm from stdin, write bitcode to stdout
 //   llvm-as [options] x.ll - Read LLVM asm from the x.ll file, write bitcode
 //                            to the x.bc file.
+//   llvm-as [options] x.ll y.ll ...
+//                          - Assemble each file (in parallel with -j), as if
+//                            one at a time.
+//
+//  With more than one -bitcode-version, the bitcode of each version is written
+//  from a single parse of the input, to x.<version>.bc (e.g., x.bc32.bc).
 //
 //===----------------------------------------------------------------------===//
 
@@ -26,20 +32,28 @@
 #include "llvm/Support/Signals.h"
 #include "llvm/Support/SourceMgr.h"
 #include "llvm/Support/SystemUtils.h"
+#include "llvm/Support/Threading.h"
 #include "llvm/Support/ToolOutputFile.h"
 
 #include "BitWriter_3_2/ReaderWriter_3_2.h"
 #include "BitWriter_2_9/ReaderWriter_2_9.h"
 #include "BitWriter_2_9_func/ReaderWriter_2_9_func.h"
 
+#include <pthread.h>
+
+#include <algorithm>
 #include <memory>
+#include <string>
+#include <vector>
 using namespace llvm;
 
-static cl::opt<std::string>
-InputFilename(cl::Positional, cl::desc("<input .llvm file>"), cl::init("-"));
+static cl::list<std::string>
+InputFilenames(cl::Positional, cl::desc("<input .llvm files>"),
+               cl::ZeroOrMore);
 
 static cl::opt<std::string>
-OutputFilename("o", cl::desc("Override output filename"),
+OutputFilename("o", cl::desc("Override output filename (with a single input "
+                             "and bitcode version only)"),
                cl::value_desc("filename"));
 
 static cl::opt<bool>
@@ -55,48 +69,73 @@ static cl::opt<bool>
 DisableVerify("disable-verify", cl::Hidden,
               cl::desc("Do not run verifier on input LLVM (dangerous!)"));
 
+static cl::list<std::string>
+DisableVerifyFor("disable-verify-for", cl::Hidden,
+                 cl::desc("Do not run verifier on this input (dangerous!)"),
+                 cl::value_desc("filename"));
+
+static cl::opt<unsigned>
+NumJobs("j", cl::desc("Assemble up to <N> input files in parallel"),
+        cl::value_desc("N"), cl::init(1));
+
 enum BCVersion {
   BC29, BC29Func, BC32, BCHEAD
 };
 
-cl::opt<BCVersion> BitcodeVersion("bitcode-version",
-  cl::desc("Set the bitcode version to be written:"),
+cl::list<BCVersion> BitcodeVersions("bitcode-version",
+  cl::desc("Set the bitcode version(s) to be written:"),
   cl::values(
     clEnumValN(BC29, "BC29", "Version 2.9"),
      clEnumVal(BC29Func,     "Version 2.9 func"),
      clEnumVal(BC32,         "Version 3.2"),
      clEnumVal(BCHEAD,       "Most current version"),
-    clEnumValEnd), cl::init(BC32));
-
-static void WriteOutputFile(const Module *M) {
-  // Infer the output filename if needed.
-  if (OutputFilename.empty()) {
-    if (InputFilename == "-") {
-      OutputFilename = "-";
-    } else {
-      std::string IFN = InputFilename;
-      int Len = IFN.length();
-      if (IFN[Len-3] == '.' && IFN[Len-2] == 'l' && IFN[Len-1] == 'l') {
-        // Source ends in .ll
-        OutputFilename = std::string(IFN.begin(), IFN.end()-3);
-      } else {
-        OutputFilename = IFN;   // Append a .bc to it
-      }
-      OutputFilename += ".bc";
-    }
+    clEnumValEnd));
+
+static const char *GetVersionSuffix(BCVersion Version) {
+  switch (Version) {
+    case BC29: return "bc29";
+    case BC29Func: return "bc29func";
+    case BC32: return "bc32";
+    case BCHEAD: return "bchead";
   }
+  return "";
+}
+
+static std::string GetOutputFilename(const std::string &InputFilename,
+                                     BCVersion Version, bool MultiVersion) {
+  if (!OutputFilename.empty())
+    return OutputFilename;
+  if (InputFilename == "-")
+    return "-";
 
+  // Infer the output filename.
+  std::string IFN = InputFilename;
+  int Len = IFN.length();
+  std::string Base;
+  if (Len >= 3 && IFN[Len-3] == '.' && IFN[Len-2] == 'l' && IFN[Len-1] == 'l') {
+    // Source ends in .ll
+    Base = std::string(IFN.begin(), IFN.end()-3);
+  } else {
+    Base = IFN;   // Append a .bc to it
+  }
+  if (MultiVersion)
+    Base = Base + "." + GetVersionSuffix(Version);
+  return Base + ".bc";
+}
+
+static bool WriteOutputFile(const Module *M, const std::string &Filename,
+                            BCVersion Version, std::string *Errors) {
   std::string ErrorInfo;
   OwningPtr<tool_output_file> Out
-  (new tool_output_file(OutputFilename.c_str(), ErrorInfo,
+  (new tool_output_file(Filename.c_str(), ErrorInfo,
                         llvm::sys::fs::F_Binary));
   if (!ErrorInfo.empty()) {
-    errs() << ErrorInfo << '\n';
-    exit(1);
+    Errors->append(ErrorInfo + "\n");
+    return false;
   }
 
   if (Force || !CheckBitcodeOutputToConsole(Out->os(), true)) {
-    switch(BitcodeVersion) {
+    switch(Version) {
       case BC29:
         llvm_2_9::WriteBitcodeToFile(M, Out->os());
         break;
@@ -114,38 +153,171 @@ static void WriteOutputFile(const Module *M) {
 
   // Declare success.
   Out->keep();
+  return true;
+}
+
+namespace {
+
+struct AssembleJob {
+  std::string InputFilename;
+  bool Success;
+  // Printed once all the jobs are done, in the order of the inputs
+  std::string Errors;
+};
+
+struct AssembleState {
+  const char *Argv0;
+  std::vector<AssembleJob> *Jobs;
+  std::vector<BCVersion> Versions;
+  // Index of the next job to hand out, guarded by QueueLock
+  size_t NextJob;
+  pthread_mutex_t QueueLock;
+};
+
+}  // namespace
+
+static bool Assemble(const char *Argv0, const std::string &InputFilename,
+                     const std::vector<BCVersion> &Versions,
+                     std::string *Errors) {
+  raw_string_ostream ErrorStream(*Errors);
+  // Each input has its own context, so the inputs don't share any state.
+  LLVMContext Context;
+
+  // Parse the file now...
+  SMDiagnostic Err;
+  OwningPtr<Module> M(ParseAssemblyFile(InputFilename, Err, Context));
+  if (M.get() == 0) {
+    Err.print(Argv0, ErrorStream);
+    return false;
+  }
+
+  if (!DisableVerify &&
+      (std::find(DisableVerifyFor.begin(), DisableVerifyFor.end(),
+                 InputFilename) == DisableVerifyFor.end())) {
+    std::string Err;
+    if (verifyModule(*M.get(), ReturnStatusAction, &Err)) {
+      ErrorStream << Argv0
+                  << ": assembly parsed, but does not verify as correct!\n";
+      ErrorStream << Err;
+      return false;
+    }
+  }
+
+  if (DumpAsm) ErrorStream << "Here's the assembly:\n" << *M.get();
+
+  if (DisableOutput)
+    return true;
+
+  ErrorStream.flush();
+  for (unsigned i = 0, e = Versions.size(); i != e; i++) {
+    std::string Filename =
+        GetOutputFilename(InputFilename, Versions[i], Versions.size() > 1);
+    if (!WriteOutputFile(M.get(), Filename, Versions[i], Errors))
+      return false;
+  }
+  return true;
+}
+
+static void *AssembleWorker(void *Data) {
+  AssembleState *State = static_cast<AssembleState *>(Data);
+  std::vector<AssembleJob> &Jobs = *State->Jobs;
+
+  while (true) {
+    AssembleJob *Job;
+    pthread_mutex_lock(&State->QueueLock);
+    if (State->NextJob == Jobs.size()) {
+      pthread_mutex_unlock(&State->QueueLock);
+      break;
+    }
+    Job = &Jobs[State->NextJob++];
+    pthread_mutex_unlock(&State->QueueLock);
+
+    Job->Success = Assemble(State->Argv0, Job->InputFilename, State->Versions,
+                            &Job->Errors);
+  }
+  return NULL;
 }
 
 int main(int argc, char **argv) {
   // Print a stack trace if we signal out.
   sys::PrintStackTraceOnErrorSignal();
   PrettyStackTraceProgram X(argc, argv);
-  LLVMContext &Context = getGlobalContext();
   llvm_shutdown_obj Y;  // Call llvm_shutdown() on exit.
   cl::ParseCommandLineOptions(argc, argv, "llvm .ll -> .bc assembler\n");
 
-  // Parse the file now...
-  SMDiagnostic Err;
-  OwningPtr<Module> M(ParseAssemblyFile(InputFilename, Err, Context));
-  if (M.get() == 0) {
-    Err.print(argv[0], errs());
+  std::vector<AssembleJob> Jobs;
+  if (InputFilenames.empty()) {
+    AssembleJob Job;
+    Job.InputFilename = "-";
+    Job.Success = false;
+    Jobs.push_back(Job);
+  }
+  for (unsigned i = 0, e = InputFilenames.size(); i != e; i++) {
+    AssembleJob Job;
+    Job.InputFilename = InputFilenames[i];
+    Job.Success = false;
+    Jobs.push_back(Job);
+  }
+
+  AssembleState State;
+  State.Argv0 = argv[0];
+  State.Jobs = &Jobs;
+  State.Versions.assign(BitcodeVersions.begin(), BitcodeVersions.end());
+  if (State.Versions.empty())
+    State.Versions.push_back(BC32);
+  State.NextJob = 0;
+
+  if (!OutputFilename.empty() &&
+      ((Jobs.size() > 1) || (State.Versions.size() > 1))) {
+    errs() << argv[0] << ": -o needs a single input and bitcode version\n";
     return 1;
   }
 
-  if (!DisableVerify) {
-    std::string Err;
-    if (verifyModule(*M.get(), ReturnStatusAction, &Err)) {
-      errs() << argv[0]
-             << ": assembly parsed, but does not verify as correct!\n";
-      errs() << Err;
-      return 1;
+  // The bitcode of stdin goes to stdout, which has room for one version only.
+  if (State.Versions.size() > 1) {
+    for (unsigned i = 0, e = Jobs.size(); i != e; i++) {
+      if (Jobs[i].InputFilename == "-") {
+        errs() << argv[0] << ": reading from stdin needs a single bitcode "
+               << "version\n";
+        return 1;
+      }
     }
   }
 
-  if (DumpAsm) errs() << "Here's the assembly:\n" << *M.get();
+  pthread_mutex_init(&State.QueueLock, NULL);
 
-  if (!DisableOutput)
-    WriteOutputFile(M.get());
+  unsigned NumWorkers = std::min<size_t>(std::max(1U, (unsigned) NumJobs),
+                                         Jobs.size());
+  if (NumWorkers <= 1) {
+    AssembleWorker(&State);
+  } else {
+    // Make LLVM's lazily initialized globals (ManagedStatic) thread-safe.
+    llvm_start_multithreaded();
 
-  return 0;
+    std::vector<pthread_t> Workers(NumWorkers);
+    unsigned NumStarted = 0;
+    while (NumStarted < NumWorkers) {
+      if (pthread_create(&Workers[NumStarted], NULL, AssembleWorker,
+                         &State) != 0)
+        break;
+      NumStarted++;
+    }
+
+    // Fall back to do all the work on this thread if no worker could be
+    // started.
+    if (NumStarted == 0)
+      AssembleWorker(&State);
+
+    for (unsigned i = 0; i != NumStarted; i++)
+      pthread_join(Workers[i], NULL);
+  }
+  pthread_mutex_destroy(&State.QueueLock);
+
+  int Result = 0;
+  for (unsigned i = 0, e = Jobs.size(); i != e; i++) {
+    errs() << Jobs[i].Errors;
+    if (!Jobs[i].Success)
+      Result = 1;
+  }
+  return Result;
 }
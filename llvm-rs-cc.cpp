@@ -14,7 +14,9 @@
  * limitations under the License.
  */
 
+#include <algorithm>
 #include <cstdlib>
+#include <cstring>
 #include <list>
 #include <set>
 #include <string>
@@ -47,8 +49,16 @@
 #include "slang.h"
 #include "slang_assert.h"
 #include "slang_diagnostic_buffer.h"
+#include "slang_execution_profile.h"
 #include "slang_rs.h"
+#include "slang_rs_export_usage.h"
 #include "slang_rs_reflect_utils.h"
+#include "slang_rs_server.h"
+#include "slang_utils.h"
+
+// The embedded rslib.bc (see SlangData.mk)
+extern "C" const char rslib_bc[];
+extern "C" const unsigned rslib_bc_size;
 
 using clang::driver::options::DriverOption;
 using llvm::opt::arg_iterator;
@@ -163,6 +173,102 @@ class RSCCOptions {
   // The optimization level used in CodeGen, and encoded in emitted bitcode
   llvm::CodeGenOpt::Level mOptimizationLevel;
 
+  // Optimize for size (-Os)
+  unsigned mOptimizeSize : 1;
+
+  // The tuning of the optimization pipeline (-opt-profile)
+  slang::Slang::OptimizationProfile mOptimizationProfile;
+
+  // Link the helpers of rslib.bc into the module (-link-rslib)
+  unsigned mLinkRSLib : 1;
+
+  // The execution profile to optimize for, if any (-fprofile-use)
+  std::string mProfileFile;
+
+  // Emit the widened variants of the elementwise kernels (-widen-kernels)
+  unsigned mWidenKernels : 1;
+
+  // Encode the export info in the compact format (-metadata-format compact)
+  unsigned mCompactMetadata : 1;
+
+  // Count the calls and the time of the kernels (-instrument-kernels)
+  unsigned mInstrumentKernels : 1;
+
+  // Group the variables the kernels read (-layout-hot-globals)
+  unsigned mLayoutHotGlobals : 1;
+
+  // Describe the globals each kernel and invokable reads and writes
+  // (-export-access-sets)
+  unsigned mExportAccessSets : 1;
+
+  // The functions to remove the calls to (-strip-debug-calls, -strip-call)
+  std::vector<std::string> mStrippedCalls;
+
+  // ABIs to compile native objects for along with the bitcode (-aot-abi)
+  std::vector<std::string> mAOTABIs;
+
+  // Output types to write along with mOutputType (-also-emit and
+  // -emit-size-report)
+  std::vector<slang::Slang::OutputType> mExtraOutputTypes;
+
+  // Number of input files to compile in parallel
+  unsigned mNumJobs;
+
+  // Directory of the precompiled RS headers, if any
+  std::string mPCHCacheDir;
+
+  // Where to cache the results of compiling the input files
+  std::string mCompileCacheDir;
+
+  // The ODR database shared with the other compiles of the project
+  std::string mODRDatabase;
+
+  // The manifest of the exports used by the app, if any (-export-usage)
+  std::string mExportUsageFile;
+
+  // Where to describe the outputs of the whole compile (-batch-manifest)
+  std::string mBatchManifest;
+
+  // Reflect the VarBatch class (-reflect-var-batch)
+  unsigned mVarBatch : 1;
+
+  // Back the reflected ScriptField classes by a ByteBuffer
+  // (-reflect-scriptfield-buffer)
+  unsigned mScriptFieldBuffer : 1;
+
+  // Reuse a FieldPacker per invokable and kernel
+  // (-reflect-preallocated-packers)
+  unsigned mPreallocatedPackers : 1;
+
+  // Create what the script class needs on first use (-reflect-lazy-init)
+  unsigned mLazyInit : 1;
+
+  // Reflect the C++ script class in its header only
+  // (-reflect-c++-header-only)
+  unsigned mCppHeaderOnly : 1;
+
+  // Embed the bitcode in the C++ script class from an assembly file
+  // (-reflect-c++-bitcode-blob)
+  unsigned mCppBitcodeBlob : 1;
+
+  // Don't rewrite the unchanged reflected files
+  unsigned mWriteIfChanged : 1;
+
+  // Go through SlangRS::compileBuffer() (-compile-from-memory)
+  unsigned mCompileFromMemory : 1;
+
+  // Print the time of each phase (-time-report)
+  unsigned mTimeReport : 1;
+
+  // Write the time of each phase as JSON to this file, if any
+  std::string mTimeReportJSONFile;
+
+  // Write the diagnostics as they come (-stream-diagnostics)
+  unsigned mStreamDiagnostics : 1;
+
+  // Write the diagnostics as SARIF to this file, if any
+  std::string mDiagnosticsSARIFFile;
+
   RSCCOptions() {
     mOutputType = slang::Slang::OT_Bitcode;
     // Triple/CPU/Features must be hard-coded to our chosen portable ABI.
@@ -177,6 +283,25 @@ class RSCCOptions {
     mTargetAPI = RS_VERSION;
     mDebugEmission = 0;
     mOptimizationLevel = llvm::CodeGenOpt::Aggressive;
+    mOptimizeSize = 0;
+    mOptimizationProfile = slang::Slang::OP_Default;
+    mLinkRSLib = 0;
+    mWidenKernels = 0;
+    mCompactMetadata = 0;
+    mInstrumentKernels = 0;
+    mLayoutHotGlobals = 0;
+    mExportAccessSets = 0;
+    mNumJobs = 1;
+    mVarBatch = 0;
+    mScriptFieldBuffer = 0;
+    mPreallocatedPackers = 0;
+    mLazyInit = 0;
+    mCppHeaderOnly = 0;
+    mCppBitcodeBlob = 0;
+    mWriteIfChanged = 0;
+    mCompileFromMemory = 0;
+    mTimeReport = 0;
+    mStreamDiagnostics = 0;
   }
 };
 
@@ -198,7 +323,9 @@ static void ParseArguments(llvm::SmallVectorImpl<const char*> &ArgVector,
       DiagEngine.Report(clang::diag::err_drv_missing_argument)
         << Args->getArgString(MissingArgIndex) << MissingArgCount;
 
-    clang::DiagnosticOptions DiagOpts;
+    // Kept in the engine so that the same options can be applied to the
+    // diagnostics of every worker of a parallel compilation.
+    clang::DiagnosticOptions &DiagOpts = DiagEngine.getDiagnosticOptions();
     DiagOpts.IgnoreWarnings = Args->hasArg(OPT_w);
     DiagOpts.Warnings = Args->getAllArgValues(OPT_W);
     clang::ProcessWarningOptions(DiagEngine, DiagOpts);
@@ -218,6 +345,20 @@ static void ParseArguments(llvm::SmallVectorImpl<const char*> &ArgVector,
 
     Opts.mIncludePaths = Args->getAllArgValues(OPT_I);
 
+    Opts.mPCHCacheDir = Args->getLastArgValue(OPT_pch_cache_dir);
+    Opts.mCompileCacheDir = Args->getLastArgValue(OPT_compile_cache_dir);
+    Opts.mODRDatabase = Args->getLastArgValue(OPT_odr_db);
+    Opts.mExportUsageFile = Args->getLastArgValue(OPT_export_usage);
+    Opts.mBatchManifest = Args->getLastArgValue(OPT_batch_manifest);
+    Opts.mWriteIfChanged = Args->hasArg(OPT_write_if_changed);
+    Opts.mCompileFromMemory = Args->hasArg(OPT_compile_from_memory);
+
+    Opts.mTimeReport = Args->hasArg(OPT_time_report);
+    Opts.mTimeReportJSONFile = Args->getLastArgValue(OPT_time_report_json);
+
+    Opts.mStreamDiagnostics = Args->hasArg(OPT_stream_diagnostics);
+    Opts.mDiagnosticsSARIFFile = Args->getLastArgValue(OPT_diagnostics_sarif);
+
     Opts.mOutputDir = Args->getLastArgValue(OPT_o);
 
     if (const Arg *A = Args->getLastArg(OPT_M_Group)) {
@@ -262,6 +403,40 @@ static void ParseArguments(llvm::SmallVectorImpl<const char*> &ArgVector,
       }
     }
 
+    for (arg_iterator it = Args->filtered_begin(OPT_also_emit),
+        ie = Args->filtered_end(); it != ie; ++it) {
+      const Arg *A = *it;
+      llvm::StringRef Type = A->getValue();
+      slang::Slang::OutputType OT;
+      if (Type == "asm") {
+        OT = slang::Slang::OT_Assembly;
+      } else if (Type == "llvm") {
+        OT = slang::Slang::OT_LLVMAssembly;
+      } else if (Type == "bc") {
+        OT = slang::Slang::OT_Bitcode;
+      } else if (Type == "obj") {
+        OT = slang::Slang::OT_Object;
+      } else {
+        DiagEngine.Report(clang::diag::err_drv_invalid_value)
+            << A->getAsString(*Args) << Type;
+        continue;
+      }
+      // Its file would be the one of the output
+      if ((OT == Opts.mOutputType) ||
+          (std::find(Opts.mExtraOutputTypes.begin(),
+                     Opts.mExtraOutputTypes.end(),
+                     OT) != Opts.mExtraOutputTypes.end()))
+        continue;
+      Opts.mExtraOutputTypes.push_back(OT);
+    }
+    if (!Opts.mExtraOutputTypes.empty() &&
+        ((Opts.mOutputType == slang::Slang::OT_Dependency) ||
+         (Opts.mOutputType == slang::Slang::OT_Nothing)))
+      DiagEngine.Report(clang::diag::err_drv_argument_not_allowed_with)
+          << "-also-emit"
+          << Args->getLastArg(OPT_M_Group, OPT_Output_Type_Group)
+                 ->getAsString(*Args);
+
     if (Opts.mOutputDep &&
         ((Opts.mOutputType != slang::Slang::OT_Bitcode) &&
          (Opts.mOutputType != slang::Slang::OT_Dependency)))
@@ -284,11 +459,38 @@ static void ParseArguments(llvm::SmallVectorImpl<const char*> &ArgVector,
       Opts.mBitcodeStorage = slang::BCST_APK_RESOURCE;
     else if (BitcodeStorageValue == "jc")
       Opts.mBitcodeStorage = slang::BCST_JAVA_CODE;
+    else if (BitcodeStorageValue == "js")
+      Opts.mBitcodeStorage = slang::BCST_JAVA_STRING;
     else if (!BitcodeStorageValue.empty())
       DiagEngine.Report(clang::diag::err_drv_invalid_value)
           << OptParser->getOptionName(OPT_bitcode_storage)
           << BitcodeStorageValue;
 
+    llvm::StringRef MetadataFormatValue =
+        Args->getLastArgValue(OPT_metadata_format);
+    if (MetadataFormatValue == "compact")
+      Opts.mCompactMetadata = 1;
+    else if (!MetadataFormatValue.empty() &&
+             (MetadataFormatValue != "verbose"))
+      DiagEngine.Report(clang::diag::err_drv_invalid_value)
+          << OptParser->getOptionName(OPT_metadata_format)
+          << MetadataFormatValue;
+
+    Opts.mVarBatch = Args->hasArg(OPT_reflect_var_batch);
+    Opts.mScriptFieldBuffer = Args->hasArg(OPT_reflect_scriptfield_buffer);
+    Opts.mPreallocatedPackers =
+        Args->hasArg(OPT_reflect_preallocated_packers);
+    Opts.mLazyInit = Args->hasArg(OPT_reflect_lazy_init);
+
+    Opts.mCppHeaderOnly = Args->hasArg(OPT_reflect_cpp_header_only);
+    if (Opts.mCppHeaderOnly && !Args->hasArg(OPT_reflect_cpp))
+      DiagEngine.Report(clang::diag::err_drv_argument_only_allowed_with)
+          << "-reflect-c++-header-only" << "-reflect-c++";
+    Opts.mCppBitcodeBlob = Args->hasArg(OPT_reflect_cpp_bitcode_blob);
+    if (Opts.mCppBitcodeBlob && !Args->hasArg(OPT_reflect_cpp))
+      DiagEngine.Report(clang::diag::err_drv_argument_only_allowed_with)
+          << "-reflect-c++-bitcode-blob" << "-reflect-c++";
+
     if (Args->hasArg(OPT_reflect_cpp)) {
       Opts.mBitcodeStorage = slang::BCST_CPP_CODE;
       // mJavaReflectionPathBase isn't set for C++ reflected builds
@@ -304,20 +506,99 @@ static void ParseArguments(llvm::SmallVectorImpl<const char*> &ArgVector,
 
     Opts.mShowHelp = Args->hasArg(OPT_help);
     Opts.mShowVersion = Args->hasArg(OPT_version);
-    Opts.mDebugEmission = Args->hasArg(OPT_emit_g);
+    Opts.mDebugEmission = Args->hasArg(OPT_emit_g) ||
+                          Args->hasArg(OPT_emit_gsplit);
+
+    if (const Arg *A = Args->getLastArg(OPT_optimization_level)) {
+      llvm::StringRef OptLevel = A->getValue();
+      unsigned Level;
+      if (OptLevel == "s") {
+        Opts.mOptimizationLevel = llvm::CodeGenOpt::Default;
+        Opts.mOptimizeSize = 1;
+      } else if (!OptLevel.getAsInteger(10, Level) && (Level <= 3)) {
+        Opts.mOptimizationLevel = static_cast<llvm::CodeGenOpt::Level>(Level);
+      } else {
+        DiagEngine.Report(clang::diag::err_drv_invalid_value)
+            << A->getAsString(*Args) << OptLevel;
+      }
+    }
 
-    size_t OptLevel = clang::getLastArgIntValue(*Args,
-                                                OPT_optimization_level,
-                                                3,
-                                                DiagEngine);
+    Opts.mAOTABIs = Args->getAllArgValues(OPT_aot_abi);
+    for (unsigned i = 0, e = Opts.mAOTABIs.size(); i != e; i++) {
+      std::string Triple, CPU, Features;
+      if (!slang::Slang::GetAOTTarget(Opts.mAOTABIs[i], &Triple, &CPU,
+                                      &Features))
+        DiagEngine.Report(clang::diag::err_drv_invalid_value)
+            << "-aot-abi" << Opts.mAOTABIs[i];
+    }
+    if (!Opts.mAOTABIs.empty() &&
+        (Opts.mOutputType != slang::Slang::OT_Bitcode))
+      DiagEngine.Report(clang::diag::err_drv_argument_only_allowed_with)
+          << "-aot-abi" << "-emit-bc";
 
-    Opts.mOptimizationLevel = OptLevel == 0 ? llvm::CodeGenOpt::None
-                                            : llvm::CodeGenOpt::Aggressive;
+    if (Args->hasArg(OPT_emit_size_report)) {
+      if (Opts.mOutputType == slang::Slang::OT_Bitcode)
+        Opts.mExtraOutputTypes.push_back(slang::Slang::OT_SizeReport);
+      else
+        DiagEngine.Report(clang::diag::err_drv_argument_only_allowed_with)
+            << "-emit-size-report" << "-emit-bc";
+    }
+
+    if (Args->hasArg(OPT_emit_gsplit)) {
+      if (Opts.mOutputType == slang::Slang::OT_Bitcode)
+        Opts.mExtraOutputTypes.push_back(slang::Slang::OT_DebugInfo);
+      else
+        DiagEngine.Report(clang::diag::err_drv_argument_only_allowed_with)
+            << "-gsplit" << "-emit-bc";
+    }
+
+    if (Args->hasArg(OPT_emit_kernel_report)) {
+      if ((Opts.mOutputType != slang::Slang::OT_Dependency) &&
+          (Opts.mOutputType != slang::Slang::OT_Nothing))
+        Opts.mExtraOutputTypes.push_back(slang::Slang::OT_KernelReport);
+      else
+        DiagEngine.Report(clang::diag::err_drv_argument_not_allowed_with)
+            << "-emit-kernel-report"
+            << Args->getLastArg(OPT_M_Group, OPT_Output_Type_Group)
+                   ->getAsString(*Args);
+    }
+
+    if (const Arg *A = Args->getLastArg(OPT_opt_profile)) {
+      llvm::StringRef Profile = A->getValue();
+      if (Profile == "kernel")
+        Opts.mOptimizationProfile = slang::Slang::OP_Kernel;
+      else if (Profile != "default")
+        DiagEngine.Report(clang::diag::err_drv_invalid_value)
+            << A->getAsString(*Args) << Profile;
+    }
+
+    Opts.mLinkRSLib = Args->hasArg(OPT_link_rslib);
+    Opts.mProfileFile = Args->getLastArgValue(OPT_fprofile_use_EQ);
+    Opts.mWidenKernels = Args->hasArg(OPT_widen_kernels);
+
+    // The counters are found through the entry of RS_EXPORT_VAR_MN.
+    Opts.mInstrumentKernels = Args->hasArg(OPT_instrument_kernels);
+    if (Opts.mInstrumentKernels && Opts.mCompactMetadata)
+      DiagEngine.Report(clang::diag::err_drv_argument_not_allowed_with)
+          << "-instrument-kernels" << "-metadata-format compact";
+    Opts.mLayoutHotGlobals = Args->hasArg(OPT_layout_hot_globals);
+    Opts.mExportAccessSets = Args->hasArg(OPT_export_access_sets);
+
+    Opts.mStrippedCalls = Args->getAllArgValues(OPT_strip_call);
+    if (Args->hasArg(OPT_strip_debug_calls))
+      Opts.mStrippedCalls.push_back("rsDebug");
 
     Opts.mTargetAPI = clang::getLastArgIntValue(*Args,
                                                 OPT_target_api,
                                                 RS_VERSION,
                                                 DiagEngine);
+
+    int NumJobs = clang::getLastArgIntValue(*Args, OPT_jobs, 1, DiagEngine);
+    if (NumJobs < 1)
+      DiagEngine.Report(clang::diag::err_drv_invalid_value)
+          << Args->getLastArg(OPT_jobs)->getAsString(*Args) << NumJobs;
+    else
+      Opts.mNumJobs = NumJobs;
   }
 
   return;
@@ -376,6 +657,90 @@ static const char *DetermineOutputFile(const std::string &OutputDir,
   return SaveStringInSet(SavedStrings, OutputFile);
 }
 
+// Write Data to File, which compile() would have written, as
+// -compile-from-memory.
+static bool WriteOutput(const std::string &File, const std::string &Data,
+                        clang::DiagnosticsEngine &DiagEngine) {
+  std::string Error;
+  llvm::StringRef Dir = llvm::sys::path::parent_path(File);
+  if ((!Dir.empty() &&
+       !slang::SlangUtils::CreateDirectoryWithParents(Dir, &Error)) ||
+      !slang::SlangUtils::WriteFileAtomically(File, Data, &Error)) {
+    DiagEngine.Report(DiagEngine.getCustomDiagID(
+        clang::DiagnosticsEngine::Error, "unable to write '%0': %1"))
+        << File << Error;
+    return false;
+  }
+  llvm::outs() << "Writing " << File << " from memory\n";
+  return true;
+}
+
+// Compile the inputs with compileBuffer() rather than compile(), as the tools
+// holding the sources in memory do. Only the bitcode (stored as a resource),
+// the dependency files and the Java reflection are supported.
+static bool CompileFromMemory(
+    slang::SlangRS *Compiler, const RSCCOptions &Opts,
+    const std::list<std::pair<const char*, const char*> > &IOFiles,
+    const std::list<std::pair<const char*, const char*> > &DepFiles,
+    clang::DiagnosticsEngine &DiagEngine) {
+  if ((Opts.mOutputType != slang::Slang::OT_Bitcode) ||
+      (Opts.mBitcodeStorage != slang::BCST_APK_RESOURCE) ||
+      !Opts.mExtraOutputTypes.empty()) {
+    DiagEngine.Report(DiagEngine.getCustomDiagID(
+        clang::DiagnosticsEngine::Error,
+        "-compile-from-memory only emits bitcode as an APK resource"));
+    return false;
+  }
+
+  std::list<std::pair<const char*, const char*> >::const_iterator
+      DI = DepFiles.begin();
+  for (std::list<std::pair<const char*, const char*> >::const_iterator
+           I = IOFiles.begin(), E = IOFiles.end();
+       I != E;
+       I++) {
+    llvm::OwningPtr<llvm::MemoryBuffer> MB;
+    llvm::error_code EC = llvm::MemoryBuffer::getFile(I->first, MB);
+    if (EC != llvm::errc::success) {
+      DiagEngine.Report(DiagEngine.getCustomDiagID(
+          clang::DiagnosticsEngine::Error, "unable to read '%0': %1"))
+          << I->first << EC.message();
+      return false;
+    }
+
+    slang::SlangRS::BufferJob Job;
+    Job.InputFile = I->first;
+    Job.Text = MB->getBufferStart();
+    Job.TextLength = MB->getBufferSize();
+    Job.OutputFile = I->second;
+    if (!Compiler->compileBuffer(&Job,
+                                 Opts.mIncludePaths,
+                                 Opts.mAdditionalDepTargets,
+                                 Opts.mAllowRSPrefix,
+                                 Opts.mOutputDep,
+                                 Opts.mTargetAPI,
+                                 Opts.mDebugEmission,
+                                 Opts.mOptimizationLevel,
+                                 Opts.mJavaReflectionPathBase,
+                                 Opts.mJavaReflectionPackageName,
+                                 Opts.mRSPackageName))
+      return false;
+
+    if (!WriteOutput(Job.OutputFile, Job.Bitcode, DiagEngine))
+      return false;
+    if (Opts.mOutputDep) {
+      if (!WriteOutput(DI->second, Job.Dependencies, DiagEngine))
+        return false;
+      DI++;
+    }
+    for (unsigned i = 0, e = Job.ReflectedFiles.size(); i != e; i++) {
+      if (!WriteOutput(Job.ReflectedFiles[i].first,
+                       Job.ReflectedFiles[i].second, DiagEngine))
+        return false;
+    }
+  }
+  return true;
+}
+
 #define str(s) #s
 #define wrap_str(s) str(s)
 static void llvm_rs_cc_VersionPrinter() {
@@ -396,15 +761,15 @@ static void llvm_rs_cc_VersionPrinter() {
 #undef wrap_str
 #undef str
 
-int main(int argc, const char **argv) {
+// Does the work of a single llvm-rs-cc invocation, either directly from
+// main() or on behalf of a client of the compiler server.
+static int Compile(int argc, const char **argv) {
   std::set<std::string> SavedStrings;
   llvm::SmallVector<const char*, 256> ArgVector;
   RSCCOptions Opts;
   llvm::SmallVector<const char*, 16> Inputs;
   std::string Argv0;
 
-  atexit(llvm::llvm_shutdown);
-
   ExpandArgv(argc, argv, ArgVector, SavedStrings);
 
   // Argv0
@@ -449,6 +814,34 @@ int main(int argc, const char **argv) {
     return 1;
   }
 
+  // Shared by all the input files
+  slang::ExecutionProfile Profile;
+  if (!Opts.mProfileFile.empty()) {
+    std::string Error;
+    if (!Profile.read(Opts.mProfileFile, &Error)) {
+      DiagEngine.Report(DiagEngine.getCustomDiagID(
+          clang::DiagnosticsEngine::Error, "unable to read profile '%0': %1"))
+          << Opts.mProfileFile << Error;
+      llvm::errs() << DiagClient->str();
+      return 1;
+    }
+  }
+
+  slang::RSExportUsage ExportUsage;
+  if (!Opts.mExportUsageFile.empty()) {
+    std::string Error;
+    if (!ExportUsage.read(Opts.mExportUsageFile, &Error)) {
+      DiagEngine.Report(DiagEngine.getCustomDiagID(
+          clang::DiagnosticsEngine::Error,
+          "unable to read export usage '%0': %1"))
+          << Opts.mExportUsageFile << Error;
+      llvm::errs() << DiagClient->str();
+      return 1;
+    }
+  }
+
+  DiagClient->setStreaming(Opts.mStreamDiagnostics);
+
   // Prepare input data for RS compiler.
   std::list<std::pair<const char*, const char*> > IOFiles;
   std::list<std::pair<const char*, const char*> > DepFiles;
@@ -489,27 +882,113 @@ int main(int argc, const char **argv) {
     IOFiles.push_back(std::make_pair(InputFile, OutputFile));
   }
 
+  Compiler->setNumJobs(Opts.mNumJobs);
+  Compiler->setPCHCacheDir(Opts.mPCHCacheDir);
+  Compiler->setCompileCacheDir(Opts.mCompileCacheDir);
+  Compiler->setODRDatabase(Opts.mODRDatabase);
+  if (!Opts.mExportUsageFile.empty())
+    Compiler->setExportUsage(&ExportUsage);
+  Compiler->setBatchManifest(Opts.mBatchManifest);
+  Compiler->setWriteIfChanged(Opts.mWriteIfChanged);
+  Compiler->setVarBatch(Opts.mVarBatch);
+  Compiler->setScriptFieldBuffer(Opts.mScriptFieldBuffer);
+  Compiler->setPreallocatedPackers(Opts.mPreallocatedPackers);
+  Compiler->setLazyInit(Opts.mLazyInit);
+  Compiler->setCppHeaderOnly(Opts.mCppHeaderOnly);
+  Compiler->setCppBitcodeBlob(Opts.mCppBitcodeBlob);
+  Compiler->setWidenKernels(Opts.mWidenKernels);
+  Compiler->setCompactMetadata(Opts.mCompactMetadata);
+  Compiler->setInstrumentKernels(Opts.mInstrumentKernels);
+  Compiler->setLayoutHotGlobals(Opts.mLayoutHotGlobals);
+  Compiler->setExportAccessSets(Opts.mExportAccessSets);
+  Compiler->setStrippedCalls(Opts.mStrippedCalls);
+  Compiler->setOptimizeSize(Opts.mOptimizeSize);
+  Compiler->setOptimizationProfile(Opts.mOptimizationProfile);
+  if (Opts.mLinkRSLib)
+    Compiler->setRuntimeLibrary(llvm::StringRef(rslib_bc, rslib_bc_size));
+  if (!Opts.mProfileFile.empty())
+    Compiler->setProfile(&Profile);
+  Compiler->setAOTABIs(Opts.mAOTABIs);
+  Compiler->setExtraOutputTypes(Opts.mExtraOutputTypes);
+  if (Opts.mTimeReport || !Opts.mTimeReportJSONFile.empty())
+    Compiler->enableTimeReport();
+
   // Let's rock!
-  int CompileFailed = !Compiler->compile(IOFiles,
-                                         DepFiles,
-                                         Opts.mIncludePaths,
-                                         Opts.mAdditionalDepTargets,
-                                         Opts.mOutputType,
-                                         Opts.mBitcodeStorage,
-                                         Opts.mAllowRSPrefix,
-                                         Opts.mOutputDep,
-                                         Opts.mTargetAPI,
-                                         Opts.mDebugEmission,
-                                         Opts.mOptimizationLevel,
-                                         Opts.mJavaReflectionPathBase,
-                                         Opts.mJavaReflectionPackageName,
-                                         Opts.mRSPackageName);
+  int CompileFailed;
+  if (Opts.mCompileFromMemory)
+    CompileFailed = !CompileFromMemory(Compiler.get(), Opts, IOFiles, DepFiles,
+                                       DiagEngine);
+  else
+    CompileFailed = !Compiler->compile(IOFiles,
+                                       DepFiles,
+                                       Opts.mIncludePaths,
+                                       Opts.mAdditionalDepTargets,
+                                       Opts.mOutputType,
+                                       Opts.mBitcodeStorage,
+                                       Opts.mAllowRSPrefix,
+                                       Opts.mOutputDep,
+                                       Opts.mTargetAPI,
+                                       Opts.mDebugEmission,
+                                       Opts.mOptimizationLevel,
+                                       Opts.mJavaReflectionPathBase,
+                                       Opts.mJavaReflectionPackageName,
+                                       Opts.mRSPackageName);
 
   Compiler->reset();
 
+  if (Opts.mTimeReport)
+    Compiler->getTimeReport()->print(llvm::errs());
+
+  if (!Opts.mTimeReportJSONFile.empty()) {
+    std::string Error;
+    llvm::raw_fd_ostream JSON(Opts.mTimeReportJSONFile.c_str(), Error);
+    if (Error.empty())
+      Compiler->getTimeReport()->printJSON(JSON);
+    else
+      llvm::errs() << "error: unable to write time report to '"
+                   << Opts.mTimeReportJSONFile << "': " << Error << "\n";
+  }
+
+  if (!Opts.mDiagnosticsSARIFFile.empty()) {
+    std::string Error;
+    if (!DiagClient->writeSARIF(Opts.mDiagnosticsSARIFFile, &Error))
+      llvm::errs() << "error: unable to write diagnostics to '"
+                   << Opts.mDiagnosticsSARIFFile << "': " << Error << "\n";
+  }
+
   return CompileFailed;
 }
 
+int main(int argc, const char **argv) {
+  atexit(llvm::llvm_shutdown);
+
+  // llvm-rs-cc --server <socket>
+  //   Keep this process (with all the global initialization done) around and
+  //   serve the compilations requested through <socket>.
+  //
+  // llvm-rs-cc --connect <socket> <options and inputs>...
+  //   Have the server at <socket> do the compilation. Falls back to compile
+  //   in this process if no server is listening.
+  if ((argc >= 3) && (::strcmp(argv[1], "--server") == 0)) {
+    slang::Slang::GlobalInitialization();
+    return slang::RSServer::Serve(argv[2], Compile);
+  }
+
+  if ((argc >= 3) && (::strcmp(argv[1], "--connect") == 0)) {
+    const char *SocketPath = argv[2];
+    // Drop "--connect <socket>" from the command line
+    argv[2] = argv[0];
+    argc -= 2;
+    argv += 2;
+
+    int ExitCode;
+    if (slang::RSServer::Connect(SocketPath, argc, argv, &ExitCode))
+      return ExitCode;
+  }
+
+  return Compile(argc, argv);
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 
 // ExpandArgsFromBuf -
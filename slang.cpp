@@ -34,11 +34,10 @@
 #include "clang/Basic/TargetOptions.h"
 
 #include "clang/Frontend/CodeGenOptions.h"
-#include "clang/Frontend/DependencyOutputOptions.h"
 #include "clang/Frontend/FrontendDiagnostic.h"
 #include "clang/Frontend/TextDiagnosticPrinter.h"
-#include "clang/Frontend/Utils.h"
 
+#include "clang/Lex/PPCallbacks.h"
 #include "clang/Lex/Preprocessor.h"
 #include "clang/Lex/PreprocessorOptions.h"
 #include "clang/Lex/HeaderSearch.h"
@@ -46,10 +45,17 @@
 
 #include "clang/Parse/ParseAST.h"
 
+#include "clang/Serialization/ASTReader.h"
+#include "clang/Serialization/ASTWriter.h"
+
 #include "llvm/ADT/IntrusiveRefCntPtr.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallPtrSet.h"
 
 #include "llvm/Bitcode/ReaderWriter.h"
 
+#include "llvm/IR/LLVMContext.h"
+
 // More force linking
 #include "llvm/Linker.h"
 
@@ -67,6 +73,7 @@
 
 #include "slang_assert.h"
 #include "slang_backend.h"
+#include "slang_header_cache.h"
 #include "slang_utils.h"
 
 namespace {
@@ -105,6 +112,10 @@ namespace slang {
 
 bool Slang::GlobalInitialized = false;
 
+bool Slang::ErrorHandlerInstalled = false;
+
+llvm::sys::ThreadLocal<Slang> Slang::ThreadInstance;
+
 // Language option (define the language feature for compiler such as C99)
 clang::LangOptions Slang::LangOpts;
 
@@ -114,6 +125,7 @@ clang::CodeGenOptions Slang::CodeGenOpts;
 // The named of metadata node that pragma resides (should be synced with
 // bcc.cpp)
 const llvm::StringRef Slang::PragmaMetadataName = "#pragma";
+const llvm::StringRef Slang::DebugInfoKeyMetadataName = "#rs_debug_info_key";
 
 static inline llvm::tool_output_file *
 OpenOutputFile(const char *OutputFile,
@@ -138,6 +150,82 @@ OpenOutputFile(const char *OutputFile,
   return NULL;
 }
 
+namespace {
+
+// Collects the files entered by the preprocessor as the dependencies of the
+// input (which is the first one).
+class DependencyCollector : public clang::PPCallbacks {
+ private:
+  Slang *mSlang;
+  const clang::SourceManager &mSourceMgr;
+
+ public:
+  DependencyCollector(Slang *S, const clang::SourceManager &SourceMgr)
+      : mSlang(S), mSourceMgr(SourceMgr) {
+  }
+
+  virtual void FileChanged(clang::SourceLocation Loc,
+                           FileChangeReason Reason,
+                           clang::SrcMgr::CharacteristicKind FileType,
+                           clang::FileID PrevFID) {
+    if (Reason != EnterFile)
+      return;
+
+    // Go all the way to the file entry, #line markers must not affect the
+    // dependencies.
+    const clang::FileEntry *FE = mSourceMgr.getFileEntryForID(
+        mSourceMgr.getFileID(mSourceMgr.getExpansionLoc(Loc)));
+    if (FE != NULL)
+      mSlang->addDependency(FE->getName());
+  }
+};
+
+// Gives the source manager the shared content of the headers found on the
+// include paths (see HeaderCache) before they're entered.
+class HeaderCacheUser : public clang::PPCallbacks {
+ private:
+  clang::SourceManager &mSourceMgr;
+  llvm::SmallPtrSet<const clang::DirectoryEntry*, 4> mIncludeDirs;
+  // The buffers given to mSourceMgr, to be released after it
+  std::vector<const llvm::MemoryBuffer*> &mBuffers;
+
+ public:
+  HeaderCacheUser(clang::SourceManager &SourceMgr,
+                  const clang::HeaderSearch &HeaderInfo,
+                  std::vector<const llvm::MemoryBuffer*> &Buffers)
+      : mSourceMgr(SourceMgr), mBuffers(Buffers) {
+    for (clang::HeaderSearch::search_dir_iterator
+             I = HeaderInfo.search_dir_begin(),
+             E = HeaderInfo.search_dir_end();
+         I != E;
+         I++)
+      mIncludeDirs.insert(I->getDir());
+  }
+
+  virtual void InclusionDirective(clang::SourceLocation HashLoc,
+                                  const clang::Token &IncludeTok,
+                                  llvm::StringRef FileName,
+                                  bool IsAngled,
+                                  clang::CharSourceRange FilenameRange,
+                                  const clang::FileEntry *File,
+                                  llvm::StringRef SearchPath,
+                                  llvm::StringRef RelativePath,
+                                  const clang::Module *Imported) {
+    // The source manager keeps the content of a file across compiles, so
+    // only the first inclusion of each header matters.
+    if ((File == NULL) || !mIncludeDirs.count(File->getDir()) ||
+        mSourceMgr.isFileOverridden(File))
+      return;
+
+    if (const llvm::MemoryBuffer *MB = HeaderCache::GetBuffer(File)) {
+      mSourceMgr.overrideFileContents(File, MB, /* DoNotFree = */true);
+      mBuffers.push_back(MB);
+    }
+  }
+};
+
+}  // namespace
+
 void Slang::GlobalInitialization() {
   if (!GlobalInitialized) {
     // We only support x86, x64 and ARM target
@@ -166,8 +254,48 @@ void Slang::GlobalInitialization() {
   }
 }
 
+namespace {
+
+struct AOTTargetInfo {
+  const char *ABI;
+  const char *Triple;
+  const char *CPU;
+  const char *Features;
+};
+
+// The bitcode follows the 32-bit ABI of armv7-none-linux-gnueabi, which the
+// device compiler also retargets to x86. There's no arm64 here, its objects
+// need bitcode with 64-bit pointers.
+static const AOTTargetInfo AOTTargets[] = {
+  { "armeabi-v7a", "armv7-none-linux-gnueabi", "cortex-a9", "+neon" },
+  { "x86", "i686-unknown-linux", "atom", "" },
+};
+
+}  // namespace
+
+bool Slang::GetAOTTarget(llvm::StringRef ABI, std::string *Triple,
+                         std::string *CPU, std::string *Features) {
+  for (unsigned i = 0; i != llvm::array_lengthof(AOTTargets); i++) {
+    if (ABI == AOTTargets[i].ABI) {
+      Triple->assign(AOTTargets[i].Triple);
+      CPU->assign(AOTTargets[i].CPU);
+      Features->assign(AOTTargets[i].Features);
+      return true;
+    }
+  }
+  return false;
+}
+
 void Slang::LLVMErrorHandler(void *UserData, const std::string &Message,
                              bool GenCrashDialog) {
+  Slang *Instance = ThreadInstance.get();
+  if (Instance != NULL) {
+    Instance->getDiagnostics().Report(clang::diag::err_fe_error_backend)
+        << Message;
+    Instance->handleFatalError();
+  }
+
+  // Not on the thread of any instance (e.g., the reflection thread)
   clang::DiagnosticsEngine* DiagEngine =
     static_cast<clang::DiagnosticsEngine *>(UserData);
 
@@ -175,6 +303,13 @@ void Slang::LLVMErrorHandler(void *UserData, const std::string &Message,
   exit(1);
 }
 
+void Slang::handleFatalError() {
+  // A streaming buffer has written them already.
+  if (!mDiagClient->isStreaming())
+    llvm::errs() << mDiagClient->str();
+  exit(1);
+}
+
 void Slang::createTarget(const std::string &Triple, const std::string &CPU,
                          const std::vector<std::string> &Features) {
   if (!Triple.empty())
@@ -201,15 +336,46 @@ void Slang::createSourceManager() {
   mSourceMgr.reset(new clang::SourceManager(*mDiagEngine, *mFileMgr));
 }
 
-void Slang::createPreprocessor() {
+void Slang::prepareHeaderSearch() {
+  if ((mHeaderSearch.get() != NULL) && (mHeaderSearchPaths == mIncludePaths)) {
+    // The directories and the lookups on them stay, but what's known about
+    // the headers (e.g., their include guards) is per compile, and so is the
+    // PCH reader of the last one.
+    mHeaderSearch->ClearFileInfo();
+    mHeaderSearch->SetExternalLookup(NULL);
+    mHeaderSearch->SetExternalSource(NULL);
+    return;
+  }
+
   // Default only search header file in current dir
   llvm::IntrusiveRefCntPtr<clang::HeaderSearchOptions> HSOpts =
       new clang::HeaderSearchOptions();
-  clang::HeaderSearch *HeaderInfo = new clang::HeaderSearch(HSOpts,
-                                                            *mFileMgr,
-                                                            *mDiagEngine,
-                                                            LangOpts,
-                                                            mTarget.get());
+  mHeaderSearch.reset(new clang::HeaderSearch(HSOpts,
+                                              *mFileMgr,
+                                              *mDiagEngine,
+                                              LangOpts,
+                                              mTarget.get()));
+
+  std::vector<clang::DirectoryLookup> SearchList;
+  for (unsigned i = 0, e = mIncludePaths.size(); i != e; i++) {
+    if (const clang::DirectoryEntry *DE =
+            mFileMgr->getDirectory(mIncludePaths[i])) {
+      SearchList.push_back(clang::DirectoryLookup(DE,
+                                                  clang::SrcMgr::C_System,
+                                                  false));
+    }
+  }
+
+  mHeaderSearch->SetSearchPaths(SearchList,
+                                /* angledDirIdx = */1,
+                                /* systemDixIdx = */1,
+                                /* noCurDirSearch = */false);
+  mHeaderSearchPaths = mIncludePaths;
+  return;
+}
+
+void Slang::createPreprocessor() {
+  prepareHeaderSearch();
 
   llvm::IntrusiveRefCntPtr<clang::PreprocessorOptions> PPOpts =
       new clang::PreprocessorOptions();
@@ -218,51 +384,99 @@ void Slang::createPreprocessor() {
                                     LangOpts,
                                     mTarget.get(),
                                     *mSourceMgr,
-                                    *HeaderInfo,
+                                    *mHeaderSearch,
                                     *this,
                                     NULL,
-                                    /* OwnsHeaderSearch = */true));
+                                    /* OwnsHeaderSearch = */false));
   // Initialize the preprocessor
   mPragmas.clear();
   mPP->AddPragmaHandler(new PragmaRecorder(&mPragmas));
 
-  std::vector<clang::DirectoryLookup> SearchList;
-  for (unsigned i = 0, e = mIncludePaths.size(); i != e; i++) {
-    if (const clang::DirectoryEntry *DE =
-            mFileMgr->getDirectory(mIncludePaths[i])) {
-      SearchList.push_back(clang::DirectoryLookup(DE,
-                                                  clang::SrcMgr::C_System,
-                                                  false));
-    }
-  }
-
-  HeaderInfo->SetSearchPaths(SearchList,
-                             /* angledDirIdx = */1,
-                             /* systemDixIdx = */1,
-                             /* noCurDirSearch = */false);
+  mPP->addPPCallbacks(new HeaderCacheUser(*mSourceMgr, *mHeaderSearch,
+                                          mHeaderBuffers));
 
   initPreprocessor();
 }
 
+clang::ASTContext *Slang::newASTContext() {
+  return new clang::ASTContext(LangOpts,
+                               *mSourceMgr,
+                               mTarget.get(),
+                               mPP->getIdentifierTable(),
+                               mPP->getSelectorTable(),
+                               mPP->getBuiltinInfo(),
+                               /* size_reserve = */0);
+}
+
 void Slang::createASTContext() {
-  mASTContext.reset(new clang::ASTContext(LangOpts,
-                                          *mSourceMgr,
-                                          mTarget.get(),
-                                          mPP->getIdentifierTable(),
-                                          mPP->getSelectorTable(),
-                                          mPP->getBuiltinInfo(),
-                                          /* size_reserve = */0));
+  mASTContext.reset(newASTContext());
+
+  // The name of the PCH is derived from the content of the headers it was
+  // built from, so skip the validation on load (which would also reject a PCH
+  // whose headers were merely touched). The options it was built with are
+  // checked up front instead: the language, the target and the macros of the
+  // preprocessor options (e.g., the target API), which the predefines
+  // suggested by the reader would otherwise take as they are.
+  if (!mPCHFileName.empty() &&
+      clang::ASTReader::isAcceptableASTFile(mPCHFileName, *mFileMgr, LangOpts,
+                                            getTargetOptions(),
+                                            mPP->getPreprocessorOpts())) {
+    clang::ASTReader *Reader =
+        new clang::ASTReader(*mPP, *mASTContext, /* isysroot = */"",
+                             /* DisableValidation = */true);
+    // Let the reader fail silently on a PCH we can't use, parsing the headers
+    // is always an option.
+    unsigned Capabilities = clang::ASTReader::ARR_Missing |
+                            clang::ASTReader::ARR_OutOfDate |
+                            clang::ASTReader::ARR_VersionMismatch |
+                            clang::ASTReader::ARR_ConfigurationMismatch;
+    if (Reader->ReadAST(mPCHFileName, clang::serialization::MK_PCH,
+                        clang::SourceLocation(), Capabilities) ==
+        clang::ASTReader::Success) {
+      // The headers are in the PCH already, don't let the predefines include
+      // them again.
+      mPP->setPredefines(Reader->getSuggestedPredefines());
+      llvm::OwningPtr<clang::ExternalASTSource> Source(Reader);
+      mASTContext->setExternalSource(Source);
+
+      // The headers in the PCH are never entered by the preprocessor, so
+      // make their files the dependencies of the input directly.
+      if (collectsDependencies()) {
+        for (unsigned i = 0, e = mSourceMgr->loaded_sloc_entry_size();
+             i != e;
+             i++) {
+          bool Invalid = false;
+          const clang::SrcMgr::SLocEntry &Entry =
+              mSourceMgr->getLoadedSLocEntry(i, &Invalid);
+          if (Invalid || !Entry.isFile())
+            continue;
+          const clang::SrcMgr::ContentCache *Content =
+              Entry.getFile().getContentCache();
+          if ((Content != NULL) && (Content->OrigEntry != NULL))
+            addDependency(Content->OrigEntry->getName());
+        }
+      }
+    } else {
+      delete Reader;
+    }
+  }
+
   initASTContext();
 }
 
 clang::ASTConsumer *
 Slang::createBackend(const clang::CodeGenOptions& CodeGenOpts,
-                     llvm::raw_ostream *OS, OutputType OT) {
-  return new Backend(mDiagEngine, CodeGenOpts, getTargetOptions(),
-                     &mPragmas, OS, OT);
+                     llvm::raw_fd_ostream *OS, std::string *OutputBuffer,
+                     OutputType OT) {
+  return new Backend(mDiagEngine, getLLVMContext(), CodeGenOpts,
+                     getTargetOptions(), &mPragmas, OS, OutputBuffer, OT,
+                     &mExtraOutputs, mRuntimeLibrary, mProfile,
+                     getTimeReport());
 }
 
-Slang::Slang() : mInitialized(false), mDiagClient(NULL), mOT(OT_Default) {
+Slang::Slang() : mInitialized(false), mDiagClient(NULL), mOT(OT_Default),
+                 mOutputBuffer(NULL), mDepOutputBuffer(NULL),
+                 mProfile(NULL), mCollectDependencies(false) {
   mTargetOpts = new clang::TargetOptions();
   GlobalInitialization();
 }
@@ -278,7 +492,11 @@ void Slang::init(const std::string &Triple, const std::string &CPU,
   mDiagClient = DiagClient;
   mDiag.reset(new clang::Diagnostic(mDiagEngine));
   initDiagnostic();
-  llvm::install_fatal_error_handler(LLVMErrorHandler, mDiagEngine);
+  if (!ErrorHandlerInstalled) {
+    llvm::install_fatal_error_handler(LLVMErrorHandler, mDiagEngine);
+    ErrorHandlerInstalled = true;
+  }
+  ThreadInstance.set(this);
 
   createTarget(Triple, CPU, Features);
   createFileManager();
@@ -304,9 +522,9 @@ bool Slang::setInputSource(llvm::StringRef InputFile,
   // Reset the ID tables if we are reusing the SourceManager
   mSourceMgr->clearIDTables();
 
-  // Load the source
-  llvm::MemoryBuffer *SB =
-      llvm::MemoryBuffer::getMemBuffer(Text, Text + TextLength);
+  // Load the source (named InputFile in the diagnostics)
+  llvm::MemoryBuffer *SB = llvm::MemoryBuffer::getMemBufferCopy(
+      llvm::StringRef(Text, TextLength), InputFile);
   mSourceMgr->createMainFileIDForMemBuffer(SB);
 
   if (mSourceMgr->getMainFileID().isInvalid()) {
@@ -382,81 +600,226 @@ bool Slang::setDepOutput(const char *OutputFile) {
   return true;
 }
 
+void Slang::setOutputBuffers(const char *OutputFile, std::string *Buffer,
+                             std::string *DepBuffer) {
+  slangAssert((mOT == OT_Bitcode) && "Only bitcode is written to memory");
+
+  mOS.reset();
+  mDOS.reset();
+  mOutputFileName = OutputFile;
+  mOutputBuffer = Buffer;
+  mDepOutputBuffer = DepBuffer;
+  return;
+}
+
+void Slang::keepOutput(std::string *Buffer) {
+  slangAssert((mOT == OT_Bitcode) && "Only bitcode is kept in memory");
+
+  mOutputBuffer = Buffer;
+  return;
+}
+
+void Slang::addDependency(llvm::StringRef File) {
+  // Remove leading "./" (or ".//" or "././" etc.)
+  while ((File.size() > 2) && (File[0] == '.') &&
+         llvm::sys::path::is_separator(File[1])) {
+    File = File.substr(1);
+    while (llvm::sys::path::is_separator(File[0]))
+      File = File.substr(1);
+  }
+
+  if (mDependencySet.insert(File))
+    mDependencies.push_back(File);
+}
+
+// Escape the spaces in a file name for make
+static void PrintDependencyFileName(llvm::raw_ostream &OS,
+                                    llvm::StringRef File) {
+  for (unsigned i = 0, e = File.size(); i != e; i++) {
+    if (File[i] == ' ')
+      OS << '\\';
+    OS << File[i];
+  }
+}
+
 int Slang::generateDepFile() {
   if (mDiagEngine->hasErrorOccurred())
     return 1;
-  if (mDOS.get() == NULL)
+  if ((mDOS.get() == NULL) && (mDepOutputBuffer == NULL))
     return 1;
 
-  // Initialize options for generating dependency file
-  clang::DependencyOutputOptions DepOpts;
-  DepOpts.IncludeSystemHeaders = 1;
-  DepOpts.OutputFile = mDepOutputFileName;
-  DepOpts.Targets = mAdditionalDepTargets;
-  DepOpts.Targets.push_back(mDepTargetBCFileName);
-  for (std::vector<std::string>::const_iterator
-           I = mGeneratedFileNames.begin(), E = mGeneratedFileNames.end();
+  TimeReport::Region Timer(getTimeReport(), TimeReport::PT_DepFile);
+
+  std::vector<std::string> Targets(mAdditionalDepTargets);
+  Targets.push_back(mDepTargetBCFileName);
+  Targets.insert(Targets.end(), mGeneratedFileNames.begin(),
+                 mGeneratedFileNames.end());
+  mGeneratedFileNames.clear();
+
+  llvm::OwningPtr<llvm::raw_string_ostream> BufferOS;
+  if (mDepOutputBuffer != NULL) {
+    mDepOutputBuffer->clear();
+    BufferOS.reset(new llvm::raw_string_ostream(*mDepOutputBuffer));
+  }
+  WriteDependencyRule((BufferOS.get() != NULL) ? *BufferOS : mDOS->os(),
+                      Targets, mDependencies);
+
+  if (mDOS.get() != NULL) {
+    mDOS->keep();
+    mDOS.reset();
+  }
+
+  mDependencies.clear();
+  mDependencySet.clear();
+
+  return 0;
+}
+
+void Slang::WriteDependencyRule(llvm::raw_ostream &OS,
+                                const std::vector<std::string> &Targets,
+                                const std::vector<std::string> &Dependencies) {
+  // Lay the rule out the same way as clang (which follows GCC) does, keeping
+  // the lines short where possible.
+  const unsigned MaxColumns = 75;
+  unsigned Columns = 0;
+
+  for (std::vector<std::string>::const_iterator I = Targets.begin(),
+           E = Targets.end();
        I != E;
        I++) {
-    DepOpts.Targets.push_back(*I);
+    unsigned N = I->length();
+    if (Columns == 0) {
+      Columns += N;
+    } else if (Columns + N + 2 > MaxColumns) {
+      Columns = N + 2;
+      OS << " \\\n  ";
+    } else {
+      Columns += N + 1;
+      OS << ' ';
+    }
+    OS << *I;
   }
-  mGeneratedFileNames.clear();
 
-  // Per-compilation needed initialization
-  createPreprocessor();
-  AttachDependencyFileGen(*mPP.get(), DepOpts);
+  OS << ':';
+  Columns += 1;
 
-  // Inform the diagnostic client we are processing a source file
-  mDiagClient->BeginSourceFile(LangOpts, mPP.get());
+  for (std::vector<std::string>::const_iterator I = Dependencies.begin(),
+           E = Dependencies.end();
+       I != E;
+       I++) {
+    // Leave space for a trailing " \" in case the line has to be broken on
+    // the next iteration.
+    unsigned N = I->length();
+    if (Columns + (N + 1) + 2 > MaxColumns) {
+      OS << " \\\n ";
+      Columns = 2;
+    }
+    OS << ' ';
+    PrintDependencyFileName(OS, *I);
+    Columns += N + 1;
+  }
+  OS << '\n';
+  return;
+}
 
-  // Go through the source file (no operations necessary)
-  clang::Token Tok;
-  mPP->EnterMainSourceFile();
-  do {
-    mPP->Lex(Tok);
-  } while (Tok.isNot(clang::tok::eof));
+int Slang::generatePCH(const std::string &PCHFile) {
+  if (mDiagEngine->hasErrorOccurred())
+    return 1;
 
-  mPP->EndSourceFile();
+  // Everything in the PCH comes from the predefines set up by
+  // initPreprocessor(), so the main file is empty.
+  mSourceMgr->clearIDTables();
+  mSourceMgr->createMainFileIDForMemBuffer(
+      llvm::MemoryBuffer::getMemBuffer("", "<rs-pch>"));
 
-  // Declare success if no error
-  if (!mDiagEngine->hasErrorOccurred())
-    mDOS->keep();
+  createPreprocessor();
+  // Note that initASTContext() is not called here: the AST of the headers is
+  // not a compilation unit on its own.
+  mASTContext.reset(newASTContext());
+
+  std::string PCHData;
+  {
+    llvm::raw_string_ostream OS(PCHData);
+    clang::PCHGenerator Generator(*mPP, PCHFile, /* Module = */NULL,
+                                  /* isysroot = */"", &OS);
+
+    mDiagClient->BeginSourceFile(LangOpts, mPP.get());
+    ParseAST(*mPP, &Generator, *mASTContext);
+    mDiagClient->EndSourceFile();
+  }
 
-  // Clean up after compilation
+  mASTContext.reset();
   mPP.reset();
-  mDOS.reset();
 
-  return mDiagEngine->hasErrorOccurred() ? 1 : 0;
+  if (mDiagEngine->hasErrorOccurred())
+    return 1;
+
+  std::string Error;
+  if (!SlangUtils::WriteFileAtomically(PCHFile, PCHData, &Error)) {
+    mDiagEngine->Report(clang::diag::err_fe_error_opening) << PCHFile << Error;
+    return 1;
+  }
+
+  return 0;
 }
 
 int Slang::compile() {
   if (mDiagEngine->hasErrorOccurred())
     return 1;
-  if (mOS.get() == NULL)
+  // With -emit-nothing, there's no output to write.
+  if ((mOS.get() == NULL) && (mOutputBuffer == NULL) && (mOT != OT_Nothing))
     return 1;
 
   // Here is per-compilation needed initialization
+  mLLVMContext.reset(new llvm::LLVMContext());
   createPreprocessor();
+
+  // Collect the dependencies on the way if they're wanted
+  mDependencies.clear();
+  mDependencySet.clear();
+  if (collectsDependencies()) {
+    // The input comes first, even before the headers from a PCH. An input
+    // from memory has no file entry, but still the name it was given.
+    if (const clang::FileEntry *Main =
+            mSourceMgr->getFileEntryForID(mSourceMgr->getMainFileID()))
+      addDependency(Main->getName());
+    else
+      addDependency(mInputFileName);
+    mPP->addPPCallbacks(new DependencyCollector(this, *mSourceMgr));
+  }
+
   createASTContext();
 
-  mBackend.reset(createBackend(CodeGenOpts, &mOS->os(), mOT));
+  mBackend.reset(createBackend(CodeGenOpts,
+                               (mOS.get() != NULL) ? &mOS->os() : NULL,
+                               mOutputBuffer, mOT));
 
   // Inform the diagnostic client we are processing a source file
   mDiagClient->BeginSourceFile(LangOpts, mPP.get());
 
   // The core of the slang compiler
-  ParseAST(*mPP, mBackend.get(), *mASTContext);
+  {
+    TimeReport::Region Timer(getTimeReport(), TimeReport::PT_Parse);
+    ParseAST(*mPP, mBackend.get(), *mASTContext);
+  }
+
+  // The module (and what the reflection needs of the exports) is all there
+  // is to the compilation from here on. The AST goes before the passes run,
+  // they'd otherwise peak with both of them in memory.
+  mASTContext.reset();
+  if (!mDiagEngine->hasErrorOccurred())
+    beginEmitModule();
+  mBackend->EmitModule();
 
   // Inform the diagnostic client we are done with previous source file
   mDiagClient->EndSourceFile();
 
   // Declare success if no error
-  if (!mDiagEngine->hasErrorOccurred())
+  if (!mDiagEngine->hasErrorOccurred() && (mOS.get() != NULL))
     mOS->keep();
 
   // The compilation ended, clear
   mBackend.reset();
-  mASTContext.reset();
   mPP.reset();
   mOS.reset();
 
@@ -470,18 +833,69 @@ void Slang::setDebugMetadataEmission(bool EmitDebug) {
     CodeGenOpts.setDebugInfo(clang::CodeGenOptions::NoDebugInfo);
 }
 
+bool Slang::getDebugMetadataEmission() const {
+  return (CodeGenOpts.getDebugInfo() != clang::CodeGenOptions::NoDebugInfo);
+}
+
 void Slang::setOptimizationLevel(llvm::CodeGenOpt::Level OptimizationLevel) {
   CodeGenOpts.OptimizationLevel = OptimizationLevel;
 }
 
+llvm::CodeGenOpt::Level Slang::getOptimizationLevel() const {
+  return static_cast<llvm::CodeGenOpt::Level>(CodeGenOpts.OptimizationLevel);
+}
+
+void Slang::setOptimizeSize(bool OptimizeSize) {
+  CodeGenOpts.OptimizeSize = OptimizeSize;
+}
+
+bool Slang::getOptimizeSize() const {
+  return CodeGenOpts.OptimizeSize;
+}
+
+// The profile is kept as the CodeGenOptions it stands for, these are the ones
+// the Backend builds the pipeline from.
+void Slang::setOptimizationProfile(OptimizationProfile Profile) {
+  bool Kernel = (Profile == OP_Kernel);
+  CodeGenOpts.VectorizeLoop = Kernel;
+  CodeGenOpts.VectorizeSLP = Kernel;
+  CodeGenOpts.UnrollLoops = Kernel;
+  CodeGenOpts.setInlining(Kernel ? clang::CodeGenOptions::NormalInlining
+                                 : clang::CodeGenOptions::NoInlining);
+}
+
+Slang::OptimizationProfile Slang::getOptimizationProfile() const {
+  return CodeGenOpts.VectorizeLoop ? OP_Kernel : OP_Default;
+}
+
 void Slang::reset() {
-  llvm::errs() << mDiagClient->str();
+  // A streaming buffer has written them already.
+  if (!mDiagClient->isStreaming())
+    llvm::errs() << mDiagClient->str();
   mDiagEngine->Reset();
   mDiagClient->reset();
+  mOutputBuffer = NULL;
+  mDepOutputBuffer = NULL;
+  mDependencies.clear();
+  mDependencySet.clear();
+  mGeneratedFileNames.clear();
+  // Everything referring to the context (e.g., the RSContext of SlangRS) must
+  // have been released by now.
+  mLLVMContext.reset();
 }
 
 Slang::~Slang() {
-  llvm::llvm_shutdown();
+  if (ThreadInstance.get() == this)
+    ThreadInstance.erase();
+
+  // No llvm_shutdown() here: other Slang instances may still be alive (e.g.
+  // the workers of a parallel compile), so tearing down LLVM's global state is
+  // left to the owner of the process.
+
+  // The source manager doesn't touch the headers it was given on the way out.
+  for (unsigned i = 0, e = mHeaderBuffers.size(); i != e; i++)
+    HeaderCache::ReleaseBuffer(mHeaderBuffers[i]);
+  return;
 }
 
 }  // namespace slang
@@ -30,13 +30,21 @@ using llvm::RefCountedBase;
 
 #include "llvm/ADT/OwningPtr.h"
 #include "llvm/ADT/StringRef.h"
+#include "llvm/ADT/StringSet.h"
+
+#include "llvm/Support/ThreadLocal.h"
 
 #include "llvm/Target/TargetMachine.h"
 
 #include "slang_diagnostic_buffer.h"
 #include "slang_pragma_recorder.h"
+#include "slang_time_report.h"
 
 namespace llvm {
+  class LLVMContext;
+  class MemoryBuffer;
+  class raw_fd_ostream;
+  class raw_ostream;
   class tool_output_file;
 }
 
@@ -49,6 +57,7 @@ namespace clang {
   class DiagnosticsEngine;
   class FileManager;
   class FileSystemOptions;
+  class HeaderSearch;
   class LangOptions;
   class Preprocessor;
   class SourceManager;
@@ -57,12 +66,19 @@ namespace clang {
 
 namespace slang {
 
+class ExecutionProfile;
+
 class Slang : public clang::ModuleLoader {
   static clang::LangOptions LangOpts;
   static clang::CodeGenOptions CodeGenOpts;
 
   static bool GlobalInitialized;
 
+  // LLVM only allows a single fatal error handler per process. It reports to
+  // the instance last initialized on the failing thread.
+  static bool ErrorHandlerInstalled;
+  static llvm::sys::ThreadLocal<Slang> ThreadInstance;
+
   static void LLVMErrorHandler(void *UserData, const std::string &Message,
                                bool GenCrashDialog);
 
@@ -74,10 +90,38 @@ class Slang : public clang::ModuleLoader {
     OT_Bitcode,
     OT_Nothing,
     OT_Object,
+    // Only as an extra output of OT_Bitcode: the size of each part of the
+    // bitcode, as JSON
+    OT_SizeReport,
+    // Only as an extra output: the cost of each kernel in the optimized
+    // module, as JSON
+    OT_KernelReport,
+    // Only as an extra output of OT_Bitcode: the bitcode with the debug
+    // metadata the other outputs are stripped of (see DebugInfoKeyMetadataName)
+    OT_DebugInfo,
 
     OT_Default = OT_Bitcode
   };
 
+  // An output written from the same compilation of the input as the one of
+  // setOutput(), e.g., the .ll next to the .bc. With an ABI, it's a native
+  // object compiled ahead of time for that ABI (see GetAOTTarget()) from the
+  // bitcode.
+  struct ExtraOutput {
+    OutputType OT;
+    std::string ABI;
+    std::string OutputFile;
+  };
+  typedef std::vector<ExtraOutput> ExtraOutputList;
+
+  // The tuning of the LLVM optimization pipeline
+  enum OptimizationProfile {
+    OP_Default,
+    // For the kernels: runs the loop and SLP vectorizers and the inliner, and
+    // unrolls the (vectorized) loops further
+    OP_Kernel
+  };
+
  private:
   bool mInitialized;
 
@@ -91,6 +135,11 @@ class Slang : public clang::ModuleLoader {
   // NOTE: The ownership is taken by mDiagEngine after creation.
   DiagnosticBuffer *mDiagClient;
 
+  // LLVM context of the current compilation unit. It's created by compile()
+  // and released by reset(), so neither types nor metadata strings outlive
+  // the file they come from, and no two compilations ever share a context.
+  llvm::OwningPtr<llvm::LLVMContext> mLLVMContext;
+
   // The target being compiled for
   llvm::IntrusiveRefCntPtr<clang::TargetOptions> mTargetOpts;
   llvm::OwningPtr<clang::TargetInfo> mTarget;
@@ -107,6 +156,16 @@ class Slang : public clang::ModuleLoader {
   // Source manager (responsible for the source code handling)
   llvm::OwningPtr<clang::SourceManager> mSourceMgr;
   void createSourceManager();
+  // The buffers of the HeaderCache given to mSourceMgr
+  std::vector<const llvm::MemoryBuffer*> mHeaderBuffers;
+
+
+  // Header search (the include paths, and the lookups of the headers on
+  // them), shared by the preprocessors of all the compiles; set up again only
+  // when the include paths it was made for (mHeaderSearchPaths) change.
+  llvm::OwningPtr<clang::HeaderSearch> mHeaderSearch;
+  std::vector<std::string> mHeaderSearchPaths;
+  void prepareHeaderSearch();
 
 
   // Preprocessor (source code preprocessor)
@@ -116,8 +175,12 @@ class Slang : public clang::ModuleLoader {
 
   // AST context (the context to hold long-lived AST nodes)
   llvm::OwningPtr<clang::ASTContext> mASTContext;
+  clang::ASTContext *newASTContext();
   void createASTContext();
 
+  // Precompiled header to load into the AST context before parsing (if any)
+  std::string mPCHFileName;
+
 
   // AST consumer, responsible for code generation
   llvm::OwningPtr<clang::ASTConsumer> mBackend;
@@ -132,14 +195,46 @@ class Slang : public clang::ModuleLoader {
   std::vector<std::string> mAdditionalDepTargets;
   std::vector<std::string> mGeneratedFileNames;
 
+  // Files the input depends on in the order compile() has seen them (only
+  // collected when there's a dependency file to write)
+  std::vector<std::string> mDependencies;
+  llvm::StringSet<> mDependencySet;
+
   OutputType mOT;
 
+  // Where the time of each phase goes (NULL unless enableTimeReport())
+  llvm::OwningPtr<TimeReport> mTimeReport;
+
   // Output stream
   llvm::OwningPtr<llvm::tool_output_file> mOS;
 
   // Dependency output stream
   llvm::OwningPtr<llvm::tool_output_file> mDOS;
 
+  // Where the output and the dependencies go instead of mOS and mDOS (see
+  // setOutputBuffers()), NULL for files. The output is also kept here when
+  // it's written to mOS (see keepOutput()).
+  std::string *mOutputBuffer;
+  std::string *mDepOutputBuffer;
+
+  // Written along with the output
+  ExtraOutputList mExtraOutputs;
+
+  // Bitcode of the runtime library linked into the module (see
+  // setRuntimeLibrary())
+  llvm::StringRef mRuntimeLibrary;
+
+  // The counts the module is optimized for (see setProfile())
+  const ExecutionProfile *mProfile;
+
+  // Collect the dependencies even without a dependency file to write (see
+  // setCollectDependencies())
+  bool mCollectDependencies;
+  bool collectsDependencies() const {
+    return mCollectDependencies || (mDOS.get() != NULL) ||
+           (mDepOutputBuffer != NULL);
+  }
+
   std::vector<std::string> mIncludePaths;
 
  protected:
@@ -151,6 +246,7 @@ class Slang : public clang::ModuleLoader {
   clang::SourceManager &getSourceManager() { return *mSourceMgr; }
   clang::Preprocessor &getPreprocessor() { return *mPP; }
   clang::ASTContext &getASTContext() { return *mASTContext; }
+  llvm::LLVMContext &getLLVMContext() { return *mLLVMContext; }
 
   inline clang::TargetOptions const &getTargetOptions() const
     { return *mTargetOpts.getPtr(); }
@@ -159,16 +255,41 @@ class Slang : public clang::ModuleLoader {
   virtual void initPreprocessor() {}
   virtual void initASTContext() {}
 
+  // Called by the fatal error handler once Message is reported to this
+  // instance. Prints the pending diagnostics and exits, must not return.
+  virtual void handleFatalError();
+
+  // Called by compile() once the module is generated without errors, before
+  // the passes run on it and the output is written. What doesn't depend on
+  // the output may go on from there on another thread, which must be done
+  // with this instance before the next compile().
+  virtual void beginEmitModule() {}
+
+  // The output goes to OutputBuffer if that's not NULL, and (from there) to
+  // OS if that's not NULL.
   virtual clang::ASTConsumer *
     createBackend(const clang::CodeGenOptions& CodeGenOpts,
-                  llvm::raw_ostream *OS,
+                  llvm::raw_fd_ostream *OS,
+                  std::string *OutputBuffer,
                   OutputType OT);
 
+  const ExtraOutputList &getExtraOutputs() const { return mExtraOutputs; }
+
  public:
   static const llvm::StringRef PragmaMetadataName;
 
+  // The named metadata of the OT_DebugInfo output holding the key of the
+  // OT_Bitcode output it's the debug info of, the SlangUtils::UpdateHash() of
+  // the content of its file (in hex).
+  static const llvm::StringRef DebugInfoKeyMetadataName;
+
   static void GlobalInitialization();
 
+  // Look up the target to compile the native objects of an Android ABI (e.g.,
+  // "armeabi-v7a") for. Returns false if the ABI is not supported.
+  static bool GetAOTTarget(llvm::StringRef ABI, std::string *Triple,
+                           std::string *CPU, std::string *Features);
+
   Slang();
 
   void init(const std::string &Triple, const std::string &CPU,
@@ -193,8 +314,14 @@ class Slang : public clang::ModuleLoader {
     mIncludePaths = IncludePaths;
   }
 
+  std::vector<std::string> const &getIncludePaths() const {
+    return mIncludePaths;
+  }
+
   void setOutputType(OutputType OT) { mOT = OT; }
 
+  OutputType getOutputType() const { return mOT; }
+
   bool setOutput(const char *OutputFile);
 
   std::string const &getOutputFileName() const {
@@ -203,6 +330,28 @@ class Slang : public clang::ModuleLoader {
 
   bool setDepOutput(const char *OutputFile);
 
+  // Have compile() write the output (which must be OT_Bitcode) named
+  // OutputFile into *Buffer, and generateDepFile() the dependencies into
+  // *DepBuffer (unless it's NULL), instead of files. Holds until reset().
+  void setOutputBuffers(const char *OutputFile, std::string *Buffer,
+                        std::string *DepBuffer);
+
+  // Have compile() also keep the output (which must be OT_Bitcode) written to
+  // the file of setOutput() in *Buffer. Holds until reset().
+  void keepOutput(std::string *Buffer);
+
+  // The output compile() has kept in memory, NULL unless setOutputBuffers()
+  // or keepOutput() was called.
+  const std::string *getOutputBuffer() const {
+    return mOutputBuffer;
+  }
+
+  // Have compile() also write ExtraOutputs, from the same module as the
+  // output.
+  void setExtraOutputs(const ExtraOutputList &ExtraOutputs) {
+    mExtraOutputs = ExtraOutputs;
+  }
+
   void setDepTargetBC(const char *TargetBCFile) {
     mDepTargetBCFileName = TargetBCFile;
   }
@@ -212,20 +361,107 @@ class Slang : public clang::ModuleLoader {
     mAdditionalDepTargets = AdditionalDepTargets;
   }
 
+  std::vector<std::string> const &getAdditionalDepTargets() const {
+    return mAdditionalDepTargets;
+  }
+
   void appendGeneratedFileName(std::string const &GeneratedFileName) {
     mGeneratedFileNames.push_back(GeneratedFileName);
   }
 
+  // The generated files which are targets of the dependency file, until
+  // generateDepFile()
+  const std::vector<std::string> &getGeneratedFileNames() const {
+    return mGeneratedFileNames;
+  }
+
+  // Add File to the dependencies written by generateDepFile().
+  void addDependency(llvm::StringRef File);
+
+  // Write the dependency file for the input compiled by the last compile(),
+  // which collects the dependencies if setDepOutput() (or setOutputBuffers()
+  // with a DepBuffer) was called before it.
   int generateDepFile();
 
+  // Have compile() collect the dependencies of the input, for
+  // getDependencies(), even without a dependency file.
+  void setCollectDependencies(bool Collect) { mCollectDependencies = Collect; }
+
+  // The dependencies the last compile() collected, until generateDepFile()
+  const std::vector<std::string> &getDependencies() const {
+    return mDependencies;
+  }
+
+  // Write the make rule of Targets on Dependencies to OS, with the lines
+  // broken the way clang (as GCC) does.
+  static void WriteDependencyRule(llvm::raw_ostream &OS,
+                                  const std::vector<std::string> &Targets,
+                                  const std::vector<std::string> &Dependencies);
+
+  // Have compile() load the declarations that initPreprocessor() brings in
+  // from the precompiled header PCHFile instead of parsing them. An empty
+  // PCHFile turns this off.
+  void setPCHFile(const std::string &PCHFile) { mPCHFileName = PCHFile; }
+
+  // Write a precompiled header of everything initPreprocessor() brings in to
+  // PCHFile. Like compile(), returns the number of errors.
+  int generatePCH(const std::string &PCHFile);
+
   int compile();
 
   char const *getErrorMessage() { return mDiagClient->str().c_str(); }
 
+  DiagnosticBuffer *getDiagnosticBuffer() { return mDiagClient; }
+
+  // Add diagnostics rendered earlier (e.g., by a compilation of the same input
+  // whose results are reused) to the ones to be reported.
+  void appendErrorMessage(llvm::StringRef Message) {
+    mDiagClient->append(Message);
+  }
+
+  // Account the time spent in each phase of the compilation (of all the
+  // input files) to getTimeReport().
+  void enableTimeReport() {
+    if (mTimeReport.get() == NULL)
+      mTimeReport.reset(new TimeReport());
+  }
+
+  TimeReport *getTimeReport() { return mTimeReport.get(); }
+
   void setDebugMetadataEmission(bool EmitDebug);
 
+  bool getDebugMetadataEmission() const;
+
   void setOptimizationLevel(llvm::CodeGenOpt::Level OptimizationLevel);
 
+  llvm::CodeGenOpt::Level getOptimizationLevel() const;
+
+  // Optimize for size rather than speed (-Os)
+  void setOptimizeSize(bool OptimizeSize);
+
+  bool getOptimizeSize() const;
+
+  void setOptimizationProfile(OptimizationProfile Profile);
+
+  OptimizationProfile getOptimizationProfile() const;
+
+  // Have compile() link the definitions of the functions the module calls
+  // from the runtime library Bitcode (e.g., the embedded rslib.bc) into the
+  // module before it's optimized, such that they can be inlined. Bitcode must
+  // outlive the compiles, an empty one turns this off.
+  void setRuntimeLibrary(llvm::StringRef Bitcode) {
+    mRuntimeLibrary = Bitcode;
+  }
+
+  llvm::StringRef getRuntimeLibrary() const { return mRuntimeLibrary; }
+
+  // Have compile() optimize the module for the counts of Profile (e.g.,
+  // collected on the device, see -fprofile-use), which must outlive the
+  // compiles. NULL turns this off.
+  void setProfile(const ExecutionProfile *Profile) { mProfile = Profile; }
+
+  const ExecutionProfile *getProfile() const { return mProfile; }
+
   // Reset the slang compiler state such that it can be reused to compile
   // another file
   virtual void reset();
@@ -16,6 +16,8 @@
 
 #include "slang_backend.h"
 
+#include <algorithm>
+#include <map>
 #include <string>
 #include <vector>
 
@@ -34,6 +36,9 @@
 #include "clang/Frontend/CodeGenOptions.h"
 #include "clang/Frontend/FrontendDiagnostic.h"
 
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringExtras.h"
 #include "llvm/Assembly/PrintModulePass.h"
 
 #include "llvm/Bitcode/ReaderWriter.h"
@@ -41,27 +46,301 @@
 #include "llvm/CodeGen/RegAllocRegistry.h"
 #include "llvm/CodeGen/SchedulerRegistry.h"
 
+#include "llvm/IR/Instructions.h"
 #include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/MDBuilder.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/Metadata.h"
+#include "llvm/IR/TypeFinder.h"
+#include "llvm/Linker.h"
 
+#include "llvm/Transforms/IPO.h"
 #include "llvm/Transforms/IPO/PassManagerBuilder.h"
+#include "llvm/Transforms/Scalar.h"
+#include "llvm/Transforms/Utils/Cloning.h"
 
 #include "llvm/IR/DataLayout.h"
 #include "llvm/Target/TargetMachine.h"
 #include "llvm/Target/TargetOptions.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/InstIterator.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
 #include "llvm/Support/TargetRegistry.h"
+#include "llvm/Support/ToolOutputFile.h"
 
 #include "llvm/MC/SubtargetFeature.h"
 
 #include "slang_assert.h"
+#include "slang_execution_profile.h"
+#include "slang_utils.h"
 #include "strip_unknown_attributes.h"
 #include "BitWriter_2_9/ReaderWriter_2_9.h"
 #include "BitWriter_2_9_func/ReaderWriter_2_9_func.h"
 #include "BitWriter_3_2/ReaderWriter_3_2.h"
+#include "BitWriter_common/BitcodeSizeReport.h"
 
 namespace slang {
 
+// The bodies of root() and the other kernels are mostly a single loop over
+// the elements of the allocation, give it more room than the default unroller
+// (threshold 150, full unrolling only) does. Partially unrolled, such a loop
+// keeps more elements in flight.
+static void AddKernelLoopUnrollPass(const llvm::PassManagerBuilder &Builder,
+                                    llvm::PassManagerBase &PM) {
+  PM.add(llvm::createLoopUnrollPass(/* Threshold */ 300,
+                                    /* Count */ -1,
+                                    /* AllowPartial */ 1));
+  return;
+}
+
+static void InitTargetOptions(llvm::TargetOptions *Options,
+                              const clang::CodeGenOptions &CodeGenOpts) {
+  Options->NoFramePointerElim = CodeGenOpts.DisableFPElim;
+
+  // Use hardware FPU.
+  //
+  // FIXME: Need to detect the CPU capability and decide whether to use softfp.
+  // To use softfp, change following 2 lines to
+  //
+  // Options->FloatABIType = llvm::FloatABI::Soft;
+  // Options->UseSoftFloat = true;
+  Options->FloatABIType = llvm::FloatABI::Hard;
+  Options->UseSoftFloat = false;
+  return;
+}
+
+static llvm::CodeGenOpt::Level
+GetCodeGenOptLevel(const clang::CodeGenOptions &CodeGenOpts) {
+  if (CodeGenOpts.OptimizationLevel == 0)
+    return llvm::CodeGenOpt::None;
+  else if (CodeGenOpts.OptimizationLevel == 3)
+    return llvm::CodeGenOpt::Aggressive;
+  return llvm::CodeGenOpt::Default;
+}
+
+// Returns false if (the allocation of) a global or a structure of M doesn't
+// have the same size and layout under Layout as under the one of M.
+static bool HasSameLayout(const llvm::Module &M,
+                          const llvm::DataLayout &Layout) {
+  llvm::DataLayout ModuleLayout(&M);
+  if (ModuleLayout.getPointerSize() != Layout.getPointerSize())
+    return false;
+
+  llvm::TypeFinder StructTypes;
+  StructTypes.run(M, false);
+  for (llvm::TypeFinder::iterator I = StructTypes.begin(),
+          E = StructTypes.end();
+       I != E;
+       I++) {
+    llvm::StructType *T = *I;
+    if (!T->isSized())
+      continue;
+
+    const llvm::StructLayout *ModuleSL = ModuleLayout.getStructLayout(T);
+    const llvm::StructLayout *SL = Layout.getStructLayout(T);
+    if ((ModuleSL->getSizeInBytes() != SL->getSizeInBytes()) ||
+        (ModuleLayout.getABITypeAlignment(T) != Layout.getABITypeAlignment(T)))
+      return false;
+    for (unsigned i = 0, e = T->getNumElements(); i != e; i++)
+      if (ModuleSL->getElementOffset(i) != SL->getElementOffset(i))
+        return false;
+  }
+
+  for (llvm::Module::const_global_iterator I = M.global_begin(),
+          E = M.global_end();
+       I != E;
+       I++) {
+    llvm::Type *T = I->getType()->getElementType();
+    if (T->isSized() &&
+        (ModuleLayout.getTypeAllocSize(T) != Layout.getTypeAllocSize(T)))
+      return false;
+  }
+
+  return true;
+}
+
+bool Backend::LinkRuntimeLibrary() {
+  if (mRuntimeLibrary.empty())
+    return true;
+
+  std::string Error;
+  llvm::OwningPtr<llvm::MemoryBuffer> MB(
+      llvm::MemoryBuffer::getMemBuffer(mRuntimeLibrary, "rslib.bc",
+                                       /* RequiresNullTerminator = */false));
+  llvm::OwningPtr<llvm::Module> Lib(
+      llvm::ParseBitcodeFile(MB.get(), mLLVMContext, &Error));
+  if (!Lib) {
+    mDiagEngine.Report(mDiagEngine.getCustomDiagID(
+        clang::DiagnosticsEngine::Error,
+        "cannot load the runtime library: %0")) << Error;
+    return false;
+  }
+
+  // Only the definitions which are called (directly or through one another)
+  // are linked in. The others would just grow the module (and their
+  // declarations, e.g., of target specific intrinsics, may not be portable).
+  llvm::SmallPtrSet<llvm::Function*, 16> Needed;
+  llvm::SmallVector<llvm::Function*, 16> Worklist;
+  for (llvm::Module::iterator I = mpModule->begin(), E = mpModule->end();
+       I != E;
+       I++) {
+    if (!I->isDeclaration() || I->use_empty())
+      continue;
+    llvm::Function *F = Lib->getFunction(I->getName());
+    if ((F != NULL) && !F->isDeclaration() && Needed.insert(F))
+      Worklist.push_back(F);
+  }
+  while (!Worklist.empty()) {
+    llvm::Function *F = Worklist.pop_back_val();
+    for (llvm::Function::iterator BI = F->begin(), BE = F->end();
+         BI != BE;
+         BI++) {
+      for (llvm::BasicBlock::iterator II = BI->begin(), IE = BI->end();
+           II != IE;
+           II++) {
+        for (unsigned i = 0, e = II->getNumOperands(); i != e; i++) {
+          llvm::Function *Callee = llvm::dyn_cast<llvm::Function>(
+              II->getOperand(i)->stripPointerCasts());
+          if ((Callee != NULL) && !Callee->isDeclaration() &&
+              Needed.insert(Callee))
+            Worklist.push_back(Callee);
+        }
+      }
+    }
+  }
+  if (Needed.empty())
+    return true;
+
+  for (llvm::Module::iterator I = Lib->begin(), E = Lib->end(); I != E; I++)
+    if (!Needed.count(I))
+      I->deleteBody();
+  // Deleting a body may leave more declarations and variables (e.g., the
+  // tables of the functions not needed) unused.
+  bool Changed = true;
+  while (Changed) {
+    Changed = false;
+    for (llvm::Module::iterator I = Lib->begin(), E = Lib->end(); I != E; ) {
+      llvm::Function *F = I++;
+      if (F->isDeclaration() && F->use_empty()) {
+        F->eraseFromParent();
+        Changed = true;
+      }
+    }
+    for (llvm::Module::global_iterator I = Lib->global_begin(),
+            E = Lib->global_end();
+         I != E; ) {
+      llvm::GlobalVariable *GV = I++;
+      if (GV->use_empty()) {
+        GV->eraseFromParent();
+        Changed = true;
+      }
+    }
+  }
+
+  std::vector<std::string> Names, GlobalNames;
+  for (llvm::Module::iterator I = Lib->begin(), E = Lib->end(); I != E; I++)
+    if (!I->isDeclaration())
+      Names.push_back(I->getName());
+  for (llvm::Module::global_iterator I = Lib->global_begin(),
+          E = Lib->global_end();
+       I != E;
+       I++)
+    if (!I->isDeclaration() && !I->hasLocalLinkage())
+      GlobalNames.push_back(I->getName());
+
+  // The library's own target has no say in the module.
+  Lib->setTargetTriple(mpModule->getTargetTriple());
+  Lib->setDataLayout(mpModule->getDataLayout());
+  if (llvm::Linker::LinkModules(mpModule, Lib.get(),
+                                llvm::Linker::DestroySource, &Error)) {
+    mDiagEngine.Report(mDiagEngine.getCustomDiagID(
+        clang::DiagnosticsEngine::Error,
+        "cannot link the runtime library: %0")) << Error;
+    return false;
+  }
+
+  // Nothing linked in is visible outside of the script, the variables of the
+  // library included (they would be taken for the script's own otherwise).
+  for (unsigned i = 0, e = Names.size(); i != e; i++)
+    if (llvm::Function *F = mpModule->getFunction(Names[i]))
+      F->setLinkage(llvm::GlobalValue::InternalLinkage);
+  for (unsigned i = 0, e = GlobalNames.size(); i != e; i++)
+    if (llvm::GlobalVariable *GV = mpModule->getNamedGlobal(GlobalNames[i]))
+      GV->setLinkage(llvm::GlobalValue::InternalLinkage);
+  return true;
+}
+
+// The weights of a branch taken Counts times, scaled to fit the 32 bits of
+// the metadata. A weight is never 0, the successors taken just as rarely
+// (e.g., never) would otherwise look more unlikely than that.
+static void GetBranchWeights(const std::vector<uint64_t> &Counts,
+                             llvm::SmallVectorImpl<uint32_t> *Weights) {
+  uint64_t Max = 0;
+  for (unsigned i = 0, e = Counts.size(); i != e; i++)
+    Max = std::max(Max, Counts[i]);
+  unsigned Shift = 0;
+  while ((Max >> Shift) > UINT32_MAX)
+    Shift++;
+  for (unsigned i = 0, e = Counts.size(); i != e; i++)
+    Weights->push_back(std::max<uint32_t>(Counts[i] >> Shift, 1));
+  return;
+}
+
+void Backend::ApplyProfile() {
+  if (mProfile == NULL)
+    return;
+
+  llvm::MDBuilder MDB(mLLVMContext);
+  for (llvm::Module::iterator F = mpModule->begin(), FE = mpModule->end();
+       F != FE;
+       F++) {
+    const ExecutionProfile::FunctionCounts *Counts =
+        F->isDeclaration() ? NULL : mProfile->getFunction(F->getName());
+    if (Counts == NULL)
+      continue;
+
+    unsigned Index = 0;
+    for (llvm::Function::iterator BB = F->begin(), BBE = F->end();
+         BB != BBE;
+         BB++) {
+      llvm::TerminatorInst *TI = BB->getTerminator();
+      if ((TI->getNumSuccessors() < 2) ||
+          !(llvm::isa<llvm::BranchInst>(TI) || llvm::isa<llvm::SwitchInst>(TI)))
+        continue;
+
+      std::map<unsigned, std::vector<uint64_t> >::const_iterator I =
+          Counts->Branches.find(Index++);
+      // A profile of another version of the function is left alone.
+      if ((I == Counts->Branches.end()) ||
+          (I->second.size() != TI->getNumSuccessors()))
+        continue;
+      llvm::SmallVector<uint32_t, 4> Weights;
+      GetBranchWeights(I->second, &Weights);
+      TI->setMetadata(llvm::LLVMContext::MD_prof,
+                      MDB.createBranchWeights(Weights));
+    }
+
+    // LLVM has no use for the entry counts themselves, but the inliner and
+    // the unroller lower their thresholds in (and for) the functions optimized
+    // for size, and raise the inliner's for the callees hinted.
+    if (mProfile->isCold(*Counts)) {
+      F->addFnAttr(llvm::Attribute::OptimizeForSize);
+    } else if (mProfile->isHot(*Counts)) {
+      for (llvm::inst_iterator I = llvm::inst_begin(F), E = llvm::inst_end(F);
+           I != E;
+           I++) {
+        const llvm::CallInst *Call = llvm::dyn_cast<llvm::CallInst>(&*I);
+        llvm::Function *Callee =
+            (Call != NULL) ? Call->getCalledFunction() : NULL;
+        if ((Callee != NULL) && !Callee->isDeclaration() && (Callee != F))
+          Callee->addFnAttr(llvm::Attribute::InlineHint);
+      }
+    }
+  }
+  return;
+}
+
 void Backend::CreateFunctionPasses() {
   if (!mPerFunctionPasses) {
     mPerFunctionPasses = new llvm::FunctionPassManager(mpModule);
@@ -82,7 +361,6 @@ void Backend::CreateModulePasses() {
     llvm::PassManagerBuilder PMBuilder;
     PMBuilder.OptLevel = mCodeGenOpts.OptimizationLevel;
     PMBuilder.SizeLevel = mCodeGenOpts.OptimizeSize;
-    PMBuilder.SizeLevel = mCodeGenOpts.OptimizeSize;
     if (mCodeGenOpts.UnitAtATime) {
       PMBuilder.DisableUnitAtATime = 0;
     } else {
@@ -95,9 +373,32 @@ void Backend::CreateModulePasses() {
       PMBuilder.DisableUnrollLoops = 1;
     }
 
+    // The kernel profile (see Slang::setOptimizationProfile()), or the
+    // execution one, which tells the hot functions from the cold ones
+    bool Inline =
+        (mCodeGenOpts.getInlining() == clang::CodeGenOptions::NormalInlining);
+    if ((Inline || (mProfile != NULL)) && (PMBuilder.OptLevel > 0)) {
+      // The thresholds of clang for -Os, -O2 and -O3
+      unsigned Threshold = 225;
+      if (PMBuilder.SizeLevel > 0)
+        Threshold = 75;
+      else if (PMBuilder.OptLevel > 2)
+        Threshold = 275;
+      PMBuilder.Inliner = llvm::createFunctionInliningPass(Threshold);
+    }
+    PMBuilder.LoopVectorize = mCodeGenOpts.VectorizeLoop;
+    PMBuilder.SLPVectorize = mCodeGenOpts.VectorizeSLP;
+    if (((mCodeGenOpts.VectorizeLoop && mCodeGenOpts.UnrollLoops) ||
+         (mProfile != NULL)) &&
+        (PMBuilder.SizeLevel == 0))
+      PMBuilder.addExtension(llvm::PassManagerBuilder::EP_ScalarOptimizerLate,
+                             AddKernelLoopUnrollPass);
+
     PMBuilder.populateModulePassManager(*mPerModulePasses);
-    // Add a pass to strip off unknown/unsupported attributes.
-    mPerModulePasses->add(createStripUnknownAttributesPass());
+    // Add a pass to strip off the attributes the bitcode readers of the
+    // targets before KitKat don't know.
+    if (getTargetAPI() < SLANG_KK_TARGET_API)
+      mPerModulePasses->add(createStripUnknownAttributesPass());
   }
   return;
 }
@@ -127,18 +428,7 @@ bool Backend::CreateCodeGenPasses() {
 
   // Target Machine Options
   llvm::TargetOptions Options;
-
-  Options.NoFramePointerElim = mCodeGenOpts.DisableFPElim;
-
-  // Use hardware FPU.
-  //
-  // FIXME: Need to detect the CPU capability and decide whether to use softfp.
-  // To use softfp, change following 2 lines to
-  //
-  // Options.FloatABIType = llvm::FloatABI::Soft;
-  // Options.UseSoftFloat = true;
-  Options.FloatABIType = llvm::FloatABI::Hard;
-  Options.UseSoftFloat = false;
+  InitTargetOptions(&Options, mCodeGenOpts);
 
   // BCC needs all unknown symbols resolved at compilation time. So we don't
   // need any relocation model.
@@ -183,20 +473,13 @@ bool Backend::CreateCodeGenPasses() {
                                      llvm::createFastRegisterAllocator :
                                      llvm::createGreedyRegisterAllocator);
 
-  llvm::CodeGenOpt::Level OptLevel = llvm::CodeGenOpt::Default;
-  if (mCodeGenOpts.OptimizationLevel == 0) {
-    OptLevel = llvm::CodeGenOpt::None;
-  } else if (mCodeGenOpts.OptimizationLevel == 3) {
-    OptLevel = llvm::CodeGenOpt::Aggressive;
-  }
-
   llvm::TargetMachine::CodeGenFileType CGFT =
       llvm::TargetMachine::CGFT_AssemblyFile;
   if (mOT == Slang::OT_Object) {
     CGFT = llvm::TargetMachine::CGFT_ObjectFile;
   }
   if (TM->addPassesToEmitFile(*mCodeGenPasses, FormattedOutStream,
-                              CGFT, OptLevel)) {
+                              CGFT, GetCodeGenOptLevel(mCodeGenOpts))) {
     mDiagEngine.Report(clang::diag::err_fe_unable_to_interface_with_target);
     return false;
   }
@@ -205,32 +488,52 @@ bool Backend::CreateCodeGenPasses() {
 }
 
 Backend::Backend(clang::DiagnosticsEngine *DiagEngine,
+                 llvm::LLVMContext &LLVMContext,
                  const clang::CodeGenOptions &CodeGenOpts,
                  const clang::TargetOptions &TargetOpts,
                  PragmaList *Pragmas,
-                 llvm::raw_ostream *OS,
-                 Slang::OutputType OT)
+                 llvm::raw_fd_ostream *OS,
+                 std::string *OutputBuffer,
+                 Slang::OutputType OT,
+                 const Slang::ExtraOutputList *ExtraOutputs,
+                 llvm::StringRef RuntimeLibrary,
+                 const ExecutionProfile *Profile,
+                 TimeReport *Report)
     : ASTConsumer(),
       mTargetOpts(TargetOpts),
       mpModule(NULL),
       mpOS(OS),
+      mpOutputBuffer(OutputBuffer),
       mOT(OT),
+      mExtraOutputs(ExtraOutputs),
+      mDebugInfoModule(NULL),
+      mRuntimeLibrary(RuntimeLibrary),
+      mProfile(Profile),
       mGen(NULL),
+      mModuleGenerated(false),
       mPerFunctionPasses(NULL),
       mPerModulePasses(NULL),
       mCodeGenPasses(NULL),
-      mLLVMContext(llvm::getGlobalContext()),
+      mLLVMContext(LLVMContext),
       mDiagEngine(*DiagEngine),
       mCodeGenOpts(CodeGenOpts),
-      mPragmas(Pragmas) {
-  FormattedOutStream.setStream(*mpOS,
-                               llvm::formatted_raw_ostream::PRESERVE_STREAM);
-  mGen = CreateLLVMCodeGen(mDiagEngine, "", mCodeGenOpts,
-                           mTargetOpts, mLLVMContext);
+      mPragmas(Pragmas),
+      mTimeReport(Report) {
+  if (mpOS != NULL)
+    FormattedOutStream.setStream(*mpOS,
+                                 llvm::formatted_raw_ostream::PRESERVE_STREAM);
+  // If the module isn't written, the input is only checked. Sema and the
+  // RS specific validation are all there is to do then.
+  if (isModuleEmitted())
+    mGen = CreateLLVMCodeGen(mDiagEngine, "", mCodeGenOpts,
+                             mTargetOpts, mLLVMContext);
   return;
 }
 
 void Backend::Initialize(clang::ASTContext &Ctx) {
+  if (mGen == NULL)
+    return;
+
   mGen->Initialize(Ctx);
 
   mpModule = mGen->GetModule();
@@ -238,29 +541,263 @@ void Backend::Initialize(clang::ASTContext &Ctx) {
   return;
 }
 
-// Encase the Bitcode in a wrapper containing RS version information.
-void Backend::WrapBitcode(llvm::raw_string_ostream &Bitcode) {
+void Backend::AddBitcodeWriterPass(llvm::PassManager *PM,
+                                   llvm::raw_ostream &OS,
+                                   llvm_legacy::BitcodeSizeReport *SizeReport) {
+  unsigned int TargetAPI = getTargetAPI();
+  switch (TargetAPI) {
+    case SLANG_HC_TARGET_API:
+    case SLANG_HC_MR1_TARGET_API:
+    case SLANG_HC_MR2_TARGET_API: {
+      // Pre-ICS targets must use the LLVM 2.9 BitcodeWriter
+      PM->add(llvm_2_9::createBitcodeWriterPass(OS, SizeReport));
+      break;
+    }
+    case SLANG_ICS_TARGET_API:
+    case SLANG_ICS_MR1_TARGET_API: {
+      // ICS targets must use the LLVM 2.9_func BitcodeWriter
+      PM->add(llvm_2_9_func::createBitcodeWriterPass(OS, SizeReport));
+      break;
+    }
+    default: {
+      if (TargetAPI < SLANG_MINIMUM_TARGET_API ||
+          TargetAPI > SLANG_MAXIMUM_TARGET_API) {
+        slangAssert(false && "Invalid target API value");
+      }
+      // Switch to the 3.2 BitcodeWriter by default, and don't use
+      // LLVM's included BitcodeWriter at all (for now).
+      PM->add(llvm_3_2::createBitcodeWriterPass(OS, SizeReport));
+      //PM->add(llvm::createBitcodeWriterPass(OS));
+      break;
+    }
+  }
+  return;
+}
+
+bool Backend::EmitNativeOutput(const Slang::ExtraOutput &Output,
+                               llvm::raw_fd_ostream *OS) {
+  std::string Triple = mpModule->getTargetTriple();
+  std::string CPU = mTargetOpts.CPU;
+  std::string FeaturesStr;
+  if (Output.ABI.empty()) {
+    llvm::SubtargetFeatures Features;
+    for (std::vector<std::string>::const_iterator
+             I = mTargetOpts.Features.begin(), E = mTargetOpts.Features.end();
+         I != E;
+         I++)
+      Features.AddFeature(*I);
+    FeaturesStr = Features.getString();
+  } else if (!Slang::GetAOTTarget(Output.ABI, &Triple, &CPU, &FeaturesStr)) {
+    slangAssert(false && "Unknown ABI of an AOT object");
+    return false;
+  }
+
+  std::string Error;
+  const llvm::Target* TargetInfo =
+      llvm::TargetRegistry::lookupTarget(Triple, Error);
+  if (TargetInfo == NULL) {
+    mDiagEngine.Report(clang::diag::err_fe_unable_to_create_target) << Error;
+    return false;
+  }
+
+  llvm::CodeModel::Model CM = llvm::CodeModel::Small;
+  if (mpModule->getPointerSize() != llvm::Module::Pointer32)
+    CM = llvm::CodeModel::Medium;
+
+  llvm::TargetOptions Options;
+  InitTargetOptions(&Options, mCodeGenOpts);
+  llvm::OwningPtr<llvm::TargetMachine> TM(
+      TargetInfo->createTargetMachine(Triple, CPU, FeaturesStr, Options,
+                                      llvm::Reloc::Static, CM));
+  if (!TM) {
+    mDiagEngine.Report(clang::diag::err_fe_unable_to_create_target) << Triple;
+    return false;
+  }
+
+  // The reflected code (and the runtime) read and write the globals at the
+  // offsets of the bitcode.
+  const llvm::DataLayout *Layout = TM->getDataLayout();
+  if (!Output.ABI.empty() && !HasSameLayout(*mpModule, *Layout)) {
+    mDiagEngine.Report(mDiagEngine.getCustomDiagID(
+        clang::DiagnosticsEngine::Error,
+        "data layout of ABI '%0' differs from the one of the bitcode, "
+        "can't compile ahead of time for it")) << Output.ABI;
+    return false;
+  }
+
+  // Code generation changes the IR, so it works on a copy.
+  llvm::OwningPtr<llvm::Module> M(llvm::CloneModule(mpModule));
+  M->setTargetTriple(Triple);
+  M->setDataLayout(Layout->getStringRepresentation());
+
+  llvm::PassManager PM;
+  PM.add(new llvm::DataLayout(*Layout));
+
+  llvm::TargetMachine::CodeGenFileType CGFT =
+      llvm::TargetMachine::CGFT_AssemblyFile;
+  if (Output.OT == Slang::OT_Object)
+    CGFT = llvm::TargetMachine::CGFT_ObjectFile;
+
+  llvm::formatted_raw_ostream FormattedOS(*OS);
+  if (TM->addPassesToEmitFile(PM, FormattedOS, CGFT,
+                              GetCodeGenOptLevel(mCodeGenOpts))) {
+    mDiagEngine.Report(clang::diag::err_fe_unable_to_interface_with_target);
+    return false;
+  }
+  PM.run(*M);
+  return true;
+}
+
+bool Backend::EmitExtraOutput(
+    const Slang::ExtraOutput &Output,
+    const llvm_legacy::BitcodeSizeReport *SizeReport) {
+  std::string Error;
+  llvm::SmallString<256> Dir(Output.OutputFile);
+  llvm::sys::path::remove_filename(Dir);
+  if (!Dir.empty() && !SlangUtils::CreateDirectoryWithParents(Dir, &Error)) {
+    mDiagEngine.Report(clang::diag::err_fe_error_opening) << Dir << Error;
+    return false;
+  }
+
+  llvm::tool_output_file Out(Output.OutputFile.c_str(), Error,
+                             llvm::sys::fs::F_Binary);
+  if (!Error.empty()) {
+    mDiagEngine.Report(clang::diag::err_fe_error_opening)
+        << Output.OutputFile << Error;
+    return false;
+  }
+
+  switch (Output.OT) {
+    case Slang::OT_Assembly:
+    case Slang::OT_Object: {
+      if (!EmitNativeOutput(Output, &Out.os()))
+        return false;
+      break;
+    }
+    case Slang::OT_LLVMAssembly: {
+      llvm::PassManager LLEmitPM;
+      LLEmitPM.add(llvm::createPrintModulePass(&Out.os()));
+      LLEmitPM.run(*mpModule);
+      break;
+    }
+    case Slang::OT_Bitcode: {
+      TimeReport::Region Timer(mTimeReport, TimeReport::PT_BitcodeWriter);
+      WriteWrappedBitcode(mpModule, &Out.os());
+      break;
+    }
+    case Slang::OT_SizeReport: {
+      slangAssert(SizeReport != NULL);
+      SizeReport->printJSON(Out.os());
+      break;
+    }
+    case Slang::OT_KernelReport: {
+      WriteKernelReport(mpModule, Out.os());
+      break;
+    }
+    case Slang::OT_DebugInfo: {
+      slangAssert(mDebugInfoModule != NULL);
+      TimeReport::Region Timer(mTimeReport, TimeReport::PT_BitcodeWriter);
+      WriteWrappedBitcode(mDebugInfoModule, &Out.os());
+      break;
+    }
+    default: {
+      slangAssert(false && "Invalid type of an extra output");
+    }
+  }
+
+  Out.keep();
+  return true;
+}
+
+void Backend::WriteKernelReport(llvm::Module *M, llvm::raw_ostream &OS) {
+  OS << "{\n  \"kernels\": []\n}\n";
+  return;
+}
+
+void Backend::WriteBufferedBitcode(llvm::Module *M, llvm::raw_ostream &OS,
+                                   llvm_legacy::BitcodeSizeReport *SizeReport) {
   bcinfo::AndroidBitcodeWrapper wrapper;
+  llvm::PassManager BCEmitPM;
+
+  std::string BCStr;
+  llvm::raw_string_ostream Bitcode(BCStr);
+  AddBitcodeWriterPass(&BCEmitPM, Bitcode, SizeReport);
+  BCEmitPM.run(*M);
+
   size_t actualWrapperLen = bcinfo::writeAndroidBitcodeWrapper(
       &wrapper, Bitcode.str().length(), getTargetAPI(),
       SlangVersion::CURRENT, mCodeGenOpts.OptimizationLevel);
+  slangAssert(actualWrapperLen > 0);
+  if (SizeReport != NULL)
+    SizeReport->setWrapperBytes(actualWrapperLen);
+
+  OS.write(reinterpret_cast<char*>(&wrapper), actualWrapperLen);
+  OS << Bitcode.str();
+  return;
+}
+
+void Backend::WriteWrappedBitcode(llvm::Module *M, llvm::raw_fd_ostream *OS,
+                                  llvm_legacy::BitcodeSizeReport *SizeReport) {
+  bcinfo::AndroidBitcodeWrapper wrapper;
+  llvm::PassManager BCEmitPM;
 
+  // Nothing goes through FormattedOutStream from here on, so the output is
+  // written directly.
+  FormattedOutStream.flush();
+
+  // The size of the bitcode is only known after it's written. Stream it right
+  // after a wrapper of the same (fixed) size to the output, then seek back to
+  // patch the wrapper. Only if the output can't seek (e.g., it's a pipe)
+  // the bitcode is kept in memory to write the wrapper first.
+  uint64_t WrapperPos = OS->tell();
+  OS->seek(WrapperPos);
+  if (OS->has_error()) {
+    OS->clear_error();
+    WriteBufferedBitcode(M, *OS, SizeReport);
+    return;
+  }
+
+  size_t actualWrapperLen = bcinfo::writeAndroidBitcodeWrapper(
+      &wrapper, 0, getTargetAPI(),
+      SlangVersion::CURRENT, mCodeGenOpts.OptimizationLevel);
   slangAssert(actualWrapperLen > 0);
+  if (SizeReport != NULL)
+    SizeReport->setWrapperBytes(actualWrapperLen);
+  OS->write(reinterpret_cast<char*>(&wrapper), actualWrapperLen);
 
-  // Write out the bitcode wrapper.
-  FormattedOutStream.write(reinterpret_cast<char*>(&wrapper), actualWrapperLen);
+  AddBitcodeWriterPass(&BCEmitPM, *OS, SizeReport);
+  BCEmitPM.run(*M);
 
-  // Write out the actual encoded bitcode.
-  FormattedOutStream << Bitcode.str();
+  uint64_t EndPos = OS->tell();
+  bcinfo::writeAndroidBitcodeWrapper(
+      &wrapper, EndPos - WrapperPos - actualWrapperLen, getTargetAPI(),
+      SlangVersion::CURRENT, mCodeGenOpts.OptimizationLevel);
+  OS->seek(WrapperPos);
+  OS->write(reinterpret_cast<char*>(&wrapper), actualWrapperLen);
+  OS->seek(EndPos);
   return;
 }
 
 bool Backend::HandleTopLevelDecl(clang::DeclGroupRef D) {
+  if (mGen == NULL)
+    return true;
+
+  TimeReport::Region Timer(mTimeReport, TimeReport::PT_IRGen);
   return mGen->HandleTopLevelDecl(D);
 }
 
 void Backend::HandleTranslationUnit(clang::ASTContext &Ctx) {
-  HandleTranslationUnitPre(Ctx);
+  {
+    TimeReport::Region Timer(mTimeReport, TimeReport::PT_RSAST);
+    HandleTranslationUnitPre(Ctx);
+  }
+
+  if (mGen == NULL) {
+    HandleTranslationUnitPost(NULL);
+    return;
+  }
+
+  TimeReport::Region IRGenTimer(mTimeReport, TimeReport::PT_IRGen);
 
   mGen->HandleTranslationUnit(Ctx);
 
@@ -268,11 +805,17 @@ void Backend::HandleTranslationUnit(clang::ASTContext &Ctx) {
   // IR). Now, interact with LLVM backend to generate actual machine code (asm
   // or machine code, whatever.)
 
+  llvm::Module *M = (mpModule != NULL) ? mGen->ReleaseModule() : NULL;
+
+  // All of the translation unit is in the module now, the code generator
+  // (whose tables point into the AST) has nothing left to do.
+  delete mGen;
+  mGen = NULL;
+
   // Silently ignore if we weren't initialized for some reason.
   if (!mpModule)
     return;
 
-  llvm::Module *M = mGen->ReleaseModule();
   if (!M) {
     // The module has been released by IR gen on failures, do not double free.
     mpModule = NULL;
@@ -303,9 +846,24 @@ void Backend::HandleTranslationUnit(clang::ASTContext &Ctx) {
 
   HandleTranslationUnitPost(mpModule);
 
+  mModuleGenerated = true;
+  return;
+}
+
+void Backend::EmitModule() {
+  if (!mModuleGenerated)
+    return;
+
+  if (!LinkRuntimeLibrary())
+    return;
+
+  ApplyProfile();
+
   // Create passes for optimization and code emission
 
   // Create and run per-function passes
+  TimeReport::Region FunctionPassesTimer(mTimeReport,
+                                         TimeReport::PT_FunctionPasses);
   CreateFunctionPasses();
   if (mPerFunctionPasses) {
     mPerFunctionPasses->doInitialization();
@@ -320,10 +878,46 @@ void Backend::HandleTranslationUnit(clang::ASTContext &Ctx) {
   }
 
   // Create and run module passes
+  TimeReport::Region ModulePassesTimer(mTimeReport,
+                                       TimeReport::PT_ModulePasses);
   CreateModulePasses();
   if (mPerModulePasses)
     mPerModulePasses->run(*mpModule);
 
+  TimeReport::Region CodeGenTimer(mTimeReport, TimeReport::PT_CodeGen);
+
+  // The size report and the debug info are of the bitcode written below.
+  const Slang::ExtraOutput *SizeReportOutput = NULL;
+  const Slang::ExtraOutput *DebugInfoOutput = NULL;
+  for (Slang::ExtraOutputList::const_iterator I = mExtraOutputs->begin(),
+          E = mExtraOutputs->end();
+       I != E;
+       I++) {
+    if (I->OT == Slang::OT_SizeReport)
+      SizeReportOutput = &*I;
+    else if (I->OT == Slang::OT_DebugInfo)
+      DebugInfoOutput = &*I;
+  }
+
+  // None of the other outputs carries the debug info then, such that the
+  // bitcode shipped in the application loads as fast as a release one.
+  if (DebugInfoOutput != NULL) {
+    mDebugInfoModule = llvm::CloneModule(mpModule);
+    llvm::PassManager StripPM;
+    StripPM.add(llvm::createStripSymbolsPass(/* OnlyDebugInfo = */true));
+    StripPM.run(*mpModule);
+  }
+
+  // Before the code generation of the output changes the module.
+  for (Slang::ExtraOutputList::const_iterator I = mExtraOutputs->begin(),
+          E = mExtraOutputs->end();
+       I != E;
+       I++) {
+    if ((&*I != SizeReportOutput) && (&*I != DebugInfoOutput) &&
+        !EmitExtraOutput(*I))
+      return;
+  }
+
   switch (mOT) {
     case Slang::OT_Assembly:
     case Slang::OT_Object: {
@@ -348,39 +942,42 @@ void Backend::HandleTranslationUnit(clang::ASTContext &Ctx) {
       break;
     }
     case Slang::OT_Bitcode: {
-      llvm::PassManager *BCEmitPM = new llvm::PassManager();
-      std::string BCStr;
-      llvm::raw_string_ostream Bitcode(BCStr);
-      unsigned int TargetAPI = getTargetAPI();
-      switch (TargetAPI) {
-        case SLANG_HC_TARGET_API:
-        case SLANG_HC_MR1_TARGET_API:
-        case SLANG_HC_MR2_TARGET_API: {
-          // Pre-ICS targets must use the LLVM 2.9 BitcodeWriter
-          BCEmitPM->add(llvm_2_9::createBitcodeWriterPass(Bitcode));
-          break;
-        }
-        case SLANG_ICS_TARGET_API:
-        case SLANG_ICS_MR1_TARGET_API: {
-          // ICS targets must use the LLVM 2.9_func BitcodeWriter
-          BCEmitPM->add(llvm_2_9_func::createBitcodeWriterPass(Bitcode));
-          break;
-        }
-        default: {
-          if (TargetAPI < SLANG_MINIMUM_TARGET_API ||
-              TargetAPI > SLANG_MAXIMUM_TARGET_API) {
-            slangAssert(false && "Invalid target API value");
-          }
-          // Switch to the 3.2 BitcodeWriter by default, and don't use
-          // LLVM's included BitcodeWriter at all (for now).
-          BCEmitPM->add(llvm_3_2::createBitcodeWriterPass(Bitcode));
-          //BCEmitPM->add(llvm::createBitcodeWriterPass(Bitcode));
-          break;
-        }
+      TimeReport::Region Timer(mTimeReport, TimeReport::PT_BitcodeWriter);
+      llvm_legacy::BitcodeSizeReport SizeReport;
+      llvm_legacy::BitcodeSizeReport *Report =
+          (SizeReportOutput != NULL) ? &SizeReport : NULL;
+      // The debug info is keyed by the hash of the bitcode, which is written
+      // from memory then.
+      std::string Bitcode;
+      std::string *OutputBuffer = mpOutputBuffer;
+      if ((OutputBuffer == NULL) && (DebugInfoOutput != NULL))
+        OutputBuffer = &Bitcode;
+      if (OutputBuffer != NULL) {
+        // Written from the buffer, which is kept for the caller
+        OutputBuffer->clear();
+        llvm::raw_string_ostream Buffer(*OutputBuffer);
+        WriteBufferedBitcode(mpModule, Buffer, Report);
+        Buffer.flush();
+        if (mpOS != NULL)
+          mpOS->write(OutputBuffer->data(), OutputBuffer->size());
+      } else {
+        WriteWrappedBitcode(mpModule, mpOS, Report);
       }
 
-      BCEmitPM->run(*mpModule);
-      WrapBitcode(Bitcode);
+      if ((Report != NULL) && !EmitExtraOutput(*SizeReportOutput, Report))
+        return;
+
+      if (DebugInfoOutput != NULL) {
+        uint64_t Key =
+            SlangUtils::UpdateHash(SlangUtils::InitialHash, *OutputBuffer);
+        llvm::Value *KeyString =
+            llvm::MDString::get(mLLVMContext, llvm::utohexstr(Key));
+        mDebugInfoModule->getOrInsertNamedMetadata(
+            Slang::DebugInfoKeyMetadataName)->addOperand(
+                llvm::MDNode::get(mLLVMContext, KeyString));
+        if (!EmitExtraOutput(*DebugInfoOutput))
+          return;
+      }
       break;
     }
     case Slang::OT_Nothing: {
@@ -397,17 +994,20 @@ void Backend::HandleTranslationUnit(clang::ASTContext &Ctx) {
 }
 
 void Backend::HandleTagDeclDefinition(clang::TagDecl *D) {
-  mGen->HandleTagDeclDefinition(D);
+  if (mGen != NULL)
+    mGen->HandleTagDeclDefinition(D);
   return;
 }
 
 void Backend::CompleteTentativeDefinition(clang::VarDecl *D) {
-  mGen->CompleteTentativeDefinition(D);
+  if (mGen != NULL)
+    mGen->CompleteTentativeDefinition(D);
   return;
 }
 
 Backend::~Backend() {
   delete mpModule;
+  delete mDebugInfoModule;
   delete mGen;
   delete mPerFunctionPasses;
   delete mPerModulePasses;
@@ -34,6 +34,11 @@ namespace llvm {
   class Module;
   class PassManager;
   class FunctionPassManager;
+  class raw_fd_ostream;
+}
+
+namespace llvm_legacy {
+  class BitcodeSizeReport;
 }
 
 namespace clang {
@@ -53,12 +58,32 @@ class Backend : public clang::ASTConsumer {
   llvm::Module *mpModule;
 
   // Output stream
-  llvm::raw_ostream *mpOS;
+  llvm::raw_fd_ostream *mpOS;
+  // If not NULL, the output goes here, and from here to mpOS (unless it's
+  // NULL)
+  std::string *mpOutputBuffer;
   Slang::OutputType mOT;
 
-  // This helps us translate Clang AST using into LLVM IR
+  // Written from the optimized module before the output
+  const Slang::ExtraOutputList *mExtraOutputs;
+
+  // The optimized module before its debug info was stripped, for the
+  // OT_DebugInfo output (NULL without one)
+  llvm::Module *mDebugInfoModule;
+
+  // Bitcode of the runtime library (empty if it's not linked in)
+  llvm::StringRef mRuntimeLibrary;
+
+  // The counts the module is optimized for (NULL without -fprofile-use)
+  const ExecutionProfile *mProfile;
+
+  // This helps us translate Clang AST using into LLVM IR. Released along
+  // with the AST once the module is generated.
   clang::CodeGenerator *mGen;
 
+  // Whether HandleTranslationUnit() generated the module for EmitModule()
+  bool mModuleGenerated;
+
   // Passes
 
   // Passes apply on function scope in a translation unit
@@ -70,11 +95,49 @@ class Backend : public clang::ASTConsumer {
 
   llvm::formatted_raw_ostream FormattedOutStream;
 
+  // Link the definitions of the functions the module calls from
+  // mRuntimeLibrary into the module. They're internalized, such that the
+  // module passes inline them (and drop them), and they can't clash with the
+  // runtime the module is linked against on the device.
+  bool LinkRuntimeLibrary();
+
+  // Turn the counts of mProfile into the branch weights of the functions of
+  // the module, and optimize the cold functions for size and the calls of the
+  // hot ones for speed.
+  void ApplyProfile();
+
   void CreateFunctionPasses();
   void CreateModulePasses();
   bool CreateCodeGenPasses();
 
-  void WrapBitcode(llvm::raw_string_ostream &Bitcode);
+  // Add the pass writing the bitcode (in the format the target API level can
+  // load) to OS. The size of each part of the bitcode goes to SizeReport, if
+  // not NULL.
+  void AddBitcodeWriterPass(llvm::PassManager *PM, llvm::raw_ostream &OS,
+                            llvm_legacy::BitcodeSizeReport *SizeReport = NULL);
+
+  // Write the bitcode of M encased in a wrapper containing RS version
+  // information to OS.
+  void WriteWrappedBitcode(llvm::Module *M, llvm::raw_fd_ostream *OS,
+                           llvm_legacy::BitcodeSizeReport *SizeReport = NULL);
+
+  // Like WriteWrappedBitcode(), for an OS which can't seek. The bitcode is
+  // written to memory first, then behind its wrapper to OS.
+  void WriteBufferedBitcode(llvm::Module *M, llvm::raw_ostream &OS,
+                            llvm_legacy::BitcodeSizeReport *SizeReport);
+
+  // Compile a copy of the (optimized) module to the assembly or object file
+  // Output into OS. For the native object of another ABI, fails if the
+  // structures or globals of the module are laid out differently for it than
+  // in the bitcode.
+  bool EmitNativeOutput(const Slang::ExtraOutput &Output,
+                        llvm::raw_fd_ostream *OS);
+
+  // Write Output from the (optimized) module. An OT_SizeReport output is
+  // written from SizeReport, which the bitcode was written to before. An
+  // OT_DebugInfo output is written from mDebugInfoModule.
+  bool EmitExtraOutput(const Slang::ExtraOutput &Output,
+                       const llvm_legacy::BitcodeSizeReport *SizeReport = NULL);
 
  protected:
   llvm::LLVMContext &mLLVMContext;
@@ -83,10 +146,20 @@ class Backend : public clang::ASTConsumer {
 
   PragmaList *mPragmas;
 
+  // NULL if the phases are not timed
+  TimeReport *mTimeReport;
+
   virtual unsigned int getTargetAPI() const {
     return SLANG_MAXIMUM_TARGET_API;
   }
 
+  // Whether the module is written to any output. It isn't for OT_Dependency
+  // and OT_Nothing, which check the input only for the diagnostics (and the
+  // reflection). No LLVM IR is generated then.
+  bool isModuleEmitted() const {
+    return (mOT != Slang::OT_Dependency) && (mOT != Slang::OT_Nothing);
+  }
+
   // This handler will be invoked before Clang translates @Ctx to LLVM IR. This
   // give you an opportunity to modified the IR in AST level (scope information,
   // unoptimized IR, etc.). After the return from this method, slang will start
@@ -98,15 +171,26 @@ class Backend : public clang::ASTConsumer {
   // This handler will be invoked when Clang have converted AST tree to LLVM IR.
   // The @M contains the resulting LLVM IR tree. After the return from this
   // method, slang will start doing optimization and code generation for @M.
+  // @M is NULL if no IR is generated (see isModuleEmitted()).
   virtual void HandleTranslationUnitPost(llvm::Module *M) { return; }
 
+  // Write the OT_KernelReport of the optimized module M to OS. There are no
+  // kernels to report by default.
+  virtual void WriteKernelReport(llvm::Module *M, llvm::raw_ostream &OS);
+
  public:
   Backend(clang::DiagnosticsEngine *DiagEngine,
+          llvm::LLVMContext &LLVMContext,
           const clang::CodeGenOptions &CodeGenOpts,
           const clang::TargetOptions &TargetOpts,
           PragmaList *Pragmas,
-          llvm::raw_ostream *OS,
-          Slang::OutputType OT);
+          llvm::raw_fd_ostream *OS,
+          std::string *OutputBuffer,
+          Slang::OutputType OT,
+          const Slang::ExtraOutputList *ExtraOutputs,
+          llvm::StringRef RuntimeLibrary,
+          const ExecutionProfile *Profile,
+          TimeReport *Report);
 
   // Initialize - This is called to initialize the consumer, providing the
   // ASTContext.
@@ -120,8 +204,16 @@ class Backend : public clang::ASTConsumer {
 
   // HandleTranslationUnit - This method is called when the ASTs for entire
   // translation unit have been parsed.
+  // The module is generated, but neither optimized nor written, here (see
+  // EmitModule()).
   virtual void HandleTranslationUnit(clang::ASTContext &Ctx);
 
+  // Run the LLVM passes on the module generated by HandleTranslationUnit()
+  // and write the output. Only the module is used, so the AST (and the
+  // preprocessor) can be gone by then, which lowers the peak memory of the
+  // compilation.
+  void EmitModule();
+
   // HandleTagDeclDefinition - This callback is invoked each time a TagDecl
   // (e.g. struct, union, enum, class) is completed.  This allows the client to
   // hack on the type, which can occur at any point in the file (because these
@@ -16,28 +16,149 @@
 
 #include "slang_diagnostic_buffer.h"
 
+#if !defined(_WIN32)
+#include <errno.h>
+#include <unistd.h>
+#endif
+
+#include <sstream>
+
+#include "clang/Basic/DiagnosticIDs.h"
 #include "clang/Basic/SourceLocation.h"
 #include "clang/Basic/SourceManager.h"
 
 #include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringRef.h"
 
 #include "slang_assert.h"
+#include "slang_utils.h"
 
 namespace slang {
 
+static const char *GetLevelName(clang::DiagnosticsEngine::Level DiagLevel) {
+  switch (DiagLevel) {
+    case clang::DiagnosticsEngine::Note: return "note";
+    case clang::DiagnosticsEngine::Warning: return "warning";
+    case clang::DiagnosticsEngine::Error: return "error";
+    case clang::DiagnosticsEngine::Fatal: return "fatal";
+    default: {
+      slangAssert(0 && "Diagnostic not handled during diagnostic buffering!");
+    }
+  }
+  return "";
+}
+
+// Parse a line rendered by HandleDiagnostic() back into *R.
+static bool ParseDiagnosticLine(llvm::StringRef Line,
+                                DiagnosticBuffer::Record *R) {
+  static const struct {
+    const char *Name;
+    clang::DiagnosticsEngine::Level Level;
+  } Levels[] = {
+    { "note: ", clang::DiagnosticsEngine::Note },
+    { "warning: ", clang::DiagnosticsEngine::Warning },
+    { "error: ", clang::DiagnosticsEngine::Error },
+    { "fatal: ", clang::DiagnosticsEngine::Fatal }
+  };
+
+  for (unsigned i = 0; i < sizeof(Levels) / sizeof(Levels[0]); i++) {
+    llvm::StringRef Name(Levels[i].Name);
+    size_t Pos = Line.startswith(Name) ? 0 : Line.find(" " + Name.str());
+    if (Pos == llvm::StringRef::npos)
+      continue;
+
+    R->Level = Levels[i].Level;
+    R->File.clear();
+    R->Line = R->Column = 0;
+    R->ID = 0;
+    if (Pos == 0) {
+      R->Message = Line.substr(Name.size());
+      return true;
+    }
+
+    // <file>:<line>:<column>:
+    llvm::StringRef Loc = Line.substr(0, Pos);
+    if (!Loc.endswith(":"))
+      continue;
+    Loc = Loc.drop_back();
+    std::pair<llvm::StringRef, llvm::StringRef> Column = Loc.rsplit(':');
+    std::pair<llvm::StringRef, llvm::StringRef> LineNo =
+        Column.first.rsplit(':');
+    if (LineNo.second.getAsInteger(10, R->Line) ||
+        Column.second.getAsInteger(10, R->Column))
+      continue;
+    R->File = LineNo.first;
+    R->Message = Line.substr(Pos + 1 + Name.size());
+    return true;
+  }
+  return false;
+}
+
+static void WriteJSONString(std::ostream &OS, llvm::StringRef S) {
+  OS << '"';
+  for (unsigned i = 0, e = S.size(); i != e; i++) {
+    unsigned char C = S[i];
+    switch (C) {
+      case '"': OS << "\\\""; break;
+      case '\\': OS << "\\\\"; break;
+      case '\n': OS << "\\n"; break;
+      case '\t': OS << "\\t"; break;
+      default: {
+        if (C < 0x20) {
+          static const char Hex[] = "0123456789abcdef";
+          OS << "\\u00" << Hex[C >> 4] << Hex[C & 0xf];
+        } else {
+          OS << C;
+        }
+        break;
+      }
+    }
+  }
+  OS << '"';
+  return;
+}
+
 DiagnosticBuffer::DiagnosticBuffer()
-  : mSOS(new llvm::raw_string_ostream(mDiags)) {
+  : mSOS(new llvm::raw_string_ostream(mDiags)),
+    mStreaming(false),
+    mStreamed(0) {
 }
 
 DiagnosticBuffer::DiagnosticBuffer(DiagnosticBuffer const &src)
   : clang::DiagnosticConsumer(src),
     mDiags(src.mDiags),
-    mSOS(new llvm::raw_string_ostream(mDiags)) {
+    mSOS(new llvm::raw_string_ostream(mDiags)),
+    mRecords(src.mRecords),
+    mStreaming(src.mStreaming),
+    mStreamed(src.mStreamed) {
 }
 
 DiagnosticBuffer::~DiagnosticBuffer() {
 }
 
+void DiagnosticBuffer::streamPending() {
+  const std::string &Diags = str();
+  const char *Buf = Diags.data() + mStreamed;
+  size_t Len = Diags.size() - mStreamed;
+#if !defined(_WIN32)
+  while (Len > 0) {
+    ssize_t N = ::write(STDERR_FILENO, Buf, Len);
+    if (N < 0) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    Buf += N;
+    Len -= N;
+  }
+#else
+  llvm::errs() << llvm::StringRef(Buf, Len);
+  llvm::errs().flush();
+#endif
+  mStreamed = Diags.size();
+  return;
+}
+
 void DiagnosticBuffer::HandleDiagnostic(
     clang::DiagnosticsEngine::Level DiagLevel,
     clang::Diagnostic const &Info) {
@@ -46,35 +167,106 @@ void DiagnosticBuffer::HandleDiagnostic(
   // 100 is enough for storing general diagnosis message
   llvm::SmallString<100> Buf;
 
+  Record R;
+  R.Level = DiagLevel;
+  R.Line = R.Column = 0;
+  R.ID = Info.getID();
+
   if (SrcLoc.isValid()) {
     SrcLoc.print(*mSOS, Info.getSourceManager());
     (*mSOS) << ": ";
-  }
 
-  switch (DiagLevel) {
-    case clang::DiagnosticsEngine::Note: {
-      (*mSOS) << "note: ";
-      break;
-    }
-    case clang::DiagnosticsEngine::Warning: {
-      (*mSOS) << "warning: ";
-      break;
-    }
-    case clang::DiagnosticsEngine::Error: {
-      (*mSOS) << "error: ";
-      break;
-    }
-    case clang::DiagnosticsEngine::Fatal: {
-      (*mSOS) << "fatal: ";
-      break;
-    }
-    default: {
-      slangAssert(0 && "Diagnostic not handled during diagnostic buffering!");
+    clang::PresumedLoc PLoc =
+        Info.getSourceManager().getPresumedLoc(SrcLoc);
+    if (PLoc.isValid()) {
+      R.File = PLoc.getFilename();
+      R.Line = PLoc.getLine();
+      R.Column = PLoc.getColumn();
     }
   }
 
+  (*mSOS) << GetLevelName(DiagLevel) << ": ";
+
   Info.FormatDiagnostic(Buf);
   (*mSOS) << Buf.str() << '\n';
+
+  R.Message = Buf.str();
+  mRecords.push_back(R);
+
+  if (mStreaming)
+    streamPending();
+}
+
+void DiagnosticBuffer::append(llvm::StringRef Diags) {
+  *mSOS << Diags;
+
+  llvm::StringRef Rest = Diags;
+  while (!Rest.empty()) {
+    std::pair<llvm::StringRef, llvm::StringRef> Line = Rest.split('\n');
+    Rest = Line.second;
+    Record R;
+    if (ParseDiagnosticLine(Line.first, &R))
+      mRecords.push_back(R);
+  }
+
+  if (mStreaming)
+    streamPending();
+  return;
+}
+
+void DiagnosticBuffer::setStreaming(bool Streaming) {
+  mStreaming = Streaming;
+  if (mStreaming)
+    streamPending();
+  return;
+}
+
+bool DiagnosticBuffer::writeSARIF(const std::string &File,
+                                  std::string *Error) const {
+  std::stringstream S;
+  S << "{\n"
+    << "  \"$schema\": \"https://json.schemastore.org/sarif-2.1.0.json\",\n"
+    << "  \"version\": \"2.1.0\",\n"
+    << "  \"runs\": [ {\n"
+    << "    \"tool\": { \"driver\": { \"name\": \"llvm-rs-cc\" } },\n"
+    << "    \"results\": [";
+  for (unsigned i = 0, e = mRecords.size(); i != e; i++) {
+    const Record &R = mRecords[i];
+    S << ((i == 0) ? "\n" : ",\n") << "      { ";
+
+    // The warnings are known by the flag controlling them.
+    if (R.ID != 0) {
+      llvm::StringRef Flag =
+          clang::DiagnosticIDs::getWarningOptionForDiag(R.ID);
+      if (!Flag.empty()) {
+        S << "\"ruleId\": ";
+        WriteJSONString(S, "-W" + Flag.str());
+        S << ", ";
+      }
+    }
+
+    S << "\"level\": \""
+      << ((R.Level == clang::DiagnosticsEngine::Fatal) ? "error"
+                                                       : GetLevelName(R.Level))
+      << "\", \"message\": { \"text\": ";
+    WriteJSONString(S, R.Message);
+    S << " }";
+
+    if (!R.File.empty()) {
+      S << ", \"locations\": [ { \"physicalLocation\": { "
+        << "\"artifactLocation\": { \"uri\": ";
+      WriteJSONString(S, R.File);
+      S << " }, \"region\": { \"startLine\": " << R.Line
+        << ", \"startColumn\": " << R.Column << " } } } ]";
+    }
+
+    S << ", \"properties\": { \"id\": " << R.ID << " } }";
+  }
+  S << "\n    ]\n"
+    << "  } ]\n"
+    << "}\n";
+
+  return SlangUtils::WriteFileAtomically(File, S.str(), Error);
 }
 
 clang::DiagnosticConsumer *
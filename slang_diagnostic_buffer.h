@@ -18,6 +18,7 @@
 #define _FRAMEWORKS_COMPILE_SLANG_SLANG_DIAGNOSTIC_BUFFER_H_
 
 #include <string>
+#include <vector>
 
 #include "clang/Basic/Diagnostic.h"
 
@@ -30,11 +31,40 @@ namespace llvm {
 namespace slang {
 
 // The diagnostics consumer instance (for reading the processed diagnostics)
+//
+// Besides the rendered text, each diagnostic is kept as a Record, e.g., to be
+// written as SARIF (writeSARIF()). Each thread compiling has its own buffer,
+// so there's no locking. When streaming, a diagnostic is also written to
+// stderr as soon as it's handled, with a single write() such that the lines
+// of concurrent buffers don't mix.
 class DiagnosticBuffer : public clang::DiagnosticConsumer {
+ public:
+  struct Record {
+    clang::DiagnosticsEngine::Level Level;
+    // Empty (and Line and Column 0) for a diagnostic without a location
+    std::string File;
+    unsigned Line;
+    unsigned Column;
+    // 0 for the diagnostics rendered earlier (see append())
+    unsigned ID;
+    std::string Message;
+  };
+  typedef std::vector<Record> RecordList;
+
  private:
   std::string mDiags;
   llvm::OwningPtr<llvm::raw_string_ostream> mSOS;
 
+  // All the diagnostics since the buffer was created, unlike mDiags which
+  // only has the ones since the last reset()
+  RecordList mRecords;
+
+  bool mStreaming;
+  // How much of mDiags is on stderr already
+  size_t mStreamed;
+
+  void streamPending();
+
  public:
   DiagnosticBuffer();
 
@@ -53,9 +83,33 @@ class DiagnosticBuffer : public clang::DiagnosticConsumer {
     return mDiags;
   }
 
+  // Add diagnostics rendered earlier (with their records parsed back from the
+  // text).
+  void append(llvm::StringRef Diags);
+
   inline void reset() {
     this->mSOS->str().clear();
+    mStreamed = 0;
+  }
+
+  // Write the diagnostics to stderr as they come (starting with the ones
+  // buffered so far), rather than leaving it to the owner of the buffer.
+  void setStreaming(bool Streaming);
+  bool isStreaming() const { return mStreaming; }
+
+  const RecordList &getRecords() const { return mRecords; }
+  // Move the records out to *Records (e.g., to hand them to another buffer
+  // with appendRecords()).
+  void takeRecords(RecordList *Records) {
+    Records->clear();
+    Records->swap(mRecords);
   }
+  void appendRecords(const RecordList &Records) {
+    mRecords.insert(mRecords.end(), Records.begin(), Records.end());
+  }
+
+  // Write the records as a SARIF 2.1.0 log to File.
+  bool writeSARIF(const std::string &File, std::string *Error) const;
 };
 
 }  // namespace slang
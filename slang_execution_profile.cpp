@@ -0,0 +1,108 @@
+/*
+ * Copyright 2013, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "slang_execution_profile.h"
+
+#include <string>
+#include <vector>
+
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringExtras.h"
+
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/system_error.h"
+
+#include "slang_utils.h"
+
+namespace slang {
+
+// A function is hot with at least a tenth of the calls of the hottest one,
+// and cold with less than a thousandth of them.
+static const uint64_t HotFraction = 10;
+static const uint64_t ColdFraction = 1000;
+
+bool ExecutionProfile::read(const std::string &File, std::string *Error) {
+  llvm::OwningPtr<llvm::MemoryBuffer> MB;
+  llvm::error_code EC = llvm::MemoryBuffer::getFile(File, MB);
+  if (EC != llvm::errc::success) {
+    Error->assign(EC.message());
+    return false;
+  }
+  mHash = SlangUtils::UpdateHash(SlangUtils::InitialHash, MB->getBuffer());
+
+  llvm::StringRef Rest = MB->getBuffer();
+  for (unsigned LineNo = 1; !Rest.empty(); LineNo++) {
+    std::pair<llvm::StringRef, llvm::StringRef> Line = Rest.split('\n');
+    Rest = Line.second;
+
+    llvm::StringRef Text = Line.first.trim();
+    if (Text.empty() || Text.startswith("#"))
+      continue;
+
+    llvm::SmallVector<llvm::StringRef, 8> Fields;
+    llvm::SplitString(Text, Fields);
+    bool Valid = (Fields.size() >= 3);
+    if (Valid && (Fields[0] == "function")) {
+      FunctionCounts &Counts = mFunctions[Fields[1]];
+      Valid = (Fields.size() == 3) &&
+              !Fields[2].getAsInteger(10, Counts.EntryCount);
+      Counts.HasEntryCount = true;
+      if (Valid && (Counts.EntryCount > mMaxEntryCount))
+        mMaxEntryCount = Counts.EntryCount;
+    } else if (Valid && (Fields[0] == "branch")) {
+      unsigned Index;
+      std::vector<uint64_t> Successors;
+      Valid = (Fields.size() >= 5) && !Fields[2].getAsInteger(10, Index);
+      for (unsigned i = 3, e = Fields.size(); Valid && (i != e); i++) {
+        uint64_t Count;
+        Valid = !Fields[i].getAsInteger(10, Count);
+        Successors.push_back(Count);
+      }
+      if (Valid)
+        mFunctions[Fields[1]].Branches[Index] = Successors;
+    } else {
+      Valid = false;
+    }
+
+    if (!Valid) {
+      Error->assign("malformed line " + llvm::utostr(LineNo) + ": '" +
+                    Text.str() + "'");
+      return false;
+    }
+  }
+  return true;
+}
+
+const ExecutionProfile::FunctionCounts *
+ExecutionProfile::getFunction(llvm::StringRef Name) const {
+  llvm::StringMap<FunctionCounts>::const_iterator I = mFunctions.find(Name);
+  if (I == mFunctions.end())
+    return NULL;
+  return &I->getValue();
+}
+
+bool ExecutionProfile::isHot(const FunctionCounts &Counts) const {
+  return Counts.HasEntryCount && (Counts.EntryCount > 0) &&
+         (Counts.EntryCount >= mMaxEntryCount / HotFraction);
+}
+
+bool ExecutionProfile::isCold(const FunctionCounts &Counts) const {
+  return Counts.HasEntryCount &&
+         (Counts.EntryCount < mMaxEntryCount / ColdFraction);
+}
+
+}  // namespace slang
@@ -0,0 +1,86 @@
+/*
+ * Copyright 2013, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _FRAMEWORKS_COMPILE_SLANG_SLANG_EXECUTION_PROFILE_H_  // NOLINT
+#define _FRAMEWORKS_COMPILE_SLANG_SLANG_EXECUTION_PROFILE_H_
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/DataTypes.h"
+
+namespace slang {
+
+// The counts collected on the device from runs of the scripts, for the
+// profile-guided optimization (-fprofile-use). Each line of the profile is
+// one of
+//
+//   function <name> <count>
+//   branch <name> <index> <count>...
+//
+// The first is the number of calls of the function <name>. The second is how
+// often each successor of its <index>th conditional branch or switch was
+// taken, counting the branches from 0 in the order of the blocks clang
+// generates, and the successors in the order of the IR (the default first for
+// a switch). Empty lines and the ones starting with '#' are skipped.
+class ExecutionProfile {
+ public:
+  struct FunctionCounts {
+    bool HasEntryCount;
+    uint64_t EntryCount;
+    // The counts of the successors of a branch, by its index
+    std::map<unsigned, std::vector<uint64_t> > Branches;
+
+    FunctionCounts() : HasEntryCount(false), EntryCount(0) { }
+  };
+
+ private:
+  llvm::StringMap<FunctionCounts> mFunctions;
+
+  // The entry count of the hottest function
+  uint64_t mMaxEntryCount;
+
+  uint64_t mHash;
+
+ public:
+  ExecutionProfile() : mMaxEntryCount(0), mHash(0) { }
+
+  // Returns false (with the reason in *Error) if File can't be read or has a
+  // malformed line.
+  bool read(const std::string &File, std::string *Error);
+
+  // NULL if there are no counts of the function Name
+  const FunctionCounts *getFunction(llvm::StringRef Name) const;
+
+  uint64_t getMaxEntryCount() const { return mMaxEntryCount; }
+
+  // Whether the function of Counts runs (relatively to the hottest one) often
+  // enough to optimize it for speed at the expense of size, or so rarely that
+  // it's optimized for size instead. It's neither without an entry count.
+  bool isHot(const FunctionCounts &Counts) const;
+  bool isCold(const FunctionCounts &Counts) const;
+
+  // The SlangUtils::UpdateHash() of the content of the profile, for the
+  // compile cache
+  uint64_t getHash() const { return mHash; }
+};
+
+}  // namespace slang
+
+#endif  // _FRAMEWORKS_COMPILE_SLANG_SLANG_EXECUTION_PROFILE_H_  NOLINT
@@ -0,0 +1,156 @@
+/*
+ * Copyright 2013, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "slang_header_cache.h"
+
+#include <sys/stat.h>
+#include <time.h>
+
+#include <map>
+#include <set>
+
+#include "clang/Basic/FileManager.h"
+
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/ADT/StringMap.h"
+
+#include "llvm/Support/ManagedStatic.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Mutex.h"
+#include "llvm/Support/MutexGuard.h"
+#include "llvm/Support/system_error.h"
+
+#include "slang_utils.h"
+
+namespace slang {
+
+namespace {
+
+struct CachedHeader {
+  const llvm::MemoryBuffer *Buffer;
+  // What File was when Buffer was read
+  dev_t Device;
+  ino_t Inode;
+  off_t Size;
+  time_t ModTime;
+  uint64_t Hash;
+  // When Buffer was read (or last found to be File's content)
+  time_t ReadTime;
+};
+
+struct HeaderCacheState {
+  llvm::sys::Mutex Lock;
+  llvm::StringMap<CachedHeader> Headers;
+  // The number of uses of each buffer handed out by GetBuffer()
+  std::map<const llvm::MemoryBuffer*, unsigned> Uses;
+  // The buffers of the headers which changed since they were read, freed with
+  // their last use.
+  std::set<const llvm::MemoryBuffer*> Stale;
+
+  ~HeaderCacheState() {
+    for (llvm::StringMap<CachedHeader>::iterator I = Headers.begin(),
+             E = Headers.end();
+         I != E;
+         I++)
+      delete I->getValue().Buffer;
+    for (std::set<const llvm::MemoryBuffer*>::iterator I = Stale.begin(),
+             E = Stale.end();
+         I != E;
+         I++)
+      delete *I;
+  }
+};
+
+}  // namespace
+
+static llvm::ManagedStatic<HeaderCacheState> State;
+
+// Returns true if Header.Buffer is still the content of the file Stat is of,
+// reading it again if the modification time can't tell.
+static bool IsUpToDate(CachedHeader &Header, const char *File,
+                       const struct stat &Stat) {
+  if ((Header.Device != Stat.st_dev) || (Header.Inode != Stat.st_ino) ||
+      (Header.Size != Stat.st_size) || (Header.ModTime != Stat.st_mtime))
+    return false;
+  // A modification in the second File was read in left the time as it was.
+  if (Header.ModTime < Header.ReadTime)
+    return true;
+
+  time_t Now = time(NULL);
+  llvm::OwningPtr<llvm::MemoryBuffer> MB;
+  if ((llvm::MemoryBuffer::getFile(File, MB, Stat.st_size) !=
+       llvm::errc::success) ||
+      (SlangUtils::UpdateHash(SlangUtils::InitialHash, MB->getBuffer()) !=
+       Header.Hash))
+    return false;
+  Header.ReadTime = Now;
+  return true;
+}
+
+const llvm::MemoryBuffer *
+HeaderCache::GetBuffer(const clang::FileEntry *File) {
+  llvm::MutexGuard Locked(State->Lock);
+
+  struct stat Stat;
+  if (::stat(File->getName(), &Stat) != 0)
+    return NULL;
+
+  CachedHeader &Header = State->Headers[File->getName()];
+  if (Header.Buffer != NULL) {
+    if (IsUpToDate(Header, File->getName(), Stat)) {
+      State->Uses[Header.Buffer]++;
+      return Header.Buffer;
+    }
+    if (State->Uses.count(Header.Buffer))
+      State->Stale.insert(Header.Buffer);
+    else
+      delete Header.Buffer;
+    Header.Buffer = NULL;
+  }
+
+  // Taken before the read, a modification during it is caught next time.
+  time_t ReadTime = time(NULL);
+  llvm::OwningPtr<llvm::MemoryBuffer> MB;
+  if (llvm::MemoryBuffer::getFile(File->getName(), MB, Stat.st_size) !=
+      llvm::errc::success)
+    return NULL;
+
+  Header.Buffer = MB.take();
+  Header.Device = Stat.st_dev;
+  Header.Inode = Stat.st_ino;
+  Header.Size = Stat.st_size;
+  Header.ModTime = Stat.st_mtime;
+  Header.Hash = SlangUtils::UpdateHash(SlangUtils::InitialHash,
+                                       Header.Buffer->getBuffer());
+  Header.ReadTime = ReadTime;
+  State->Uses[Header.Buffer]++;
+  return Header.Buffer;
+}
+
+void HeaderCache::ReleaseBuffer(const llvm::MemoryBuffer *MB) {
+  llvm::MutexGuard Locked(State->Lock);
+
+  std::map<const llvm::MemoryBuffer*, unsigned>::iterator I =
+      State->Uses.find(MB);
+  if ((I == State->Uses.end()) || (--I->second != 0))
+    return;
+  State->Uses.erase(I);
+  if (State->Stale.erase(MB))
+    delete MB;
+  return;
+}
+
+}  // namespace slang
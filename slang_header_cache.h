@@ -0,0 +1,54 @@
+/*
+ * Copyright 2013, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _FRAMEWORKS_COMPILE_SLANG_SLANG_HEADER_CACHE_H_  // NOLINT
+#define _FRAMEWORKS_COMPILE_SLANG_SLANG_HEADER_CACHE_H_
+
+namespace clang {
+  class FileEntry;
+}
+
+namespace llvm {
+  class MemoryBuffer;
+}
+
+namespace slang {
+
+// The content of the headers on the include paths, read (mmapped if they're
+// large enough) once per process and shared by the source managers of all the
+// compiles, e.g., those of the workers of a parallel compile or of the
+// requests to the server. Thread-safe.
+class HeaderCache {
+ private:
+  HeaderCache() {}
+
+ public:
+  // The content of File, or NULL if it can't be read. A buffer is reused as
+  // long as File is the same file (device and inode) with the same size and
+  // modification time. If File was modified in the second it was read, its
+  // content is compared as well. The buffer must be given to a SourceManager
+  // with DoNotFree set, and released with ReleaseBuffer() once that
+  // SourceManager is done with it.
+  static const llvm::MemoryBuffer *GetBuffer(const clang::FileEntry *File);
+
+  // Drop a use of MB, as returned by GetBuffer(). A buffer replaced by a newer
+  // content of its file is freed with its last use.
+  static void ReleaseBuffer(const llvm::MemoryBuffer *MB);
+};
+
+}  // namespace slang
+
+#endif  // _FRAMEWORKS_COMPILE_SLANG_SLANG_HEADER_CACHE_H_  NOLINT
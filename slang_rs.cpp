@@ -16,25 +16,48 @@
 
 #include "slang_rs.h"
 
+#include <algorithm>
 #include <cstring>
+#include <ctime>
 #include <list>
 #include <sstream>
 #include <string>
 #include <utility>
 #include <vector>
 
+#if !defined(_WIN32)
+#include <pthread.h>
+#endif
+
+#include "clang/Basic/DiagnosticOptions.h"
 #include "clang/Basic/SourceLocation.h"
 
 #include "clang/Frontend/FrontendDiagnostic.h"
+#include "clang/Frontend/Utils.h"
+
+#include "clang/Lex/Preprocessor.h"
+#include "clang/Lex/PreprocessorOptions.h"
 
 #include "clang/Sema/SemaDiagnostic.h"
 
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringExtras.h"
+
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MutexGuard.h"
 #include "llvm/Support/Path.h"
+#include "llvm/Support/Threading.h"
+#include "llvm/Support/raw_ostream.h"
 
 #include "os_sep.h"
+#include "slang_execution_profile.h"
 #include "slang_rs_backend.h"
+#include "slang_rs_compile_cache.h"
+#include "slang_rs_odr_database.h"
 #include "slang_rs_context.h"
 #include "slang_rs_export_type.h"
+#include "slang_rs_export_usage.h"
+#include "slang_utils.h"
 
 #include "slang_rs_reflection_cpp.h"
 
@@ -79,7 +102,10 @@ bool SlangRS::reflectToJava(const std::string &OutputPathBase,
   return mRSContext->reflectToJava(OutputPathBase,
                                    RSPackageName,
                                    getInputFileName(),
-                                   getOutputFileName());
+                                   getOutputFileName(),
+                                   mWriteIfChanged,
+                                   mReflectionBuffers,
+                                   mNumJobs);
 }
 
 bool SlangRS::generateBitcodeAccessor(const std::string &OutputPathBase,
@@ -88,95 +114,200 @@ bool SlangRS::generateBitcodeAccessor(const std::string &OutputPathBase,
 
   BCAccessorContext.rsFileName = getInputFileName().c_str();
   BCAccessorContext.bcFileName = getOutputFileName().c_str();
+  BCAccessorContext.bcBuffer = getOutputBuffer();
   BCAccessorContext.reflectPath = OutputPathBase.c_str();
   BCAccessorContext.packageName = PackageName.c_str();
-  BCAccessorContext.bcStorage = BCST_JAVA_CODE;   // Must be BCST_JAVA_CODE
+  // Must be BCST_JAVA_CODE or BCST_JAVA_STRING
+  BCAccessorContext.bcStorage = mBitcodeStorage;
+  BCAccessorContext.writeIfChanged = mWriteIfChanged;
 
   return RSSlangReflectUtils::GenerateBitCodeAccessor(BCAccessorContext);
 }
 
-bool SlangRS::checkODR(const char *CurInputFile) {
-  for (RSContext::ExportableList::iterator I = mRSContext->exportable_begin(),
-          E = mRSContext->exportable_end();
+// Returns RSE as a record type if it is subject to the ODR check, i.e., it was
+// defined by the user in the source.
+static RSExportRecordType *GetUserDefinedRecordType(RSExportable *RSE) {
+  if (RSE->getKind() != RSExportable::EX_TYPE)
+    return NULL;
+
+  RSExportType *ET = static_cast<RSExportType *>(RSE);
+  if (ET->getClass() != RSExportType::ExportClassRecord)
+    return NULL;
+
+  RSExportRecordType *ERT = static_cast<RSExportRecordType *>(ET);
+
+  // Artificial record types (create by us not by user in the source) always
+  // conforms the ODR.
+  if (ERT->isArtificial())
+    return NULL;
+
+  return ERT;
+}
+
+// Describe the structure of ET as RSExportType::equals() compares it, i.e.,
+// without the names of the types and of the fields.
+static void DescribeStructure(std::ostream &OS, const RSExportType *ET) {
+  OS << ET->getClass();
+  switch (ET->getClass()) {
+    case RSExportType::ExportClassPrimitive: {
+      OS << ' ' << static_cast<const RSExportPrimitiveType*>(ET)->getType();
+      break;
+    }
+    case RSExportType::ExportClassVector: {
+      const RSExportVectorType *EVT =
+          static_cast<const RSExportVectorType*>(ET);
+      OS << ' ' << EVT->getType() << 'x' << EVT->getNumElement();
+      break;
+    }
+    case RSExportType::ExportClassPointer: {
+      OS << " *";
+      DescribeStructure(
+          OS, static_cast<const RSExportPointerType*>(ET)->getPointeeType());
+      break;
+    }
+    case RSExportType::ExportClassMatrix: {
+      OS << ' ' << static_cast<const RSExportMatrixType*>(ET)->getDim();
+      break;
+    }
+    case RSExportType::ExportClassConstantArray: {
+      const RSExportConstantArrayType *ECAT =
+          static_cast<const RSExportConstantArrayType*>(ET);
+      OS << " [" << ECAT->getSize() << "] ";
+      DescribeStructure(OS, ECAT->getElementType());
+      break;
+    }
+    case RSExportType::ExportClassRecord: {
+      const RSExportRecordType *ERT =
+          static_cast<const RSExportRecordType*>(ET);
+      OS << " {" << ERT->getFields().size();
+      for (RSExportRecordType::const_field_iterator I = ERT->fields_begin(),
+               E = ERT->fields_end();
+           I != E;
+           I++) {
+        OS << ' ';
+        DescribeStructure(OS, (*I)->getType());
+      }
+      OS << '}';
+      break;
+    }
+    default: {
+      break;
+    }
+  }
+  OS << ';';
+  return;
+}
+
+void SlangRS::GetODRRecordTypes(RSContext *Context, const char *CurInputFile,
+                                ODRRecordTypeList *RecordTypes) {
+  for (RSContext::ExportableList::iterator I = Context->exportable_begin(),
+          E = Context->exportable_end();
        I != E;
        I++) {
-    RSExportable *RSE = *I;
-    if (RSE->getKind() != RSExportable::EX_TYPE)
+    RSExportRecordType *ERT = GetUserDefinedRecordType(*I);
+    if (ERT == NULL)
       continue;
 
-    RSExportType *ET = static_cast<RSExportType *>(RSE);
-    if (ET->getClass() != RSExportType::ExportClassRecord)
-      continue;
+    ODRRecordType RT;
+    RT.Name = ERT->getName();
+    std::stringstream Signature;
+    DescribeStructure(Signature, ERT);
+    for (RSExportRecordType::const_field_iterator FI = ERT->fields_begin(),
+             FE = ERT->fields_end();
+         FI != FE;
+         FI++)
+      Signature << ' ' << (*FI)->getName();
+    RT.Signature = Signature.str();
+    RT.Definition = RSODRDatabase::GetDefinition(
+        ERT, Context->getReflectJavaPackageName(), CurInputFile);
+    RecordTypes->push_back(RT);
+  }
+  return;
+}
 
-    RSExportRecordType *ERT = static_cast<RSExportRecordType *>(ET);
+bool SlangRS::checkODR(const char *CurInputFile) {
+  // Nothing to check if the results of CurInputFile came from the cache, they
+  // are only reused if there's no record type (see restoreFromCache()).
+  if (mRSContext == NULL)
+    return true;
 
-    // Artificial record types (create by us not by user in the source) always
-    // conforms the ODR.
-    if (ERT->isArtificial())
-      continue;
+  ODRRecordTypeList RecordTypes;
+  GetODRRecordTypes(mRSContext, CurInputFile, &RecordTypes);
+  for (unsigned i = 0, e = RecordTypes.size(); i != e; i++) {
+    if (!checkODR(RecordTypes[i], CurInputFile))
+      return false;
+  }
+  return checkODRDatabase(RecordTypes, CurInputFile);
+}
 
-    // Key to lookup ERT in ReflectedDefinitions
-    llvm::StringRef RDKey(ERT->getName());
-    ReflectedDefinitionListTy::const_iterator RD =
-        ReflectedDefinitions.find(RDKey);
-
-    if (RD != ReflectedDefinitions.end()) {
-      const RSExportRecordType *Reflected = RD->getValue().first;
-      // There's a record (struct) with the same name reflected before. Enforce
-      // ODR checking - the Reflected must hold *exactly* the same "definition"
-      // as the one defined previously. We say two record types A and B have the
-      // same definition iff:
-      //
-      //  struct A {              struct B {
-      //    Type(a1) a1,            Type(b1) b1,
-      //    Type(a2) a2,            Type(b1) b2,
-      //    ...                     ...
-      //    Type(aN) aN             Type(b3) b3,
-      //  };                      }
-      //  Cond. #1. They have same number of fields, i.e., N = M;
-      //  Cond. #2. for (i := 1 to N)
-      //              Type(ai) = Type(bi) must hold;
-      //  Cond. #3. for (i := 1 to N)
-      //              Name(ai) = Name(bi) must hold;
-      //
-      // where,
-      //  Type(F) = the type of field F and
-      //  Name(F) = the field name.
-
-      bool PassODR = false;
-      // Cond. #1 and Cond. #2
-      if (Reflected->equals(ERT)) {
-        // Cond #3.
-        RSExportRecordType::const_field_iterator AI = Reflected->fields_begin(),
-                                                 BI = ERT->fields_begin();
-
-        for (unsigned i = 0, e = Reflected->getFields().size(); i != e; i++) {
-          if ((*AI)->getName() != (*BI)->getName())
-            break;
-          AI++;
-          BI++;
-        }
-        PassODR = (AI == (Reflected->fields_end()));
-      }
+bool SlangRS::checkODR(const ODRRecordType &RT, const char *CurInputFile) {
+  // Key to lookup RT in ReflectedDefinitions
+  llvm::StringRef RDKey(RT.Name);
+  ReflectedDefinitionListTy::const_iterator RD =
+      ReflectedDefinitions.find(RDKey);
+
+  if (RD != ReflectedDefinitions.end()) {
+    // There's a record (struct) with the same name reflected before. Enforce
+    // ODR checking - the Reflected must hold *exactly* the same "definition"
+    // as the one defined previously. We say two record types A and B have the
+    // same definition iff:
+    //
+    //  struct A {              struct B {
+    //    Type(a1) a1,            Type(b1) b1,
+    //    Type(a2) a2,            Type(b1) b2,
+    //    ...                     ...
+    //    Type(aN) aN             Type(b3) b3,
+    //  };                      }
+    //  Cond. #1. They have same number of fields, i.e., N = M;
+    //  Cond. #2. for (i := 1 to N)
+    //              Type(ai) = Type(bi) must hold;
+    //  Cond. #3. for (i := 1 to N)
+    //              Name(ai) = Name(bi) must hold;
+    //
+    // where,
+    //  Type(F) = the type of field F and
+    //  Name(F) = the field name.
+    //
+    // The signatures hold all three.
+    if (RD->getValue().first != RT.Signature) {
+      getDiagnostics().Report(mDiagErrorODR) << RT.Name
+                                             << CurInputFile
+                                             << RD->getValue().second;
+      return false;
+    }
+  } else {
+    llvm::StringMapEntry<ReflectedDefinitionTy> *ME =
+        llvm::StringMapEntry<ReflectedDefinitionTy>::Create(RDKey.begin(),
+                                                            RDKey.end());
+    ME->setValue(std::make_pair(RT.Signature, CurInputFile));
 
-      if (!PassODR) {
-        getDiagnostics().Report(mDiagErrorODR) << Reflected->getName()
-                                               << getInputFileName()
-                                               << RD->getValue().second;
-        return false;
-      }
-    } else {
-      llvm::StringMapEntry<ReflectedDefinitionTy> *ME =
-          llvm::StringMapEntry<ReflectedDefinitionTy>::Create(RDKey.begin(),
-                                                              RDKey.end());
-      ME->setValue(std::make_pair(ERT, CurInputFile));
+    if (!ReflectedDefinitions.insert(ME))
+      ME->Destroy();
+  }
+  return true;
+}
 
-      if (!ReflectedDefinitions.insert(ME))
-        delete ME;
+bool SlangRS::checkODRDatabase(const ODRRecordTypeList &RecordTypes,
+                               const char *CurInputFile) {
+  if (mODRDatabase.empty())
+    return true;
 
-      // Take the ownership of ERT such that it won't be freed in ~RSContext().
-      ERT->keep();
-    }
+  std::vector<RSODRDatabase::Definition> Defs;
+  for (unsigned i = 0, e = RecordTypes.size(); i != e; i++)
+    Defs.push_back(RecordTypes[i].Definition);
+
+  int Conflict;
+  std::string ConflictFile, Error;
+  if (!RSODRDatabase::Update(mODRDatabase, CurInputFile, Defs, &Conflict,
+                             &ConflictFile, &Error)) {
+    getDiagnostics().Report(mDiagErrorODRDatabase) << mODRDatabase << Error;
+    return false;
+  }
+
+  if (Conflict >= 0) {
+    getDiagnostics().Report(mDiagErrorODR) << RecordTypes[Conflict].Name
+                                           << CurInputFile << ConflictFile;
+    return false;
   }
   return true;
 }
@@ -205,10 +336,20 @@ void SlangRS::initDiagnostic() {
       "type '%0' in different translation unit (%1 v.s. %2) "
       "has incompatible type definition");
 
+  mDiagErrorODRDatabase =
+    DiagEngine.getCustomDiagID(
+      clang::DiagnosticsEngine::Error,
+      "cannot update the ODR database '%0': %1");
+
   mDiagErrorTargetAPIRange =
     DiagEngine.getCustomDiagID(
       clang::DiagnosticsEngine::Error,
       "target API level '%0' is out of range ('%1' - '%2')");
+
+  mDiagErrorBatchManifest =
+    DiagEngine.getCustomDiagID(
+      clang::DiagnosticsEngine::Error,
+      "cannot write the batch manifest '%0': %1");
 }
 
 void SlangRS::initPreprocessor() {
@@ -218,31 +359,76 @@ void SlangRS::initPreprocessor() {
   RSH << "#define RS_VERSION " << mTargetAPI << std::endl;
   RSH << "#include \"rs_core." RS_HEADER_SUFFIX "\"" << std::endl;
   PP.setPredefines(RSH.str());
+
+  // Also recorded in the preprocessor options, which a PCH keeps, so that a
+  // PCH for another target API is never loaded (see createASTContext()).
+  PP.getPreprocessorOpts().addMacroDef("RS_VERSION=" +
+                                       llvm::utostr(mTargetAPI));
 }
 
 void SlangRS::initASTContext() {
   mRSContext = new RSContext(getPreprocessor(),
                              getASTContext(),
                              getTargetInfo(),
+                             getLLVMContext(),
                              &mPragmas,
                              mTargetAPI,
                              &mGeneratedFileNames);
+  mRSContext->setVarBatch(mVarBatch);
+  mRSContext->setScriptFieldBuffer(mScriptFieldBuffer);
+  mRSContext->setPreallocatedPackers(mPreallocatedPackers);
+  mRSContext->setLazyInit(mLazyInit);
+  mRSContext->setCppHeaderOnly(mCppHeaderOnly);
+  mRSContext->setCppBitcodeBlob(mCppBitcodeBlob);
+  mRSContext->setWidenKernels(mWidenKernels);
+  mRSContext->setCompactMetadata(mCompactMetadata);
+  mRSContext->setInstrumentKernels(mInstrumentKernels);
+  mRSContext->setLayoutHotGlobals(mLayoutHotGlobals);
+  mRSContext->setExportAccessSets(mExportAccessSets);
+  mRSContext->setStrippedCalls(mStrippedCalls);
+  if (mExportUsage != NULL)
+    mRSContext->setUsedExports(mExportUsage->getUsedExports(
+        RSSlangReflectUtils::GetFileNameStem(getInputFileName().c_str())));
+  if (getOutputType() == Slang::OT_Bitcode)
+    mRSContext->setPrebuiltABIs(mAOTABIs);
 }
 
 clang::ASTConsumer
 *SlangRS::createBackend(const clang::CodeGenOptions& CodeGenOpts,
-                        llvm::raw_ostream *OS,
+                        llvm::raw_fd_ostream *OS,
+                        std::string *OutputBuffer,
                         Slang::OutputType OT) {
     return new RSBackend(mRSContext,
                          &getDiagnostics(),
+                         getLLVMContext(),
                          CodeGenOpts,
                          getTargetOptions(),
                          &mPragmas,
                          OS,
+                         OutputBuffer,
                          OT,
+                         &getExtraOutputs(),
+                         getRuntimeLibrary(),
+                         getProfile(),
                          getSourceManager(),
                          mAllowRSPrefix,
-                         mIsFilterscript);
+                         mIsFilterscript,
+                         getTimeReport());
+}
+
+// The extension llvm-rs-cc gives the output files of OT
+static const char *GetOutputFileExtension(Slang::OutputType OT) {
+  switch (OT) {
+    case Slang::OT_Assembly: return "S";
+    case Slang::OT_LLVMAssembly: return "ll";
+    case Slang::OT_Object: return "o";
+    case Slang::OT_Bitcode: return "bc";
+    case Slang::OT_SizeReport: return "size.json";
+    case Slang::OT_KernelReport: return "kernels.json";
+    case Slang::OT_DebugInfo: return "dbg.bc";
+    default: slangAssert(false && "Output type without a file");
+  }
+  return "";
 }
 
 bool SlangRS::IsRSHeaderFile(const char *File) {
@@ -269,9 +455,663 @@ bool SlangRS::IsLocInRSHeaderFile(const clang::SourceLocation &Loc,
 
 SlangRS::SlangRS()
   : Slang(), mRSContext(NULL), mAllowRSPrefix(false), mTargetAPI(0),
-    mIsFilterscript(false) {
+    mIsFilterscript(false), mBitcodeStorage(BCST_APK_RESOURCE),
+    mOutputDep(false), mNumJobs(1), mExportUsage(NULL), mVarBatch(false),
+    mScriptFieldBuffer(false), mPreallocatedPackers(false), mLazyInit(false),
+    mCppHeaderOnly(false), mCppBitcodeBlob(false),
+    mWidenKernels(false), mCompactMetadata(false), mInstrumentKernels(false),
+    mLayoutHotGlobals(false), mExportAccessSets(false),
+    mWriteIfChanged(false),
+    mNumInputFiles(0),
+    mReflectionLock(NULL), mParallelState(NULL), mParallelJob(NULL),
+    mReflectionBuffers(NULL),
+#if !defined(_WIN32)
+    mReflectionThreadStarted(false),
+#endif
+    mReflectedExports(true) {
+}
+
+bool SlangRS::reflectCpp() {
+  std::string ClassName = "ScriptC_" +
+      RSSlangReflectUtils::GetFileNameStem(getInputFileName().c_str());
+  mReflectedFiles.push_back(mJavaReflectionPathBase + ClassName + ".h");
+  if (!mCppHeaderOnly)
+    mReflectedFiles.push_back(mJavaReflectionPathBase + ClassName + ".cpp");
+  // The assembly file includes the bitcode file.
+  if (includesCppBitcodeFile())
+    mReflectedFiles.push_back(mJavaReflectionPathBase + ClassName + ".S");
+
+  RSReflectionCpp R(mRSContext);
+  return R.reflect(mJavaReflectionPathBase, getInputFileName(),
+                   getOutputFileName(), getOutputBuffer(),
+                   mWriteIfChanged);
+}
+
+bool SlangRS::reflectExports(TimeReport *Report) {
+  const std::string &RealPackageName =
+      mRSContext->getReflectJavaPackageName();
+
+  TimeReport::Region Timer(Report, TimeReport::PT_Reflection);
+
+  // The C++ class embeds the bitcode unless the assembly file includes it.
+  // Only then the bitcode isn't needed, the one in memory is still being
+  // written by the passes.
+  if (mBitcodeStorage == BCST_CPP_CODE)
+    return !includesCppBitcodeFile() || reflectCpp();
+
+  if (!reflectToJava(mJavaReflectionPathBase, mRSPackageName)) {
+    return false;
+  }
+
+  for (std::vector<std::string>::const_iterator
+           I = mGeneratedFileNames.begin(), E = mGeneratedFileNames.end();
+       I != E;
+       I++) {
+    std::string ReflectedName = RSSlangReflectUtils::ComputePackagedPath(
+        mJavaReflectionPathBase.c_str(),
+        (RealPackageName + OS_PATH_SEPARATOR_STR + *I).c_str());
+    appendGeneratedFileName(ReflectedName + ".java");
+    mReflectedFiles.push_back(ReflectedName + ".java");
+  }
+
+  return true;
+}
+
+bool SlangRS::reflectExportsLocked(TimeReport *Report) {
+  if (mReflectionLock != NULL)
+    mReflectionLock->acquire();
+  bool Reflected = reflectExports(Report);
+  if (mReflectionLock != NULL)
+    mReflectionLock->release();
+  return Reflected;
+}
+
+#if !defined(_WIN32)
+void *SlangRS::ReflectExportsWorker(void *Data) {
+  SlangRS *S = static_cast<SlangRS *>(Data);
+  S->mReflectedExports =
+      S->reflectExportsLocked(S->mReflectionTimeReport.get());
+  return NULL;
+}
+#endif
+
+void SlangRS::beginEmitModule() {
+  if (!mJavaReflectionPackageName.empty()) {
+    mRSContext->setReflectJavaPackageName(mJavaReflectionPackageName);
+  }
+
+  mReflectedExports = true;
+  if (getOutputType() == Slang::OT_Dependency)
+    return;
+
+#if !defined(_WIN32)
+  // The passes create types in the LLVMContext, which isn't thread-safe, so
+  // the reflection must have all of its types by then.
+  mRSContext->convertExportTypes();
+
+  // Make LLVM's lazily initialized globals (ManagedStatic) thread-safe.
+  llvm::llvm_start_multithreaded();
+
+  if (getTimeReport() != NULL)
+    mReflectionTimeReport.reset(new TimeReport());
+  mReflectionThreadStarted = (pthread_create(&mReflectionThread, NULL,
+                                             ReflectExportsWorker, this) == 0);
+  if (mReflectionThreadStarted)
+    return;
+  mReflectionTimeReport.reset();
+#endif
+
+  // Fall back to do it on this thread if the thread could not be started.
+  mReflectedExports = reflectExportsLocked(getTimeReport());
+  return;
+}
+
+bool SlangRS::joinReflectionThread() {
+#if !defined(_WIN32)
+  if (mReflectionThreadStarted) {
+    pthread_join(mReflectionThread, NULL);
+    mReflectionThreadStarted = false;
+    if (mReflectionTimeReport.get() != NULL) {
+      getTimeReport()->merge(*mReflectionTimeReport);
+      mReflectionTimeReport.reset();
+    }
+  }
+#endif
+  return mReflectedExports;
+}
+
+bool SlangRS::reflectBitcode() {
+  const std::string &RealPackageName =
+      mRSContext->getReflectJavaPackageName();
+
+  if (mBitcodeStorage == BCST_CPP_CODE) {
+    if (includesCppBitcodeFile())
+      return true;
+    TimeReport::Region Timer(getTimeReport(), TimeReport::PT_Reflection);
+    return reflectCpp();
+  }
+
+  if ((getOutputType() == Slang::OT_Bitcode) &&
+      ((mBitcodeStorage == BCST_JAVA_CODE) ||
+       (mBitcodeStorage == BCST_JAVA_STRING))) {
+    TimeReport::Region AccessorTimer(getTimeReport(),
+                                     TimeReport::PT_BitcodeAccessor);
+    if (!generateBitcodeAccessor(mJavaReflectionPathBase,
+                                 RealPackageName.c_str())) {
+      return false;
+    }
+
+    mReflectedFiles.push_back(
+        RSSlangReflectUtils::ComputePackagedPath(
+            mJavaReflectionPathBase.c_str(), RealPackageName.c_str()) +
+        OS_PATH_SEPARATOR_STR +
+        RSSlangReflectUtils::JavaClassNameFromRSFileName(
+            getInputFileName().c_str()) +
+        "BitCode.java");
+  }
+
+  return true;
+}
+
+std::string SlangRS::getRSHeaderPCH() {
+  // Find the RS headers the way the preprocessor does (first match wins).
+  const std::vector<std::string> &IncludePaths = getIncludePaths();
+  std::string HeaderDir;
+  for (unsigned i = 0, e = IncludePaths.size(); i != e; i++) {
+    llvm::SmallString<256> Core(IncludePaths[i]);
+    llvm::sys::path::append(Core, "rs_core." RS_HEADER_SUFFIX);
+    if (llvm::sys::fs::exists(Core.str())) {
+      HeaderDir = IncludePaths[i];
+      break;
+    }
+  }
+  if (HeaderDir.empty())
+    return "";
+
+  // Key the PCH by everything that goes into it.
+  std::stringstream Config;
+  Config << mTargetAPI << ' ' << getTargetOptions().Triple << ' '
+         << mIsFilterscript;
+  uint64_t Hash = SlangUtils::UpdateHash(SlangUtils::InitialHash,
+                                         Config.str());
+#define RS_HEADER_ENTRY(name)  \
+  {  \
+    llvm::SmallString<256> Header(HeaderDir);  \
+    llvm::sys::path::append(Header, #name "." RS_HEADER_SUFFIX);  \
+    SlangUtils::UpdateHashWithFile(&Hash, Header.str());  \
+  }
+ENUM_RS_HEADER()
+#undef RS_HEADER_ENTRY
+
+  std::string Error;
+  if (!SlangUtils::CreateDirectoryWithParents(mPCHCacheDir, &Error))
+    return "";
+
+  llvm::SmallString<256> PCHFile(mPCHCacheDir);
+  llvm::sys::path::append(PCHFile, "rs_headers-" + llvm::utohexstr(Hash) +
+                                   ".pch");
+  if (llvm::sys::fs::exists(PCHFile.str()))
+    return PCHFile.str();
+
+  // Failing to precompile the headers is not an error. If they are broken the
+  // compilation reports it, so drop the diagnostics here.
+  getDiagnostics().setSuppressAllDiagnostics(true);
+  bool Generated = (generatePCH(PCHFile.str()) == 0);
+  getDiagnostics().setSuppressAllDiagnostics(false);
+  if (!Generated) {
+    reset();
+    return "";
+  }
+
+  return PCHFile.str();
+}
+
+bool SlangRS::getCacheKey(const CompileJob &Job, uint64_t *Key) {
+  // Everything but the headers that affects the results. The version strings
+  // stand for the compiler itself. The headers are checked against the hashes
+  // in the entry (see RSCompileCache::lookup()).
+  const clang::TargetOptions &TargetOpts = getTargetOptions();
+  const clang::DiagnosticOptions &DiagOpts =
+      getDiagnostics().getDiagnosticOptions();
+  std::stringstream Config;
+  Config << SlangUtils::GetCompilerVersion() << '\n'
+         << TargetOpts.Triple << ' ' << TargetOpts.CPU << '\n'
+         << mTargetAPI << ' ' << getOptimizationLevel() << ' '
+         << getOptimizeSize() << ' ' << getOptimizationProfile() << ' '
+         << getDebugMetadataEmission() << ' ' << mBitcodeStorage << ' '
+         << getOutputType() << ' ' << mAllowRSPrefix << ' '
+         << mIsFilterscript << ' ' << mVarBatch << ' ' << mScriptFieldBuffer
+         << ' ' << mPreallocatedPackers << ' ' << mLazyInit << ' '
+         << mCppHeaderOnly << ' ' << mCppBitcodeBlob << ' '
+         << mWidenKernels << ' ' << mCompactMetadata << ' '
+         << mInstrumentKernels << ' ' << mLayoutHotGlobals << ' '
+         << mExportAccessSets << ' '
+         << !mBatchManifest.empty() << ' '
+         << DiagOpts.IgnoreWarnings << ' '
+         << !getRuntimeLibrary().empty() << '\n';
+  if (getProfile() != NULL)
+    Config << "-fprofile-use " << getProfile()->getHash() << '\n';
+  if (mExportUsage != NULL)
+    Config << "-export-usage "
+           << mExportUsage->getHash(
+                  RSSlangReflectUtils::GetFileNameStem(Job.InputFile))
+           << '\n';
+  for (unsigned i = 0, e = DiagOpts.Warnings.size(); i != e; i++)
+    Config << "-W" << DiagOpts.Warnings[i] << '\n';
+  for (unsigned i = 0, e = mStrippedCalls.size(); i != e; i++)
+    Config << "-strip-call " << mStrippedCalls[i] << '\n';
+  for (unsigned i = 0, e = mAOTABIs.size(); i != e; i++)
+    Config << "-aot-abi " << mAOTABIs[i] << '\n';
+  for (unsigned i = 0, e = mExtraOutputTypes.size(); i != e; i++)
+    Config << "-also-emit " << mExtraOutputTypes[i] << '\n';
+  const std::vector<std::string> &IncludePaths = getIncludePaths();
+  for (unsigned i = 0, e = IncludePaths.size(); i != e; i++)
+    Config << "-I " << IncludePaths[i] << '\n';
+  Config << mJavaReflectionPathBase << '\n'
+         << mJavaReflectionPackageName << '\n'
+         << mRSPackageName << '\n'
+         << Job.InputFile << '\n'
+         << Job.OutputFile << '\n';
+
+  *Key = SlangUtils::UpdateHash(SlangUtils::InitialHash, Config.str());
+  return SlangUtils::UpdateHashWithFile(Key, Job.InputFile);
+}
+
+bool SlangRS::restoreFromCache(CompileJob &Job, uint64_t Key) {
+  RSCompileCache Cache(mCompileCacheDir);
+  RSCompileCache::Entry Entry;
+  if (!Cache.lookup(Key, &Entry))
+    return false;
+
+  // The definitions of the record types are needed to check the ODR against
+  // the other input files, which takes a real compilation.
+  if ((Entry.NumRecordTypes > 0) &&
+      ((mNumInputFiles > 1) || !mODRDatabase.empty()))
+    return false;
+
+  // The reflected files may be shared with other input files.
+  if (mReflectionLock != NULL)
+    mReflectionLock->acquire();
+  std::string Error;
+  bool Restored = Cache.restore(Key, Entry, mWriteIfChanged, &Error);
+  if (mReflectionLock != NULL)
+    mReflectionLock->release();
+
+  // Whatever was restored before the failure is overwritten by compiling.
+  if (!Restored)
+    return false;
+
+  appendErrorMessage(Entry.Diagnostics);
+
+  if (!mBatchManifest.empty()) {
+    Job.Outputs = Entry.Files;
+    Job.Dependencies = Entry.Dependencies;
+  }
+
+  // The dependency file is written the same way as by a compilation, its
+  // targets and dependencies are those of the current options.
+  if (mOutputDep) {
+    setDepTargetBC(Job.BCOutputFile);
+    if (!setDepOutput(Job.DepOutputFile))
+      return false;
+    for (unsigned i = 0, e = Entry.Dependencies.size(); i != e; i++)
+      addDependency(Entry.Dependencies[i]);
+    for (unsigned i = 0, e = Entry.DepTargets.size(); i != e; i++)
+      appendGeneratedFileName(Entry.DepTargets[i]);
+    if (generateDepFile() > 0)
+      return false;
+  }
+  return true;
+}
+
+void SlangRS::getOutputFiles(const CompileJob &Job,
+                             std::vector<std::string> *Files) const {
+  if (getOutputType() != Slang::OT_Nothing)
+    Files->push_back(Job.OutputFile);
+  const ExtraOutputList &ExtraOutputs = getExtraOutputs();
+  for (unsigned i = 0, e = ExtraOutputs.size(); i != e; i++)
+    Files->push_back(ExtraOutputs[i].OutputFile);
+  Files->insert(Files->end(), mReflectedFiles.begin(), mReflectedFiles.end());
+  return;
+}
+
+void SlangRS::storeToCache(const CompileJob &Job, uint64_t Key,
+                           time_t CompileStart, RSCompileCache::Entry &Entry) {
+  getOutputFiles(Job, &Entry.Files);
+
+  Entry.Diagnostics = getErrorMessage();
+
+  for (RSContext::ExportableList::iterator I = mRSContext->exportable_begin(),
+          E = mRSContext->exportable_end();
+       I != E;
+       I++) {
+    if (GetUserDefinedRecordType(*I) != NULL)
+      Entry.NumRecordTypes++;
+  }
+
+  // Failing to fill the cache only makes the next compilation take longer.
+  RSCompileCache Cache(mCompileCacheDir);
+  if (mReflectionLock != NULL)
+    mReflectionLock->acquire();
+  std::string Error;
+  Cache.store(Key, Entry, CompileStart, &Error);
+  if (mReflectionLock != NULL)
+    mReflectionLock->release();
+
+  return;
+}
+
+bool SlangRS::compileFile(CompileJob &Job) {
+  reset();
+
+  // The cache keeps the dependencies to check its entries against them.
+  setCollectDependencies(!mBatchManifest.empty() || !mCompileCacheDir.empty());
+
+  mIsFilterscript = isFilterscript(Job.InputFile);
+
+  // Must be done before setting the input, generating the PCH replaces it.
+  if (!mPCHCacheDir.empty())
+    setPCHFile(getRSHeaderPCH());
+
+  if (!setInputSource(Job.InputFile))
+    return false;
+
+  time_t CompileStart = time(NULL);
+  uint64_t CacheKey = 0;
+  bool Cached = !mCompileCacheDir.empty() && getCacheKey(Job, &CacheKey);
+  if (Cached && restoreFromCache(Job, CacheKey))
+    return true;
+
+  if (!setOutput(Job.OutputFile))
+    return false;
+
+  // The reflection embedding the bitcode gets it from memory, rather than
+  // reading back the file. The assembly file of the C++ one includes the
+  // file instead.
+  if ((getOutputType() == Slang::OT_Bitcode) &&
+      (mBitcodeStorage != BCST_APK_RESOURCE) &&
+      !((mBitcodeStorage == BCST_CPP_CODE) && mCppBitcodeBlob))
+    keepOutput(&mBitcode);
+
+  ExtraOutputList ExtraOutputs;
+  for (unsigned i = 0, e = mExtraOutputTypes.size(); i != e; i++) {
+    ExtraOutput Output;
+    Output.OT = mExtraOutputTypes[i];
+    llvm::SmallString<256> Path(Job.OutputFile);
+    llvm::sys::path::replace_extension(Path,
+                                       GetOutputFileExtension(Output.OT));
+    Output.OutputFile = Path.str();
+    ExtraOutputs.push_back(Output);
+  }
+  if (getOutputType() == Slang::OT_Bitcode) {
+    llvm::StringRef Dir = llvm::sys::path::parent_path(Job.OutputFile);
+    std::string Name = llvm::sys::path::stem(Job.OutputFile).str() + ".o";
+    for (unsigned i = 0, e = mAOTABIs.size(); i != e; i++) {
+      ExtraOutput Object;
+      Object.OT = Slang::OT_Object;
+      Object.ABI = mAOTABIs[i];
+      llvm::SmallString<256> Path(Dir);
+      llvm::sys::path::append(Path, mAOTABIs[i], Name);
+      Object.OutputFile = Path.str();
+      ExtraOutputs.push_back(Object);
+    }
+  }
+  setExtraOutputs(ExtraOutputs);
+
+  // The dependencies are collected by the compilation itself.
+  if (mOutputDep) {
+    setDepTargetBC(Job.BCOutputFile);
+
+    if (!setDepOutput(Job.DepOutputFile))
+      return false;
+  }
+
+  // The reflection of the exports is written while compile() runs the
+  // passes. It's waited for even on errors, it uses the RSContext.
+  bool Compiled = (Slang::compile() == 0);
+  bool Reflected = joinReflectionThread();
+  if (!Compiled)
+    return false;
+
+  if (getOutputType() != Slang::OT_Dependency) {
+    if (mReflectionLock != NULL)
+      mReflectionLock->acquire();
+    Reflected = Reflected && reflectBitcode();
+    if (mReflectionLock != NULL)
+      mReflectionLock->release();
+
+    if (!Reflected)
+      return false;
+  }
+
+  // Before generateDepFile() lets go of the dependencies
+  if (!mBatchManifest.empty()) {
+    Job.Outputs.clear();
+    getOutputFiles(Job, &Job.Outputs);
+    Job.Dependencies = getDependencies();
+  }
+
+  RSCompileCache::Entry CacheEntry;
+  if (Cached) {
+    CacheEntry.Dependencies = getDependencies();
+    CacheEntry.DepTargets = getGeneratedFileNames();
+  }
+
+  // Written after the reflection, whose files are targets of the rule.
+  if (mOutputDep && (generateDepFile() > 0))
+    return false;
+
+  if (Cached)
+    storeToCache(Job, CacheKey, CompileStart, CacheEntry);
+
+  return true;
+}
+
+#if !defined(_WIN32)
+
+struct SlangRS::ParallelCompileState {
+  SlangRS *Parent;
+  CompileJobList *Jobs;
+  // Index of the next job to hand out, guarded by QueueLock
+  size_t NextJob;
+  // Whether a job has failed, after which (as in a sequential compile) no more
+  // are handed out. Guarded by QueueLock.
+  bool Failed;
+  // Whether the workers run on threads of their own, rather than on the thread
+  // of compileParallel()
+  bool OnWorkerThreads;
+  llvm::sys::Mutex QueueLock;
+  llvm::sys::Mutex ReflectionLock;
+};
+
+void SlangRS::handleFatalError() {
+  if (mParallelJob == NULL)
+    Slang::handleFatalError();
+
+  // Fail the job for compileParallel() to report it among the others, in the
+  // order of the input files, and end this worker's thread (abandoning what's
+  // on its stack).
+  mParallelJob->Success = false;
+  mParallelJob->Diagnostics = getDiagnosticBuffer()->str();
+  getDiagnosticBuffer()->takeRecords(&mParallelJob->DiagnosticRecords);
+  {
+    llvm::MutexGuard Locked(mParallelState->QueueLock);
+    mParallelState->Failed = true;
+  }
+  pthread_exit(NULL);
+}
+
+void *SlangRS::ParallelCompileWorker(void *Data) {
+  ParallelCompileState *State = static_cast<ParallelCompileState *>(Data);
+  SlangRS *Parent = State->Parent;
+  CompileJobList &Jobs = *State->Jobs;
+
+  // Each worker has its own diagnostics and compiler instance (and hence its
+  // own RSContext and LLVMContext). Only the options are copied from Parent.
+  DiagnosticBuffer *DiagClient = new DiagnosticBuffer();
+  DiagClient->setStreaming(Parent->getDiagnosticBuffer()->isStreaming());
+
+  llvm::IntrusiveRefCntPtr<clang::DiagnosticIDs> DiagIDs(
+    new clang::DiagnosticIDs());
+
+  llvm::IntrusiveRefCntPtr<clang::DiagnosticOptions> DiagOpts(
+    new clang::DiagnosticOptions(
+        Parent->getDiagnostics().getDiagnosticOptions()));
+  clang::DiagnosticsEngine DiagEngine(DiagIDs, &*DiagOpts, DiagClient, true);
+  clang::ProcessWarningOptions(DiagEngine, *DiagOpts);
+
+  SlangRS Worker;
+  const clang::TargetOptions &TargetOpts = Parent->getTargetOptions();
+  Worker.init(TargetOpts.Triple, TargetOpts.CPU, TargetOpts.FeaturesAsWritten,
+              &DiagEngine, DiagClient);
+
+  Worker.setIncludePaths(Parent->getIncludePaths());
+  Worker.setOutputType(Parent->getOutputType());
+  Worker.setAdditionalDepTargets(Parent->getAdditionalDepTargets());
+  Worker.mAllowRSPrefix = Parent->mAllowRSPrefix;
+  Worker.mTargetAPI = Parent->mTargetAPI;
+  Worker.mBitcodeStorage = Parent->mBitcodeStorage;
+  Worker.mOutputDep = Parent->mOutputDep;
+  Worker.mJavaReflectionPathBase = Parent->mJavaReflectionPathBase;
+  Worker.mJavaReflectionPackageName = Parent->mJavaReflectionPackageName;
+  Worker.mRSPackageName = Parent->mRSPackageName;
+  Worker.mPCHCacheDir = Parent->mPCHCacheDir;
+  Worker.mCompileCacheDir = Parent->mCompileCacheDir;
+  Worker.mExportUsage = Parent->mExportUsage;
+  Worker.mBatchManifest = Parent->mBatchManifest;
+  Worker.mVarBatch = Parent->mVarBatch;
+  Worker.mScriptFieldBuffer = Parent->mScriptFieldBuffer;
+  Worker.mPreallocatedPackers = Parent->mPreallocatedPackers;
+  Worker.mLazyInit = Parent->mLazyInit;
+  Worker.mCppHeaderOnly = Parent->mCppHeaderOnly;
+  Worker.mCppBitcodeBlob = Parent->mCppBitcodeBlob;
+  Worker.mWidenKernels = Parent->mWidenKernels;
+  Worker.mCompactMetadata = Parent->mCompactMetadata;
+  Worker.mInstrumentKernels = Parent->mInstrumentKernels;
+  Worker.mLayoutHotGlobals = Parent->mLayoutHotGlobals;
+  Worker.mExportAccessSets = Parent->mExportAccessSets;
+  Worker.mWriteIfChanged = Parent->mWriteIfChanged;
+  Worker.mStrippedCalls = Parent->mStrippedCalls;
+  Worker.mAOTABIs = Parent->mAOTABIs;
+  Worker.mExtraOutputTypes = Parent->mExtraOutputTypes;
+  Worker.setRuntimeLibrary(Parent->getRuntimeLibrary());
+  Worker.setProfile(Parent->getProfile());
+  Worker.mNumInputFiles = Parent->mNumInputFiles;
+  // Only used for generating the reflected classes of a file (since the
+  // worker is handed the files one by one)
+  Worker.mNumJobs = Parent->mNumJobs;
+  Worker.mReflectionLock = &State->ReflectionLock;
+  Worker.mParallelState = State;
+  if (Parent->getTimeReport() != NULL)
+    Worker.enableTimeReport();
+
+  while (true) {
+    CompileJob *Job;
+    {
+      llvm::MutexGuard Locked(State->QueueLock);
+      if (State->Failed || (State->NextJob == Jobs.size()))
+        break;
+      Job = &Jobs[State->NextJob++];
+    }
+
+    if (State->OnWorkerThreads)
+      Worker.mParallelJob = Job;
+    Job->Success = Worker.compileFile(*Job);
+    Worker.mParallelJob = NULL;
+    if (!Job->Success) {
+      llvm::MutexGuard Locked(State->QueueLock);
+      State->Failed = true;
+    }
+
+    // There's no RSContext if the results came from the cache. Copy the record
+    // types out of it, it goes away with the next input file.
+    if (Job->Success && (Worker.mRSContext != NULL))
+      GetODRRecordTypes(Worker.mRSContext, Job->InputFile, &Job->RecordTypes);
+
+    // Keep the diagnostics for the parent instead of letting reset() print
+    // them, so that the output of different files is not interleaved.
+    Job->Diagnostics = DiagClient->str();
+    DiagClient->takeRecords(&Job->DiagnosticRecords);
+    DiagClient->reset();
+  }
+
+  if (Worker.getTimeReport() != NULL) {
+    llvm::MutexGuard Locked(State->QueueLock);
+    Parent->getTimeReport()->merge(*Worker.getTimeReport());
+  }
+
+  Worker.reset();
+  return NULL;
 }
 
+bool SlangRS::compileParallel(CompileJobList &Jobs) {
+  ParallelCompileState State;
+  State.Parent = this;
+  State.Jobs = &Jobs;
+  State.NextJob = 0;
+  State.Failed = false;
+  State.OnWorkerThreads = true;
+
+  // Make LLVM's lazily initialized globals (ManagedStatic) thread-safe.
+  llvm::llvm_start_multithreaded();
+
+  unsigned NumWorkers = std::min<size_t>(mNumJobs, Jobs.size());
+  std::vector<pthread_t> Workers(NumWorkers);
+
+  // The parser recurses deeply on some inputs, so don't rely on the default
+  // stack size of secondary threads (which is rather small on some hosts).
+  pthread_attr_t Attr;
+  pthread_attr_init(&Attr);
+  pthread_attr_setstacksize(&Attr, 8 * 1024 * 1024);
+
+  unsigned NumStarted = 0;
+  while (NumStarted < NumWorkers) {
+    if (pthread_create(&Workers[NumStarted], &Attr, ParallelCompileWorker,
+                       &State) != 0)
+      break;
+    NumStarted++;
+  }
+  pthread_attr_destroy(&Attr);
+
+  // Fall back to do all the work on this thread if no worker could be started.
+  if (NumStarted == 0) {
+    State.OnWorkerThreads = false;
+    ParallelCompileWorker(&State);
+  }
+
+  for (unsigned i = 0; i != NumStarted; i++)
+    pthread_join(Workers[i], NULL);
+
+  // Go through the results in the order of input files, such that the
+  // diagnostics (and the ODR errors) come out as in a sequential compile,
+  // which stops at the first failing file.
+  bool Success = true;
+  for (CompileJobList::iterator I = Jobs.begin(), E = Jobs.end();
+       I != E;
+       I++) {
+    if (Success) {
+      // A streaming worker has written them as they came (whichever file
+      // they're from).
+      if (!getDiagnosticBuffer()->isStreaming())
+        llvm::errs() << I->Diagnostics;
+      getDiagnosticBuffer()->appendRecords(I->DiagnosticRecords);
+      Success = I->Success;
+    }
+
+    for (unsigned i = 0, e = I->RecordTypes.size(); i != e; i++) {
+      if (Success && !checkODR(I->RecordTypes[i], I->InputFile))
+        Success = false;
+    }
+    if (Success && !checkODRDatabase(I->RecordTypes, I->InputFile))
+      Success = false;
+    I->RecordTypes.clear();
+  }
+
+  return Success;
+}
+
+#endif  // !defined(_WIN32)
+
 bool SlangRS::compile(
     const std::list<std::pair<const char*, const char*> > &IOFiles,
     const std::list<std::pair<const char*, const char*> > &DepFiles,
@@ -292,12 +1132,111 @@ bool SlangRS::compile(
     return false;
   }
 
-  std::string RealPackageName;
+  if (!setCompileOptions(IncludePaths, AdditionalDepTargets, OutputType,
+                         BitcodeStorage, AllowRSPrefix, OutputDep, TargetAPI,
+                         EmitDebug, OptimizationLevel, JavaReflectionPathBase,
+                         JavaReflectionPackageName, RSPackageName))
+    return false;
 
-  const char *InputFile, *OutputFile, *BCOutputFile, *DepOutputFile;
+  mNumInputFiles = IOFiles.size();
+
+  CompileJobList Jobs(IOFiles.size());
   std::list<std::pair<const char*, const char*> >::const_iterator
       IOFileIter = IOFiles.begin(), DepFileIter = DepFiles.begin();
 
+  for (unsigned i = 0, e = IOFiles.size(); i != e; i++) {
+    CompileJob &Job = Jobs[i];
+    Job.InputFile = IOFileIter->first;
+    Job.OutputFile = IOFileIter->second;
+    Job.BCOutputFile = NULL;
+    Job.DepOutputFile = NULL;
+    Job.Success = false;
+
+    if (OutputDep) {
+      Job.BCOutputFile = DepFileIter->first;
+      Job.DepOutputFile = DepFileIter->second;
+      DepFileIter++;
+    }
+
+    IOFileIter++;
+  }
+
+#if !defined(_WIN32)
+  if ((mNumJobs > 1) && (Jobs.size() > 1))
+    return compileParallel(Jobs) && writeBatchManifest(Jobs);
+#endif
+
+  for (CompileJobList::iterator I = Jobs.begin(), E = Jobs.end();
+       I != E;
+       I++) {
+    if (!compileFile(*I))
+      return false;
+
+    if (!checkODR(I->InputFile))
+      return false;
+  }
+
+  return writeBatchManifest(Jobs);
+}
+
+bool SlangRS::writeBatchManifest(const CompileJobList &Jobs) {
+  if (mBatchManifest.empty())
+    return true;
+
+  std::stringstream Manifest;
+  std::string DepRules;
+  llvm::raw_string_ostream DepOS(DepRules);
+  for (CompileJobList::const_iterator I = Jobs.begin(), E = Jobs.end();
+       I != E;
+       I++) {
+    Manifest << "input " << I->InputFile << '\n';
+    for (unsigned i = 0, e = I->Outputs.size(); i != e; i++) {
+      uint64_t Hash = SlangUtils::InitialHash;
+      if (!SlangUtils::UpdateHashWithFile(&Hash, I->Outputs[i])) {
+        getDiagnostics().Report(mDiagErrorBatchManifest)
+            << mBatchManifest << ("failed to read file '" + I->Outputs[i] +
+                                  "'");
+        return false;
+      }
+      Manifest << "output " << llvm::utohexstr(Hash) << ' ' << I->Outputs[i]
+               << '\n';
+    }
+
+    std::vector<std::string> Targets(getAdditionalDepTargets());
+    Targets.insert(Targets.end(), I->Outputs.begin(), I->Outputs.end());
+    WriteDependencyRule(DepOS, Targets, I->Dependencies);
+  }
+  DepOS.flush();
+
+  std::string Error;
+  bool Written =
+      mWriteIfChanged ?
+      (SlangUtils::WriteFileIfChanged(mBatchManifest + ".d", DepRules,
+                                      &Error) &&
+       SlangUtils::WriteFileIfChanged(mBatchManifest, Manifest.str(),
+                                      &Error)) :
+      (SlangUtils::WriteFileAtomically(mBatchManifest + ".d", DepRules,
+                                       &Error) &&
+       SlangUtils::WriteFileAtomically(mBatchManifest, Manifest.str(),
+                                       &Error));
+  if (!Written) {
+    getDiagnostics().Report(mDiagErrorBatchManifest) << mBatchManifest
+                                                     << Error;
+    return false;
+  }
+  return true;
+}
+
+bool SlangRS::setCompileOptions(
+    const std::vector<std::string> &IncludePaths,
+    const std::vector<std::string> &AdditionalDepTargets,
+    Slang::OutputType OutputType, BitCodeStorageType BitcodeStorage,
+    bool AllowRSPrefix, bool OutputDep,
+    unsigned int TargetAPI, bool EmitDebug,
+    llvm::CodeGenOpt::Level OptimizationLevel,
+    const std::string &JavaReflectionPathBase,
+    const std::string &JavaReflectionPackageName,
+    const std::string &RSPackageName) {
   setIncludePaths(IncludePaths);
   setOutputType(OutputType);
   if (OutputDep) {
@@ -310,6 +1249,12 @@ bool SlangRS::compile(
 
   mAllowRSPrefix = AllowRSPrefix;
 
+  mBitcodeStorage = BitcodeStorage;
+  mOutputDep = OutputDep;
+  mJavaReflectionPathBase = JavaReflectionPathBase;
+  mJavaReflectionPackageName = JavaReflectionPackageName;
+  mRSPackageName = RSPackageName;
+
   mTargetAPI = TargetAPI;
   if (mTargetAPI < SLANG_MINIMUM_TARGET_API ||
       mTargetAPI > SLANG_MAXIMUM_TARGET_API) {
@@ -318,112 +1263,71 @@ bool SlangRS::compile(
     return false;
   }
 
-  // Skip generation of warnings a second time if we are doing more than just
-  // a single pass over the input file.
-  bool SuppressAllWarnings = (OutputType != Slang::OT_Dependency);
-
-  for (unsigned i = 0, e = IOFiles.size(); i != e; i++) {
-    InputFile = IOFileIter->first;
-    OutputFile = IOFileIter->second;
-
-    reset();
-
-    if (!setInputSource(InputFile))
-      return false;
-
-    if (!setOutput(OutputFile))
-      return false;
-
-    mIsFilterscript = isFilterscript(InputFile);
-
-    if (Slang::compile() > 0)
-      return false;
+  return true;
+}
 
-    if (!JavaReflectionPackageName.empty()) {
-      mRSContext->setReflectJavaPackageName(JavaReflectionPackageName);
-    }
-    const std::string &RealPackageName =
-        mRSContext->getReflectJavaPackageName();
-
-    if (OutputType != Slang::OT_Dependency) {
-
-      if (BitcodeStorage == BCST_CPP_CODE) {
-          RSReflectionCpp R(mRSContext);
-          bool ret = R.reflect(JavaReflectionPathBase, getInputFileName(), getOutputFileName());
-          if (!ret) {
-            return false;
-          }
-      } else {
-
-        if (!reflectToJava(JavaReflectionPathBase, RSPackageName)) {
-          return false;
-        }
-
-        for (std::vector<std::string>::const_iterator
-                 I = mGeneratedFileNames.begin(), E = mGeneratedFileNames.end();
-             I != E;
-             I++) {
-          std::string ReflectedName = RSSlangReflectUtils::ComputePackagedPath(
-              JavaReflectionPathBase.c_str(),
-              (RealPackageName + OS_PATH_SEPARATOR_STR + *I).c_str());
-          appendGeneratedFileName(ReflectedName + ".java");
-        }
-
-        if ((OutputType == Slang::OT_Bitcode) &&
-            (BitcodeStorage == BCST_JAVA_CODE) &&
-            !generateBitcodeAccessor(JavaReflectionPathBase,
-                                     RealPackageName.c_str())) {
-          return false;
-        }
-      }
-    }
+bool SlangRS::compileBuffer(
+    BufferJob *Job,
+    const std::vector<std::string> &IncludePaths,
+    const std::vector<std::string> &AdditionalDepTargets,
+    bool AllowRSPrefix, bool OutputDep,
+    unsigned int TargetAPI, bool EmitDebug,
+    llvm::CodeGenOpt::Level OptimizationLevel,
+    const std::string &JavaReflectionPathBase,
+    const std::string &JavaReflectionPackageName,
+    const std::string &RSPackageName) {
+  if (!setCompileOptions(IncludePaths, AdditionalDepTargets,
+                         Slang::OT_Bitcode, BCST_APK_RESOURCE, AllowRSPrefix,
+                         OutputDep, TargetAPI, EmitDebug, OptimizationLevel,
+                         JavaReflectionPathBase, JavaReflectionPackageName,
+                         RSPackageName))
+    return false;
 
-    if (OutputDep) {
-      BCOutputFile = DepFileIter->first;
-      DepOutputFile = DepFileIter->second;
+  mNumInputFiles = 1;
 
-      setDepTargetBC(BCOutputFile);
+  reset();
 
-      if (!setDepOutput(DepOutputFile))
-        return false;
+  mIsFilterscript = isFilterscript(Job->InputFile);
 
-      if (SuppressAllWarnings) {
-        getDiagnostics().setSuppressAllDiagnostics(true);
-      }
-      if (generateDepFile() > 0)
-        return false;
-      if (SuppressAllWarnings) {
-        getDiagnostics().setSuppressAllDiagnostics(false);
-      }
+  // Must be done before setting the input, generating the PCH replaces it.
+  if (!mPCHCacheDir.empty())
+    setPCHFile(getRSHeaderPCH());
 
-      DepFileIter++;
-    }
+  if (!setInputSource(Job->InputFile, Job->Text, Job->TextLength))
+    return false;
 
-    if (!checkODR(InputFile))
-      return false;
+  Job->ReflectedFiles.clear();
+  setOutputBuffers(Job->OutputFile, &Job->Bitcode,
+                   mOutputDep ? &Job->Dependencies : NULL);
+  setExtraOutputs(ExtraOutputList());
+  mReflectionBuffers = &Job->ReflectedFiles;
+  if (mOutputDep)
+    setDepTargetBC(Job->OutputFile);
+
+  bool Compiled = (Slang::compile() == 0);
+  bool Reflected = joinReflectionThread();
+  if (!Compiled || !Reflected || !reflectBitcode())
+    return false;
 
-    IOFileIter++;
-  }
+  if (mOutputDep && (generateDepFile() > 0))
+    return false;
 
-  return true;
+  return checkODR(Job->InputFile);
 }
 
 void SlangRS::reset() {
+  joinReflectionThread();
   delete mRSContext;
   mRSContext = NULL;
   mGeneratedFileNames.clear();
+  mReflectedFiles.clear();
+  mReflectionBuffers = NULL;
   Slang::reset();
   return;
 }
 
 SlangRS::~SlangRS() {
   delete mRSContext;
-  for (ReflectedDefinitionListTy::iterator I = ReflectedDefinitions.begin(),
-          E = ReflectedDefinitions.end();
-       I != E;
-       I++) {
-    delete I->getValue().first;
-  }
   return;
 }
 
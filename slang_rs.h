@@ -24,14 +24,24 @@
 #include <utility>
 #include <vector>
 
+#if !defined(_WIN32)
+#include <pthread.h>
+#endif
+
+#include "llvm/ADT/OwningPtr.h"
 #include "llvm/ADT/StringMap.h"
+#include "llvm/Support/Mutex.h"
 
+#include "slang_rs_compile_cache.h"
+#include "slang_rs_odr_database.h"
 #include "slang_rs_reflect_utils.h"
+#include "slang_utils.h"
 #include "slang_version.h"
 
 namespace slang {
   class RSContext;
   class RSExportRecordType;
+  class RSExportUsage;
 
 class SlangRS : public Slang {
  private:
@@ -44,21 +54,144 @@ class SlangRS : public Slang {
 
   bool mIsFilterscript;
 
+  // Options of the ongoing compile() which apply to every input file
+  BitCodeStorageType mBitcodeStorage;
+  bool mOutputDep;
+  std::string mJavaReflectionPathBase;
+  std::string mJavaReflectionPackageName;
+  std::string mRSPackageName;
+
+  // Maximum number of input files compile() is allowed to process at once
+  unsigned mNumJobs;
+
+  // Where to keep the precompiled RS headers (empty to always parse them)
+  std::string mPCHCacheDir;
+
+  // Where to keep the results of compiling the input files for reuse (empty
+  // to always compile them)
+  std::string mCompileCacheDir;
+
+  // The ODR database shared with other compiles of the project (empty to only
+  // check the ODR among the input files of this compile)
+  std::string mODRDatabase;
+
+  // The exports used by the app, NULL to export everything
+  const RSExportUsage *mExportUsage;
+
+  // Where to describe the outputs of all the input files (empty for nowhere)
+  std::string mBatchManifest;
+
+  // Synthesize and reflect the batch setter of the exported variables
+  bool mVarBatch;
+
+  // Back the reflected ScriptField_* classes by a ByteBuffer
+  bool mScriptFieldBuffer;
+
+  // Reuse a FieldPacker per invokable and kernel in the reflected class
+  bool mPreallocatedPackers;
+
+  // Create the Elements etc. of the reflected class on first use
+  bool mLazyInit;
+
+  // Reflect the C++ script class in its header only
+  bool mCppHeaderOnly;
+
+  // Embed the bitcode in the C++ script class from an assembly file
+  bool mCppBitcodeBlob;
+
+  // Emit the widened variants of the elementwise kernels
+  bool mWidenKernels;
+
+  // Encode the export info in the compact format
+  bool mCompactMetadata;
+
+  // Count the calls and the time of the kernels and invokables
+  bool mInstrumentKernels;
+
+  // Group the variables the kernels read
+  bool mLayoutHotGlobals;
+
+  // Describe the globals each kernel and invokable reads and writes
+  bool mExportAccessSets;
+
+  // Leave the reflected files whose content doesn't change alone
+  bool mWriteIfChanged;
+
+  // The functions to remove the calls to
+  std::vector<std::string> mStrippedCalls;
+
+  // The ABIs to compile native objects for along with the bitcode
+  std::vector<std::string> mAOTABIs;
+
+  // Output types to write along with the one of compile() from the single
+  // compilation of each input file
+  std::vector<Slang::OutputType> mExtraOutputTypes;
+
+  // Number of input files given to the ongoing compile()
+  unsigned mNumInputFiles;
+
+  // The workers of a parallel compile() share this lock to write out their
+  // reflection one at a time (the ScriptField_* class of a struct used by
+  // several input files always goes to the same file). NULL otherwise.
+  llvm::sys::Mutex *mReflectionLock;
+
   // Custom diagnostic identifiers
   unsigned mDiagErrorInvalidOutputDepParameter;
   unsigned mDiagErrorODR;
+  unsigned mDiagErrorODRDatabase;
   unsigned mDiagErrorTargetAPIRange;
+  unsigned mDiagErrorBatchManifest;
 
   // Collect generated filenames (without the .java) for dependency generation
   std::vector<std::string> mGeneratedFileNames;
 
+  // Paths of all the files reflect() has written for the current input file
+  std::vector<std::string> mReflectedFiles;
+
+  // If not NULL, where reflect() keeps the files rather than writing them
+  FileContentList *mReflectionBuffers;
+
+  // The bitcode of the current input file, kept for the reflection which
+  // embeds it (i.e., with any storage but BCST_APK_RESOURCE)
+  std::string mBitcode;
+
+#if !defined(_WIN32)
+  // The thread reflectExports() runs on while the passes run on the module
+  // of the current input file (see beginEmitModule()), if it was started
+  pthread_t mReflectionThread;
+  bool mReflectionThreadStarted;
+  // Where the time of the reflection on mReflectionThread goes, until it's
+  // merged into getTimeReport()
+  llvm::OwningPtr<TimeReport> mReflectionTimeReport;
+#endif
+  // What reflectExports() returned for the current input file
+  bool mReflectedExports;
+
+  // What the ODR checks need of a user-defined record type, copied out of the
+  // RSContext such that nothing outlives the compile of its input file (the
+  // exportables hold on to the arena of their RSContext).
+  struct ODRRecordType {
+    std::string Name;
+    // The types of the fields as RSExportRecordType::equals() compares them,
+    // followed by the names of the fields
+    std::string Signature;
+    // Its definition in mODRDatabase
+    RSODRDatabase::Definition Definition;
+  };
+  typedef std::vector<ODRRecordType> ODRRecordTypeList;
+
+  // The ODRRecordType of each user-defined record type exported by the input
+  // file of Context, as reflected into its Java package.
+  static void GetODRRecordTypes(RSContext *Context, const char *CurInputFile,
+                                ODRRecordTypeList *RecordTypes);
+
   // FIXME: Should be std::list<RSExportable *> here. But currently we only
   //        check ODR on record type.
   //
   // ReflectedDefinitions maps record type name to a pair:
-  //  <its RSExportRecordType instance,
+  //  <its ODRRecordType::Signature,
   //   the first file contains this record type definition>
-  typedef std::pair<RSExportRecordType*, const char*> ReflectedDefinitionTy;
+  typedef std::pair<std::string, const char*> ReflectedDefinitionTy;
   typedef llvm::StringMap<ReflectedDefinitionTy> ReflectedDefinitionListTy;
   ReflectedDefinitionListTy ReflectedDefinitions;
 
@@ -71,6 +204,116 @@ class SlangRS : public Slang {
   // CurInputFile is the pointer to a char array holding the input filename
   // and is valid before compile() ends.
   bool checkODR(const char *CurInputFile);
+  bool checkODR(const ODRRecordType &RT, const char *CurInputFile);
+  // Check the record types of CurInputFile against mODRDatabase (if any).
+  bool checkODRDatabase(const ODRRecordTypeList &RecordTypes,
+                        const char *CurInputFile);
+
+  // An input file given to compile() together with what compiling it in a
+  // worker thread has turned out.
+  struct CompileJob {
+    const char *InputFile;
+    const char *OutputFile;
+    // Only used if mOutputDep is set
+    const char *BCOutputFile;
+    const char *DepOutputFile;
+
+    bool Success;
+    std::string Diagnostics;
+    DiagnosticBuffer::RecordList DiagnosticRecords;
+    // User-defined record types exported by InputFile, to be checked against
+    // ReflectedDefinitions
+    ODRRecordTypeList RecordTypes;
+    // What compiling InputFile wrote and read, for the batch manifest (only
+    // collected with one)
+    std::vector<std::string> Outputs;
+    std::vector<std::string> Dependencies;
+  };
+  typedef std::vector<CompileJob> CompileJobList;
+
+  // Compile, reflect and (if requested) generate the dependency file for a
+  // single input file.
+  bool compileFile(CompileJob &Job);
+
+  // Take the options of compile() (and compileBuffer()) which apply to every
+  // input file.
+  bool setCompileOptions(const std::vector<std::string> &IncludePaths,
+                         const std::vector<std::string> &AdditionalDepTargets,
+                         Slang::OutputType OutputType,
+                         BitCodeStorageType BitcodeStorage,
+                         bool AllowRSPrefix, bool OutputDep,
+                         unsigned int TargetAPI, bool EmitDebug,
+                         llvm::CodeGenOpt::Level OptimizationLevel,
+                         const std::string &JavaReflectionPathBase,
+                         const std::string &JavaReflectionPackageName,
+                         const std::string &RSPackageName);
+
+  // Reflect the C++ script class of the current input file.
+  bool reflectCpp();
+
+  // Whether the C++ script class leaves the bitcode to an assembly file
+  // including the bitcode file (-reflect-c++-bitcode-blob), rather than
+  // embedding the bitcode, which is only there once the module is written.
+  // With the bitcode kept in memory (see compileBuffer()), it's embedded.
+  bool includesCppBitcodeFile() const {
+    return mCppBitcodeBlob && (getOutputBuffer() == NULL);
+  }
+
+  // Reflect the exports of the current input file, as far as the bitcode
+  // written by compile() isn't needed.
+  bool reflectExports(TimeReport *Report);
+
+  // reflectExports() holding mReflectionLock
+  bool reflectExportsLocked(TimeReport *Report);
+  static void *ReflectExportsWorker(void *Data);
+
+  // Wait for the reflectExports() beginEmitModule() started on another
+  // thread, if any. Returns false if it failed.
+  bool joinReflectionThread();
+
+  // Reflect what takes the bitcode written by compile(), after
+  // reflectExports().
+  bool reflectBitcode();
+
+  // Set *Key to the key of the results of compiling the current input file in
+  // mCompileCacheDir. Returns false if the input file can't be read.
+  bool getCacheKey(const CompileJob &Job, uint64_t *Key);
+
+  // Put the results cached under Key in place and write the dependency file.
+  // Returns false if the current input file needs to be compiled.
+  bool restoreFromCache(CompileJob &Job, uint64_t Key);
+
+  // Cache what compileFile(), started at CompileStart, has done for Job under
+  // Key. Entry has the dependencies and the targets of the dependency file.
+  void storeToCache(const CompileJob &Job, uint64_t Key, time_t CompileStart,
+                    RSCompileCache::Entry &Entry);
+
+  // The files compileFile() has written for Job, but the dependency file
+  void getOutputFiles(const CompileJob &Job,
+                      std::vector<std::string> *Files) const;
+
+  // Write mBatchManifest and its dependency file for the (successful) Jobs.
+  // Returns true if there's none to write.
+  bool writeBatchManifest(const CompileJobList &Jobs);
+
+  // Return the precompiled header of the RS headers to use for the current
+  // input file, building it first if it's not in mPCHCacheDir yet. Returns an
+  // empty string if there's none to use.
+  std::string getRSHeaderPCH();
+
+  // State shared by the worker threads of compileParallel()
+  struct ParallelCompileState;
+
+  // Distribute Jobs among mNumJobs worker threads, each having a private
+  // SlangRS instance, then check the ODR of their results in input order.
+  bool compileParallel(CompileJobList &Jobs);
+  static void *ParallelCompileWorker(void *Data);
+
+  // Set on a worker of a parallel compile() which has a thread of its own:
+  // the state shared by the workers and the job being compiled, which a fatal
+  // error fails rather than the whole process (see handleFatalError()).
+  ParallelCompileState *mParallelState;
+  CompileJob *mParallelJob;
 
   // Returns true if this is a Filterscript file.
   static bool isFilterscript(const char *Filename);
@@ -80,9 +323,18 @@ class SlangRS : public Slang {
   virtual void initPreprocessor();
   virtual void initASTContext();
 
+#if !defined(_WIN32)
+  virtual void handleFatalError();
+#endif
+
+  // Start reflectExports() on another thread, such that the reflection (which
+  // only needs the exports) is written while the passes run.
+  virtual void beginEmitModule();
+
   virtual clang::ASTConsumer
   *createBackend(const clang::CodeGenOptions& CodeGenOpts,
-                 llvm::raw_ostream *OS,
+                 llvm::raw_fd_ostream *OS,
+                 std::string *OutputBuffer,
                  Slang::OutputType OT);
 
 
@@ -96,6 +348,130 @@ class SlangRS : public Slang {
 
   SlangRS();
 
+  // Allow compile() to process up to NumJobs input files concurrently, and
+  // the reflection to generate the ScriptField classes of a file on up to
+  // NumJobs threads.
+  void setNumJobs(unsigned NumJobs) {
+    mNumJobs = (NumJobs > 0) ? NumJobs : 1;
+  }
+
+  // Cache the parsed RS headers as precompiled headers in Dir.
+  void setPCHCacheDir(const std::string &Dir) { mPCHCacheDir = Dir; }
+
+  // Reuse the results of earlier compilations of the same preprocessed input
+  // with the same options, kept in Dir.
+  void setCompileCacheDir(const std::string &Dir) { mCompileCacheDir = Dir; }
+
+  // Check the ODR of the exported record types against (and record them in)
+  // the database File, shared by separate compiles (see RSODRDatabase).
+  void setODRDatabase(const std::string &File) { mODRDatabase = File; }
+
+  // Only export the members of the input files Usage lists (see
+  // RSExportUsage), which must outlive the compiles.
+  void setExportUsage(const RSExportUsage *Usage) { mExportUsage = Usage; }
+
+  // Have compile() write, once all the input files are compiled, the outputs
+  // of each (its bitcode, extra outputs and reflected files) with the hash of
+  // their content to File, and a single dependency file of them to File.d,
+  // for the build to check all at once whether it's up to date:
+  //
+  //   input <input file>
+  //   output <hash> <output file>
+  //   ...
+  void setBatchManifest(const std::string &File) { mBatchManifest = File; }
+
+  // Reflect the VarBatch class, which sets the batchable exported variables
+  // (see RSExportVar::isBatchable()) with a single invoke().
+  void setVarBatch(bool VarBatch) { mVarBatch = VarBatch; }
+
+  // Keep the elements of the reflected ScriptField_* classes in a ByteBuffer
+  // laid out as in the allocation, rather than in an array of Items, such
+  // that copyAll() is a single copy.
+  void setScriptFieldBuffer(bool ScriptFieldBuffer) {
+    mScriptFieldBuffer = ScriptFieldBuffer;
+  }
+
+  // Have the script class allocate the FieldPacker of the arguments of each
+  // invokable and kernel once, which its (then synchronized) invoke_*() and
+  // forEach_*() reset and refill, rather than a new one per call.
+  void setPreallocatedPackers(bool PreallocatedPackers) {
+    mPreallocatedPackers = PreallocatedPackers;
+  }
+
+  // Have the script class create the Elements it checks the allocations
+  // against, the initial values of its exported vectors and arrays and its
+  // preallocated FieldPackers when they're first used, rather than all of
+  // them in its constructor.
+  void setLazyInit(bool LazyInit) { mLazyInit = LazyInit; }
+
+  // Reflect the C++ script class (with BCST_CPP_CODE) inline in its header,
+  // with no .cpp (see RSContext::setCppHeaderOnly()).
+  void setCppHeaderOnly(bool CppHeaderOnly) { mCppHeaderOnly = CppHeaderOnly; }
+
+  // Have the C++ script class (with BCST_CPP_CODE) get its bitcode from the
+  // ScriptC_<name>.S reflected next to it (see RSContext::setCppBitcodeBlob()).
+  void setCppBitcodeBlob(bool CppBitcodeBlob) {
+    mCppBitcodeBlob = CppBitcodeBlob;
+  }
+
+  // Next to each elementwise uchar4/float4 kernel, emit a variant processing
+  // several consecutive cells of a row per call (see
+  // RS_EXPORT_FOREACH_WIDENED_MN), which the runtime can run its row loop on.
+  void setWidenKernels(bool WidenKernels) { mWidenKernels = WidenKernels; }
+
+  // Encode the export info with the string table and the type stream of
+  // slang_rs_metadata_spec.h rather than as a named MDNode of strings per
+  // kind, for the runtimes which decode it.
+  void setCompactMetadata(bool CompactMetadata) {
+    mCompactMetadata = CompactMetadata;
+  }
+
+  // Count the calls of each forEach kernel and invokable and the time spent
+  // in them, which the reflected getProfileCounters() reads back (see
+  // RS_PROFILE_COUNTERS_VAR_NAME).
+  void setInstrumentKernels(bool InstrumentKernels) {
+    mInstrumentKernels = InstrumentKernels;
+  }
+
+  // Lay out the scalar and vector variables read by the forEach kernels in a
+  // block ahead of the others, such that their uniform parameters take few
+  // cache lines. The slots of the exported variables don't change.
+  void setLayoutHotGlobals(bool LayoutHotGlobals) {
+    mLayoutHotGlobals = LayoutHotGlobals;
+  }
+
+  // Describe the globals each forEach kernel and invokable reads and writes
+  // (see RS_EXPORT_ACCESS_MN), such that the runtime can tell which of them
+  // may run at once.
+  void setExportAccessSets(bool ExportAccessSets) {
+    mExportAccessSets = ExportAccessSets;
+  }
+
+  // Don't rewrite (and so touch) the reflected files which would get the same
+  // content, such that the build steps consuming them don't rerun.
+  void setWriteIfChanged(bool WriteIfChanged) {
+    mWriteIfChanged = WriteIfChanged;
+  }
+
+  // Remove the calls to the functions Names (see
+  // RSContext::setStrippedCalls()) from the bitcode.
+  void setStrippedCalls(const std::vector<std::string> &Names) {
+    mStrippedCalls = Names;
+  }
+
+  // Along with the bitcode of each input file, write native objects of it for
+  // ABIs (see Slang::GetAOTTarget()). The object of foo.bc for ABI goes to
+  // <ABI>/foo.o next to it.
+  void setAOTABIs(const std::vector<std::string> &ABIs) { mAOTABIs = ABIs; }
+
+  // Also write the outputs of ExtraOutputTypes (none of OT_Dependency and
+  // OT_Nothing) for each input file, next to its output and differing only in
+  // the extension. They come from the same parse, RS AST processing and
+  // optimized module as the output.
+  void setExtraOutputTypes(const std::vector<Slang::OutputType> &OutputTypes) {
+    mExtraOutputTypes = OutputTypes;
+  }
+
   // Compile bunch of RS files given in the llvm-rs-cc arguments. Return true if
   // all given input files are successfully compiled without errors.
   //
@@ -144,6 +520,41 @@ class SlangRS : public Slang {
                const std::string &JavaReflectionPackageName,
                const std::string &RSPackageName);
 
+  // An input held in memory for compileBuffer(), and the outputs compiling it
+  // has produced, also in memory.
+  struct BufferJob {
+    // The name of the input, for the diagnostics, the dependencies and the
+    // name of the script. Must outlive the SlangRS, which remembers the
+    // input files for the ODR check.
+    const char *InputFile;
+    const char *Text;
+    size_t TextLength;
+    // The name of the bitcode, for the reflection and the dependency rule
+    const char *OutputFile;
+
+    std::string Bitcode;
+    // The dependency rule, only with OutputDep
+    std::string Dependencies;
+    // The reflected files, with the paths compile() would write them to
+    FileContentList ReflectedFiles;
+  };
+
+  // Compile, reflect and (with @OutputDep) generate the dependency rule of
+  // the input of Job like compile() does, but without going through the file
+  // system for the input or for any output: all of them are in *Job. The
+  // options are the ones of compile(), except that the output is always
+  // OT_Bitcode stored as a resource (BCST_APK_RESOURCE). Neither the compile
+  // cache nor the extra outputs are used.
+  bool compileBuffer(BufferJob *Job,
+                     const std::vector<std::string> &IncludePaths,
+                     const std::vector<std::string> &AdditionalDepTargets,
+                     bool AllowRSPrefix, bool OutputDep,
+                     unsigned int TargetAPI, bool EmitDebug,
+                     llvm::CodeGenOpt::Level OptimizationLevel,
+                     const std::string &JavaReflectionPathBase,
+                     const std::string &JavaReflectionPackageName,
+                     const std::string &RSPackageName);
+
   virtual void reset();
 
   virtual ~SlangRS();
@@ -16,47 +16,82 @@
 
 #include "slang_rs_backend.h"
 
+#include <ctype.h>
+#include <string.h>
+
+#include <algorithm>
+#include <list>
+#include <set>
 #include <string>
 #include <vector>
 
 #include "clang/AST/ASTContext.h"
 #include "clang/Frontend/CodeGenOptions.h"
 
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/ADT/Twine.h"
 #include "llvm/ADT/StringExtras.h"
 
+#include "llvm/Analysis/Dominators.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ValueTracking.h"
+
+#include "llvm/IR/Attributes.h"
 #include "llvm/IR/Constant.h"
 #include "llvm/IR/Constants.h"
+#include "llvm/IR/DataLayout.h"
 #include "llvm/IR/DerivedTypes.h"
 #include "llvm/IR/Function.h"
+#include "llvm/IR/GlobalVariable.h"
 #include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
 #include "llvm/IR/Metadata.h"
 #include "llvm/IR/Module.h"
+#include "llvm/IR/Operator.h"
 
+#include "llvm/Support/CallSite.h"
 #include "llvm/Support/DebugLoc.h"
+#include "llvm/Support/InstIterator.h"
+#include "llvm/Support/ValueHandle.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/Local.h"
+#include "llvm/Transforms/Utils/ValueMapper.h"
 
 #include "slang_assert.h"
 #include "slang_rs.h"
 #include "slang_rs_context.h"
 #include "slang_rs_export_foreach.h"
 #include "slang_rs_export_func.h"
+#include "slang_rs_export_reduce.h"
 #include "slang_rs_export_type.h"
 #include "slang_rs_export_var.h"
 #include "slang_rs_metadata.h"
+#include "slang_version.h"
 
 namespace slang {
 
 RSBackend::RSBackend(RSContext *Context,
                      clang::DiagnosticsEngine *DiagEngine,
+                     llvm::LLVMContext &LLVMContext,
                      const clang::CodeGenOptions &CodeGenOpts,
                      const clang::TargetOptions &TargetOpts,
                      PragmaList *Pragmas,
-                     llvm::raw_ostream *OS,
+                     llvm::raw_fd_ostream *OS,
+                     std::string *OutputBuffer,
                      Slang::OutputType OT,
+                     const Slang::ExtraOutputList *ExtraOutputs,
+                     llvm::StringRef RuntimeLibrary,
+                     const ExecutionProfile *Profile,
                      clang::SourceManager &SourceMgr,
                      bool AllowRSPrefix,
-                     bool IsFilterscript)
-  : Backend(DiagEngine, CodeGenOpts, TargetOpts, Pragmas, OS, OT),
+                     bool IsFilterscript,
+                     TimeReport *Report)
+  : Backend(DiagEngine, LLVMContext, CodeGenOpts, TargetOpts, Pragmas, OS,
+            OutputBuffer, OT, ExtraOutputs, RuntimeLibrary, Profile, Report),
     mContext(Context),
     mSourceMgr(SourceMgr),
     mAllowRSPrefix(AllowRSPrefix),
@@ -67,18 +102,36 @@ RSBackend::RSBackend(RSContext *Context,
     mExportForEachSignatureMetadata(NULL),
     mExportTypeMetadata(NULL),
     mRSObjectSlotsMetadata(NULL),
+    mMetadataEncoder(NULL),
     mRefCount(mContext->getASTContext()),
-    mASTChecker(Context, Context->getTargetAPI(), IsFilterscript) {
+    mASTChecker(Context, Context->getTargetAPI(), IsFilterscript),
+    mElementAtLowering(mContext->getASTContext()) {
 }
 
 // 1) Add zero initialization of local RS object types
+// 2) Lower the untyped accesses to allocations to the typed accessors
 void RSBackend::AnnotateFunction(clang::FunctionDecl *FD) {
   if (FD &&
       FD->hasBody() &&
       !SlangRS::IsLocInRSHeaderFile(FD->getLocation(), mSourceMgr)) {
+    TimeReport::Region Timer(mTimeReport, TimeReport::PT_RSAST);
     mRefCount.Init();
     mRefCount.Visit(FD->getBody());
+    if (getTargetAPI() >= SLANG_JB_MR2_TARGET_API)
+      mElementAtLowering.Visit(FD->getBody());
   }
+  HandleRefCountHelpers();
+  return;
+}
+
+void RSBackend::HandleRefCountHelpers() {
+  std::list<clang::FunctionDecl*> Helpers;
+  mRefCount.takeNewHelpers(&Helpers);
+  for (std::list<clang::FunctionDecl*>::const_iterator I = Helpers.begin(),
+          E = Helpers.end();
+       I != E;
+       I++)
+    Backend::HandleTopLevelDecl(clang::DeclGroupRef(*I));
   return;
 }
 
@@ -129,8 +182,25 @@ bool RSBackend::HandleTopLevelDecl(clang::DeclGroupRef D) {
 void RSBackend::HandleTranslationUnitPre(clang::ASTContext &C) {
   clang::TranslationUnitDecl *TUDecl = C.getTranslationUnitDecl();
 
+  // Walk the top-level declarations once, validating each and picking out
+  // what the RS object handling below needs.
+  std::vector<clang::VarDecl*> GlobalVars;
+  std::vector<clang::FunctionDecl*> StaticFuncs;
+  for (clang::DeclContext::decl_iterator I = TUDecl->decls_begin(),
+          E = TUDecl->decls_end(); I != E; I++) {
+    mASTChecker.ValidateDecl(*I);
+
+    if (clang::VarDecl *VD = llvm::dyn_cast<clang::VarDecl>(*I)) {
+      GlobalVars.push_back(VD);
+    } else if (clang::FunctionDecl *FD =
+                   llvm::dyn_cast<clang::FunctionDecl>(*I)) {
+      if (!FD->isGlobal())
+        StaticFuncs.push_back(FD);
+    }
+  }
+
   // If we have an invalid RS/FS AST, don't check further.
-  if (!mASTChecker.Validate()) {
+  if (!mASTChecker.isValid()) {
     return;
   }
 
@@ -162,21 +232,15 @@ void RSBackend::HandleTranslationUnitPre(clang::ASTContext &C) {
 
   // Create a static global destructor if necessary (to handle RS object
   // runtime cleanup).
-  clang::FunctionDecl *FD = mRefCount.CreateStaticGlobalDtor();
+  clang::FunctionDecl *FD = mRefCount.CreateStaticGlobalDtor(GlobalVars);
   if (FD) {
     HandleTopLevelDecl(clang::DeclGroupRef(FD));
   }
 
   // Process any static function declarations
-  for (clang::DeclContext::decl_iterator I = TUDecl->decls_begin(),
-          E = TUDecl->decls_end(); I != E; I++) {
-    if ((I->getKind() >= clang::Decl::firstFunction) &&
-        (I->getKind() <= clang::Decl::lastFunction)) {
-      clang::FunctionDecl *FD = llvm::dyn_cast<clang::FunctionDecl>(*I);
-      if (FD && !FD->isGlobal()) {
-        AnnotateFunction(FD);
-      }
-    }
+  for (std::vector<clang::FunctionDecl*>::const_iterator
+           I = StaticFuncs.begin(), E = StaticFuncs.end(); I != E; I++) {
+    AnnotateFunction(*I);
   }
 
   return;
@@ -185,7 +249,7 @@ void RSBackend::HandleTranslationUnitPre(clang::ASTContext &C) {
 ///////////////////////////////////////////////////////////////////////////////
 void RSBackend::dumpExportVarInfo(llvm::Module *M) {
   int slotCount = 0;
-  if (mExportVarMetadata == NULL)
+  if ((mExportVarMetadata == NULL) && (mMetadataEncoder == NULL))
     mExportVarMetadata = M->getOrInsertNamedMetadata(RS_EXPORT_VAR_MN);
 
   llvm::SmallVector<llvm::Value*, 2> ExportVarInfo;
@@ -201,6 +265,19 @@ void RSBackend::dumpExportVarInfo(llvm::Module *M) {
     const RSExportType *ET = EV->getType();
     bool countsAsRSObject = false;
 
+    if (mMetadataEncoder != NULL) {
+      RSVar V = { EV->getName().c_str(), ET->getSpecType() };
+      checkMetadataEncoding(RSEncodeVarMetadata(mMetadataEncoder, &V),
+                            EV->getName());
+      if ((ET->getClass() == RSExportType::ExportClassPrimitive) &&
+          static_cast<const RSExportPrimitiveType*>(ET)->isRSObjectType())
+        checkMetadataEncoding(
+            RSEncodeObjectSlotMetadata(mMetadataEncoder, slotCount),
+            EV->getName());
+      slotCount++;
+      continue;
+    }
+
     // Variable name
     ExportVarInfo.push_back(
         llvm::MDString::get(mLLVMContext, EV->getName().c_str()));
@@ -259,15 +336,76 @@ void RSBackend::dumpExportVarInfo(llvm::Module *M) {
 
     slotCount++;
   }
+
+  // The compact metadata isn't used with the instrumentation.
+  if ((mMetadataEncoder == NULL) &&
+      (M->getNamedGlobal(RS_PROFILE_COUNTERS_VAR_NAME) != NULL)) {
+    slangAssert(slotCount ==
+                static_cast<int>(mContext->getProfileCountersSlot()));
+    ExportVarInfo.push_back(
+        llvm::MDString::get(mLLVMContext, RS_PROFILE_COUNTERS_VAR_NAME));
+    ExportVarInfo.push_back(llvm::MDString::get(mLLVMContext, "*long"));
+    mExportVarMetadata->addOperand(
+        llvm::MDNode::get(mLLVMContext, ExportVarInfo));
+  }
+  return;
 }
 
-void RSBackend::dumpExportFunctionInfo(llvm::Module *M) {
+void RSBackend::addExportFuncInfo(llvm::Module *M, const std::string &Name) {
+  if (mMetadataEncoder != NULL) {
+    RSFunction F = { Name.c_str() };
+    checkMetadataEncoding(RSEncodeFunctionMetadata(mMetadataEncoder, &F), Name);
+    return;
+  }
+
   if (mExportFuncMetadata == NULL)
     mExportFuncMetadata =
         M->getOrInsertNamedMetadata(RS_EXPORT_FUNC_MN);
+  mExportFuncMetadata->addOperand(
+      llvm::MDNode::get(mLLVMContext,
+                        llvm::MDString::get(mLLVMContext, Name)));
+  return;
+}
 
-  llvm::SmallVector<llvm::Value*, 1> ExportFuncInfo;
+void RSBackend::addExportForEachInfo(llvm::Module *M, const std::string &Name,
+                                     unsigned Signature) {
+  if (mMetadataEncoder != NULL) {
+    RSForEach F = { Name.c_str(), Signature };
+    checkMetadataEncoding(RSEncodeForEachMetadata(mMetadataEncoder, &F), Name);
+    return;
+  }
 
+  if (mExportForEachNameMetadata == NULL) {
+    mExportForEachNameMetadata =
+        M->getOrInsertNamedMetadata(RS_EXPORT_FOREACH_NAME_MN);
+  }
+  if (mExportForEachSignatureMetadata == NULL) {
+    mExportForEachSignatureMetadata =
+        M->getOrInsertNamedMetadata(RS_EXPORT_FOREACH_MN);
+  }
+
+  mExportForEachNameMetadata->addOperand(
+      llvm::MDNode::get(mLLVMContext,
+                        llvm::MDString::get(mLLVMContext, Name)));
+  mExportForEachSignatureMetadata->addOperand(
+      llvm::MDNode::get(mLLVMContext,
+                        llvm::MDString::get(mLLVMContext,
+                                            llvm::utostr_32(Signature))));
+  return;
+}
+
+void RSBackend::checkMetadataEncoding(int Res, const std::string &Name) {
+  if (Res == 0)
+    return;
+  mDiagEngine.Report(
+      mDiagEngine.getCustomDiagID(clang::DiagnosticsEngine::Error,
+                                  "failed to encode the metadata of '%0' "
+                                  "(error %1)"))
+      << Name << Res;
+  return;
+}
+
+void RSBackend::dumpExportFunctionInfo(llvm::Module *M) {
   for (RSContext::const_export_func_iterator
           I = mContext->export_funcs_begin(),
           E = mContext->export_funcs_end();
@@ -277,8 +415,7 @@ void RSBackend::dumpExportFunctionInfo(llvm::Module *M) {
 
     // Function name
     if (!EF->hasParam()) {
-      ExportFuncInfo.push_back(llvm::MDString::get(mLLVMContext,
-                                                   EF->getName().c_str()));
+      addExportFuncInfo(M, EF->getName());
     } else {
       llvm::Function *F = M->getFunction(EF->getName());
       llvm::Function *HelperFunction;
@@ -379,28 +516,656 @@ void RSBackend::dumpExportFunctionInfo(llvm::Module *M) {
         }
       }
 
-      ExportFuncInfo.push_back(
-          llvm::MDString::get(mLLVMContext, HelperFunctionName.c_str()));
+      addExportFuncInfo(M, HelperFunctionName);
+    }
+  }
+}
+
+void RSBackend::dumpVarBatchInfo(llvm::Module *M) {
+  std::vector<size_t> Offsets;
+  if (mContext->getVarBatchLayout(&Offsets) == 0)
+    return;
+
+  llvm::Type *Int8PtrTy = llvm::Type::getInt8PtrTy(mLLVMContext);
+  llvm::Type *Int32Ty = llvm::Type::getInt32Ty(mLLVMContext);
+
+  // void RS_VAR_BATCH_FUNC_NAME(const void *Packet) copies the value of each
+  // variable whose bit is set in the packet into place.
+  llvm::FunctionType *BatchFunctionType =
+      llvm::FunctionType::get(llvm::Type::getVoidTy(mLLVMContext),
+                              Int8PtrTy,
+                              /* IsVarArgs = */false);
+  llvm::Function *BatchFunction =
+      llvm::Function::Create(BatchFunctionType,
+                             llvm::GlobalValue::ExternalLinkage,
+                             RS_VAR_BATCH_FUNC_NAME,
+                             M);
+  BatchFunction->addFnAttr(llvm::Attribute::NoInline);
+
+  llvm::Value *Packet = &(*BatchFunction->arg_begin());
+  llvm::BasicBlock *BB =
+      llvm::BasicBlock::Create(mLLVMContext, "entry", BatchFunction);
+  llvm::IRBuilder<> IB(BB);
+  llvm::Value *Mask =
+      IB.CreateBitCast(Packet, llvm::PointerType::getUnqual(Int32Ty));
+
+  unsigned Index = 0;
+  for (RSContext::const_export_var_iterator I = mContext->export_vars_begin(),
+          E = mContext->export_vars_end();
+       I != E;
+       I++) {
+    const RSExportVar *EV = *I;
+    if (!EV->isBatchable())
+      continue;
+
+    llvm::GlobalVariable *GV = M->getNamedGlobal(EV->getName());
+    slangAssert(GV && "Variable marked as exported disappeared in Bitcode");
+
+    llvm::Value *MaskWord =
+        IB.CreateLoad(IB.CreateConstInBoundsGEP1_32(Mask, Index / 32));
+    llvm::Value *IsSet =
+        IB.CreateICmpNE(IB.CreateAnd(MaskWord, 1U << (Index % 32)),
+                        llvm::ConstantInt::get(Int32Ty, 0));
+
+    llvm::BasicBlock *SetBB =
+        llvm::BasicBlock::Create(mLLVMContext, "set." + EV->getName(),
+                                 BatchFunction);
+    llvm::BasicBlock *NextBB =
+        llvm::BasicBlock::Create(mLLVMContext, "next", BatchFunction);
+    IB.CreateCondBr(IsSet, SetBB, NextBB);
+
+    IB.SetInsertPoint(SetBB);
+    IB.CreateMemCpy(IB.CreateBitCast(GV, Int8PtrTy),
+                    IB.CreateConstInBoundsGEP1_32(Packet, Offsets[Index]),
+                    RSExportType::GetTypeAllocSize(EV->getType()),
+                    /* Align = */1);
+    IB.CreateBr(NextBB);
+
+    IB.SetInsertPoint(NextBB);
+    Index++;
+  }
+  IB.CreateRetVoid();
+
+  addExportFuncInfo(M, RS_VAR_BATCH_FUNC_NAME);
+  return;
+}
+
+// Whether F is one of the functions Names, or an overload of one of them
+// (named _Z<length><name><parameters>).
+static bool IsStrippedFunction(const llvm::Function *F,
+                               const std::vector<std::string> &Names) {
+  llvm::StringRef Name = F->getName();
+  for (unsigned i = 0, e = Names.size(); i != e; i++) {
+    if ((Name == Names[i]) ||
+        Name.startswith("_Z" + llvm::utostr(Names[i].size()) + Names[i]))
+      return true;
+  }
+  return false;
+}
+
+void RSBackend::stripCalls(llvm::Module *M) {
+  const std::vector<std::string> &Names = mContext->getStrippedCalls();
+  std::vector<llvm::Function*> Functions;
+  for (llvm::Module::iterator I = M->begin(), E = M->end(); I != E; I++)
+    if (IsStrippedFunction(I, Names))
+      Functions.push_back(I);
+
+  // The constants the arguments come from (e.g., the messages of rsDebug())
+  llvm::SmallPtrSet<llvm::GlobalVariable*, 8> Globals;
+  for (unsigned i = 0, e = Functions.size(); i != e; i++) {
+    llvm::Function *F = Functions[i];
+    std::vector<llvm::CallInst*> Calls;
+    for (llvm::Value::use_iterator U = F->use_begin(), UE = F->use_end();
+         U != UE;
+         U++) {
+      llvm::CallInst *CI = llvm::dyn_cast<llvm::CallInst>(*U);
+      if ((CI != NULL) && (CI->getCalledFunction() == F) && CI->use_empty())
+        Calls.push_back(CI);
+    }
+
+    for (unsigned j = 0, je = Calls.size(); j != je; j++) {
+      // An argument may be given twice, or be the operand of another one.
+      llvm::SmallVector<llvm::WeakVH, 8> Args;
+      for (unsigned k = 0, ke = Calls[j]->getNumArgOperands(); k != ke; k++)
+        Args.push_back(Calls[j]->getArgOperand(k));
+      Calls[j]->eraseFromParent();
+
+      for (unsigned k = 0, ke = Args.size(); k != ke; k++) {
+        llvm::Value *Arg = Args[k];
+        if (Arg == NULL)
+          continue;
+        if (llvm::isa<llvm::Instruction>(Arg))
+          llvm::RecursivelyDeleteTriviallyDeadInstructions(Arg);
+        else if (llvm::GlobalVariable *GV =
+                     llvm::dyn_cast<llvm::GlobalVariable>(
+                         Arg->stripPointerCasts()))
+          Globals.insert(GV);
+      }
     }
 
-    mExportFuncMetadata->addOperand(
-        llvm::MDNode::get(mLLVMContext, ExportFuncInfo));
-    ExportFuncInfo.clear();
+    if (F->isDeclaration() && F->use_empty())
+      F->eraseFromParent();
+  }
+
+  for (llvm::SmallPtrSet<llvm::GlobalVariable*, 8>::iterator
+           I = Globals.begin(),
+           E = Globals.end();
+       I != E;
+       I++) {
+    llvm::GlobalVariable *GV = *I;
+    GV->removeDeadConstantUsers();
+    if (GV->hasLocalLinkage() && GV->use_empty())
+      GV->eraseFromParent();
   }
+  return;
+}
+
+// V as an argument of type T. The ABI passes some of the cells coerced (e.g.,
+// a uchar2 as an i32, a float3 as a <4 x i32>), but returns them as they are,
+// so the two may not even have the same size. The cell goes through a stack
+// slot large enough for both, which the inlining and SROA then fold away.
+static llvm::Value *CoerceCell(llvm::IRBuilder<> &Builder, llvm::Value *V,
+                               llvm::Type *T, const llvm::DataLayout &Layout) {
+  if (V->getType() == T)
+    return V;
+
+  llvm::Type *SlotTy = V->getType();
+  if (Layout.getTypeAllocSize(T) > Layout.getTypeAllocSize(SlotTy))
+    SlotTy = T;
+  llvm::BasicBlock &Entry =
+      Builder.GetInsertBlock()->getParent()->getEntryBlock();
+  llvm::IRBuilder<> SlotBuilder(&Entry, Entry.begin());
+  llvm::AllocaInst *Slot = SlotBuilder.CreateAlloca(SlotTy);
+  Slot->setAlignment(std::max(Layout.getABITypeAlignment(V->getType()),
+                              Layout.getABITypeAlignment(T)));
+
+  Builder.CreateStore(V, Builder.CreateBitCast(
+      Slot, llvm::PointerType::getUnqual(V->getType())));
+  return Builder.CreateLoad(Builder.CreateBitCast(
+      Slot, llvm::PointerType::getUnqual(T)));
+}
+
+void RSBackend::genFusedKernels(llvm::Module *M) {
+  llvm::Type *Int32Ty = llvm::Type::getInt32Ty(mLLVMContext);
+
+  for (RSContext::const_export_foreach_iterator
+          I = mContext->export_foreach_begin(),
+          E = mContext->export_foreach_end();
+       I != E;
+       I++) {
+    const RSExportForEach *EFE = *I;
+    if (!EFE->isFused())
+      continue;
+
+    const std::vector<const RSExportForEach*> &Kernels =
+        EFE->getFusedKernels();
+    std::vector<llvm::Function*> Functions;
+    for (unsigned i = 0, e = Kernels.size(); i != e; i++) {
+      llvm::Function *F = M->getFunction(Kernels[i]->getName());
+      slangAssert((F != NULL) && !F->isDeclaration() &&
+                  "fused kernel without a function");
+      Functions.push_back(F);
+    }
+
+    // (in[, x][, y]) as the first kernel takes the cell
+    std::vector<llvm::Type*> Params;
+    Params.push_back(Functions.front()->getFunctionType()->getParamType(0));
+    if (EFE->hasX())
+      Params.push_back(Int32Ty);
+    if (EFE->hasY())
+      Params.push_back(Int32Ty);
+    llvm::FunctionType *FT =
+        llvm::FunctionType::get(Functions.back()->getReturnType(), Params,
+                                false);
+    llvm::Function *Fused =
+        llvm::Function::Create(FT, llvm::GlobalValue::ExternalLinkage,
+                               EFE->getName(), M);
+    Fused->setCallingConv(Functions.front()->getCallingConv());
+    llvm::Function::arg_iterator AI = Fused->arg_begin();
+    llvm::Value *Cell = AI++;
+    Cell->setName("in");
+    llvm::Value *X = NULL;
+    llvm::Value *Y = NULL;
+    if (EFE->hasX()) {
+      X = AI++;
+      X->setName("x");
+    }
+    if (EFE->hasY()) {
+      Y = AI++;
+      Y->setName("y");
+    }
+
+    llvm::IRBuilder<> Builder(
+        llvm::BasicBlock::Create(mLLVMContext, "entry", Fused));
+    std::vector<llvm::CallInst*> Calls;
+    for (unsigned i = 0, e = Kernels.size(); i != e; i++) {
+      llvm::FunctionType *KernelFT = Functions[i]->getFunctionType();
+      std::vector<llvm::Value*> Args;
+      Args.push_back(CoerceCell(Builder, Cell, KernelFT->getParamType(0),
+                                *mContext->getDataLayout()));
+      if (Kernels[i]->hasX())
+        Args.push_back(X);
+      if (Kernels[i]->hasY())
+        Args.push_back(Y);
+      slangAssert((Args.size() == KernelFT->getNumParams()) &&
+                  "unexpected parameters of a fused kernel");
+      llvm::CallInst *Call = Builder.CreateCall(Functions[i], Args);
+      Call->setCallingConv(Functions[i]->getCallingConv());
+      Call->setAttributes(Functions[i]->getAttributes());
+      Calls.push_back(Call);
+      Cell = Call;
+    }
+    Builder.CreateRet(Cell);
+
+    // The cells then stay in registers between the kernels.
+    for (unsigned i = 0, e = Calls.size(); i != e; i++) {
+      llvm::InlineFunctionInfo IFI;
+      llvm::InlineFunction(Calls[i], IFI);
+    }
+  }
+
+  return;
+}
+
+// The (mangled) name of int64_t rsUptimeNanos() of rs_time.rsh
+static const char *UptimeNanosFuncName = "_Z13rsUptimeNanosv";
+
+void RSBackend::instrumentKernels(llvm::Module *M) {
+  std::vector<std::string> Names;
+  mContext->getProfiledFunctions(&Names);
+  if (Names.empty())
+    return;
+
+  llvm::Type *Int64Ty = llvm::Type::getInt64Ty(mLLVMContext);
+  llvm::PointerType *CountersTy = llvm::PointerType::getUnqual(Int64Ty);
+  llvm::GlobalVariable *Counters =
+      new llvm::GlobalVariable(*M, CountersTy, /* isConstant = */false,
+                               llvm::GlobalValue::ExternalLinkage,
+                               llvm::ConstantPointerNull::get(CountersTy),
+                               RS_PROFILE_COUNTERS_VAR_NAME);
+  llvm::Constant *Clock = M->getOrInsertFunction(UptimeNanosFuncName,
+                                                 Int64Ty, NULL);
+  llvm::Value *One = llvm::ConstantInt::get(Int64Ty, 1);
+
+  for (unsigned i = 0, e = Names.size(); i != e; i++) {
+    llvm::Function *F = M->getFunction(Names[i]);
+    slangAssert(F && "Function marked as exported disappeared in Bitcode");
+
+    llvm::IRBuilder<> IB(&*F->getEntryBlock().getFirstInsertionPt());
+    llvm::Value *Start = IB.CreateCall(Clock, "profile.start");
+
+    // The kernels run on many threads at once, the counters are shared.
+    for (llvm::Function::iterator BB = F->begin(), BBE = F->end();
+         BB != BBE;
+         BB++) {
+      llvm::ReturnInst *RI =
+          llvm::dyn_cast<llvm::ReturnInst>(BB->getTerminator());
+      if (RI == NULL)
+        continue;
+
+      IB.SetInsertPoint(RI);
+      llvm::Value *Base = IB.CreateLoad(Counters);
+      IB.CreateAtomicRMW(llvm::AtomicRMWInst::Add,
+                         IB.CreateConstInBoundsGEP1_32(Base, 2 * i), One,
+                         llvm::Monotonic);
+      llvm::Value *Time = IB.CreateSub(IB.CreateCall(Clock), Start);
+      IB.CreateAtomicRMW(llvm::AtomicRMWInst::Add,
+                         IB.CreateConstInBoundsGEP1_32(Base, 2 * i + 1), Time,
+                         llvm::Monotonic);
+    }
+  }
+  return;
+}
+
+void RSBackend::annotateKernelParams(llvm::Module *M) {
+  for (RSContext::const_export_foreach_iterator
+          I = mContext->export_foreach_begin(),
+          E = mContext->export_foreach_end();
+       I != E;
+       I++) {
+    const RSExportForEach *EFE = *I;
+    // The cells of pass-by-value kernels are no pointers.
+    if (EFE->isDummyRoot() || EFE->isKernelStyle())
+      continue;
+
+    // Only the launches by the runtime are known to get distinct cells, the
+    // script may call the kernel (or take its address) with overlapping ones.
+    llvm::Function *F = M->getFunction(EFE->getName());
+    if ((F == NULL) || F->isDeclaration() || !F->use_empty())
+      continue;
+
+    // The parameters are in, out, usrData, x, y (of the ones there are).
+    llvm::Function::arg_iterator AI = F->arg_begin();
+    if (EFE->hasIn()) {
+      llvm::Argument *In = AI++;
+      if (In->getType()->isPointerTy()) {
+        llvm::AttrBuilder B;
+        B.addAttribute(llvm::Attribute::NoAlias);
+        if (getTargetAPI() >= SLANG_KK_TARGET_API)
+          B.addAttribute(llvm::Attribute::ReadOnly);
+        In->addAttr(llvm::AttributeSet::get(mLLVMContext, In->getArgNo() + 1,
+                                            B));
+      }
+    }
+    if (EFE->hasOut()) {
+      llvm::Argument *Out = AI++;
+      if (Out->getType()->isPointerTy()) {
+        llvm::AttrBuilder B;
+        B.addAttribute(llvm::Attribute::NoAlias);
+        Out->addAttr(llvm::AttributeSet::get(mLLVMContext,
+                                             Out->getArgNo() + 1, B));
+      }
+    }
+  }
+
+  return;
+}
+
+void RSBackend::internalizeUnusedExports(llvm::Module *M) {
+  const std::vector<std::string> &Names = mContext->getUnusedExports();
+  for (unsigned i = 0, e = Names.size(); i != e; i++) {
+    llvm::GlobalValue *GV = M->getNamedValue(Names[i]);
+    if ((GV != NULL) && !GV->isDeclaration())
+      GV->setLinkage(llvm::GlobalValue::InternalLinkage);
+  }
+  return;
+}
+
+void RSBackend::applyKernelPrecisions(llvm::Module *M) {
+  typedef llvm::DenseMap<llvm::Function*, RSContext::KernelPrecision>
+      PrecisionMapTy;
+  PrecisionMapTy Precisions;
+
+  // A kernel has its own precision, an internal helper the lowest one of its
+  // callers (starting optimistically from the highest one, for recursion),
+  // anything else the full one.
+  for (llvm::Module::iterator I = M->begin(), E = M->end(); I != E; I++) {
+    if (I->isDeclaration())
+      continue;
+    if (I->hasLocalLinkage())
+      Precisions[I] = RSContext::KP_Imprecise;
+    else
+      Precisions[I] = mContext->getKernelPrecision(I->getName());
+  }
+
+  bool Changed = true;
+  while (Changed) {
+    Changed = false;
+    for (PrecisionMapTy::iterator I = Precisions.begin(), E = Precisions.end();
+         I != E;
+         I++) {
+      llvm::Function *F = I->first;
+      if (!F->hasLocalLinkage() || (I->second == RSContext::KP_Full))
+        continue;
+
+      RSContext::KernelPrecision P = I->second;
+      if (F->use_empty())
+        P = RSContext::KP_Full;
+      for (llvm::Value::use_iterator UI = F->use_begin(), UE = F->use_end();
+           UI != UE;
+           UI++) {
+        llvm::CallSite CS(*UI);
+        if (!CS || (CS.getCalledValue() != F)) {
+          P = RSContext::KP_Full;
+          break;
+        }
+        PrecisionMapTy::const_iterator CI =
+            Precisions.find(CS.getInstruction()->getParent()->getParent());
+        if ((CI != Precisions.end()) && (CI->second < P))
+          P = CI->second;
+      }
+      if (P != I->second) {
+        I->second = P;
+        Changed = true;
+      }
+    }
+  }
+
+  for (PrecisionMapTy::const_iterator I = Precisions.begin(),
+           E = Precisions.end();
+       I != E;
+       I++) {
+    if (I->second == RSContext::KP_Full)
+      continue;
+
+    llvm::FastMathFlags FMF;
+    if (I->second == RSContext::KP_Imprecise) {
+      FMF.setUnsafeAlgebra();
+    } else {
+      // Relaxed still computes infinities and NaNs.
+      FMF.setNoSignedZeros();
+      FMF.setAllowReciprocal();
+    }
+    for (llvm::Function::iterator BI = I->first->begin(),
+             BE = I->first->end();
+         BI != BE;
+         BI++) {
+      for (llvm::BasicBlock::iterator II = BI->begin(), IE = BI->end();
+           II != IE;
+           II++) {
+        if (llvm::isa<llvm::FPMathOperator>(II))
+          II->setFastMathFlags(FMF);
+      }
+    }
+  }
+  return;
 }
 
 void RSBackend::dumpExportForEachInfo(llvm::Module *M) {
-  if (mExportForEachNameMetadata == NULL) {
-    mExportForEachNameMetadata =
-        M->getOrInsertNamedMetadata(RS_EXPORT_FOREACH_NAME_MN);
+  for (RSContext::const_export_foreach_iterator
+          I = mContext->export_foreach_begin(),
+          E = mContext->export_foreach_end();
+       I != E;
+       I++) {
+    const RSExportForEach *EFE = *I;
+    addExportForEachInfo(M, EFE->getName(), EFE->getSignatureMetadata());
   }
-  if (mExportForEachSignatureMetadata == NULL) {
-    mExportForEachSignatureMetadata =
-        M->getOrInsertNamedMetadata(RS_EXPORT_FOREACH_MN);
+}
+
+// How many rounds of inlining a specialized kernel gets, i.e., how deep the
+// calls reading the frozen variables are followed
+#define SPECIALIZE_INLINE_DEPTH 8
+
+void RSBackend::dumpSpecializedForEachInfo(llvm::Module *M) {
+  const RSContext::SpecializedVarList &Vars = mContext->getSpecializedVars();
+
+  // The frozen globals with their values, and the functions reading them
+  // (directly or through their callees)
+  std::vector<std::pair<llvm::GlobalVariable*, llvm::Constant*> > Frozen;
+  llvm::SmallPtrSet<llvm::Function*, 16> Readers;
+  std::vector<llvm::Function*> Worklist;
+
+  for (unsigned i = 0, e = Vars.size(); i != e; i++) {
+    llvm::GlobalVariable *GV = M->getNamedGlobal(Vars[i].Name);
+    if (GV == NULL)
+      continue;
+
+    llvm::Type *T = GV->getType()->getElementType();
+    // The value is read in the type of the variable, an integer one being
+    // integral (see RSContext::processSpecializedVars()).
+    llvm::Constant *Value;
+    if (T->isFloatingPointTy())
+      Value = llvm::ConstantFP::get(T, Vars[i].Value);
+    else
+      Value = llvm::ConstantInt::get(llvm::cast<llvm::IntegerType>(T),
+                                     Vars[i].Value, 10);
+
+    // The reflected class mirrors the values set from Java, a write from the
+    // script itself would go unnoticed.
+    for (llvm::Value::use_iterator UI = GV->use_begin(), UE = GV->use_end();
+         UI != UE;
+         UI++) {
+      llvm::LoadInst *LI = llvm::dyn_cast<llvm::LoadInst>(*UI);
+      if (LI == NULL) {
+        mContext->ReportError(Vars[i].Loc, "cannot specialize on '%0', the "
+                              "script writes it or takes its address")
+            << Vars[i].Name;
+        return;
+      }
+      llvm::Function *F = LI->getParent()->getParent();
+      if (Readers.insert(F))
+        Worklist.push_back(F);
+    }
+    Frozen.push_back(std::make_pair(GV, Value));
+  }
+
+  while (!Worklist.empty()) {
+    llvm::Function *F = Worklist.back();
+    Worklist.pop_back();
+    for (llvm::Value::use_iterator UI = F->use_begin(), UE = F->use_end();
+         UI != UE;
+         UI++) {
+      llvm::CallSite CS(*UI);
+      if (!CS || (CS.getCalledValue() != F))
+        continue;
+      llvm::Function *Caller = CS.getInstruction()->getParent()->getParent();
+      if (Readers.insert(Caller))
+        Worklist.push_back(Caller);
+    }
+  }
+
+  for (RSContext::const_export_foreach_iterator
+          I = mContext->export_foreach_begin(),
+          E = mContext->export_foreach_end();
+       I != E;
+       I++) {
+    const RSExportForEach *EFE = *I;
+    if (EFE->isDummyRoot())
+      continue;
+
+    llvm::Function *F = M->getFunction(EFE->getName());
+    slangAssert(F != NULL && "kernel without a function");
+
+    llvm::ValueToValueMapTy VMap;
+    llvm::Function *Clone = llvm::CloneFunction(F, VMap, false);
+    Clone->setName(EFE->getName() + RS_SPECIALIZED_KERNEL_SUFFIX);
+    M->getFunctionList().push_back(Clone);
+
+    // Bring the reads of the frozen variables into the clone.
+    for (unsigned Round = 0; Round < SPECIALIZE_INLINE_DEPTH; Round++) {
+      std::vector<llvm::CallInst*> Calls;
+      for (llvm::Function::iterator BI = Clone->begin(), BE = Clone->end();
+           BI != BE;
+           BI++) {
+        for (llvm::BasicBlock::iterator II = BI->begin(), IE = BI->end();
+             II != IE;
+             II++) {
+          llvm::CallInst *CI = llvm::dyn_cast<llvm::CallInst>(II);
+          if (CI == NULL)
+            continue;
+          llvm::Function *Callee = CI->getCalledFunction();
+          if ((Callee != NULL) && !Callee->isDeclaration() &&
+              Readers.count(Callee))
+            Calls.push_back(CI);
+        }
+      }
+      if (Calls.empty())
+        break;
+      for (unsigned i = 0, e = Calls.size(); i != e; i++) {
+        llvm::InlineFunctionInfo IFI;
+        llvm::InlineFunction(Calls[i], IFI);
+      }
+    }
+
+    for (unsigned i = 0, e = Frozen.size(); i != e; i++) {
+      std::vector<llvm::LoadInst*> Loads;
+      for (llvm::Value::use_iterator UI = Frozen[i].first->use_begin(),
+               UE = Frozen[i].first->use_end();
+           UI != UE;
+           UI++) {
+        llvm::LoadInst *LI = llvm::cast<llvm::LoadInst>(*UI);
+        if (LI->getParent()->getParent() == Clone)
+          Loads.push_back(LI);
+      }
+      for (unsigned j = 0, f = Loads.size(); j != f; j++) {
+        Loads[j]->replaceAllUsesWith(Frozen[i].second);
+        Loads[j]->eraseFromParent();
+      }
+    }
+
+    addExportForEachInfo(M, Clone->getName(), EFE->getSignatureMetadata());
+  }
+  return;
+}
+
+// Returns true if F has no other side effect than its result, i.e., it only
+// stores to its own stack and only calls functions which are such too (or
+// don't write memory). A call to the RS runtime (e.g., rsGetElementAt_*() or
+// rsSetElementAt_*()) makes F impure.
+static bool IsPureFunction(llvm::Function *F,
+                           llvm::SmallPtrSet<llvm::Function*, 8> *Visited) {
+  if (!Visited->insert(F))
+    return true;  // Recursion, decided by the outer call
+  if (F->isDeclaration())
+    return F->onlyReadsMemory();
+
+  for (llvm::Function::iterator BI = F->begin(), BE = F->end();
+       BI != BE;
+       BI++) {
+    for (llvm::BasicBlock::iterator II = BI->begin(), IE = BI->end();
+         II != IE;
+         II++) {
+      if (llvm::StoreInst *SI = llvm::dyn_cast<llvm::StoreInst>(II)) {
+        if (!llvm::isa<llvm::AllocaInst>(
+                SI->getPointerOperand()->stripPointerCasts()))
+          return false;
+      } else if (llvm::isa<llvm::CallInst>(II) ||
+                 llvm::isa<llvm::InvokeInst>(II)) {
+        llvm::CallSite CS(II);
+        if (CS.onlyReadsMemory())
+          continue;
+        llvm::Function *Callee = CS.getCalledFunction();
+        if ((Callee == NULL) || !IsPureFunction(Callee, Visited))
+          return false;
+      } else if (II->mayWriteToMemory()) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// How many cells of a row the widened variant of a kernel computes per call,
+// 0 if the kernel can't be widened: it has to map a uchar4 or a float4 to the
+// same type, through pure code.
+static unsigned GetKernelWidth(const RSExportForEach *EFE, llvm::Function *F) {
+  if (EFE->isDummyRoot() || !EFE->isKernelStyle() || !EFE->hasIn() ||
+      !EFE->hasReturn() || (F == NULL))
+    return 0;
+
+  const RSExportType *InType = EFE->getInType();
+  const RSExportType *OutType = EFE->getOutType();
+  if ((InType == NULL) || (OutType == NULL) ||
+      (InType->getClass() != RSExportType::ExportClassVector) ||
+      !InType->equals(OutType))
+    return 0;
+  const RSExportVectorType *EVT = static_cast<const RSExportVectorType*>(InType);
+  if (EVT->getNumElement() != 4)
+    return 0;
+
+  // The IR signature has to be (in[, x][, y]) -> out, with in and out passed
+  // by value.
+  llvm::FunctionType *FT = F->getFunctionType();
+  unsigned NumParams = 1 + EFE->hasX() + EFE->hasY();
+  if ((FT->getNumParams() != NumParams) ||
+      (FT->getReturnType() != FT->getParamType(0)))
+    return 0;
+
+  llvm::SmallPtrSet<llvm::Function*, 8> Visited;
+  if (!IsPureFunction(F, &Visited))
+    return 0;
+
+  // Two cache lines of uchar4s, four 128-bit registers of float4s
+  switch (EVT->getType()) {
+    case RSExportPrimitiveType::DataTypeUnsigned8: return 8;
+    case RSExportPrimitiveType::DataTypeFloat32: return 4;
+    default: return 0;
   }
+}
 
-  llvm::SmallVector<llvm::Value*, 1> ExportForEachName;
-  llvm::SmallVector<llvm::Value*, 1> ExportForEachInfo;
+void RSBackend::dumpWidenedForEachInfo(llvm::Module *M) {
+  llvm::NamedMDNode *WidenedMetadata = NULL;
+  llvm::Type *Int32Ty = llvm::Type::getInt32Ty(mLLVMContext);
 
   for (RSContext::const_export_foreach_iterator
           I = mContext->export_foreach_begin(),
@@ -408,22 +1173,109 @@ void RSBackend::dumpExportForEachInfo(llvm::Module *M) {
        I != E;
        I++) {
     const RSExportForEach *EFE = *I;
+    llvm::Function *Kernel = M->getFunction(EFE->getName());
+    unsigned Width = GetKernelWidth(EFE, Kernel);
+    if (Width == 0)
+      continue;
+
+    // The specialized variant (if any) is widened as well.
+    std::vector<llvm::Function*> Variants;
+    Variants.push_back(Kernel);
+    if (llvm::Function *F =
+            M->getFunction(EFE->getName() + RS_SPECIALIZED_KERNEL_SUFFIX))
+      Variants.push_back(F);
+
+    for (unsigned v = 0, ve = Variants.size(); v != ve; v++) {
+      llvm::Function *F = Variants[v];
+      llvm::Type *T = F->getReturnType();
+      llvm::Type *Params[] = { T->getPointerTo(), T->getPointerTo(), Int32Ty,
+                               Int32Ty };
+      llvm::FunctionType *FT =
+          llvm::FunctionType::get(llvm::Type::getVoidTy(mLLVMContext), Params,
+                                  false);
+      llvm::Function *Widened =
+          llvm::Function::Create(FT, llvm::GlobalValue::ExternalLinkage,
+                                 F->getName() + RS_WIDENED_KERNEL_SUFFIX, M);
+      llvm::Function::arg_iterator AI = Widened->arg_begin();
+      llvm::Value *In = AI++;
+      llvm::Value *Out = AI++;
+      llvm::Value *X = AI++;
+      llvm::Value *Y = AI++;
+      In->setName("in");
+      Out->setName("out");
+      X->setName("x");
+      Y->setName("y");
+
+      // The cells are computed in straight-line code, which the SLP
+      // vectorizer turns into vector operations across the cells.
+      llvm::IRBuilder<> Builder(
+          llvm::BasicBlock::Create(mLLVMContext, "entry", Widened));
+      std::vector<llvm::CallInst*> Calls;
+      for (unsigned i = 0; i < Width; i++) {
+        llvm::Value *Args[3];
+        unsigned NumArgs = 0;
+        Args[NumArgs++] = Builder.CreateLoad(Builder.CreateConstGEP1_32(In, i));
+        if (EFE->hasX())
+          Args[NumArgs++] = Builder.CreateAdd(X,
+                                              llvm::ConstantInt::get(Int32Ty,
+                                                                     i));
+        if (EFE->hasY())
+          Args[NumArgs++] = Y;
+        llvm::CallInst *Call =
+            Builder.CreateCall(F, llvm::ArrayRef<llvm::Value*>(Args, NumArgs));
+        Call->setCallingConv(F->getCallingConv());
+        Builder.CreateStore(Call, Builder.CreateConstGEP1_32(Out, i));
+        Calls.push_back(Call);
+      }
+      Builder.CreateRetVoid();
 
-    ExportForEachName.push_back(
-        llvm::MDString::get(mLLVMContext, EFE->getName().c_str()));
+      for (unsigned i = 0, e = Calls.size(); i != e; i++) {
+        llvm::InlineFunctionInfo IFI;
+        llvm::InlineFunction(Calls[i], IFI);
+      }
 
-    mExportForEachNameMetadata->addOperand(
-        llvm::MDNode::get(mLLVMContext, ExportForEachName));
-    ExportForEachName.clear();
+      if (WidenedMetadata == NULL)
+        WidenedMetadata =
+            M->getOrInsertNamedMetadata(RS_EXPORT_FOREACH_WIDENED_MN);
+      llvm::Value *Info[] = {
+        llvm::MDString::get(mLLVMContext, F->getName()),
+        llvm::MDString::get(mLLVMContext, llvm::utostr_32(Width))
+      };
+      WidenedMetadata->addOperand(llvm::MDNode::get(mLLVMContext, Info));
+    }
+  }
+  return;
+}
 
-    ExportForEachInfo.push_back(
-        llvm::MDString::get(mLLVMContext,
-                            llvm::utostr_32(EFE->getSignatureMetadata())));
+// The name of FD as an operand of the metadata, NULL if there's no FD.
+static llvm::Value *GetFunctionNameMD(llvm::LLVMContext &C,
+                                      const clang::FunctionDecl *FD) {
+  if (FD == NULL)
+    return NULL;
+  return llvm::MDString::get(C, FD->getName());
+}
 
-    mExportForEachSignatureMetadata->addOperand(
-        llvm::MDNode::get(mLLVMContext, ExportForEachInfo));
-    ExportForEachInfo.clear();
+void RSBackend::dumpExportReduceInfo(llvm::Module *M) {
+  llvm::NamedMDNode *ReduceMetadata =
+      M->getOrInsertNamedMetadata(RS_EXPORT_REDUCE_MN);
+  for (RSContext::const_export_reduce_iterator
+           I = mContext->export_reduce_begin(),
+           E = mContext->export_reduce_end();
+       I != E;
+       I++) {
+    const RSExportReduce *ER = *I;
+    size_t AccumSize = RSExportType::GetTypeAllocSize(ER->getAccumType());
+    llvm::Value *Info[] = {
+      llvm::MDString::get(mLLVMContext, ER->getName()),
+      llvm::MDString::get(mLLVMContext, llvm::utostr_64(AccumSize)),
+      GetFunctionNameMD(mLLVMContext, ER->getAccumulator()),
+      GetFunctionNameMD(mLLVMContext, ER->getInitializer()),
+      GetFunctionNameMD(mLLVMContext, ER->getCombiner()),
+      GetFunctionNameMD(mLLVMContext, ER->getOutConverter())
+    };
+    ReduceMetadata->addOperand(llvm::MDNode::get(mLLVMContext, Info));
   }
+  return;
 }
 
 void RSBackend::dumpExportTypeInfo(llvm::Module *M) {
@@ -437,6 +1289,16 @@ void RSBackend::dumpExportTypeInfo(llvm::Module *M) {
     // First, dump type name list to export
     const RSExportType *ET = I->getValue();
 
+    // The compact encoder lays out the records it meets (down to the ones of
+    // the fields) on its own.
+    if (mMetadataEncoder != NULL) {
+      if (ET->getClass() == RSExportType::ExportClassRecord)
+        checkMetadataEncoding(
+            RSEncodeTypeMetadata(mMetadataEncoder, ET->getSpecType()),
+            ET->getName());
+      continue;
+    }
+
     ExportTypeInfo.clear();
     // Type name
     ExportTypeInfo.push_back(
@@ -481,27 +1343,547 @@ void RSBackend::dumpExportTypeInfo(llvm::Module *M) {
             llvm::MDNode::get(mLLVMContext, FieldInfo));
         FieldInfo.clear();
       }
+
+      const std::vector<size_t> &Offsets = ERT->getRSObjectOffsets();
+      if (!Offsets.empty()) {
+        llvm::SmallVector<llvm::Value*, 8> OffsetInfo;
+        OffsetInfo.push_back(
+            llvm::MDString::get(mLLVMContext, ET->getName().c_str()));
+        for (unsigned i = 0, e = Offsets.size(); i != e; i++)
+          OffsetInfo.push_back(
+              llvm::MDString::get(mLLVMContext, llvm::utostr_32(Offsets[i])));
+        M->getOrInsertNamedMetadata(RS_OBJECT_OFFSETS_MN)->addOperand(
+            llvm::MDNode::get(mLLVMContext, OffsetInfo));
+      }
     }   // ET->getClass() == RSExportType::ExportClassRecord
   }
 }
 
+// How many times a pointer kept in a local variable is followed back to the
+// values stored into it, which is enough for the locals of the unoptimized
+// code (e.g., a copy of a parameter).
+static const unsigned MaxStoredPointerDepth = 4;
+
+static bool GetAccessedGlobals(llvm::Value *Ptr, unsigned Depth,
+                               std::set<std::string> *Names);
+
+// Add the globals the pointers stored into the local A may point into to
+// Names. Returns false if A is used otherwise than loaded and stored as a
+// whole, or if what's stored into it is unknown.
+static bool GetStoredPointers(llvm::AllocaInst *A, unsigned Depth,
+                              std::set<std::string> *Names) {
+  bool Known = true;
+  for (llvm::Value::use_iterator I = A->use_begin(), E = A->use_end();
+       I != E;
+       I++) {
+    if (llvm::LoadInst *LI = llvm::dyn_cast<llvm::LoadInst>(*I)) {
+      if (LI->getPointerOperand() == A)
+        continue;
+    } else if (llvm::StoreInst *SI = llvm::dyn_cast<llvm::StoreInst>(*I)) {
+      if (SI->getPointerOperand() == A) {
+        if (!GetAccessedGlobals(SI->getValueOperand(), Depth, Names))
+          Known = false;
+        continue;
+      }
+    }
+    return false;
+  }
+  return Known;
+}
+
+// Add the globals the accesses through Ptr may touch to Names, the bound
+// allocation of a pointer variable as RS_BOUND_ALLOCATION_PREFIX and its
+// name. The constants don't count, nor do the locals and the parameters
+// (those of a helper are accounted for by its callers). Returns false if Ptr
+// may point to other memory, e.g., memory the runtime returned.
+static bool GetAccessedGlobals(llvm::Value *Ptr, unsigned Depth,
+                               std::set<std::string> *Names) {
+  llvm::SmallVector<llvm::Value*, 4> Objects;
+  llvm::GetUnderlyingObjects(Ptr, Objects);
+  bool Known = true;
+  for (unsigned i = 0, e = Objects.size(); i != e; i++) {
+    llvm::Value *O = Objects[i];
+    if (llvm::isa<llvm::AllocaInst>(O) || llvm::isa<llvm::Argument>(O) ||
+        llvm::isa<llvm::ConstantPointerNull>(O) ||
+        llvm::isa<llvm::UndefValue>(O))
+      continue;
+
+    if (llvm::GlobalVariable *GV = llvm::dyn_cast<llvm::GlobalVariable>(O)) {
+      if (!GV->isConstant())
+        Names->insert(GV->getName());
+      continue;
+    }
+
+    // A pointer loaded from a variable, or from a local holding a copy of it
+    if (llvm::LoadInst *LI = llvm::dyn_cast<llvm::LoadInst>(O)) {
+      llvm::Value *From = llvm::GetUnderlyingObject(LI->getPointerOperand());
+      llvm::GlobalVariable *GV = llvm::dyn_cast<llvm::GlobalVariable>(From);
+      if ((GV != NULL) && !GV->isConstant()) {
+        Names->insert(RS_BOUND_ALLOCATION_PREFIX + GV->getName().str());
+        continue;
+      }
+      llvm::AllocaInst *A = llvm::dyn_cast<llvm::AllocaInst>(From);
+      if ((A != NULL) && (A == LI->getPointerOperand()) &&
+          (Depth < MaxStoredPointerDepth) &&
+          GetStoredPointers(A, Depth + 1, Names))
+        continue;
+    }
+
+    Known = false;
+  }
+  return Known;
+}
+
+// Find the globals F and the functions it calls access. The calls into the
+// runtime (and through function pointers) which may access memory leave S
+// incomplete, for the allocations behind the rs_allocation handles.
+static void GetAccessSet(llvm::Function *F, RSContext::AccessSet *S) {
+  S->Reads.clear();
+  S->Writes.clear();
+  S->Complete = true;
+
+  llvm::SmallPtrSet<llvm::Function*, 16> Visited;
+  std::vector<llvm::Function*> Worklist;
+  Visited.insert(F);
+  Worklist.push_back(F);
+  while (!Worklist.empty()) {
+    llvm::Function *Current = Worklist.back();
+    Worklist.pop_back();
+    for (llvm::inst_iterator I = llvm::inst_begin(Current),
+             E = llvm::inst_end(Current);
+         I != E;
+         I++) {
+      llvm::Instruction *Inst = &*I;
+      bool Known = true;
+      if (llvm::LoadInst *LI = llvm::dyn_cast<llvm::LoadInst>(Inst)) {
+        Known = GetAccessedGlobals(LI->getPointerOperand(), 0, &S->Reads);
+      } else if (llvm::StoreInst *SI = llvm::dyn_cast<llvm::StoreInst>(Inst)) {
+        Known = GetAccessedGlobals(SI->getPointerOperand(), 0, &S->Writes);
+        // The address of a global stored out of the locals is lost track of.
+        if (SI->getValueOperand()->getType()->isPointerTy() &&
+            !llvm::isa<llvm::AllocaInst>(SI->getPointerOperand())) {
+          std::set<std::string> Escaped;
+          if (!GetAccessedGlobals(SI->getValueOperand(), 0, &Escaped) ||
+              !Escaped.empty())
+            Known = false;
+        }
+      } else if (llvm::isa<llvm::AtomicRMWInst>(Inst) ||
+                 llvm::isa<llvm::AtomicCmpXchgInst>(Inst)) {
+        llvm::Value *Ptr = Inst->getOperand(0);
+        Known = GetAccessedGlobals(Ptr, 0, &S->Reads) &&
+                GetAccessedGlobals(Ptr, 0, &S->Writes);
+      } else if (llvm::isa<llvm::DbgInfoIntrinsic>(Inst)) {
+        continue;
+      } else if (llvm::MemTransferInst *MTI =
+                     llvm::dyn_cast<llvm::MemTransferInst>(Inst)) {
+        Known = GetAccessedGlobals(MTI->getRawSource(), 0, &S->Reads) &&
+                GetAccessedGlobals(MTI->getRawDest(), 0, &S->Writes);
+      } else if (llvm::MemSetInst *MSI =
+                     llvm::dyn_cast<llvm::MemSetInst>(Inst)) {
+        Known = GetAccessedGlobals(MSI->getRawDest(), 0, &S->Writes);
+      } else if (llvm::isa<llvm::CallInst>(Inst) ||
+                 llvm::isa<llvm::InvokeInst>(Inst)) {
+        llvm::CallSite CS(Inst);
+        if (CS.doesNotAccessMemory())
+          continue;
+        llvm::Function *Callee = CS.getCalledFunction();
+        if ((Callee == NULL) ||
+            (Callee->isDeclaration() && !Callee->isIntrinsic())) {
+          Known = false;
+        } else {
+          // What the callee accesses through its parameters
+          for (llvm::CallSite::arg_iterator AI = CS.arg_begin(),
+                   AE = CS.arg_end();
+               AI != AE;
+               AI++) {
+            if (!(*AI)->getType()->isPointerTy())
+              continue;
+            if (!GetAccessedGlobals(*AI, 0, &S->Reads) ||
+                (!CS.onlyReadsMemory() &&
+                 !GetAccessedGlobals(*AI, 0, &S->Writes)))
+              Known = false;
+          }
+          if (!Callee->isDeclaration() && Visited.insert(Callee))
+            Worklist.push_back(Callee);
+        }
+      } else if (Inst->mayReadOrWriteMemory()) {
+        Known = false;
+      }
+      if (!Known)
+        S->Complete = false;
+    }
+  }
+  return;
+}
+
+void RSBackend::dumpExportAccessInfo(llvm::Module *M) {
+  std::vector<std::string> Names;
+  for (RSContext::const_export_foreach_iterator
+           I = mContext->export_foreach_begin(),
+           E = mContext->export_foreach_end();
+       I != E;
+       I++) {
+    if (!(*I)->isDummyRoot())
+      Names.push_back((*I)->getName());
+  }
+  for (RSContext::const_export_func_iterator
+           I = mContext->export_funcs_begin(),
+           E = mContext->export_funcs_end();
+       I != E;
+       I++) {
+    Names.push_back((*I)->getName());
+  }
+
+  llvm::NamedMDNode *AccessMetadata =
+      M->getOrInsertNamedMetadata(RS_EXPORT_ACCESS_MN);
+  for (unsigned i = 0, e = Names.size(); i != e; i++) {
+    llvm::Function *F = M->getFunction(Names[i]);
+    if (F == NULL)
+      continue;
+
+    RSContext::AccessSet S;
+    GetAccessSet(F, &S);
+    mContext->setAccessSet(Names[i], S);
+
+    llvm::SmallVector<llvm::Value*, 8> Reads, Writes;
+    for (std::set<std::string>::const_iterator I = S.Reads.begin(),
+             E = S.Reads.end();
+         I != E;
+         I++)
+      Reads.push_back(llvm::MDString::get(mLLVMContext, *I));
+    for (std::set<std::string>::const_iterator I = S.Writes.begin(),
+             E = S.Writes.end();
+         I != E;
+         I++)
+      Writes.push_back(llvm::MDString::get(mLLVMContext, *I));
+
+    llvm::Value *Info[] = {
+      llvm::MDString::get(mLLVMContext, Names[i]),
+      llvm::MDString::get(mLLVMContext, S.Complete ? "1" : "0"),
+      llvm::MDNode::get(mLLVMContext, Reads),
+      llvm::MDNode::get(mLLVMContext, Writes)
+    };
+    AccessMetadata->addOperand(llvm::MDNode::get(mLLVMContext, Info));
+  }
+  return;
+}
+
+// The variables are grouped by the cache line of the CPUs the scripts run on.
+static const unsigned CacheLineSize = 64;
+
+void RSBackend::layoutHotGlobals(llvm::Module *M) {
+  // The variables read by the kernels or the helpers they call
+  llvm::SmallPtrSet<llvm::GlobalVariable*, 16> Hot;
+  llvm::SmallPtrSet<llvm::Function*, 16> Visited;
+  std::vector<llvm::Function*> Worklist;
+  for (RSContext::const_export_foreach_iterator
+           I = mContext->export_foreach_begin(),
+           E = mContext->export_foreach_end();
+       I != E;
+       I++) {
+    llvm::Function *F = M->getFunction((*I)->getName());
+    if ((F != NULL) && !(*I)->isDummyRoot() && Visited.insert(F))
+      Worklist.push_back(F);
+  }
+  while (!Worklist.empty()) {
+    llvm::Function *F = Worklist.back();
+    Worklist.pop_back();
+    for (llvm::inst_iterator I = llvm::inst_begin(F), E = llvm::inst_end(F);
+         I != E;
+         I++) {
+      if (llvm::LoadInst *LI = llvm::dyn_cast<llvm::LoadInst>(&*I)) {
+        llvm::GlobalVariable *GV = llvm::dyn_cast<llvm::GlobalVariable>(
+            llvm::GetUnderlyingObject(LI->getPointerOperand()));
+        if (GV != NULL)
+          Hot.insert(GV);
+      } else if (llvm::CallInst *CI = llvm::dyn_cast<llvm::CallInst>(&*I)) {
+        llvm::Function *Callee = CI->getCalledFunction();
+        if ((Callee != NULL) && !Callee->isDeclaration() &&
+            Visited.insert(Callee))
+          Worklist.push_back(Callee);
+      }
+    }
+  }
+
+  llvm::Module::GlobalListType &Globals = M->getGlobalList();
+  std::vector<llvm::GlobalVariable*> Front, Back;
+  for (llvm::Module::global_iterator I = M->global_begin(),
+           E = M->global_end();
+       I != E;
+       I++) {
+    if (I->isDeclaration())
+      continue;
+    llvm::Type *T = I->getType()->getElementType();
+    if (T->isIntegerTy() || T->isFloatingPointTy() || T->isVectorTy()) {
+      if (Hot.count(I))
+        Front.push_back(I);
+    } else if (T->isArrayTy() &&
+               (mContext->getDataLayout()->getTypeAllocSize(T) >
+                CacheLineSize)) {
+      Back.push_back(I);
+    }
+  }
+  if (Front.empty() && Back.empty())
+    return;
+
+  // The initialized and the zero-initialized variables are laid out in
+  // separate sections (.data and .bss), each block of them starts a cache
+  // line. A common variable (e.g., "float gain;") would be placed by the
+  // linker, it's defined here instead (which is the same in a single unit).
+  bool Aligned[2] = { false, false };
+  for (unsigned i = Front.size(); i != 0; i--) {
+    llvm::GlobalVariable *GV = Front[i - 1];
+    if (GV->hasCommonLinkage())
+      GV->setLinkage(llvm::GlobalValue::ExternalLinkage);
+    Globals.splice(Globals.begin(), Globals, GV);
+  }
+  for (unsigned i = 0, e = Front.size(); i != e; i++) {
+    llvm::GlobalVariable *GV = Front[i];
+    bool &IsAligned = Aligned[GV->getInitializer()->isNullValue()];
+    if (!IsAligned)
+      GV->setAlignment(std::max(GV->getAlignment(), CacheLineSize));
+    IsAligned = true;
+  }
+  for (unsigned i = 0, e = Back.size(); i != e; i++)
+    Globals.splice(Globals.end(), Globals, Back[i]);
+
+  return;
+}
+
 void RSBackend::HandleTranslationUnitPost(llvm::Module *M) {
   if (!mContext->processExport()) {
     return;
   }
 
-  if (mContext->hasExportVar())
+  // The metadata is what makes the LLVM types, the allocation sizes and the
+  // spec types of all the exports be built. Without a module (to write), only
+  // the reflection asks for them, and only for what it reflects.
+  if (M == NULL)
+    return;
+
+  // Before the kernels are fused, instrumented or cloned
+  if (!mContext->getStrippedCalls().empty())
+    stripCalls(M);
+
+  // The fused kernels are then handled like all the others.
+  if (mContext->hasFusedKernels())
+    genFusedKernels(M);
+
+  // After the kernels are fused, such that a fused kernel counts once.
+  if (mContext->hasInstrumentKernels())
+    instrumentKernels(M);
+
+  if (mContext->hasExportForEach())
+    annotateKernelParams(M);
+
+  if (mContext->hasKernelPrecisions())
+    applyKernelPrecisions(M);
+
+  // After the precisions are applied, an unused kernel keeps its own.
+  if (!mContext->getUnusedExports().empty())
+    internalizeUnusedExports(M);
+
+  if (mContext->hasCompactMetadata())
+    mMetadataEncoder = CreateRSMetadataEncoder(M);
+
+  if (mContext->hasExportVar() ||
+      (M->getNamedGlobal(RS_PROFILE_COUNTERS_VAR_NAME) != NULL))
     dumpExportVarInfo(M);
 
   if (mContext->hasExportFunc())
     dumpExportFunctionInfo(M);
 
-  if (mContext->hasExportForEach())
+  if (mContext->hasVarBatch())
+    dumpVarBatchInfo(M);
+
+  if (mContext->hasExportForEach()) {
     dumpExportForEachInfo(M);
+    if (mContext->hasSpecializedVars())
+      dumpSpecializedForEachInfo(M);
+    if (mContext->hasWidenKernels())
+      dumpWidenedForEachInfo(M);
+  }
+
+  if (mContext->hasExportReduce())
+    dumpExportReduceInfo(M);
 
   if (mContext->hasExportType())
     dumpExportTypeInfo(M);
 
+  // Of the kernels as written, their variants access no more than they do.
+  if (mContext->hasExportAccessSets() &&
+      (mContext->hasExportForEach() || mContext->hasExportFunc()))
+    dumpExportAccessInfo(M);
+
+  // After all the kernels and their variants are generated
+  if (mContext->hasLayoutHotGlobals() && mContext->hasExportForEach())
+    layoutHotGlobals(M);
+
+  if (mMetadataEncoder != NULL) {
+    checkMetadataEncoding(FinalizeRSMetadataEncoder(mMetadataEncoder),
+                          M->getModuleIdentifier());
+    mMetadataEncoder = NULL;
+  }
+
+  return;
+}
+
+namespace {
+
+// The cost of a kernel, from the instructions of its (optimized) function
+struct KernelCost {
+  unsigned FP;
+  unsigned Int;
+  unsigned Memory;
+  unsigned Calls;
+  unsigned Other;
+  // Out of the calls, those into the RS runtime
+  unsigned RuntimeCalls;
+  // Size of the fixed size allocas
+  uint64_t StackBytes;
+  unsigned Loops;
+  unsigned VectorizedLoops;
+};
+
+}  // namespace
+
+// Whether F is a function of the RS runtime (rs*(), mangled or not)
+static bool IsRSRuntimeFunction(const llvm::Function *F) {
+  if (!F->isDeclaration() || F->isIntrinsic())
+    return false;
+  llvm::StringRef Name = F->getName();
+  if (Name.startswith("_Z")) {
+    Name = Name.drop_front(2);
+    while (!Name.empty() && isdigit(Name[0]))
+      Name = Name.drop_front(1);
+  }
+  return Name.startswith("rs");
+}
+
+static void CountLoops(const llvm::Loop *L, KernelCost *Cost) {
+  Cost->Loops++;
+  // The loop vectorizer names the body it creates.
+  for (llvm::Loop::block_iterator I = L->block_begin(), E = L->block_end();
+       I != E;
+       I++) {
+    if ((*I)->getName().startswith("vector.body")) {
+      Cost->VectorizedLoops++;
+      break;
+    }
+  }
+  for (llvm::Loop::iterator I = L->begin(), E = L->end(); I != E; I++)
+    CountLoops(*I, Cost);
+  return;
+}
+
+static void GetKernelCost(llvm::Function *F, const llvm::DataLayout &Layout,
+                          KernelCost *Cost) {
+  ::memset(Cost, 0, sizeof(*Cost));
+
+  for (llvm::Function::iterator BI = F->begin(), BE = F->end();
+       BI != BE;
+       BI++) {
+    for (llvm::BasicBlock::iterator II = BI->begin(), IE = BI->end();
+         II != IE;
+         II++) {
+      llvm::Instruction *I = II;
+      if (llvm::isa<llvm::DbgInfoIntrinsic>(I))
+        continue;
+
+      if (llvm::CallInst *CI = llvm::dyn_cast<llvm::CallInst>(I)) {
+        Cost->Calls++;
+        llvm::Function *Callee = CI->getCalledFunction();
+        if ((Callee != NULL) && IsRSRuntimeFunction(Callee))
+          Cost->RuntimeCalls++;
+      } else if (llvm::AllocaInst *AI = llvm::dyn_cast<llvm::AllocaInst>(I)) {
+        Cost->Memory++;
+        if (llvm::ConstantInt *N =
+                llvm::dyn_cast<llvm::ConstantInt>(AI->getArraySize()))
+          Cost->StackBytes +=
+              Layout.getTypeAllocSize(AI->getAllocatedType()) *
+              N->getZExtValue();
+      } else if (llvm::isa<llvm::LoadInst>(I) ||
+                 llvm::isa<llvm::StoreInst>(I) ||
+                 llvm::isa<llvm::GetElementPtrInst>(I) ||
+                 llvm::isa<llvm::AtomicRMWInst>(I) ||
+                 llvm::isa<llvm::AtomicCmpXchgInst>(I)) {
+        Cost->Memory++;
+      } else if (llvm::isa<llvm::FCmpInst>(I) ||
+                 (llvm::isa<llvm::BinaryOperator>(I) &&
+                  I->getType()->isFPOrFPVectorTy()) ||
+                 llvm::isa<llvm::FPTruncInst>(I) ||
+                 llvm::isa<llvm::FPExtInst>(I) ||
+                 llvm::isa<llvm::FPToUIInst>(I) ||
+                 llvm::isa<llvm::FPToSIInst>(I) ||
+                 llvm::isa<llvm::UIToFPInst>(I) ||
+                 llvm::isa<llvm::SIToFPInst>(I)) {
+        Cost->FP++;
+      } else if (llvm::isa<llvm::ICmpInst>(I) ||
+                 llvm::isa<llvm::BinaryOperator>(I) ||
+                 llvm::isa<llvm::TruncInst>(I) ||
+                 llvm::isa<llvm::ZExtInst>(I) ||
+                 llvm::isa<llvm::SExtInst>(I)) {
+        Cost->Int++;
+      } else {
+        Cost->Other++;
+      }
+    }
+  }
+
+  // Outside of a pass manager, the analyses are run by hand.
+  llvm::DominatorTree DT;
+  DT.runOnFunction(*F);
+  llvm::LoopInfoBase<llvm::BasicBlock, llvm::Loop> LI;
+  LI.Analyze(DT.getBase());
+  for (llvm::LoopInfoBase<llvm::BasicBlock, llvm::Loop>::iterator
+           I = LI.begin(), E = LI.end();
+       I != E;
+       I++)
+    CountLoops(*I, Cost);
+  return;
+}
+
+void RSBackend::WriteKernelReport(llvm::Module *M, llvm::raw_ostream &OS) {
+  llvm::DataLayout Layout(M);
+
+  OS << "{\n"
+     << "  \"kernels\": [";
+  bool First = true;
+  for (RSContext::const_export_foreach_iterator
+           I = mContext->export_foreach_begin(),
+           E = mContext->export_foreach_end();
+       I != E;
+       I++) {
+    const RSExportForEach *EFE = *I;
+    llvm::Function *F = M->getFunction(EFE->getName());
+    if (EFE->isDummyRoot() || (F == NULL) || F->isDeclaration())
+      continue;
+
+    KernelCost Cost;
+    GetKernelCost(F, Layout, &Cost);
+    unsigned Total =
+        Cost.FP + Cost.Int + Cost.Memory + Cost.Calls + Cost.Other;
+
+    OS << (First ? "\n" : ",\n")
+       << "    {\n"
+       << "      \"name\": \"" << EFE->getName() << "\",\n"
+       << "      \"instructions\": " << Total << ",\n"
+       << "      \"fp\": " << Cost.FP << ",\n"
+       << "      \"int\": " << Cost.Int << ",\n"
+       << "      \"memory\": " << Cost.Memory << ",\n"
+       << "      \"calls\": " << Cost.Calls << ",\n"
+       << "      \"other\": " << Cost.Other << ",\n"
+       << "      \"rs_runtime_calls\": " << Cost.RuntimeCalls << ",\n"
+       << "      \"stack_bytes\": " << Cost.StackBytes << ",\n"
+       << "      \"loops\": " << Cost.Loops << ",\n"
+       << "      \"vectorized_loops\": " << Cost.VectorizedLoops << ",\n"
+       << "      \"uses_x\": " << (EFE->hasX() ? "true" : "false") << ",\n"
+       << "      \"uses_y\": " << (EFE->hasY() ? "true" : "false") << "\n"
+       << "    }";
+    First = false;
+  }
+  OS << (First ? "]\n" : "\n  ]\n")
+     << "}\n";
   return;
 }
 
@@ -20,6 +20,8 @@
 #include "slang_backend.h"
 #include "slang_pragma_recorder.h"
 #include "slang_rs_check_ast.h"
+#include "slang_rs_element_at.h"
+#include "slang_rs_metadata_spec.h"
 #include "slang_rs_object_ref_count.h"
 
 namespace llvm {
@@ -58,16 +60,65 @@ class RSBackend : public Backend {
   llvm::NamedMDNode *mExportElementMetadata;
   llvm::NamedMDNode *mRSObjectSlotsMetadata;
 
+  // Encodes the export info in the compact format instead (-metadata-format
+  // compact), NULL for the verbose one
+  RSMetadataEncoder *mMetadataEncoder;
+
   RSObjectRefCount mRefCount;
 
   RSCheckAST mASTChecker;
 
+  RSElementAtLowering mElementAtLowering;
+
   void AnnotateFunction(clang::FunctionDecl *FD);
+  // Generate code for the helpers mRefCount created
+  void HandleRefCountHelpers();
+
+  // Record an exported function or forEach kernel in the metadata of the
+  // selected format.
+  void addExportFuncInfo(llvm::Module *M, const std::string &Name);
+  void addExportForEachInfo(llvm::Module *M, const std::string &Name,
+                            unsigned Signature);
+  // Report the failure of the compact encoder (Res != 0) for Name.
+  void checkMetadataEncoding(int Res, const std::string &Name);
 
   void dumpExportVarInfo(llvm::Module *M);
   void dumpExportFunctionInfo(llvm::Module *M);
+  // Synthesize RS_VAR_BATCH_FUNC_NAME (after all other exported functions)
+  void dumpVarBatchInfo(llvm::Module *M);
+  // Remove the calls to RSContext::getStrippedCalls().
+  void stripCalls(llvm::Module *M);
+  // Synthesize the functions of the fused kernels (see #pragma rs fuse), each
+  // calling the ones of its kernels in turn with the calls inlined.
+  void genFusedKernels(llvm::Module *M);
+  // Synthesize RS_PROFILE_COUNTERS_VAR_NAME and count the calls and the time
+  // of the functions of RSContext::getProfiledFunctions() into it.
+  void instrumentKernels(llvm::Module *M);
+  // Mark the in/out pointers of the (old-style) kernels noalias, the
+  // allocations of a launch being distinct, and in readonly where the
+  // target keeps the attribute.
+  void annotateKernelParams(llvm::Module *M);
+  // Set the fast-math flags of the kernels with a precision of their own
+  // (see RSContext::KernelPrecision) and of the helpers only they call.
+  void applyKernelPrecisions(llvm::Module *M);
+  // Internalize the definitions of RSContext::getUnusedExports(), such that
+  // the optimizations drop or specialize them.
+  void internalizeUnusedExports(llvm::Module *M);
   void dumpExportForEachInfo(llvm::Module *M);
+  // Clone the kernels into variants with the frozen variables (see #pragma rs
+  // specialize) folded to their values, in the slots after the kernels.
+  void dumpSpecializedForEachInfo(llvm::Module *M);
+  // Emit the widened variants of the elementwise kernels (-widen-kernels).
+  void dumpWidenedForEachInfo(llvm::Module *M);
+  void dumpExportReduceInfo(llvm::Module *M);
   void dumpExportTypeInfo(llvm::Module *M);
+  // Find the globals each kernel and invokable reads and writes, for the
+  // reflection and RS_EXPORT_ACCESS_MN (-export-access-sets).
+  void dumpExportAccessInfo(llvm::Module *M);
+  // Move the scalar and vector variables the kernels read to the front of the
+  // globals, aligned to a cache line, and the large arrays to the back
+  // (-layout-hot-globals).
+  void layoutHotGlobals(llvm::Module *M);
 
  protected:
   virtual unsigned int getTargetAPI() const {
@@ -80,17 +131,27 @@ class RSBackend : public Backend {
 
   virtual void HandleTranslationUnitPost(llvm::Module *M);
 
+  // The instructions of each forEach kernel by kind, its calls into the RS
+  // runtime, its stack, its loops and the coordinates it takes.
+  virtual void WriteKernelReport(llvm::Module *M, llvm::raw_ostream &OS);
+
  public:
   RSBackend(RSContext *Context,
             clang::DiagnosticsEngine *DiagEngine,
+            llvm::LLVMContext &LLVMContext,
             const clang::CodeGenOptions &CodeGenOpts,
             const clang::TargetOptions &TargetOpts,
             PragmaList *Pragmas,
-            llvm::raw_ostream *OS,
+            llvm::raw_fd_ostream *OS,
+            std::string *OutputBuffer,
             Slang::OutputType OT,
+            const Slang::ExtraOutputList *ExtraOutputs,
+            llvm::StringRef RuntimeLibrary,
+            const ExecutionProfile *Profile,
             clang::SourceManager &SourceMgr,
             bool AllowRSPrefix,
-            bool IsFilterscript);
+            bool IsFilterscript,
+            TimeReport *Report);
 
   virtual ~RSBackend();
 };
@@ -18,6 +18,7 @@
 
 #include "slang_assert.h"
 #include "slang_rs.h"
+#include "slang_rs_element_at.h"
 #include "slang_rs_export_foreach.h"
 #include "slang_rs_export_type.h"
 
@@ -44,6 +45,13 @@ void RSCheckAST::WarnOnSetElementAt(clang::CallExpr *E) {
     return;
   }
 
+  // No need to warn if the call is lowered to the typed one anyway (see
+  // RSBackend::AnnotateFunction()).
+  if ((Context->getTargetAPI() >= SLANG_JB_MR2_TARGET_API) &&
+      RSElementAtLowering(C).getTypedSetElementAt(E)) {
+    return;
+  }
+
   clang::Expr *Expr;
   clang::ImplicitCastExpr *ImplCast;
   Expr = E->getArg(1);
@@ -270,22 +278,28 @@ void RSCheckAST::VisitExpr(clang::Expr *E) {
 }
 
 
+void RSCheckAST::ValidateDecl(clang::Decl *D) {
+  if (SlangRS::IsLocInRSHeaderFile(D->getLocStart(), mSM)) {
+    return;
+  }
+
+  if (clang::VarDecl *VD = llvm::dyn_cast<clang::VarDecl>(D)) {
+    ValidateVarDecl(VD);
+  } else if (clang::FunctionDecl *FD = llvm::dyn_cast<clang::FunctionDecl>(D)) {
+    ValidateFunctionDecl(FD);
+  } else if (clang::Stmt *Body = D->getBody()) {
+    Visit(Body);
+  }
+}
+
+
 bool RSCheckAST::Validate() {
   clang::TranslationUnitDecl *TUDecl = C.getTranslationUnitDecl();
   for (clang::DeclContext::decl_iterator DI = TUDecl->decls_begin(),
           DE = TUDecl->decls_end();
        DI != DE;
        DI++) {
-    if (!SlangRS::IsLocInRSHeaderFile(DI->getLocStart(), mSM)) {
-      if (clang::VarDecl *VD = llvm::dyn_cast<clang::VarDecl>(*DI)) {
-        ValidateVarDecl(VD);
-      } else if (clang::FunctionDecl *FD =
-            llvm::dyn_cast<clang::FunctionDecl>(*DI)) {
-        ValidateFunctionDecl(FD);
-      } else if (clang::Stmt *Body = (*DI)->getBody()) {
-        Visit(Body);
-      }
-    }
+    ValidateDecl(*DI);
   }
 
   return mValid;
@@ -72,7 +72,14 @@ class RSCheckAST : public clang::StmtVisitor<RSCheckAST> {
 
   void ValidateVarDecl(clang::VarDecl *VD);
 
+  // Validate a top-level declaration of the translation unit (one
+  // not coming from an RS header).
+  void ValidateDecl(clang::Decl *D);
+
+  // Validate the whole translation unit.
   bool Validate();
+
+  bool isValid() const { return mValid; }
 };
 
 }  // namespace slang
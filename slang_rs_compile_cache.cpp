@@ -0,0 +1,196 @@
+/*
+ * Copyright 2013, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "slang_rs_compile_cache.h"
+
+#include <sys/stat.h>
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/StringRef.h"
+
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/system_error.h"
+
+#include "slang_utils.h"
+
+namespace slang {
+
+// The manifest is laid out as
+//
+//   <NumRecordTypes> <NumFiles> <NumDepTargets> <NumDependencies>\n
+//   <file 0>\n
+//   ...
+//   <file NumFiles - 1>\n
+//   <dependency target 0>\n
+//   ...
+//   <dependency target NumDepTargets - 1>\n
+//   <hash of dependency 0> <dependency 0>\n
+//   ...
+//   <hash of dependency NumDependencies - 1> <dependency NumDependencies - 1>\n
+//   <diagnostics>
+
+std::string RSCompileCache::getPath(uint64_t Key,
+                                    const std::string &Suffix) const {
+  llvm::SmallString<256> Path(mDir);
+  llvm::sys::path::append(Path, llvm::utohexstr(Key) + "." + Suffix);
+  return Path.str();
+}
+
+// Read the next N lines of *Rest into *Lines.
+static bool ReadLines(llvm::StringRef *Rest, unsigned N,
+                      std::vector<std::string> *Lines) {
+  Lines->clear();
+  for (unsigned i = 0; i < N; i++) {
+    std::pair<llvm::StringRef, llvm::StringRef> Line = Rest->split('\n');
+    if (Line.first.empty())
+      return false;
+    Lines->push_back(Line.first);
+    *Rest = Line.second;
+  }
+  return true;
+}
+
+bool RSCompileCache::lookup(uint64_t Key, Entry *E) const {
+  llvm::OwningPtr<llvm::MemoryBuffer> MB;
+  if (llvm::MemoryBuffer::getFile(getPath(Key, "manifest"), MB) !=
+      llvm::errc::success)
+    return false;
+
+  std::pair<llvm::StringRef, llvm::StringRef> Line =
+      MB->getBuffer().split('\n');
+  llvm::SmallVector<llvm::StringRef, 4> Counts;
+  llvm::SplitString(Line.first, Counts);
+  unsigned NumFiles, NumDepTargets, NumDependencies;
+  if ((Counts.size() != 4) ||
+      Counts[0].getAsInteger(10, E->NumRecordTypes) ||
+      Counts[1].getAsInteger(10, NumFiles) ||
+      Counts[2].getAsInteger(10, NumDepTargets) ||
+      Counts[3].getAsInteger(10, NumDependencies))
+    return false;
+
+  llvm::StringRef Rest = Line.second;
+  std::vector<std::string> Dependencies;
+  if (!ReadLines(&Rest, NumFiles, &E->Files) ||
+      !ReadLines(&Rest, NumDepTargets, &E->DepTargets) ||
+      !ReadLines(&Rest, NumDependencies, &Dependencies))
+    return false;
+
+  // Reading the dependencies is much cheaper than preprocessing the input
+  // again, and as good unless a new header shadows one of them.
+  E->Dependencies.clear();
+  for (unsigned i = 0; i < NumDependencies; i++) {
+    std::pair<llvm::StringRef, llvm::StringRef> Dependency =
+        llvm::StringRef(Dependencies[i]).split(' ');
+    uint64_t Expected;
+    uint64_t Hash = SlangUtils::InitialHash;
+    if (Dependency.first.getAsInteger(16, Expected) ||
+        !SlangUtils::UpdateHashWithFile(&Hash, Dependency.second) ||
+        (Hash != Expected))
+      return false;
+    E->Dependencies.push_back(Dependency.second);
+  }
+  E->Diagnostics = Rest;
+
+  return true;
+}
+
+bool RSCompileCache::restore(uint64_t Key, const Entry &E,
+                             bool WriteIfChanged, std::string *Error) const {
+  for (unsigned i = 0, e = E.Files.size(); i != e; i++) {
+    const std::string &File = E.Files[i];
+
+    llvm::OwningPtr<llvm::MemoryBuffer> MB;
+    llvm::error_code EC =
+        llvm::MemoryBuffer::getFile(getPath(Key, llvm::utostr(i)), MB);
+    if (EC != llvm::errc::success) {
+      Error->assign(EC.message());
+      return false;
+    }
+
+    // The reflection creates the package directories on the fly.
+    llvm::StringRef Dir = llvm::sys::path::parent_path(File);
+    if (!Dir.empty() && !SlangUtils::CreateDirectoryWithParents(Dir, Error))
+      return false;
+
+    if (WriteIfChanged) {
+      if (!SlangUtils::WriteFileIfChanged(File, MB->getBuffer(), Error))
+        return false;
+    } else if (!SlangUtils::WriteFileAtomically(File, MB->getBuffer(), Error)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool RSCompileCache::store(uint64_t Key, const Entry &E, time_t CompileStart,
+                           std::string *Error) const {
+  std::stringstream Dependencies;
+  for (unsigned i = 0, e = E.Dependencies.size(); i != e; i++) {
+    const std::string &File = E.Dependencies[i];
+    struct stat Stat;
+    uint64_t Hash = SlangUtils::InitialHash;
+    if ((::stat(File.c_str(), &Stat) != 0) ||
+        !SlangUtils::UpdateHashWithFile(&Hash, File)) {
+      Error->assign("can't read " + File);
+      return false;
+    }
+    if (Stat.st_mtime >= CompileStart) {
+      Error->assign(File + " was modified during the compilation");
+      return false;
+    }
+    Dependencies << llvm::utohexstr(Hash) << ' ' << File << '\n';
+  }
+
+  if (!SlangUtils::CreateDirectoryWithParents(mDir, Error))
+    return false;
+
+  std::stringstream Manifest;
+  Manifest << E.NumRecordTypes << ' ' << E.Files.size() << ' '
+           << E.DepTargets.size() << ' ' << E.Dependencies.size() << '\n';
+
+  for (unsigned i = 0, e = E.Files.size(); i != e; i++) {
+    const std::string &File = E.Files[i];
+
+    llvm::OwningPtr<llvm::MemoryBuffer> MB;
+    llvm::error_code EC = llvm::MemoryBuffer::getFile(File, MB);
+    if (EC != llvm::errc::success) {
+      Error->assign(EC.message());
+      return false;
+    }
+
+    if (!SlangUtils::WriteFileAtomically(getPath(Key, llvm::utostr(i)),
+                                         MB->getBuffer(), Error))
+      return false;
+
+    Manifest << File << '\n';
+  }
+  for (unsigned i = 0, e = E.DepTargets.size(); i != e; i++)
+    Manifest << E.DepTargets[i] << '\n';
+  Manifest << Dependencies.str() << E.Diagnostics;
+
+  return SlangUtils::WriteFileAtomically(getPath(Key, "manifest"),
+                                         Manifest.str(), Error);
+}
+
+}  // namespace slang
@@ -0,0 +1,84 @@
+/*
+ * Copyright 2013, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _FRAMEWORKS_COMPILE_SLANG_SLANG_RS_COMPILE_CACHE_H_  // NOLINT
+#define _FRAMEWORKS_COMPILE_SLANG_SLANG_RS_COMPILE_CACHE_H_
+
+#include <stdint.h>
+#include <time.h>
+
+#include <string>
+#include <vector>
+
+namespace slang {
+
+// On-disk cache of the results of compiling an input file. An entry is keyed
+// by a hash of the options and the input the results depend on (see
+// SlangRS::getCacheKey()) and consists of
+//
+//   <Dir>/<Key>.manifest  - the description of the entry below
+//   <Dir>/<Key>.<N>       - the content of the N-th output file
+//
+// The manifest is written last, so an entry is never seen half-stored. It
+// also has the hash of each file the compilation read (the input and the
+// headers), an entry only holds as long as these keep their content.
+class RSCompileCache {
+ public:
+  struct Entry {
+    // The files produced by the compilation (the bitcode and the reflected
+    // sources), the dependency file aside
+    std::vector<std::string> Files;
+    // The files the input depended on, in the order of the dependency file
+    std::vector<std::string> Dependencies;
+    // The generated files which are targets of the dependency file along with
+    // the bitcode (see Slang::getGeneratedFileNames())
+    std::vector<std::string> DepTargets;
+    // The diagnostics (i.e., warnings) the compilation reported
+    std::string Diagnostics;
+    // Number of the user-defined record types exported by the input file
+    unsigned NumRecordTypes;
+
+    Entry() : NumRecordTypes(0) {}
+  };
+
+ private:
+  std::string mDir;
+
+  std::string getPath(uint64_t Key, const std::string &Suffix) const;
+
+ public:
+  explicit RSCompileCache(const std::string &Dir) : mDir(Dir) {}
+
+  // Read the manifest of the entry of Key into *E. Returns false if there's
+  // no such entry, or if one of its dependencies changed since it was stored.
+  bool lookup(uint64_t Key, Entry *E) const;
+
+  // Copy the files of the entry E (as returned by lookup()) into place. With
+  // WriteIfChanged, the files which already have the cached content are left
+  // alone.
+  bool restore(uint64_t Key, const Entry &E, bool WriteIfChanged,
+               std::string *Error) const;
+
+  // Make an entry of Key from E and the current content of its files and
+  // dependencies. No entry is made if a dependency was modified at or after
+  // CompileStart, the compilation may have read it before the change.
+  bool store(uint64_t Key, const Entry &E, time_t CompileStart,
+             std::string *Error) const;
+};
+
+}  // namespace slang
+
+#endif  // _FRAMEWORKS_COMPILE_SLANG_SLANG_RS_COMPILE_CACHE_H_  NOLINT
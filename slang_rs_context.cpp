@@ -16,7 +16,9 @@
 
 #include "slang_rs_context.h"
 
+#include <algorithm>
 #include <string>
+#include <vector>
 
 #include "clang/AST/ASTContext.h"
 #include "clang/AST/Decl.h"
@@ -27,13 +29,21 @@
 #include "clang/Basic/Linkage.h"
 #include "clang/Basic/TargetInfo.h"
 
+#include "llvm/ADT/APFloat.h"
+#include "llvm/ADT/APInt.h"
+
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/DataLayout.h"
 
+#include "llvm/Support/Allocator.h"
+#include "llvm/Support/Atomic.h"
+#include "llvm/Support/MathExtras.h"
+
 #include "slang.h"
 #include "slang_assert.h"
 #include "slang_rs_export_foreach.h"
 #include "slang_rs_export_func.h"
+#include "slang_rs_export_reduce.h"
 #include "slang_rs_export_type.h"
 #include "slang_rs_export_var.h"
 #include "slang_rs_exportable.h"
@@ -45,6 +55,7 @@ namespace slang {
 RSContext::RSContext(clang::Preprocessor &PP,
                      clang::ASTContext &Ctx,
                      const clang::TargetInfo &Target,
+                     llvm::LLVMContext &LLVMContext,
                      PragmaList *Pragmas,
                      unsigned int TargetAPI,
                      std::vector<std::string> *GeneratedFileNames)
@@ -55,11 +66,24 @@ RSContext::RSContext(clang::Preprocessor &PP,
       mTargetAPI(TargetAPI),
       mGeneratedFileNames(GeneratedFileNames),
       mDataLayout(NULL),
-      mLLVMContext(llvm::getGlobalContext()),
+      mLLVMContext(LLVMContext),
+      mExportableArena(new ExportableArena()),
       mLicenseNote(NULL),
       mRSPackageName("android.renderscript"),
       version(0),
       mIsCompatLib(false),
+      mVarBatch(false),
+      mScriptFieldBuffer(false),
+      mPreallocatedPackers(false),
+      mLazyInit(false),
+      mCppHeaderOnly(false),
+      mCppBitcodeBlob(false),
+      mWidenKernels(false),
+      mCompactMetadata(false),
+      mInstrumentKernels(false),
+      mLayoutHotGlobals(false),
+      mExportAccessSets(false),
+      mUsedExports(NULL),
       mMangleCtx(Ctx.createMangleContext()) {
   slangAssert(mGeneratedFileNames && "Must supply GeneratedFileNames");
 
@@ -75,6 +99,26 @@ RSContext::RSContext(clang::Preprocessor &PP,
   PP.AddPragmaHandler(
       "rs", RSPragmaHandler::CreatePragmaReflectLicenseHandler(this));
 
+  // For #pragma rs specialize
+  PP.AddPragmaHandler(
+      "rs", RSPragmaHandler::CreatePragmaSpecializeHandler(this));
+
+  // For #pragma rs fp_relaxed and #pragma rs fp_imprecise
+  PP.AddPragmaHandler(
+      "rs", RSPragmaHandler::CreatePragmaKernelPrecisionHandler(
+          this, "fp_relaxed", KP_Relaxed));
+  PP.AddPragmaHandler(
+      "rs", RSPragmaHandler::CreatePragmaKernelPrecisionHandler(
+          this, "fp_imprecise", KP_Imprecise));
+
+  // For #pragma rs reduce
+  PP.AddPragmaHandler(
+      "rs", RSPragmaHandler::CreatePragmaReduceHandler(this));
+
+  // For #pragma rs fuse
+  PP.AddPragmaHandler(
+      "rs", RSPragmaHandler::CreatePragmaFuseHandler(this));
+
   // For #pragma version
   PP.AddPragmaHandler(RSPragmaHandler::CreatePragmaVersionHandler(this));
 
@@ -93,7 +137,7 @@ bool RSContext::processExportVar(const clang::VarDecl *VD) {
   if (!ET)
     return false;
 
-  RSExportVar *EV = new RSExportVar(this, VD, ET);
+  RSExportVar *EV = new (this) RSExportVar(this, VD, ET);
   if (EV == NULL)
     return false;
   else
@@ -115,7 +159,10 @@ bool RSContext::processExportFunc(const clang::FunctionDecl *FD) {
     return false;
   }
 
-  if (RSExportForEach::isSpecialRSFunc(mTargetAPI, FD)) {
+  if (isReduceFunc(FD)) {
+    // Exported along with its reduction kernel (see processExportReduces())
+    return true;
+  } else if (RSExportForEach::isSpecialRSFunc(mTargetAPI, FD)) {
     // Do not reflect specialized functions like init, dtor, or graphics root.
     return RSExportForEach::validateSpecialFuncDecl(mTargetAPI, this, FD);
   } else if (RSExportForEach::isRSForEachFunc(mTargetAPI, this, FD)) {
@@ -217,6 +264,98 @@ void RSContext::cleanupForEach() {
 }
 
 
+// The name of each function of ER
+static void GetReduceFuncNames(const RSExportReduce *ER,
+                               std::vector<std::string> *Names) {
+  const clang::FunctionDecl *Funcs[] = {
+    ER->getInitializer(), ER->getAccumulator(), ER->getCombiner(),
+    ER->getOutConverter()
+  };
+  for (unsigned i = 0; i < sizeof(Funcs) / sizeof(Funcs[0]); i++)
+    if (Funcs[i] != NULL)
+      Names->push_back(Funcs[i]->getName());
+  return;
+}
+
+void RSContext::pruneUnusedExports() {
+  llvm::StringSet<> Frozen;
+  for (unsigned i = 0, e = mSpecializedVars.size(); i != e; i++)
+    Frozen.insert(mSpecializedVars[i].Name);
+
+  for (ExportVarList::iterator I = mExportVars.begin(),
+           E = mExportVars.end();
+       I != E;) {
+    const std::string &Name = (*I)->getName();
+    if (mUsedExports->count(Name) || Frozen.count(Name)) {
+      I++;
+      continue;
+    }
+    mUnusedExports.push_back(Name);
+    I = mExportVars.erase(I);
+  }
+
+  for (ExportFuncList::iterator I = mExportFuncs.begin(),
+           E = mExportFuncs.end();
+       I != E;) {
+    // The module knows an overloadable invokable by its mangled name.
+    if (mUsedExports->count((*I)->getName(/* mangle = */false))) {
+      I++;
+      continue;
+    }
+    mUnusedExports.push_back((*I)->getName());
+    I = mExportFuncs.erase(I);
+  }
+
+  // A kernel fused into a used one is kept (internally) as its callee, a
+  // fused kernel is generated by the backend from the exported ones only.
+  bool HadRoot = false;
+  for (ExportForEachList::iterator I = mExportForEach.begin(),
+           E = mExportForEach.end();
+       I != E;) {
+    RSExportForEach *EFE = *I;
+    if (EFE->isDummyRoot() || mUsedExports->count(EFE->getName())) {
+      I++;
+      continue;
+    }
+    if (EFE->getName() == "root")
+      HadRoot = true;
+    if (!EFE->isFused())
+      mUnusedExports.push_back(EFE->getName());
+    I = mExportForEach.erase(I);
+  }
+
+  // Slot 0 is still taken by a root, possibly a dummy (see cleanupForEach()),
+  // as long as there are other kernels.
+  if ((mExportForEach.size() == 1) && mExportForEach.front()->isDummyRoot())
+    mExportForEach.clear();
+  else if (HadRoot && !mExportForEach.empty())
+    mExportForEach.push_front(RSExportForEach::CreateDummyRoot(this));
+
+  // The functions of a pruned reduction kernel may be shared with a used one.
+  std::vector<std::string> UnusedReduceFuncs;
+  llvm::StringSet<> UsedReduceFuncs;
+  for (ExportReduceList::iterator I = mExportReduces.begin(),
+           E = mExportReduces.end();
+       I != E;) {
+    std::vector<std::string> Names;
+    GetReduceFuncNames(*I, &Names);
+    if (mUsedExports->count((*I)->getName())) {
+      for (unsigned i = 0, e = Names.size(); i != e; i++)
+        UsedReduceFuncs.insert(Names[i]);
+      I++;
+      continue;
+    }
+    UnusedReduceFuncs.insert(UnusedReduceFuncs.end(), Names.begin(),
+                             Names.end());
+    I = mExportReduces.erase(I);
+  }
+  for (unsigned i = 0, e = UnusedReduceFuncs.size(); i != e; i++)
+    if (!UsedReduceFuncs.count(UnusedReduceFuncs[i]))
+      mUnusedExports.push_back(UnusedReduceFuncs[i]);
+
+  return;
+}
+
 bool RSContext::processExport() {
   bool valid = true;
 
@@ -252,6 +391,27 @@ bool RSContext::processExport() {
     cleanupForEach();
   }
 
+  if (!processSpecializedVars()) {
+    valid = false;
+  }
+
+  if (!processFusedKernels()) {
+    valid = false;
+  }
+
+  if (!processKernelPrecisions()) {
+    valid = false;
+  }
+
+  if (!processExportReduces()) {
+    valid = false;
+  }
+
+  // After the kernels are fused, such that a fused kernel may be used alone.
+  if (valid && (mUsedExports != NULL)) {
+    pruneUnusedExports();
+  }
+
   // Finally, export type forcely set to be exported by user
   for (NeedExportTypeSet::const_iterator EI = mNeedExportTypes.begin(),
            EE = mNeedExportTypes.end();
@@ -265,6 +425,252 @@ bool RSContext::processExport() {
   return valid;
 }
 
+void RSContext::addSpecializedVar(const std::string &Name,
+                                  const std::string &Value,
+                                  bool IsFloat,
+                                  clang::SourceLocation Loc) {
+  SpecializedVar SV;
+  SV.Name = Name;
+  SV.Value = Value;
+  SV.IsFloat = IsFloat;
+  SV.Loc = Loc;
+  SV.Var = NULL;
+  mSpecializedVars.push_back(SV);
+  return;
+}
+
+bool RSContext::isReduceFunc(const clang::FunctionDecl *FD) const {
+  llvm::StringRef Name = FD->getName();
+  for (unsigned i = 0, e = mReduceDecls.size(); i != e; i++) {
+    const ReduceDecl &RD = mReduceDecls[i];
+    if ((Name == RD.Initializer) || (Name == RD.Accumulator) ||
+        (Name == RD.Combiner) || (Name == RD.OutConverter))
+      return true;
+  }
+  return false;
+}
+
+bool RSContext::processExportReduces() {
+  bool valid = true;
+
+  for (unsigned i = 0, e = mReduceDecls.size(); i != e; i++) {
+    const ReduceDecl &RD = mReduceDecls[i];
+    bool Duplicate = false;
+    for (unsigned j = 0; j < i; j++)
+      Duplicate |= (mReduceDecls[j].Name == RD.Name);
+    if (Duplicate) {
+      ReportError(RD.Loc, "reduction kernel '%0' is declared twice")
+          << RD.Name;
+      valid = false;
+      continue;
+    }
+
+    RSExportReduce *ER = RSExportReduce::Create(this, RD);
+    if (ER == NULL)
+      valid = false;
+    else
+      mExportReduces.push_back(ER);
+  }
+
+  return valid;
+}
+
+bool RSContext::processFusedKernels() {
+  bool valid = true;
+
+  for (unsigned i = 0, e = mFuseDecls.size(); i != e; i++) {
+    const FuseDecl &FD = mFuseDecls[i];
+    std::vector<const RSExportForEach*> Kernels;
+    std::string Name;
+    for (unsigned k = 0, ke = FD.Kernels.size(); k != ke; k++) {
+      const RSExportForEach *Kernel = NULL;
+      for (const_export_foreach_iterator I = export_foreach_begin(),
+               E = export_foreach_end();
+           I != E;
+           I++) {
+        if (!(*I)->isDummyRoot() && ((*I)->getName() == FD.Kernels[k])) {
+          Kernel = *I;
+          break;
+        }
+      }
+      if (Kernel == NULL) {
+        ReportError(FD.Loc, "'%0' in #pragma rs fuse is not a forEach kernel")
+            << FD.Kernels[k];
+        valid = false;
+        break;
+      }
+      Kernels.push_back(Kernel);
+      Name.append(k ? "_" : "").append(Kernel->getName());
+    }
+    if (Kernels.size() != FD.Kernels.size())
+      continue;
+
+    // The fused kernel mustn't take the name of something else in the script.
+    bool Conflict = false;
+    for (const_export_foreach_iterator I = export_foreach_begin(),
+             E = export_foreach_end();
+         I != E;
+         I++)
+      Conflict |= ((*I)->getName() == Name);
+    const clang::IdentifierInfo *II = mPP.getIdentifierInfo(Name);
+    if (Conflict || !mCtx.getTranslationUnitDecl()->lookup(II).empty()) {
+      ReportError(FD.Loc, "fused kernel '%0' conflicts with a name declared "
+                  "in the script")
+          << Name;
+      valid = false;
+      continue;
+    }
+
+    RSExportForEach *EFE = RSExportForEach::CreateFused(this, FD, Kernels,
+                                                        Name);
+    if (EFE == NULL) {
+      valid = false;
+      continue;
+    }
+    mExportForEach.push_back(EFE);
+
+    // The fused kernel is as precise as the most precise of its kernels.
+    KernelPrecision P = KP_Imprecise;
+    for (unsigned k = 0, ke = Kernels.size(); k != ke; k++)
+      P = std::min(P, getKernelPrecision(Kernels[k]->getName()));
+    if (P != KP_Full)
+      addKernelPrecision(Name, P);
+  }
+
+  return valid;
+}
+
+bool RSContext::processKernelPrecisions() {
+  bool valid = true;
+
+  for (KernelPrecisionMap::const_iterator I = mKernelPrecisions.begin(),
+           E = mKernelPrecisions.end();
+       I != E;
+       I++) {
+    bool Found = false;
+    for (const_export_foreach_iterator FI = export_foreach_begin(),
+             FE = export_foreach_end();
+         FI != FE;
+         FI++) {
+      if (!(*FI)->isDummyRoot() && ((*FI)->getName() == I->getKey())) {
+        Found = true;
+        break;
+      }
+    }
+    if (!Found) {
+      ReportError("'%0' in #pragma rs %1 is not a forEach kernel")
+          << I->getKey()
+          << ((I->getValue() == KP_Relaxed) ? "fp_relaxed" : "fp_imprecise");
+      valid = false;
+    }
+  }
+
+  return valid;
+}
+
+bool RSContext::processSpecializedVars() {
+  bool valid = true;
+
+  for (SpecializedVarList::iterator I = mSpecializedVars.begin(),
+           E = mSpecializedVars.end();
+       I != E;
+       I++) {
+    for (const_export_var_iterator VI = export_vars_begin(),
+             VE = export_vars_end();
+         VI != VE;
+         VI++) {
+      if ((*VI)->getName() == I->Name) {
+        I->Var = *VI;
+        break;
+      }
+    }
+
+    // Only the scalars reflected with a setter keep their value on the Java
+    // side, to be compared against the frozen one.
+    const RSExportPrimitiveType *EPT = NULL;
+    if ((I->Var != NULL) && !I->Var->isConst() &&
+        (I->Var->getType()->getClass() == RSExportType::ExportClassPrimitive))
+      EPT = static_cast<const RSExportPrimitiveType*>(I->Var->getType());
+    if (EPT == NULL) {
+      ReportError(I->Loc, "cannot specialize on '%0', it's not a non-const "
+                  "exported variable of a scalar type") << I->Name;
+      valid = false;
+      continue;
+    }
+
+    RSExportPrimitiveType::DataType DT = EPT->getType();
+    bool IsFloatVar = (DT == RSExportPrimitiveType::DataTypeFloat32) ||
+                      (DT == RSExportPrimitiveType::DataTypeFloat64);
+    bool IsIntVar = (DT >= RSExportPrimitiveType::DataTypeSigned8) &&
+                    (DT <= RSExportPrimitiveType::DataTypeUnsigned64);
+    if (!IsFloatVar && !IsIntVar) {
+      ReportError(I->Loc, "cannot specialize on '%0', its type is neither an "
+                  "integer nor a floating point type") << I->Name;
+      valid = false;
+      continue;
+    }
+
+    if (IsFloatVar) {
+      // The value is a finite double (see the pragma handler), which may still
+      // overflow a float. Both the backend and the reflection read it in the
+      // type of the variable.
+      llvm::APFloat Val((DT == RSExportPrimitiveType::DataTypeFloat32) ?
+                            llvm::APFloat::IEEEsingle :
+                            llvm::APFloat::IEEEdouble,
+                        I->Value);
+      if (Val.isInfinity()) {
+        ReportError(I->Loc, "value of '%0' is not in range of its type")
+            << I->Name;
+        valid = false;
+      }
+    } else if (I->IsFloat) {
+      ReportError(I->Loc, "value '%0' of '%1' is not an integer")
+          << I->Value << I->Name;
+      valid = false;
+    } else {
+      // The value of an integer is in range of int64_t (see the pragma
+      // handler).
+      unsigned Bits = RSExportPrimitiveType::GetSizeInBits(EPT);
+      bool IsUnsigned = (DT >= RSExportPrimitiveType::DataTypeUnsigned8);
+      llvm::APInt Val(64, I->Value, 10);
+      bool InRange = true;
+      if (Bits < 64) {
+        if (IsUnsigned)
+          InRange = Val.isIntN(Bits) && !Val.isNegative();
+        else
+          InRange = Val.isSignedIntN(Bits);
+      } else if (IsUnsigned) {
+        InRange = !Val.isNegative();
+      }
+      if (!InRange) {
+        ReportError(I->Loc, "value '%0' of '%1' is not in range of its type")
+            << I->Value << I->Name;
+        valid = false;
+      }
+    }
+  }
+
+  return valid;
+}
+
+int RSContext::getSpecializedForEachSlot(const RSExportForEach *EFE) const {
+  if (mSpecializedVars.empty() || EFE->isDummyRoot())
+    return -1;
+
+  int Slot = mExportForEach.size();
+  for (const_export_foreach_iterator I = export_foreach_begin(),
+           E = export_foreach_end();
+       I != E;
+       I++) {
+    if (*I == EFE)
+      return Slot;
+    if (!(*I)->isDummyRoot())
+      Slot++;
+  }
+  slangAssert(false && "EFE is not a kernel of this context");
+  return -1;
+}
+
 bool RSContext::insertExportType(const llvm::StringRef &TypeName,
                                  RSExportType *ET) {
   ExportTypeMap::value_type *NewItem =
@@ -281,10 +687,24 @@ bool RSContext::insertExportType(const llvm::StringRef &TypeName,
   }
 }
 
+void RSContext::convertExportTypes() {
+  for (ExportableList::const_iterator I = mExportables.begin(),
+          E = mExportables.end();
+       I != E;
+       I++) {
+    if ((*I)->getKind() == RSExportable::EX_TYPE)
+      static_cast<const RSExportType*>(*I)->getLLVMType();
+  }
+  return;
+}
+
 bool RSContext::reflectToJava(const std::string &OutputPathBase,
                               const std::string &RSPackageName,
                               const std::string &InputFileName,
-                              const std::string &OutputBCFileName) {
+                              const std::string &OutputBCFileName,
+                              bool WriteIfChanged,
+                              FileContentList *OutputBuffers,
+                              unsigned NumThreads) {
   if (!RSPackageName.empty()) {
     mRSPackageName = RSPackageName;
   }
@@ -297,7 +717,8 @@ bool RSContext::reflectToJava(const std::string &OutputPathBase,
 
   RSReflection *R = new RSReflection(this, mGeneratedFileNames);
   bool ret = R->reflect(OutputPathBase, mReflectJavaPackageName, mRSPackageName,
-                        InputFileName, OutputBCFileName);
+                        InputFileName, OutputBCFileName, WriteIfChanged,
+                        OutputBuffers, NumThreads);
   if (!ret)
     fprintf(stderr, "RSContext::reflectToJava : failed to do reflection "
                     "(%s)\n", R->getLastError());
@@ -305,6 +726,104 @@ bool RSContext::reflectToJava(const std::string &OutputPathBase,
   return ret;
 }
 
+void RSContext::getProfiledFunctions(std::vector<std::string> *Names) const {
+  if (!mInstrumentKernels)
+    return;
+
+  for (const_export_foreach_iterator I = export_foreach_begin(),
+          E = export_foreach_end();
+       I != E;
+       I++) {
+    if (!(*I)->isDummyRoot())
+      Names->push_back((*I)->getName());
+  }
+  for (const_export_func_iterator I = export_funcs_begin(),
+          E = export_funcs_end();
+       I != E;
+       I++)
+    Names->push_back((*I)->getName());
+  return;
+}
+
+size_t RSContext::getVarBatchLayout(std::vector<size_t> *Offsets) const {
+  Offsets->clear();
+  if (!mVarBatch)
+    return 0;
+
+  for (const_export_var_iterator I = export_vars_begin(),
+          E = export_vars_end();
+       I != E;
+       I++) {
+    if ((*I)->isBatchable())
+      Offsets->push_back(0);
+  }
+  if (Offsets->empty())
+    return 0;
+
+  size_t Size = ((Offsets->size() + 31) / 32) * 4;
+  unsigned Index = 0;
+  for (const_export_var_iterator I = export_vars_begin(),
+          E = export_vars_end();
+       I != E;
+       I++) {
+    const RSExportVar *EV = *I;
+    if (!EV->isBatchable())
+      continue;
+    Size = llvm::RoundUpToAlignment(Size, 16);
+    (*Offsets)[Index++] = Size;
+    Size += RSExportType::GetTypeAllocSize(EV->getType());
+  }
+  return Size;
+}
+
+// The arena counts the references to it, i.e., the one of the context plus one
+// per allocated object. The objects kept from a context may be freed on
+// another thread than the one of the context, hence the atomic operations.
+class RSContext::ExportableArena {
+ private:
+  llvm::BumpPtrAllocator mAllocator;
+  volatile llvm::sys::cas_flag mRefs;
+
+ public:
+  ExportableArena() : mRefs(1) {}
+
+  void *allocate(size_t Size) {
+    llvm::sys::AtomicIncrement(&mRefs);
+    return mAllocator.Allocate(Size, 8);
+  }
+
+  void release() {
+    if (llvm::sys::AtomicDecrement(&mRefs) == 0)
+      delete this;
+    return;
+  }
+};
+
+namespace {
+
+// Prepended to each allocation to find its arena again
+union ExportableHeader {
+  void *Arena;
+  uint64_t Align;
+};
+
+}  // namespace
+
+void *RSContext::allocateExportable(size_t Size) {
+  ExportableHeader *H = static_cast<ExportableHeader*>(
+      mExportableArena->allocate(sizeof(ExportableHeader) + Size));
+  H->Arena = mExportableArena;
+  return H + 1;
+}
+
+void RSContext::deallocateExportable(void *P) {
+  if (P == NULL)
+    return;
+  ExportableHeader *H = static_cast<ExportableHeader*>(P) - 1;
+  static_cast<ExportableArena*>(H->Arena)->release();
+  return;
+}
+
 RSContext::~RSContext() {
   delete mLicenseNote;
   delete mDataLayout;
@@ -315,6 +834,7 @@ RSContext::~RSContext() {
     if (!(*I)->isKeep())
       delete *I;
   }
+  mExportableArena->release();
 }
 
 clang::DiagnosticBuilder RSContext::Report(
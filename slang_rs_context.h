@@ -20,16 +20,20 @@
 #include <cstdio>
 #include <list>
 #include <map>
+#include <set>
 #include <string>
+#include <vector>
 
 #include "clang/Lex/Preprocessor.h"
 #include "clang/AST/Mangle.h"
 
+#include "llvm/ADT/DenseMap.h"
 #include "llvm/ADT/OwningPtr.h"
 #include "llvm/ADT/StringSet.h"
 #include "llvm/ADT/StringMap.h"
 
 #include "slang_pragma_recorder.h"
+#include "slang_utils.h"
 
 namespace llvm {
   class LLVMContext;
@@ -49,6 +53,7 @@ namespace slang {
   class RSExportVar;
   class RSExportFunc;
   class RSExportForEach;
+  class RSExportReduce;
   class RSExportType;
 
 class RSContext {
@@ -61,7 +66,66 @@ class RSContext {
   typedef std::list<RSExportVar*> ExportVarList;
   typedef std::list<RSExportFunc*> ExportFuncList;
   typedef std::list<RSExportForEach*> ExportForEachList;
+  typedef std::list<RSExportReduce*> ExportReduceList;
   typedef llvm::StringMap<RSExportType*> ExportTypeMap;
+  typedef llvm::DenseMap<const clang::Type*, RSExportType*> ExportTypeCache;
+
+  // An exported variable frozen to a value by #pragma rs specialize. A variant
+  // of each forEach kernel is compiled with the frozen values folded in.
+  struct SpecializedVar {
+    std::string Name;
+    // The value, as a decimal integer or floating point literal
+    std::string Value;
+    bool IsFloat;
+    clang::SourceLocation Loc;
+    // Resolved by processExport()
+    const RSExportVar *Var;
+  };
+  typedef std::vector<SpecializedVar> SpecializedVarList;
+
+  // The floating point precision of a kernel set by #pragma rs fp_relaxed(...)
+  // or #pragma rs fp_imprecise(...), which the backend turns into fast-math
+  // flags on the instructions of the kernel (and of its helpers). In order of
+  // increasing leeway.
+  enum KernelPrecision {
+    KP_Full,
+    KP_Relaxed,
+    KP_Imprecise
+  };
+  typedef llvm::StringMap<KernelPrecision> KernelPrecisionMap;
+
+  // A reduction kernel as declared by #pragma rs reduce (see RSExportReduce):
+  // the names of its functions, empty for the ones not given.
+  struct ReduceDecl {
+    std::string Name;
+    std::string Initializer;
+    std::string Accumulator;
+    std::string Combiner;
+    std::string OutConverter;
+    clang::SourceLocation Loc;
+  };
+  typedef std::vector<ReduceDecl> ReduceDeclList;
+
+  // A chain of elementwise kernels as declared by #pragma rs fuse(a, b, ...),
+  // which is exported as the kernel a_b_... running them one after another
+  // on each cell.
+  struct FuseDecl {
+    std::vector<std::string> Kernels;
+    clang::SourceLocation Loc;
+  };
+  typedef std::vector<FuseDecl> FuseDeclList;
+
+  // The globals an exported kernel or invokable reads and writes (and what it
+  // calls does), by name, where RS_BOUND_ALLOCATION_PREFIX followed by the
+  // name of a pointer variable stands for the allocation bound to it. Unless
+  // Complete, the function may access other memory as well (e.g., through a
+  // call into the runtime). See RS_EXPORT_ACCESS_MN.
+  struct AccessSet {
+    std::set<std::string> Reads;
+    std::set<std::string> Writes;
+    bool Complete;
+  };
+  typedef llvm::StringMap<AccessSet> AccessSetMap;
 
  private:
   clang::Preprocessor &mPP;
@@ -74,10 +138,22 @@ class RSContext {
   llvm::DataLayout *mDataLayout;
   llvm::LLVMContext &mLLVMContext;
 
+  // The memory of the exportables of this context (see allocateExportable())
+  class ExportableArena;
+  ExportableArena *mExportableArena;
+
   ExportableList mExportables;
 
   NeedExportTypeSet mNeedExportTypes;
 
+  SpecializedVarList mSpecializedVars;
+
+  KernelPrecisionMap mKernelPrecisions;
+
+  ReduceDeclList mReduceDecls;
+
+  FuseDeclList mFuseDecls;
+
   std::string *mLicenseNote;
   std::string mReflectJavaPackageName;
   std::string mReflectJavaPathName;
@@ -88,23 +164,83 @@ class RSContext {
 
   bool mIsCompatLib;
 
+  // Synthesize and reflect a setter of all the batchable exported variables
+  bool mVarBatch;
+
+  // Keep the elements of the reflected type classes in a ByteBuffer
+  bool mScriptFieldBuffer;
+
+  // Allocate the FieldPackers of the invokables and kernels once
+  bool mPreallocatedPackers;
+
+  // Create the Elements etc. of the script class on first use
+  bool mLazyInit;
+
+  // Reflect the C++ script class in its header only
+  bool mCppHeaderOnly;
+
+  // Embed the bitcode in the C++ script class from an assembly file
+  bool mCppBitcodeBlob;
+
+  // Emit the widened variants of the elementwise kernels
+  bool mWidenKernels;
+
+  // Encode the export info in the compact format
+  bool mCompactMetadata;
+
+  // Count the calls and the time of the kernels and invokables
+  bool mInstrumentKernels;
+
+  // Group the variables the kernels read
+  bool mLayoutHotGlobals;
+
+  // Describe the globals each kernel and invokable reads and writes
+  bool mExportAccessSets;
+
+  // The functions the calls to are removed
+  std::vector<std::string> mStrippedCalls;
+
+  // What the exported functions access, by their name (see getAccessSet())
+  AccessSetMap mAccessSets;
+
+  // The ABIs there are native objects of the script for besides its bitcode
+  std::vector<std::string> mPrebuiltABIs;
+
+  // The names of the exports used by the app (see RSExportUsage), NULL if
+  // they all are
+  const llvm::StringSet<> *mUsedExports;
+  // The definitions of the exports pruned for not being used, along with the
+  // functions of the pruned reduction kernels
+  std::vector<std::string> mUnusedExports;
+
   llvm::OwningPtr<clang::MangleContext> mMangleCtx;
 
   bool processExportVar(const clang::VarDecl *VD);
   bool processExportFunc(const clang::FunctionDecl *FD);
   bool processExportType(const llvm::StringRef &Name);
+  bool processSpecializedVars();
+  bool processKernelPrecisions();
+  bool processExportReduces();
+  bool processFusedKernels();
 
   void cleanupForEach();
+  void pruneUnusedExports();
 
   ExportVarList mExportVars;
   ExportFuncList mExportFuncs;
   ExportForEachList mExportForEach;
+  ExportReduceList mExportReduces;
   ExportTypeMap mExportTypes;
+  // The RSExportType (in mExportTypes) RSExportType::Create() returned for a
+  // (not yet normalized) type, such that looking it up again doesn't have to
+  // construct its name.
+  ExportTypeCache mExportTypeCache;
 
  public:
   RSContext(clang::Preprocessor &PP,
             clang::ASTContext &Ctx,
             const clang::TargetInfo &Target,
+            llvm::LLVMContext &LLVMContext,
             PragmaList *Pragmas,
             unsigned int TargetAPI,
             std::vector<std::string> *GeneratedFileNames);
@@ -136,6 +272,39 @@ class RSContext {
     return;
   }
 
+  void addSpecializedVar(const std::string &Name, const std::string &Value,
+                         bool IsFloat, clang::SourceLocation Loc);
+  const SpecializedVarList &getSpecializedVars() const {
+    return mSpecializedVars;
+  }
+  bool hasSpecializedVars() const { return !mSpecializedVars.empty(); }
+
+  // Kernel gets (at least) the precision P.
+  void addKernelPrecision(const std::string &Kernel, KernelPrecision P) {
+    KernelPrecision &Old = mKernelPrecisions[Kernel];
+    if (Old < P)
+      Old = P;
+    return;
+  }
+  KernelPrecision getKernelPrecision(llvm::StringRef Kernel) const {
+    KernelPrecisionMap::const_iterator I = mKernelPrecisions.find(Kernel);
+    return (I == mKernelPrecisions.end()) ? KP_Full : I->getValue();
+  }
+  bool hasKernelPrecisions() const { return !mKernelPrecisions.empty(); }
+
+  void addReduce(const ReduceDecl &RD) { mReduceDecls.push_back(RD); }
+  // Whether FD is one of the functions of a reduction kernel, which isn't
+  // exported as an invokable.
+  bool isReduceFunc(const clang::FunctionDecl *FD) const;
+
+  void addFuse(const FuseDecl &FD) { mFuseDecls.push_back(FD); }
+  bool hasFusedKernels() const { return !mFuseDecls.empty(); }
+
+  // The slot of the variant of EFE specialized on the frozen variables. The
+  // variants take the slots following the ones of all the kernels, in the
+  // same order, but without the dummy root. -1 if EFE has no variant.
+  int getSpecializedForEachSlot(const RSExportForEach *EFE) const;
+
   inline void setReflectJavaPackageName(const std::string &S) {
     mReflectJavaPackageName = S;
     return;
@@ -153,6 +322,20 @@ class RSContext {
   }
 
   bool processExport();
+
+  // Have every exported type create its LLVM type now, the reflection only
+  // reads them from there on (e.g., on another thread, see
+  // SlangRS::beginEmitModule()).
+  void convertExportTypes();
+
+  // Allocate Size bytes for an RSExportable (or a field of a record type)
+  // owned by this context. The memory comes from an arena which is released at
+  // once when the context and the exportables kept (see RSExportable::keep())
+  // from it are gone.
+  void *allocateExportable(size_t Size);
+  // Release the memory of P (allocated by allocateExportable() of any context)
+  static void deallocateExportable(void *P);
+
   inline void newExportable(RSExportable *E) {
     if (E != NULL)
       mExportables.push_back(E);
@@ -194,6 +377,15 @@ class RSContext {
   }
   inline bool hasExportForEach() const { return !mExportForEach.empty(); }
 
+  typedef ExportReduceList::const_iterator const_export_reduce_iterator;
+  const_export_reduce_iterator export_reduce_begin() const {
+    return mExportReduces.begin();
+  }
+  const_export_reduce_iterator export_reduce_end() const {
+    return mExportReduces.end();
+  }
+  inline bool hasExportReduce() const { return !mExportReduces.empty(); }
+
   typedef ExportTypeMap::iterator export_type_iterator;
   typedef ExportTypeMap::const_iterator const_export_type_iterator;
   export_type_iterator export_types_begin() { return mExportTypes.begin(); }
@@ -213,6 +405,14 @@ class RSContext {
     return mExportTypes.find(TypeName);
   }
 
+  RSExportType *findCachedExportType(const clang::Type *T) const {
+    ExportTypeCache::const_iterator I = mExportTypeCache.find(T);
+    return (I != mExportTypeCache.end()) ? I->second : NULL;
+  }
+  void cacheExportType(const clang::Type *T, RSExportType *ET) {
+    mExportTypeCache[T] = ET;
+  }
+
   // Insert the specified Typename/Type pair into the map. If the key already
   // exists in the map, return false and ignore the request, otherwise insert it
   // and return true.
@@ -221,7 +421,10 @@ class RSContext {
   bool reflectToJava(const std::string &OutputPathBase,
                      const std::string &RSPackageName,
                      const std::string &InputFileName,
-                     const std::string &OutputBCFileName);
+                     const std::string &OutputBCFileName,
+                     bool WriteIfChanged,
+                     FileContentList *OutputBuffers,
+                     unsigned NumThreads);
 
   int getVersion() const { return version; }
   void setVersion(int v) {
@@ -231,6 +434,119 @@ class RSContext {
 
   bool isCompatLib() const { return mIsCompatLib; }
 
+  void setVarBatch(bool VarBatch) { mVarBatch = VarBatch; }
+  bool hasVarBatch() const { return mVarBatch; }
+
+  void setScriptFieldBuffer(bool ScriptFieldBuffer) {
+    mScriptFieldBuffer = ScriptFieldBuffer;
+  }
+  bool hasScriptFieldBuffer() const { return mScriptFieldBuffer; }
+
+  void setPreallocatedPackers(bool PreallocatedPackers) {
+    mPreallocatedPackers = PreallocatedPackers;
+  }
+  bool hasPreallocatedPackers() const { return mPreallocatedPackers; }
+
+  void setLazyInit(bool LazyInit) { mLazyInit = LazyInit; }
+  bool hasLazyInit() const { return mLazyInit; }
+
+  // Reflect the whole C++ script class inline in its header, with the layouts
+  // of the exported structs, and pack the arguments of the invokables into a
+  // buffer on the stack.
+  void setCppHeaderOnly(bool CppHeaderOnly) { mCppHeaderOnly = CppHeaderOnly; }
+  bool hasCppHeaderOnly() const { return mCppHeaderOnly; }
+
+  // Reflect an assembly file next to the C++ script class, including the
+  // bitcode file (.incbin) under symbols the class refers to, rather than a
+  // table of the bytes of the bitcode in the class.
+  void setCppBitcodeBlob(bool CppBitcodeBlob) {
+    mCppBitcodeBlob = CppBitcodeBlob;
+  }
+  bool hasCppBitcodeBlob() const { return mCppBitcodeBlob; }
+
+  void setWidenKernels(bool WidenKernels) { mWidenKernels = WidenKernels; }
+  bool hasWidenKernels() const { return mWidenKernels; }
+
+  void setCompactMetadata(bool CompactMetadata) {
+    mCompactMetadata = CompactMetadata;
+  }
+  bool hasCompactMetadata() const { return mCompactMetadata; }
+
+  void setInstrumentKernels(bool InstrumentKernels) {
+    mInstrumentKernels = InstrumentKernels;
+  }
+  bool hasInstrumentKernels() const { return mInstrumentKernels; }
+
+  void setLayoutHotGlobals(bool LayoutHotGlobals) {
+    mLayoutHotGlobals = LayoutHotGlobals;
+  }
+  bool hasLayoutHotGlobals() const { return mLayoutHotGlobals; }
+
+  void setExportAccessSets(bool ExportAccessSets) {
+    mExportAccessSets = ExportAccessSets;
+  }
+  bool hasExportAccessSets() const { return mExportAccessSets; }
+
+  // What the backend found the exported function Name to access (see
+  // RSBackend::dumpExportAccessInfo()).
+  void setAccessSet(llvm::StringRef Name, const AccessSet &S) {
+    mAccessSets[Name] = S;
+  }
+  // NULL if the backend didn't describe the function (without a module or
+  // -export-access-sets).
+  const AccessSet *getAccessSet(llvm::StringRef Name) const {
+    AccessSetMap::const_iterator I = mAccessSets.find(Name);
+    return (I == mAccessSets.end()) ? NULL : &I->getValue();
+  }
+
+  // The names of the functions instrumented (see RS_PROFILE_COUNTERS_VAR_NAME)
+  // in the order of their counters: the forEach kernels (but a dummy root),
+  // then the invokables. Empty unless instrumented.
+  void getProfiledFunctions(std::vector<std::string> *Names) const;
+
+  // The slot of RS_PROFILE_COUNTERS_VAR_NAME, which follows the ones of the
+  // exported variables
+  unsigned getProfileCountersSlot() const { return mExportVars.size(); }
+
+  // Only export (and reflect) the variables, kernels, invokables and reduction
+  // kernels in UsedExports, which must outlive the context. The variables
+  // frozen by #pragma rs specialize are kept anyway.
+  void setUsedExports(const llvm::StringSet<> *UsedExports) {
+    mUsedExports = UsedExports;
+  }
+  // The names of the variables and functions defined by the script which were
+  // left out of the exports by setUsedExports(), for the backend to
+  // internalize
+  const std::vector<std::string> &getUnusedExports() const {
+    return mUnusedExports;
+  }
+
+  // Remove the calls (whose result is unused) to the functions Names from the
+  // module, with the computations of their arguments. A name stands for the C
+  // function and all the overloads of it.
+  void setStrippedCalls(const std::vector<std::string> &Names) {
+    mStrippedCalls = Names;
+  }
+  const std::vector<std::string> &getStrippedCalls() const {
+    return mStrippedCalls;
+  }
+
+  void setPrebuiltABIs(const std::vector<std::string> &ABIs) {
+    mPrebuiltABIs = ABIs;
+  }
+  const std::vector<std::string> &getPrebuiltABIs() const {
+    return mPrebuiltABIs;
+  }
+
+  // The layout of the packet the batch setter of the exported variables takes:
+  // a bitmask of the variables to set (an uint32_t per 32 variables) followed
+  // by the values of all the batchable ones (see RSExportVar::isBatchable())
+  // in the order they are exported, each 16-byte aligned as FieldPacker aligns
+  // the components relative to the start of the packet. Offsets receives the
+  // offset of each value. Returns the size of the packet, or 0 if the setter
+  // isn't requested or there's no batchable variable.
+  size_t getVarBatchLayout(std::vector<size_t> *Offsets) const;
+
   void addPragma(const std::string &T, const std::string &V) {
     mPragmas->push_back(make_pair(T, V));
   }
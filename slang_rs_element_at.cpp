@@ -0,0 +1,237 @@
+/*
+ * Copyright 2013, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "slang_rs_element_at.h"
+
+#include <string>
+
+#include "clang/AST/ASTContext.h"
+#include "clang/AST/Decl.h"
+#include "clang/AST/Expr.h"
+#include "clang/AST/Type.h"
+
+#include "llvm/ADT/StringExtras.h"
+
+namespace slang {
+
+// The suffix of the typed accessors for cells of type T (e.g., "float4"),
+// empty if there are none.
+static std::string GetAccessorSuffix(clang::QualType T) {
+  const clang::Type *Ty = T->getUnqualifiedDesugaredType();
+  const clang::VectorType *VectorTy = llvm::dyn_cast<clang::VectorType>(Ty);
+  if (VectorTy != NULL) {
+    if ((VectorTy->getNumElements() < 2) || (VectorTy->getNumElements() > 4))
+      return "";
+    Ty = VectorTy->getElementType()->getUnqualifiedDesugaredType();
+  }
+  const clang::BuiltinType *ElementTy = llvm::dyn_cast<clang::BuiltinType>(Ty);
+  if (ElementTy == NULL)
+    return "";
+
+  std::string Suffix;
+  switch (ElementTy->getKind()) {
+    case clang::BuiltinType::Float: Suffix = "float"; break;
+    case clang::BuiltinType::Double: Suffix = "double"; break;
+    case clang::BuiltinType::Char_S: Suffix = "char"; break;
+    case clang::BuiltinType::Short: Suffix = "short"; break;
+    case clang::BuiltinType::Int: Suffix = "int"; break;
+    case clang::BuiltinType::Long: Suffix = "long"; break;
+    case clang::BuiltinType::UChar: Suffix = "uchar"; break;
+    case clang::BuiltinType::UShort: Suffix = "ushort"; break;
+    case clang::BuiltinType::UInt: Suffix = "uint"; break;
+    case clang::BuiltinType::ULong: Suffix = "ulong"; break;
+    default: return "";
+  }
+  if (VectorTy != NULL)
+    Suffix.append(llvm::utostr(VectorTy->getNumElements()));
+  return Suffix;
+}
+
+// The function CE calls if it's the RS runtime function Name, NULL otherwise.
+static const clang::FunctionDecl *GetCallee(const clang::CallExpr *CE,
+                                            const char *Name) {
+  const clang::FunctionDecl *FD =
+      llvm::dyn_cast_or_null<clang::FunctionDecl>(CE->getCalleeDecl());
+  if ((FD == NULL) || (FD->getIdentifier() == NULL) ||
+      (FD->getName() != Name))
+    return NULL;
+  return FD;
+}
+
+const clang::FunctionDecl *
+RSElementAtLowering::lookupTypedAccessor(const char *Prefix, clang::QualType T,
+                                         unsigned NumArgs) const {
+  std::string Suffix = GetAccessorSuffix(T);
+  if (Suffix.empty())
+    return NULL;
+
+  clang::DeclContext::lookup_const_result R =
+      C.getTranslationUnitDecl()->lookup(&C.Idents.get(Prefix + Suffix));
+  for (clang::DeclContext::lookup_const_iterator I = R.begin(), E = R.end();
+       I != E;
+       I++) {
+    const clang::FunctionDecl *FD = llvm::dyn_cast<clang::FunctionDecl>(*I);
+    if ((FD != NULL) && (FD->getNumParams() == NumArgs))
+      return FD;
+  }
+  return NULL;
+}
+
+bool RSElementAtLowering::haveSameParams(const clang::FunctionDecl *FD,
+                                         const clang::FunctionDecl *OldFD,
+                                         unsigned Skip) const {
+  if (FD->getNumParams() != OldFD->getNumParams())
+    return false;
+  for (unsigned i = 0, e = FD->getNumParams(); i != e; i++) {
+    if ((i != Skip) &&
+        !C.hasSameType(FD->getParamDecl(i)->getType(),
+                       OldFD->getParamDecl(i)->getType()))
+      return false;
+  }
+  return true;
+}
+
+void RSElementAtLowering::setCallee(clang::CallExpr *CE,
+                                    const clang::FunctionDecl *FD) {
+  clang::FunctionDecl *Callee = const_cast<clang::FunctionDecl*>(FD);
+  clang::DeclRefExpr *Ref =
+      clang::DeclRefExpr::Create(C,
+                                 clang::NestedNameSpecifierLoc(),
+                                 clang::SourceLocation(),
+                                 Callee,
+                                 false,
+                                 CE->getCallee()->getExprLoc(),
+                                 Callee->getType(),
+                                 clang::VK_LValue);
+  CE->setCallee(clang::ImplicitCastExpr::Create(
+      C, C.getPointerType(Callee->getType()),
+      clang::CK_FunctionToPointerDecay, Ref, NULL, clang::VK_RValue));
+  CE->setType(Callee->getResultType().getNonReferenceType());
+  return;
+}
+
+// The read of the cell *(const T *) rsGetElementAt(a, ...) is done by
+// the ImplicitCastExpr (LValueToRValue) of the dereference, which gets the
+// value of rsGetElementAt_T(a, ...) instead.
+void RSElementAtLowering::lowerGetElementAt(clang::ImplicitCastExpr *ICE) {
+  if (ICE->getCastKind() != clang::CK_LValueToRValue)
+    return;
+  clang::UnaryOperator *Deref =
+      llvm::dyn_cast<clang::UnaryOperator>(ICE->getSubExpr()->IgnoreParens());
+  if ((Deref == NULL) || (Deref->getOpcode() != clang::UO_Deref))
+    return;
+  clang::CallExpr *CE =
+      llvm::dyn_cast<clang::CallExpr>(Deref->getSubExpr()->IgnoreParenCasts());
+  if (CE == NULL)
+    return;
+  const clang::FunctionDecl *OldFD = GetCallee(CE, "rsGetElementAt");
+  if (OldFD == NULL)
+    return;
+
+  const clang::FunctionDecl *FD =
+      lookupTypedAccessor("rsGetElementAt_", ICE->getType(),
+                          CE->getNumArgs());
+  if ((FD == NULL) || !haveSameParams(FD, OldFD, ~0u) ||
+      !C.hasSameUnqualifiedType(FD->getResultType(), ICE->getType()))
+    return;
+
+  setCallee(CE, FD);
+  ICE->setSubExpr(CE);
+  ICE->setCastKind(clang::CK_NoOp);
+  return;
+}
+
+const clang::FunctionDecl *
+RSElementAtLowering::getTypedSetElementAt(const clang::CallExpr *CE) const {
+  const clang::FunctionDecl *OldFD = GetCallee(CE, "rsSetElementAt");
+  if ((OldFD == NULL) || (CE->getNumArgs() < 2))
+    return NULL;
+  const clang::ImplicitCastExpr *ToVoidPtr =
+      llvm::dyn_cast<clang::ImplicitCastExpr>(CE->getArg(1));
+  if (ToVoidPtr == NULL)
+    return NULL;
+  const clang::Expr *Ptr = ToVoidPtr->getSubExpr();
+  if (!Ptr->getType()->isPointerType())
+    return NULL;
+  clang::QualType CellTy = Ptr->getType()->getPointeeType();
+
+  const clang::FunctionDecl *FD =
+      lookupTypedAccessor("rsSetElementAt_", CellTy, CE->getNumArgs());
+  if ((FD == NULL) || !haveSameParams(FD, OldFD, 1))
+    return NULL;
+
+  clang::QualType ParamTy = FD->getParamDecl(1)->getType();
+  if (ParamTy->isPointerType())
+    ParamTy = ParamTy->getPointeeType();
+  if (!C.hasSameUnqualifiedType(ParamTy, CellTy))
+    return NULL;
+  return FD;
+}
+
+// The cell of rsSetElementAt(a, &v, ...) is passed to rsSetElementAt_T(a, v,
+// ...) as it's declared, by value or by pointer.
+void RSElementAtLowering::lowerSetElementAt(clang::CallExpr *CE) {
+  const clang::FunctionDecl *FD = getTypedSetElementAt(CE);
+  if (FD == NULL)
+    return;
+  clang::Expr *Ptr =
+      llvm::cast<clang::ImplicitCastExpr>(CE->getArg(1))->getSubExpr();
+  clang::QualType CellTy = Ptr->getType()->getPointeeType();
+
+  clang::QualType ParamTy = FD->getParamDecl(1)->getType();
+  clang::Expr *Arg = NULL;
+  if (ParamTy->isPointerType()) {
+    // A qualification conversion (T * to const T *) at most
+    Arg = clang::ImplicitCastExpr::Create(C, ParamTy, clang::CK_NoOp, Ptr,
+                                          NULL, clang::VK_RValue);
+  } else {
+    clang::Expr *Cell =
+        new (C) clang::UnaryOperator(Ptr, clang::UO_Deref, CellTy,
+                                     clang::VK_LValue, clang::OK_Ordinary,
+                                     Ptr->getExprLoc());
+    Arg = clang::ImplicitCastExpr::Create(C, ParamTy.getUnqualifiedType(),
+                                          clang::CK_LValueToRValue, Cell,
+                                          NULL, clang::VK_RValue);
+  }
+
+  setCallee(CE, FD);
+  CE->setArg(1, Arg);
+  return;
+}
+
+void RSElementAtLowering::VisitStmt(clang::Stmt *S) {
+  for (clang::Stmt::child_iterator I = S->child_begin(), E = S->child_end();
+       I != E;
+       I++) {
+    if (clang::Stmt *Child = *I)
+      Visit(Child);
+  }
+  return;
+}
+
+void RSElementAtLowering::VisitCallExpr(clang::CallExpr *CE) {
+  lowerSetElementAt(CE);
+  VisitStmt(CE);
+  return;
+}
+
+void RSElementAtLowering::VisitImplicitCastExpr(clang::ImplicitCastExpr *ICE) {
+  lowerGetElementAt(ICE);
+  VisitStmt(ICE);
+  return;
+}
+
+}  // namespace slang
@@ -0,0 +1,82 @@
+/*
+ * Copyright 2013, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _FRAMEWORKS_COMPILE_SLANG_SLANG_RS_ELEMENT_AT_H_  // NOLINT
+#define _FRAMEWORKS_COMPILE_SLANG_SLANG_RS_ELEMENT_AT_H_
+
+#include "clang/AST/StmtVisitor.h"
+
+#include "slang_assert.h"
+
+namespace clang {
+  class ASTContext;
+  class CallExpr;
+  class FunctionDecl;
+  class ImplicitCastExpr;
+  class QualType;
+  class Stmt;
+}
+
+namespace slang {
+
+// Rewrites the untyped accesses to the cells of an allocation whose element
+// type is known statically, i.e.,
+//
+//   *(const T *) rsGetElementAt(a, x, ...)  (read as an rvalue)
+//   rsSetElementAt(a, &v, x, ...)  (v of type T)
+//
+// into calls to the typed rsGetElementAt_T() and rsSetElementAt_T() (if the
+// RS headers provide them), which the runtime inlines instead of going
+// through a void * out of line.
+class RSElementAtLowering : public clang::StmtVisitor<RSElementAtLowering> {
+ private:
+  clang::ASTContext &C;
+
+  // The typed accessor Prefix_T() (e.g., rsGetElementAt_float4()) for cells
+  // of type T taking NumArgs arguments, NULL if there's none.
+  const clang::FunctionDecl *lookupTypedAccessor(const char *Prefix,
+                                                 clang::QualType T,
+                                                 unsigned NumArgs) const;
+
+  // Whether FD has the parameters of OldFD but the one at Skip.
+  bool haveSameParams(const clang::FunctionDecl *FD,
+                      const clang::FunctionDecl *OldFD, unsigned Skip) const;
+
+  // Retarget the call CE at FD.
+  void setCallee(clang::CallExpr *CE, const clang::FunctionDecl *FD);
+
+  void lowerGetElementAt(clang::ImplicitCastExpr *ICE);
+  void lowerSetElementAt(clang::CallExpr *CE);
+
+ public:
+  explicit RSElementAtLowering(clang::ASTContext &Ctx)
+      : C(Ctx) {
+    return;
+  }
+
+  // The typed accessor the call CE of rsSetElementAt() is lowered to, NULL if
+  // it's left alone.
+  const clang::FunctionDecl *getTypedSetElementAt(
+      const clang::CallExpr *CE) const;
+
+  void VisitStmt(clang::Stmt *S);
+  void VisitCallExpr(clang::CallExpr *CE);
+  void VisitImplicitCastExpr(clang::ImplicitCastExpr *ICE);
+};
+
+}  // namespace slang
+
+#endif  // _FRAMEWORKS_COMPILE_SLANG_SLANG_RS_ELEMENT_AT_H_  NOLINT
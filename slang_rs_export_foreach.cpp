@@ -17,6 +17,7 @@
 #include "slang_rs_export_foreach.h"
 
 #include <string>
+#include <vector>
 
 #include "clang/AST/ASTContext.h"
 #include "clang/AST/Attr.h"
@@ -334,7 +335,7 @@ RSExportForEach *RSExportForEach::Create(RSContext *Context,
 
   slangAssert(!Name.empty() && "Function must have a name");
 
-  FE = new RSExportForEach(Context, Name);
+  FE = new (Context) RSExportForEach(Context, Name);
 
   if (!FE->validateAndConstructParams(Context, FD)) {
     return NULL;
@@ -423,11 +424,82 @@ RSExportForEach *RSExportForEach::Create(RSContext *Context,
 RSExportForEach *RSExportForEach::CreateDummyRoot(RSContext *Context) {
   slangAssert(Context);
   llvm::StringRef Name = "root";
-  RSExportForEach *FE = new RSExportForEach(Context, Name);
+  RSExportForEach *FE = new (Context) RSExportForEach(Context, Name);
   FE->mDummyRoot = true;
   return FE;
 }
 
+// The cells of a fused kernel are passed along in registers, hence only
+// primitives and vectors.
+static bool IsFusableCellType(const RSExportType *ET) {
+  if (ET->getClass() == RSExportType::ExportClassVector)
+    return true;
+  if (ET->getClass() != RSExportType::ExportClassPrimitive)
+    return false;
+  const RSExportPrimitiveType *EPT =
+      static_cast<const RSExportPrimitiveType*>(ET);
+  return !EPT->isRSObjectType() &&
+         (EPT->getType() != RSExportPrimitiveType::DataTypeBoolean);
+}
+
+RSExportForEach *RSExportForEach::CreateFused(
+    RSContext *Context, const RSContext::FuseDecl &FD,
+    const std::vector<const RSExportForEach*> &Kernels,
+    const std::string &Name) {
+  slangAssert(Context && (Kernels.size() > 1));
+  bool valid = true;
+
+  for (unsigned i = 0, e = Kernels.size(); i != e; i++) {
+    const RSExportForEach *K = Kernels[i];
+    if (!K->isKernelStyle() || !K->hasIn() || !K->hasReturn()) {
+      Context->ReportError(FD.Loc, "kernel '%0' can't be fused, it must be a "
+                           "pass-by-value kernel taking an input cell and "
+                           "returning the output one")
+          << K->getName();
+      valid = false;
+    } else if (!IsFusableCellType(K->getInType()) ||
+               !IsFusableCellType(K->getOutType())) {
+      Context->ReportError(FD.Loc, "kernel '%0' can't be fused, its cells "
+                           "must be of primitive or vector types")
+          << K->getName();
+      valid = false;
+    } else if ((i != 0) && Kernels[i - 1]->hasReturn() &&
+               (K->getInType() != Kernels[i - 1]->getOutType())) {
+      Context->ReportError(FD.Loc, "kernel '%0' can't be fused after '%1', "
+                           "its input type '%2' is not the result type '%3'")
+          << K->getName() << Kernels[i - 1]->getName()
+          << K->getInType()->getName()
+          << Kernels[i - 1]->getOutType()->getName();
+      valid = false;
+    }
+  }
+  if (!valid)
+    return NULL;
+
+  const RSExportForEach *First = Kernels.front();
+  const RSExportForEach *Last = Kernels.back();
+  RSExportForEach *FE = new (Context) RSExportForEach(Context, Name);
+  FE->mIn = First->mIn;
+  FE->mInType = First->mInType;
+  FE->mOutType = Last->mOutType;
+  FE->mResultType = Last->mResultType;
+  FE->mHasReturnType = true;
+  FE->mIsKernelStyle = true;
+  for (unsigned i = 0, e = Kernels.size(); i != e; i++) {
+    if (FE->mX == NULL)
+      FE->mX = Kernels[i]->mX;
+    if (FE->mY == NULL)
+      FE->mY = Kernels[i]->mY;
+  }
+  FE->numParams = 1 + (FE->mX ? 1 : 0) + (FE->mY ? 1 : 0);
+  FE->mFusedKernels = Kernels;
+
+  // Pass-by-value kernels always target levels which can skip parameters.
+  if (!FE->setSignatureMetadata(Context, NULL))
+    return NULL;
+  return FE;
+}
+
 bool RSExportForEach::isGraphicsRootRSFunc(int targetAPI,
                                            const clang::FunctionDecl *FD) {
   if (FD->hasAttr<clang::KernelAttr>()) {
@@ -17,6 +17,9 @@
 #ifndef _FRAMEWORKS_COMPILE_SLANG_SLANG_RS_EXPORT_FOREACH_H_  // NOLINT
 #define _FRAMEWORKS_COMPILE_SLANG_SLANG_RS_EXPORT_FOREACH_H_
 
+#include <string>
+#include <vector>
+
 #include "llvm/ADT/StringRef.h"
 #include "llvm/Support/raw_ostream.h"
 
@@ -59,6 +62,10 @@ class RSExportForEach : public RSExportable {
 
   bool mDummyRoot;
 
+  // The kernels this one runs one after another on each cell, empty if it
+  // isn't fused
+  std::vector<const RSExportForEach*> mFusedKernels;
+
   // TODO(all): Add support for LOD/face when we have them
   RSExportForEach(RSContext *Context, const llvm::StringRef &Name)
     : RSExportable(Context, RSExportable::EX_FOREACH),
@@ -91,6 +98,13 @@ class RSExportForEach : public RSExportable {
 
   static RSExportForEach *CreateDummyRoot(RSContext *Context);
 
+  // The kernel Name fusing Kernels as declared by FD. The backend synthesizes
+  // its function out of theirs.
+  static RSExportForEach *CreateFused(
+      RSContext *Context, const RSContext::FuseDecl &FD,
+      const std::vector<const RSExportForEach*> &Kernels,
+      const std::string &Name);
+
   inline const std::string &getName() const {
     return mName;
   }
@@ -111,6 +125,14 @@ class RSExportForEach : public RSExportable {
     return (mUsrData != NULL);
   }
 
+  inline bool hasX() const {
+    return (mX != NULL);
+  }
+
+  inline bool hasY() const {
+    return (mY != NULL);
+  }
+
   inline bool hasReturn() const {
     return mHasReturnType;
   }
@@ -131,10 +153,22 @@ class RSExportForEach : public RSExportable {
     return mSignatureMetadata;
   }
 
+  inline bool isKernelStyle() const {
+    return mIsKernelStyle;
+  }
+
   inline bool isDummyRoot() const {
     return mDummyRoot;
   }
 
+  inline bool isFused() const {
+    return !mFusedKernels.empty();
+  }
+
+  inline const std::vector<const RSExportForEach*> &getFusedKernels() const {
+    return mFusedKernels;
+  }
+
   typedef RSExportRecordType::const_field_iterator const_param_iterator;
 
   inline const_param_iterator params_begin() const {
@@ -0,0 +1,209 @@
+/*
+ * Copyright 2013, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "slang_rs_export_reduce.h"
+
+#include <string>
+
+#include "clang/AST/ASTContext.h"
+#include "clang/AST/Decl.h"
+#include "clang/AST/Type.h"
+
+#include "slang_assert.h"
+#include "slang_rs_context.h"
+#include "slang_rs_export_type.h"
+
+namespace slang {
+
+// Find the definition of the function Name, the Kind (e.g., "accumulator") of
+// the reduction kernel RD, into *FD (left alone if Name is empty). Returns
+// false if there's no such function, or it can't be one of the kernel.
+static bool LookupFunction(RSContext *Context,
+                           const RSContext::ReduceDecl &RD,
+                           const std::string &Name,
+                           const char *Kind,
+                           unsigned NumParams,
+                           const clang::FunctionDecl **FD) {
+  if (Name.empty())
+    return true;
+
+  clang::TranslationUnitDecl *TUDecl =
+      Context->getASTContext().getTranslationUnitDecl();
+  const clang::IdentifierInfo *II =
+      Context->getPreprocessor().getIdentifierInfo(Name);
+  clang::DeclContext::lookup_const_result R = TUDecl->lookup(II);
+  const clang::FunctionDecl *Definition = NULL;
+  for (clang::DeclContext::lookup_const_iterator I = R.begin(), E = R.end();
+       I != E;
+       I++) {
+    const clang::FunctionDecl *D = llvm::dyn_cast<clang::FunctionDecl>(*I);
+    if ((D != NULL) && D->hasBody(Definition))
+      break;
+  }
+
+  if (Definition == NULL) {
+    Context->ReportError(RD.Loc, "%0 '%1' of reduction kernel '%2' is not a "
+                         "function defined in this file")
+        << Kind << Name << RD.Name;
+    return false;
+  }
+  if (Definition->getStorageClass() == clang::SC_Static) {
+    Context->ReportError(Definition->getLocation(),
+                         "%0 '%1' of reduction kernel '%2' can't be static")
+        << Kind << Name << RD.Name;
+    return false;
+  }
+  if (!Definition->getResultType()->isVoidType() ||
+      (Definition->getNumParams() != NumParams)) {
+    Context->ReportError(Definition->getLocation(),
+                         "%0 '%1' of reduction kernel '%2' must return void "
+                         "and take %3 parameter(s)")
+        << Kind << Name << RD.Name << NumParams;
+    return false;
+  }
+
+  *FD = Definition;
+  return true;
+}
+
+// The type parameter Index of FD points to (unqualified), a null type if it's
+// not a pointer, or if it's not a pointer to const (IsConst) or non-const.
+static clang::QualType GetPointeeType(const clang::FunctionDecl *FD,
+                                      unsigned Index, bool IsConst) {
+  clang::QualType QT = FD->getParamDecl(Index)->getType().getCanonicalType();
+  if (!QT->isPointerType())
+    return clang::QualType();
+  clang::QualType PointeeQT = QT->getPointeeType();
+  if (PointeeQT.isConstQualified() != IsConst)
+    return clang::QualType();
+  return PointeeQT.getUnqualifiedType();
+}
+
+// The export type of QT, the Kind (e.g., "input") of the type of the
+// reduction kernel RD. NULL if it can't be exported.
+static RSExportType *CreateType(RSContext *Context,
+                                const RSContext::ReduceDecl &RD,
+                                clang::QualType QT,
+                                const char *Kind) {
+  RSExportType *ET = RSExportType::Create(Context, QT.getTypePtr());
+  if (ET == NULL)
+    Context->ReportError(RD.Loc, "%0 type '%1' of reduction kernel '%2' is "
+                         "not supported by the reflection")
+        << Kind << QT.getAsString() << RD.Name;
+  return ET;
+}
+
+bool RSExportReduce::validateAndConstructTypes(
+    RSContext *Context, const RSContext::ReduceDecl &RD) {
+  // The accumulator sets the accumulator type.
+  clang::QualType AccumQT = GetPointeeType(mAccumulator, 0, false);
+  clang::QualType InQT =
+      mAccumulator->getParamDecl(1)->getType().getCanonicalType();
+  if (AccumQT.isNull() || InQT->isPointerType()) {
+    Context->ReportError(mAccumulator->getLocation(),
+                         "accumulator '%0' of reduction kernel '%1' must take "
+                         "a pointer to the (non-const) accumulator and an "
+                         "input cell by value")
+        << RD.Accumulator << RD.Name;
+    return false;
+  }
+  InQT = InQT.getUnqualifiedType();
+
+  bool valid = true;
+  if ((mInitializer != NULL) &&
+      (GetPointeeType(mInitializer, 0, false) != AccumQT)) {
+    Context->ReportError(mInitializer->getLocation(),
+                         "initializer '%0' of reduction kernel '%1' must take "
+                         "a pointer to the accumulator type '%2'")
+        << RD.Initializer << RD.Name << AccumQT.getAsString();
+    valid = false;
+  }
+
+  if (mCombiner != NULL) {
+    if ((GetPointeeType(mCombiner, 0, false) != AccumQT) ||
+        (GetPointeeType(mCombiner, 1, true) != AccumQT)) {
+      Context->ReportError(mCombiner->getLocation(),
+                           "combiner '%0' of reduction kernel '%1' must take "
+                           "a pointer and a pointer to const to the "
+                           "accumulator type '%2'")
+          << RD.Combiner << RD.Name << AccumQT.getAsString();
+      valid = false;
+    }
+  } else if (InQT != AccumQT) {
+    Context->ReportError(RD.Loc, "reduction kernel '%0' needs a combiner, its "
+                         "input type '%1' is not the accumulator type '%2'")
+        << RD.Name << InQT.getAsString() << AccumQT.getAsString();
+    valid = false;
+  }
+
+  clang::QualType ResultQT = AccumQT;
+  if (mOutConverter != NULL) {
+    ResultQT = GetPointeeType(mOutConverter, 0, false);
+    if (ResultQT.isNull() ||
+        (GetPointeeType(mOutConverter, 1, true) != AccumQT)) {
+      Context->ReportError(mOutConverter->getLocation(),
+                           "outconverter '%0' of reduction kernel '%1' must "
+                           "take a pointer to the (non-const) result and a "
+                           "pointer to const to the accumulator type '%2'")
+          << RD.OutConverter << RD.Name << AccumQT.getAsString();
+      return false;
+    }
+  }
+  if (!valid)
+    return false;
+
+  mInType = CreateType(Context, RD, InQT, "input");
+  mAccumType = CreateType(Context, RD, AccumQT, "accumulator");
+  mResultType = CreateType(Context, RD, ResultQT, "result");
+  if ((mInType == NULL) || (mAccumType == NULL) || (mResultType == NULL))
+    return false;
+
+  // The result is returned by the reflected reduce_*().
+  bool IsPlainResult =
+      (mResultType->getClass() == RSExportType::ExportClassVector) ||
+      ((mResultType->getClass() == RSExportType::ExportClassPrimitive) &&
+       !static_cast<RSExportPrimitiveType*>(mResultType)->isRSObjectType());
+  if (!IsPlainResult) {
+    Context->ReportError(RD.Loc, "result type '%0' of reduction kernel '%1' "
+                         "must be a primitive or a vector type")
+        << ResultQT.getAsString() << RD.Name;
+    return false;
+  }
+
+  return true;
+}
+
+RSExportReduce *RSExportReduce::Create(RSContext *Context,
+                                       const RSContext::ReduceDecl &RD) {
+  slangAssert(!RD.Accumulator.empty() && "Reduction kernel must accumulate");
+
+  RSExportReduce *ER = new (Context) RSExportReduce(Context, RD.Name);
+  bool valid = true;
+  valid &= LookupFunction(Context, RD, RD.Initializer, "initializer", 1,
+                          &ER->mInitializer);
+  valid &= LookupFunction(Context, RD, RD.Accumulator, "accumulator", 2,
+                          &ER->mAccumulator);
+  valid &= LookupFunction(Context, RD, RD.Combiner, "combiner", 2,
+                          &ER->mCombiner);
+  valid &= LookupFunction(Context, RD, RD.OutConverter, "outconverter", 2,
+                          &ER->mOutConverter);
+  if (!valid || !ER->validateAndConstructTypes(Context, RD))
+    return NULL;
+
+  return ER;
+}
+
+}  // namespace slang
@@ -0,0 +1,102 @@
+/*
+ * Copyright 2013, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _FRAMEWORKS_COMPILE_SLANG_SLANG_RS_EXPORT_REDUCE_H_  // NOLINT
+#define _FRAMEWORKS_COMPILE_SLANG_SLANG_RS_EXPORT_REDUCE_H_
+
+#include <string>
+
+#include "llvm/ADT/StringRef.h"
+
+#include "slang_rs_context.h"
+#include "slang_rs_exportable.h"
+#include "slang_rs_export_type.h"
+
+namespace clang {
+  class FunctionDecl;
+}  // namespace clang
+
+namespace slang {
+
+// A reduction kernel, declared by
+//
+//   #pragma rs reduce(name) accumulator(fn) [initializer(fn)] [combiner(fn)]
+//       [outconverter(fn)]
+//
+// out of the (non-static) functions
+//
+//   void initializer(AccumType *accum)
+//   void accumulator(AccumType *accum, InType in)
+//   void combiner(AccumType *accum, const AccumType *other)
+//   void outconverter(ResultType *result, const AccumType *accum)
+//
+// The runtime splits the input allocation between its threads, each of which
+// initializes an accumulator of its own (to zeros without an initializer) and
+// folds its cells into it, then combines the accumulators into one and
+// converts it into the result. Without a combiner, the accumulator combines
+// (InType is then AccumType). Without an outconverter, the result is the
+// accumulator. The functions aren't exported as invokables.
+class RSExportReduce : public RSExportable {
+ private:
+  std::string mName;
+
+  const clang::FunctionDecl *mInitializer;
+  const clang::FunctionDecl *mAccumulator;
+  const clang::FunctionDecl *mCombiner;
+  const clang::FunctionDecl *mOutConverter;
+
+  RSExportType *mInType;
+  RSExportType *mAccumType;
+  RSExportType *mResultType;
+
+  RSExportReduce(RSContext *Context, const llvm::StringRef &Name)
+    : RSExportable(Context, RSExportable::EX_REDUCE),
+      mName(Name.data(), Name.size()), mInitializer(NULL), mAccumulator(NULL),
+      mCombiner(NULL), mOutConverter(NULL), mInType(NULL), mAccumType(NULL),
+      mResultType(NULL) {
+    return;
+  }
+
+  bool validateAndConstructTypes(RSContext *Context,
+                                 const RSContext::ReduceDecl &RD);
+
+ public:
+  static RSExportReduce *Create(RSContext *Context,
+                                const RSContext::ReduceDecl &RD);
+
+  inline const std::string &getName() const { return mName; }
+
+  // NULL for the ones not given
+  inline const clang::FunctionDecl *getInitializer() const {
+    return mInitializer;
+  }
+  inline const clang::FunctionDecl *getAccumulator() const {
+    return mAccumulator;
+  }
+  inline const clang::FunctionDecl *getCombiner() const { return mCombiner; }
+  inline const clang::FunctionDecl *getOutConverter() const {
+    return mOutConverter;
+  }
+
+  inline const RSExportType *getInType() const { return mInType; }
+  inline const RSExportType *getAccumType() const { return mAccumType; }
+  // A primitive or a vector type
+  inline const RSExportType *getResultType() const { return mResultType; }
+};  // RSExportReduce
+
+}  // namespace slang
+
+#endif  // _FRAMEWORKS_COMPILE_SLANG_SLANG_RS_EXPORT_REDUCE_H_  NOLINT
@@ -17,11 +17,13 @@
 #include "slang_rs_export_type.h"
 
 #include <list>
+#include <ostream>
 #include <vector>
 
 #include "clang/AST/ASTContext.h"
 #include "clang/AST/Attr.h"
 #include "clang/AST/RecordLayout.h"
+#include "clang/Basic/SourceManager.h"
 
 #include "llvm/ADT/StringExtras.h"
 #include "llvm/IR/DataLayout.h"
@@ -675,8 +677,12 @@ RSExportType *RSExportType::Create(RSContext *Context,
   // in RSExportType::RSExportType()
   RSContext::export_type_iterator ETI = Context->findExportType(TypeName);
 
-  if (ETI != Context->export_types_end())
+  if (ETI != Context->export_types_end()) {
+    if (T->getTypeClass() == clang::Type::Pointer)
+      // Allocated in RSExportType::GetTypeName
+      delete [] TypeName.data();
     return ETI->second;
+  }
 
   RSExportType *ET = NULL;
   switch (T->getTypeClass()) {
@@ -756,9 +762,19 @@ RSExportType *RSExportType::Create(RSContext *Context,
 }
 
 RSExportType *RSExportType::Create(RSContext *Context, const clang::Type *T) {
+  RSExportType *ET = Context->findCachedExportType(T);
+  if (ET != NULL)
+    return ET;
+
+  const clang::Type *OrigT = T;
   llvm::StringRef TypeName;
   if (NormalizeType(T, TypeName, Context, NULL)) {
-    return Create(Context, T, TypeName);
+    ET = Create(Context, T, TypeName);
+    // Only the types in the name map of the context are unique
+    if ((ET != NULL) &&
+        !llvm::StringRef(ET->getName()).startswith(DUMMY_RS_TYPE_NAME_PREFIX))
+      Context->cacheExportType(OrigT, ET);
+    return ET;
   } else {
     return NULL;
   }
@@ -782,6 +798,51 @@ size_t RSExportType::GetTypeAllocSize(const RSExportType *ET) {
         ET->getLLVMType());
 }
 
+void RSExportType::Describe(std::ostream &OS, const RSExportType *ET) {
+  if (ET == NULL) {
+    OS << "-;";
+    return;
+  }
+
+  OS << ET->getClass() << ' ' << ET->getName() << ' '
+     << RSExportType::GetTypeAllocSize(ET);
+  switch (ET->getClass()) {
+    case RSExportType::ExportClassPointer: {
+      const RSExportType *PointeeType =
+          static_cast<const RSExportPointerType*>(ET)->getPointeeType();
+      OS << " *" << PointeeType->getClass() << ' ' << PointeeType->getName();
+      break;
+    }
+    case RSExportType::ExportClassConstantArray: {
+      const RSExportConstantArrayType *ECAT =
+          static_cast<const RSExportConstantArrayType*>(ET);
+      OS << " [" << ECAT->getSize() << "] ";
+      Describe(OS, ECAT->getElementType());
+      break;
+    }
+    case RSExportType::ExportClassRecord: {
+      const RSExportRecordType *ERT =
+          static_cast<const RSExportRecordType*>(ET);
+      OS << " {" << ERT->isPacked() << ' ' << ERT->isArtificial() << ' ';
+      for (RSExportRecordType::const_field_iterator I = ERT->fields_begin(),
+               E = ERT->fields_end();
+           I != E;
+           I++) {
+        const RSExportRecordType::Field *F = *I;
+        OS << F->getName() << '@' << F->getOffsetInParent() << ':';
+        Describe(OS, F->getType());
+      }
+      OS << '}';
+      break;
+    }
+    default: {
+      break;
+    }
+  }
+  OS << ';';
+  return;
+}
+
 RSExportType::RSExportType(RSContext *Context,
                            ExportClass Class,
                            const llvm::StringRef &Name)
@@ -819,10 +880,28 @@ RSExportType::~RSExportType() {
 }
 
 /************************** RSExportPrimitiveType **************************/
-llvm::ManagedStatic<RSExportPrimitiveType::RSSpecificTypeMapTy>
-RSExportPrimitiveType::RSSpecificTypeMap;
-
-llvm::Type *RSExportPrimitiveType::RSObjectLLVMType = NULL;
+// The RS matrix and object types in the slots of their names' hash (see
+// RSSpecificTypeNameHash()). Being constant, the table needs neither
+// construction nor locking.
+#define RS_SPECIFIC_TYPE_HASH(seed, bits)                           \
+  static const unsigned RSSpecificTypeHashSeed = seed;              \
+  static const unsigned RSSpecificTypeHashBits = bits;
+#define RS_SPECIFIC_TYPE_HASH_SLOT(type, cname)
+#define RS_SPECIFIC_TYPE_HASH_EMPTY_SLOT()
+#include "RSSpecificTypeHash.inc"
+
+static const struct RSSpecificTypeHashSlot {
+  const char *Name;
+  unsigned Length;
+  RSExportPrimitiveType::DataType Type;
+} RSSpecificTypeHashTable[] = {
+#define RS_SPECIFIC_TYPE_HASH(seed, bits)
+#define RS_SPECIFIC_TYPE_HASH_SLOT(type, cname)                     \
+  { cname, sizeof(cname) - 1, RSExportPrimitiveType::DataType ## type },
+#define RS_SPECIFIC_TYPE_HASH_EMPTY_SLOT()                          \
+  { NULL, 0, RSExportPrimitiveType::DataTypeUnknown },
+#include "RSSpecificTypeHash.inc"
+};
 
 bool RSExportPrimitiveType::IsPrimitiveType(const clang::Type *T) {
   if ((T != NULL) && (T->getTypeClass() == clang::Type::Builtin))
@@ -833,23 +912,17 @@ bool RSExportPrimitiveType::IsPrimitiveType(const clang::Type *T) {
 
 RSExportPrimitiveType::DataType
 RSExportPrimitiveType::GetRSSpecificType(const llvm::StringRef &TypeName) {
-  if (TypeName.empty())
+  if (TypeName.size() < RS_SPECIFIC_TYPE_NAME_MIN_LENGTH)
     return DataTypeUnknown;
 
-  if (RSSpecificTypeMap->empty()) {
-#define ENUM_RS_MATRIX_TYPE(type, cname, dim)                       \
-    RSSpecificTypeMap->GetOrCreateValue(cname, DataType ## type);
-#include "RSMatrixTypeEnums.inc"
-#define ENUM_RS_OBJECT_TYPE(type, cname)                            \
-    RSSpecificTypeMap->GetOrCreateValue(cname, DataType ## type);
-#include "RSObjectTypeEnums.inc"
-  }
-
-  RSSpecificTypeMapTy::const_iterator I = RSSpecificTypeMap->find(TypeName);
-  if (I == RSSpecificTypeMap->end())
+  const RSSpecificTypeHashSlot &Slot =
+      RSSpecificTypeHashTable[RSSpecificTypeNameHash(TypeName.data(),
+                                                     TypeName.size(),
+                                                     RSSpecificTypeHashSeed,
+                                                     RSSpecificTypeHashBits)];
+  if (TypeName != llvm::StringRef(Slot.Name, Slot.Length))
     return DataTypeUnknown;
-  else
-    return I->getValue();
+  return Slot.Type;
 }
 
 RSExportPrimitiveType::DataType
@@ -993,8 +1066,8 @@ RSExportPrimitiveType
   if ((DT == DataTypeUnknown) || TypeName.empty())
     return NULL;
   else
-    return new RSExportPrimitiveType(Context, ExportClassPrimitive, TypeName,
-                                     DT, Normalized);
+    return new (Context) RSExportPrimitiveType(Context, ExportClassPrimitive,
+                                               TypeName, DT, Normalized);
 }
 
 RSExportPrimitiveType *RSExportPrimitiveType::Create(RSContext *Context,
@@ -1020,12 +1093,11 @@ llvm::Type *RSExportPrimitiveType::convertToLLVMType() const {
     //
     // <{ [1 x i32] }> in LLVM
     //
-    if (RSObjectLLVMType == NULL) {
-      std::vector<llvm::Type *> Elements;
-      Elements.push_back(llvm::ArrayType::get(llvm::Type::getInt32Ty(C), 1));
-      RSObjectLLVMType = llvm::StructType::get(C, Elements, true);
-    }
-    return RSObjectLLVMType;
+    // Literal struct types are uniqued by their LLVMContext, so there's no
+    // need to cache this across RSContexts (which may not share one).
+    std::vector<llvm::Type *> Elements;
+    Elements.push_back(llvm::ArrayType::get(llvm::Type::getInt32Ty(C), 1));
+    return llvm::StructType::get(C, Elements, true);
   }
 
   switch (mType) {
@@ -1116,7 +1188,7 @@ RSExportPointerType
     return NULL;
   }
 
-  return new RSExportPointerType(Context, TypeName, PointeeET);
+  return new (Context) RSExportPointerType(Context, TypeName, PointeeET);
 }
 
 llvm::Type *RSExportPointerType::convertToLLVMType() const {
@@ -1190,11 +1262,11 @@ RSExportVectorType *RSExportVectorType::Create(RSContext *Context,
       RSExportPrimitiveType::GetDataType(Context, ElementType);
 
   if (DT != RSExportPrimitiveType::DataTypeUnknown)
-    return new RSExportVectorType(Context,
-                                  TypeName,
-                                  DT,
-                                  Normalized,
-                                  EVT->getNumElements());
+    return new (Context) RSExportVectorType(Context,
+                                            TypeName,
+                                            DT,
+                                            Normalized,
+                                            EVT->getNumElements());
   else
     return NULL;
 }
@@ -1284,7 +1356,7 @@ RSExportMatrixType *RSExportMatrixType::Create(RSContext *Context,
     }
   }
 
-  return new RSExportMatrixType(Context, TypeName, Dim);
+  return new (Context) RSExportMatrixType(Context, TypeName, Dim);
 }
 
 llvm::Type *RSExportMatrixType::convertToLLVMType() const {
@@ -1334,9 +1406,9 @@ RSExportConstantArrayType
     return NULL;
   }
 
-  return new RSExportConstantArrayType(Context,
-                                       ElementET,
-                                       Size);
+  return new (Context) RSExportConstantArrayType(Context,
+                                                 ElementET,
+                                                 Size);
 }
 
 llvm::Type *RSExportConstantArrayType::convertToLLVMType() const {
@@ -1373,6 +1445,40 @@ bool RSExportConstantArrayType::equals(const RSExportable *E) const {
 }
 
 /**************************** RSExportRecordType ****************************/
+// Append the offset of each RS object in ET, at Offset in its struct, to
+// *Offsets. The nested structs have theirs already.
+static void AppendRSObjectOffsets(const RSExportType *ET, size_t Offset,
+                                  std::vector<size_t> *Offsets) {
+  switch (ET->getClass()) {
+    case RSExportType::ExportClassPrimitive: {
+      if (static_cast<const RSExportPrimitiveType*>(ET)->isRSObjectType())
+        Offsets->push_back(Offset);
+      break;
+    }
+    case RSExportType::ExportClassConstantArray: {
+      const RSExportConstantArrayType *ECAT =
+          static_cast<const RSExportConstantArrayType*>(ET);
+      const RSExportType *ElementType = ECAT->getElementType();
+      size_t ElementSize = RSExportType::GetTypeAllocSize(ElementType);
+      for (unsigned i = 0, e = ECAT->getSize(); i != e; i++)
+        AppendRSObjectOffsets(ElementType, Offset + i * ElementSize, Offsets);
+      break;
+    }
+    case RSExportType::ExportClassRecord: {
+      const std::vector<size_t> &Nested =
+          static_cast<const RSExportRecordType*>(ET)->getRSObjectOffsets();
+      for (unsigned i = 0, e = Nested.size(); i != e; i++)
+        Offsets->push_back(Offset + Nested[i]);
+      break;
+    }
+    default: {
+      // Pointers, vectors and matrices hold no RS object.
+      break;
+    }
+  }
+  return;
+}
+
 RSExportRecordType *RSExportRecordType::Create(RSContext *Context,
                                                const clang::RecordType *RT,
                                                const llvm::StringRef &TypeName,
@@ -1396,11 +1502,15 @@ RSExportRecordType *RSExportRecordType::Create(RSContext *Context,
       "Failed to retrieve the struct layout from Clang.");
 
   RSExportRecordType *ERT =
-      new RSExportRecordType(Context,
-                             TypeName,
-                             RD->hasAttr<clang::PackedAttr>(),
-                             mIsArtificial,
-                             RL->getSize().getQuantity());
+      new (Context) RSExportRecordType(Context,
+                                       TypeName,
+                                       RD->hasAttr<clang::PackedAttr>(),
+                                       mIsArtificial,
+                                       RL->getSize().getQuantity());
+  clang::PresumedLoc PLoc =
+      Context->getSourceManager()->getPresumedLoc(RD->getLocation());
+  if (PLoc.isValid())
+    ERT->mDefinitionFile = PLoc.getFilename();
   unsigned int Index = 0;
 
   for (clang::RecordDecl::field_iterator FI = RD->field_begin(),
@@ -1421,8 +1531,8 @@ RSExportRecordType *RSExportRecordType::Create(RSContext *Context,
 
     if (ET != NULL) {
       ERT->mFields.push_back(
-          new Field(ET, FD->getName(), ERT,
-                    static_cast<size_t>(RL->getFieldOffset(Index) >> 3)));
+          new (Context) Field(ET, FD->getName(), ERT,
+              static_cast<size_t>(RL->getFieldOffset(Index) >> 3)));
     } else {
       Context->ReportError(RD->getLocation(),
                            "field type cannot be exported: '%0.%1'")
@@ -1431,6 +1541,12 @@ RSExportRecordType *RSExportRecordType::Create(RSContext *Context,
     }
   }
 
+  for (const_field_iterator I = ERT->fields_begin(), E = ERT->fields_end();
+       I != E;
+       I++)
+    AppendRSObjectOffsets((*I)->getType(), (*I)->getOffsetInParent(),
+                          &ERT->mRSObjectOffsets);
+
   return ERT;
 }
 
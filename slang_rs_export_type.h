@@ -21,6 +21,7 @@
 #include <set>
 #include <string>
 #include <sstream>
+#include <vector>
 
 #include "clang/AST/Decl.h"
 #include "clang/AST/Type.h"
@@ -29,8 +30,6 @@
 #include "llvm/ADT/StringMap.h"
 #include "llvm/ADT/StringRef.h"
 
-#include "llvm/Support/ManagedStatic.h"
-
 #include "slang_rs_exportable.h"
 
 #define GET_CANONICAL_TYPE(T) \
@@ -200,6 +199,12 @@ class RSExportType : public RSExportable {
   // The size of allocation of specified RSExportType (alignment considered)
   static size_t GetTypeAllocSize(const RSExportType *ET);
 
+  // Describe ET (or NULL) by its layout and field names, such that the types
+  // with the same description are interchangeable for the reflection and the
+  // ODR. The pointee of a pointer is described by its name only, a record may
+  // point to itself.
+  static void Describe(std::ostream &OS, const RSExportType *ET);
+
   inline const std::string &getName() const { return mName; }
 
   virtual std::string getElementName() const {
@@ -250,11 +255,6 @@ class RSExportPrimitiveType : public RSExportType {
   DataType mType;
   bool mNormalized;
 
-  typedef llvm::StringMap<DataType> RSSpecificTypeMapTy;
-  static llvm::ManagedStatic<RSSpecificTypeMapTy> RSSpecificTypeMap;
-
-  static llvm::Type *RSObjectLLVMType;
-
   static const size_t SizeOfDataTypeInBits[];
   // @T was normalized by calling RSExportType::NormalizeType() before calling
   // this.
@@ -502,6 +502,18 @@ class RSExportRecordType : public RSExportType {
       return;
     }
 
+    // Fields are allocated from the context of their parent, just like the
+    // exportables
+    static void *operator new(size_t Size, RSContext *Context) {
+      return Context->allocateExportable(Size);
+    }
+    static void operator delete(void *P, RSContext *Context) {
+      RSContext::deallocateExportable(P);
+    }
+    static void operator delete(void *P) {
+      RSContext::deallocateExportable(P);
+    }
+
     inline const RSExportRecordType *getParent() const { return mParent; }
     inline const RSExportType *getType() const { return mType; }
     inline const std::string &getName() const { return mName; }
@@ -524,6 +536,11 @@ class RSExportRecordType : public RSExportType {
   // get reflected)
   bool mIsArtificial;
   size_t mAllocSize;
+  // The (presumed) file of the definition, which may be a header
+  std::string mDefinitionFile;
+  // The byte offset of each RS object in the struct, down to the ones in the
+  // arrays and the nested structs, in increasing order
+  std::vector<size_t> mRSObjectOffsets;
 
   RSExportRecordType(RSContext *Context,
                      const llvm::StringRef &Name,
@@ -554,6 +571,14 @@ class RSExportRecordType : public RSExportType {
   inline bool isPacked() const { return mIsPacked; }
   inline bool isArtificial() const { return mIsArtificial; }
   inline size_t getAllocSize() const { return mAllocSize; }
+  inline const std::string &getDefinitionFile() const {
+    return mDefinitionFile;
+  }
+  // What clearing the RS objects of an instance takes (see
+  // RS_OBJECT_OFFSETS_MN), empty if it holds none
+  inline const std::vector<size_t> &getRSObjectOffsets() const {
+    return mRSObjectOffsets;
+  }
 
   virtual std::string getElementName() const {
     return "ScriptField_" + getName();
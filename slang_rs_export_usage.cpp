@@ -0,0 +1,90 @@
+/*
+ * Copyright 2013, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "slang_rs_export_usage.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringExtras.h"
+
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/system_error.h"
+
+#include "slang_utils.h"
+
+namespace slang {
+
+bool RSExportUsage::read(const std::string &File, std::string *Error) {
+  llvm::OwningPtr<llvm::MemoryBuffer> MB;
+  llvm::error_code EC = llvm::MemoryBuffer::getFile(File, MB);
+  if (EC != llvm::errc::success) {
+    Error->assign(EC.message());
+    return false;
+  }
+
+  llvm::StringRef Rest = MB->getBuffer();
+  for (unsigned LineNo = 1; !Rest.empty(); LineNo++) {
+    std::pair<llvm::StringRef, llvm::StringRef> Line = Rest.split('\n');
+    Rest = Line.second;
+
+    llvm::StringRef Text = Line.first.trim();
+    if (Text.empty() || Text.startswith("#"))
+      continue;
+
+    llvm::SmallVector<llvm::StringRef, 2> Fields;
+    llvm::SplitString(Text, Fields);
+    if (Fields.size() != 2) {
+      Error->assign("malformed line " + llvm::utostr(LineNo) + ": '" +
+                    Text.str() + "'");
+      return false;
+    }
+    mScripts[Fields[0]].insert(Fields[1]);
+  }
+  return true;
+}
+
+const llvm::StringSet<> *
+RSExportUsage::getUsedExports(llvm::StringRef Script) const {
+  llvm::StringMap<llvm::StringSet<> >::const_iterator I = mScripts.find(Script);
+  if (I == mScripts.end())
+    return NULL;
+  return &I->getValue();
+}
+
+uint64_t RSExportUsage::getHash(llvm::StringRef Script) const {
+  const llvm::StringSet<> *Used = getUsedExports(Script);
+  if (Used == NULL)
+    return 0;
+
+  // A StringSet isn't iterated in any particular order.
+  std::vector<std::string> Names;
+  for (llvm::StringSet<>::const_iterator I = Used->begin(), E = Used->end();
+       I != E;
+       I++)
+    Names.push_back(I->getKey());
+  std::sort(Names.begin(), Names.end());
+
+  uint64_t Hash = SlangUtils::InitialHash;
+  for (unsigned i = 0, e = Names.size(); i != e; i++)
+    Hash = SlangUtils::UpdateHash(Hash, Names[i] + '\n');
+  return Hash;
+}
+
+}  // namespace slang
@@ -0,0 +1,59 @@
+/*
+ * Copyright 2013, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _FRAMEWORKS_COMPILE_SLANG_SLANG_RS_EXPORT_USAGE_H_  // NOLINT
+#define _FRAMEWORKS_COMPILE_SLANG_SLANG_RS_EXPORT_USAGE_H_
+
+#include <string>
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/Support/DataTypes.h"
+
+namespace slang {
+
+// The exports of the scripts the app actually uses (-export-usage), as found
+// by the build in its compiled classes. Each line of the manifest is
+//
+//   <script> <name>
+//
+// where <script> is the name of the .rs file without the extension (the one
+// of ScriptC_<script>) and <name> the exported variable, forEach kernel,
+// invokable or reduction kernel as declared in the script. The exports of a
+// listed script which aren't are internalized and not reflected. A script not
+// listed at all keeps all its exports. Empty lines and the ones starting with
+// '#' are skipped.
+class RSExportUsage {
+ private:
+  llvm::StringMap<llvm::StringSet<> > mScripts;
+
+ public:
+  // Returns false (with the reason in *Error) if File can't be read or has a
+  // malformed line.
+  bool read(const std::string &File, std::string *Error);
+
+  // The names used of Script, NULL if the manifest doesn't list it
+  const llvm::StringSet<> *getUsedExports(llvm::StringRef Script) const;
+
+  // The SlangUtils::UpdateHash() of the names used of Script (in order), for
+  // the compile cache. The entries of the other scripts don't matter.
+  uint64_t getHash(llvm::StringRef Script) const;
+};
+
+}  // namespace slang
+
+#endif  // _FRAMEWORKS_COMPILE_SLANG_SLANG_RS_EXPORT_USAGE_H_  NOLINT
@@ -107,4 +107,48 @@ RSExportVar::RSExportVar(RSContext *Context,
   return;
 }
 
+namespace {
+
+// Whether a value of type ET can be copied in as is, i.e. it holds no RS
+// object (reference counted) and no pointer, down to the fields of the
+// structs and the elements of the arrays.
+bool IsCopyableAsIs(const RSExportType *ET) {
+  switch (ET->getClass()) {
+    case RSExportType::ExportClassPrimitive: {
+      return !static_cast<const RSExportPrimitiveType*>(ET)->isRSObjectType();
+    }
+    case RSExportType::ExportClassPointer: {
+      return false;
+    }
+    case RSExportType::ExportClassConstantArray: {
+      return IsCopyableAsIs(
+          static_cast<const RSExportConstantArrayType*>(ET)->getElementType());
+    }
+    case RSExportType::ExportClassRecord: {
+      const RSExportRecordType *ERT =
+          static_cast<const RSExportRecordType*>(ET);
+      for (RSExportRecordType::const_field_iterator I = ERT->fields_begin(),
+               E = ERT->fields_end();
+           I != E;
+           I++) {
+        if (!IsCopyableAsIs((*I)->getType()))
+          return false;
+      }
+      return true;
+    }
+    default: {
+      return true;
+    }
+  }
+}
+
+}  // namespace
+
+bool RSExportVar::isBatchable() const {
+  if (mIsConst || (RSExportType::GetTypeAllocSize(mET) == 0))
+    return false;
+
+  return IsCopyableAsIs(mET);
+}
+
 }  // namespace slang
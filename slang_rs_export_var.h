@@ -57,6 +57,12 @@ class RSExportVar : public RSExportable {
 
   inline const clang::APValue &getInit() const { return mInit.Val; }
 
+  // Whether the variable can be set through the batch setter reflected with
+  // -reflect-var-batch (see RSContext::getVarBatchLayout()). Like set_*(), it
+  // copies the value in as is, so RS objects (reference counted) and pointers
+  // (bound instead of set) are out, as are the structs and arrays holding any.
+  bool isBatchable() const;
+
   inline size_t getArraySize() const { return mArraySize; }
   inline size_t getNumInits() const { return mNumInits; }
   inline const clang::APValue &getInitArray(unsigned int i) const {
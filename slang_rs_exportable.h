@@ -27,7 +27,8 @@ class RSExportable {
     EX_FUNC,
     EX_TYPE,
     EX_VAR,
-    EX_FOREACH
+    EX_FOREACH,
+    EX_REDUCE
   };
 
  private:
@@ -49,6 +50,7 @@ class RSExportable {
   // When keep() is invoked, mKeep will set to true and the associated RSContext
   // won't free this RSExportable object in its destructor. The deallcation
   // responsibility is then transferred to the object who invoked this function.
+  // The memory of the context's arena stays around until that happens.
   // Return false if the exportable is kept or failed to keep.
   virtual bool keep();
   inline bool isKeep() const { return (mContext == NULL); }
@@ -57,6 +59,18 @@ class RSExportable {
 
   inline RSContext *getRSContext() const { return mContext; }
 
+  // Exportables are allocated from their context, i.e., with
+  // new (Context) RSExportXXX(Context, ...).
+  static void *operator new(size_t Size, RSContext *Context) {
+    return Context->allocateExportable(Size);
+  }
+  static void operator delete(void *P, RSContext *Context) {
+    RSContext::deallocateExportable(P);
+  }
+  static void operator delete(void *P) {
+    RSContext::deallocateExportable(P);
+  }
+
   virtual ~RSExportable() { }
 };
 }  // namespace slang
@@ -25,12 +25,74 @@
 #define RS_EXPORT_FUNC_MN "#rs_export_func"
 #define RS_EXPORT_FUNC_NAME 0
 
+// The exported function synthesized to set the batchable exported variables
+// at once (-reflect-var-batch), always the last one in RS_EXPORT_FUNC_MN
+#define RS_VAR_BATCH_FUNC_NAME ".rs.set_vars_batch"
+
+// The exported (int64_t *) variable synthesized for the counters of the
+// instrumented kernels and invokables (-instrument-kernels), always the last
+// one in RS_EXPORT_VAR_MN. The reflected class binds it, and the counters of
+// the Nth function of RSContext::getProfiledFunctions() are at 2N (calls) and
+// 2N + 1 (time in nanoseconds).
+#define RS_PROFILE_COUNTERS_VAR_NAME ".rs.profile_counters"
+
 #define RS_EXPORT_TYPE_MN "#rs_export_type"
 
 #define RS_OBJECT_SLOTS_MN "#rs_object_slots"
 
+// The RS objects of the exported struct types holding some, one entry per
+// type: its name followed by the byte offset of each object (down to the
+// ones in the arrays and the nested structs), such that the runtime clears
+// them in a loop rather than by walking the fields. Not in the compact
+// metadata.
+#define RS_OBJECT_OFFSETS_MN "#rs_object_offsets"
+#define RS_OBJECT_OFFSETS_TYPE_NAME 0
+#define RS_OBJECT_OFFSETS_FIRST 1
+
 #define RS_EXPORT_FOREACH_NAME_MN "#rs_export_foreach_name"
 
 #define RS_EXPORT_FOREACH_MN "#rs_export_foreach"
 
+// Appended to the name of a forEach kernel for its variant specialized on the
+// variables frozen by #pragma rs specialize
+#define RS_SPECIALIZED_KERNEL_SUFFIX ".specialized"
+
+// The widened variants of the elementwise kernels (-widen-kernels), one entry
+// per variant. The variant of kernel K is K RS_WIDENED_KERNEL_SUFFIX, taking
+// (const T *in, T *out, uint32_t x, uint32_t y) and computing the cells x to
+// x + width - 1 of row y.
+#define RS_EXPORT_FOREACH_WIDENED_MN "#rs_export_foreach_widened"
+#define RS_EXPORT_FOREACH_WIDENED_NAME 0
+#define RS_EXPORT_FOREACH_WIDENED_WIDTH 1
+
+#define RS_WIDENED_KERNEL_SUFFIX ".widened"
+
+// The reduction kernels (#pragma rs reduce), one entry per kernel, with the
+// names of its functions (a null operand for those not given). Always in
+// this format, also with the compact metadata.
+#define RS_EXPORT_REDUCE_MN "#rs_export_reduce"
+#define RS_EXPORT_REDUCE_NAME 0
+#define RS_EXPORT_REDUCE_ACCUM_SIZE 1
+#define RS_EXPORT_REDUCE_ACCUMULATOR 2
+#define RS_EXPORT_REDUCE_INITIALIZER 3
+#define RS_EXPORT_REDUCE_COMBINER 4
+#define RS_EXPORT_REDUCE_OUTCONVERTER 5
+
+// The globals each forEach kernel (but a dummy root) and invokable reads and
+// writes (-export-access-sets), one entry per function: its name, "1" if
+// the sets are complete ("0" if it may access other memory too, e.g. through
+// the runtime), then a node of the names of the globals it reads and one of
+// those it writes. The kernels whose sets are complete and don't write what
+// the other reads or writes can run at once. Always in this format, also with
+// the compact metadata.
+#define RS_EXPORT_ACCESS_MN "#rs_export_access"
+#define RS_EXPORT_ACCESS_NAME 0
+#define RS_EXPORT_ACCESS_COMPLETE 1
+#define RS_EXPORT_ACCESS_READS 2
+#define RS_EXPORT_ACCESS_WRITES 3
+
+// Prepended to the name of a pointer variable in the access sets for the
+// allocation bound to it (rather than the variable itself)
+#define RS_BOUND_ALLOCATION_PREFIX "*"
+
 #endif  // _FRAMEWORKS_COMPILE_SLANG_SLANG_RS_METADATA_H_  NOLINT
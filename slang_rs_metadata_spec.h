@@ -33,6 +33,13 @@
 //
 // 5. RSVar => an string table index plus RSType array index
 // 6. RSFunction => an string table index
+// 7. RSForEach => an string table index plus its signature
+// 8. The object slots => a single array of the indices of the RS object
+//    variables
+//
+// This is the compact format of the export info (-metadata-format compact).
+// It's told apart from the verbose one (see slang_rs_metadata.h) by the
+// presence of the string table.
 
 namespace llvm {
   class Module;
@@ -50,6 +57,11 @@ struct RSFunction {
   const char *name;  // function name
 };
 
+struct RSForEach {
+  const char *name;  // kernel name
+  unsigned signature;  // as in the verbose #rs_export_foreach
+};
+
 // Opaque pointer
 typedef int RSMetadataEncoder;
 
@@ -60,6 +72,14 @@ RSMetadataEncoder *CreateRSMetadataEncoder(llvm::Module *M);
 int RSEncodeVarMetadata(RSMetadataEncoder *E, const RSVar *V);
 // Encode F as a metadata in M. Return 0 if every thing goes well.
 int RSEncodeFunctionMetadata(RSMetadataEncoder *E, const RSFunction *F);
+// Encode F (a forEach kernel) as a metadata in M. Return 0 if every thing goes
+// well.
+int RSEncodeForEachMetadata(RSMetadataEncoder *E, const RSForEach *F);
+// Encode T as an exported type in M. Return 0 if every thing goes well.
+int RSEncodeTypeMetadata(RSMetadataEncoder *E, const union RSType *T);
+// Record the variable at index Slot (in the order of RSEncodeVarMetadata())
+// as an RS object. Return 0 if every thing goes well.
+int RSEncodeObjectSlotMetadata(RSMetadataEncoder *E, unsigned Slot);
 
 // Release the memory allocation of Encoder without flushing things.
 void DestroyRSMetadataEncoder(RSMetadataEncoder *E);
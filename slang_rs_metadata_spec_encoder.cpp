@@ -22,10 +22,11 @@
 #include <string>
 
 #include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringMap.h"
 #include "llvm/ADT/StringRef.h"
 
-#include "llvm/Metadata.h"
-#include "llvm/Module.h"
+#include "llvm/IR/Metadata.h"
+#include "llvm/IR/Module.h"
 
 #include "slang_assert.h"
 #include "slang_rs_type_spec.h"
@@ -34,6 +35,9 @@
 #define RS_TYPE_INFO_MN         "#rs_type_info"
 #define RS_EXPORT_VAR_MN        "#rs_export_var"
 #define RS_EXPORT_FUNC_MN       "#rs_export_func"
+#define RS_EXPORT_FOREACH_MN    "#rs_export_foreach"
+#define RS_EXPORT_TYPE_MN       "#rs_export_type"
+#define RS_OBJECT_SLOTS_MN      "#rs_object_slots"
 #define RS_EXPORT_RECORD_TYPE_NAME_MN_PREFIX  "%"
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -69,13 +73,22 @@ class RSMetadataEncoderInternal {
   typedef std::map</* name */std::string, unsigned/* index */> RecordTypesMapTy;
   RecordTypesMapTy mRecordTypes;
 
-  typedef std::map<std::string, unsigned/* index */> StringsMapTy;
+  // The interned strings, whose keys live in the allocator of the map. Each
+  // is appended to mStringTable (with its '\0') and gets its offset there in
+  // mStringOffsets when it's first joined, such that the tables are flushed
+  // as they are.
+  typedef llvm::StringMap<unsigned/* index */> StringsMapTy;
   StringsMapTy mStrings;
-  std::list<const char*> mEncodedStrings;
+  llvm::SmallVector<char, 256> mStringTable;
+  llvm::SmallVector<unsigned, 32> mStringOffsets;
   unsigned mCurStringIndex;
 
   llvm::NamedMDNode *mVarInfoMetadata;
   llvm::NamedMDNode *mFuncInfoMetadata;
+  llvm::NamedMDNode *mForEachInfoMetadata;
+  llvm::NamedMDNode *mTypeInfoMetadata;
+
+  std::list<unsigned> mObjectSlots;
 
   // This function check the return value of function:
   //   joinString, encodeTypeBase, encode*Type(), encodeRSType, encodeRSVar,
@@ -88,7 +101,7 @@ class RSMetadataEncoderInternal {
     return true;
   }
 
-  unsigned joinString(const std::string &S);
+  unsigned joinString(llvm::StringRef S);
 
   unsigned encodeTypeBase(const struct RSTypeBase *Base);
   unsigned encodeTypeBaseAsKey(const struct RSTypeBase *Base);
@@ -101,12 +114,16 @@ RS_DATA_TYPE_CLASS_ENUMS
 
   int flushStringTable();
   int flushTypeInfo();
+  int flushObjectSlots();
 
  public:
   explicit RSMetadataEncoderInternal(llvm::Module *M);
 
   int encodeRSVar(const RSVar *V);
   int encodeRSFunc(const RSFunction *F);
+  int encodeRSForEach(const RSForEach *F);
+  int encodeRSExportType(const union RSType *T);
+  int encodeRSObjectSlot(unsigned Slot);
 
   int finalize();
 };
@@ -118,7 +135,9 @@ RSMetadataEncoderInternal::RSMetadataEncoderInternal(llvm::Module *M)
       mCurTypeIndex(0),
       mCurStringIndex(0),
       mVarInfoMetadata(NULL),
-      mFuncInfoMetadata(NULL) {
+      mFuncInfoMetadata(NULL),
+      mForEachInfoMetadata(NULL),
+      mTypeInfoMetadata(NULL) {
   mTypes.clear();
   mEncodedRSTypeInfo.clear();
   mRecordTypes.clear();
@@ -129,25 +148,24 @@ RSMetadataEncoderInternal::RSMetadataEncoderInternal(llvm::Module *M)
 
 // Return (StringIndex + 1) when successfully join the string and 0 if there's
 // any error.
-unsigned RSMetadataEncoderInternal::joinString(const std::string &S) {
-  StringsMapTy::const_iterator I = mStrings.find(S);
-
-  if (I != mStrings.end())
-    return (I->second + 1);
-
-  // Add S into mStrings
-  std::pair<StringsMapTy::iterator, bool> Res =
-      mStrings.insert(std::make_pair(S, mCurStringIndex));
-  // Insertion failed
-  if (!Res.second)
+unsigned RSMetadataEncoderInternal::joinString(llvm::StringRef S) {
+  // A '\0' would cut the string short in the table.
+  if (S.find('\0') != llvm::StringRef::npos)
     return 0;
 
-  // Add S into mEncodedStrings
-  mEncodedStrings.push_back(Res.first->first.c_str());
+  unsigned NumStrings = mStrings.size();
+  StringsMapTy::MapEntryTy &Entry =
+      mStrings.GetOrCreateValue(S, mCurStringIndex);
+  if (mStrings.size() == NumStrings)
+    return (Entry.getValue() + 1);
+
+  mStringOffsets.push_back(mStringTable.size());
+  mStringTable.append(S.begin(), S.end());
+  mStringTable.push_back('\0');
   mCurStringIndex++;
 
   // Return (StringIndex + 1)
-  return (Res.first->second + 1);
+  return (Entry.getValue() + 1);
 }
 
 unsigned
@@ -237,7 +255,7 @@ unsigned RSMetadataEncoderInternal::encodeRecordType(const union RSType *T) {
   mEncodedRSTypeInfo.push_back(RecordName);
 
   // Add this record type into the map
-  std::pair<StringsMapTy::iterator, bool> Res =
+  std::pair<RecordTypesMapTy::iterator, bool> Res =
       mRecordTypes.insert(std::make_pair(RecordInfoMetadataName, Base));
   // Insertion failed
   if (!Res.second)
@@ -314,6 +332,9 @@ int RSMetadataEncoderInternal::encodeRSVar(const RSVar *V) {
 
   // 2. type
   unsigned Type = encodeRSType(V->type);
+  if (!checkReturnIndex(&Type)) {
+    return -5;
+  }
 
   llvm::SmallVector<llvm::Value*, 1> VarInfo;
 
@@ -359,9 +380,70 @@ int RSMetadataEncoderInternal::encodeRSFunc(const RSFunction *F) {
   return 0;
 }
 
+int RSMetadataEncoderInternal::encodeRSForEach(const RSForEach *F) {
+  // check parameter
+  if ((F == NULL) || (F->name == NULL)) {
+    return -1;
+  }
+
+  // 1. kernel name
+  unsigned ForEachName = joinString(F->name);
+  if (!checkReturnIndex(&ForEachName)) {
+    return -2;
+  }
+
+  llvm::SmallVector<llvm::Value*, 2> ForEachInfo;
+  if (!EncodeInteger(mModule->getContext(), ForEachName, ForEachInfo)) {
+    return -3;
+  }
+  // 2. signature
+  if (!EncodeInteger(mModule->getContext(), F->signature, ForEachInfo)) {
+    return -4;
+  }
+
+  if (mForEachInfoMetadata == NULL)
+    mForEachInfoMetadata =
+        mModule->getOrInsertNamedMetadata(RS_EXPORT_FOREACH_MN);
+
+  mForEachInfoMetadata->addOperand(llvm::MDNode::get(mModule->getContext(),
+                                                     ForEachInfo));
+
+  return 0;
+}
+
+int RSMetadataEncoderInternal::encodeRSExportType(const union RSType *T) {
+  // check parameter
+  if (T == NULL) {
+    return -1;
+  }
+
+  unsigned Type = encodeRSType(T);
+  if (!checkReturnIndex(&Type)) {
+    return -2;
+  }
+
+  llvm::SmallVector<llvm::Value*, 1> TypeInfo;
+  if (!EncodeInteger(mModule->getContext(), Type, TypeInfo)) {
+    return -3;
+  }
+
+  if (mTypeInfoMetadata == NULL)
+    mTypeInfoMetadata = mModule->getOrInsertNamedMetadata(RS_EXPORT_TYPE_MN);
+
+  mTypeInfoMetadata->addOperand(llvm::MDNode::get(mModule->getContext(),
+                                                  TypeInfo));
+
+  return 0;
+}
+
+int RSMetadataEncoderInternal::encodeRSObjectSlot(unsigned Slot) {
+  mObjectSlots.push_back(Slot);
+  return 0;
+}
+
 // Write string table and string index table
 int RSMetadataEncoderInternal::flushStringTable() {
-  slangAssert((mCurStringIndex == mEncodedStrings.size()));
+  slangAssert((mCurStringIndex == mStringOffsets.size()));
   slangAssert((mCurStringIndex == mStrings.size()));
 
   if (mCurStringIndex == 0)
@@ -372,49 +454,11 @@ int RSMetadataEncoderInternal::flushStringTable() {
       mModule->getOrInsertNamedMetadata(RS_METADATA_STRTAB_MN);
   RSMetadataStrTab->dropAllReferences();
 
-  unsigned StrTabSize = 0;
-  unsigned *StrIdx = reinterpret_cast<unsigned*>(
-                        ::malloc((mStrings.size() + 1) * sizeof(unsigned)));
-
-  if (StrIdx == NULL)
-    return -1;
-
-  unsigned StrIdxI = 0;  // iterator for array StrIdx
-
-  // count StrTabSize and fill StrIdx by the way
-  for (std::list<const char*>::const_iterator I = mEncodedStrings.begin(),
-          E = mEncodedStrings.end();
-       I != E;
-       I++) {
-    StrIdx[StrIdxI++] = StrTabSize;
-    StrTabSize += ::strlen(*I) + 1 /* for '\0' */;
-  }
-  StrIdx[StrIdxI] = StrTabSize;
-
-  // Allocate
-  char *StrTab = reinterpret_cast<char*>(::malloc(StrTabSize));
-  if (StrTab == NULL) {
-    free(StrIdx);
-    return -1;
-  }
-
-  llvm::StringRef StrTabData(StrTab, StrTabSize);
-  llvm::StringRef StrIdxData(reinterpret_cast<const char*>(StrIdx),
-                             mStrings.size() * sizeof(unsigned));
-
-  // Copy
-  StrIdxI = 1;
-  for (std::list<const char*>::const_iterator I = mEncodedStrings.begin(),
-          E = mEncodedStrings.end();
-       I != E;
-       I++) {
-    // Get string length from StrIdx (O(1)) instead of call strlen again (O(n)).
-    unsigned CurStrLength = StrIdx[StrIdxI] - StrIdx[StrIdxI - 1];
-    ::memcpy(StrTab, *I, CurStrLength);
-    // Move forward the pointer
-    StrTab += CurStrLength;
-    StrIdxI++;
-  }
+  // Both are laid out as they're flushed already, so they're copied once.
+  llvm::StringRef StrTabData(mStringTable.data(), mStringTable.size());
+  llvm::StringRef StrIdxData(
+      reinterpret_cast<const char*>(mStringOffsets.data()),
+      mStringOffsets.size() * sizeof(unsigned));
 
   // Flush to metadata
   llvm::Value *StrTabMDS =
@@ -422,11 +466,8 @@ int RSMetadataEncoderInternal::flushStringTable() {
   llvm::Value *StrIdxMDS =
       llvm::MDString::get(mModule->getContext(), StrIdxData);
 
-  if ((StrTabMDS == NULL) || (StrIdxMDS == NULL)) {
-    free(StrIdx);
-    free(StrTab);
+  if ((StrTabMDS == NULL) || (StrIdxMDS == NULL))
     return -1;
-  }
 
   llvm::SmallVector<llvm::Value*, 2> StrTabVal;
   StrTabVal.push_back(StrTabMDS);
@@ -480,6 +521,29 @@ int RSMetadataEncoderInternal::flushTypeInfo() {
   return 0;
 }
 
+// Write the object slots as a single array
+int RSMetadataEncoderInternal::flushObjectSlots() {
+  if (mObjectSlots.empty())
+    return 0;
+
+  llvm::SmallVector<unsigned, 8> Slots(mObjectSlots.begin(),
+                                       mObjectSlots.end());
+  llvm::StringRef SlotsData(reinterpret_cast<const char*>(Slots.data()),
+                            Slots.size() * sizeof(unsigned));
+  llvm::Value *SlotsMDS = llvm::MDString::get(mModule->getContext(),
+                                              SlotsData);
+  if (SlotsMDS == NULL)
+    return -1;
+
+  llvm::NamedMDNode *RSObjectSlots =
+      mModule->getOrInsertNamedMetadata(RS_OBJECT_SLOTS_MN);
+  RSObjectSlots->dropAllReferences();
+  RSObjectSlots->addOperand(llvm::MDNode::get(mModule->getContext(),
+                                              SlotsMDS));
+
+  return 0;
+}
+
 int RSMetadataEncoderInternal::finalize() {
   int Res = flushStringTable();
   if (Res != 0)
@@ -489,6 +553,10 @@ int RSMetadataEncoderInternal::finalize() {
   if (Res != 0)
     return Res;
 
+  Res = flushObjectSlots();
+  if (Res != 0)
+    return Res;
+
   return 0;
 }
 
@@ -507,6 +575,19 @@ int RSEncodeFunctionMetadata(RSMetadataEncoder *E, const RSFunction *F) {
   return reinterpret_cast<RSMetadataEncoderInternal*>(E)->encodeRSFunc(F);
 }
 
+int RSEncodeForEachMetadata(RSMetadataEncoder *E, const RSForEach *F) {
+  return reinterpret_cast<RSMetadataEncoderInternal*>(E)->encodeRSForEach(F);
+}
+
+int RSEncodeTypeMetadata(RSMetadataEncoder *E, const union RSType *T) {
+  return reinterpret_cast<RSMetadataEncoderInternal*>(E)->encodeRSExportType(T);
+}
+
+int RSEncodeObjectSlotMetadata(RSMetadataEncoder *E, unsigned Slot) {
+  return
+      reinterpret_cast<RSMetadataEncoderInternal*>(E)->encodeRSObjectSlot(Slot);
+}
+
 void DestroyRSMetadataEncoder(RSMetadataEncoder *E) {
   RSMetadataEncoderInternal *C =
       reinterpret_cast<RSMetadataEncoderInternal*>(E);
@@ -17,6 +17,9 @@
 #include "slang_rs_object_ref_count.h"
 
 #include <list>
+#include <map>
+#include <set>
+#include <vector>
 
 #include "clang/AST/DeclGroup.h"
 #include "clang/AST/Expr.h"
@@ -25,9 +28,10 @@
 #include "clang/AST/Stmt.h"
 #include "clang/AST/StmtVisitor.h"
 
+#include "llvm/ADT/StringExtras.h"
+
 #include "slang_assert.h"
 #include "slang_rs.h"
-#include "slang_rs_ast_replace.h"
 #include "slang_rs_export_type.h"
 
 namespace slang {
@@ -114,254 +118,114 @@ static clang::CompoundStmt* BuildCompoundStmt(clang::ASTContext &C,
   return CS;
 }
 
-static void AppendAfterStmt(clang::ASTContext &C,
-                            clang::CompoundStmt *CS,
-                            clang::Stmt *S,
-                            std::list<clang::Stmt*> &StmtList) {
-  slangAssert(CS);
-  clang::CompoundStmt::body_iterator bI = CS->body_begin();
-  clang::CompoundStmt::body_iterator bE = CS->body_end();
-  clang::Stmt **UpdatedStmtList =
-      new clang::Stmt*[CS->size() + StmtList.size()];
-
-  unsigned UpdatedStmtCount = 0;
-  unsigned Once = 0;
-  for ( ; bI != bE; bI++) {
-    if (!S && ((*bI)->getStmtClass() == clang::Stmt::ReturnStmtClass)) {
-      // If we come across a return here, we don't have anything we can
-      // reasonably replace. We should have already inserted our destructor
-      // code in the proper spot, so we just clean up and return.
-      delete [] UpdatedStmtList;
-
-      return;
-    }
-
-    UpdatedStmtList[UpdatedStmtCount++] = *bI;
-
-    if ((*bI == S) && !Once) {
-      Once++;
-      std::list<clang::Stmt*>::const_iterator I = StmtList.begin();
-      std::list<clang::Stmt*>::const_iterator E = StmtList.end();
-      for ( ; I != E; I++) {
-        UpdatedStmtList[UpdatedStmtCount++] = *I;
-      }
-    }
-  }
-  slangAssert(Once <= 1);
-
-  // When S is NULL, we are appending to the end of the CompoundStmt.
-  if (!S) {
-    slangAssert(Once == 0);
-    std::list<clang::Stmt*>::const_iterator I = StmtList.begin();
-    std::list<clang::Stmt*>::const_iterator E = StmtList.end();
-    for ( ; I != E; I++) {
-      UpdatedStmtList[UpdatedStmtCount++] = *I;
+// Return the variable the lvalue E is (a part of), or NULL if E is reached
+// through a pointer.
+static const clang::VarDecl *GetLValueVar(clang::Expr *E) {
+  while (true) {
+    E = E->IgnoreParens();
+    if (clang::DeclRefExpr *DRE = llvm::dyn_cast<clang::DeclRefExpr>(E))
+      return llvm::dyn_cast<clang::VarDecl>(DRE->getDecl());
+
+    if (clang::MemberExpr *ME = llvm::dyn_cast<clang::MemberExpr>(E)) {
+      if (ME->isArrow())
+        return NULL;
+      E = ME->getBase();
+    } else if (clang::ExtVectorElementExpr *EVE =
+                   llvm::dyn_cast<clang::ExtVectorElementExpr>(E)) {
+      if (EVE->isArrow())
+        return NULL;
+      E = EVE->getBase();
+    } else if (clang::ArraySubscriptExpr *ASE =
+                   llvm::dyn_cast<clang::ArraySubscriptExpr>(E)) {
+      // An element of an array variable, rather than of a pointer
+      clang::ImplicitCastExpr *ICE =
+          llvm::dyn_cast<clang::ImplicitCastExpr>(ASE->getBase());
+      if ((ICE == NULL) || (ICE->getCastKind() != clang::CK_ArrayToPointerDecay))
+        return NULL;
+      E = ICE->getSubExpr();
+    } else {
+      return NULL;
     }
   }
-
-  CS->setStmts(C, UpdatedStmtList, UpdatedStmtCount);
-
-  delete [] UpdatedStmtList;
-
-  return;
 }
 
-// This class visits a compound statement and inserts DtorStmt
-// in proper locations. This includes inserting it before any
-// return statement in any sub-block, at the end of the logical enclosing
-// scope (compound statement), and/or before any break/continue statement that
-// would resume outside the declared scope. We will not handle the case for
-// goto statements that leave a local scope.
-//
-// To accomplish these goals, it collects a list of sub-Stmt's that
-// correspond to scope exit points. It then uses an RSASTReplace visitor to
-// transform the AST, inserting appropriate destructors before each of those
-// sub-Stmt's (and also before the exit of the outermost containing Stmt for
-// the scope).
-class DestructorVisitor : public clang::StmtVisitor<DestructorVisitor> {
+// This class finds the variables a function modifies (i.e., assigns or takes
+// the address of) and whether it may modify any other variable, i.e., it
+// writes through a pointer (which may hold the address of a global taken
+// anywhere else) or calls any function other than the ones of the RS runtime.
+class RSObjectUsageVisitor : public clang::StmtVisitor<RSObjectUsageVisitor> {
  private:
-  clang::ASTContext &mCtx;
-
-  // The loop depth of the currently visited node.
-  int mLoopDepth;
-
-  // The switch statement depth of the currently visited node.
-  // Note that this is tracked separately from the loop depth because
-  // SwitchStmt-contained ContinueStmt's should have destructors for the
-  // corresponding loop scope.
-  int mSwitchDepth;
-
-  // The outermost statement block that we are currently visiting.
-  // This should always be a CompoundStmt.
-  clang::Stmt *mOuterStmt;
-
-  // The destructor to execute for this scope/variable.
-  clang::Stmt* mDtorStmt;
-
-  // The stack of statements which should be replaced by a compound statement
-  // containing the new destructor call followed by the original Stmt.
-  std::stack<clang::Stmt*> mReplaceStmtStack;
-
-  // The source location for the variable declaration that we are trying to
-  // insert destructors for. Note that InsertDestructors() will not generate
-  // destructor calls for source locations that occur lexically before this
-  // location.
-  clang::SourceLocation mVarLoc;
+  clang::SourceManager &mSM;
+  std::set<const clang::VarDecl*> &mModifiedVars;
+  bool &mMayModifyAnyVar;
+
+  void markModified(clang::Expr *E) {
+    const clang::VarDecl *VD = GetLValueVar(E);
+    if (VD != NULL)
+      mModifiedVars.insert(VD);
+    else
+      mMayModifyAnyVar = true;
+    return;
+  }
 
  public:
-  DestructorVisitor(clang::ASTContext &C,
-                    clang::Stmt* OuterStmt,
-                    clang::Stmt* DtorStmt,
-                    clang::SourceLocation VarLoc);
-
-  // This code walks the collected list of Stmts to replace and actually does
-  // the replacement. It also finishes up by appending the destructor to the
-  // current outermost CompoundStmt.
-  void InsertDestructors() {
-    clang::Stmt *S = NULL;
-    clang::SourceManager &SM = mCtx.getSourceManager();
-    std::list<clang::Stmt *> StmtList;
-    StmtList.push_back(mDtorStmt);
-
-    while (!mReplaceStmtStack.empty()) {
-      S = mReplaceStmtStack.top();
-      mReplaceStmtStack.pop();
-
-      // Skip all source locations that occur before the variable's
-      // declaration, since it won't have been initialized yet.
-      if (SM.isBeforeInTranslationUnit(S->getLocStart(), mVarLoc)) {
-        continue;
-      }
-
-      StmtList.push_back(S);
-      clang::CompoundStmt *CS =
-          BuildCompoundStmt(mCtx, StmtList, S->getLocEnd());
-      StmtList.pop_back();
-
-      RSASTReplace R(mCtx);
-      R.ReplaceStmt(mOuterStmt, S, CS);
-    }
-    clang::CompoundStmt *CS =
-      llvm::dyn_cast<clang::CompoundStmt>(mOuterStmt);
-    slangAssert(CS);
-    AppendAfterStmt(mCtx, CS, NULL, StmtList);
+  RSObjectUsageVisitor(clang::SourceManager &SM,
+                       std::set<const clang::VarDecl*> &ModifiedVars,
+                       bool &MayModifyAnyVar)
+      : mSM(SM),
+        mModifiedVars(ModifiedVars),
+        mMayModifyAnyVar(MayModifyAnyVar) {
+    return;
   }
 
-  void VisitStmt(clang::Stmt *S);
-  void VisitCompoundStmt(clang::CompoundStmt *CS);
-
-  void VisitBreakStmt(clang::BreakStmt *BS);
-  void VisitCaseStmt(clang::CaseStmt *CS);
-  void VisitContinueStmt(clang::ContinueStmt *CS);
-  void VisitDefaultStmt(clang::DefaultStmt *DS);
-  void VisitDoStmt(clang::DoStmt *DS);
-  void VisitForStmt(clang::ForStmt *FS);
-  void VisitIfStmt(clang::IfStmt *IS);
-  void VisitReturnStmt(clang::ReturnStmt *RS);
-  void VisitSwitchCase(clang::SwitchCase *SC);
-  void VisitSwitchStmt(clang::SwitchStmt *SS);
-  void VisitWhileStmt(clang::WhileStmt *WS);
-};
-
-DestructorVisitor::DestructorVisitor(clang::ASTContext &C,
-                         clang::Stmt *OuterStmt,
-                         clang::Stmt *DtorStmt,
-                         clang::SourceLocation VarLoc)
-  : mCtx(C),
-    mLoopDepth(0),
-    mSwitchDepth(0),
-    mOuterStmt(OuterStmt),
-    mDtorStmt(DtorStmt),
-    mVarLoc(VarLoc) {
-  return;
-}
-
-void DestructorVisitor::VisitStmt(clang::Stmt *S) {
-  for (clang::Stmt::child_iterator I = S->child_begin(), E = S->child_end();
-       I != E;
-       I++) {
-    if (clang::Stmt *Child = *I) {
-      Visit(Child);
+  void VisitStmt(clang::Stmt *S) {
+    for (clang::Stmt::child_iterator I = S->child_begin(), E = S->child_end();
+         I != E;
+         I++) {
+      if (clang::Stmt *Child = *I) {
+        Visit(Child);
+      }
     }
+    return;
   }
-  return;
-}
-
-void DestructorVisitor::VisitCompoundStmt(clang::CompoundStmt *CS) {
-  VisitStmt(CS);
-  return;
-}
 
-void DestructorVisitor::VisitBreakStmt(clang::BreakStmt *BS) {
-  VisitStmt(BS);
-  if ((mLoopDepth == 0) && (mSwitchDepth == 0)) {
-    mReplaceStmtStack.push(BS);
+  void VisitBinaryOperator(clang::BinaryOperator *BO) {
+    if (BO->isAssignmentOp())
+      markModified(BO->getLHS());
+    VisitStmt(BO);
+    return;
   }
-  return;
-}
-
-void DestructorVisitor::VisitCaseStmt(clang::CaseStmt *CS) {
-  VisitStmt(CS);
-  return;
-}
 
-void DestructorVisitor::VisitContinueStmt(clang::ContinueStmt *CS) {
-  VisitStmt(CS);
-  if (mLoopDepth == 0) {
-    // Switch statements can have nested continues.
-    mReplaceStmtStack.push(CS);
+  void VisitUnaryOperator(clang::UnaryOperator *UO) {
+    if ((UO->getOpcode() == clang::UO_AddrOf) || UO->isIncrementDecrementOp())
+      markModified(UO->getSubExpr());
+    VisitStmt(UO);
+    return;
   }
-  return;
-}
-
-void DestructorVisitor::VisitDefaultStmt(clang::DefaultStmt *DS) {
-  VisitStmt(DS);
-  return;
-}
-
-void DestructorVisitor::VisitDoStmt(clang::DoStmt *DS) {
-  mLoopDepth++;
-  VisitStmt(DS);
-  mLoopDepth--;
-  return;
-}
 
-void DestructorVisitor::VisitForStmt(clang::ForStmt *FS) {
-  mLoopDepth++;
-  VisitStmt(FS);
-  mLoopDepth--;
-  return;
-}
-
-void DestructorVisitor::VisitIfStmt(clang::IfStmt *IS) {
-  VisitStmt(IS);
-  return;
-}
-
-void DestructorVisitor::VisitReturnStmt(clang::ReturnStmt *RS) {
-  mReplaceStmtStack.push(RS);
-  return;
-}
-
-void DestructorVisitor::VisitSwitchCase(clang::SwitchCase *SC) {
-  slangAssert(false && "Both case and default have specialized handlers");
-  VisitStmt(SC);
-  return;
-}
-
-void DestructorVisitor::VisitSwitchStmt(clang::SwitchStmt *SS) {
-  mSwitchDepth++;
-  VisitStmt(SS);
-  mSwitchDepth--;
-  return;
-}
-
-void DestructorVisitor::VisitWhileStmt(clang::WhileStmt *WS) {
-  mLoopDepth++;
-  VisitStmt(WS);
-  mLoopDepth--;
-  return;
-}
+  void VisitCallExpr(clang::CallExpr *CE) {
+    // Kernels launched by rsForEach() may modify globals of this script.
+    const clang::FunctionDecl *FD = CE->getDirectCallee();
+    if ((FD == NULL) ||
+        !SlangRS::IsLocInRSHeaderFile(FD->getLocation(), mSM) ||
+        FD->getName().startswith("rsForEach"))
+      mMayModifyAnyVar = true;
+
+    // The runtime writes through the pointers it's passed (e.g., the one of
+    // rsSetObject()), the addresses taken here are already marked.
+    for (unsigned i = 0, e = CE->getNumArgs(); i != e; i++) {
+      clang::Expr *Arg = CE->getArg(i)->IgnoreParenImpCasts();
+      const clang::PointerType *PT =
+          CE->getArg(i)->getType()->getAs<clang::PointerType>();
+      clang::UnaryOperator *UO = llvm::dyn_cast<clang::UnaryOperator>(Arg);
+      if ((PT != NULL) && !PT->getPointeeType().isConstQualified() &&
+          ((UO == NULL) || (UO->getOpcode() != clang::UO_AddrOf)))
+        mMayModifyAnyVar = true;
+    }
+    VisitStmt(CE);
+    return;
+  }
+};
 
 clang::Expr *ClearSingleRSObject(clang::ASTContext &C,
                                  clang::Expr *RefRSVar,
@@ -429,6 +293,49 @@ clang::Expr *ClearSingleRSObject(clang::ASTContext &C,
   return RSClearObjectCall;
 }
 
+// Same as ClearSingleRSObject(), but only calls into the runtime if the object
+// is set, i.e., for the common case of a (partially) empty array or struct.
+static clang::Stmt *ClearSingleRSObjectIfSet(clang::ASTContext &C,
+                                             clang::Expr *RefRSVar,
+                                             clang::SourceLocation Loc) {
+  // (IfStmt
+  //   (ImplicitCastExpr 'const int *' <LValueToRValue>
+  //     (MemberExpr 'const int *const' .p
+  //       (DeclRefExpr 'rs_font':'rs_font' Var='localFont')))
+  //   (CallExpr 'void' ... rsClearObject(&localFont)))
+  const clang::Type *T = RefRSVar->getType().getTypePtr();
+  clang::RecordDecl *RD = T->getAsStructureType()->getDecl()->getDefinition();
+  slangAssert((RD != NULL) && !RD->field_empty() &&
+              "RS object types should be structs holding the handle first");
+  clang::FieldDecl *HandleFD = *RD->field_begin();
+
+  clang::MemberExpr *Handle =
+      clang::MemberExpr::Create(C,
+                                RefRSVar,
+                                false,
+                                clang::NestedNameSpecifierLoc(),
+                                clang::SourceLocation(),
+                                HandleFD,
+                                clang::DeclAccessPair::make(HandleFD,
+                                                            clang::AS_none),
+                                clang::DeclarationNameInfo(),
+                                NULL,
+                                HandleFD->getType(),
+                                clang::VK_LValue,
+                                clang::OK_Ordinary);
+
+  clang::Expr *HandleValue =
+      clang::ImplicitCastExpr::Create(C,
+                                      HandleFD->getType().getUnqualifiedType(),
+                                      clang::CK_LValueToRValue,
+                                      Handle,
+                                      NULL,
+                                      clang::VK_RValue);
+
+  return new(C) clang::IfStmt(C, Loc, NULL, HandleValue,
+                              ClearSingleRSObject(C, RefRSVar, Loc));
+}
+
 static int ArrayDim(const clang::Type *T) {
   if (!T || !T->isArrayType()) {
     return 0;
@@ -439,14 +346,8 @@ static int ArrayDim(const clang::Type *T) {
   return static_cast<int>(CAT->getSize().getSExtValue());
 }
 
-static clang::Stmt *ClearStructRSObject(
-    clang::ASTContext &C,
-    clang::DeclContext *DC,
-    clang::Expr *RefRSStruct,
-    clang::SourceLocation StartLoc,
-    clang::SourceLocation Loc);
-
 static clang::Stmt *ClearArrayRSObject(
+    RSObjectRefCount *RC,
     clang::ASTContext &C,
     clang::DeclContext *DC,
     clang::Expr *RefRSArr,
@@ -582,12 +483,11 @@ static clang::Stmt *ClearArrayRSObject(
   clang::Stmt *RSClearObjectCall = NULL;
   if (BaseType->isArrayType()) {
     RSClearObjectCall =
-        ClearArrayRSObject(C, DC, RefRSArrPtrSubscript, StartLoc, Loc);
+        ClearArrayRSObject(RC, C, DC, RefRSArrPtrSubscript, StartLoc, Loc);
   } else if (DT == RSExportPrimitiveType::DataTypeUnknown) {
-    RSClearObjectCall =
-        ClearStructRSObject(C, DC, RefRSArrPtrSubscript, StartLoc, Loc);
+    RSClearObjectCall = RC->CreateClearStructCall(RefRSArrPtrSubscript, Loc);
   } else {
-    RSClearObjectCall = ClearSingleRSObject(C, RefRSArrPtrSubscript, Loc);
+    RSClearObjectCall = ClearSingleRSObjectIfSet(C, RefRSArrPtrSubscript, Loc);
   }
 
   clang::ForStmt *DestructorLoop =
@@ -663,7 +563,10 @@ static unsigned CountRSObjectTypes(clang::ASTContext &C,
   return RSObjectCount;
 }
 
+// The body of the clear helper of a struct type (see
+// RSObjectRefCount::CreateClearStructCall())
 static clang::Stmt *ClearStructRSObject(
+    RSObjectRefCount *RC,
     clang::ASTContext &C,
     clang::DeclContext *DC,
     clang::Expr *RefRSStruct,
@@ -724,15 +627,16 @@ static clang::Stmt *ClearStructRSObject(
       slangAssert(StmtCount < FieldsToDestroy);
 
       if (IsArrayType) {
-        StmtArray[StmtCount++] = ClearArrayRSObject(C,
+        StmtArray[StmtCount++] = ClearArrayRSObject(RC,
+                                                    C,
                                                     DC,
                                                     RSObjectMember,
                                                     StartLoc,
                                                     Loc);
       } else {
-        StmtArray[StmtCount++] = ClearSingleRSObject(C,
-                                                     RSObjectMember,
-                                                     Loc);
+        StmtArray[StmtCount++] = ClearSingleRSObjectIfSet(C,
+                                                          RSObjectMember,
+                                                          Loc);
       }
     } else if (FT->isStructureType() && CountRSObjectTypes(C, FT, Loc)) {
       // In this case, we have a nested struct. We may not end up filling all
@@ -755,17 +659,15 @@ static clang::Stmt *ClearStructRSObject(
                                     clang::OK_Ordinary);
 
       if (IsArrayType) {
-        StmtArray[StmtCount++] = ClearArrayRSObject(C,
+        StmtArray[StmtCount++] = ClearArrayRSObject(RC,
+                                                    C,
                                                     DC,
                                                     RSObjectMember,
                                                     StartLoc,
                                                     Loc);
       } else {
-        StmtArray[StmtCount++] = ClearStructRSObject(C,
-                                                     DC,
-                                                     RSObjectMember,
-                                                     StartLoc,
-                                                     Loc);
+        StmtArray[StmtCount++] = RC->CreateClearStructCall(RSObjectMember,
+                                                           Loc);
       }
     }
   }
@@ -1112,7 +1014,7 @@ static clang::Stmt *CreateStructRSSetObject(clang::ASTContext &C,
 
 }  // namespace
 
-void RSObjectRefCount::Scope::ReplaceRSObjectAssignment(
+clang::Stmt *RSObjectRefCount::Scope::ReplaceRSObjectAssignment(
     clang::BinaryOperator *AS) {
 
   clang::QualType QT = AS->getType();
@@ -1133,9 +1035,7 @@ void RSObjectRefCount::Scope::ReplaceRSObjectAssignment(
         CreateSingleRSSetObject(C, AS->getLHS(), AS->getRHS(), StartLoc, Loc);
   }
 
-  RSASTReplace R(C);
-  R.ReplaceStmt(mCS, AS, UpdatedStmt);
-  return;
+  return UpdatedStmt;
 }
 
 void RSObjectRefCount::Scope::AppendRSObjectInit(
@@ -1172,9 +1072,7 @@ void RSObjectRefCount::Scope::AppendRSObjectInit(
     clang::Stmt *RSSetObjectOps =
         CreateStructRSSetObject(C, RefRSVar, InitExpr, StartLoc, Loc);
 
-    std::list<clang::Stmt*> StmtList;
-    StmtList.push_back(RSSetObjectOps);
-    AppendAfterStmt(C, mCS, DS, StmtList);
+    mInits[DS].push_back(RSSetObjectOps);
     return;
   }
 
@@ -1235,33 +1133,50 @@ void RSObjectRefCount::Scope::AppendRSObjectInit(
                              clang::VK_RValue,
                              Loc);
 
-  std::list<clang::Stmt*> StmtList;
-  StmtList.push_back(RSSetObjectCall);
-  AppendAfterStmt(C, mCS, DS, StmtList);
+  mInits[DS].push_back(RSSetObjectCall);
 
   return;
 }
 
-void RSObjectRefCount::Scope::InsertLocalVarDestructors() {
-  for (std::list<clang::VarDecl*>::const_iterator I = mRSO.begin(),
-          E = mRSO.end();
-        I != E;
-        I++) {
-    clang::VarDecl *VD = *I;
-    clang::Stmt *RSClearObjectCall = ClearRSObject(VD, VD->getDeclContext());
-    if (RSClearObjectCall) {
-      DestructorVisitor DV((*mRSO.begin())->getASTContext(),
-                           mCS,
-                           RSClearObjectCall,
-                           VD->getSourceRange().getBegin());
-      DV.Visit(mCS);
-      DV.InsertDestructors();
-    }
+void RSObjectRefCount::Scope::addRSObject(clang::Stmt *RSClearObjectCall) {
+  if (RSClearObjectCall)
+    mRSODtors.push_back(RSClearObjectCall);
+  return;
+}
+
+void RSObjectRefCount::Scope::InsertInitsAndDestructors(
+    clang::ASTContext &C) {
+  // If we come across a return at the end of the scope, there is nothing we
+  // can reasonably append to, the destructors are in front of the return
+  // already.
+  bool AppendDtors = !mRSODtors.empty() && !mHasReturn;
+  if (mInits.empty() && !AppendDtors)
+    return;
+
+  std::vector<clang::Stmt*> UpdatedStmtList;
+  UpdatedStmtList.reserve(mCS->size() + mRSODtors.size());
+  for (clang::CompoundStmt::body_iterator I = mCS->body_begin(),
+          E = mCS->body_end();
+       I != E;
+       I++) {
+    UpdatedStmtList.push_back(*I);
+
+    std::map<clang::Stmt*, std::list<clang::Stmt*> >::const_iterator Init =
+        mInits.find(*I);
+    if (Init != mInits.end())
+      UpdatedStmtList.insert(UpdatedStmtList.end(), Init->second.begin(),
+                             Init->second.end());
   }
+
+  if (AppendDtors)
+    UpdatedStmtList.insert(UpdatedStmtList.end(), mRSODtors.begin(),
+                           mRSODtors.end());
+
+  mCS->setStmts(C, &UpdatedStmtList[0], UpdatedStmtList.size());
   return;
 }
 
-clang::Stmt *RSObjectRefCount::Scope::ClearRSObject(
+clang::Stmt *RSObjectRefCount::ClearRSObject(
     clang::VarDecl *VD,
     clang::DeclContext *DC) {
   slangAssert(VD);
@@ -1283,7 +1198,7 @@ clang::Stmt *RSObjectRefCount::Scope::ClearRSObject(
                                  NULL);
 
   if (T->isArrayType()) {
-    return ClearArrayRSObject(C, DC, RefRSVar, StartLoc, Loc);
+    return ClearArrayRSObject(this, C, DC, RefRSVar, StartLoc, Loc);
   }
 
   RSExportPrimitiveType::DataType DT =
@@ -1291,7 +1206,7 @@ clang::Stmt *RSObjectRefCount::Scope::ClearRSObject(
 
   if (DT == RSExportPrimitiveType::DataTypeUnknown ||
       DT == RSExportPrimitiveType::DataTypeIsStruct) {
-    return ClearStructRSObject(C, DC, RefRSVar, StartLoc, Loc);
+    return CreateClearStructCall(RefRSVar, Loc);
   }
 
   slangAssert((RSExportPrimitiveType::IsRSObjectType(DT)) &&
@@ -1300,6 +1215,108 @@ clang::Stmt *RSObjectRefCount::Scope::ClearRSObject(
   return ClearSingleRSObject(C, RefRSVar, Loc);
 }
 
+clang::Expr *RSObjectRefCount::CreateClearStructCall(
+    clang::Expr *RefRSStruct,
+    clang::SourceLocation Loc) {
+  const clang::Type *T = RefRSStruct->getType().getTypePtr();
+  clang::RecordDecl *RD = T->getAsStructureType()->getDecl()->getDefinition();
+  clang::QualType PtrT = mCtx.getPointerType(T->getCanonicalTypeInternal());
+
+  clang::FunctionDecl *&FD = mClearStructFDs[RD];
+  if (FD == NULL) {
+    // static void .rs.clear.<struct>(struct <struct> *p) {
+    //   if (p->a.p) rsClearObject(&p->a);
+    //   for (...) .rs.clear.<nested struct>(&p->b[rsIntIter]);
+    //   ...
+    // }
+    std::string Name(".rs.clear.");
+    if (!RD->getName().empty())
+      Name.append(RD->getName());
+    else if (RD->getTypedefNameForAnonDecl() != NULL)
+      Name.append(RD->getTypedefNameForAnonDecl()->getName());
+    else
+      Name.append(llvm::utostr(mClearStructFDs.size()));
+
+    clang::DeclContext *DC = mCtx.getTranslationUnitDecl();
+    clang::SourceLocation NoLoc;
+    clang::FunctionProtoType::ExtProtoInfo EPI;
+    clang::QualType FT = mCtx.getFunctionType(mCtx.VoidTy,
+        llvm::ArrayRef<clang::QualType>(PtrT), EPI);
+    FD = clang::FunctionDecl::Create(mCtx, DC, NoLoc, NoLoc,
+                                     clang::DeclarationName(
+                                         &mCtx.Idents.get(Name)),
+                                     FT, NULL, clang::SC_Static);
+
+    clang::ParmVarDecl *PVD =
+        clang::ParmVarDecl::Create(mCtx, FD, NoLoc, NoLoc,
+                                   &mCtx.Idents.get("p"), PtrT,
+                                   mCtx.getTrivialTypeSourceInfo(PtrT),
+                                   clang::SC_None, NULL);
+    FD->setParams(llvm::ArrayRef<clang::ParmVarDecl*>(PVD));
+
+    clang::DeclRefExpr *RefP =
+        clang::DeclRefExpr::Create(mCtx,
+                                   clang::NestedNameSpecifierLoc(),
+                                   clang::SourceLocation(),
+                                   PVD,
+                                   false,
+                                   NoLoc,
+                                   PtrT,
+                                   clang::VK_RValue,
+                                   NULL);
+    clang::Expr *DerefP =
+        new(mCtx) clang::UnaryOperator(RefP,
+                                       clang::UO_Deref,
+                                       T->getCanonicalTypeInternal(),
+                                       clang::VK_LValue,
+                                       clang::OK_Ordinary,
+                                       NoLoc);
+
+    FD->setBody(ClearStructRSObject(this, mCtx, FD, DerefP, NoLoc, NoLoc));
+    mNewHelperFDs.push_back(FD);
+  }
+
+  clang::Expr *RefFD =
+      clang::DeclRefExpr::Create(mCtx,
+                                 clang::NestedNameSpecifierLoc(),
+                                 clang::SourceLocation(),
+                                 FD,
+                                 false,
+                                 Loc,
+                                 FD->getType(),
+                                 clang::VK_RValue,
+                                 NULL);
+
+  clang::Expr *FP =
+      clang::ImplicitCastExpr::Create(mCtx,
+                                      mCtx.getPointerType(FD->getType()),
+                                      clang::CK_FunctionToPointerDecay,
+                                      RefFD,
+                                      NULL,
+                                      clang::VK_RValue);
+
+  llvm::SmallVector<clang::Expr*, 1> ArgList;
+  ArgList.push_back(new(mCtx) clang::UnaryOperator(RefRSStruct,
+                                                   clang::UO_AddrOf,
+                                                   PtrT,
+                                                   clang::VK_RValue,
+                                                   clang::OK_Ordinary,
+                                                   Loc));
+
+  return new(mCtx) clang::CallExpr(mCtx,
+                                   FP,
+                                   ArgList,
+                                   mCtx.VoidTy,
+                                   clang::VK_RValue,
+                                   Loc);
+}
+
+void RSObjectRefCount::takeNewHelpers(
+    std::list<clang::FunctionDecl*> *Helpers) {
+  Helpers->splice(Helpers->end(), mNewHelperFDs);
+  return;
+}
+
 bool RSObjectRefCount::InitializeRSObject(clang::VarDecl *VD,
                                           RSExportPrimitiveType::DataType *DT,
                                           clang::Expr **InitExpr) {
@@ -1466,6 +1483,10 @@ void RSObjectRefCount::VisitDeclStmt(clang::DeclStmt *DS) {
       RSExportPrimitiveType::DataType DT =
           RSExportPrimitiveType::DataTypeUnknown;
       clang::Expr *InitExpr = NULL;
+      if (IsBorrowedRSObject(VD)) {
+        // Keep the plain copy of the global
+        continue;
+      }
       if (InitializeRSObject(VD, &DT, &InitExpr)) {
         // We need to zero-init all RS object types (including matrices), ...
         getCurrentScope()->AppendRSObjectInit(VD, DS, DT, InitExpr);
@@ -1473,7 +1494,8 @@ void RSObjectRefCount::VisitDeclStmt(clang::DeclStmt *DS) {
         // non-matrix RS object fields.
         if (CountRSObjectTypes(mCtx, VD->getType().getTypePtr(),
                                VD->getLocation())) {
-          getCurrentScope()->addRSObject(VD);
+          getCurrentScope()->addRSObject(
+              ClearRSObject(VD, VD->getDeclContext()));
         }
       }
     }
@@ -1481,18 +1503,50 @@ void RSObjectRefCount::VisitDeclStmt(clang::DeclStmt *DS) {
   return;
 }
 
+bool RSObjectRefCount::IsBorrowedRSObject(const clang::VarDecl *VD) const {
+  if (mMayModifyAnyVar || !VD->hasLocalStorage() || !VD->hasInit() ||
+      !RSExportPrimitiveType::IsRSObjectType(VD->getType().getTypePtr()) ||
+      mModifiedVars.count(VD))
+    return false;
+
+  const clang::DeclRefExpr *DRE =
+      llvm::dyn_cast<clang::DeclRefExpr>(VD->getInit()->IgnoreParenImpCasts());
+  if (DRE == NULL)
+    return false;
+
+  const clang::VarDecl *Global = llvm::dyn_cast<clang::VarDecl>(DRE->getDecl());
+  return (Global != NULL) && Global->hasGlobalStorage() &&
+         !mModifiedVars.count(Global);
+}
+
 void RSObjectRefCount::VisitCompoundStmt(clang::CompoundStmt *CS) {
+  if (mScopeStack.empty()) {
+    // Entering the body of a function
+    mModifiedVars.clear();
+    mMayModifyAnyVar = false;
+    RSObjectUsageVisitor UV(mCtx.getSourceManager(), mModifiedVars,
+                            mMayModifyAnyVar);
+    UV.Visit(CS);
+  }
+
   if (!CS->body_empty()) {
     // Push a new scope
-    Scope *S = new Scope(CS);
-    mScopeStack.push(S);
-
-    VisitStmt(CS);
+    Scope *S = new Scope(CS, mLoopDepth, mSwitchDepth);
+    mScopeStack.push_back(S);
+
+    for (clang::CompoundStmt::body_iterator I = CS->body_begin(),
+            E = CS->body_end();
+         I != E;
+         I++) {
+      if (llvm::isa<clang::ReturnStmt>(*I))
+        S->setHasReturn();
+      VisitChild(*I);
+    }
 
     // Destroy the scope
     slangAssert((getCurrentScope() == S) && "Corrupted scope stack!");
-    S->InsertLocalVarDestructors();
-    mScopeStack.pop();
+    S->InsertInitsAndDestructors(mCtx);
+    mScopeStack.pop_back();
     delete S;
   }
   return;
@@ -1502,19 +1556,113 @@ void RSObjectRefCount::VisitBinAssign(clang::BinaryOperator *AS) {
   clang::QualType QT = AS->getType();
 
   if (CountRSObjectTypes(mCtx, QT.getTypePtr(), AS->getExprLoc())) {
-    getCurrentScope()->ReplaceRSObjectAssignment(AS);
+    mReplacement = Scope::ReplaceRSObjectAssignment(AS);
   }
 
   return;
 }
 
+void RSObjectRefCount::VisitBreakStmt(clang::BreakStmt *BS) {
+  InsertExitDestructors(BS);
+  return;
+}
+
+void RSObjectRefCount::VisitContinueStmt(clang::ContinueStmt *CS) {
+  InsertExitDestructors(CS);
+  return;
+}
+
+void RSObjectRefCount::VisitReturnStmt(clang::ReturnStmt *RS) {
+  VisitStmt(RS);
+  InsertExitDestructors(RS);
+  return;
+}
+
+void RSObjectRefCount::VisitDoStmt(clang::DoStmt *DS) {
+  mLoopDepth++;
+  VisitStmt(DS);
+  mLoopDepth--;
+  return;
+}
+
+void RSObjectRefCount::VisitForStmt(clang::ForStmt *FS) {
+  mLoopDepth++;
+  VisitStmt(FS);
+  mLoopDepth--;
+  return;
+}
+
+void RSObjectRefCount::VisitWhileStmt(clang::WhileStmt *WS) {
+  mLoopDepth++;
+  VisitStmt(WS);
+  mLoopDepth--;
+  return;
+}
+
+void RSObjectRefCount::VisitSwitchStmt(clang::SwitchStmt *SS) {
+  mSwitchDepth++;
+  VisitStmt(SS);
+  mSwitchDepth--;
+  return;
+}
+
 void RSObjectRefCount::VisitStmt(clang::Stmt *S) {
   for (clang::Stmt::child_iterator I = S->child_begin(), E = S->child_end();
        I != E;
        I++) {
-    if (clang::Stmt *Child = *I) {
-      Visit(Child);
+    if (*I != NULL) {
+      VisitChild(*I);
+    }
+  }
+  return;
+}
+
+void RSObjectRefCount::VisitChild(clang::Stmt *&S) {
+  Visit(S);
+  if (mReplacement != NULL) {
+    S = mReplacement;
+    mReplacement = NULL;
+  }
+  return;
+}
+
+void RSObjectRefCount::InsertExitDestructors(clang::Stmt *S) {
+  // The RS objects declared so far in the scopes S leaves (from the innermost
+  // one) need to be destroyed. A return leaves all of the scopes of the
+  // function, a continue leaves the ones in the innermost loop and a break
+  // the ones in the innermost loop or switch statement. We don't handle goto
+  // statements that leave a local scope.
+  std::list<clang::Stmt*> StmtList;
+  for (std::vector<Scope*>::const_reverse_iterator I = mScopeStack.rbegin(),
+          E = mScopeStack.rend();
+       I != E;
+       I++) {
+    const Scope *SC = *I;
+    bool Leaves;
+    switch (S->getStmtClass()) {
+      case clang::Stmt::BreakStmtClass: {
+        Leaves = (SC->getLoopDepth() == mLoopDepth) &&
+                 (SC->getSwitchDepth() == mSwitchDepth);
+        break;
+      }
+      case clang::Stmt::ContinueStmtClass: {
+        Leaves = (SC->getLoopDepth() == mLoopDepth);
+        break;
+      }
+      default: {
+        Leaves = true;
+        break;
+      }
     }
+
+    if (Leaves)
+      StmtList.insert(StmtList.end(), SC->getRSObjectDtors().begin(),
+                      SC->getRSObjectDtors().end());
+  }
+
+  if (!StmtList.empty()) {
+    StmtList.push_back(S);
+    mReplacement = BuildCompoundStmt(mCtx, StmtList, S->getLocEnd());
   }
   return;
 }
@@ -1522,7 +1670,8 @@ void RSObjectRefCount::VisitStmt(clang::Stmt *S) {
 // This function walks the list of global variables and (potentially) creates
 // a single global static destructor function that properly decrements
 // reference counts on the contained RS object types.
-clang::FunctionDecl *RSObjectRefCount::CreateStaticGlobalDtor() {
+clang::FunctionDecl *RSObjectRefCount::CreateStaticGlobalDtor(
+    const std::vector<clang::VarDecl*> &GlobalVars) {
   Init();
 
   clang::DeclContext *DC = mCtx.getTranslationUnitDecl();
@@ -1539,21 +1688,19 @@ clang::FunctionDecl *RSObjectRefCount::CreateStaticGlobalDtor() {
   // Generate rsClearObject() call chains for every global variable
   // (whether static or extern).
   std::list<clang::Stmt *> StmtList;
-  for (clang::DeclContext::decl_iterator I = DC->decls_begin(),
-          E = DC->decls_end(); I != E; I++) {
-    clang::VarDecl *VD = llvm::dyn_cast<clang::VarDecl>(*I);
-    if (VD) {
-      if (CountRSObjectTypes(mCtx, VD->getType().getTypePtr(), loc)) {
-        if (!FD) {
-          // Only create FD if we are going to use it.
-          FD = clang::FunctionDecl::Create(mCtx, DC, loc, loc, N, T, NULL,
-                                           clang::SC_None);
-        }
-        // Make sure to create any helpers within the function's DeclContext,
-        // not the one associated with the global translation unit.
-        clang::Stmt *RSClearObjectCall = Scope::ClearRSObject(VD, FD);
-        StmtList.push_back(RSClearObjectCall);
+  for (std::vector<clang::VarDecl*>::const_iterator I = GlobalVars.begin(),
+          E = GlobalVars.end(); I != E; I++) {
+    clang::VarDecl *VD = *I;
+    if (CountRSObjectTypes(mCtx, VD->getType().getTypePtr(), loc)) {
+      if (!FD) {
+        // Only create FD if we are going to use it.
+        FD = clang::FunctionDecl::Create(mCtx, DC, loc, loc, N, T, NULL,
+                                         clang::SC_None);
       }
+      // Make sure to create any helpers within the function's DeclContext,
+      // not the one associated with the global translation unit.
+      clang::Stmt *RSClearObjectCall = ClearRSObject(VD, FD);
+      StmtList.push_back(RSClearObjectCall);
     }
   }
 
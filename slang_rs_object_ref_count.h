@@ -18,7 +18,9 @@
 #define _FRAMEWORKS_COMPILE_SLANG_SLANG_RS_OBJECT_REF_COUNT_H_
 
 #include <list>
-#include <stack>
+#include <map>
+#include <set>
+#include <vector>
 
 #include "clang/AST/StmtVisitor.h"
 
@@ -44,47 +46,103 @@ namespace slang {
 // of scope.
 class RSObjectRefCount : public clang::StmtVisitor<RSObjectRefCount> {
  private:
+  // The changes to a compound statement are collected while its statements
+  // are visited and applied at once when the visit leaves it.
   class Scope {
    private:
     clang::CompoundStmt *mCS;      // Associated compound statement ({ ... })
-    std::list<clang::VarDecl*> mRSO;  // Declared RS objects in this scope
+    // The destructors of the RS objects declared in this scope so far
+    std::vector<clang::Stmt*> mRSODtors;
+    // The initializations to insert after the (top-level) declarations
+    std::map<clang::Stmt*, std::list<clang::Stmt*> > mInits;
+    // The loop and switch depths of the scope in its function
+    int mLoopDepth;
+    int mSwitchDepth;
+    // Whether there's a return among the top-level statements
+    bool mHasReturn;
 
    public:
-    explicit Scope(clang::CompoundStmt *CS) : mCS(CS) {
+    Scope(clang::CompoundStmt *CS, int LoopDepth, int SwitchDepth)
+        : mCS(CS),
+          mLoopDepth(LoopDepth),
+          mSwitchDepth(SwitchDepth),
+          mHasReturn(false) {
       return;
     }
 
-    inline void addRSObject(clang::VarDecl* VD) {
-      mRSO.push_back(VD);
+    // Add the destructor of an RS object declared in this scope (if any).
+    void addRSObject(clang::Stmt *RSClearObjectCall);
+
+    inline const std::vector<clang::Stmt*> &getRSObjectDtors() const {
+      return mRSODtors;
+    }
+    inline int getLoopDepth() const { return mLoopDepth; }
+    inline int getSwitchDepth() const { return mSwitchDepth; }
+    inline void setHasReturn() {
+      mHasReturn = true;
       return;
     }
 
-    void ReplaceRSObjectAssignment(clang::BinaryOperator *AS);
+    // Return the rsSetObject() call(s) to replace the assignment AS with.
+    static clang::Stmt *ReplaceRSObjectAssignment(clang::BinaryOperator *AS);
 
     void AppendRSObjectInit(clang::VarDecl *VD,
                             clang::DeclStmt *DS,
                             RSExportPrimitiveType::DataType DT,
                             clang::Expr *InitExpr);
 
-    void InsertLocalVarDestructors();
-
-    static clang::Stmt *ClearRSObject(clang::VarDecl *VD,
-                                      clang::DeclContext *DC);
+    // Rewrite the compound statement with the initializations and the
+    // destructors at the end of the scope.
+    void InsertInitsAndDestructors(clang::ASTContext &C);
   };
 
   clang::ASTContext &mCtx;
-  std::stack<Scope*> mScopeStack;
+  std::vector<Scope*> mScopeStack;
   bool RSInitFD;
 
+  // The loops and switch statements around the currently visited statement
+  int mLoopDepth;
+  int mSwitchDepth;
+
+  // What the statement just visited is to be replaced with (if not NULL)
+  clang::Stmt *mReplacement;
+
+  // The variables the current function assigns or takes the address of, and
+  // whether it may modify any variable (by writing through a pointer or by
+  // calling anything but the RS runtime)
+  std::set<const clang::VarDecl*> mModifiedVars;
+  bool mMayModifyAnyVar;
+
+  // Return true if the local RS object VD is only a copy of an RS object
+  // global that stays in place while VD is alive. The global holds the
+  // reference then, and VD needs neither rsSetObject() nor rsClearObject().
+  bool IsBorrowedRSObject(const clang::VarDecl *VD) const;
+
+  // The clear helpers of the struct types (see CreateClearStructCall()), and
+  // the ones which haven't been taken by takeNewHelpers() yet
+  std::map<const clang::RecordDecl*, clang::FunctionDecl*> mClearStructFDs;
+  std::list<clang::FunctionDecl*> mNewHelperFDs;
+
+  // Return the destructor of the RS object(s) in VD, creating the helpers of
+  // the destructor in DC.
+  clang::Stmt *ClearRSObject(clang::VarDecl *VD, clang::DeclContext *DC);
+
   // RSSetObjectFD and RSClearObjectFD holds FunctionDecl of rsSetObject()
   // and rsClearObject() in the current ASTContext.
   static clang::FunctionDecl *RSSetObjectFD[];
   static clang::FunctionDecl *RSClearObjectFD[];
 
   inline Scope *getCurrentScope() {
-    return mScopeStack.top();
+    return mScopeStack.back();
   }
 
+  // Visit the statement in the slot S and replace it if requested.
+  void VisitChild(clang::Stmt *&S);
+
+  // Request to replace the break, continue or return statement S with the
+  // destructors of the RS objects of the scopes it leaves, followed by S.
+  void InsertExitDestructors(clang::Stmt *S);
+
   // Initialize RSSetObjectFD and RSClearObjectFD.
   static void GetRSRefCountingFunctions(clang::ASTContext &C);
 
@@ -104,7 +162,11 @@ class RSObjectRefCount : public clang::StmtVisitor<RSObjectRefCount> {
  public:
   explicit RSObjectRefCount(clang::ASTContext &C)
       : mCtx(C),
-        RSInitFD(false) {
+        RSInitFD(false),
+        mLoopDepth(0),
+        mSwitchDepth(0),
+        mReplacement(NULL),
+        mMayModifyAnyVar(false) {
     return;
   }
 
@@ -136,15 +198,34 @@ class RSObjectRefCount : public clang::StmtVisitor<RSObjectRefCount> {
     return GetRSClearObjectFD(RSExportPrimitiveType::GetRSSpecificType(T));
   }
 
+  // Return a call to the helper function clearing the RS objects in the
+  // struct RefRSStruct. There's one per struct type, such that the elements
+  // of arrays (and every global) share its code.
+  clang::Expr *CreateClearStructCall(clang::Expr *RefRSStruct,
+                                     clang::SourceLocation Loc);
+
+  // Move the helper functions created since the last call into Helpers (to
+  // generate code for them).
+  void takeNewHelpers(std::list<clang::FunctionDecl*> *Helpers);
+
   void VisitStmt(clang::Stmt *S);
   void VisitDeclStmt(clang::DeclStmt *DS);
   void VisitCompoundStmt(clang::CompoundStmt *CS);
   void VisitBinAssign(clang::BinaryOperator *AS);
+  void VisitBreakStmt(clang::BreakStmt *BS);
+  void VisitContinueStmt(clang::ContinueStmt *CS);
+  void VisitReturnStmt(clang::ReturnStmt *RS);
+  void VisitDoStmt(clang::DoStmt *DS);
+  void VisitForStmt(clang::ForStmt *FS);
+  void VisitWhileStmt(clang::WhileStmt *WS);
+  void VisitSwitchStmt(clang::SwitchStmt *SS);
   // We believe that RS objects are never involved in CompoundAssignOperator.
   // I.e., rs_allocation foo; foo += bar;
 
-  // Emit a global destructor to clean up RS objects.
-  clang::FunctionDecl *CreateStaticGlobalDtor();
+  // Emit a global destructor to clean up the RS objects of GlobalVars (the
+  // variables declared at the top level of the translation unit).
+  clang::FunctionDecl *CreateStaticGlobalDtor(
+      const std::vector<clang::VarDecl*> &GlobalVars);
 };
 
 }  // namespace slang
@@ -0,0 +1,171 @@
+/*
+ * Copyright 2013, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "slang_rs_odr_database.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#if !defined(_WIN32)
+#include <sys/file.h>
+#include <unistd.h>
+#endif
+
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/StringRef.h"
+
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/system_error.h"
+
+#include "slang_rs_export_type.h"
+#include "slang_utils.h"
+
+namespace slang {
+
+// The modification time of File, 0 if it doesn't exist.
+static uint64_t GetModTime(const std::string &File) {
+  struct stat Stat;
+  if (stat(File.c_str(), &Stat) != 0)
+    return 0;
+  return static_cast<uint64_t>(Stat.st_mtime);
+}
+
+namespace {
+
+// An exclusive lock on the database, held by a separate lock file, since
+// the database itself is replaced on every update.
+class DatabaseLock {
+ private:
+  int mFD;
+
+ public:
+  DatabaseLock() : mFD(-1) {}
+
+  bool acquire(const std::string &Path, std::string *Error) {
+#if !defined(_WIN32)
+    std::string LockFile = Path + ".lock";
+    mFD = open(LockFile.c_str(), O_RDWR | O_CREAT, 0666);
+    if (mFD < 0) {
+      Error->assign("failed to open '" + LockFile + "': " + strerror(errno));
+      return false;
+    }
+    while (flock(mFD, LOCK_EX) != 0) {
+      if (errno != EINTR) {
+        Error->assign("failed to lock '" + LockFile + "': " +
+                      strerror(errno));
+        return false;
+      }
+    }
+#endif
+    return true;
+  }
+
+  ~DatabaseLock() {
+#if !defined(_WIN32)
+    // Closing the file releases the lock.
+    if (mFD >= 0)
+      close(mFD);
+#endif
+  }
+};
+
+}  // namespace
+
+RSODRDatabase::Definition
+RSODRDatabase::GetDefinition(const RSExportRecordType *ERT,
+                             const std::string &Package,
+                             const std::string &InputFile) {
+  std::stringstream S;
+  RSExportType::Describe(S, ERT);
+
+  Definition Def;
+  Def.Key = Package + "." + ERT->getName();
+  Def.Fingerprint = SlangUtils::UpdateHash(SlangUtils::InitialHash, S.str());
+  Def.InputFile = InputFile;
+  Def.DefinitionFile = ERT->getDefinitionFile();
+  Def.ModTime = GetModTime(Def.DefinitionFile);
+  return Def;
+}
+
+bool RSODRDatabase::Update(const std::string &Path,
+                           const std::string &InputFile,
+                           const std::vector<Definition> &Defs,
+                           int *Conflict, std::string *ConflictFile,
+                           std::string *Error) {
+  *Conflict = -1;
+
+  DatabaseLock Lock;
+  if (!Lock.acquire(Path, Error))
+    return false;
+
+  // The definitions of the other input files which are still live
+  std::vector<Definition> Others;
+  llvm::OwningPtr<llvm::MemoryBuffer> MB;
+  if (llvm::MemoryBuffer::getFile(Path, MB) == llvm::errc::success) {
+    llvm::StringRef Rest = MB->getBuffer();
+    while (!Rest.empty()) {
+      std::pair<llvm::StringRef, llvm::StringRef> Line = Rest.split('\n');
+      Rest = Line.second;
+
+      // A malformed line is just dropped.
+      llvm::SmallVector<llvm::StringRef, 5> Fields;
+      Line.first.split(Fields, "\t");
+      Definition Def;
+      if ((Fields.size() != 5) ||
+          Fields[0].getAsInteger(16, Def.Fingerprint) ||
+          Fields[1].getAsInteger(10, Def.ModTime))
+        continue;
+      Def.Key = Fields[2];
+      Def.InputFile = Fields[3];
+      Def.DefinitionFile = Fields[4];
+
+      if ((Def.InputFile != InputFile) &&
+          (GetModTime(Def.DefinitionFile) == Def.ModTime))
+        Others.push_back(Def);
+    }
+  }
+
+  for (unsigned i = 0, e = Defs.size(); i != e; i++) {
+    for (unsigned j = 0, f = Others.size(); j != f; j++) {
+      if ((Defs[i].Key == Others[j].Key) &&
+          (Defs[i].Fingerprint != Others[j].Fingerprint)) {
+        *Conflict = i;
+        *ConflictFile = Others[j].InputFile;
+        return true;
+      }
+    }
+  }
+
+  std::stringstream S;
+  Others.insert(Others.end(), Defs.begin(), Defs.end());
+  for (unsigned i = 0, e = Others.size(); i != e; i++) {
+    const Definition &Def = Others[i];
+    S << llvm::utohexstr(Def.Fingerprint) << '\t' << Def.ModTime << '\t'
+      << Def.Key << '\t' << Def.InputFile << '\t' << Def.DefinitionFile
+      << '\n';
+  }
+  return SlangUtils::WriteFileAtomically(Path, S.str(), Error);
+}
+
+}  // namespace slang
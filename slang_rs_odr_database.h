@@ -0,0 +1,73 @@
+/*
+ * Copyright 2013, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _FRAMEWORKS_COMPILE_SLANG_SLANG_RS_ODR_DATABASE_H_  // NOLINT
+#define _FRAMEWORKS_COMPILE_SLANG_SLANG_RS_ODR_DATABASE_H_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+namespace slang {
+
+class RSExportRecordType;
+
+// The definitions of the exported record types of all the input files of a
+// project, shared by the llvm-rs-cc processes compiling them (-odr-db), such
+// that the ODR is checked across separate (and concurrent) compiles. The
+// database is a file with a line
+//
+//   <fingerprint> <mtime> <key> <input file> <definition file>\n
+//
+// for each definition (separated by tabs), where the key is the Java package
+// and the name of the type. A definition whose definition file (which may be
+// a header) changed since is stale, it's replaced once the input files using
+// it are compiled again.
+class RSODRDatabase {
+ public:
+  struct Definition {
+    std::string Key;
+    // Hash of the layout and the field names (see RSExportType::Describe())
+    uint64_t Fingerprint;
+    std::string InputFile;
+    std::string DefinitionFile;
+    // Modification time of DefinitionFile when InputFile was compiled
+    uint64_t ModTime;
+  };
+
+  // Make the definition of ERT, as reflected into the Java package Package
+  // from InputFile.
+  static Definition GetDefinition(const RSExportRecordType *ERT,
+                                  const std::string &Package,
+                                  const std::string &InputFile);
+
+  // Check Defs (all from InputFile) against the other input files in the
+  // database at Path, then replace the definitions of InputFile with Defs.
+  // Everything happens under an exclusive lock on Path. If there's a
+  // different definition of the same type, *Conflict is the index of the
+  // first such one in Defs and *ConflictFile the input file of the other, and
+  // the database is left alone. Otherwise *Conflict is -1. Returns false (and
+  // sets *Error) if the database can't be updated.
+  static bool Update(const std::string &Path, const std::string &InputFile,
+                     const std::vector<Definition> &Defs,
+                     int *Conflict, std::string *ConflictFile,
+                     std::string *Error);
+};
+
+}  // namespace slang
+
+#endif  // _FRAMEWORKS_COMPILE_SLANG_SLANG_RS_ODR_DATABASE_H_  NOLINT
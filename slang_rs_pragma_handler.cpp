@@ -25,6 +25,9 @@
 #include "clang/Lex/Preprocessor.h"
 #include "clang/Lex/Token.h"
 
+#include "llvm/ADT/APFloat.h"
+#include "llvm/ADT/APInt.h"
+
 #include "slang_assert.h"
 #include "slang_rs_context.h"
 
@@ -168,6 +171,270 @@ class RSVersionPragmaHandler : public RSPragmaHandler {
   }
 };
 
+// #pragma rs specialize(var = value, ...)
+class RSSpecializePragmaHandler : public RSPragmaHandler {
+ private:
+  // Lex "var = [-]value" after PragmaToken, true if it's well formed.
+  bool handleSpecializedVar(clang::Preprocessor &PP,
+                            clang::Token &PragmaToken) {
+    PP.LexUnexpandedToken(PragmaToken);
+    if (PragmaToken.isNot(clang::tok::identifier)) {
+      reportError(PP, PragmaToken, "expected the name of a variable");
+      return false;
+    }
+    std::string Name = PP.getSpelling(PragmaToken);
+    clang::SourceLocation Loc = PragmaToken.getLocation();
+
+    PP.LexUnexpandedToken(PragmaToken);
+    if (PragmaToken.isNot(clang::tok::equal)) {
+      reportError(PP, PragmaToken, "expected a '='");
+      return false;
+    }
+
+    PP.LexUnexpandedToken(PragmaToken);
+    bool Negative = PragmaToken.is(clang::tok::minus);
+    if (Negative)
+      PP.LexUnexpandedToken(PragmaToken);
+    if (PragmaToken.isNot(clang::tok::numeric_constant)) {
+      reportError(PP, PragmaToken, "expected a numeric constant");
+      return false;
+    }
+
+    llvm::SmallString<128> SpellingBuffer;
+    SpellingBuffer.resize(PragmaToken.getLength() + 1);
+    llvm::StringRef TokSpelling = PP.getSpelling(PragmaToken, SpellingBuffer);
+    clang::NumericLiteralParser NumericLiteral(TokSpelling,
+        PragmaToken.getLocation(), PP);
+    if (NumericLiteral.hadError) {
+      // Diagnostics will be generated automatically
+      return false;
+    }
+
+    std::string Value;
+    bool IsFloat = NumericLiteral.isFloatingLiteral();
+    if (IsFloat) {
+      llvm::APFloat Val(llvm::APFloat::IEEEdouble);
+      NumericLiteral.GetFloatValue(Val);
+      if (Val.isInfinity() || Val.isNaN()) {
+        reportError(PP, PragmaToken, "floating point value is not finite");
+        return false;
+      }
+      if (Negative)
+        Val.changeSign();
+      llvm::SmallString<32> Str;
+      // Spelled with enough digits to read back as the same double
+      Val.toString(Str);
+      Value = Str.str();
+    } else {
+      llvm::APInt Val(64, 0);
+      if (NumericLiteral.GetIntegerValue(Val) || Val.isNegative()) {
+        reportError(PP, PragmaToken, "integer value is too large");
+        return false;
+      }
+      if (Negative)
+        Val = -Val;
+      Value = Val.toString(10, /* Signed = */true);
+    }
+
+    mContext->addPragma(this->getName(), Name + "=" + Value);
+    mContext->addSpecializedVar(Name, Value, IsFloat, Loc);
+    return true;
+  }
+
+ public:
+  RSSpecializePragmaHandler(llvm::StringRef Name, RSContext *Context)
+      : RSPragmaHandler(Name, Context) { return; }
+
+  void HandlePragma(clang::Preprocessor &PP,
+                    clang::PragmaIntroducerKind Introducer,
+                    clang::Token &FirstToken) {
+    clang::Token &PragmaToken = FirstToken;
+
+    // Skip first token, "specialize"
+    PP.LexUnexpandedToken(PragmaToken);
+
+    if (PragmaToken.isNot(clang::tok::l_paren)) {
+      reportError(PP, PragmaToken, "expected a '('");
+      return;
+    }
+
+    bool Valid;
+    do {
+      Valid = handleSpecializedVar(PP, PragmaToken);
+      if (!Valid)
+        break;
+      PP.LexUnexpandedToken(PragmaToken);
+    } while (PragmaToken.is(clang::tok::comma));
+
+    if (Valid && PragmaToken.isNot(clang::tok::r_paren))
+      reportError(PP, PragmaToken, "expected a ')'");
+
+    while (PragmaToken.isNot(clang::tok::eod))
+      PP.LexUnexpandedToken(PragmaToken);
+    return;
+  }
+};
+
+// #pragma rs fp_relaxed(kernel, ...) and #pragma rs fp_imprecise(kernel, ...)
+class RSKernelPrecisionPragmaHandler : public RSPragmaHandler {
+ private:
+  RSContext::KernelPrecision mPrecision;
+
+  void handleItem(const std::string &Item) {
+    mContext->addKernelPrecision(Item, mPrecision);
+  }
+
+ public:
+  RSKernelPrecisionPragmaHandler(llvm::StringRef Name, RSContext *Context,
+                                 RSContext::KernelPrecision Precision)
+      : RSPragmaHandler(Name, Context), mPrecision(Precision) { return; }
+
+  void HandlePragma(clang::Preprocessor &PP,
+                    clang::PragmaIntroducerKind Introducer,
+                    clang::Token &FirstToken) {
+    this->handleItemListPragma(PP, FirstToken);
+  }
+};
+
+// #pragma rs reduce(name) accumulator(fn) [initializer(fn)] [combiner(fn)]
+//     [outconverter(fn)]
+class RSReducePragmaHandler : public RSPragmaHandler {
+ private:
+  // Lex "(identifier)" after PragmaToken into *Name, true if it's well formed.
+  bool handleParenthesizedName(clang::Preprocessor &PP,
+                               clang::Token &PragmaToken,
+                               std::string *Name) {
+    PP.LexUnexpandedToken(PragmaToken);
+    if (PragmaToken.isNot(clang::tok::l_paren)) {
+      reportError(PP, PragmaToken, "expected a '('");
+      return false;
+    }
+    PP.LexUnexpandedToken(PragmaToken);
+    if (PragmaToken.isNot(clang::tok::identifier)) {
+      reportError(PP, PragmaToken, "expected a name");
+      return false;
+    }
+    *Name = PP.getSpelling(PragmaToken);
+    PP.LexUnexpandedToken(PragmaToken);
+    if (PragmaToken.isNot(clang::tok::r_paren)) {
+      reportError(PP, PragmaToken, "expected a ')'");
+      return false;
+    }
+    return true;
+  }
+
+ public:
+  RSReducePragmaHandler(llvm::StringRef Name, RSContext *Context)
+      : RSPragmaHandler(Name, Context) { return; }
+
+  void HandlePragma(clang::Preprocessor &PP,
+                    clang::PragmaIntroducerKind Introducer,
+                    clang::Token &FirstToken) {
+    clang::Token &PragmaToken = FirstToken;
+    RSContext::ReduceDecl RD;
+    RD.Loc = PragmaToken.getLocation();
+
+    // The first token is "reduce".
+    bool Valid = handleParenthesizedName(PP, PragmaToken, &RD.Name);
+    while (Valid) {
+      PP.LexUnexpandedToken(PragmaToken);
+      if (PragmaToken.is(clang::tok::eod))
+        break;
+
+      std::string *Function = NULL;
+      if (PragmaToken.is(clang::tok::identifier)) {
+        llvm::StringRef Keyword = PragmaToken.getIdentifierInfo()->getName();
+        if (Keyword == "initializer")
+          Function = &RD.Initializer;
+        else if (Keyword == "accumulator")
+          Function = &RD.Accumulator;
+        else if (Keyword == "combiner")
+          Function = &RD.Combiner;
+        else if (Keyword == "outconverter")
+          Function = &RD.OutConverter;
+      }
+      if (Function == NULL) {
+        reportError(PP, PragmaToken, "expected 'initializer', 'accumulator', "
+                    "'combiner' or 'outconverter'");
+        Valid = false;
+      } else if (!Function->empty()) {
+        reportError(PP, PragmaToken, "function of the reduction kernel given "
+                    "twice");
+        Valid = false;
+      } else {
+        Valid = handleParenthesizedName(PP, PragmaToken, Function);
+      }
+    }
+
+    if (Valid) {
+      if (RD.Accumulator.empty()) {
+        reportError(PP, PragmaToken, "expected an 'accumulator'");
+      } else {
+        mContext->addPragma(this->getName(), RD.Name);
+        mContext->addReduce(RD);
+      }
+    }
+
+    while (PragmaToken.isNot(clang::tok::eod))
+      PP.LexUnexpandedToken(PragmaToken);
+    return;
+  }
+};
+
+// #pragma rs fuse(kernel, kernel, ...)
+class RSFusePragmaHandler : public RSPragmaHandler {
+ public:
+  RSFusePragmaHandler(llvm::StringRef Name, RSContext *Context)
+      : RSPragmaHandler(Name, Context) { return; }
+
+  void HandlePragma(clang::Preprocessor &PP,
+                    clang::PragmaIntroducerKind Introducer,
+                    clang::Token &FirstToken) {
+    clang::Token &PragmaToken = FirstToken;
+    RSContext::FuseDecl FD;
+    FD.Loc = PragmaToken.getLocation();
+
+    // Skip first token, "fuse"
+    PP.LexUnexpandedToken(PragmaToken);
+
+    bool Valid = true;
+    if (PragmaToken.isNot(clang::tok::l_paren)) {
+      reportError(PP, PragmaToken, "expected a '('");
+      Valid = false;
+    }
+    while (Valid) {
+      PP.LexUnexpandedToken(PragmaToken);
+      if (PragmaToken.isNot(clang::tok::identifier)) {
+        reportError(PP, PragmaToken, "expected a kernel name");
+        Valid = false;
+        break;
+      }
+      FD.Kernels.push_back(PP.getSpelling(PragmaToken));
+      PP.LexUnexpandedToken(PragmaToken);
+      if (PragmaToken.isNot(clang::tok::comma))
+        break;
+    }
+
+    if (Valid) {
+      if (PragmaToken.isNot(clang::tok::r_paren)) {
+        reportError(PP, PragmaToken, "expected a ')'");
+      } else if (FD.Kernels.size() < 2) {
+        reportError(PP, PragmaToken, "expected at least two kernels to fuse");
+      } else {
+        std::string Kernels = FD.Kernels.front();
+        for (unsigned i = 1, e = FD.Kernels.size(); i != e; i++)
+          Kernels.append(",").append(FD.Kernels[i]);
+        mContext->addPragma(this->getName(), Kernels);
+        mContext->addFuse(FD);
+      }
+    }
+
+    while (PragmaToken.isNot(clang::tok::eod))
+      PP.LexUnexpandedToken(PragmaToken);
+    return;
+  }
+};
+
 }  // namespace
 
 RSPragmaHandler *
@@ -190,6 +457,37 @@ RSPragmaHandler::CreatePragmaVersionHandler(RSContext *Context) {
   return new RSVersionPragmaHandler("version", Context);
 }
 
+RSPragmaHandler *
+RSPragmaHandler::CreatePragmaSpecializeHandler(RSContext *Context) {
+  return new RSSpecializePragmaHandler("specialize", Context);
+}
+
+RSPragmaHandler *
+RSPragmaHandler::CreatePragmaKernelPrecisionHandler(
+    RSContext *Context, llvm::StringRef Name,
+    RSContext::KernelPrecision Precision) {
+  return new RSKernelPrecisionPragmaHandler(Name, Context, Precision);
+}
+
+RSPragmaHandler *
+RSPragmaHandler::CreatePragmaReduceHandler(RSContext *Context) {
+  return new RSReducePragmaHandler("reduce", Context);
+}
+
+RSPragmaHandler *
+RSPragmaHandler::CreatePragmaFuseHandler(RSContext *Context) {
+  return new RSFusePragmaHandler("fuse", Context);
+}
+
+void RSPragmaHandler::reportError(clang::Preprocessor &PP,
+                                  const clang::Token &Tok,
+                                  const char *Message) {
+  PP.Diag(Tok,
+          PP.getDiagnostics().getCustomDiagID(
+              clang::DiagnosticsEngine::Error, Message));
+  return;
+}
+
 void RSPragmaHandler::handleItemListPragma(clang::Preprocessor &PP,
                                            clang::Token &FirstToken) {
   clang::Token &PragmaToken = FirstToken;
@@ -21,6 +21,8 @@
 
 #include "clang/Lex/Pragma.h"
 
+#include "slang_rs_context.h"
+
 namespace clang {
   class Token;
   class IdentifierInfo;
@@ -64,12 +66,21 @@ class RSPragmaHandler : public clang::PragmaHandler {
   void handleIntegerParamPragma(clang::Preprocessor &PP,
                                 clang::Token &FirstToken);
 
+  void reportError(clang::Preprocessor &PP, const clang::Token &Tok,
+                   const char *Message);
+
  public:
   static RSPragmaHandler *CreatePragmaExportTypeHandler(RSContext *Context);
   static RSPragmaHandler *CreatePragmaJavaPackageNameHandler(
       RSContext *Context);
   static RSPragmaHandler *CreatePragmaReflectLicenseHandler(RSContext *Context);
   static RSPragmaHandler *CreatePragmaVersionHandler(RSContext *Context);
+  static RSPragmaHandler *CreatePragmaSpecializeHandler(RSContext *Context);
+  static RSPragmaHandler *CreatePragmaKernelPrecisionHandler(
+      RSContext *Context, llvm::StringRef Name,
+      RSContext::KernelPrecision Precision);
+  static RSPragmaHandler *CreatePragmaReduceHandler(RSContext *Context);
+  static RSPragmaHandler *CreatePragmaFuseHandler(RSContext *Context);
 
   virtual void HandlePragma(clang::Preprocessor &PP,
                             clang::PragmaIntroducerKind Introducer,
@@ -16,11 +16,15 @@
 
 #include "slang_rs_reflect_utils.h"
 
+#include <algorithm>
 #include <cstdio>
 #include <cstring>
 #include <string>
 
+#include "llvm/ADT/OwningPtr.h"
 #include "llvm/ADT/StringRef.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/system_error.h"
 
 #include "os_sep.h"
 #include "slang_utils.h"
@@ -158,11 +162,30 @@ static bool GenerateSegmentMethod(
     return true;
 }
 
+// Get the bitcode of the context, from memory if it's there. Otherwise it's
+// read from the file into *file, which holds it.
+static bool GetBitCode(
+    const RSSlangReflectUtils::BitCodeAccessorContext &context,
+    llvm::OwningPtr<llvm::MemoryBuffer> *file, llvm::StringRef *bc) {
+    if (context.bcBuffer != NULL) {
+        *bc = *context.bcBuffer;
+        return true;
+    }
+
+    if (llvm::MemoryBuffer::getFile(context.bcFileName, *file) !=
+        llvm::errc::success) {
+        fprintf(stderr, "Error: could not read file %s\n", context.bcFileName);
+        return false;
+    }
+    *bc = (*file)->getBuffer();
+    return true;
+}
+
 static bool GenerateJavaCodeAccessorMethod(
     const RSSlangReflectUtils::BitCodeAccessorContext &context, FILE *pfout) {
-    FILE *pfin = fopen(context.bcFileName, "rb");
-    if (pfin == NULL) {
-        fprintf(stderr, "Error: could not read file %s\n", context.bcFileName);
+    llvm::OwningPtr<llvm::MemoryBuffer> file;
+    llvm::StringRef bc;
+    if (!GetBitCode(context, &file, &bc)) {
         return false;
     }
 
@@ -175,18 +198,14 @@ static bool GenerateJavaCodeAccessorMethod(
     // output the data
     // make sure the generated function for a segment won't break the Javac
     // size limitation (64K).
-    static const int SEG_SIZE = 0x2000;
-    char *buff = new char[SEG_SIZE];
-    int read_length;
+    static const size_t SEG_SIZE = 0x2000;
     int seg_num = 0;
-    int total_length = 0;
-    while ((read_length = fread(buff, 1, SEG_SIZE, pfin)) > 0) {
-        GenerateSegmentMethod(buff, read_length, seg_num, pfout);
+    int total_length = bc.size();
+    for (size_t offset = 0; offset < bc.size(); offset += SEG_SIZE) {
+        size_t length = std::min(SEG_SIZE, bc.size() - offset);
+        GenerateSegmentMethod(bc.data() + offset, length, seg_num, pfout);
         ++seg_num;
-        total_length += read_length;
     }
-    delete []buff;
-    fclose(pfin);
 
     // output the internal accessor method
     fprintf(pfout, "  private static int bitCodeLength = %d;\n\n",
@@ -206,6 +225,68 @@ static bool GenerateJavaCodeAccessorMethod(
     return true;
 }
 
+// Java string constants must not exceed 64k bytes in the class file (in
+// modified UTF-8, where a char takes up to 2 bytes), so the bitcode is split
+// into multiple string chunks. Each char of a chunk holds one byte.
+static void GenerateStringChunk(const char *buff, int blen, FILE *pfout) {
+    static const int LINE_BYTE_NUM = 32;
+
+    fprintf(pfout, "    \"");
+    for (int i = 0; i < blen; ++i) {
+        unsigned char c = static_cast<unsigned char>(buff[i]);
+        if ((i > 0) && ((i % LINE_BYTE_NUM) == 0)) {
+            fprintf(pfout, "\" +\n    \"");
+        }
+        if ((c >= 0x20) && (c < 0x7f) && (c != '"') && (c != '\\')) {
+            fputc(c, pfout);
+        } else {
+            // Always use 3 digits, so a following digit isn't taken as part
+            // of the escape.
+            fprintf(pfout, "\\%03o", c);
+        }
+    }
+    fprintf(pfout, "\",\n");
+    return;
+}
+
+static bool GenerateJavaStringAccessorMethod(
+    const RSSlangReflectUtils::BitCodeAccessorContext &context, FILE *pfout) {
+    llvm::OwningPtr<llvm::MemoryBuffer> file;
+    llvm::StringRef bc;
+    if (!GetBitCode(context, &file, &bc)) {
+        return false;
+    }
+
+    // output the data
+    fprintf(pfout, "  // the bitcode, one byte per char.\n");
+    fprintf(pfout, "  private static final String[] bitCodeChunks = {\n");
+
+    static const size_t CHUNK_SIZE = 0x4000;
+    int total_length = bc.size();
+    for (size_t offset = 0; offset < bc.size(); offset += CHUNK_SIZE) {
+        size_t length = std::min(CHUNK_SIZE, bc.size() - offset);
+        GenerateStringChunk(bc.data() + offset, length, pfout);
+    }
+
+    fprintf(pfout, "  };\n\n");
+    fprintf(pfout, "  private static final int bitCodeLength = %d;\n\n",
+        total_length);
+
+    // the accessor method decodes the chunks in place
+    GenerateAccessorMethodSignature(context, pfout);
+    fprintf(pfout, "    byte[] bc = new byte[bitCodeLength];\n");
+    fprintf(pfout, "    int offset = 0;\n");
+    fprintf(pfout, "    for (String chunk : bitCodeChunks) {\n");
+    fprintf(pfout, "      for (int i = 0, e = chunk.length(); i < e; i++) {\n");
+    fprintf(pfout, "        bc[offset++] = (byte) chunk.charAt(i);\n");
+    fprintf(pfout, "      }\n");
+    fprintf(pfout, "    }\n");
+    fprintf(pfout, "    return bc;\n");
+    fprintf(pfout, "  }\n\n");
+
+    return true;
+}
+
 static bool GenerateAccessorClass(
     const RSSlangReflectUtils::BitCodeAccessorContext &context,
     const char *clazz_name, FILE *pfout) {
@@ -223,6 +304,9 @@ static bool GenerateAccessorClass(
       case BCST_JAVA_CODE:
         ret = GenerateJavaCodeAccessorMethod(context, pfout);
         break;
+      case BCST_JAVA_STRING:
+        ret = GenerateJavaStringAccessorMethod(context, pfout);
+        break;
       default:
         ret = false;
     }
@@ -253,11 +337,21 @@ bool RSSlangReflectUtils::GenerateBitCodeAccessor(
     string output_filename(output_path);
     output_filename += OS_PATH_SEPARATOR_STR;
     output_filename += filename;
+    string pending_filename(output_filename);
+    if (context.writeIfChanged) {
+        string error;
+        if (!SlangUtils::CreatePendingFile(output_filename, &pending_filename,
+                                           &error)) {
+            fprintf(stderr, "Error: could not write to file %s (%s)\n",
+                    output_filename.c_str(), error.c_str());
+            return false;
+        }
+    }
     printf("Generating %s ...\n", filename.c_str());
-    FILE *pfout = fopen(output_filename.c_str(), "w");
+    FILE *pfout = fopen(pending_filename.c_str(), "w");
     if (pfout == NULL) {
         fprintf(stderr, "Error: could not write to file %s\n",
-                output_filename.c_str());
+                pending_filename.c_str());
         return false;
     }
 
@@ -265,6 +359,15 @@ bool RSSlangReflectUtils::GenerateBitCodeAccessor(
                GenerateAccessorClass(context, clazz_name.c_str(), pfout);
 
     fclose(pfout);
+    if (ret && context.writeIfChanged) {
+        string error;
+        if (!SlangUtils::ReplaceFileIfChanged(pending_filename,
+                                              output_filename, &error)) {
+            fprintf(stderr, "Error: could not write to file %s (%s)\n",
+                    output_filename.c_str(), error.c_str());
+            return false;
+        }
+    }
     return ret;
 }
 }  // namespace slang
@@ -25,7 +25,10 @@ namespace slang {
 enum BitCodeStorageType {
   BCST_APK_RESOURCE,
   BCST_JAVA_CODE,
-  BCST_CPP_CODE
+  BCST_CPP_CODE,
+  // Like BCST_JAVA_CODE, but the bitcode is packed into string constants
+  // (one byte per char) rather than spelled out as Java byte arrays.
+  BCST_JAVA_STRING
 };
 
 class RSSlangReflectUtils {
@@ -36,13 +39,18 @@ class RSSlangReflectUtils {
   // reflectPath: where to output the generated Java file, no package name in
   // it.
   // packageName: the package of the output Java file.
+  // writeIfChanged: leave the Java file alone if its content doesn't change.
   struct BitCodeAccessorContext {
     const char *rsFileName;
     const char *bcFileName;
+    // The content of bcFileName, if it's in memory (NULL if it's not, then
+    // the file is read)
+    const std::string *bcBuffer;
     const char *reflectPath;
     const char *packageName;
 
     BitCodeStorageType bcStorage;
+    bool writeIfChanged;
   };
 
   // Return the stem of the file name, i.e., remove the dir and the extension.
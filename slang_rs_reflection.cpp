@@ -17,24 +17,34 @@
 #include "slang_rs_reflection.h"
 
 #include <sys/stat.h>
+#if !defined(_WIN32)
+#include <pthread.h>
+#endif
 
 #include <cstdarg>
 #include <cctype>
 
 #include <algorithm>
+#include <set>
 #include <sstream>
 #include <string>
 #include <utility>
 
 #include "llvm/ADT/APFloat.h"
+#include "llvm/ADT/OwningPtr.h"
 #include "llvm/ADT/StringExtras.h"
+#include "llvm/Support/Mutex.h"
+#include "llvm/Support/MutexGuard.h"
+#include "llvm/Support/Threading.h"
 
 #include "os_sep.h"
 #include "slang_rs_context.h"
 #include "slang_rs_export_var.h"
 #include "slang_rs_export_foreach.h"
 #include "slang_rs_export_func.h"
+#include "slang_rs_export_reduce.h"
 #include "slang_rs_reflect_utils.h"
+#include "slang_rs_reflection_manifest.h"
 #include "slang_version.h"
 #include "slang_utils.h"
 
@@ -49,6 +59,9 @@
 
 #define RS_TYPE_ITEM_BUFFER_NAME         "mItemArray"
 #define RS_TYPE_ITEM_BUFFER_PACKER_NAME  "mIOBuffer"
+#define RS_TYPE_BYTE_BUFFER_NAME         "mByteBuffer"
+#define RS_TYPE_DIRTY_MIN_NAME           "mDirtyMin"
+#define RS_TYPE_DIRTY_MAX_NAME           "mDirtyMax"
 #define RS_TYPE_ELEMENT_REF_NAME         "mElementCache"
 
 #define RS_EXPORT_VAR_INDEX_PREFIX       "mExportVarIdx_"
@@ -58,13 +71,44 @@
 #define RS_EXPORT_VAR_CONST_PREFIX       "const_"
 
 #define RS_ELEM_PREFIX                   "__"
+#define RS_LAZY_ELEM_PREFIX              "__elem_"
+#define RS_CONTEXT_NAME                  "__rs_context"
 
 #define RS_FP_PREFIX                     "__rs_fp_"
+#define RS_INVOKE_FP_PREFIX              RS_FP_PREFIX "invoke_"
+#define RS_FOREACH_FP_PREFIX             RS_FP_PREFIX "forEach_"
 
 #define RS_RESOURCE_NAME                 "__rs_resource_name"
 
+#define RS_INIT_BLOB_PREFIX              "__rs_init_"
+#define RS_INIT_UNPACK_NAME              "__rs_unpack"
+// Arrays with fewer initial values are set a value at a time.
+#define RS_INIT_BLOB_MIN_VALUES          16
+// The chars of each string constant of a blob, such that its modified UTF-8
+// (at most 3 bytes per char) fits the 64K limit of the class file.
+#define RS_INIT_BLOB_CHUNK_SIZE          8192
+
 #define RS_EXPORT_FUNC_INDEX_PREFIX      "mExportFuncIdx_"
 #define RS_EXPORT_FOREACH_INDEX_PREFIX   "mExportForEachIdx_"
+#define RS_EXPORT_REDUCE_INDEX_PREFIX    "mExportReduceIdx_"
+#define RS_EXPORT_FOREACH_SPECIALIZED_INDEX_PREFIX \
+    "mExportForEachSpecializedIdx_"
+#define RS_EXPORT_FUNC_READS_PREFIX      "mExportFuncReads_"
+#define RS_EXPORT_FUNC_WRITES_PREFIX     "mExportFuncWrites_"
+#define RS_EXPORT_FOREACH_READS_PREFIX   "mExportForEachReads_"
+#define RS_EXPORT_FOREACH_WRITES_PREFIX  "mExportForEachWrites_"
+#define RS_SPECIALIZED_VALUES_MATCH_NAME "specializedValuesMatch"
+
+#define RS_BOUND_LAUNCH_CLASS_PREFIX     "BoundLaunch_"
+
+#define RS_VAR_BATCH_CLASS_NAME          "VarBatch"
+#define RS_VAR_BATCH_PACKET_NAME         "mPacket"
+#define RS_VAR_BATCH_MASK_NAME           "mMask"
+#define RS_VAR_BATCH_FUNC_INDEX_NAME     "mExportFuncIdx_set_vars_batch"
+
+#define RS_PROFILE_COUNTERS_NAME         "__rs_profile_counters"
+#define RS_PROFILE_COUNTERS_INDEX_NAME   "__rs_profile_counters_idx"
+#define RS_PROFILE_COUNTER_INDEX_PREFIX  "mProfileCounterIdx_"
 
 #define RS_EXPORT_VAR_ALLOCATION_PREFIX  "mAlloction_"
 #define RS_EXPORT_VAR_DATA_STORAGE_PREFIX "mData_"
@@ -159,6 +203,303 @@ static const char *GetPackerAPIName(const RSExportPrimitiveType *EPT) {
   return NULL;
 }
 
+// The Java type of the (elements of the) primitive or vector type which can
+// be packed into a FieldPacker in bulk through a java.nio buffer, or NULL.
+// BufferView receives the method giving the view of a ByteBuffer that takes
+// such values. Unsigned types are left out since FieldPacker checks the range
+// of their values.
+static const char *GetBulkPackerType(const RSExportType *ET,
+                                     const char **BufferView) {
+  if ((ET->getClass() != RSExportType::ExportClassPrimitive) &&
+      (ET->getClass() != RSExportType::ExportClassVector))
+    return NULL;
+
+  switch (static_cast<const RSExportPrimitiveType*>(ET)->getType()) {
+    case RSExportPrimitiveType::DataTypeFloat32: {
+      *BufferView = "asFloatBuffer()";
+      return "float";
+    }
+    case RSExportPrimitiveType::DataTypeFloat64: {
+      *BufferView = "asDoubleBuffer()";
+      return "double";
+    }
+    case RSExportPrimitiveType::DataTypeSigned8: {
+      *BufferView = NULL;
+      return "byte";
+    }
+    case RSExportPrimitiveType::DataTypeSigned16: {
+      *BufferView = "asShortBuffer()";
+      return "short";
+    }
+    case RSExportPrimitiveType::DataTypeSigned32: {
+      *BufferView = "asIntBuffer()";
+      return "int";
+    }
+    case RSExportPrimitiveType::DataTypeSigned64: {
+      *BufferView = "asLongBuffer()";
+      return "long";
+    }
+    default: {
+      return NULL;
+    }
+  }
+}
+
+// The expressions putting the value of a primitive type into, and getting it
+// from, the (little-endian) java.nio.ByteBuffer b at Offset. Values of the
+// unsigned types are kept in the wider Java type FieldPacker takes them in.
+static std::string GetByteBufferPut(RSExportPrimitiveType::DataType DT,
+                                    const std::string &Offset,
+                                    const std::string &Value) {
+  switch (DT) {
+    case RSExportPrimitiveType::DataTypeFloat32:
+      return "b.putFloat(" + Offset + ", " + Value + ")";
+    case RSExportPrimitiveType::DataTypeFloat64:
+      return "b.putDouble(" + Offset + ", " + Value + ")";
+    case RSExportPrimitiveType::DataTypeSigned8:
+      return "b.put(" + Offset + ", " + Value + ")";
+    case RSExportPrimitiveType::DataTypeSigned16:
+      return "b.putShort(" + Offset + ", " + Value + ")";
+    case RSExportPrimitiveType::DataTypeSigned32:
+      return "b.putInt(" + Offset + ", " + Value + ")";
+    case RSExportPrimitiveType::DataTypeSigned64:
+    case RSExportPrimitiveType::DataTypeUnsigned64:
+      return "b.putLong(" + Offset + ", " + Value + ")";
+    case RSExportPrimitiveType::DataTypeUnsigned8:
+      return "b.put(" + Offset + ", (byte) " + Value + ")";
+    case RSExportPrimitiveType::DataTypeUnsigned16:
+      return "b.putShort(" + Offset + ", (short) " + Value + ")";
+    case RSExportPrimitiveType::DataTypeUnsigned32:
+      return "b.putInt(" + Offset + ", (int) " + Value + ")";
+    case RSExportPrimitiveType::DataTypeBoolean:
+      return "b.put(" + Offset + ", (byte) (" + Value + " ? 1 : 0))";
+    default:
+      slangAssert(false && "GetByteBufferPut : Unsupported data type");
+  }
+  return "";
+}
+
+static std::string GetByteBufferGet(RSExportPrimitiveType::DataType DT,
+                                    const std::string &Offset) {
+  switch (DT) {
+    case RSExportPrimitiveType::DataTypeFloat32:
+      return "b.getFloat(" + Offset + ")";
+    case RSExportPrimitiveType::DataTypeFloat64:
+      return "b.getDouble(" + Offset + ")";
+    case RSExportPrimitiveType::DataTypeSigned8:
+      return "b.get(" + Offset + ")";
+    case RSExportPrimitiveType::DataTypeSigned16:
+      return "b.getShort(" + Offset + ")";
+    case RSExportPrimitiveType::DataTypeSigned32:
+      return "b.getInt(" + Offset + ")";
+    case RSExportPrimitiveType::DataTypeSigned64:
+    case RSExportPrimitiveType::DataTypeUnsigned64:
+      return "b.getLong(" + Offset + ")";
+    case RSExportPrimitiveType::DataTypeUnsigned8:
+      return "(short) (b.get(" + Offset + ") & 0xff)";
+    case RSExportPrimitiveType::DataTypeUnsigned16:
+      return "(b.getShort(" + Offset + ") & 0xffff)";
+    case RSExportPrimitiveType::DataTypeUnsigned32:
+      return "(b.getInt(" + Offset + ") & 0xffffffffL)";
+    case RSExportPrimitiveType::DataTypeBoolean:
+      return "(b.get(" + Offset + ") != 0)";
+    default:
+      slangAssert(false && "GetByteBufferGet : Unsupported data type");
+  }
+  return "";
+}
+
+// Whether values of ET can be kept in a ByteBuffer (i.e., it has no RS object
+// or pointer in it, which the Java side holds as objects).
+static bool IsByteBufferBackable(const RSExportType *ET) {
+  switch (ET->getClass()) {
+    case RSExportType::ExportClassPrimitive:
+    case RSExportType::ExportClassVector: {
+      switch (static_cast<const RSExportPrimitiveType*>(ET)->getType()) {
+        case RSExportPrimitiveType::DataTypeFloat32:
+        case RSExportPrimitiveType::DataTypeFloat64:
+        case RSExportPrimitiveType::DataTypeSigned8:
+        case RSExportPrimitiveType::DataTypeSigned16:
+        case RSExportPrimitiveType::DataTypeSigned32:
+        case RSExportPrimitiveType::DataTypeSigned64:
+        case RSExportPrimitiveType::DataTypeUnsigned8:
+        case RSExportPrimitiveType::DataTypeUnsigned16:
+        case RSExportPrimitiveType::DataTypeUnsigned32:
+        case RSExportPrimitiveType::DataTypeUnsigned64:
+        case RSExportPrimitiveType::DataTypeBoolean:
+          return true;
+        default:
+          return false;
+      }
+    }
+    case RSExportType::ExportClassMatrix: {
+      return true;
+    }
+    case RSExportType::ExportClassConstantArray: {
+      return IsByteBufferBackable(
+          static_cast<const RSExportConstantArrayType*>(ET)->getElementType());
+    }
+    case RSExportType::ExportClassRecord: {
+      const RSExportRecordType *ERT =
+          static_cast<const RSExportRecordType*>(ET);
+      for (RSExportRecordType::const_field_iterator I = ERT->fields_begin(),
+               E = ERT->fields_end();
+           I != E;
+           I++) {
+        if (!IsByteBufferBackable((*I)->getType()))
+          return false;
+      }
+      return true;
+    }
+    default: {
+      return false;
+    }
+  }
+}
+
+// The number of 16-bit chars the bits of the Java type values of DT are
+// reflected as are packed into (see PackInitValue()), 0 if they can't be.
+static unsigned GetPackedWidth(RSExportPrimitiveType::DataType DT) {
+  switch (DT) {
+    case RSExportPrimitiveType::DataTypeSigned8:
+    case RSExportPrimitiveType::DataTypeSigned16:
+    case RSExportPrimitiveType::DataTypeUnsigned8:
+    case RSExportPrimitiveType::DataTypeBoolean:
+      return 1;
+    case RSExportPrimitiveType::DataTypeFloat32:
+    case RSExportPrimitiveType::DataTypeSigned32:
+    case RSExportPrimitiveType::DataTypeUnsigned16:
+      return 2;
+    case RSExportPrimitiveType::DataTypeFloat64:
+    case RSExportPrimitiveType::DataTypeSigned64:
+    case RSExportPrimitiveType::DataTypeUnsigned32:
+    case RSExportPrimitiveType::DataTypeUnsigned64:
+      return 4;
+    default:
+      return 0;
+  }
+}
+
+// Append the bits of Val (as the Java type DT is reflected as) to Blob, low
+// chars first. Returns false if Val isn't a value of DT.
+static bool PackInitValue(RSExportPrimitiveType::DataType DT,
+                          const clang::APValue &Val,
+                          std::vector<uint16_t> *Blob) {
+  bool IsFloat = (DT == RSExportPrimitiveType::DataTypeFloat32) ||
+                 (DT == RSExportPrimitiveType::DataTypeFloat64);
+  uint64_t Bits;
+  if (Val.isFloat() && IsFloat) {
+    Bits = Val.getFloat().bitcastToAPInt().getZExtValue();
+  } else if (Val.isInt() && !IsFloat) {
+    const llvm::APSInt &Int = Val.getInt();
+    if (DT == RSExportPrimitiveType::DataTypeBoolean)
+      Bits = (Int != 0);
+    else if (Int.isSigned())
+      Bits = static_cast<uint64_t>(Int.getSExtValue());
+    else
+      Bits = Int.getZExtValue();
+  } else {
+    return false;
+  }
+
+  for (unsigned i = 0, e = GetPackedWidth(DT); i != e; i++)
+    Blob->push_back(static_cast<uint16_t>(Bits >> (16 * i)));
+  return true;
+}
+
+// The expression of the Java value of DT whose packed bits are the long
+// Bits.
+static std::string GetUnpackedValue(RSExportPrimitiveType::DataType DT,
+                                    const std::string &Bits) {
+  switch (DT) {
+    case RSExportPrimitiveType::DataTypeFloat32:
+      return "Float.intBitsToFloat((int) " + Bits + ")";
+    case RSExportPrimitiveType::DataTypeFloat64:
+      return "Double.longBitsToDouble(" + Bits + ")";
+    case RSExportPrimitiveType::DataTypeSigned8:
+      return "(byte) " + Bits;
+    case RSExportPrimitiveType::DataTypeSigned16:
+    case RSExportPrimitiveType::DataTypeUnsigned8:
+      return "(short) " + Bits;
+    case RSExportPrimitiveType::DataTypeSigned32:
+    case RSExportPrimitiveType::DataTypeUnsigned16:
+      return "(int) " + Bits;
+    case RSExportPrimitiveType::DataTypeBoolean:
+      return "(" + Bits + " != 0)";
+    default:
+      return Bits;
+  }
+}
+
+// The Java array type a value of DT is copied out of an Allocation into, and
+// the expression of the value (as the Java type DT is reflected as) of its
+// element Elem.
+static const char *GetCopyArrayType(RSExportPrimitiveType::DataType DT) {
+  switch (DT) {
+    case RSExportPrimitiveType::DataTypeFloat32:
+      return "float";
+    case RSExportPrimitiveType::DataTypeFloat64:
+      return "double";
+    case RSExportPrimitiveType::DataTypeSigned16:
+    case RSExportPrimitiveType::DataTypeUnsigned16:
+      return "short";
+    case RSExportPrimitiveType::DataTypeSigned32:
+    case RSExportPrimitiveType::DataTypeUnsigned32:
+      return "int";
+    case RSExportPrimitiveType::DataTypeSigned64:
+    case RSExportPrimitiveType::DataTypeUnsigned64:
+      return "long";
+    default:
+      return "byte";
+  }
+}
+
+static std::string GetCopiedValue(RSExportPrimitiveType::DataType DT,
+                                  const std::string &Elem) {
+  switch (DT) {
+    case RSExportPrimitiveType::DataTypeUnsigned8:
+      return "(short) (" + Elem + " & 0xff)";
+    case RSExportPrimitiveType::DataTypeUnsigned16:
+      return "(" + Elem + " & 0xffff)";
+    case RSExportPrimitiveType::DataTypeUnsigned32:
+      return "(" + Elem + " & 0xffffffffL)";
+    case RSExportPrimitiveType::DataTypeBoolean:
+      return "(" + Elem + " != 0)";
+    default:
+      return Elem;
+  }
+}
+
+// The chars of Blob[Begin, End) as the contents of a Java string literal.
+// Unicode escapes are processed before the literal is, so the ones standing
+// for a line terminator, '"' or '\\' are written as an escape sequence.
+static std::string GetStringLiteralChars(const std::vector<uint16_t> &Blob,
+                                         size_t Begin, size_t End) {
+  std::string S;
+  for (size_t i = Begin; i != End; i++) {
+    uint16_t Char = Blob[i];
+    if ((Char == '"') || (Char == '\\')) {
+      S.push_back('\\');
+      S.push_back(static_cast<char>(Char));
+    } else if (Char == '\n') {
+      S.append("\\n");
+    } else if (Char == '\r') {
+      S.append("\\r");
+    } else if ((Char >= 0x20) && (Char < 0x7f)) {
+      S.push_back(static_cast<char>(Char));
+    } else {
+      S.append("\\u" + llvm::utohexstr(0x10000 | Char).substr(1));
+    }
+  }
+  return S;
+}
+
+static std::string AddOffset(const std::string &Base, size_t Offset) {
+  if (Offset == 0)
+    return Base;
+  return Base + " + " + llvm::utostr(Offset);
+}
+
 static std::string GetTypeName(const RSExportType *ET, bool Brackets = true) {
   switch (ET->getClass()) {
     case RSExportType::ExportClassPrimitive: {
@@ -302,6 +643,16 @@ bool RSReflection::genScriptClass(Context &C,
              E = mRSContext->export_foreach_end();
          I != E; I++)
       genExportForEach(C, *I);
+
+    if (mRSContext->hasSpecializedVars())
+      genSpecializedValuesMatch(C);
+
+    for (RSContext::const_export_reduce_iterator
+             I = mRSContext->export_reduce_begin(),
+             E = mRSContext->export_reduce_end();
+         I != E;
+         I++)
+      genExportReduce(C, *I);
   }
 
   // Reflect export function
@@ -311,9 +662,16 @@ bool RSReflection::genScriptClass(Context &C,
        I != E; I++)
     genExportFunction(C, *I);
 
-  C.endClass();
+  // Reflect the batch setter, whose slot follows the one of the last export
+  // function
+  if (mRSContext->hasVarBatch())
+    genVarBatchClass(C);
 
-  return true;
+  genProfileCounters(C, /* Declare = */true);
+
+  genInitBlobs(C);
+
+  return C.endClass(ErrorMsg);
 }
 
 void RSReflection::genScriptClassConstructor(Context &C) {
@@ -322,6 +680,20 @@ void RSReflection::genScriptClassConstructor(Context &C) {
              << C.getResourceId()
              << "\";" << std::endl;
 
+  const std::vector<std::string> &ABIs = mRSContext->getPrebuiltABIs();
+  if (!ABIs.empty()) {
+    // The runtime doesn't need to compile the bitcode on these.
+    C.indent() << "// ABIs with code of the script compiled ahead of time"
+               << std::endl;
+    C.indent() << "public static final String[] PREBUILT_ABIS = { ";
+    for (unsigned i = 0, e = ABIs.size(); i != e; i++) {
+      if (i != 0)
+        C.out() << ", ";
+      C.out() << "\"" << ABIs[i] << "\"";
+    }
+    C.out() << " };" << std::endl;
+  }
+
   // Generate a simple constructor with only a single parameter (the rest
   // can be inferred from information we already have).
   C.indent() << "// Constructor" << std::endl;
@@ -354,6 +726,12 @@ void RSReflection::genScriptClassConstructor(Context &C) {
   // Call constructor of super class
   C.indent() << "super(rs, resources, id);" << std::endl;
 
+  // The Elements (and the initial values allocating objects) are created on
+  // first use from here on.
+  C.mLazyElements = mRSContext->hasLazyInit();
+  if (C.mLazyElements || mRSContext->hasExportReduce())
+    C.indent() << RS_CONTEXT_NAME " = rs;" << std::endl;
+
   // If an exported variable has initial value, reflect it
 
   for (RSContext::const_export_var_iterator I = mRSContext->export_vars_begin(),
@@ -361,23 +739,8 @@ void RSReflection::genScriptClassConstructor(Context &C) {
        I != E;
        I++) {
     const RSExportVar *EV = *I;
-    if (!EV->getInit().isUninit()) {
-      genInitExportVariable(C, EV->getType(), EV->getName(), EV->getInit());
-    } else if (EV->getArraySize()) {
-      // Always create an initial zero-init array object.
-      C.indent() << RS_EXPORT_VAR_PREFIX << EV->getName() << " = new "
-                 << GetTypeName(EV->getType(), false) << "["
-                 << EV->getArraySize() << "];" << std::endl;
-      size_t NumInits = EV->getNumInits();
-      const RSExportConstantArrayType *ECAT =
-          static_cast<const RSExportConstantArrayType*>(EV->getType());
-      const RSExportType *ET = ECAT->getElementType();
-      for (size_t i = 0; i < NumInits; i++) {
-        std::stringstream Name;
-        Name << EV->getName() << "[" << i << "]";
-        genInitExportVariable(C, ET, Name.str(), EV->getInitArray(i));
-      }
-    }
+    if (!hasLazyInitialValue(EV))
+      genInitExportVariableValue(C, EV);
     if (mRSContext->getTargetAPI() >= SLANG_JB_TARGET_API) {
       genTypeInstance(C, EV->getType());
     }
@@ -401,14 +764,35 @@ void RSReflection::genScriptClassConstructor(Context &C) {
     }
   }
 
+  for (RSContext::const_export_reduce_iterator
+           I = mRSContext->export_reduce_begin(),
+           E = mRSContext->export_reduce_end();
+       I != E;
+       I++) {
+    genTypeInstance(C, (*I)->getInType());
+    genTypeInstance(C, (*I)->getResultType());
+  }
+
+  if (mRSContext->hasPreallocatedPackers() && !mRSContext->hasLazyInit())
+    genPreallocatedFieldPackers(C, /* Declare = */false);
+
+  genProfileCounters(C, /* Declare = */false);
+
   C.endFunction();
 
+  if (mRSContext->hasPreallocatedPackers())
+    genPreallocatedFieldPackers(C, /* Declare = */true);
+
   for (std::set<std::string>::iterator I = C.mTypesToCheck.begin(),
                                        E = C.mTypesToCheck.end();
        I != E;
        I++) {
     C.indent() << "private Element " RS_ELEM_PREFIX << *I << ";" << std::endl;
   }
+  if (C.mLazyElements || mRSContext->hasExportReduce())
+    C.indent() << "private RenderScript " RS_CONTEXT_NAME ";" << std::endl;
+  if (C.mLazyElements)
+    genLazyElements(C);
 
   for (std::set<std::string>::iterator I = C.mFieldPackerTypes.begin(),
                                        E = C.mFieldPackerTypes.end();
@@ -420,6 +804,201 @@ void RSReflection::genScriptClassConstructor(Context &C) {
   return;
 }
 
+void RSReflection::genInitExportVariableValue(Context &C,
+                                              const RSExportVar *EV) {
+  if (!EV->getInit().isUninit()) {
+    genInitExportVariable(C, EV->getType(), EV->getName(), EV->getInit());
+  } else if (EV->getArraySize()) {
+    // Always create an initial zero-init array object.
+    C.indent() << RS_EXPORT_VAR_PREFIX << EV->getName() << " = new "
+               << GetTypeName(EV->getType(), false) << "["
+               << EV->getArraySize() << "];" << std::endl;
+    if (genInitBlobExportVariable(C, EV))
+      return;
+    size_t NumInits = EV->getNumInits();
+    const RSExportConstantArrayType *ECAT =
+        static_cast<const RSExportConstantArrayType*>(EV->getType());
+    const RSExportType *ET = ECAT->getElementType();
+    for (size_t i = 0; i < NumInits; i++) {
+      std::stringstream Name;
+      Name << EV->getName() << "[" << i << "]";
+      genInitExportVariable(C, ET, Name.str(), EV->getInitArray(i));
+    }
+  }
+  return;
+}
+
+bool RSReflection::genInitBlobExportVariable(Context &C,
+                                             const RSExportVar *EV) {
+  const RSExportType *ET =
+      static_cast<const RSExportConstantArrayType*>(EV->getType())->
+          getElementType();
+  unsigned NumComponents;
+  if (ET->getClass() == RSExportType::ExportClassPrimitive)
+    NumComponents = 1;
+  else if (ET->getClass() == RSExportType::ExportClassVector)
+    NumComponents = static_cast<const RSExportVectorType*>(ET)->getNumElement();
+  else
+    return false;
+
+  RSExportPrimitiveType::DataType DT =
+      static_cast<const RSExportPrimitiveType*>(ET)->getType();
+  unsigned Width = GetPackedWidth(DT);
+  size_t NumInits = EV->getNumInits();
+  if ((Width == 0) || (NumInits * NumComponents < RS_INIT_BLOB_MIN_VALUES))
+    return false;
+
+  std::vector<uint16_t> Blob;
+  for (size_t i = 0; i < NumInits; i++) {
+    const clang::APValue &Val = EV->getInitArray(i);
+    for (unsigned j = 0; j < NumComponents; j++) {
+      if (!Val.isVector()) {
+        // A primitive, or a vector with all the components alike
+        if (!PackInitValue(DT, Val, &Blob))
+          return false;
+      } else if (j < Val.getVectorLength()) {
+        if (!PackInitValue(DT, Val.getVectorElt(j), &Blob))
+          return false;
+      } else {
+        Blob.insert(Blob.end(), Width, 0);
+      }
+    }
+  }
+  C.mInitBlobs[EV->getName()].swap(Blob);
+
+  std::string VarName = RS_EXPORT_VAR_PREFIX + EV->getName();
+  C.startBlock(true);
+  C.indent() << "long[] bits = " RS_INIT_UNPACK_NAME "(" RS_INIT_BLOB_PREFIX
+             << EV->getName() << ", " << (NumInits * NumComponents) << ", "
+             << Width << ");" << std::endl;
+  C.indent() << "for (int i = 0; i < " << NumInits << "; i++)";
+  C.startBlock();
+  if (NumComponents == 1) {
+    C.indent() << VarName << "[i] = " << GetUnpackedValue(DT, "bits[i]")
+               << ";" << std::endl;
+  } else {
+    C.indent() << VarName << "[i] = new " << GetTypeName(ET) << "();"
+               << std::endl;
+    for (unsigned j = 0; j < NumComponents; j++) {
+      std::stringstream Bits;
+      Bits << "bits[" << NumComponents << " * i + " << j << "]";
+      C.indent() << VarName << "[i]." << GetVectorAccessor(j) << " = "
+                 << GetUnpackedValue(DT, Bits.str()) << ";" << std::endl;
+    }
+  }
+  C.endBlock();
+  C.endBlock();
+  return true;
+}
+
+void RSReflection::genInitBlobs(Context &C) {
+  if (C.mInitBlobs.empty())
+    return;
+
+  // Chars per line of a string constant
+  static const size_t LineSize = 12;
+  for (std::map<std::string, std::vector<uint16_t> >::const_iterator
+           I = C.mInitBlobs.begin(),
+           E = C.mInitBlobs.end();
+       I != E;
+       I++) {
+    const std::vector<uint16_t> &Blob = I->second;
+    C.indent() << "private final static String[] " RS_INIT_BLOB_PREFIX
+               << I->first << " = {" << std::endl;
+    C.incIndentLevel();
+    for (size_t Chunk = 0; Chunk < Blob.size();
+         Chunk += RS_INIT_BLOB_CHUNK_SIZE) {
+      size_t ChunkEnd = std::min(Chunk + RS_INIT_BLOB_CHUNK_SIZE, Blob.size());
+      for (size_t Line = Chunk; Line < ChunkEnd; Line += LineSize) {
+        size_t LineEnd = std::min(Line + LineSize, ChunkEnd);
+        C.indent() << "\"" << GetStringLiteralChars(Blob, Line, LineEnd)
+                   << "\"";
+        if (LineEnd != ChunkEnd)
+          C.out() << " +";
+        else if (ChunkEnd != Blob.size())
+          C.out() << ",";
+        C.out() << std::endl;
+      }
+    }
+    C.decIndentLevel();
+    C.indent() << "};" << std::endl;
+  }
+  C.out() << std::endl;
+
+  // The values packed (low chars first) into count * width chars of blob
+  C.startFunction(Context::AM_Private, true, "long[]", RS_INIT_UNPACK_NAME,
+                  3, "String[]", "blob", "int", "count", "int", "width");
+  C.indent() << "long[] bits = new long[count];" << std::endl;
+  C.indent() << "int c = 0;" << std::endl;
+  C.indent() << "for (int i = 0; i < count; i++)";
+  C.startBlock();
+  C.indent() << "long b = 0;" << std::endl;
+  C.indent() << "for (int j = 0; j < width; j++, c++)";
+  C.startBlock();
+  C.indent() << "b |= ((long) blob[c / " << RS_INIT_BLOB_CHUNK_SIZE
+             << "].charAt(c % " << RS_INIT_BLOB_CHUNK_SIZE
+             << ")) << (16 * j);" << std::endl;
+  C.endBlock();
+  C.indent() << "bits[i] = b;" << std::endl;
+  C.endBlock();
+  C.indent() << "return bits;" << std::endl;
+  C.endFunction();
+
+  C.mInitBlobs.clear();
+  return;
+}
+
+bool RSReflection::hasLazyInitialValue(const RSExportVar *EV) const {
+  // The primitive initial values are constants, set along with the script.
+  if (!mRSContext->hasLazyInit())
+    return false;
+  if (EV->getInit().isUninit())
+    return (EV->getArraySize() != 0);
+  return ((EV->getType()->getClass() == RSExportType::ExportClassVector) &&
+          EV->getInit().isVector());
+}
+
+void RSReflection::genPreallocatedFieldPackers(Context &C, bool Declare) {
+  // The packet of each invokable and each kernel with a usrData goes to its
+  // own FieldPacker, which its (synchronized) methods reset and refill.
+  std::vector<std::pair<std::string, const RSExportRecordType*> > Packets;
+  for (RSContext::const_export_func_iterator
+           I = mRSContext->export_funcs_begin(),
+           E = mRSContext->export_funcs_end();
+       I != E;
+       I++) {
+    const RSExportFunc *EF = *I;
+    if (EF->hasParam())
+      Packets.push_back(std::make_pair(RS_INVOKE_FP_PREFIX + EF->getName(),
+                                       EF->getParamPacketType()));
+  }
+  if (mRSContext->getTargetAPI() >= SLANG_ICS_TARGET_API) {
+    for (RSContext::const_export_foreach_iterator
+             I = mRSContext->export_foreach_begin(),
+             E = mRSContext->export_foreach_end();
+         I != E;
+         I++) {
+      const RSExportForEach *EF = *I;
+      if (EF->getParamPacketType() != NULL)
+        Packets.push_back(std::make_pair(RS_FOREACH_FP_PREFIX + EF->getName(),
+                                         EF->getParamPacketType()));
+    }
+  }
+
+  for (unsigned i = 0, e = Packets.size(); i != e; i++) {
+    size_t AllocSize = RSExportType::GetTypeAllocSize(Packets[i].second);
+    if (AllocSize == 0)
+      continue;
+    if (Declare)
+      C.indent() << "private " << (mRSContext->hasLazyInit() ? "" : "final ")
+                 << "FieldPacker " << Packets[i].first << ";" << std::endl;
+    else
+      C.indent() << Packets[i].first << " = new FieldPacker(" << AllocSize
+                 << ");" << std::endl;
+  }
+  return;
+}
+
 void RSReflection::genInitBoolExportVariable(Context &C,
                                              const std::string &VarName,
                                              const clang::APValue &Val) {
@@ -598,10 +1177,41 @@ void RSReflection::genExportVariable(Context &C, const RSExportVar *EV) {
   return;
 }
 
+void RSReflection::genAccessSet(Context &C, const std::string &Name,
+                                const std::string &ReadsName,
+                                const std::string &WritesName) {
+  const RSContext::AccessSet *S = mRSContext->getAccessSet(Name);
+  if (S == NULL)
+    return;
+
+  // A name starting with RS_BOUND_ALLOCATION_PREFIX stands for the
+  // allocation bound to the pointer variable of the rest of the name.
+  const std::set<std::string> *Sets[] = { &S->Reads, &S->Writes };
+  const std::string *Names[] = { &ReadsName, &WritesName };
+  for (unsigned i = 0; i < 2; i++) {
+    C.indent() << "public final static String[] " << *Names[i] << " = ";
+    if (!S->Complete) {
+      C.out() << "null;" << std::endl;
+      continue;
+    }
+    C.out() << "{";
+    for (std::set<std::string>::const_iterator I = Sets[i]->begin(),
+             E = Sets[i]->end();
+         I != E;
+         I++)
+      C.out() << ((I == Sets[i]->begin()) ? " \"" : ", \"") << *I << "\"";
+    C.out() << (Sets[i]->empty() ? "};" : " };") << std::endl;
+  }
+  return;
+}
+
 void RSReflection::genExportFunction(Context &C, const RSExportFunc *EF) {
   C.indent() << "private final static int "RS_EXPORT_FUNC_INDEX_PREFIX
              << EF->getName() << " = " << C.getNextExportFuncSlot() << ";"
              << std::endl;
+  genAccessSet(C, EF->getName(),
+               RS_EXPORT_FUNC_READS_PREFIX + EF->getName(/*Mangle=*/ false),
+               RS_EXPORT_FUNC_WRITES_PREFIX + EF->getName(/*Mangle=*/ false));
 
   // invoke_*()
   Context::ArgTy Args;
@@ -616,7 +1226,9 @@ void RSReflection::genExportFunction(Context &C, const RSExportFunc *EF) {
     }
   }
 
-  C.startFunction(Context::AM_Public,
+  // The preallocated packet is filled under the lock of the script.
+  C.startFunction((EF->hasParam() && mRSContext->hasPreallocatedPackers()) ?
+                      Context::AM_PublicSynchronized : Context::AM_Public,
                   false,
                   "void",
                   "invoke_" + EF->getName(/*Mangle=*/ false),
@@ -631,8 +1243,9 @@ void RSReflection::genExportFunction(Context &C, const RSExportFunc *EF) {
     const RSExportRecordType *ERT = EF->getParamPacketType();
     std::string FieldPackerName = EF->getName() + "_fp";
 
-    if (genCreateFieldPacker(C, ERT, FieldPackerName.c_str()))
-      genPackVarOfType(C, ERT, NULL, FieldPackerName.c_str());
+    if (genPacketFieldPacker(C, ERT, RS_INVOKE_FP_PREFIX + EF->getName(),
+                             FieldPackerName.c_str()))
+      genPackVarOfType(C, ERT, NULL, FieldPackerName.c_str(), 0);
 
     C.indent() << "invoke("RS_EXPORT_FUNC_INDEX_PREFIX << EF->getName() << ", "
                << FieldPackerName << ");" << std::endl;
@@ -642,6 +1255,95 @@ void RSReflection::genExportFunction(Context &C, const RSExportFunc *EF) {
   return;
 }
 
+void RSReflection::genSpecializedValuesMatch(Context &C) {
+  // Whether the kernels can be launched in their variants specialized on the
+  // frozen variables (see #pragma rs specialize)
+  C.startFunction(Context::AM_Private,
+                  false,
+                  "boolean",
+                  RS_SPECIALIZED_VALUES_MATCH_NAME,
+                  0);
+  C.indent() << "return ";
+  const RSContext::SpecializedVarList &Vars = mRSContext->getSpecializedVars();
+  for (unsigned i = 0, e = Vars.size(); i != e; i++) {
+    std::string TypeName = GetTypeName(Vars[i].Var->getType());
+    if (i != 0)
+      C.out() << " &&" << std::endl << "       ";
+    C.out() << "(" RS_EXPORT_VAR_PREFIX << Vars[i].Name << " == ";
+    // The value is compared in the Java type of the variable, e.g., a frozen
+    // float is read as a float literal, rounded once as by the backend.
+    if (TypeName == "float")
+      C.out() << Vars[i].Value << "f";
+    else if (TypeName == "long")
+      C.out() << Vars[i].Value << "L";
+    else
+      C.out() << Vars[i].Value;
+    C.out() << ")";
+  }
+  C.out() << ";" << std::endl;
+  C.endFunction();
+  return;
+}
+
+void RSReflection::genForEachSlot(Context &C, const RSExportForEach *EF) {
+  if (mRSContext->getSpecializedForEachSlot(EF) < 0) {
+    C.out() << RS_EXPORT_FOREACH_INDEX_PREFIX << EF->getName();
+    return;
+  }
+  C.out() << "(" RS_SPECIALIZED_VALUES_MATCH_NAME "() ? "
+          << RS_EXPORT_FOREACH_SPECIALIZED_INDEX_PREFIX << EF->getName()
+          << " : " << RS_EXPORT_FOREACH_INDEX_PREFIX << EF->getName() << ")";
+  return;
+}
+
+void RSReflection::genExportReduce(Context &C, const RSExportReduce *ER) {
+  C.indent() << "private final static int " RS_EXPORT_REDUCE_INDEX_PREFIX
+             << ER->getName() << " = " << C.getNextExportReduceSlot() << ";"
+             << std::endl;
+
+  const RSExportType *RET = ER->getResultType();
+  std::string ResultTypeName = GetTypeName(RET);
+  C.startFunction(Context::AM_Public, false, ResultTypeName.c_str(),
+                  "reduce_" + ER->getName(), 1, "Allocation", "ain");
+  genTypeCheck(C, ER->getInType(), "ain");
+
+  C.indent() << "Allocation aout = Allocation.createSized(" RS_CONTEXT_NAME
+             << ", " << GetElementRef(C, RET->getElementName()) << ", 1);"
+             << std::endl;
+  C.indent() << "reduce(" RS_EXPORT_REDUCE_INDEX_PREFIX << ER->getName()
+             << ", new Allocation[] { ain }, aout, null);" << std::endl;
+
+  // The components of a vector of 3 are copied out as 4.
+  const RSExportPrimitiveType *EPT =
+      static_cast<const RSExportPrimitiveType*>(RET);
+  RSExportPrimitiveType::DataType DT = EPT->getType();
+  unsigned NumComponents = 1;
+  if (RET->getClass() == RSExportType::ExportClassVector)
+    NumComponents = static_cast<const RSExportVectorType*>(RET)->
+        getNumElement();
+  C.indent() << GetCopyArrayType(DT) << "[] outArray = new "
+             << GetCopyArrayType(DT) << "["
+             << ((NumComponents == 3) ? 4 : NumComponents) << "];"
+             << std::endl;
+  C.indent() << "aout.copyTo(outArray);" << std::endl;
+  C.indent() << "aout.destroy();" << std::endl;
+
+  if (RET->getClass() == RSExportType::ExportClassVector) {
+    C.indent() << "return new " << ResultTypeName << "(";
+    for (unsigned i = 0; i < NumComponents; i++) {
+      if (i != 0)
+        C.out() << ", ";
+      C.out() << GetCopiedValue(DT, "outArray[" + llvm::utostr(i) + "]");
+    }
+    C.out() << ");" << std::endl;
+  } else {
+    C.indent() << "return " << GetCopiedValue(DT, "outArray[0]") << ";"
+               << std::endl;
+  }
+  C.endFunction();
+  return;
+}
+
 void RSReflection::genExportForEach(Context &C, const RSExportForEach *EF) {
   if (EF->isDummyRoot()) {
     // Skip reflection for dummy root() kernels. Note that we have to
@@ -655,6 +1357,15 @@ void RSReflection::genExportForEach(Context &C, const RSExportForEach *EF) {
   C.indent() << "private final static int "RS_EXPORT_FOREACH_INDEX_PREFIX
              << EF->getName() << " = " << C.getNextExportForEachSlot() << ";"
              << std::endl;
+  genAccessSet(C, EF->getName(),
+               RS_EXPORT_FOREACH_READS_PREFIX + EF->getName(),
+               RS_EXPORT_FOREACH_WRITES_PREFIX + EF->getName());
+  int SpecializedSlot = mRSContext->getSpecializedForEachSlot(EF);
+  if (SpecializedSlot >= 0)
+    C.indent() << "private final static int "
+                  RS_EXPORT_FOREACH_SPECIALIZED_INDEX_PREFIX
+               << EF->getName() << " = " << SpecializedSlot << ";"
+               << std::endl;
 
   // forEach_*()
   Context::ArgTy Args;
@@ -732,42 +1443,25 @@ void RSReflection::genExportForEach(Context &C, const RSExportForEach *EF) {
     Args.push_back(std::make_pair("Script.LaunchOptions", "sc"));
   }
 
-  C.startFunction(Context::AM_Public,
+  // The preallocated packet is filled under the lock of the script.
+  C.startFunction(((ERT != NULL) && mRSContext->hasPreallocatedPackers()) ?
+                      Context::AM_PublicSynchronized : Context::AM_Public,
                   false,
                   "void",
                   "forEach_" + EF->getName(),
                   Args);
 
-  if (IET) {
-    genTypeCheck(C, IET, "ain");
-  }
-  if (OET) {
-    genTypeCheck(C, OET, "aout");
-  }
-
-  if (EF->hasIn() && (EF->hasOut() || EF->hasReturn())) {
-    C.indent() << "// Verify dimensions" << std::endl;
-    C.indent() << "Type tIn = ain.getType();" << std::endl;
-    C.indent() << "Type tOut = aout.getType();" << std::endl;
-    C.indent() << "if ((tIn.getCount() != tOut.getCount()) ||" << std::endl;
-    C.indent() << "    (tIn.getX() != tOut.getX()) ||" << std::endl;
-    C.indent() << "    (tIn.getY() != tOut.getY()) ||" << std::endl;
-    C.indent() << "    (tIn.getZ() != tOut.getZ()) ||" << std::endl;
-    C.indent() << "    (tIn.hasFaces() != tOut.hasFaces()) ||" << std::endl;
-    C.indent() << "    (tIn.hasMipmaps() != tOut.hasMipmaps())) {" << std::endl;
-    C.indent() << "    throw new RSRuntimeException(\"Dimension mismatch "
-               << "between input and output parameters!\");";
-    C.out()    << std::endl;
-    C.indent() << "}" << std::endl;
-  }
+  genForEachArgCheck(C, EF);
 
   std::string FieldPackerName = EF->getName() + "_fp";
   if (ERT) {
-    if (genCreateFieldPacker(C, ERT, FieldPackerName.c_str())) {
-      genPackVarOfType(C, ERT, NULL, FieldPackerName.c_str());
+    if (genPacketFieldPacker(C, ERT, RS_FOREACH_FP_PREFIX + EF->getName(),
+                             FieldPackerName.c_str())) {
+      genPackVarOfType(C, ERT, NULL, FieldPackerName.c_str(), 0);
     }
   }
-  C.indent() << "forEach("RS_EXPORT_FOREACH_INDEX_PREFIX << EF->getName();
+  C.indent() << "forEach(";
+  genForEachSlot(C, EF);
 
   if (EF->hasIn())
     C.out() << ", ain";
@@ -791,43 +1485,343 @@ void RSReflection::genExportForEach(Context &C, const RSExportForEach *EF) {
   }
 
   C.endFunction();
+
+  genExportForEachBind(C, EF, Args);
+  genExportForEachBatch(C, EF);
   return;
 }
 
-void RSReflection::genTypeInstanceFromPointer(Context &C,
-                                              const RSExportType *ET) {
-  if (ET->getClass() == RSExportType::ExportClassPointer) {
-    // For pointer parameters to original forEach kernels.
-    const RSExportPointerType *EPT =
-        static_cast<const RSExportPointerType*>(ET);
-    genTypeInstance(C, EPT->getPointeeType());
-  } else {
-    // For handling pass-by-value kernel parameters.
-    genTypeInstance(C, ET);
-  }
-}
+void RSReflection::genExportForEachBind(Context &C,
+                                        const RSExportForEach *EF,
+                                        const Context::ArgTy &Args) {
+  bool HasIn = EF->hasIn();
+  bool HasOut = EF->hasOut() || EF->hasReturn();
+  const RSExportRecordType *ERT = EF->getParamPacketType();
+  bool HasLaunchOptions =
+      (mRSContext->getTargetAPI() >= SLANG_JB_MR2_TARGET_API);
+
+  // The bound launch of a kernel (as returned by bind_*()), which checks the
+  // allocations and packs the usrData once. Its run() issues the very launch
+  // forEach_*() with the same arguments would.
+  std::string ClassName = RS_BOUND_LAUNCH_CLASS_PREFIX + EF->getName();
+  C.indent() << "public class " << ClassName;
+  C.startBlock();
 
-void RSReflection::genTypeInstance(Context &C,
-                                   const RSExportType *ET) {
-  switch (ET->getClass()) {
-    case RSExportType::ExportClassPrimitive:
-    case RSExportType::ExportClassVector:
-    case RSExportType::ExportClassConstantArray: {
-      std::string TypeName = ET->getElementName();
-      if (C.addTypeNameForElement(TypeName)) {
-        C.indent() << RS_ELEM_PREFIX << TypeName << " = Element." << TypeName
-                   << "(rs);" << std::endl;
-      }
-      break;
-    }
+  if (HasIn)
+    C.indent() << "private Allocation mIn;" << std::endl;
+  if (HasOut)
+    C.indent() << "private Allocation mOut;" << std::endl;
+  if (EF->hasUsrData())
+    C.indent() << "private FieldPacker mUsrData;" << std::endl;
+  if (HasLaunchOptions)
+    C.indent() << "private Script.LaunchOptions mLaunchOptions;" << std::endl;
+  C.out() << std::endl;
 
-    case RSExportType::ExportClassRecord: {
-      std::string ClassName = ET->getElementName();
-      if (C.addTypeNameForElement(ClassName)) {
-        C.indent() << RS_ELEM_PREFIX << ClassName << " = " << ClassName <<
-                      ".createElement(rs);" << std::endl;
-      }
-      break;
+  C.startFunction(Context::AM_Private,
+                  false,
+                  NULL,
+                  ClassName,
+                  Args);
+
+  genForEachArgCheck(C, EF);
+
+  if (HasIn)
+    C.indent() << "mIn = ain;" << std::endl;
+  if (HasOut)
+    C.indent() << "mOut = aout;" << std::endl;
+
+  std::string FieldPackerName = EF->getName() + "_fp";
+  if (ERT) {
+    if (genCreateFieldPacker(C, ERT, FieldPackerName.c_str())) {
+      genPackVarOfType(C, ERT, NULL, FieldPackerName.c_str(), 0);
+    }
+  }
+  if (EF->hasUsrData())
+    C.indent() << "mUsrData = " << FieldPackerName << ";" << std::endl;
+
+  if (HasLaunchOptions)
+    C.indent() << "mLaunchOptions = sc;" << std::endl;
+  C.endFunction();
+
+  C.startFunction(Context::AM_Public,
+                  false,
+                  "void",
+                  "run",
+                  0);
+  C.indent() << "forEach(";
+  genForEachSlot(C, EF);
+
+  if (HasIn)
+    C.out() << ", mIn";
+  else
+    C.out() << ", null";
+
+  if (HasOut)
+    C.out() << ", mOut";
+  else
+    C.out() << ", null";
+
+  if (EF->hasUsrData())
+    C.out() << ", mUsrData";
+  else
+    C.out() << ", null";
+
+  if (HasLaunchOptions) {
+    C.out() << ", mLaunchOptions);" << std::endl;
+  } else {
+    C.out() << ");" << std::endl;
+  }
+  C.endFunction();
+
+  // end BoundLaunch_* class
+  C.endBlock();
+
+  // bind_*(), with the same overloads as forEach_*()
+  Context::ArgTy BindArgs(Args);
+  if (HasLaunchOptions) {
+    BindArgs.pop_back();
+    C.startFunction(Context::AM_Public,
+                    false,
+                    ClassName.c_str(),
+                    "bind_" + EF->getName(),
+                    BindArgs);
+    C.indent() << "return new " << ClassName << "(";
+    for (Context::ArgTy::const_iterator I = BindArgs.begin(),
+             E = BindArgs.end();
+         I != E;
+         I++) {
+      C.out() << I->second << ", ";
+    }
+    // No clipped bounds to pass in.
+    C.out() << "null);" << std::endl;
+    C.endFunction();
+  }
+
+  C.startFunction(Context::AM_Public,
+                  false,
+                  ClassName.c_str(),
+                  "bind_" + EF->getName(),
+                  Args);
+  C.indent() << "return new " << ClassName << "(";
+  for (Context::ArgTy::const_iterator I = Args.begin(), E = Args.end();
+       I != E;
+       I++) {
+    if (I != Args.begin())
+      C.out() << ", ";
+    C.out() << I->second;
+  }
+  C.out() << ");" << std::endl;
+  C.endFunction();
+
+  return;
+}
+
+void RSReflection::genExportForEachBatch(Context &C,
+                                         const RSExportForEach *EF) {
+  bool HasIn = EF->hasIn();
+  bool HasOut = EF->hasOut() || EF->hasReturn();
+
+  // forEachBatch_*(), which launches the kernel over each allocation (pair)
+  // of the arrays. The checks are done once for each distinct Type, which is
+  // mostly the same for all (e.g., the tiles of an image), and the usrData is
+  // packed once.
+  Context::ArgTy Args;
+  if (HasIn)
+    Args.push_back(std::make_pair("Allocation[]", "ains"));
+  if (HasOut)
+    Args.push_back(std::make_pair("Allocation[]", "aouts"));
+
+  const RSExportRecordType *ERT = EF->getParamPacketType();
+  if (ERT) {
+    for (RSExportForEach::const_param_iterator I = EF->params_begin(),
+             E = EF->params_end();
+         I != E;
+         I++) {
+      Args.push_back(std::make_pair(GetTypeName((*I)->getType()),
+                                    (*I)->getName()));
+    }
+  }
+
+  bool HasLaunchOptions =
+      (mRSContext->getTargetAPI() >= SLANG_JB_MR2_TARGET_API);
+  if (HasLaunchOptions) {
+    C.startFunction(Context::AM_Public,
+                    false,
+                    "void",
+                    "forEachBatch_" + EF->getName(),
+                    Args);
+    C.indent() << "forEachBatch_" << EF->getName() << "(";
+    for (Context::ArgTy::const_iterator I = Args.begin(), E = Args.end();
+         I != E;
+         I++) {
+      C.out() << I->second << ", ";
+    }
+    // No clipped bounds to pass in.
+    C.out() << "null);" << std::endl;
+    C.endFunction();
+
+    Args.push_back(std::make_pair("Script.LaunchOptions", "sc"));
+  }
+
+  C.startFunction(((ERT != NULL) && mRSContext->hasPreallocatedPackers()) ?
+                      Context::AM_PublicSynchronized : Context::AM_Public,
+                  false,
+                  "void",
+                  "forEachBatch_" + EF->getName(),
+                  Args);
+
+  const char *Count = HasIn ? "ains.length" : "aouts.length";
+  if (HasIn && HasOut) {
+    C.indent() << "if (ains.length != aouts.length) {" << std::endl;
+    C.indent() << "    throw new RSRuntimeException(\"Mismatched number "
+               << "of input and output allocations!\");" << std::endl;
+    C.indent() << "}" << std::endl;
+  }
+
+  const RSExportType *IET = EF->getInType();
+  const RSExportType *OET = EF->getOutType();
+  bool CheckIn = (IET != NULL) || (HasIn && HasOut);
+  bool CheckOut = (OET != NULL) || (HasIn && HasOut);
+  if (CheckIn || CheckOut) {
+    if (CheckIn)
+      C.indent() << "Type tInChecked = null;" << std::endl;
+    if (CheckOut)
+      C.indent() << "Type tOutChecked = null;" << std::endl;
+
+    C.indent() << "for (int i = 0; i < " << Count << "; i++)";
+    C.startBlock();
+    if (CheckIn)
+      C.indent() << "Type tIn = ains[i].getType();" << std::endl;
+    if (CheckOut)
+      C.indent() << "Type tOut = aouts[i].getType();" << std::endl;
+
+    C.indent() << "if (";
+    if (CheckIn)
+      C.out() << "(tIn != tInChecked)";
+    if (CheckIn && CheckOut)
+      C.out() << " || ";
+    if (CheckOut)
+      C.out() << "(tOut != tOutChecked)";
+    C.out() << ")";
+    C.startBlock();
+    if (IET)
+      genTypeCheck(C, IET, "ains[i]");
+    if (OET)
+      genTypeCheck(C, OET, "aouts[i]");
+    if (HasIn && HasOut)
+      genForEachDimensionCheck(C);
+    if (CheckIn)
+      C.indent() << "tInChecked = tIn;" << std::endl;
+    if (CheckOut)
+      C.indent() << "tOutChecked = tOut;" << std::endl;
+    C.endBlock();
+
+    C.endBlock();
+  }
+
+  std::string FieldPackerName = EF->getName() + "_fp";
+  if (ERT) {
+    if (genPacketFieldPacker(C, ERT, RS_FOREACH_FP_PREFIX + EF->getName(),
+                             FieldPackerName.c_str())) {
+      genPackVarOfType(C, ERT, NULL, FieldPackerName.c_str(), 0);
+    }
+  }
+
+  C.indent() << "for (int i = 0; i < " << Count << "; i++)";
+  C.startBlock();
+  C.indent() << "forEach(";
+  genForEachSlot(C, EF);
+
+  if (HasIn)
+    C.out() << ", ains[i]";
+  else
+    C.out() << ", null";
+
+  if (HasOut)
+    C.out() << ", aouts[i]";
+  else
+    C.out() << ", null";
+
+  if (EF->hasUsrData())
+    C.out() << ", " << FieldPackerName;
+  else
+    C.out() << ", null";
+
+  if (HasLaunchOptions) {
+    C.out() << ", sc);" << std::endl;
+  } else {
+    C.out() << ");" << std::endl;
+  }
+  C.endBlock();
+
+  C.endFunction();
+  return;
+}
+
+void RSReflection::genForEachArgCheck(Context &C, const RSExportForEach *EF) {
+  const RSExportType *IET = EF->getInType();
+  const RSExportType *OET = EF->getOutType();
+
+  if (IET) {
+    genTypeCheck(C, IET, "ain");
+  }
+  if (OET) {
+    genTypeCheck(C, OET, "aout");
+  }
+
+  if (EF->hasIn() && (EF->hasOut() || EF->hasReturn())) {
+    C.indent() << "// Verify dimensions" << std::endl;
+    C.indent() << "Type tIn = ain.getType();" << std::endl;
+    C.indent() << "Type tOut = aout.getType();" << std::endl;
+    genForEachDimensionCheck(C);
+  }
+  return;
+}
+
+void RSReflection::genForEachDimensionCheck(Context &C) {
+  C.indent() << "if ((tIn.getCount() != tOut.getCount()) ||" << std::endl;
+  C.indent() << "    (tIn.getX() != tOut.getX()) ||" << std::endl;
+  C.indent() << "    (tIn.getY() != tOut.getY()) ||" << std::endl;
+  C.indent() << "    (tIn.getZ() != tOut.getZ()) ||" << std::endl;
+  C.indent() << "    (tIn.hasFaces() != tOut.hasFaces()) ||" << std::endl;
+  C.indent() << "    (tIn.hasMipmaps() != tOut.hasMipmaps())) {" << std::endl;
+  C.indent() << "    throw new RSRuntimeException(\"Dimension mismatch "
+             << "between input and output parameters!\");";
+  C.out()    << std::endl;
+  C.indent() << "}" << std::endl;
+  return;
+}
+
+void RSReflection::genTypeInstanceFromPointer(Context &C,
+                                              const RSExportType *ET) {
+  if (ET->getClass() == RSExportType::ExportClassPointer) {
+    // For pointer parameters to original forEach kernels.
+    const RSExportPointerType *EPT =
+        static_cast<const RSExportPointerType*>(ET);
+    genTypeInstance(C, EPT->getPointeeType());
+  } else {
+    // For handling pass-by-value kernel parameters.
+    genTypeInstance(C, ET);
+  }
+}
+
+void RSReflection::genTypeInstance(Context &C,
+                                   const RSExportType *ET) {
+  switch (ET->getClass()) {
+    case RSExportType::ExportClassPrimitive:
+    case RSExportType::ExportClassVector:
+    case RSExportType::ExportClassConstantArray: {
+      std::string TypeName = ET->getElementName();
+      if (C.addTypeNameForElement(TypeName))
+        genElementInstance(C, TypeName, "Element." + TypeName);
+      break;
+    }
+
+    case RSExportType::ExportClassRecord: {
+      std::string ClassName = ET->getElementName();
+      if (C.addTypeNameForElement(ClassName))
+        genElementInstance(C, ClassName, ClassName + ".createElement");
+      break;
     }
 
     default:
@@ -835,6 +1829,46 @@ void RSReflection::genTypeInstance(Context &C,
   }
 }
 
+void RSReflection::genElementInstance(Context &C,
+                                      const std::string &TypeName,
+                                      const std::string &Creator) {
+  if (C.mLazyElements)
+    C.mElementCreators[TypeName] = Creator;
+  else
+    C.indent() << RS_ELEM_PREFIX << TypeName << " = " << Creator << "(rs);"
+               << std::endl;
+  return;
+}
+
+void RSReflection::genLazyElements(Context &C) {
+  for (std::map<std::string, std::string>::const_iterator
+           I = C.mElementCreators.begin(),
+           E = C.mElementCreators.end();
+       I != E;
+       I++) {
+    C.startFunction(Context::AM_PrivateSynchronized,
+                    false,
+                    "Element",
+                    RS_LAZY_ELEM_PREFIX + I->first,
+                    0);
+    C.indent() << "if (" RS_ELEM_PREFIX << I->first << " == null) {"
+               << std::endl;
+    C.indent() << "    " RS_ELEM_PREFIX << I->first << " = " << I->second
+               << "(" RS_CONTEXT_NAME ");" << std::endl;
+    C.indent() << "}" << std::endl;
+    C.indent() << "return " RS_ELEM_PREFIX << I->first << ";" << std::endl;
+    C.endFunction();
+  }
+  return;
+}
+
+std::string RSReflection::GetElementRef(const Context &C,
+                                       const std::string &TypeName) {
+  if (C.mLazyElements)
+    return RS_LAZY_ELEM_PREFIX + TypeName + "()";
+  return RS_ELEM_PREFIX + TypeName;
+}
+
 void RSReflection::genFieldPackerInstance(Context &C,
                                           const RSExportType *ET) {
   switch (ET->getClass()) {
@@ -879,8 +1913,8 @@ void RSReflection::genTypeCheck(Context &C,
 
   if (!TypeName.empty()) {
     C.indent() << "if (!" << VarName
-               << ".getType().getElement().isCompatible(" RS_ELEM_PREFIX
-               << TypeName << ")) {" << std::endl;
+               << ".getType().getElement().isCompatible("
+               << GetElementRef(C, TypeName) << ")) {" << std::endl;
     C.indent() << "    throw new RSRuntimeException(\"Type mismatch with "
                << TypeName << "!\");" << std::endl;
     C.indent() << "}" << std::endl;
@@ -955,7 +1989,7 @@ void RSReflection::genPrimitiveTypeExportVariable(
     C.endFunction();
   }
 
-  genGetExportVariable(C, TypeName, VarName);
+  genGetExportVariable(C, TypeName, EV);
   genGetFieldID(C, VarName);
   return;
 }
@@ -996,7 +2030,7 @@ void RSReflection::genPointerTypeExportVariable(Context &C,
 
   C.endFunction();
 
-  genGetExportVariable(C, TypeName, VarName);
+  genGetExportVariable(C, TypeName, EV);
   return;
 }
 
@@ -1010,7 +2044,7 @@ void RSReflection::genVectorTypeExportVariable(Context &C,
 
   genPrivateExportVariable(C, TypeName, VarName);
   genSetExportVariable(C, TypeName, EV);
-  genGetExportVariable(C, TypeName, VarName);
+  genGetExportVariable(C, TypeName, EV);
   genGetFieldID(C, VarName);
   return;
 }
@@ -1045,7 +2079,7 @@ void RSReflection::genMatrixTypeExportVariable(Context &C,
     C.endFunction();
   }
 
-  genGetExportVariable(C, TypeName, VarName);
+  genGetExportVariable(C, TypeName, EV);
   genGetFieldID(C, VarName);
   return;
 }
@@ -1062,7 +2096,7 @@ void RSReflection::genConstantArrayTypeExportVariable(
 
   genPrivateExportVariable(C, TypeName, VarName);
   genSetExportVariable(C, TypeName, EV);
-  genGetExportVariable(C, TypeName, VarName);
+  genGetExportVariable(C, TypeName, EV);
   genGetFieldID(C, VarName);
   return;
 }
@@ -1077,7 +2111,7 @@ void RSReflection::genRecordTypeExportVariable(Context &C,
 
   genPrivateExportVariable(C, TypeName, VarName);
   genSetExportVariable(C, TypeName, EV);
-  genGetExportVariable(C, TypeName, VarName);
+  genGetExportVariable(C, TypeName, EV);
   genGetFieldID(C, VarName);
   return;
 }
@@ -1106,7 +2140,7 @@ void RSReflection::genSetExportVariable(Context &C,
     C.indent() << RS_EXPORT_VAR_PREFIX << VarName << " = v;" << std::endl;
 
     if (genCreateFieldPacker(C, ET, FieldPackerName))
-      genPackVarOfType(C, ET, "v", FieldPackerName);
+      genPackVarOfType(C, ET, "v", FieldPackerName, 0);
 
     if (mRSContext->getTargetAPI() < SLANG_JB_TARGET_API) {
       // Legacy apps must use the old setVar() without Element/dim components.
@@ -1118,8 +2152,9 @@ void RSReflection::genSetExportVariable(Context &C,
       C.indent() << "int []__dimArr = new int[1];" << std::endl;
       C.indent() << "__dimArr[0] = " << ET->getSize() << ";" << std::endl;
       C.indent() << "setVar("RS_EXPORT_VAR_INDEX_PREFIX << VarName << ", "
-                 << FieldPackerName << ", " RS_ELEM_PREFIX
-                 << ET->getElementName() << ", __dimArr);" << std::endl;
+                 << FieldPackerName << ", "
+                 << GetElementRef(C, ET->getElementName()) << ", __dimArr);"
+                 << std::endl;
     }
 
     C.endFunction();
@@ -1129,13 +2164,23 @@ void RSReflection::genSetExportVariable(Context &C,
 
 void RSReflection::genGetExportVariable(Context &C,
                                         const std::string &TypeName,
-                                        const std::string &VarName) {
-  C.startFunction(Context::AM_Public,
+                                        const RSExportVar *EV) {
+  const std::string &VarName = EV->getName();
+  bool LazyInit = hasLazyInitialValue(EV);
+  C.startFunction(LazyInit ? Context::AM_PublicSynchronized :
+                             Context::AM_Public,
                   false,
                   TypeName.c_str(),
                   "get_" + VarName,
                   0);
 
+  if (LazyInit) {
+    // Unless a setter already replaced it
+    C.indent() << "if (" RS_EXPORT_VAR_PREFIX << VarName << " == null)";
+    C.startBlock();
+    genInitExportVariableValue(C, EV);
+    C.endBlock();
+  }
   C.indent() << "return "RS_EXPORT_VAR_PREFIX << VarName << ";" << std::endl;
 
   C.endFunction();
@@ -1157,6 +2202,156 @@ void RSReflection::genGetFieldID(Context &C, const std::string &VarName) {
   }
 }
 
+void RSReflection::genVarBatchClass(Context &C) {
+  std::vector<size_t> Offsets;
+  size_t PacketSize = mRSContext->getVarBatchLayout(&Offsets);
+  if (PacketSize == 0)
+    return;
+
+  C.indent() << "private final static int " RS_VAR_BATCH_FUNC_INDEX_NAME " = "
+             << C.getNextExportFuncSlot() << ";" << std::endl;
+
+  // Changes made through the set_*() of a VarBatch reach the script all at
+  // once when it's committed. get_*() returns the new values right away.
+  C.indent() << "public class " RS_VAR_BATCH_CLASS_NAME;
+  C.startBlock();
+
+  C.indent() << "private FieldPacker " RS_VAR_BATCH_PACKET_NAME ";"
+             << std::endl;
+  C.indent() << "private int[] " RS_VAR_BATCH_MASK_NAME ";" << std::endl;
+  C.out() << std::endl;
+
+  C.startFunction(Context::AM_Private,
+                  false,
+                  NULL,
+                  RS_VAR_BATCH_CLASS_NAME,
+                  0);
+  C.indent() << RS_VAR_BATCH_PACKET_NAME " = new FieldPacker(" << PacketSize
+             << ");" << std::endl;
+  C.indent() << RS_VAR_BATCH_MASK_NAME " = new int["
+             << (Offsets.size() + 31) / 32 << "];" << std::endl;
+  C.endFunction();
+
+  unsigned Index = 0;
+  for (RSContext::const_export_var_iterator I = mRSContext->export_vars_begin(),
+           E = mRSContext->export_vars_end();
+       I != E;
+       I++) {
+    const RSExportVar *EV = *I;
+    if (!EV->isBatchable())
+      continue;
+
+    std::string TypeName = GetTypeName(EV->getType());
+    C.startFunction(Context::AM_Public,
+                    false,
+                    "void",
+                    "set_" + EV->getName(),
+                    1,
+                    TypeName.c_str(), "v");
+    C.indent() << RS_VAR_BATCH_PACKET_NAME ".reset(" << Offsets[Index] << ");"
+               << std::endl;
+    genPackVarOfType(C, EV->getType(), "v", RS_VAR_BATCH_PACKET_NAME,
+                     Offsets[Index]);
+    C.indent() << RS_VAR_BATCH_MASK_NAME "[" << Index / 32 << "] |= 0x"
+               << llvm::utohexstr(1U << (Index % 32)) << ";" << std::endl;
+    // Dalvik update comes last, since the input may be invalid (and hence
+    // throw an exception).
+    C.indent() << RS_EXPORT_VAR_PREFIX << EV->getName() << " = v;"
+               << std::endl;
+    C.endFunction();
+
+    Index++;
+  }
+
+  // commit() sends the bitmask of the variables set since the last commit()
+  // together with their values.
+  C.startFunction(Context::AM_Public,
+                  false,
+                  "void",
+                  "commit",
+                  0);
+  C.indent() << RS_VAR_BATCH_PACKET_NAME ".reset();" << std::endl;
+  C.indent() << "for (int i = 0; i < " RS_VAR_BATCH_MASK_NAME ".length; i++)";
+  C.startBlock();
+  C.indent() << RS_VAR_BATCH_PACKET_NAME ".addI32(" RS_VAR_BATCH_MASK_NAME
+                "[i]);" << std::endl;
+  C.indent() << RS_VAR_BATCH_MASK_NAME "[i] = 0;" << std::endl;
+  C.endBlock();
+  C.indent() << "invoke(" RS_VAR_BATCH_FUNC_INDEX_NAME ", "
+                RS_VAR_BATCH_PACKET_NAME ");" << std::endl;
+  C.endFunction();
+
+  // end VarBatch class
+  C.endBlock();
+
+  C.startFunction(Context::AM_Public,
+                  false,
+                  RS_VAR_BATCH_CLASS_NAME,
+                  "createVarBatch",
+                  0);
+  C.indent() << "return new " RS_VAR_BATCH_CLASS_NAME "();" << std::endl;
+  C.endFunction();
+
+  return;
+}
+
+void RSReflection::genProfileCounters(Context &C, bool Declare) {
+  std::vector<std::string> Names;
+  mRSContext->getProfiledFunctions(&Names);
+  if (Names.empty())
+    return;
+
+  // The 64-bit counters are read as pairs of ints, the Allocation can't be
+  // copied to a long[] before L.
+  if (!Declare) {
+    C.indent() << RS_PROFILE_COUNTERS_NAME " = Allocation.createSized(rs, "
+                  "Element.I32(rs), " << 4 * Names.size() << ");"
+               << std::endl;
+    C.indent() << "bindAllocation(" RS_PROFILE_COUNTERS_NAME ", "
+                  RS_PROFILE_COUNTERS_INDEX_NAME ");" << std::endl;
+    C.indent() << "resetProfileCounters();" << std::endl;
+    return;
+  }
+
+  C.indent() << "private final static int " RS_PROFILE_COUNTERS_INDEX_NAME " = "
+             << mRSContext->getProfileCountersSlot() << ";" << std::endl;
+  C.indent() << "private Allocation " RS_PROFILE_COUNTERS_NAME ";"
+             << std::endl;
+  for (unsigned i = 0, e = Names.size(); i != e; i++)
+    C.indent() << "public final static int " RS_PROFILE_COUNTER_INDEX_PREFIX
+               << Names[i] << " = " << i << ";" << std::endl;
+  C.out() << std::endl;
+
+  // The calls of the function mProfileCounterIdx_<name> are at 2 * index,
+  // the time spent in it (in nanoseconds, summed over the threads) at
+  // 2 * index + 1.
+  C.startFunction(Context::AM_Public,
+                  false,
+                  "long[]",
+                  "getProfileCounters",
+                  0);
+  C.indent() << "int[] raw = new int[" << 4 * Names.size() << "];"
+             << std::endl;
+  C.indent() << RS_PROFILE_COUNTERS_NAME ".copyTo(raw);" << std::endl;
+  C.indent() << "long[] counters = new long[" << 2 * Names.size() << "];"
+             << std::endl;
+  C.indent() << "for (int i = 0; i < counters.length; i++)" << std::endl;
+  C.indent() << "    counters[i] = ((long) raw[2 * i + 1] << 32) | "
+                "(raw[2 * i] & 0xffffffffL);" << std::endl;
+  C.indent() << "return counters;" << std::endl;
+  C.endFunction();
+
+  C.startFunction(Context::AM_Public,
+                  false,
+                  "void",
+                  "resetProfileCounters",
+                  0);
+  C.indent() << RS_PROFILE_COUNTERS_NAME ".copyFrom(new int["
+             << 4 * Names.size() << "]);" << std::endl;
+  C.endFunction();
+  return;
+}
+
 /******************* Methods to generate script class /end *******************/
 
 bool RSReflection::genCreateFieldPacker(Context &C,
@@ -1171,10 +2366,58 @@ bool RSReflection::genCreateFieldPacker(Context &C,
   return true;
 }
 
+bool RSReflection::genPacketFieldPacker(Context &C,
+                                        const RSExportRecordType *ERT,
+                                        const std::string &PreallocatedName,
+                                        const char *FieldPackerName) {
+  if (!mRSContext->hasPreallocatedPackers())
+    return genCreateFieldPacker(C, ERT, FieldPackerName);
+
+  size_t AllocSize = RSExportType::GetTypeAllocSize(ERT);
+  if (AllocSize == 0)
+    return false;
+  if (mRSContext->hasLazyInit()) {
+    // Allocated by the first call
+    C.indent() << "if (" << PreallocatedName << " == null) {" << std::endl;
+    C.indent() << "    " << PreallocatedName << " = new FieldPacker("
+               << AllocSize << ");" << std::endl;
+    C.indent() << "}" << std::endl;
+  }
+  C.indent() << "FieldPacker " << FieldPackerName << " = " << PreallocatedName
+             << ";" << std::endl;
+  C.indent() << FieldPackerName << ".reset();" << std::endl;
+  return true;
+}
+
+// Copy the NumValues values of the Java array ArrayName into FieldPackerName
+// at Offset with a single call rather than one add*() per value.
+void RSReflection::genBulkPackArray(Context &C,
+                                    const char *BufferView,
+                                    const std::string &ArrayName,
+                                    size_t NumValues,
+                                    size_t Offset,
+                                    size_t Size,
+                                    const char *FieldPackerName) {
+  if (BufferView == NULL) {
+    C.indent() << "System.arraycopy(" << ArrayName << ", 0, "
+               << FieldPackerName << ".getData(), " << Offset << ", "
+               << NumValues << ");" << std::endl;
+  } else {
+    C.indent() << "java.nio.ByteBuffer.wrap(" << FieldPackerName
+               << ".getData(), " << Offset << ", " << Size << ")"
+               << ".order(java.nio.ByteOrder.LITTLE_ENDIAN)." << BufferView
+               << ".put(" << ArrayName << ", 0, " << NumValues << ");"
+               << std::endl;
+  }
+  C.indent() << FieldPackerName << ".skip(" << Size << ");" << std::endl;
+  return;
+}
+
 void RSReflection::genPackVarOfType(Context &C,
                                     const RSExportType *ET,
                                     const char *VarName,
-                                    const char *FieldPackerName) {
+                                    const char *FieldPackerName,
+                                    int Offset) {
   switch (ET->getClass()) {
     case RSExportType::ExportClassPrimitive:
     case RSExportType::ExportClassVector: {
@@ -1222,14 +2465,52 @@ void RSReflection::genPackVarOfType(Context &C,
       std::string IndexVarName("ct");
       IndexVarName.append(llvm::utostr_32(Level));
 
+      const RSExportType *ElementET = ECAT->getElementType();
+      const char *BufferView;
+      const char *BulkType = GetBulkPackerType(ElementET, &BufferView);
+      if ((Offset >= 0) && (BulkType != NULL)) {
+        size_t Size = RSExportType::GetTypeAllocSize(ECAT);
+
+        if (ElementET->getClass() == RSExportType::ExportClassPrimitive) {
+          genBulkPackArray(C, BufferView, VarName, ECAT->getSize(),
+                           Offset, Size, FieldPackerName);
+          break;
+        }
+
+        // Gather the components of the vectors (with the padding of a
+        // 3-component vector left zero) first.
+        const RSExportVectorType *EVT =
+            static_cast<const RSExportVectorType*>(ElementET);
+        size_t Stride = RSExportType::GetTypeAllocSize(EVT) * 8 /
+                        RSExportPrimitiveType::GetSizeInBits(EVT);
+        std::string BulkVarName(IndexVarName + "_bulk");
+
+        C.startBlock(true);
+        C.indent() << BulkType << "[] " << BulkVarName << " = new " << BulkType
+                   << "[" << ECAT->getSize() * Stride << "];" << std::endl;
+        C.indent() << "for (int " << IndexVarName << " = 0; " <<
+                            IndexVarName << " < " << ECAT->getSize() << "; " <<
+                            IndexVarName << "++)";
+        C.startBlock();
+        for (unsigned i = 0; i < EVT->getNumElement(); i++) {
+          C.indent() << BulkVarName << "[" << IndexVarName << " * " << Stride
+                     << " + " << i << "] = " << VarName << "[" << IndexVarName
+                     << "]." << GetVectorAccessor(i) << ";" << std::endl;
+        }
+        C.endBlock();
+        genBulkPackArray(C, BufferView, BulkVarName, ECAT->getSize() * Stride,
+                         Offset, Size, FieldPackerName);
+        C.endBlock();
+        break;
+      }
+
       C.indent() << "for (int " << IndexVarName << " = 0; " <<
                           IndexVarName << " < " << ECAT->getSize() << "; " <<
                           IndexVarName << "++)";
       C.startBlock();
 
       ElementVarName.append("[" + IndexVarName + "]");
-      genPackVarOfType(C, ECAT->getElementType(), ElementVarName.c_str(),
-                       FieldPackerName);
+      genPackVarOfType(C, ElementET, ElementVarName.c_str(), FieldPackerName);
 
       C.endBlock();
       break;
@@ -1259,7 +2540,8 @@ void RSReflection::genPackVarOfType(Context &C,
           C.indent() << FieldPackerName << ".skip("
                      << (FieldOffset - Pos) << ");" << std::endl;
 
-        genPackVarOfType(C, F->getType(), FieldName.c_str(), FieldPackerName);
+        genPackVarOfType(C, F->getType(), FieldName.c_str(), FieldPackerName,
+                         (Offset >= 0) ? (Offset + FieldOffset) : -1);
 
         // There is padding in the field type
         if (FieldAllocSize > FieldStoreSize)
@@ -1307,33 +2589,185 @@ void RSReflection::genAllocateVarOfType(Context &C,
     }
     case RSExportType::ExportClassConstantArray: {
       const RSExportConstantArrayType *ECAT =
-          static_cast<const RSExportConstantArrayType *>(T);
-      const RSExportType *ElementType = ECAT->getElementType();
-
-      C.indent() << VarName << " = new " << GetTypeName(ElementType)
-                 << "[" << ECAT->getSize() << "];" << std::endl;
-
-      // Primitive type element doesn't need allocation code.
-      if (ElementType->getClass() != RSExportType::ExportClassPrimitive) {
-        C.indent() << "for (int $ct = 0; $ct < " << ECAT->getSize() << "; "
-                            "$ct++)";
-        C.startBlock();
-
-        std::string ElementVarName(VarName);
-        ElementVarName.append("[$ct]");
-        genAllocateVarOfType(C, ElementType, ElementVarName);
-
-        C.endBlock();
-      }
+          static_cast<const RSExportConstantArrayType *>(T);
+      const RSExportType *ElementType = ECAT->getElementType();
+
+      C.indent() << VarName << " = new " << GetTypeName(ElementType)
+                 << "[" << ECAT->getSize() << "];" << std::endl;
+
+      // Primitive type element doesn't need allocation code.
+      if (ElementType->getClass() != RSExportType::ExportClassPrimitive) {
+        C.indent() << "for (int $ct = 0; $ct < " << ECAT->getSize() << "; "
+                            "$ct++)";
+        C.startBlock();
+
+        std::string ElementVarName(VarName);
+        ElementVarName.append("[$ct]");
+        genAllocateVarOfType(C, ElementType, ElementVarName);
+
+        C.endBlock();
+      }
+      break;
+    }
+    case RSExportType::ExportClassVector:
+    case RSExportType::ExportClassMatrix:
+    case RSExportType::ExportClassRecord: {
+      C.indent() << VarName << " = new " << GetTypeName(T) << "();"
+                 << std::endl;
+      break;
+    }
+  }
+  return;
+}
+
+void RSReflection::genByteBufferPutVarOfType(Context &C,
+                                             const RSExportType *ET,
+                                             const std::string &VarName,
+                                             const std::string &Offset,
+                                             unsigned Level) {
+  switch (ET->getClass()) {
+    case RSExportType::ExportClassPrimitive: {
+      const RSExportPrimitiveType *EPT =
+          static_cast<const RSExportPrimitiveType*>(ET);
+      C.indent() << GetByteBufferPut(EPT->getType(), Offset, VarName) << ";"
+                 << std::endl;
+      break;
+    }
+    case RSExportType::ExportClassVector: {
+      const RSExportVectorType *EVT =
+          static_cast<const RSExportVectorType*>(ET);
+      size_t ElementSize = RSExportPrimitiveType::GetSizeInBits(EVT) / 8;
+      for (unsigned i = 0; i < EVT->getNumElement(); i++) {
+        C.indent() << GetByteBufferPut(EVT->getType(),
+                                       AddOffset(Offset, i * ElementSize),
+                                       VarName + "." + GetVectorAccessor(i))
+                   << ";" << std::endl;
+      }
+      break;
+    }
+    case RSExportType::ExportClassMatrix: {
+      const RSExportMatrixType *EMT =
+          static_cast<const RSExportMatrixType*>(ET);
+      std::string IndexVarName("ct" + llvm::utostr_32(Level));
+      C.indent() << "for (int " << IndexVarName << " = 0; " << IndexVarName
+                 << " < " << EMT->getDim() * EMT->getDim() << "; "
+                 << IndexVarName << "++)" << std::endl;
+      C.indent() << "    b.putFloat(" << Offset << " + " << IndexVarName
+                 << " * 4, " << VarName << ".getArray()[" << IndexVarName
+                 << "]);" << std::endl;
+      break;
+    }
+    case RSExportType::ExportClassConstantArray: {
+      const RSExportConstantArrayType *ECAT =
+          static_cast<const RSExportConstantArrayType*>(ET);
+      const RSExportType *ElementET = ECAT->getElementType();
+      std::string IndexVarName("ct" + llvm::utostr_32(Level));
+      C.indent() << "for (int " << IndexVarName << " = 0; " << IndexVarName
+                 << " < " << ECAT->getSize() << "; " << IndexVarName << "++)";
+      C.startBlock();
+      genByteBufferPutVarOfType(C, ElementET,
+                                VarName + "[" + IndexVarName + "]",
+                                Offset + " + " + IndexVarName + " * " +
+                                llvm::utostr(
+                                    RSExportType::GetTypeAllocSize(ElementET)),
+                                Level + 1);
+      C.endBlock();
+      break;
+    }
+    case RSExportType::ExportClassRecord: {
+      const RSExportRecordType *ERT =
+          static_cast<const RSExportRecordType*>(ET);
+      for (RSExportRecordType::const_field_iterator I = ERT->fields_begin(),
+               E = ERT->fields_end();
+           I != E;
+           I++) {
+        const RSExportRecordType::Field *F = *I;
+        genByteBufferPutVarOfType(C, F->getType(),
+                                  VarName + "." + F->getName(),
+                                  AddOffset(Offset, F->getOffsetInParent()),
+                                  Level);
+      }
+      break;
+    }
+    default: {
+      slangAssert(false && "Type can't be kept in a ByteBuffer");
+    }
+  }
+  return;
+}
+
+void RSReflection::genByteBufferGetVarOfType(Context &C,
+                                             const RSExportType *ET,
+                                             const std::string &VarName,
+                                             const std::string &Offset,
+                                             unsigned Level) {
+  switch (ET->getClass()) {
+    case RSExportType::ExportClassPrimitive: {
+      const RSExportPrimitiveType *EPT =
+          static_cast<const RSExportPrimitiveType*>(ET);
+      C.indent() << VarName << " = " << GetByteBufferGet(EPT->getType(), Offset)
+                 << ";" << std::endl;
+      break;
+    }
+    case RSExportType::ExportClassVector: {
+      const RSExportVectorType *EVT =
+          static_cast<const RSExportVectorType*>(ET);
+      size_t ElementSize = RSExportPrimitiveType::GetSizeInBits(EVT) / 8;
+      for (unsigned i = 0; i < EVT->getNumElement(); i++) {
+        C.indent() << VarName << "." << GetVectorAccessor(i) << " = "
+                   << GetByteBufferGet(EVT->getType(),
+                                       AddOffset(Offset, i * ElementSize))
+                   << ";" << std::endl;
+      }
+      break;
+    }
+    case RSExportType::ExportClassMatrix: {
+      const RSExportMatrixType *EMT =
+          static_cast<const RSExportMatrixType*>(ET);
+      std::string IndexVarName("ct" + llvm::utostr_32(Level));
+      C.indent() << "for (int " << IndexVarName << " = 0; " << IndexVarName
+                 << " < " << EMT->getDim() * EMT->getDim() << "; "
+                 << IndexVarName << "++)" << std::endl;
+      C.indent() << "    " << VarName << ".getArray()[" << IndexVarName
+                 << "] = b.getFloat(" << Offset << " + " << IndexVarName
+                 << " * 4);" << std::endl;
+      break;
+    }
+    case RSExportType::ExportClassConstantArray: {
+      const RSExportConstantArrayType *ECAT =
+          static_cast<const RSExportConstantArrayType*>(ET);
+      const RSExportType *ElementET = ECAT->getElementType();
+      std::string IndexVarName("ct" + llvm::utostr_32(Level));
+      C.indent() << "for (int " << IndexVarName << " = 0; " << IndexVarName
+                 << " < " << ECAT->getSize() << "; " << IndexVarName << "++)";
+      C.startBlock();
+      genByteBufferGetVarOfType(C, ElementET,
+                                VarName + "[" + IndexVarName + "]",
+                                Offset + " + " + IndexVarName + " * " +
+                                llvm::utostr(
+                                    RSExportType::GetTypeAllocSize(ElementET)),
+                                Level + 1);
+      C.endBlock();
       break;
     }
-    case RSExportType::ExportClassVector:
-    case RSExportType::ExportClassMatrix:
     case RSExportType::ExportClassRecord: {
-      C.indent() << VarName << " = new " << GetTypeName(T) << "();"
-                 << std::endl;
+      const RSExportRecordType *ERT =
+          static_cast<const RSExportRecordType*>(ET);
+      for (RSExportRecordType::const_field_iterator I = ERT->fields_begin(),
+               E = ERT->fields_end();
+           I != E;
+           I++) {
+        const RSExportRecordType::Field *F = *I;
+        genByteBufferGetVarOfType(C, F->getType(),
+                                  VarName + "." + F->getName(),
+                                  AddOffset(Offset, F->getOffsetInParent()),
+                                  Level);
+      }
       break;
     }
+    default: {
+      slangAssert(false && "Type can't be kept in a ByteBuffer");
+    }
   }
   return;
 }
@@ -1376,38 +2810,63 @@ bool RSReflection::genTypeClass(Context &C,
                     ErrorMsg))
     return false;
 
-  mGeneratedFileNames->push_back(ClassName);
-
   genTypeItemClass(C, ERT);
 
+  // With -reflect-scriptfield-buffer, the elements live in the byte buffer
+  // of the item buffer packer (laid out as in the allocation) rather than in
+  // an array of Items.
+  bool UseByteBuffer = isByteBufferBacked(ERT);
+
   // Declare item buffer and item buffer packer
-  C.indent() << "private "RS_TYPE_ITEM_CLASS_NAME" "RS_TYPE_ITEM_BUFFER_NAME"[]"
-      ";" << std::endl;
+  if (!UseByteBuffer)
+    C.indent() << "private "RS_TYPE_ITEM_CLASS_NAME" "RS_TYPE_ITEM_BUFFER_NAME
+                  "[];" << std::endl;
   C.indent() << "private FieldPacker "RS_TYPE_ITEM_BUFFER_PACKER_NAME";"
              << std::endl;
+  if (UseByteBuffer)
+    C.indent() << "private java.nio.ByteBuffer "RS_TYPE_BYTE_BUFFER_NAME";"
+               << std::endl;
+  // The range of the elements set without copyNow since the last copy
+  C.indent() << "private int " RS_TYPE_DIRTY_MIN_NAME " = Integer.MAX_VALUE;"
+             << std::endl;
+  C.indent() << "private int " RS_TYPE_DIRTY_MAX_NAME " = -1;" << std::endl;
   C.indent() << "private static java.lang.ref.WeakReference<Element> "
              RS_TYPE_ELEMENT_REF_NAME
              " = new java.lang.ref.WeakReference<Element>(null);" << std::endl;
 
   genTypeClassConstructor(C, ERT);
-  genTypeClassCopyToArrayLocal(C, ERT);
-  genTypeClassCopyToArray(C, ERT);
-  genTypeClassItemSetter(C, ERT);
-  genTypeClassItemGetter(C, ERT);
-  genTypeClassComponentSetter(C, ERT);
-  genTypeClassComponentGetter(C, ERT);
-  genTypeClassCopyAll(C, ERT);
-  if (!mRSContext->isCompatLib()) {
-    // Skip the resize method if we are targeting a compatibility library.
-    genTypeClassResize(C);
+  genTypeClassMarkDirty(C);
+  if (UseByteBuffer) {
+    genTypeClassByteBuffer(C);
+    genTypeClassByteBufferItemSetter(C, ERT);
+    genTypeClassByteBufferItemGetter(C, ERT);
+    genTypeClassByteBufferComponentSetter(C, ERT);
+    genTypeClassByteBufferComponentGetter(C, ERT);
+    genTypeClassByteBufferCopyAll(C);
+    genTypeClassCopyDirty(C, UseByteBuffer);
+    if (!mRSContext->isCompatLib())
+      genTypeClassByteBufferResize(C);
+  } else {
+    genTypeClassCopyToArrayLocal(C, ERT);
+    genTypeClassCopyToArray(C, ERT);
+    genTypeClassItemSetter(C, ERT);
+    genTypeClassItemGetter(C, ERT);
+    genTypeClassComponentSetter(C, ERT);
+    genTypeClassComponentGetter(C, ERT);
+    genTypeClassCopyAll(C, ERT);
+    genTypeClassCopyDirty(C, UseByteBuffer);
+    if (!mRSContext->isCompatLib()) {
+      // Skip the resize method if we are targeting a compatibility library.
+      genTypeClassResize(C);
+    }
   }
 
-  C.endClass();
+  bool Ret = C.endClass(ErrorMsg);
 
   C.resetFieldIndex();
   C.clearFieldIndexMap();
 
-  return true;
+  return Ret;
 }
 
 void RSReflection::genTypeItemClass(Context &C,
@@ -1453,6 +2912,7 @@ void RSReflection::genTypeItemClass(Context &C,
 void RSReflection::genTypeClassConstructor(Context &C,
                                            const RSExportRecordType *ERT) {
   const char *RenderScriptVar = "rs";
+  bool UseByteBuffer = isByteBufferBacked(ERT);
 
   C.startFunction(Context::AM_Public,
                   true,
@@ -1482,7 +2942,8 @@ void RSReflection::genTypeClassConstructor(Context &C,
                   C.getClassName(),
                   1,
                   "RenderScript", RenderScriptVar);
-  C.indent() << RS_TYPE_ITEM_BUFFER_NAME" = null;" << std::endl;
+  if (!UseByteBuffer)
+    C.indent() << RS_TYPE_ITEM_BUFFER_NAME" = null;" << std::endl;
   C.indent() << RS_TYPE_ITEM_BUFFER_PACKER_NAME" = null;" << std::endl;
   C.indent() << "mElement = createElement(" << RenderScriptVar << ");"
              << std::endl;
@@ -1497,7 +2958,8 @@ void RSReflection::genTypeClassConstructor(Context &C,
                   "RenderScript", RenderScriptVar,
                   "int", "count");
 
-  C.indent() << RS_TYPE_ITEM_BUFFER_NAME" = null;" << std::endl;
+  if (!UseByteBuffer)
+    C.indent() << RS_TYPE_ITEM_BUFFER_NAME" = null;" << std::endl;
   C.indent() << RS_TYPE_ITEM_BUFFER_PACKER_NAME" = null;" << std::endl;
   C.indent() << "mElement = createElement(" << RenderScriptVar << ");"
              << std::endl;
@@ -1515,7 +2977,8 @@ void RSReflection::genTypeClassConstructor(Context &C,
                   "int", "count",
                   "int", "usages");
 
-  C.indent() << RS_TYPE_ITEM_BUFFER_NAME" = null;" << std::endl;
+  if (!UseByteBuffer)
+    C.indent() << RS_TYPE_ITEM_BUFFER_NAME" = null;" << std::endl;
   C.indent() << RS_TYPE_ITEM_BUFFER_PACKER_NAME" = null;" << std::endl;
   C.indent() << "mElement = createElement(" << RenderScriptVar << ");"
              << std::endl;
@@ -1677,6 +3140,7 @@ void RSReflection::genTypeClassItemSetter(Context &C,
   genNewItemBufferIfNull(C, NULL);
   C.indent() << RS_TYPE_ITEM_BUFFER_NAME"[index] = i;" << std::endl;
 
+  C.indent() << "if (!copyNow) markDirty(index);" << std::endl;
   C.indent() << "if (copyNow) ";
   C.startBlock();
 
@@ -1731,6 +3195,7 @@ void RSReflection::genTypeClassComponentSetter(Context &C,
     C.indent() << RS_TYPE_ITEM_BUFFER_NAME"[index]." << F->getName()
                << " = v;" << std::endl;
 
+    C.indent() << "if (!copyNow) markDirty(index);" << std::endl;
     C.indent() << "if (copyNow) ";
     C.startBlock();
 
@@ -1791,6 +3256,7 @@ void RSReflection::genTypeClassCopyAll(Context &C,
   C.indent() << "mAllocation.setFromFieldPacker(0, "
                   RS_TYPE_ITEM_BUFFER_PACKER_NAME");"
              << std::endl;
+  genResetDirtyRange(C);
 
   C.endFunction();
   return;
@@ -1815,6 +3281,8 @@ void RSReflection::genTypeClassResize(Context &C) {
   C.indent() << "mItemArray = ni;" << std::endl;
   C.endBlock();
   C.indent() << "mAllocation.resize(newSize);" << std::endl;
+  C.indent() << "if (" RS_TYPE_DIRTY_MAX_NAME " >= newSize) "
+                RS_TYPE_DIRTY_MAX_NAME " = newSize - 1;" << std::endl;
 
   C.indent() << "if (" RS_TYPE_ITEM_BUFFER_PACKER_NAME " != null) "
                   RS_TYPE_ITEM_BUFFER_PACKER_NAME " = "
@@ -1826,6 +3294,263 @@ void RSReflection::genTypeClassResize(Context &C) {
   return;
 }
 
+void RSReflection::genTypeClassMarkDirty(Context &C) {
+  C.startFunction(Context::AM_Private,
+                  false,
+                  "void",
+                  "markDirty",
+                  1,
+                  "int", "index");
+  C.indent() << "if (index < " RS_TYPE_DIRTY_MIN_NAME ") "
+                RS_TYPE_DIRTY_MIN_NAME " = index;" << std::endl;
+  C.indent() << "if (index > " RS_TYPE_DIRTY_MAX_NAME ") "
+                RS_TYPE_DIRTY_MAX_NAME " = index;" << std::endl;
+  C.endFunction();
+  return;
+}
+
+void RSReflection::genResetDirtyRange(Context &C) {
+  C.indent() << RS_TYPE_DIRTY_MIN_NAME " = Integer.MAX_VALUE;" << std::endl;
+  C.indent() << RS_TYPE_DIRTY_MAX_NAME " = -1;" << std::endl;
+  return;
+}
+
+void RSReflection::genTypeClassCopyDirty(Context &C, bool UseByteBuffer) {
+  // copyDirty() uploads only the elements set without copyNow since the last
+  // copyAll() or copyDirty().
+  C.startFunction(Context::AM_PublicSynchronized,
+                  false,
+                  "void",
+                  "copyDirty",
+                  0);
+
+  C.indent() << "if (" RS_TYPE_DIRTY_MAX_NAME " < " RS_TYPE_DIRTY_MIN_NAME
+                ") return;" << std::endl;
+  if (!UseByteBuffer) {
+    C.indent() << "for (int ct = " RS_TYPE_DIRTY_MIN_NAME "; ct <= "
+                  RS_TYPE_DIRTY_MAX_NAME "; ct++)" << std::endl;
+    C.indent() << "    if (" RS_TYPE_ITEM_BUFFER_NAME "[ct] != null) "
+                  "copyToArray(" RS_TYPE_ITEM_BUFFER_NAME "[ct], ct);"
+               << std::endl;
+  }
+  C.indent() << "int count = " RS_TYPE_DIRTY_MAX_NAME " - "
+                RS_TYPE_DIRTY_MIN_NAME " + 1;" << std::endl;
+  C.indent() << "FieldPacker fp = new FieldPacker(" RS_TYPE_ITEM_CLASS_NAME
+                ".sizeof * count);" << std::endl;
+  C.indent() << "System.arraycopy(" RS_TYPE_ITEM_BUFFER_PACKER_NAME
+                ".getData(), " RS_TYPE_DIRTY_MIN_NAME " * "
+                RS_TYPE_ITEM_CLASS_NAME ".sizeof, fp.getData(), 0, "
+                RS_TYPE_ITEM_CLASS_NAME ".sizeof * count);" << std::endl;
+  C.indent() << "mAllocation.setFromFieldPacker(" RS_TYPE_DIRTY_MIN_NAME
+                ", fp);" << std::endl;
+  genResetDirtyRange(C);
+
+  C.endFunction();
+  return;
+}
+
+bool RSReflection::isByteBufferBacked(const RSExportRecordType *ERT) const {
+  return mRSContext->hasScriptFieldBuffer() && IsByteBufferBackable(ERT);
+}
+
+void RSReflection::genTypeClassByteBuffer(Context &C) {
+  // The buffer is created on first use, as the count is known only once the
+  // allocation is.
+  C.startFunction(Context::AM_PublicSynchronized,
+                  false,
+                  "java.nio.ByteBuffer",
+                  "getByteBuffer",
+                  0);
+  C.indent() << "if (" RS_TYPE_ITEM_BUFFER_PACKER_NAME " == null)";
+  C.startBlock();
+  C.indent() << RS_TYPE_ITEM_BUFFER_PACKER_NAME " = new FieldPacker("
+                RS_TYPE_ITEM_CLASS_NAME ".sizeof * getType().getX()"
+                "/* count */);" << std::endl;
+  C.indent() << RS_TYPE_BYTE_BUFFER_NAME " = java.nio.ByteBuffer.wrap("
+                RS_TYPE_ITEM_BUFFER_PACKER_NAME ".getData())" << std::endl;
+  C.indent() << "    .order(java.nio.ByteOrder.LITTLE_ENDIAN);" << std::endl;
+  C.endBlock();
+  C.indent() << "return " RS_TYPE_BYTE_BUFFER_NAME ";" << std::endl;
+  C.endFunction();
+  return;
+}
+
+void RSReflection::genTypeClassByteBufferItemSetter(
+    Context &C, const RSExportRecordType *ERT) {
+  C.startFunction(Context::AM_PublicSynchronized,
+                  false,
+                  "void",
+                  "set",
+                  3,
+                  RS_TYPE_ITEM_CLASS_NAME, "i",
+                  "int", "index",
+                  "boolean", "copyNow");
+  C.indent() << "java.nio.ByteBuffer b = getByteBuffer();" << std::endl;
+  C.indent() << "int o = index * " RS_TYPE_ITEM_CLASS_NAME ".sizeof;"
+             << std::endl;
+  genByteBufferPutVarOfType(C, ERT, "i", "o", 1);
+
+  C.indent() << "if (!copyNow) markDirty(index);" << std::endl;
+  C.indent() << "if (copyNow) ";
+  C.startBlock();
+
+  C.indent() << "FieldPacker fp = new FieldPacker(" RS_TYPE_ITEM_CLASS_NAME
+                ".sizeof);" << std::endl;
+  C.indent() << "System.arraycopy(" RS_TYPE_ITEM_BUFFER_PACKER_NAME
+                ".getData(), o, fp.getData(), 0, " RS_TYPE_ITEM_CLASS_NAME
+                ".sizeof);" << std::endl;
+  C.indent() << "mAllocation.setFromFieldPacker(index, fp);" << std::endl;
+
+  // End of if (copyNow)
+  C.endBlock();
+
+  C.endFunction();
+  return;
+}
+
+void RSReflection::genTypeClassByteBufferItemGetter(
+    Context &C, const RSExportRecordType *ERT) {
+  C.startFunction(Context::AM_PublicSynchronized,
+                  false,
+                  RS_TYPE_ITEM_CLASS_NAME,
+                  "get",
+                  1,
+                  "int", "index");
+  C.indent() << "if (" RS_TYPE_ITEM_BUFFER_PACKER_NAME " == null) return null;"
+             << std::endl;
+  C.indent() << "java.nio.ByteBuffer b = " RS_TYPE_BYTE_BUFFER_NAME ";"
+             << std::endl;
+  C.indent() << "int o = index * " RS_TYPE_ITEM_CLASS_NAME ".sizeof;"
+             << std::endl;
+  C.indent() << RS_TYPE_ITEM_CLASS_NAME " i = new " RS_TYPE_ITEM_CLASS_NAME
+                "();" << std::endl;
+  genByteBufferGetVarOfType(C, ERT, "i", "o", 1);
+  C.indent() << "return i;" << std::endl;
+  C.endFunction();
+  return;
+}
+
+void RSReflection::genTypeClassByteBufferComponentSetter(
+    Context &C, const RSExportRecordType *ERT) {
+  for (RSExportRecordType::const_field_iterator FI = ERT->fields_begin(),
+           FE = ERT->fields_end();
+       FI != FE;
+       FI++) {
+    const RSExportRecordType::Field *F = *FI;
+    size_t FieldOffset = F->getOffsetInParent();
+    size_t FieldStoreSize = RSExportType::GetTypeStoreSize(F->getType());
+    unsigned FieldIndex = C.getFieldIndex(F);
+
+    C.startFunction(Context::AM_PublicSynchronized,
+                    false,
+                    "void",
+                    "set_" + F->getName(), 3,
+                    "int", "index",
+                    GetTypeName(F->getType()).c_str(), "v",
+                    "boolean", "copyNow");
+    C.indent() << "java.nio.ByteBuffer b = getByteBuffer();" << std::endl;
+    C.indent() << "int o = "
+               << AddOffset("index * " RS_TYPE_ITEM_CLASS_NAME ".sizeof",
+                            FieldOffset)
+               << ";" << std::endl;
+    genByteBufferPutVarOfType(C, F->getType(), "v", "o", 1);
+
+    C.indent() << "if (!copyNow) markDirty(index);" << std::endl;
+    C.indent() << "if (copyNow) ";
+    C.startBlock();
+
+    C.indent() << "FieldPacker fp = new FieldPacker(" << FieldStoreSize << ");"
+               << std::endl;
+    C.indent() << "System.arraycopy(" RS_TYPE_ITEM_BUFFER_PACKER_NAME
+                  ".getData(), o, fp.getData(), 0, " << FieldStoreSize << ");"
+               << std::endl;
+    C.indent() << "mAllocation.setFromFieldPacker(index, " << FieldIndex
+               << ", fp);"
+               << std::endl;
+
+    // End of if (copyNow)
+    C.endBlock();
+
+    C.endFunction();
+  }
+  return;
+}
+
+void RSReflection::genTypeClassByteBufferComponentGetter(
+    Context &C, const RSExportRecordType *ERT) {
+  for (RSExportRecordType::const_field_iterator FI = ERT->fields_begin(),
+           FE = ERT->fields_end();
+       FI != FE;
+       FI++) {
+    const RSExportRecordType::Field *F = *FI;
+    std::string TypeName = GetTypeName(F->getType());
+    C.startFunction(Context::AM_PublicSynchronized,
+                    false,
+                    TypeName.c_str(),
+                    "get_" + F->getName(),
+                    1,
+                    "int", "index");
+    C.indent() << "if (" RS_TYPE_ITEM_BUFFER_PACKER_NAME " == null) return "
+               << GetTypeNullValue(F->getType()) << ";" << std::endl;
+    C.indent() << "java.nio.ByteBuffer b = " RS_TYPE_BYTE_BUFFER_NAME ";"
+               << std::endl;
+    C.indent() << "int o = "
+               << AddOffset("index * " RS_TYPE_ITEM_CLASS_NAME ".sizeof",
+                            F->getOffsetInParent())
+               << ";" << std::endl;
+    C.indent() << TypeName << " v;" << std::endl;
+    genAllocateVarOfType(C, F->getType(), "v");
+    genByteBufferGetVarOfType(C, F->getType(), "v", "o", 1);
+    C.indent() << "return v;" << std::endl;
+    C.endFunction();
+  }
+  return;
+}
+
+void RSReflection::genTypeClassByteBufferCopyAll(Context &C) {
+  C.startFunction(Context::AM_PublicSynchronized, false, "void", "copyAll", 0);
+
+  // The elements are already laid out as in the allocation.
+  C.indent() << "getByteBuffer();" << std::endl;
+  C.indent() << "mAllocation.setFromFieldPacker(0, "
+                  RS_TYPE_ITEM_BUFFER_PACKER_NAME");"
+             << std::endl;
+  genResetDirtyRange(C);
+
+  C.endFunction();
+  return;
+}
+
+void RSReflection::genTypeClassByteBufferResize(Context &C) {
+  C.startFunction(Context::AM_PublicSynchronized,
+                  false,
+                  "void",
+                  "resize",
+                  1,
+                  "int", "newSize");
+
+  C.indent() << "if (" RS_TYPE_ITEM_BUFFER_PACKER_NAME " != null) ";
+  C.startBlock();
+  C.indent() << "byte[] oldData = " RS_TYPE_ITEM_BUFFER_PACKER_NAME
+                ".getData();" << std::endl;
+  C.indent() << RS_TYPE_ITEM_BUFFER_PACKER_NAME " = new FieldPacker("
+                RS_TYPE_ITEM_CLASS_NAME ".sizeof * newSize);" << std::endl;
+  C.indent() << "byte[] newData = " RS_TYPE_ITEM_BUFFER_PACKER_NAME
+                ".getData();" << std::endl;
+  C.indent() << "System.arraycopy(oldData, 0, newData, 0, "
+                "Math.min(oldData.length, newData.length));" << std::endl;
+  C.indent() << RS_TYPE_BYTE_BUFFER_NAME " = java.nio.ByteBuffer.wrap(newData)"
+             << std::endl;
+  C.indent() << "    .order(java.nio.ByteOrder.LITTLE_ENDIAN);" << std::endl;
+  C.endBlock();
+  C.indent() << "mAllocation.resize(newSize);" << std::endl;
+  C.indent() << "if (" RS_TYPE_DIRTY_MAX_NAME " >= newSize) "
+                RS_TYPE_DIRTY_MAX_NAME " = newSize - 1;" << std::endl;
+
+  C.endFunction();
+  return;
+}
+
 /******************** Methods to generate type class /end ********************/
 
 /********** Methods to create Element in Java of given record type ***********/
@@ -2029,11 +3754,82 @@ void RSReflection::genAddPaddingToElementBuiler(Context &C,
 #undef EB_ADD
 /******** Methods to create Element in Java of given record type /end ********/
 
+struct RSReflection::TypeClassState {
+  RSReflection *R;
+  const Context *Proto;
+  std::vector<const RSExportRecordType*> Types;
+  // The results of each type: the class files (when kept in memory), the
+  // error and whether it succeeded
+  std::vector<FileContentList> OutputBuffers;
+  std::vector<std::string> Errors;
+  std::vector<char> Success;
+  // The types whose class is left as it is (see RSReflectionManifest)
+  std::vector<char> UpToDate;
+  // Index of the next type to hand out, guarded by QueueLock
+  size_t NextType;
+  llvm::sys::Mutex QueueLock;
+};
+
+void *RSReflection::genTypeClassWorker(void *Data) {
+  TypeClassState *State = static_cast<TypeClassState *>(Data);
+  llvm::OwningPtr<Context> C(State->Proto->clone());
+
+  while (true) {
+    size_t i;
+    {
+      llvm::MutexGuard Locked(State->QueueLock);
+      if (State->NextType == State->Types.size())
+        break;
+      i = State->NextType++;
+    }
+
+    if (State->UpToDate[i])
+      continue;
+
+    if (State->Proto->mOutputBuffers != NULL)
+      C->setOutputBuffers(&State->OutputBuffers[i]);
+    State->Success[i] =
+        State->R->genTypeClass(*C, State->Types[i], State->Errors[i]);
+  }
+
+  return NULL;
+}
+
+void RSReflection::prepareTypeClass(const RSExportType *ET) {
+  RSExportType::GetTypeStoreSize(ET);
+  RSExportType::GetTypeAllocSize(ET);
+
+  switch (ET->getClass()) {
+    case RSExportType::ExportClassConstantArray: {
+      prepareTypeClass(
+          static_cast<const RSExportConstantArrayType*>(ET)->getElementType());
+      break;
+    }
+    case RSExportType::ExportClassRecord: {
+      const RSExportRecordType *ERT =
+          static_cast<const RSExportRecordType*>(ET);
+      for (RSExportRecordType::const_field_iterator I = ERT->fields_begin(),
+               E = ERT->fields_end();
+           I != E;
+           I++)
+        prepareTypeClass((*I)->getType());
+      break;
+    }
+    default: {
+      break;
+    }
+  }
+  return;
+}
+
 bool RSReflection::reflect(const std::string &OutputPathBase,
                            const std::string &OutputPackageName,
                            const std::string &RSPackageName,
                            const std::string &InputFileName,
-                           const std::string &OutputBCFileName) {
+                           const std::string &OutputBCFileName,
+                           bool WriteIfChanged,
+                           FileContentList *OutputBuffers,
+                           unsigned NumThreads) {
   Context *C = NULL;
   std::string ResourceId = "";
   std::string PaddingPrefix = "";
@@ -2052,12 +3848,15 @@ bool RSReflection::reflect(const std::string &OutputPathBase,
 
   if (OutputPackageName.empty() || OutputPackageName == "-")
     C = new Context(OutputPathBase, InputFileName, "<Package Name>",
-                    RSPackageName, ResourceId, PaddingPrefix, true);
+                    RSPackageName, ResourceId, PaddingPrefix, true, false);
   else
     C = new Context(OutputPathBase, InputFileName, OutputPackageName,
-                    RSPackageName, ResourceId, PaddingPrefix, false);
+                    RSPackageName, ResourceId, PaddingPrefix, false,
+                    WriteIfChanged);
 
   if (C != NULL) {
+    C->setOutputBuffers(OutputBuffers);
+
     std::string ErrorMsg, ScriptClassName;
     // class ScriptC_<ScriptName>
     if (!GetClassNameFromFileName(InputFileName, ScriptClassName))
@@ -2072,7 +3871,31 @@ bool RSReflection::reflect(const std::string &OutputPathBase,
       C->setLicenseNote(*(mRSContext->getLicenseNote()));
     }
 
-    if (!genScriptClass(*C, ScriptClassName, ErrorMsg)) {
+    // With WriteIfChanged, the classes whose signature is the same as the
+    // last time are left alone.
+    llvm::OwningPtr<RSReflectionManifest> Manifest;
+    std::string ClassDir;
+    if (WriteIfChanged && !C->mUseStdout && (OutputBuffers == NULL)) {
+      ClassDir = RSSlangReflectUtils::ComputePackagedPath(
+          OutputPathBase.c_str(), OutputPackageName.c_str()) +
+          OS_PATH_SEPARATOR_STR;
+      std::string Settings = InputFileName + '\n' + OutputPackageName + '\n' +
+          RSPackageName + '\n' + ResourceId + '\n' + PaddingPrefix;
+      Manifest.reset(new RSReflectionManifest(
+          ClassDir + ScriptClassName + ".manifest", mRSContext, Settings));
+    }
+
+    if (Manifest.get() != NULL) {
+      std::string ClassFile = ClassDir + ScriptClassName + ".java";
+      uint64_t Signature = Manifest->getScriptSignature();
+      if (!Manifest->isUpToDate(ClassFile, Signature) &&
+          (!genScriptClass(*C, ScriptClassName, ErrorMsg) ||
+           !Manifest->update(ClassFile, Signature, &ErrorMsg))) {
+        std::cerr << "Failed to generate class " << ScriptClassName << " ("
+                  << ErrorMsg << ")" << std::endl;
+        return false;
+      }
+    } else if (!genScriptClass(*C, ScriptClassName, ErrorMsg)) {
       std::cerr << "Failed to generate class " << ScriptClassName << " ("
                 << ErrorMsg << ")" << std::endl;
       return false;
@@ -2081,6 +3904,10 @@ bool RSReflection::reflect(const std::string &OutputPathBase,
     mGeneratedFileNames->push_back(ScriptClassName);
 
     // class ScriptField_<TypeName>
+    TypeClassState State;
+    State.R = this;
+    State.Proto = C;
+    State.NextType = 0;
     for (RSContext::const_export_type_iterator TI =
              mRSContext->export_types_begin(),
              TE = mRSContext->export_types_end();
@@ -2092,13 +3919,82 @@ bool RSReflection::reflect(const std::string &OutputPathBase,
         const RSExportRecordType *ERT =
             static_cast<const RSExportRecordType*>(ET);
 
-        if (!ERT->isArtificial() && !genTypeClass(*C, ERT, ErrorMsg)) {
-          std::cerr << "Failed to generate type class for struct '"
-                    << ERT->getName() << "' (" << ErrorMsg << ")" << std::endl;
-          return false;
+        if (!ERT->isArtificial()) {
+          prepareTypeClass(ERT);
+          State.Types.push_back(ERT);
         }
       }
     }
+    State.OutputBuffers.resize(State.Types.size());
+    State.Errors.resize(State.Types.size());
+    State.Success.resize(State.Types.size(), false);
+    State.UpToDate.resize(State.Types.size(), false);
+
+    std::vector<uint64_t> Signatures(State.Types.size());
+    if (Manifest.get() != NULL) {
+      for (unsigned i = 0, e = State.Types.size(); i != e; i++) {
+        Signatures[i] = Manifest->getRecordSignature(State.Types[i]);
+        State.UpToDate[i] = Manifest->isUpToDate(
+            ClassDir + State.Types[i]->getElementName() + ".java",
+            Signatures[i]);
+        State.Success[i] = State.UpToDate[i];
+      }
+    }
+
+    unsigned NumStarted = 0;
+#if !defined(_WIN32)
+    // The classes go to std::cout one after the other without a package.
+    unsigned NumWorkers = C->mUseStdout ? 0 :
+        std::min<size_t>(NumThreads, State.Types.size());
+    if (NumWorkers > 1) {
+      llvm::llvm_start_multithreaded();
+
+      std::vector<pthread_t> Workers(NumWorkers);
+      while (NumStarted < NumWorkers) {
+        if (pthread_create(&Workers[NumStarted], NULL, genTypeClassWorker,
+                           &State) != 0)
+          break;
+        NumStarted++;
+      }
+      for (unsigned i = 0; i != NumStarted; i++)
+        pthread_join(Workers[i], NULL);
+    }
+#endif
+
+    // Do all the work on this thread if no worker was started.
+    if (NumStarted == 0)
+      genTypeClassWorker(&State);
+
+    // Go through the results in order, as if they were generated one by one.
+    for (unsigned i = 0, e = State.Types.size(); i != e; i++) {
+      if (!State.Success[i]) {
+        std::cerr << "Failed to generate type class for struct '"
+                  << State.Types[i]->getName() << "' (" << State.Errors[i]
+                  << ")" << std::endl;
+        return false;
+      }
+
+      const std::string &ClassName = State.Types[i]->getElementName();
+      mGeneratedFileNames->push_back(ClassName);
+      if (OutputBuffers != NULL)
+        OutputBuffers->insert(OutputBuffers->end(),
+                              State.OutputBuffers[i].begin(),
+                              State.OutputBuffers[i].end());
+      if ((Manifest.get() != NULL) && !State.UpToDate[i] &&
+          !Manifest->update(ClassDir + ClassName + ".java", Signatures[i],
+                            &ErrorMsg)) {
+        std::cerr << "Failed to generate type class for struct '"
+                  << State.Types[i]->getName() << "' (" << ErrorMsg << ")"
+                  << std::endl;
+        return false;
+      }
+    }
+
+    if ((Manifest.get() != NULL) && !Manifest->write(&ErrorMsg)) {
+      std::cerr << "Failed to write the manifest of class " << ScriptClassName
+                << " (" << ErrorMsg << ")" << std::endl;
+      return false;
+    }
   }
 
   return true;
@@ -2132,14 +4028,25 @@ bool RSReflection::Context::openClassFile(const std::string &ClassName,
         RSSlangReflectUtils::ComputePackagedPath(mOutputPathBase.c_str(),
                                                  mPackageName.c_str());
 
+    mClassFile = Path + OS_PATH_SEPARATOR_STR + ClassName + ".java";
+    if (mOutputBuffers != NULL) {
+      mBuffer.str("");
+      mBuffer.clear();
+      return true;
+    }
+
     if (!SlangUtils::CreateDirectoryWithParents(Path, &ErrorMsg))
       return false;
+    std::string OutputFile = mClassFile;
+    if (mWriteIfChanged) {
+      if (!SlangUtils::CreatePendingFile(mClassFile, &mPendingFile, &ErrorMsg))
+        return false;
+      OutputFile = mPendingFile;
+    }
 
-    std::string ClassFile = Path + OS_PATH_SEPARATOR_STR + ClassName + ".java";
-
-    mOF.open(ClassFile.c_str());
+    mOF.open(OutputFile.c_str());
     if (!mOF.good()) {
-      ErrorMsg = "failed to open file '" + ClassFile + "' for write";
+      ErrorMsg = "failed to open file '" + OutputFile + "' for write";
       return false;
     }
   }
@@ -2152,6 +4059,7 @@ const char *RSReflection::Context::AccessModifierStr(AccessModifier AM) {
     case AM_Protected: return "protected"; break;
     case AM_Private: return "private"; break;
     case AM_PublicSynchronized: return "public synchronized"; break;
+    case AM_PrivateSynchronized: return "private synchronized"; break;
     default: return ""; break;
   }
 }
@@ -2206,12 +4114,22 @@ bool RSReflection::Context::startClass(AccessModifier AM,
   return true;
 }
 
-void RSReflection::Context::endClass() {
+bool RSReflection::Context::endClass(std::string &ErrorMsg) {
   endBlock();
-  if (!mUseStdout)
-    mOF.close();
   clear();
-  return;
+  if (!mUseStdout && (mOutputBuffers != NULL)) {
+    mOutputBuffers->push_back(std::make_pair(mClassFile, mBuffer.str()));
+  } else if (!mUseStdout) {
+    mOF.close();
+    if (mOF.fail()) {
+      ErrorMsg = "failed to write file '" + mClassFile + "'";
+      return false;
+    }
+    if (mWriteIfChanged &&
+        !SlangUtils::ReplaceFileIfChanged(mPendingFile, mClassFile, &ErrorMsg))
+      return false;
+  }
+  return true;
 }
 
 void RSReflection::Context::startBlock(bool ShouldIndent) {
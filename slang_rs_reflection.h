@@ -17,10 +17,13 @@
 #ifndef _FRAMEWORKS_COMPILE_SLANG_SLANG_RS_REFLECTION_H_  // NOLINT
 #define _FRAMEWORKS_COMPILE_SLANG_SLANG_RS_REFLECTION_H_
 
+#include <stdint.h>
+
 #include <fstream>
 #include <iostream>
 #include <map>
 #include <set>
+#include <sstream>
 #include <string>
 #include <vector>
 
@@ -28,6 +31,7 @@
 
 #include "slang_assert.h"
 #include "slang_rs_export_type.h"
+#include "slang_utils.h"
 
 namespace slang {
 
@@ -35,6 +39,7 @@ namespace slang {
   class RSExportVar;
   class RSExportFunc;
   class RSExportForEach;
+  class RSExportReduce;
 
 class RSReflection {
  private:
@@ -66,11 +71,20 @@ class RSReflection {
 
     std::string mIndent;
 
+    // Write the class files to a pending file first and only replace the
+    // class file if its content changes (with SlangUtils::ReplaceFileIfChanged)
+    bool mWriteIfChanged;
+    // The class file being written
+    std::string mClassFile;
+    // and the pending file standing in for it with mWriteIfChanged
+    std::string mPendingFile;
+
     int mPaddingFieldIndex;
 
     int mNextExportVarSlot;
     int mNextExportFuncSlot;
     int mNextExportForEachSlot;
+    int mNextExportReduceSlot;
 
     // A mapping from a field in a record type to its index in the rsType
     // instance. Only used when generates TypeClass (ScriptField_*).
@@ -87,6 +101,7 @@ class RSReflection {
       mNextExportVarSlot = 0;
       mNextExportFuncSlot = 0;
       mNextExportForEachSlot = 0;
+      mNextExportReduceSlot = 0;
       return;
     }
 
@@ -98,18 +113,35 @@ class RSReflection {
       AM_Public,
       AM_Protected,
       AM_Private,
-      AM_PublicSynchronized
+      AM_PublicSynchronized,
+      AM_PrivateSynchronized
     } AccessModifier;
 
     bool mUseStdout;
     mutable std::ofstream mOF;
 
+    // If not NULL, the class files are kept here (written through mBuffer)
+    // rather than written
+    FileContentList *mOutputBuffers;
+    mutable std::ostringstream mBuffer;
+
     // Generated RS Elements for type-checking code.
     std::set<std::string> mTypesToCheck;
 
     // Generated FieldPackers for unsigned setters/validation.
     std::set<std::string> mFieldPackerTypes;
 
+    // Whether the Elements of mTypesToCheck are created on first use (see
+    // RSContext::hasLazyInit()), by the expression of each in
+    // mElementCreators (called with the RenderScript), rather than by the
+    // constructor
+    bool mLazyElements;
+    std::map<std::string, std::string> mElementCreators;
+
+    // The initial values of the exported arrays packed into string constants
+    // of the class (see genInitBlobExportVariable()), by variable name
+    std::map<std::string, std::vector<uint16_t> > mInitBlobs;
+
     bool addTypeNameForElement(const std::string &TypeName);
     bool addTypeNameForFieldPacker(const std::string &TypeName);
 
@@ -121,7 +153,8 @@ class RSReflection {
             const std::string &RSPackageName,
             const std::string &ResourceId,
             const std::string &PaddingPrefix,
-            bool UseStdout)
+            bool UseStdout,
+            bool WriteIfChanged)
         : mVerbose(true),
           mOutputPathBase(OutputPathBase),
           mInputRSFile(InputRSFile),
@@ -130,7 +163,10 @@ class RSReflection {
           mResourceId(ResourceId),
           mPaddingPrefix(PaddingPrefix),
           mLicenseNote(ApacheLicenseNote),
-          mUseStdout(UseStdout) {
+          mWriteIfChanged(WriteIfChanged),
+          mUseStdout(UseStdout),
+          mOutputBuffers(NULL),
+          mLazyElements(false) {
       clear();
       resetFieldIndex();
       clearFieldIndexMap();
@@ -138,7 +174,13 @@ class RSReflection {
     }
 
     inline std::ostream &out() const {
-      return ((mUseStdout) ? std::cout : mOF);
+      if (mUseStdout)
+        return std::cout;
+      return ((mOutputBuffers != NULL) ? mBuffer : mOF);
+    }
+
+    inline void setOutputBuffers(FileContentList *OutputBuffers) {
+      mOutputBuffers = OutputBuffers;
     }
     inline std::ostream &indent() const {
       out() << mIndent;
@@ -162,6 +204,7 @@ class RSReflection {
 
     inline int getNextExportFuncSlot() { return mNextExportFuncSlot++; }
     inline int getNextExportForEachSlot() { return mNextExportForEachSlot++; }
+    inline int getNextExportReduceSlot() { return mNextExportReduceSlot++; }
 
     // Will remove later due to field name information is not necessary for
     // C-reflect-to-Java
@@ -173,12 +216,23 @@ class RSReflection {
       mLicenseNote = LicenseNote;
     }
 
+    // A new context with the same settings (but its own output), such that
+    // other classes can be generated at the same time, e.g., on another
+    // thread.
+    Context *clone() const {
+      Context *C = new Context(mOutputPathBase, mInputRSFile, mPackageName,
+                               mRSPackageName, mResourceId, mPaddingPrefix,
+                               mUseStdout, mWriteIfChanged);
+      C->mLicenseNote = mLicenseNote;
+      return C;
+    }
+
     bool startClass(AccessModifier AM,
                     bool IsStatic,
                     const std::string &ClassName,
                     const char *SuperClassName,
                     std::string &ErrorMsg);
-    void endClass();
+    bool endClass(std::string &ErrorMsg);
 
     void startFunction(AccessModifier AM,
                        bool IsStatic,
@@ -242,6 +296,15 @@ class RSReflection {
                                     const RSExportType *ET,
                                     const std::string &VarName,
                                     const clang::APValue &Val);
+  // Set the initial values of the array EV from a string constant they're
+  // packed into (16 bits per char), rather than with a statement per value,
+  // which keeps a large lookup table from overflowing the 64K code of the
+  // method. Returns false (and generates nothing) if EV has too few values
+  // to be worth it, or values which can't be packed.
+  static bool genInitBlobExportVariable(Context &C, const RSExportVar *EV);
+  // The string constants of genInitBlobExportVariable() and the method
+  // unpacking them.
+  static void genInitBlobs(Context &C);
   void genExportVariable(Context &C, const RSExportVar *EV);
   void genPrimitiveTypeExportVariable(Context &C, const RSExportVar *EV);
   void genPointerTypeExportVariable(Context &C, const RSExportVar *EV);
@@ -257,15 +320,59 @@ class RSReflection {
                             const RSExportVar *EV);
   void genGetExportVariable(Context &C,
                             const std::string &TypeName,
-                            const std::string &VarName);
+                            const RSExportVar *EV);
+  // Set the initial value of EV (if it's not a zero), as the constructor or,
+  // with hasLazyInitialValue(), the getter does.
+  void genInitExportVariableValue(Context &C, const RSExportVar *EV);
+  // Whether the initial value of EV is allocated by its getter on first use
+  // rather than by the constructor (see RSContext::hasLazyInit())
+  bool hasLazyInitialValue(const RSExportVar *EV) const;
   void genGetFieldID(Context &C,
                      const std::string &VarName);
 
   void genExportFunction(Context &C,
                          const RSExportFunc *EF);
 
+  // The public ReadsName and WritesName arrays of the globals the kernel or
+  // invokable Name reads and writes, null if it may access other memory too
+  // (see RSContext::getAccessSet()). Nothing without -export-access-sets.
+  void genAccessSet(Context &C, const std::string &Name,
+                    const std::string &ReadsName,
+                    const std::string &WritesName);
+
+  // The VarBatch class (-reflect-var-batch), which packs the values of the
+  // batchable exported variables to set them with a single invoke().
+  void genVarBatchClass(Context &C);
+
+  // Allocate and bind (in the constructor) or declare the counters of the
+  // instrumented functions (-instrument-kernels), with getProfileCounters()
+  // and resetProfileCounters().
+  void genProfileCounters(Context &C, bool Declare);
+
   void genExportForEach(Context &C,
                         const RSExportForEach *EF);
+  // reduce_*(), which launches the reduction kernel ER over an allocation
+  // and returns the result.
+  void genExportReduce(Context &C, const RSExportReduce *ER);
+  // The check of the frozen variables against their values in the
+  // specialized kernels
+  void genSpecializedValuesMatch(Context &C);
+  // The slot forEach() launches EF in: the one of its specialized variant
+  // while the frozen variables have their values, if there's such a variant.
+  void genForEachSlot(Context &C, const RSExportForEach *EF);
+  void genExportForEachBind(Context &C,
+                            const RSExportForEach *EF,
+                            const Context::ArgTy &Args);
+  void genExportForEachBatch(Context &C,
+                             const RSExportForEach *EF);
+
+  // Check the allocations ain and aout passed to a kernel.
+  static void genForEachArgCheck(Context &C,
+                                 const RSExportForEach *EF);
+
+  // Throw if the Types tIn and tOut (of the input and output allocations of
+  // a kernel) differ in dimensions.
+  static void genForEachDimensionCheck(Context &C);
 
   static void genTypeCheck(Context &C,
                            const RSExportType *ET,
@@ -277,9 +384,30 @@ class RSReflection {
   static void genTypeInstance(Context &C,
                               const RSExportType *ET);
 
+  // Create the Element TypeName with Creator (e.g., "Element.F32_4") in the
+  // constructor, or record it for genLazyElements().
+  static void genElementInstance(Context &C,
+                                 const std::string &TypeName,
+                                 const std::string &Creator);
+
+  // The getters creating the Elements of C.mElementCreators on first use
+  static void genLazyElements(Context &C);
+
+  // How the code of the script class refers to the Element TypeName
+  static std::string GetElementRef(const Context &C,
+                                   const std::string &TypeName);
+
   static void genFieldPackerInstance(Context &C,
                                      const RSExportType *ET);
 
+  // The ScriptField_* classes are independent of each other, so they're
+  // generated on a few threads, each with its own Context (see reflect()).
+  struct TypeClassState;
+  static void *genTypeClassWorker(void *Data);
+  // Compute the LLVM type and the layout of ET (and of the types it contains)
+  // ahead, they're lazily cached and mustn't be created by several threads.
+  static void prepareTypeClass(const RSExportType *ET);
+
   bool genTypeClass(Context &C,
                     const RSExportRecordType *ERT,
                     std::string &ErrorMsg);
@@ -293,6 +421,24 @@ class RSReflection {
   void genTypeClassComponentGetter(Context &C, const RSExportRecordType *ERT);
   void genTypeClassCopyAll(Context &C, const RSExportRecordType *ERT);
   void genTypeClassResize(Context &C);
+  void genTypeClassMarkDirty(Context &C);
+  void genTypeClassCopyDirty(Context &C, bool UseByteBuffer);
+  static void genResetDirtyRange(Context &C);
+
+  // The type class of ERT keeps its elements in a ByteBuffer
+  // (-reflect-scriptfield-buffer and ERT has no RS object or pointer in it).
+  bool isByteBufferBacked(const RSExportRecordType *ERT) const;
+  void genTypeClassByteBuffer(Context &C);
+  void genTypeClassByteBufferItemSetter(Context &C,
+                                        const RSExportRecordType *ERT);
+  void genTypeClassByteBufferItemGetter(Context &C,
+                                        const RSExportRecordType *ERT);
+  void genTypeClassByteBufferComponentSetter(Context &C,
+                                             const RSExportRecordType *ERT);
+  void genTypeClassByteBufferComponentGetter(Context &C,
+                                             const RSExportRecordType *ERT);
+  void genTypeClassByteBufferCopyAll(Context &C);
+  void genTypeClassByteBufferResize(Context &C);
 
   void genBuildElement(Context &C,
                        const char *ElementBuilderName,
@@ -313,13 +459,44 @@ class RSReflection {
   bool genCreateFieldPacker(Context &C,
                             const RSExportType *T,
                             const char *FieldPackerName);
+  // Get FieldPackerName ready for packing the packet ERT: the preallocated
+  // PreallocatedName reset (see RSContext::hasPreallocatedPackers()), or a
+  // new one.
+  bool genPacketFieldPacker(Context &C,
+                            const RSExportRecordType *ERT,
+                            const std::string &PreallocatedName,
+                            const char *FieldPackerName);
+  // Allocate (in the constructor) or declare the preallocated packers
+  void genPreallocatedFieldPackers(Context &C, bool Declare);
+  void genBulkPackArray(Context &C,
+                        const char *BufferView,
+                        const std::string &ArrayName,
+                        size_t NumValues,
+                        size_t Offset,
+                        size_t Size,
+                        const char *FieldPackerName);
+  // Offset is the position of FieldPackerName at this point, if it's known
+  // (>= 0). That allows for packing arrays in bulk.
   void genPackVarOfType(Context &C,
                         const RSExportType *T,
                         const char *VarName,
-                        const char *FieldPackerName);
+                        const char *FieldPackerName,
+                        int Offset = -1);
   void genAllocateVarOfType(Context &C,
                             const RSExportType *T,
                             const std::string &VarName);
+  // Put VarName into (get it from) the ByteBuffer b at the position given by
+  // the Java expression Offset. Level numbers the loop variables.
+  void genByteBufferPutVarOfType(Context &C,
+                                 const RSExportType *ET,
+                                 const std::string &VarName,
+                                 const std::string &Offset,
+                                 unsigned Level);
+  void genByteBufferGetVarOfType(Context &C,
+                                 const RSExportType *ET,
+                                 const std::string &VarName,
+                                 const std::string &Offset,
+                                 unsigned Level);
   void genNewItemBufferIfNull(Context &C, const char *Index);
   void genNewItemBufferPackerIfNull(Context &C);
 
@@ -333,11 +510,15 @@ class RSReflection {
     return;
   }
 
+  // The ScriptField_* classes are generated on up to NumThreads threads.
   bool reflect(const std::string &OutputPathBase,
                const std::string &OutputPackageName,
                const std::string &RSPackageName,
                const std::string &InputFileName,
-               const std::string &OutputBCFileName);
+               const std::string &OutputBCFileName,
+               bool WriteIfChanged,
+               FileContentList *OutputBuffers,
+               unsigned NumThreads);
 
   inline const char *getLastError() const {
     if (mLastError.empty())
@@ -62,7 +62,7 @@ static const char *const gApacheLicenseNote =
 
 
 RSReflectionBase::RSReflectionBase(const RSContext *con)
-  : mVerbose(true) {
+  : mVerbose(true), mWriteIfChanged(false) {
   mRSContext = con;
   mLicenseNote = gApacheLicenseNote;
 
@@ -72,24 +72,47 @@ RSReflectionBase::~RSReflectionBase() {
 
 }
 
-/*
 bool RSReflectionBase::openFile(const string &name, string &errorMsg) {
-    if(!mUseStdout) {
-        mOF.clear();
-        if(!SlangUtils::CreateDirectoryWithParents(mOutputPath, &errorMsg)) {
-            return false;
-        }
+  static const size_t BufferSize = 256 * 1024;
+
+  mOFName = mOutputPath + name;
+  string OutputFile = mOFName;
+  if (mWriteIfChanged) {
+    if (!SlangUtils::CreatePendingFile(mOFName, &mPendingFile, &errorMsg))
+      return false;
+    OutputFile = mPendingFile;
+  }
 
-        string cf(mOutputPath + OS_PATH_SEPARATOR_STR + name);
-        mOF.open(cf.c_str());
-        if(!mOF.good()) {
-            errorMsg = "failed to open file '" + cf + "' for write";
-            return false;
-        }
-    }
-    return true;
+  mOF.reset(new llvm::tool_output_file(OutputFile.c_str(), errorMsg,
+                                       llvm::sys::fs::F_None));
+  if (!errorMsg.empty()) {
+    errorMsg = "failed to open file '" + OutputFile + "' for write: " +
+               errorMsg;
+    mOF.reset();
+    return false;
+  }
+  mOF->os().SetBufferSize(BufferSize);
+  return true;
+}
+
+bool RSReflectionBase::closeFile(string &errorMsg) {
+  slangAssert((mOF.get() != NULL) && "No file was opened");
+
+  mOF->os().close();
+  if (mOF->os().has_error()) {
+    mOF->os().clear_error();
+    errorMsg = "failed to write file '" + mOFName + "'";
+    mOF.reset();
+    return false;
+  }
+  mOF->keep();
+  mOF.reset();
+
+  if (mWriteIfChanged) {
+    return SlangUtils::ReplaceFileIfChanged(mPendingFile, mOFName, &errorMsg);
+  }
+  return true;
 }
-*/
 
 void RSReflectionBase::startFile(const string &filename) {
   if(mVerbose) {
@@ -125,12 +148,34 @@ string RSReflectionBase::stripRS(const string &s) const {
 }
 
 void RSReflectionBase::write(const std::string &t) {
-  //printf("%s%s\n", mIndent.c_str(), t.c_str());
-  mText.push_back(mIndent + t);
+  mOF->os() << mIndent << t << '\n';
 }
 
 void RSReflectionBase::write(const std::stringstream &t) {
-  mText.push_back(mIndent + t.str());
+  write(t.str());
+}
+
+void RSReflectionBase::writeHexTable(const unsigned char *Buf, size_t Len) {
+  static const char HexDigits[] = "0123456789abcdef";
+  static const size_t BytesPerLine = 16;
+
+  // Each byte is spelled as "0xNN,"
+  char Line[BytesPerLine * 5 + 1];
+  llvm::raw_ostream &OS = mOF->os();
+  for (size_t i = 0; i < Len; i += BytesPerLine) {
+    size_t e = std::min(Len, i + BytesPerLine);
+    char *P = Line;
+    for (size_t j = i; j < e; j++) {
+      *P++ = '0';
+      *P++ = 'x';
+      *P++ = HexDigits[Buf[j] >> 4];
+      *P++ = HexDigits[Buf[j] & 0xf];
+      *P++ = ',';
+    }
+    *P++ = '\n';
+    OS << mIndent;
+    OS.write(Line, P - Line);
+  }
 }
 
 
@@ -142,21 +187,6 @@ void RSReflectionBase::decIndent() {
   mIndent.erase(0, 4);
 }
 
-bool RSReflectionBase::writeFile(const string &filename, const vector< string > &txt) {
-  FILE *pfin = fopen((mOutputPath + filename).c_str(), "wt");
-  if (pfin == NULL) {
-    fprintf(stderr, "Error: could not write file %s\n", filename.c_str());
-    return false;
-  }
-
-  for(size_t ct=0; ct < txt.size(); ct++) {
-    fprintf(pfin, "%s\n", txt[ct].c_str());
-  }
-  fclose(pfin);
-  return true;
-}
-
-
 string RSReflectionBase::genInitValue(const clang::APValue &Val, bool asBool) {
   stringstream tmp;
   switch (Val.getKind()) {
@@ -24,7 +24,10 @@
 #include <string>
 #include <vector>
 
+#include "llvm/ADT/OwningPtr.h"
 #include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/ToolOutputFile.h"
 
 #include "slang_assert.h"
 #include "slang_rs_export_type.h"
@@ -34,6 +37,7 @@ namespace slang {
     class RSExportVar;
     class RSExportFunc;
     class RSExportForEach;
+    class RSExportReduce;
 
 class RSReflectionBase {
 protected:
@@ -54,20 +58,32 @@ protected:
     std::string mOutputPath;
     std::string mOutputBCFileName;
 
-    std::vector< std::string > mText;
+    // The file being generated. The text is streamed to it through a large
+    // buffer rather than kept in memory.
+    llvm::OwningPtr<llvm::tool_output_file> mOF;
+    std::string mOFName;
+    // The pending file mOF writes to with mWriteIfChanged
+    std::string mPendingFile;
+    // Only replace the files whose content changes (see
+    // SlangUtils::ReplaceFileIfChanged())
+    bool mWriteIfChanged;
     std::string mIndent;
 
+    // Open mOutputPath + name for write() and friends.
     bool openFile(const std::string &name, std::string &errorMsg);
+    // Flush and close the file opened by openFile(). The partially written
+    // file is removed on error.
+    bool closeFile(std::string &errorMsg);
     void startFile(const std::string &filename);
     void incIndent();
     void decIndent();
     void write(const std::string &t);
     void write(const std::stringstream &t);
+    // Write Len bytes as a table of "0x.," hex literals, 16 per line.
+    void writeHexTable(const unsigned char *Buf, size_t Len);
 
     std::string stripRS(const std::string &s) const;
 
-    bool writeFile(const std::string &filename, const std::vector< std::string > &txt);
-
     bool addTypeNameForElement(const std::string &TypeName);
 
     static const char *getVectorAccessor(unsigned index);
@@ -25,13 +25,19 @@
 #include <sstream>
 #include <string>
 #include <utility>
+#include <vector>
+
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/system_error.h"
 
 #include "os_sep.h"
 #include "slang_rs_context.h"
 #include "slang_rs_export_var.h"
 #include "slang_rs_export_foreach.h"
 #include "slang_rs_export_func.h"
+#include "slang_rs_export_reduce.h"
 #include "slang_rs_reflect_utils.h"
+#include "slang_rs_reflection_manifest.h"
 #include "slang_version.h"
 #include "slang_utils.h"
 
@@ -44,6 +50,9 @@ namespace slang {
 #define RS_TYPE_ITEM_CLASS_NAME          "Item"
 
 #define RS_ELEM_PREFIX "__rs_elem_"
+#define RS_INIT_TABLE_PREFIX "__rs_init_"
+#define RS_PROFILE_COUNTERS_NAME "__rs_profile_counters"
+#define RS_PROFILE_COUNTER_INDEX_PREFIX "mProfileCounterIdx_"
 
 static const char *GetMatrixTypeName(const RSExportMatrixType *EMT) {
   static const char *MatrixTypeCNameMap[] = {
@@ -116,8 +125,41 @@ static std::string GetTypeName(const RSExportType *ET, bool Brackets = true) {
 }
 
 
+// Whether the arrays of ET are laid out in the reflected class just as they
+// are in the script, such that they're set and initialized by a copy.
+static bool IsPlainArrayElement(const RSExportType *ET) {
+  if (ET->getClass() == RSExportType::ExportClassVector)
+    return true;
+  return (ET->getClass() == RSExportType::ExportClassPrimitive) &&
+         !static_cast<const RSExportPrimitiveType*>(ET)->isRSObjectType();
+}
+
+// Whether EV is an array with initial values in a table of
+// genInitArrayTables().
+static bool HasInitTable(const RSExportVar *EV) {
+  const RSExportType *ET = EV->getType();
+  return (ET->getClass() == RSExportType::ExportClassConstantArray) &&
+         (EV->getNumInits() > 0) &&
+         IsPlainArrayElement(
+             static_cast<const RSExportConstantArrayType*>(ET)->
+                 getElementType());
+}
+
+// The initial value Val in a table of genInitArrayTables(). Unlike
+// genInitValue(), the values of unsigned types keep their sign.
+static std::string GetTableValue(const clang::APValue &Val, bool IsBool) {
+  if (Val.isInt() && !IsBool && Val.getInt().isUnsigned()) {
+    std::string S = llvm::utostr(Val.getInt().getZExtValue()) + "U";
+    if (Val.getInt().getBitWidth() > 32)
+      S.append("LL");
+    return S;
+  }
+  return RSReflectionBase::genInitValue(Val, IsBool);
+}
+
 RSReflectionCpp::RSReflectionCpp(const RSContext *con)
-    : RSReflectionBase(con) {
+    : RSReflectionBase(con), mOutputBC(NULL), mHeaderOnly(false),
+      mBitcodeBlob(false) {
   clear();
 }
 
@@ -126,24 +168,94 @@ RSReflectionCpp::~RSReflectionCpp() {
 
 bool RSReflectionCpp::reflect(const string &OutputPathBase,
                               const string &InputFileName,
-                              const string &OutputBCFileName) {
+                              const string &OutputBCFileName,
+                              const string *OutputBC,
+                              bool WriteIfChanged) {
   mInputFileName = InputFileName;
+  mWriteIfChanged = WriteIfChanged;
   mOutputPath = OutputPathBase;
   mOutputBCFileName = OutputBCFileName;
+  mOutputBC = OutputBC;
   mClassName = string("ScriptC_") + stripRS(InputFileName);
+  mHeaderOnly = mRSContext->hasCppHeaderOnly();
+  // There's no file for the assembler to include with an in-memory bitcode.
+  mBitcodeBlob = mRSContext->hasCppBitcodeBlob() && (mOutputBC == NULL);
+
+  // Both the header and the implementation declare the elements.
+  collectTypesToCheck();
+
+  // With WriteIfChanged, the files whose signature is the same as the last
+  // time are left alone. The implementation embeds the bitcode, so it's part
+  // of its signature, unless the assembly file includes it.
+  llvm::OwningPtr<RSReflectionManifest> Manifest;
+  uint64_t HeaderSignature = 0, ImplSignature = 0, BlobSignature = 0;
+  bool HeaderUpToDate = false, ImplUpToDate = false, BlobUpToDate = false;
+  if (WriteIfChanged) {
+    std::string Settings = InputFileName + '\n' + OutputBCFileName + '\n' +
+        mRSContext->getReflectJavaPackageName();
+    Manifest.reset(new RSReflectionManifest(
+        mOutputPath + mClassName + ".manifest", mRSContext, Settings));
+
+    HeaderSignature = Manifest->getScriptSignature();
+    ImplSignature = HeaderSignature;
+    if (mBitcodeBlob)
+      BlobSignature = SlangUtils::UpdateHash(HeaderSignature,
+                                             "blob " + mOutputBCFileName);
+    else if (mOutputBC != NULL)
+      ImplSignature = SlangUtils::UpdateHash(ImplSignature, *mOutputBC);
+    else if (!SlangUtils::UpdateHashWithFile(&ImplSignature,
+                                             mOutputBCFileName))
+      ImplSignature = 0;
+
+    // The header-only one embeds the bitcode.
+    if (mHeaderOnly)
+      HeaderSignature = ImplSignature;
+    HeaderUpToDate = (HeaderSignature != 0) &&
+        Manifest->isUpToDate(mOutputPath + mClassName + ".h",
+                             HeaderSignature);
+    ImplUpToDate = (ImplSignature != 0) &&
+        Manifest->isUpToDate(mOutputPath + mClassName + ".cpp",
+                             ImplSignature);
+    BlobUpToDate = (BlobSignature != 0) &&
+        Manifest->isUpToDate(mOutputPath + mClassName + ".S", BlobSignature);
+  }
 
-  makeHeader("android::RSC::ScriptC");
-  std::vector< std::string > header(mText);
-  mText.clear();
-
-  makeImpl("android::RSC::ScriptC");
-  std::vector< std::string > cpp(mText);
-  mText.clear();
-
-
-  writeFile(mClassName + ".h", header);
-  writeFile(mClassName + ".cpp", cpp);
+  std::string ErrorMsg;
+  bool Success = true;
+  if (!HeaderUpToDate) {
+    Success = openFile(mClassName + ".h", ErrorMsg) &&
+              makeHeader("android::RSC::ScriptC") &&
+              closeFile(ErrorMsg) &&
+              ((Manifest.get() == NULL) ||
+               Manifest->update(mOutputPath + mClassName + ".h",
+                                HeaderSignature, &ErrorMsg));
+  }
+  if (Success && !mHeaderOnly && !ImplUpToDate) {
+    Success = openFile(mClassName + ".cpp", ErrorMsg) &&
+              makeImpl("android::RSC::ScriptC") &&
+              closeFile(ErrorMsg) &&
+              ((Manifest.get() == NULL) ||
+               Manifest->update(mOutputPath + mClassName + ".cpp",
+                                ImplSignature, &ErrorMsg));
+  }
+  if (Success && mBitcodeBlob && !BlobUpToDate) {
+    Success = openFile(mClassName + ".S", ErrorMsg) &&
+              makeBlob() &&
+              closeFile(ErrorMsg) &&
+              ((Manifest.get() == NULL) ||
+               Manifest->update(mOutputPath + mClassName + ".S",
+                                BlobSignature, &ErrorMsg));
+  }
+  if (Success && (Manifest.get() != NULL))
+    Success = Manifest->write(&ErrorMsg);
 
+  if (!Success) {
+    if (!ErrorMsg.empty()) {
+      fprintf(stderr, "Error: %s\n", ErrorMsg.c_str());
+    }
+    mOF.reset();
+    return false;
+  }
 
   return true;
 }
@@ -161,6 +273,14 @@ bool RSReflectionCpp::makeHeader(const std::string &baseClass) {
   write("using namespace android::RSC;");
   write("");
 
+  // The tables are static, so each file including the header has its own.
+  if (mHeaderOnly) {
+    if (!writeBC()) {
+      return false;
+    }
+    genInitArrayTables();
+  }
+
   // Imports
   //for(unsigned i = 0; i < (sizeof(Import) / sizeof(const char*)); i++)
       //out() << "import " << Import[i] << ";" << std::endl;
@@ -178,26 +298,21 @@ bool RSReflectionCpp::makeHeader(const std::string &baseClass) {
   for (RSContext::const_export_var_iterator I = mRSContext->export_vars_begin(),
          E = mRSContext->export_vars_end(); I != E; I++, slot++) {
     const RSExportVar *ev = *I;
-    if (!ev->isConst()) {
+    if (ev->getType()->getClass() == RSExportType::ExportClassConstantArray) {
+      // Kept even if it's const, it's what get_*() returns.
+      stringstream ss;
+      ss << GetTypeName(ev->getType(), false) << " " RS_EXPORT_VAR_PREFIX
+         << ev->getName() << "["
+         << static_cast<const RSExportConstantArrayType*>(ev->getType())->
+                getSize()
+         << "];";
+      write(ss);
+    } else if (!ev->isConst()) {
       write(GetTypeName(ev->getType()) + " " RS_EXPORT_VAR_PREFIX
             + ev->getName() + ";");
     }
   }
 
-  for (RSContext::const_export_foreach_iterator
-           I = mRSContext->export_foreach_begin(),
-           E = mRSContext->export_foreach_end(); I != E; I++) {
-    const RSExportForEach *EF = *I;
-    const RSExportType *IET = EF->getInType();
-    const RSExportType *OET = EF->getOutType();
-    if (IET) {
-      genTypeInstanceFromPointer(IET);
-    }
-    if (OET) {
-      genTypeInstanceFromPointer(OET);
-    }
-  }
-
   for (std::set<std::string>::iterator I = mTypesToCheck.begin(),
                                        E = mTypesToCheck.end();
        I != E;
@@ -206,14 +321,26 @@ bool RSReflectionCpp::makeHeader(const std::string &baseClass) {
           + *I + ";");
   }
 
+  std::vector<std::string> ProfiledFunctions;
+  mRSContext->getProfiledFunctions(&ProfiledFunctions);
+  if (!ProfiledFunctions.empty())
+    write("android::RSC::sp<android::RSC::Allocation> "
+          RS_PROFILE_COUNTERS_NAME ";");
+
   decIndent();
 
   write("public:");
   incIndent();
-  write(mClassName + "(android::RSC::sp<android::RSC::RS> rs);");
-  write("virtual ~" + mClassName + "();");
-  write("");
+  if (mHeaderOnly) {
+    genConstructor();
+  } else {
+    write(mClassName + "(android::RSC::sp<android::RSC::RS> rs);");
+    write("virtual ~" + mClassName + "();");
+    write("");
+  }
 
+  if (mHeaderOnly)
+    genRecordLayouts();
 
   // Reflect export variable
   slot = 0;
@@ -223,53 +350,38 @@ bool RSReflectionCpp::makeHeader(const std::string &baseClass) {
   }
 
   // Reflect export for each functions
+  slot = 0;
   for (RSContext::const_export_foreach_iterator
            I = mRSContext->export_foreach_begin(),
-           E = mRSContext->export_foreach_end(); I != E; I++) {
-    const RSExportForEach *ef = *I;
-    if (ef->isDummyRoot()) {
-      write("// No forEach_root(...)");
-      continue;
-    }
-
-    ArgTy Args;
-    stringstream ss;
-    ss << "void forEach_" << ef->getName() << "(";
-
-    if (ef->hasIn()) {
-      Args.push_back(std::make_pair(
-          "android::RSC::sp<const android::RSC::Allocation>", "ain"));
-    }
-
-    if (ef->hasOut() || ef->hasReturn()) {
-      Args.push_back(std::make_pair(
-          "android::RSC::sp<const android::RSC::Allocation>", "aout"));
-    }
-
-    const RSExportRecordType *ERT = ef->getParamPacketType();
-    if (ERT) {
-      for (RSExportForEach::const_param_iterator i = ef->params_begin(),
-           e = ef->params_end(); i != e; i++) {
-        RSReflectionTypeData rtd;
-        (*i)->getType()->convertToRTD(&rtd);
-        Args.push_back(std::make_pair(rtd.type->c_name, (*i)->getName()));
-      }
-    }
-    makeArgs(ss, Args);
-    ss << ");";
-    write(ss);
-  }
-
+           E = mRSContext->export_foreach_end(); I != E; I++, slot++)
+    genExportForEach(*I, mHeaderOnly, slot);
 
   // Reflect export function
+  slot = 0;
   for (RSContext::const_export_func_iterator
         I = mRSContext->export_funcs_begin(),
-        E = mRSContext->export_funcs_end(); I != E; I++) {
-    const RSExportFunc *ef = *I;
+        E = mRSContext->export_funcs_end(); I != E; I++, slot++)
+    genExportFunc(*I, mHeaderOnly, slot);
 
-    stringstream ss;
-    makeFunctionSignature(ss, false, ef);
-    write(ss);
+  // Reflect export reduction kernels
+  slot = 0;
+  for (RSContext::const_export_reduce_iterator
+           I = mRSContext->export_reduce_begin(),
+           E = mRSContext->export_reduce_end(); I != E; I++, slot++)
+    genExportReduce(*I, mHeaderOnly, slot);
+
+  // Reflect the counters of -instrument-kernels, the calls of the function
+  // mProfileCounterIdx_<name> are at 2 * index and the nanoseconds spent in
+  // it at 2 * index + 1.
+  if (!ProfiledFunctions.empty()) {
+    write("");
+    for (unsigned i = 0, e = ProfiledFunctions.size(); i != e; i++) {
+      stringstream ss;
+      ss << "static const uint32_t " RS_PROFILE_COUNTER_INDEX_PREFIX
+         << ProfiledFunctions[i] << " = " << i << ";";
+      write(ss);
+    }
+    genProfileCounters(mHeaderOnly, ProfiledFunctions.size());
   }
 
   decIndent();
@@ -278,26 +390,30 @@ bool RSReflectionCpp::makeHeader(const std::string &baseClass) {
 }
 
 bool RSReflectionCpp::writeBC() {
-  FILE *pfin = fopen(mOutputBCFileName.c_str(), "rb");
-  if (pfin == NULL) {
-    fprintf(stderr, "Error: could not read file %s\n",
-            mOutputBCFileName.c_str());
-    return false;
+  if (mBitcodeBlob) {
+    write("extern \"C\" const unsigned char " + getBitcodeSymbol() + "[];");
+    write("extern \"C\" const unsigned " + getBitcodeSymbol() + "_size;");
+    write("");
+    return true;
   }
 
-  unsigned char buf[16];
-  int read_length;
-  write("static const unsigned char __txt[] = {");
-  incIndent();
-  while ((read_length = fread(buf, 1, sizeof(buf), pfin)) > 0) {
-    string s;
-    for (int i = 0; i < read_length; i++) {
-      char buf2[16];
-      snprintf(buf2, sizeof(buf2), "0x%02x,", buf[i]);
-      s += buf2;
+  llvm::OwningPtr<llvm::MemoryBuffer> File;
+  llvm::StringRef BC;
+  if (mOutputBC != NULL) {
+    BC = *mOutputBC;
+  } else {
+    if (llvm::MemoryBuffer::getFile(mOutputBCFileName, File) !=
+        llvm::errc::success) {
+      fprintf(stderr, "Error: could not read file %s\n",
+              mOutputBCFileName.c_str());
+      return false;
     }
-    write(s);
+    BC = File->getBuffer();
   }
+
+  write("static const unsigned char __txt[] = {");
+  incIndent();
+  writeHexTable(reinterpret_cast<const unsigned char *>(BC.data()), BC.size());
   decIndent();
   write("};");
   write("");
@@ -311,7 +427,11 @@ bool RSReflectionCpp::makeImpl(const std::string &baseClass) {
   write("#include \"" + mClassName + ".h\"");
   write("");
 
-  writeBC();
+  if (!writeBC()) {
+    return false;
+  }
+
+  genInitArrayTables();
 
   // Imports
   //for(unsigned i = 0; i < (sizeof(Import) / sizeof(const char*)); i++)
@@ -319,11 +439,73 @@ bool RSReflectionCpp::makeImpl(const std::string &baseClass) {
   //out() << std::endl;
 
   write("\n");
+  genConstructor();
+
+  // Reflect export for each functions
+  uint32_t slot = 0;
+  for (RSContext::const_export_foreach_iterator
+       I = mRSContext->export_foreach_begin(),
+       E = mRSContext->export_foreach_end(); I != E; I++, slot++)
+    genExportForEach(*I, true, slot);
+
+  slot = 0;
+  // Reflect export function
+  for (RSContext::const_export_func_iterator
+       I = mRSContext->export_funcs_begin(),
+       E = mRSContext->export_funcs_end(); I != E; I++, slot++)
+    genExportFunc(*I, true, slot);
+
+  slot = 0;
+  for (RSContext::const_export_reduce_iterator
+           I = mRSContext->export_reduce_begin(),
+           E = mRSContext->export_reduce_end(); I != E; I++, slot++)
+    genExportReduce(*I, true, slot);
+
+  std::vector<std::string> ProfiledFunctions;
+  mRSContext->getProfiledFunctions(&ProfiledFunctions);
+  if (!ProfiledFunctions.empty())
+    genProfileCounters(true, ProfiledFunctions.size());
+
+  decIndent();
+  return true;
+}
+
+bool RSReflectionCpp::makeBlob() {
+  // The assembler includes the bitcode file itself, from the path given to
+  // llvm-rs-cc (so relative to where it ran, as for the other outputs). The
+  // symbols are the ones declared by writeBC(). See slangdata.py about the
+  // Apple variant.
+  startFile(mClassName + ".S");
+
+  const std::string Symbol = getBitcodeSymbol();
+  const std::string Prefixes[] = { "_", "" };
+  for (unsigned i = 0; i < 2; i++) {
+    const std::string Name = Prefixes[i] + Symbol;
+    write((i == 0) ? "#ifdef __APPLE_CC__" : "#else");
+    write(".globl " + Name);
+    write((i == 0) ? "  .section .rodata," : "  .section .rodata");
+    write("  .balign 4");
+    write(Name + ":");
+    write("  .incbin \"" + mOutputBCFileName + "\"");
+    write(Name + "_end:");
+    write(".globl " + Name + "_size");
+    write("  .balign 4");
+    write(Name + "_size:");
+    write("  .long " + Name + "_end - " + Name);
+  }
+  write("#endif");
+  return true;
+}
+
+void RSReflectionCpp::genConstructor() {
   stringstream ss;
   const std::string &packageName = mRSContext->getReflectJavaPackageName();
-  ss << mClassName << "::" << mClassName
+  const std::string BC = mBitcodeBlob ?
+      getBitcodeSymbol() + ", " + getBitcodeSymbol() + "_size" :
+      std::string("__txt, sizeof(__txt)");
+  ss << getQualifier() << mClassName
      << "(android::RSC::sp<android::RSC::RS> rs):\n"
-        "        ScriptC(rs, __txt, sizeof(__txt), \""
+        "        ScriptC(rs, " << BC << ", \""
      << stripRS(mInputFileName) << "\", " << stripRS(mInputFileName).length()
      << ", \"/data/data/" << packageName << "/app\", sizeof(\"" << packageName << "\")) {";
   write(ss);
@@ -345,134 +527,348 @@ bool RSReflectionCpp::makeImpl(const std::string &baseClass) {
       genInitExportVariable(EV->getType(), EV->getName(), EV->getInit());
     } else {
       genZeroInitExportVariable(EV->getName());
+      if (HasInitTable(EV)) {
+        ss << "memcpy(" RS_EXPORT_VAR_PREFIX << EV->getName() << ", "
+           RS_INIT_TABLE_PREFIX << EV->getName() << ", sizeof("
+           RS_INIT_TABLE_PREFIX << EV->getName() << "));";
+        write(ss);
+        ss.str("");
+      }
     }
   }
+
+  std::vector<std::string> ProfiledFunctions;
+  mRSContext->getProfiledFunctions(&ProfiledFunctions);
+  if (!ProfiledFunctions.empty()) {
+    ss << RS_PROFILE_COUNTERS_NAME " = android::RSC::Allocation::createSized("
+          "mRS, android::RSC::Element::U64(mRS), "
+       << 2 * ProfiledFunctions.size() << ");";
+    write(ss);
+    ss.str("");
+    ss << "bindAllocation(" RS_PROFILE_COUNTERS_NAME ", "
+       << mRSContext->getProfileCountersSlot() << ");";
+    write(ss);
+    ss.str("");
+    write("resetProfileCounters();");
+  }
   decIndent();
   write("}");
   write("");
 
-  write(mClassName + "::~" + mClassName + "() {");
+  if (mHeaderOnly)
+    write("virtual ~" + mClassName + "() {");
+  else
+    write(mClassName + "::~" + mClassName + "() {");
   write("}");
   write("");
+  return;
+}
 
-  // Reflect export for each functions
-  uint32_t slot = 0;
-  for (RSContext::const_export_foreach_iterator
-       I = mRSContext->export_foreach_begin(),
-       E = mRSContext->export_foreach_end(); I != E; I++, slot++) {
-    const RSExportForEach *ef = *I;
-    if (ef->isDummyRoot()) {
-      write("// No forEach_root(...)");
-      continue;
-    }
+void RSReflectionCpp::genExportForEach(const RSExportForEach *ef, bool IsImpl,
+                                       unsigned Slot) {
+  if (ef->isDummyRoot()) {
+    write("// No forEach_root(...)");
+    return;
+  }
 
-    stringstream tmp;
-    ArgTy Args;
-    tmp << "void " << mClassName << "::forEach_" << ef->getName() << "(";
+  stringstream tmp;
+  ArgTy Args;
+  tmp << "void " << (IsImpl ? getQualifier() : std::string()) << "forEach_"
+      << ef->getName() << "(";
 
-    if (ef->hasIn()) {
-      Args.push_back(std::make_pair(
-          "android::RSC::sp<const android::RSC::Allocation>", "ain"));
-    }
+  if (ef->hasIn()) {
+    Args.push_back(std::make_pair(
+        "android::RSC::sp<const android::RSC::Allocation>", "ain"));
+  }
 
-    if (ef->hasOut() || ef->hasReturn()) {
-      Args.push_back(std::make_pair(
-          "android::RSC::sp<const android::RSC::Allocation>", "aout"));
-    }
+  if (ef->hasOut() || ef->hasReturn()) {
+    Args.push_back(std::make_pair(
+        "android::RSC::sp<const android::RSC::Allocation>", "aout"));
+  }
 
-    const RSExportRecordType *ERT = ef->getParamPacketType();
-    if (ERT) {
-      for (RSExportForEach::const_param_iterator i = ef->params_begin(),
-           e = ef->params_end(); i != e; i++) {
-        RSReflectionTypeData rtd;
-        (*i)->getType()->convertToRTD(&rtd);
-        Args.push_back(std::make_pair(rtd.type->c_name, (*i)->getName()));
-      }
+  const RSExportRecordType *ERT = ef->getParamPacketType();
+  if (ERT) {
+    for (RSExportForEach::const_param_iterator i = ef->params_begin(),
+         e = ef->params_end(); i != e; i++) {
+      RSReflectionTypeData rtd;
+      (*i)->getType()->convertToRTD(&rtd);
+      Args.push_back(std::make_pair(rtd.type->c_name, (*i)->getName()));
     }
-    makeArgs(tmp, Args);
+  }
+  makeArgs(tmp, Args);
 
-    tmp << ") {";
+  if (!IsImpl) {
+    tmp << ");";
     write(tmp);
-    tmp.str("");
+    return;
+  }
 
-    const RSExportType *IET = ef->getInType();
-    const RSExportType *OET = ef->getOutType();
+  tmp << ") {";
+  write(tmp);
+  tmp.str("");
 
-    incIndent();
-    if (IET) {
-      genTypeCheck(IET, "ain");
-    }
+  const RSExportType *IET = ef->getInType();
+  const RSExportType *OET = ef->getOutType();
 
-    if (OET) {
-      genTypeCheck(OET, "aout");
-    }
-    decIndent();
-
-    std::string FieldPackerName = ef->getName() + "_fp";
-    if (ERT) {
-      if (genCreateFieldPacker(ERT, FieldPackerName.c_str())) {
-        genPackVarOfType(ERT, NULL, FieldPackerName.c_str());
-      }
-    }
-    tmp << "    forEach(" << slot << ", ";
+  incIndent();
+  if (IET) {
+    genTypeCheck(IET, "ain");
+  }
 
-    if (ef->hasIn()) {
-      tmp << "ain, ";
-    } else {
-      tmp << "NULL, ";
-    }
+  if (OET) {
+    genTypeCheck(OET, "aout");
+  }
+  decIndent();
 
-    if (ef->hasOut() || ef->hasReturn()) {
-      tmp << "aout, ";
-    } else {
-      tmp << "NULL, ";
+  // The packer goes unused (see below), so the header-only class doesn't
+  // allocate it.
+  std::string FieldPackerName = ef->getName() + "_fp";
+  if (ERT && !mHeaderOnly) {
+    if (genCreateFieldPacker(ERT, FieldPackerName.c_str())) {
+      genPackVarOfType(ERT, NULL, FieldPackerName.c_str(), 0);
     }
+  }
+  tmp << "    forEach(" << Slot << ", ";
 
-    // FIXME (no support for usrData with C++ kernels)
-    tmp << "NULL, 0);";
-    write(tmp);
+  if (ef->hasIn()) {
+    tmp << "ain, ";
+  } else {
+    tmp << "NULL, ";
+  }
 
-    write("}");
-    write("");
+  if (ef->hasOut() || ef->hasReturn()) {
+    tmp << "aout, ";
+  } else {
+    tmp << "NULL, ";
   }
 
-  slot = 0;
-  // Reflect export function
-  for (RSContext::const_export_func_iterator
-       I = mRSContext->export_funcs_begin(),
-       E = mRSContext->export_funcs_end(); I != E; I++) {
-    const RSExportFunc *ef = *I;
+  // FIXME (no support for usrData with C++ kernels)
+  tmp << "NULL, 0);";
+  write(tmp);
 
-    stringstream ss;
-    makeFunctionSignature(ss, true, ef);
-    write(ss);
-    ss.str("");
-    const RSExportRecordType *params = ef->getParamPacketType();
+  write("}");
+  write("");
+  return;
+}
+
+void RSReflectionCpp::genExportFunc(const RSExportFunc *ef, bool IsImpl,
+                                    unsigned Slot) {
+  stringstream ss;
+  makeFunctionSignature(ss, IsImpl, ef);
+  write(ss);
+  if (!IsImpl)
+    return;
+
+  ss.str("");
+  const RSExportRecordType *params = ef->getParamPacketType();
+  if (params && mHeaderOnly && genPackParamsOnStack(params, "__params")) {
+    ss << "    invoke(" << Slot << ", __params, sizeof(__params));";
+  } else {
     size_t param_len = 0;
     if (params) {
       param_len = RSExportType::GetTypeAllocSize(params);
       if (genCreateFieldPacker(params, "__fp")) {
-        genPackVarOfType(params, NULL, "__fp");
+        genPackVarOfType(params, NULL, "__fp", 0);
       }
     }
 
-    ss.str("");
-    ss << "    invoke(" << slot;
+    ss << "    invoke(" << Slot;
     if (params) {
       ss << ", __fp.getData(), " << param_len << ");";
     } else {
       ss << ", NULL, 0);";
     }
+  }
+  write(ss);
+
+  write("}");
+  write("");
+  return;
+}
+
+bool RSReflectionCpp::genPackParamsOnStack(const RSExportRecordType *ERT,
+                                           const char *BufferName) {
+  for (RSExportRecordType::const_field_iterator I = ERT->fields_begin(),
+           E = ERT->fields_end();
+       I != E;
+       I++)
+    if (!IsPlainArrayElement((*I)->getType()))
+      return false;
+
+  std::stringstream ss;
+  ss << "    uint8_t " << BufferName << "["
+     << RSExportType::GetTypeAllocSize(ERT) << "];";
+  write(ss);
+  ss.str("");
+  ss << "    memset(" << BufferName << ", 0, sizeof(" << BufferName << "));";
+  write(ss);
+  for (RSExportRecordType::const_field_iterator I = ERT->fields_begin(),
+           E = ERT->fields_end();
+       I != E;
+       I++) {
+    const RSExportRecordType::Field *F = *I;
+    // Only the store size, a vector of 3 may be smaller in the script.
+    ss.str("");
+    ss << "    memcpy(" << BufferName << " + " << F->getOffsetInParent()
+       << ", &" << F->getName() << ", "
+       << RSExportType::GetTypeStoreSize(F->getType()) << ");";
     write(ss);
+  }
+  return true;
+}
 
-    write("}");
-    write("");
+void RSReflectionCpp::genProfileCounters(bool IsImpl, unsigned NumFunctions) {
+  if (!IsImpl) {
+    write("void getProfileCounters(uint64_t *counters);");
+    write("void resetProfileCounters();");
+    return;
+  }
+
+  write("void " + getQualifier() + "getProfileCounters(uint64_t *counters) {");
+  write("    " RS_PROFILE_COUNTERS_NAME "->copy1DTo(counters);");
+  write("}");
+  write("");
+
+  stringstream tmp;
+  write("void " + getQualifier() + "resetProfileCounters() {");
+  tmp << "    uint64_t zeros[" << 2 * NumFunctions << "] = { 0 };";
+  write(tmp);
+  write("    " RS_PROFILE_COUNTERS_NAME "->copy1DFrom(zeros);");
+  write("}");
+  write("");
+  return;
+}
+
+// Whether the fields of ERT are all laid out in the script as they are in a
+// C++ struct of the same fields (see genRecordLayout()).
+static bool IsPlainRecord(const RSExportRecordType *ERT) {
+  for (RSExportRecordType::const_field_iterator I = ERT->fields_begin(),
+           E = ERT->fields_end();
+       I != E;
+       I++) {
+    const RSExportType *FT = (*I)->getType();
+    if (FT->getClass() == RSExportType::ExportClassConstantArray)
+      FT = static_cast<const RSExportConstantArrayType*>(FT)->getElementType();
+    if (FT->getClass() == RSExportType::ExportClassRecord) {
+      if (!IsPlainRecord(static_cast<const RSExportRecordType*>(FT)))
+        return false;
+    } else if (!IsPlainArrayElement(FT)) {
+      return false;
+    }
+  }
+  return true;
+}
 
-    slot++;
+void RSReflectionCpp::genRecordLayouts() {
+  std::set<std::string> Done;
+  for (RSContext::const_export_type_iterator
+           I = mRSContext->export_types_begin(),
+           E = mRSContext->export_types_end();
+       I != E;
+       I++) {
+    const RSExportType *ET = I->getValue();
+    if ((ET->getClass() == RSExportType::ExportClassRecord) &&
+        !static_cast<const RSExportRecordType*>(ET)->isArtificial())
+      genRecordLayout(static_cast<const RSExportRecordType*>(ET), &Done);
   }
 
+  // The views on a mapped allocation (e.g., of Allocation::getPointer()) of
+  // cells of a struct above, or of any other type
+  write("template <typename T> static T &cell(void *base, size_t index) {");
+  write("    return static_cast<T *>(base)[index];");
+  write("}");
+  write("template <typename T> static T getField(const void *cell, "
+        "size_t offset) {");
+  write("    T v;");
+  write("    memcpy(&v, static_cast<const uint8_t *>(cell) + offset, "
+        "sizeof(v));");
+  write("    return v;");
+  write("}");
+  write("template <typename T> static void setField(void *cell, "
+        "size_t offset, const T &v) {");
+  write("    memcpy(static_cast<uint8_t *>(cell) + offset, &v, sizeof(v));");
+  write("}");
+  write("");
+  return;
+}
+
+void RSReflectionCpp::genRecordLayout(const RSExportRecordType *ERT,
+                                      std::set<std::string> *Done) {
+  if (!Done->insert(ERT->getName()).second)
+    return;
+
+  // The structs of the fields come first.
+  for (RSExportRecordType::const_field_iterator I = ERT->fields_begin(),
+           E = ERT->fields_end();
+       I != E;
+       I++) {
+    const RSExportType *FT = (*I)->getType();
+    if (FT->getClass() == RSExportType::ExportClassConstantArray)
+      FT = static_cast<const RSExportConstantArrayType*>(FT)->getElementType();
+    if (FT->getClass() == RSExportType::ExportClassRecord)
+      genRecordLayout(static_cast<const RSExportRecordType*>(FT), Done);
+  }
+
+  // A struct holding RS objects (or matrices) only gets the offsets of its
+  // fields, C++ doesn't lay them out the same.
+  bool IsPlain = IsPlainRecord(ERT);
+  const std::string &Name = ERT->getName();
+  std::stringstream ss;
+  write("struct " + Name + " {");
+  incIndent();
+  for (RSExportRecordType::const_field_iterator I = ERT->fields_begin(),
+           E = ERT->fields_end();
+       IsPlain && (I != E);
+       I++) {
+    const RSExportType *FT = (*I)->getType();
+    ss.str("");
+    if (FT->getClass() == RSExportType::ExportClassConstantArray) {
+      const RSExportConstantArrayType *ECAT =
+          static_cast<const RSExportConstantArrayType*>(FT);
+      const RSExportType *ElementET = ECAT->getElementType();
+      ss << ((ElementET->getClass() == RSExportType::ExportClassRecord) ?
+             ElementET->getName() : GetTypeName(ElementET))
+         << " " << (*I)->getName() << "[" << ECAT->getSize() << "];";
+    } else if (FT->getClass() == RSExportType::ExportClassRecord) {
+      ss << FT->getName() << " " << (*I)->getName() << ";";
+    } else {
+      ss << GetTypeName(FT) << " " << (*I)->getName() << ";";
+    }
+    write(ss);
+  }
+  ss.str("");
+  ss << "static const size_t alloc_size = "
+     << RSExportType::GetTypeAllocSize(ERT) << ";";
+  write(ss);
+  for (RSExportRecordType::const_field_iterator I = ERT->fields_begin(),
+           E = ERT->fields_end();
+       I != E;
+       I++) {
+    ss.str("");
+    ss << "static const size_t offset_" << (*I)->getName() << " = "
+       << (*I)->getOffsetInParent() << ";";
+    write(ss);
+  }
   decIndent();
-  return true;
+  write("};");
+
+  if (IsPlain) {
+    write("#if __cplusplus >= 201103L");
+    write("static_assert(sizeof(" + Name + ") == " + Name + "::alloc_size, "
+          "\"layout of " + Name + "\");");
+    for (RSExportRecordType::const_field_iterator I = ERT->fields_begin(),
+             E = ERT->fields_end();
+         I != E;
+         I++) {
+      const std::string &FieldName = (*I)->getName();
+      write("static_assert(offsetof(" + Name + ", " + FieldName + ") == " +
+            Name + "::offset_" + FieldName + ", \"layout of " + Name + "." +
+            FieldName + "\");");
+    }
+    write("#endif");
+  }
+  write("");
+  return;
 }
 
 void RSReflectionCpp::genExportVariable(const RSExportVar *EV) {
@@ -622,7 +1018,33 @@ void RSReflectionCpp::genMatrixTypeExportVariable(const RSExportVar *EV) {
 
 void RSReflectionCpp::genConstantArrayTypeExportVariable(
     const RSExportVar *EV) {
-  slangAssert(false);
+  const RSExportConstantArrayType *ECAT =
+      static_cast<const RSExportConstantArrayType*>(EV->getType());
+  const RSExportType *ElementET = ECAT->getElementType();
+  slangAssert(IsPlainArrayElement(ElementET) &&
+              "Unsupported element type of exported array");
+
+  std::string ElementTypeName = GetTypeName(ElementET);
+  std::string VarName = EV->getName();
+  uint32_t slot = getNextExportVarSlot();
+
+  if (!EV->isConst()) {
+    stringstream ss;
+    ss << "void set_" << VarName << "(const " << ElementTypeName << " v["
+       << ECAT->getSize() << "]) {";
+    write(ss);
+    ss.str("");
+    ss << "    setVar(" << slot << ", v, sizeof(" RS_EXPORT_VAR_PREFIX
+       << VarName << "));";
+    write(ss);
+    write(string("    memcpy(" RS_EXPORT_VAR_PREFIX) + VarName + ", v, sizeof("
+          RS_EXPORT_VAR_PREFIX + VarName + "));");
+    write("}");
+  }
+  write("const " + ElementTypeName + " *get_" + VarName + "() const {");
+  write(string("    return " RS_EXPORT_VAR_PREFIX) + VarName + ";");
+  write("}");
+  write("");
 }
 
 void RSReflectionCpp::genRecordTypeExportVariable(const RSExportVar *EV) {
@@ -636,7 +1058,7 @@ void RSReflectionCpp::makeFunctionSignature(
     const RSExportFunc *ef) {
   ss << "void ";
   if (isDefinition) {
-    ss << mClassName << "::";
+    ss << getQualifier();
   }
   ss << "invoke_" << ef->getName() << "(";
 
@@ -693,7 +1115,8 @@ bool RSReflectionCpp::genCreateFieldPacker(const RSExportType *ET,
 
 void RSReflectionCpp::genPackVarOfType(const RSExportType *ET,
                                        const char *VarName,
-                                       const char *FieldPackerName) {
+                                       const char *FieldPackerName,
+                                       int Offset) {
   std::stringstream ss;
   switch (ET->getClass()) {
     case RSExportType::ExportClassPrimitive:
@@ -705,35 +1128,50 @@ void RSReflectionCpp::genPackVarOfType(const RSExportType *ET,
       break;
     }
     case RSExportType::ExportClassConstantArray: {
-      /*const RSExportConstantArrayType *ECAT =
+      const RSExportConstantArrayType *ECAT =
           static_cast<const RSExportConstantArrayType *>(ET);
-
-      // TODO(zonr): more elegant way. Currently, we obtain the unique index
-      //             variable (this method involves recursive call which means
-      //             we may have more than one level loop, therefore we can't
-      //             always use the same index variable name here) name given
-      //             in the for-loop from counting the '.' in @VarName.
-      unsigned Level = 0;
-      size_t LastDotPos = 0;
-      std::string ElementVarName(VarName);
-
-      while (LastDotPos != std::string::npos) {
-        LastDotPos = ElementVarName.find_first_of('.', LastDotPos + 1);
-        Level++;
+      const RSExportType *ElementET = ECAT->getElementType();
+      size_t ElementAllocSize = RSExportType::GetTypeAllocSize(ElementET);
+
+      // The elements are laid out in VarName just as they are in the packer,
+      // so copy them at once if we know where the packer is.
+      bool IsPlainElement =
+          ((ElementET->getClass() == RSExportType::ExportClassPrimitive) &&
+           !static_cast<const RSExportPrimitiveType*>(ElementET)->
+               isRSObjectType()) ||
+          (ElementET->getClass() == RSExportType::ExportClassVector) ||
+          (ElementET->getClass() == RSExportType::ExportClassMatrix);
+      if ((Offset >= 0) && IsPlainElement &&
+          (ElementAllocSize == RSExportType::GetTypeStoreSize(ElementET))) {
+        size_t Size = RSExportType::GetTypeAllocSize(ECAT);
+        ss << "    memcpy((uint8_t *)" << FieldPackerName << ".getData() + "
+           << Offset << ", " << VarName << ", " << Size << ");";
+        write(ss);
+        ss.str("");
+        ss << "    " << FieldPackerName << ".skip(" << Size << ");";
+        write(ss);
+        break;
       }
-      std::string IndexVarName("ct");
-      IndexVarName.append(llvm::utostr_32(Level));
-
-      C.indent() << "for (int " << IndexVarName << " = 0; " <<
-                          IndexVarName << " < " << ECAT->getSize() << "; " <<
-                          IndexVarName << "++)";
-      C.startBlock();
 
+      // Obtain a unique index variable name for the (possibly nested) loop
+      // from the depth of @VarName.
+      std::string ElementVarName(VarName);
+      unsigned Level = std::count(ElementVarName.begin(),
+                                  ElementVarName.end(), '.') +
+                       std::count(ElementVarName.begin(),
+                                  ElementVarName.end(), '[');
+      std::stringstream Index;
+      Index << "ct" << Level;
+      std::string IndexVarName(Index.str());
+
+      ss << "    for (int " << IndexVarName << " = 0; " << IndexVarName
+         << " < " << ECAT->getSize() << "; " << IndexVarName << "++) {";
+      write(ss);
+      incIndent();
       ElementVarName.append("[" + IndexVarName + "]");
-      genPackVarOfType(C, ECAT->getElementType(), ElementVarName.c_str(),
-                       FieldPackerName);
-
-      C.endBlock();*/
+      genPackVarOfType(ElementET, ElementVarName.c_str(), FieldPackerName);
+      decIndent();
+      write("    }");
       break;
     }
     case RSExportType::ExportClassRecord: {
@@ -764,7 +1202,8 @@ void RSReflectionCpp::genPackVarOfType(const RSExportType *ET,
           write(ss);
         }
 
-        genPackVarOfType(F->getType(), FieldName.c_str(), FieldPackerName);
+        genPackVarOfType(F->getType(), FieldName.c_str(), FieldPackerName,
+                         (Offset >= 0) ? (Offset + FieldOffset) : -1);
 
         // There is padding in the field type
         if (FieldAllocSize > FieldStoreSize) {
@@ -794,7 +1233,8 @@ void RSReflectionCpp::genPackVarOfType(const RSExportType *ET,
 
 
 void RSReflectionCpp::genTypeCheck(const RSExportType *ET,
-                                   const char *VarName) {
+                                   const char *VarName,
+                                   const char *ReturnValue) {
   stringstream tmp;
   tmp << "// Type check for " << VarName;
   write(tmp);
@@ -830,13 +1270,88 @@ void RSReflectionCpp::genTypeCheck(const RSExportType *ET,
     incIndent();
     write("mRS->throwError(RS_ERROR_RUNTIME_ERROR, "
           "\"Incompatible type\");");
-    write("return;");
+    if (ReturnValue != NULL)
+      write(std::string("return ") + ReturnValue + ";");
+    else
+      write("return;");
     decIndent();
 
     write("}");
   }
 }
 
+void RSReflectionCpp::collectTypesToCheck() {
+  for (RSContext::const_export_foreach_iterator
+           I = mRSContext->export_foreach_begin(),
+           E = mRSContext->export_foreach_end(); I != E; I++) {
+    const RSExportForEach *EF = *I;
+    const RSExportType *IET = EF->getInType();
+    const RSExportType *OET = EF->getOutType();
+    if (IET) {
+      genTypeInstanceFromPointer(IET);
+    }
+    if (OET) {
+      genTypeInstanceFromPointer(OET);
+    }
+  }
+  for (RSContext::const_export_reduce_iterator
+           I = mRSContext->export_reduce_begin(),
+           E = mRSContext->export_reduce_end(); I != E; I++) {
+    genTypeInstance((*I)->getInType());
+    genTypeInstance((*I)->getResultType());
+  }
+  return;
+}
+
+// The C++ type the (primitive or vector) result of a reduction is returned as
+static std::string GetReduceResultType(const RSExportType *ET) {
+  RSReflectionTypeData rtd;
+  ET->convertToRTD(&rtd);
+  if (ET->getClass() == RSExportType::ExportClassVector) {
+    std::stringstream ss;
+    ss << rtd.type->rs_c_vector_prefix
+       << static_cast<const RSExportVectorType*>(ET)->getNumElement();
+    return ss.str();
+  }
+  return rtd.type->c_name;
+}
+
+void RSReflectionCpp::genExportReduce(const RSExportReduce *ER, bool IsImpl,
+                                      unsigned Slot) {
+  std::string ResultType = GetReduceResultType(ER->getResultType());
+  stringstream ss;
+  ss << ResultType << " ";
+  if (IsImpl)
+    ss << getQualifier();
+  ss << "reduce_" << ER->getName()
+     << "(android::RSC::sp<const android::RSC::Allocation> ain)";
+  if (!IsImpl) {
+    ss << ";";
+    write(ss);
+    return;
+  }
+  ss << " {";
+  write(ss);
+  ss.str("");
+
+  incIndent();
+  write(ResultType + " result;");
+  write("memset(&result, 0, sizeof(result));");
+  genTypeCheck(ER->getInType(), "ain", "result");
+  write("android::RSC::sp<android::RSC::Allocation> aout =");
+  write("    android::RSC::Allocation::createSized(mRS, " RS_ELEM_PREFIX +
+        ER->getResultType()->getElementName() + ", 1);");
+  ss << "reduce(" << Slot << ", ain, aout, NULL);";
+  write(ss);
+  write("aout->copy1DTo(&result);");
+  write("return result;");
+  decIndent();
+
+  write("}");
+  write("");
+  return;
+}
+
 void RSReflectionCpp::genTypeInstanceFromPointer(const RSExportType *ET) {
   if (ET->getClass() == RSExportType::ExportClassPointer) {
     // For pointer parameters to original forEach kernels.
@@ -938,6 +1453,66 @@ void RSReflectionCpp::genInitExportVariable(const RSExportType *ET,
   return;
 }
 
+void RSReflectionCpp::genInitArrayTables() {
+  // Values per line of a table
+  static const unsigned LineSize = 8;
+  for (RSContext::const_export_var_iterator I = mRSContext->export_vars_begin(),
+                                            E = mRSContext->export_vars_end();
+       I != E;
+       I++) {
+    const RSExportVar *EV = *I;
+    if (!HasInitTable(EV))
+      continue;
+
+    const RSExportType *ET =
+        static_cast<const RSExportConstantArrayType*>(EV->getType())->
+            getElementType();
+    bool IsBool = (ET->getClass() == RSExportType::ExportClassPrimitive) &&
+                  (static_cast<const RSExportPrimitiveType*>(ET)->getType() ==
+                   RSExportPrimitiveType::DataTypeBoolean);
+    unsigned NumComponents = 0;
+    if (ET->getClass() == RSExportType::ExportClassVector)
+      NumComponents = static_cast<const RSExportVectorType*>(ET)->
+          getNumElement();
+
+    stringstream ss;
+    ss << "static const " << GetTypeName(ET) << " " RS_INIT_TABLE_PREFIX
+       << EV->getName() << "[" << EV->getNumInits() << "] = {";
+    write(ss);
+    ss.str("");
+    incIndent();
+    for (size_t i = 0, e = EV->getNumInits(); i != e; i++) {
+      const clang::APValue &Val = EV->getInitArray(i);
+      if (NumComponents == 0) {
+        ss << GetTableValue(Val, IsBool);
+      } else {
+        // A vector, possibly with all the components alike
+        ss << "{";
+        for (unsigned j = 0; j < NumComponents; j++) {
+          if (Val.isVector() && (j >= Val.getVectorLength()))
+            break;
+          if (j != 0)
+            ss << ", ";
+          ss << GetTableValue(Val.isVector() ? Val.getVectorElt(j) : Val,
+                              false);
+        }
+        ss << "}";
+      }
+      if (i + 1 != e)
+        ss << ",";
+      if (((i + 1) % LineSize == 0) || (i + 1 == e)) {
+        write(ss);
+        ss.str("");
+      } else {
+        ss << " ";
+      }
+    }
+    decIndent();
+    write("};");
+    write("");
+  }
+}
+
 void RSReflectionCpp::genZeroInitExportVariable(const std::string &VarName) {
   std::stringstream ss;
   ss << "memset(&" RS_EXPORT_VAR_PREFIX << VarName << ", 0, sizeof("
@@ -31,9 +31,13 @@ class RSReflectionCpp : public RSReflectionBase {
   explicit RSReflectionCpp(const RSContext *);
   virtual ~RSReflectionCpp();
 
+  // OutputBC is the content of OutputBCFileName if it's in memory, NULL to
+  // read the file.
   bool reflect(const std::string &OutputPathBase,
                const std::string &InputFileName,
-               const std::string &OutputBCFileName);
+               const std::string &OutputBCFileName,
+               const std::string *OutputBC,
+               bool WriteIfChanged);
 
 
  private:
@@ -41,6 +45,20 @@ class RSReflectionCpp : public RSReflectionBase {
   unsigned int mNextExportFuncSlot;
   unsigned int mNextExportForEachSlot;
 
+  const std::string *mOutputBC;
+
+  // Everything goes inline in the header (see RSContext::hasCppHeaderOnly()).
+  bool mHeaderOnly;
+
+  // The bitcode comes from the ScriptC_<name>.S including the .bc file (see
+  // RSContext::hasCppBitcodeBlob()), rather than from a table of its bytes.
+  bool mBitcodeBlob;
+
+  // What the definitions of the members start with
+  std::string getQualifier() const {
+    return mHeaderOnly ? std::string() : mClassName + "::";
+  }
+
   inline void clear() {
     mNextExportVarSlot = 0;
     mNextExportFuncSlot = 0;
@@ -62,10 +80,41 @@ class RSReflectionCpp : public RSReflectionBase {
 
   bool makeHeader(const std::string &baseClass);
   bool makeImpl(const std::string &baseClass);
+  bool makeBlob();
   void makeFunctionSignature(std::stringstream &ss, bool isDefinition,
                              const RSExportFunc *ef);
   bool writeBC();
 
+  // The name of the symbol of the bitcode in the assembly file (and of its
+  // size, with "_size")
+  std::string getBitcodeSymbol() const { return mClassName + "_bitcode"; }
+
+  // Write out the definitions of the constructor and the destructor.
+  void genConstructor();
+
+  // Write out the declaration (or definition if IsImpl) of the forEach_*() of
+  // the kernel EF (in Slot), and of the invoke_*() of the invokable EF.
+  void genExportForEach(const RSExportForEach *EF, bool IsImpl, unsigned Slot);
+  void genExportFunc(const RSExportFunc *EF, bool IsImpl, unsigned Slot);
+
+  // Write out a local buffer BufferName holding the parameters of the packet
+  // ERT, copied at their offsets. Returns false (writing nothing) if the
+  // parameters aren't all plain values, which a FieldPacker packs instead.
+  bool genPackParamsOnStack(const RSExportRecordType *ERT,
+                            const char *BufferName);
+
+  // Write out the declarations (or definitions if IsImpl) of the accessors
+  // of the counters of the NumFunctions instrumented functions.
+  void genProfileCounters(bool IsImpl, unsigned NumFunctions);
+
+  // Write out a struct for each exported struct type, with its size and the
+  // offsets of its fields as constants, then the templates accessing the
+  // cells of mapped allocations. A struct of plain fields gets them as its
+  // members too, with its layout checked against the one in the script.
+  void genRecordLayouts();
+  void genRecordLayout(const RSExportRecordType *ERT,
+                       std::set<std::string> *Done);
+
   bool startScriptHeader();
 
 
@@ -78,6 +127,9 @@ class RSReflectionCpp : public RSReflectionBase {
                                  const clang::APValue &Val);
   void genInitPrimitiveExportVariable(const std::string &VarName,
                                       const clang::APValue &Val);
+  // Write out the initial values of the exported arrays as static tables,
+  // which the constructor copies at once.
+  void genInitArrayTables();
 
   // Produce an argument string of the form "T1 t, T2 u, T3 v".
   void makeArgs(std::stringstream &ss, const ArgTy& Args);
@@ -96,13 +148,26 @@ class RSReflectionCpp : public RSReflectionBase {
   bool genCreateFieldPacker(const RSExportType *T,
                             const char *FieldPackerName);
 
-  // Populate (write) the FieldPacker with add() operations.
+  // Populate (write) the FieldPacker with add() operations. Offset is the
+  // position of the FieldPacker at this point if it's known (>= 0), in which
+  // case arrays of plain values are copied in at once.
   void genPackVarOfType(const RSExportType *ET,
                         const char *VarName,
-                        const char *FieldPackerName);
+                        const char *FieldPackerName,
+                        int Offset = -1);
+
+  // Generate a runtime type check for VarName. The failing check returns
+  // ReturnValue from a non-void function.
+  void genTypeCheck(const RSExportType *ET, const char *VarName,
+                    const char *ReturnValue = NULL);
+
+  // Collect the elements of the forEach and reduce arguments (mTypesToCheck).
+  void collectTypesToCheck();
 
-  // Generate a runtime type check for VarName.
-  void genTypeCheck(const RSExportType *ET, const char *VarName);
+  // Generate the declaration (or definition if IsImpl) of reduce_*(), which
+  // launches the reduction kernel ER (in Slot) over an allocation and returns
+  // the result.
+  void genExportReduce(const RSExportReduce *ER, bool IsImpl, unsigned Slot);
 
   // Generate a type instance for a given forEach argument type.
   void genTypeInstanceFromPointer(const RSExportType *ET);
@@ -0,0 +1,249 @@
+/*
+ * Copyright 2013, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "slang_rs_reflection_manifest.h"
+
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "clang/AST/APValue.h"
+
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/StringRef.h"
+
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/system_error.h"
+
+#include "slang_rs_context.h"
+#include "slang_rs_export_foreach.h"
+#include "slang_rs_export_func.h"
+#include "slang_rs_export_reduce.h"
+#include "slang_rs_export_type.h"
+#include "slang_rs_export_var.h"
+#include "slang_utils.h"
+
+namespace slang {
+
+static void DescribeValue(std::ostream &OS, const clang::APValue &Val) {
+  OS << Val.getKind();
+  switch (Val.getKind()) {
+    case clang::APValue::Int: {
+      OS << ' ' << Val.getInt().toString(10);
+      break;
+    }
+    case clang::APValue::Float: {
+      OS << ' ' << Val.getFloat().bitcastToAPInt().toString(16, false);
+      break;
+    }
+    case clang::APValue::Vector: {
+      for (unsigned i = 0, e = Val.getVectorLength(); i != e; i++) {
+        OS << ' ';
+        DescribeValue(OS, Val.getVectorElt(i));
+      }
+      break;
+    }
+    default: {
+      // Ignored by the reflection
+      break;
+    }
+  }
+  OS << ';';
+  return;
+}
+
+// The access set of a function is reflected along with it (see
+// -export-access-sets), it comes from the code rather than the declaration.
+static void DescribeAccessSet(std::ostream &OS,
+                              const RSContext::AccessSet *S) {
+  if (S == NULL)
+    return;
+  OS << " access " << S->Complete;
+  for (std::set<std::string>::const_iterator I = S->Reads.begin(),
+           E = S->Reads.end();
+       I != E;
+       I++)
+    OS << " r " << *I;
+  for (std::set<std::string>::const_iterator I = S->Writes.begin(),
+           E = S->Writes.end();
+       I != E;
+       I++)
+    OS << " w " << *I;
+  return;
+}
+
+RSReflectionManifest::RSReflectionManifest(const std::string &Path,
+                                           const RSContext *Context,
+                                           const std::string &Settings)
+    : mPath(Path), mRSContext(Context) {
+  // The version of llvm-rs-cc stands for the reflection itself, as in the
+  // compile cache.
+  std::stringstream S;
+  S << SlangUtils::GetCompilerVersion() << '\n'
+    << Settings << '\n'
+    << Context->getTargetAPI() << ' ' << Context->getVersion() << ' '
+    << Context->isCompatLib() << ' ' << Context->hasVarBatch() << ' '
+    << Context->hasScriptFieldBuffer() << ' '
+    << Context->hasPreallocatedPackers() << ' ' << Context->hasLazyInit()
+    << ' ' << Context->hasInstrumentKernels() << ' '
+    << Context->hasCppHeaderOnly() << ' ' << Context->hasCppBitcodeBlob()
+    << ' ' << Context->hasExportAccessSets() << '\n';
+  if (Context->getLicenseNote() != NULL)
+    S << *Context->getLicenseNote() << '\n';
+  const std::vector<std::string> &ABIs = Context->getPrebuiltABIs();
+  for (unsigned i = 0, e = ABIs.size(); i != e; i++)
+    S << ABIs[i] << '\n';
+  mSettingsHash = SlangUtils::UpdateHash(SlangUtils::InitialHash, S.str());
+
+  llvm::OwningPtr<llvm::MemoryBuffer> MB;
+  if (llvm::MemoryBuffer::getFile(mPath, MB) != llvm::errc::success)
+    return;
+
+  // A malformed line (and whatever follows) is just forgotten.
+  llvm::StringRef Rest = MB->getBuffer();
+  while (!Rest.empty()) {
+    std::pair<llvm::StringRef, llvm::StringRef> Line = Rest.split('\n');
+    Rest = Line.second;
+
+    std::pair<llvm::StringRef, llvm::StringRef> Signature =
+        Line.first.split(' ');
+    std::pair<llvm::StringRef, llvm::StringRef> Content =
+        Signature.second.split(' ');
+    uint64_t SignatureHash, ContentHash;
+    if (Signature.first.getAsInteger(16, SignatureHash) ||
+        Content.first.getAsInteger(16, ContentHash) ||
+        Content.second.empty())
+      return;
+    mOldEntries[Content.second] = std::make_pair(SignatureHash, ContentHash);
+  }
+}
+
+uint64_t RSReflectionManifest::getScriptSignature() const {
+  std::stringstream S;
+
+  for (RSContext::const_export_var_iterator I = mRSContext->export_vars_begin(),
+           E = mRSContext->export_vars_end();
+       I != E;
+       I++) {
+    const RSExportVar *EV = *I;
+    S << "var " << EV->getName() << ' ' << EV->isConst() << ' '
+      << EV->isUnsigned() << ' ';
+    RSExportType::Describe(S, EV->getType());
+    DescribeValue(S, EV->getInit());
+    S << EV->getArraySize();
+    for (unsigned i = 0, e = EV->getNumInits(); i != e; i++) {
+      S << ' ';
+      DescribeValue(S, EV->getInitArray(i));
+    }
+    S << '\n';
+  }
+
+  for (RSContext::const_export_func_iterator
+           I = mRSContext->export_funcs_begin(),
+           E = mRSContext->export_funcs_end();
+       I != E;
+       I++) {
+    const RSExportFunc *EF = *I;
+    S << "func " << EF->getName() << ' ';
+    RSExportType::Describe(S, EF->getParamPacketType());
+    DescribeAccessSet(S, mRSContext->getAccessSet(EF->getName()));
+    S << '\n';
+  }
+
+  for (RSContext::const_export_foreach_iterator
+           I = mRSContext->export_foreach_begin(),
+           E = mRSContext->export_foreach_end();
+       I != E;
+       I++) {
+    const RSExportForEach *EF = *I;
+    S << "foreach " << EF->getName() << ' ' << EF->getSignatureMetadata()
+      << ' ' << EF->isDummyRoot() << ' ' << EF->hasIn() << EF->hasOut()
+      << EF->hasUsrData() << EF->hasReturn() << ' ';
+    RSExportType::Describe(S, EF->getInType());
+    RSExportType::Describe(S, EF->getOutType());
+    RSExportType::Describe(S, EF->getParamPacketType());
+    DescribeAccessSet(S, mRSContext->getAccessSet(EF->getName()));
+    S << '\n';
+  }
+
+  for (RSContext::const_export_reduce_iterator
+           I = mRSContext->export_reduce_begin(),
+           E = mRSContext->export_reduce_end();
+       I != E;
+       I++) {
+    const RSExportReduce *ER = *I;
+    S << "reduce " << ER->getName() << ' ';
+    RSExportType::Describe(S, ER->getInType());
+    RSExportType::Describe(S, ER->getResultType());
+    S << '\n';
+  }
+
+  const RSContext::SpecializedVarList &Vars = mRSContext->getSpecializedVars();
+  for (unsigned i = 0, e = Vars.size(); i != e; i++)
+    S << "specialize " << Vars[i].Name << '=' << Vars[i].Value << '\n';
+
+  return SlangUtils::UpdateHash(mSettingsHash, S.str());
+}
+
+uint64_t RSReflectionManifest::getRecordSignature(
+    const RSExportRecordType *ERT) const {
+  std::stringstream S;
+  S << "record ";
+  RSExportType::Describe(S, ERT);
+  return SlangUtils::UpdateHash(mSettingsHash, S.str());
+}
+
+bool RSReflectionManifest::isUpToDate(const std::string &ClassFile,
+                                      uint64_t Signature) {
+  EntryMapTy::const_iterator I = mOldEntries.find(ClassFile);
+  if ((I == mOldEntries.end()) || (I->second.first != Signature))
+    return false;
+
+  uint64_t ContentHash = SlangUtils::InitialHash;
+  if (!SlangUtils::UpdateHashWithFile(&ContentHash, ClassFile) ||
+      (ContentHash != I->second.second))
+    return false;
+
+  mNewEntries[ClassFile] = I->second;
+  return true;
+}
+
+bool RSReflectionManifest::update(const std::string &ClassFile,
+                                  uint64_t Signature, std::string *Error) {
+  uint64_t ContentHash = SlangUtils::InitialHash;
+  if (!SlangUtils::UpdateHashWithFile(&ContentHash, ClassFile)) {
+    Error->assign("failed to read file '" + ClassFile + "'");
+    return false;
+  }
+  mNewEntries[ClassFile] = std::make_pair(Signature, ContentHash);
+  return true;
+}
+
+bool RSReflectionManifest::write(std::string *Error) const {
+  std::stringstream S;
+  for (EntryMapTy::const_iterator I = mNewEntries.begin(),
+           E = mNewEntries.end();
+       I != E;
+       I++)
+    S << llvm::utohexstr(I->second.first) << ' '
+      << llvm::utohexstr(I->second.second) << ' ' << I->first << '\n';
+
+  return SlangUtils::WriteFileIfChanged(mPath, S.str(), Error);
+}
+
+}  // namespace slang
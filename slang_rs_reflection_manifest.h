@@ -0,0 +1,84 @@
+/*
+ * Copyright 2013, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _FRAMEWORKS_COMPILE_SLANG_SLANG_RS_REFLECTION_MANIFEST_H_  // NOLINT
+#define _FRAMEWORKS_COMPILE_SLANG_SLANG_RS_REFLECTION_MANIFEST_H_
+
+#include <stdint.h>
+
+#include <map>
+#include <string>
+#include <utility>
+
+namespace slang {
+
+class RSContext;
+class RSExportRecordType;
+
+// With -write-if-changed, a class reflected from a script is only generated
+// again if what it's generated from (its signature) changed. E.g., an edit of
+// the body of a kernel leaves the ScriptC_* class and the ScriptField_*
+// classes alone. The signature of each class is recorded in a manifest next
+// to them, laid out as
+//
+//   <signature hash> <content hash> <class file>\n
+//   ...
+//
+// The content hash catches the class files changed behind our back (e.g., by
+// restoring them from the compile cache).
+class RSReflectionManifest {
+ private:
+  std::string mPath;
+  const RSContext *mRSContext;
+  // The hash of everything all the classes depend on
+  uint64_t mSettingsHash;
+
+  // Class file -> (signature hash, content hash)
+  typedef std::map<std::string, std::pair<uint64_t, uint64_t> > EntryMapTy;
+  // As read from mPath
+  EntryMapTy mOldEntries;
+  // As to be written to mPath
+  EntryMapTy mNewEntries;
+
+ public:
+  // Read the manifest at Path, if there's one. Settings stands for whatever
+  // else (than the context) the reflected classes depend on, e.g., the
+  // package names.
+  RSReflectionManifest(const std::string &Path, const RSContext *Context,
+                       const std::string &Settings);
+
+  // The signature of the script class: the exported variables (down to their
+  // initial values), functions and forEach kernels, in slot order.
+  uint64_t getScriptSignature() const;
+
+  // The signature of the class reflected for ERT: its field layout.
+  uint64_t getRecordSignature(const RSExportRecordType *ERT) const;
+
+  // Returns true if ClassFile is still what it was generated as from
+  // Signature, then it's kept in the manifest.
+  bool isUpToDate(const std::string &ClassFile, uint64_t Signature);
+
+  // Record that ClassFile was (just) generated from Signature.
+  bool update(const std::string &ClassFile, uint64_t Signature,
+              std::string *Error);
+
+  // Write the recorded entries to the manifest.
+  bool write(std::string *Error) const;
+};
+
+}  // namespace slang
+
+#endif  // _FRAMEWORKS_COMPILE_SLANG_SLANG_RS_REFLECTION_MANIFEST_H_  NOLINT
@@ -0,0 +1,308 @@
+/*
+ * Copyright 2013, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "slang_rs_server.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include "llvm/Support/raw_ostream.h"
+
+namespace slang {
+
+#if !defined(_WIN32)
+
+namespace {
+
+// A request is laid out as
+//
+//   uint32_t Length;      // of the following payload
+//   char Payload[Length]; // <cwd>\0<arg1>\0<arg2>\0...
+//
+// where the message carrying Length also passes the client's stdout and
+// stderr (SCM_RIGHTS). The reply is a single int32_t exit code.
+static const int NumPassedFDs = 2;
+
+static bool WriteAll(int FD, const char *Buf, size_t Len) {
+  while (Len > 0) {
+    ssize_t N = ::write(FD, Buf, Len);
+    if (N < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    Buf += N;
+    Len -= N;
+  }
+  return true;
+}
+
+static bool ReadAll(int FD, char *Buf, size_t Len) {
+  while (Len > 0) {
+    ssize_t N = ::read(FD, Buf, Len);
+    if (N < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    if (N == 0)
+      return false;
+    Buf += N;
+    Len -= N;
+  }
+  return true;
+}
+
+static bool GetSocketAddress(const std::string &SocketPath,
+                             struct sockaddr_un *Addr) {
+  ::memset(Addr, 0, sizeof(*Addr));
+  Addr->sun_family = AF_UNIX;
+  if (SocketPath.empty() || (SocketPath.size() >= sizeof(Addr->sun_path)))
+    return false;
+  ::strncpy(Addr->sun_path, SocketPath.c_str(), sizeof(Addr->sun_path) - 1);
+  return true;
+}
+
+static bool SendRequest(int Sock, const std::string &Payload) {
+  uint32_t Length = Payload.size();
+
+  struct iovec IOV;
+  IOV.iov_base = &Length;
+  IOV.iov_len = sizeof(Length);
+
+  char Control[CMSG_SPACE(sizeof(int) * NumPassedFDs)];
+  ::memset(Control, 0, sizeof(Control));
+
+  struct msghdr Msg;
+  ::memset(&Msg, 0, sizeof(Msg));
+  Msg.msg_iov = &IOV;
+  Msg.msg_iovlen = 1;
+  Msg.msg_control = Control;
+  Msg.msg_controllen = sizeof(Control);
+
+  struct cmsghdr *CMsg = CMSG_FIRSTHDR(&Msg);
+  CMsg->cmsg_level = SOL_SOCKET;
+  CMsg->cmsg_type = SCM_RIGHTS;
+  CMsg->cmsg_len = CMSG_LEN(sizeof(int) * NumPassedFDs);
+  int FDs[NumPassedFDs] = { STDOUT_FILENO, STDERR_FILENO };
+  ::memcpy(CMSG_DATA(CMsg), FDs, sizeof(FDs));
+
+  if (::sendmsg(Sock, &Msg, 0) != static_cast<ssize_t>(sizeof(Length)))
+    return false;
+
+  return WriteAll(Sock, Payload.data(), Payload.size());
+}
+
+static bool ReceiveRequest(int Sock, std::string *Payload, int *FDs) {
+  uint32_t Length = 0;
+
+  struct iovec IOV;
+  IOV.iov_base = &Length;
+  IOV.iov_len = sizeof(Length);
+
+  char Control[CMSG_SPACE(sizeof(int) * NumPassedFDs)];
+
+  struct msghdr Msg;
+  ::memset(&Msg, 0, sizeof(Msg));
+  Msg.msg_iov = &IOV;
+  Msg.msg_iovlen = 1;
+  Msg.msg_control = Control;
+  Msg.msg_controllen = sizeof(Control);
+
+  if (::recvmsg(Sock, &Msg, MSG_WAITALL) !=
+      static_cast<ssize_t>(sizeof(Length)))
+    return false;
+
+  struct cmsghdr *CMsg = CMSG_FIRSTHDR(&Msg);
+  if ((CMsg == NULL) ||
+      (CMsg->cmsg_level != SOL_SOCKET) ||
+      (CMsg->cmsg_type != SCM_RIGHTS) ||
+      (CMsg->cmsg_len != CMSG_LEN(sizeof(int) * NumPassedFDs)))
+    return false;
+  ::memcpy(FDs, CMSG_DATA(CMsg), sizeof(int) * NumPassedFDs);
+
+  std::vector<char> Buf(Length);
+  if ((Length > 0) && !ReadAll(Sock, &Buf[0], Length))
+    return false;
+  Payload->assign(Buf.begin(), Buf.end());
+  return true;
+}
+
+// Runs in the forked child. Never returns.
+static void HandleRequest(int Sock, RSServer::CompileFunc Compile) {
+  std::string Payload;
+  int FDs[NumPassedFDs];
+
+  if (!ReceiveRequest(Sock, &Payload, FDs))
+    ::_exit(1);
+
+  // Split the payload into the working directory and the argument list
+  std::vector<std::string> Strings;
+  for (size_t Begin = 0, End; Begin < Payload.size(); Begin = End + 1) {
+    End = Payload.find('\0', Begin);
+    if (End == std::string::npos)
+      End = Payload.size();
+    Strings.push_back(Payload.substr(Begin, End - Begin));
+  }
+
+  int32_t ExitCode = 1;
+  if (!Strings.empty() &&
+      (::chdir(Strings[0].c_str()) == 0) &&
+      (::dup2(FDs[0], STDOUT_FILENO) >= 0) &&
+      (::dup2(FDs[1], STDERR_FILENO) >= 0)) {
+    std::vector<const char*> Argv;
+    Argv.push_back("llvm-rs-cc");
+    for (unsigned i = 1, e = Strings.size(); i != e; i++)
+      Argv.push_back(Strings[i].c_str());
+    Argv.push_back(NULL);
+
+    ExitCode = Compile(Argv.size() - 1, &Argv[0]);
+  }
+
+  // Everything written on behalf of the client must be out before it sees
+  // the exit code.
+  llvm::outs().flush();
+  llvm::errs().flush();
+  ::fflush(NULL);
+
+  WriteAll(Sock, reinterpret_cast<const char*>(&ExitCode), sizeof(ExitCode));
+  ::close(Sock);
+
+  ::exit(0);
+}
+
+}  // namespace
+
+int RSServer::Serve(const std::string &SocketPath, CompileFunc Compile) {
+  struct sockaddr_un Addr;
+  if (!GetSocketAddress(SocketPath, &Addr)) {
+    llvm::errs() << "error: invalid server socket path '" << SocketPath
+                 << "'\n";
+    return 1;
+  }
+
+  int Sock = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if (Sock < 0) {
+    llvm::errs() << "error: unable to create server socket: "
+                 << ::strerror(errno) << "\n";
+    return 1;
+  }
+
+  // Take over the socket left behind by a previous server
+  ::unlink(SocketPath.c_str());
+  if ((::bind(Sock, reinterpret_cast<struct sockaddr*>(&Addr),
+              sizeof(Addr)) < 0) ||
+      (::listen(Sock, SOMAXCONN) < 0)) {
+    llvm::errs() << "error: unable to listen on '" << SocketPath << "': "
+                 << ::strerror(errno) << "\n";
+    ::close(Sock);
+    return 1;
+  }
+
+  // Let the kernel reap the request handlers.
+  ::signal(SIGCHLD, SIG_IGN);
+
+  while (true) {
+    int Conn = ::accept(Sock, NULL, NULL);
+    if (Conn < 0) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+
+    pid_t Pid = ::fork();
+    if (Pid == 0) {
+      ::close(Sock);
+      HandleRequest(Conn, Compile);
+    }
+    if (Pid < 0) {
+      llvm::errs() << "error: unable to serve request: " << ::strerror(errno)
+                   << "\n";
+    }
+    ::close(Conn);
+  }
+
+  ::close(Sock);
+  return 1;
+}
+
+bool RSServer::Connect(const std::string &SocketPath, int Argc,
+                       const char **Argv, int *ExitCode) {
+  struct sockaddr_un Addr;
+  if (!GetSocketAddress(SocketPath, &Addr))
+    return false;
+
+  int Sock = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if (Sock < 0)
+    return false;
+
+  if (::connect(Sock, reinterpret_cast<struct sockaddr*>(&Addr),
+                sizeof(Addr)) < 0) {
+    ::close(Sock);
+    return false;
+  }
+
+  std::vector<char> CWD(4096);
+  if (::getcwd(&CWD[0], CWD.size()) == NULL) {
+    ::close(Sock);
+    return false;
+  }
+
+  std::string Payload(&CWD[0]);
+  for (int i = 1; i < Argc; i++) {
+    Payload.append(1, '\0');
+    Payload.append(Argv[i]);
+  }
+
+  int32_t Result;
+  bool Success = SendRequest(Sock, Payload) &&
+                 ReadAll(Sock, reinterpret_cast<char*>(&Result),
+                         sizeof(Result));
+  ::close(Sock);
+
+  if (Success)
+    *ExitCode = Result;
+  return Success;
+}
+
+#else  // defined(_WIN32)
+
+int RSServer::Serve(const std::string &SocketPath, CompileFunc Compile) {
+  llvm::errs() << "error: server mode is not supported on this host\n";
+  return 1;
+}
+
+bool RSServer::Connect(const std::string &SocketPath, int Argc,
+                       const char **Argv, int *ExitCode) {
+  return false;
+}
+
+#endif  // !defined(_WIN32)
+
+}  // namespace slang
@@ -0,0 +1,57 @@
+/*
+ * Copyright 2013, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _FRAMEWORKS_COMPILE_SLANG_SLANG_RS_SERVER_H_  // NOLINT
+#define _FRAMEWORKS_COMPILE_SLANG_SLANG_RS_SERVER_H_
+
+#include <string>
+
+namespace slang {
+
+// Compiler server for llvm-rs-cc. A long-running server process does the
+// process-wide initialization (loading LLVM/clang, registering the targets,
+// etc.) once. Each request is then served by a fork() of the initialized
+// process, so requests can never observe state (e.g. cached file contents)
+// left behind by an earlier one.
+//
+// A request carries the working directory and the command line of the client
+// together with its stdout/stderr, which the server writes the diagnostics
+// (and all the other output) to directly. The exit code of the compilation is
+// sent back at the end.
+class RSServer {
+ public:
+  // Does the work of a single llvm-rs-cc invocation and returns its exit code.
+  typedef int (*CompileFunc)(int Argc, const char **Argv);
+
+ private:
+  RSServer() {}
+
+ public:
+  // Listen on the Unix domain socket at SocketPath and serve the requests by
+  // calling Compile. Only returns (with the exit code of llvm-rs-cc) if the
+  // socket could not be set up.
+  static int Serve(const std::string &SocketPath, CompileFunc Compile);
+
+  // Forward a command line (Argv[0] is ignored) to the server listening at
+  // SocketPath. Returns false if there's no server to talk to, otherwise sets
+  // ExitCode to the result of the compilation.
+  static bool Connect(const std::string &SocketPath, int Argc,
+                      const char **Argv, int *ExitCode);
+};
+
+}  // namespace slang
+
+#endif  // _FRAMEWORKS_COMPILE_SLANG_SLANG_RS_SERVER_H_  NOLINT
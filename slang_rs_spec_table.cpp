@@ -14,10 +14,14 @@
  * limitations under the License.
  */
 
+#include <stdint.h>
+
 #include <cstdio>
 #include <cstring>
 
+#include <algorithm>
 #include <string>
+#include <vector>
 
 #include "slang_rs_type_spec.h"
 
@@ -289,6 +293,77 @@ int GenRSDataElementEnums(const RSDataElementSpec *const DataElements[],
   return 0;
 }
 
+// -gen-rs-specific-type-hash
+//
+// RS_SPECIFIC_TYPE_HASH(seed, bits)
+// RS_SPECIFIC_TYPE_HASH_SLOT(type, cname) or RS_SPECIFIC_TYPE_HASH_EMPTY_SLOT()
+//   for each of the (1 << bits) slots
+// e.g., RS_SPECIFIC_TYPE_HASH_SLOT(RSMatrix2x2, "rs_matrix2x2")
+//
+// The slot of an RS matrix or object type is the RSSpecificTypeNameHash() of
+// its name.
+static int GenRSSpecificTypeHash(const RSDataTypeSpec *const DataTypes[],
+                                 unsigned NumDataTypes) {
+  std::vector<const RSDataTypeSpec*> Types;
+  for (unsigned i = 0; i < NumDataTypes; i++)
+    if (DataTypes[i]->isRSMatrix() || DataTypes[i]->isRSObject()) {
+      const char *Name = DataTypes[i]->getTypePragmaName();
+      if ((::strlen(Name) < RS_SPECIFIC_TYPE_NAME_MIN_LENGTH) ||
+          (::strncmp(Name, "rs_", 3) != 0)) {
+        fprintf(stderr, "rs-spec-gen: Can't hash the type name '%s'\n", Name);
+        return 1;
+      }
+      Types.push_back(DataTypes[i]);
+    }
+
+  unsigned Bits = 1;
+  while ((1U << Bits) < Types.size())
+    Bits++;
+
+  // Look for a multiplier spreading the names over the smallest table (of
+  // up to 4 times their number of slots). The candidates come from a linear
+  // congruential generator, since small multipliers leave the top bits of
+  // the product alike for all the names.
+  for (unsigned MaxBits = Bits + 2; Bits <= MaxBits; Bits++) {
+    std::vector<int> Slots(1U << Bits);
+    uint32_t State = 1;
+    for (unsigned Tries = 0; Tries < (1U << 20); Tries++) {
+      State = State * 1664525U + 1013904223U;
+      unsigned Seed = State | 1;
+      std::fill(Slots.begin(), Slots.end(), -1);
+
+      unsigned i;
+      for (i = 0; i < Types.size(); i++) {
+        const char *Name = Types[i]->getTypePragmaName();
+        unsigned Slot =
+            RSSpecificTypeNameHash(Name, ::strlen(Name), Seed, Bits);
+        if (Slots[Slot] >= 0)
+          break;
+        Slots[Slot] = i;
+      }
+      if (i < Types.size())
+        continue;
+
+      printf("RS_SPECIFIC_TYPE_HASH(%uU, %u)\n", Seed, Bits);
+      for (i = 0; i < Slots.size(); i++) {
+        if (Slots[i] < 0)
+          printf("RS_SPECIFIC_TYPE_HASH_EMPTY_SLOT()\n");
+        else
+          printf("RS_SPECIFIC_TYPE_HASH_SLOT(%s, \"%s\")\n",
+                 Types[Slots[i]]->getTypeName(),
+                 Types[Slots[i]]->getTypePragmaName());
+      }
+      printf("#undef RS_SPECIFIC_TYPE_HASH\n");
+      printf("#undef RS_SPECIFIC_TYPE_HASH_SLOT\n");
+      printf("#undef RS_SPECIFIC_TYPE_HASH_EMPTY_SLOT\n");
+      return 0;
+    }
+  }
+
+  fprintf(stderr, "rs-spec-gen: No perfect hash of the RS type names found\n");
+  return 1;
+}
+
 int main(int argc, char **argv) {
   if (argc < 2) {
     fprintf(stderr, "usage: %s [gen type]\n", argv[0]);
@@ -394,6 +469,8 @@ int main(int argc, char **argv) {
     Result = GenRSObjectTypeEnums(DataTypes, NumDataTypes);
   else if (::strcmp(argv[1], "-gen-rs-data-element-enums") == 0)
     Result = GenRSDataElementEnums(DataElements, NumDataElements);
+  else if (::strcmp(argv[1], "-gen-rs-specific-type-hash") == 0)
+    Result = GenRSSpecificTypeHash(DataTypes, NumDataTypes);
   else
     fprintf(stderr, "%s: Unknown table generation type '%s'\n",
                     argv[0], argv[1]);
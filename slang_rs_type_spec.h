@@ -99,6 +99,23 @@ enum RSDataType {
   RS_DT_USER_DEFINED
 };
 
+// The names of the RS matrix and object types are looked up in a table
+// indexed by this hash (see -gen-rs-specific-type-hash of rs-spec-gen, which
+// picks Seed and Bits such that the table has no collision). It only looks at
+// the length and two characters of a name, all of them being "rs_" followed
+// by at least one character.
+#define RS_SPECIFIC_TYPE_NAME_MIN_LENGTH 4
+
+static inline unsigned RSSpecificTypeNameHash(const char *Name,
+                                              unsigned Length,
+                                              unsigned Seed,
+                                              unsigned Bits) {
+  unsigned Key = (Length << 16) |
+                 (static_cast<unsigned char>(Name[3]) << 8) |
+                 static_cast<unsigned char>(Name[Length - 1]);
+  return (Key * Seed) >> (32 - Bits);
+}
+
 // Forward declaration
 union RSType;
 
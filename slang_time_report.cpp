@@ -0,0 +1,149 @@
+/*
+ * Copyright 2013, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "slang_time_report.h"
+
+#include <string>
+
+#include "llvm/Support/Format.h"
+#include "llvm/Support/raw_ostream.h"
+
+namespace slang {
+
+namespace {
+
+struct PhaseInfo {
+  // Key in the JSON output
+  const char *Id;
+  // Name in the table
+  const char *Name;
+};
+
+static const PhaseInfo Phases[TimeReport::PT_Count] = {
+  { "parse", "Preprocessing and parsing" },
+  { "rs-ast", "RS AST processing (incl. reference counting)" },
+  { "irgen", "IR generation" },
+  { "function-passes", "Per-function passes" },
+  { "module-passes", "Per-module passes" },
+  { "codegen", "Code generation" },
+  { "bitcode-writer", "Bitcode writer" },
+  { "reflection", "Reflection" },
+  { "bitcode-accessor", "Bitcode accessor generation" },
+  { "dep-file", "Dependency file generation" },
+};
+
+static void PrintTime(llvm::raw_ostream &OS, double Time, double Total) {
+  OS << llvm::format("%9.4f (%5.1f%%)", Time,
+                     (Total != 0) ? (Time * 100 / Total) : 0.0);
+  return;
+}
+
+}  // namespace
+
+TimeReport::Region::Region(TimeReport *Report, Phase P)
+    : mReport(Report), mOuter(PT_Count) {
+  if (mReport != NULL)
+    mOuter = mReport->enter(P);
+  return;
+}
+
+TimeReport::Region::~Region() {
+  if (mReport != NULL)
+    mReport->leave(mOuter);
+  return;
+}
+
+TimeReport::TimeReport() : mCurrent(PT_Count) {
+  return;
+}
+
+TimeReport::Phase TimeReport::enter(Phase P) {
+  llvm::TimeRecord Now = llvm::TimeRecord::getCurrentTime(true);
+  if (mCurrent != PT_Count) {
+    llvm::TimeRecord Elapsed = Now;
+    Elapsed -= mCurrentStart;
+    mTimes[mCurrent] += Elapsed;
+  }
+
+  Phase Outer = mCurrent;
+  mCurrent = P;
+  mCurrentStart = Now;
+  return Outer;
+}
+
+void TimeReport::leave(Phase Outer) {
+  llvm::TimeRecord Now = llvm::TimeRecord::getCurrentTime(false);
+  llvm::TimeRecord Elapsed = Now;
+  Elapsed -= mCurrentStart;
+  mTimes[mCurrent] += Elapsed;
+
+  mCurrent = Outer;
+  mCurrentStart = Now;
+  return;
+}
+
+void TimeReport::merge(const TimeReport &Other) {
+  for (unsigned i = 0; i != PT_Count; i++)
+    mTimes[i] += Other.mTimes[i];
+  return;
+}
+
+void TimeReport::print(llvm::raw_ostream &OS) const {
+  llvm::TimeRecord Total;
+  for (unsigned i = 0; i != PT_Count; i++)
+    Total += mTimes[i];
+
+  OS << "===" << std::string(73, '-') << "===\n"
+     << std::string(27, ' ') << "llvm-rs-cc Time Report\n"
+     << "===" << std::string(73, '-') << "===\n"
+     << llvm::format("  Total Execution Time: %.4f seconds (%.4f wall clock)\n",
+                     Total.getProcessTime(), Total.getWallTime())
+     << "\n   ---User+System---   ---Wall Time---  --- Phase ---\n";
+
+  for (unsigned i = 0; i != PT_Count; i++) {
+    OS << "  ";
+    PrintTime(OS, mTimes[i].getProcessTime(), Total.getProcessTime());
+    OS << "  ";
+    PrintTime(OS, mTimes[i].getWallTime(), Total.getWallTime());
+    OS << "  " << Phases[i].Name << '\n';
+  }
+
+  OS << "  ";
+  PrintTime(OS, Total.getProcessTime(), Total.getProcessTime());
+  OS << "  ";
+  PrintTime(OS, Total.getWallTime(), Total.getWallTime());
+  OS << "  Total\n\n";
+
+  OS.flush();
+  return;
+}
+
+void TimeReport::printJSON(llvm::raw_ostream &OS) const {
+  OS << "{\n";
+  for (unsigned i = 0; i != PT_Count; i++) {
+    const llvm::TimeRecord &T = mTimes[i];
+    OS << "  \"" << Phases[i].Id << "\": "
+       << llvm::format("{ \"wall\": %.6f, \"user\": %.6f, \"system\": %.6f }",
+                       T.getWallTime(), T.getUserTime(), T.getSystemTime())
+       << ((i + 1 != PT_Count) ? ",\n" : "\n");
+  }
+  OS << "}\n";
+
+  OS.flush();
+  return;
+}
+
+}  // namespace slang
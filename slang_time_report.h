@@ -0,0 +1,88 @@
+/*
+ * Copyright 2013, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _FRAMEWORKS_COMPILE_SLANG_SLANG_TIME_REPORT_H_  // NOLINT
+#define _FRAMEWORKS_COMPILE_SLANG_SLANG_TIME_REPORT_H_
+
+#include "llvm/Support/Timer.h"
+
+namespace llvm {
+  class raw_ostream;
+}
+
+namespace slang {
+
+// The time spent in each phase of the compilation (-time-report). The phases
+// nest (e.g., IR generation happens while parsing), and the time of a phase
+// never includes the time of the phases nested in it.
+//
+// Note that the CPU time is the one of the whole process, so it's only
+// meaningful if the input files are not compiled in parallel.
+class TimeReport {
+ public:
+  enum Phase {
+    PT_Parse,
+    PT_RSAST,
+    PT_IRGen,
+    PT_FunctionPasses,
+    PT_ModulePasses,
+    PT_CodeGen,
+    PT_BitcodeWriter,
+    PT_Reflection,
+    PT_BitcodeAccessor,
+    PT_DepFile,
+
+    PT_Count
+  };
+
+  // Charge the time until the end of the scope to a phase.
+  class Region {
+   private:
+    TimeReport *mReport;
+    Phase mOuter;
+
+   public:
+    // Does nothing if Report is NULL.
+    Region(TimeReport *Report, Phase P);
+    ~Region();
+  };
+
+ private:
+  llvm::TimeRecord mTimes[PT_Count];
+
+  // The innermost phase (PT_Count if there's none) and when it was (re)entered
+  Phase mCurrent;
+  llvm::TimeRecord mCurrentStart;
+
+  Phase enter(Phase P);
+  void leave(Phase Outer);
+
+ public:
+  TimeReport();
+
+  // Add the times of Other (e.g., of a worker thread).
+  void merge(const TimeReport &Other);
+
+  // Print a table of the phases.
+  void print(llvm::raw_ostream &OS) const;
+
+  // Write the times as a JSON object.
+  void printJSON(llvm::raw_ostream &OS) const;
+};
+
+}  // namespace slang
+
+#endif  // _FRAMEWORKS_COMPILE_SLANG_SLANG_TIME_REPORT_H_  NOLINT
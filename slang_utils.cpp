@@ -16,12 +16,21 @@
 
 #include "slang_utils.h"
 
+#include <sstream>
 #include <string>
 
+#include "clang/Basic/Version.h"
+
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/ADT/SmallString.h"
 #include "llvm/ADT/StringRef.h"
 #include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
 #include "llvm/Support/system_error.h"
 
+#include "slang_version.h"
+
 namespace slang {
 
 bool SlangUtils::CreateDirectoryWithParents(llvm::StringRef Dir,
@@ -34,4 +43,132 @@ bool SlangUtils::CreateDirectoryWithParents(llvm::StringRef Dir,
   return true;
 }
 
+bool SlangUtils::WriteFileAtomically(llvm::StringRef File,
+                                     llvm::StringRef Data,
+                                     std::string *Error) {
+  int FD;
+  llvm::SmallString<128> TmpFile;
+  llvm::error_code EC =
+      llvm::sys::fs::unique_file(File + "-%%%%%%%%", FD, TmpFile,
+                                 /* makeAbsolute = */false);
+  if (EC != llvm::errc::success) {
+    Error->assign(EC.message());
+    return false;
+  }
+
+  {
+    llvm::raw_fd_ostream OS(FD, /* shouldClose = */true);
+    OS << Data;
+    OS.close();
+    if (OS.has_error()) {
+      OS.clear_error();
+      Error->assign("failed to write " + TmpFile.str().str());
+      bool Existed;
+      llvm::sys::fs::remove(TmpFile.str(), Existed);
+      return false;
+    }
+  }
+
+  EC = llvm::sys::fs::rename(TmpFile.str(), File);
+  if (EC != llvm::errc::success) {
+    Error->assign(EC.message());
+    bool Existed;
+    llvm::sys::fs::remove(TmpFile.str(), Existed);
+    return false;
+  }
+  return true;
+}
+
+bool SlangUtils::CreatePendingFile(llvm::StringRef File,
+                                   std::string *PendingFile,
+                                   std::string *Error) {
+  int FD;
+  llvm::SmallString<128> TmpFile;
+  llvm::error_code EC =
+      llvm::sys::fs::unique_file(File + "-%%%%%%%%.tmp", FD, TmpFile,
+                                 /* makeAbsolute = */false);
+  if (EC != llvm::errc::success) {
+    Error->assign(EC.message());
+    return false;
+  }
+  // The caller reopens the file by its name.
+  llvm::raw_fd_ostream OS(FD, /* shouldClose = */true);
+  PendingFile->assign(TmpFile.str());
+  return true;
+}
+
+// Returns true if File exists and has the content Data.
+static bool HasContent(llvm::StringRef File, llvm::StringRef Data) {
+  uint64_t Size;
+  if ((llvm::sys::fs::file_size(File, Size) != llvm::errc::success) ||
+      (Size != Data.size()))
+    return false;
+
+  llvm::OwningPtr<llvm::MemoryBuffer> MB;
+  if (llvm::MemoryBuffer::getFile(File, MB) != llvm::errc::success)
+    return false;
+  // Compares the sizes, then the bytes with memcmp().
+  return (MB->getBuffer() == Data);
+}
+
+// Returns true if both files exist and have the same content.
+static bool IsSameFile(llvm::StringRef File1, llvm::StringRef File2) {
+  llvm::OwningPtr<llvm::MemoryBuffer> MB;
+  if (llvm::MemoryBuffer::getFile(File1, MB) != llvm::errc::success)
+    return false;
+  return HasContent(File2, MB->getBuffer());
+}
+
+bool SlangUtils::ReplaceFileIfChanged(llvm::StringRef PendingFile,
+                                      llvm::StringRef File,
+                                      std::string *Error) {
+  bool Existed;
+  if (IsSameFile(PendingFile, File)) {
+    llvm::sys::fs::remove(PendingFile, Existed);
+    return true;
+  }
+
+  llvm::error_code EC = llvm::sys::fs::rename(PendingFile, File);
+  if (EC != llvm::errc::success) {
+    Error->assign(EC.message());
+    llvm::sys::fs::remove(PendingFile, Existed);
+    return false;
+  }
+  return true;
+}
+
+bool SlangUtils::WriteFileIfChanged(llvm::StringRef File,
+                                    llvm::StringRef Data,
+                                    std::string *Error) {
+  if (HasContent(File, Data))
+    return true;
+  return WriteFileAtomically(File, Data, Error);
+}
+
+uint64_t SlangUtils::UpdateHash(uint64_t Hash, llvm::StringRef Data) {
+  for (llvm::StringRef::iterator I = Data.begin(), E = Data.end();
+       I != E;
+       I++) {
+    Hash ^= static_cast<unsigned char>(*I);
+    Hash *= 1099511628211ULL;
+  }
+  return Hash;
+}
+
+bool SlangUtils::UpdateHashWithFile(uint64_t *Hash, llvm::StringRef File) {
+  llvm::OwningPtr<llvm::MemoryBuffer> MB;
+  if (llvm::MemoryBuffer::getFile(File, MB) != llvm::errc::success)
+    return false;
+  *Hash = UpdateHash(*Hash, MB->getBuffer());
+  return true;
+}
+
+std::string SlangUtils::GetCompilerVersion() {
+  std::stringstream Version;
+  Version << "slang " << SlangVersion::CURRENT << " (API "
+          << SLANG_MINIMUM_TARGET_API << " - " << SLANG_MAXIMUM_TARGET_API
+          << "), " << clang::getClangFullRepositoryVersion();
+  return Version.str();
+}
+
 }  // namespace slang
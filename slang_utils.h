@@ -17,7 +17,11 @@
 #ifndef _COMPILE_SLANG_SLANG_UTILS_H_  // NOLINT
 #define _COMPILE_SLANG_SLANG_UTILS_H_
 
+#include <stdint.h>
+
 #include <string>
+#include <utility>
+#include <vector>
 
 namespace llvm {
   class StringRef;
@@ -25,6 +29,9 @@ namespace llvm {
 
 namespace slang {
 
+// Generated files kept in memory, as pairs of <path, content>
+typedef std::vector<std::pair<std::string, std::string> > FileContentList;
+
 class SlangUtils {
  private:
   SlangUtils() {}
@@ -32,6 +39,42 @@ class SlangUtils {
  public:
   static bool CreateDirectoryWithParents(llvm::StringRef Dir,
                                          std::string* Error);
+
+  // Write Data to File through a temporary file which is then renamed, so that
+  // concurrent readers never see a partially written File.
+  static bool WriteFileAtomically(llvm::StringRef File, llvm::StringRef Data,
+                                  std::string *Error);
+
+  // Create a uniquely named, empty file next to File into which to write a
+  // generated file, to be moved over File with ReplaceFileIfChanged(). Its
+  // name is returned in *PendingFile.
+  static bool CreatePendingFile(llvm::StringRef File, std::string *PendingFile,
+                                std::string *Error);
+
+  // Move PendingFile over File, unless File already has the same content. In
+  // that case PendingFile is removed and File (including its modification
+  // time) is left alone, such that the build steps consuming it don't rerun.
+  static bool ReplaceFileIfChanged(llvm::StringRef PendingFile,
+                                   llvm::StringRef File,
+                                   std::string *Error);
+
+  // Like WriteFileAtomically(), but leave File alone if it already has the
+  // content Data.
+  static bool WriteFileIfChanged(llvm::StringRef File, llvm::StringRef Data,
+                                 std::string *Error);
+
+  // 64-bit FNV-1a hashing. Unlike llvm::hash_value() the result is the same
+  // across runs and hosts, so it's suitable for naming files in a cache.
+  static const uint64_t InitialHash = 14695981039346656037ULL;
+  static uint64_t UpdateHash(uint64_t Hash, llvm::StringRef Data);
+  // Hash the content of File into *Hash. Returns false if File can't be read.
+  static bool UpdateHashWithFile(uint64_t *Hash, llvm::StringRef File);
+
+  // The versions of slang, of the RS API and of clang/LLVM it's built from,
+  // which stand for the compiler in the keys of the caches and the signatures
+  // of the generated files. Unlike the build time, they're the same across
+  // rebuilds of the same sources.
+  static std::string GetCompilerVersion();
 };
 }  // namespace slang
 
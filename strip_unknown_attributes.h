@@ -23,7 +23,7 @@ namespace slang {
 // Jellybean's LLVM version didn't support readnone/readonly as anything
 // other than function attributes, so it will fail verification otherwise.
 // Since we never ran the verifier in Jellybean, it ends up with potential
-// crashes deeper in CodeGen.
+// crashes deeper in CodeGen. Only run for targets before KitKat.
 class StripUnknownAttributes : public llvm::ModulePass {
 public:
   static char ID;
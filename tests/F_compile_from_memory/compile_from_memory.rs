@@ -0,0 +1,7 @@
+// -compile-from-memory
+#pragma version(1)
+#pragma rs java_package_name(foo)
+
+int foo() {
+    return 0;
+}
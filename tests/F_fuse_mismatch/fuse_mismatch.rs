@@ -0,0 +1,9 @@
+#pragma version(1)
+#pragma rs java_package_name(foo)
+
+#pragma rs fuse(toFloat, toFloat)
+#pragma rs fuse(toFloat, missing)
+
+float4 __attribute__((kernel)) toFloat(uchar4 in) {
+  return convert_float4(in);
+}
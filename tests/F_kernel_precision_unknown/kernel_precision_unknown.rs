@@ -0,0 +1,9 @@
+// -target-api 18
+#pragma version(1)
+#pragma rs java_package_name(foo)
+
+#pragma rs fp_imprecise(blur)
+
+float __attribute__((kernel)) smooth(float in) {
+  return in * 0.5f;
+}
@@ -0,0 +1,8 @@
+#pragma version(1)
+#pragma rs java_package_name(foo)
+
+#pragma rs reduce(count) accumulator(countAccum)
+
+void countAccum(int *accum, uchar val) {
+  *accum += (val != 0);
+}
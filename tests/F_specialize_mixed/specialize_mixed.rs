@@ -0,0 +1,12 @@
+// -target-api 18
+#pragma version(1)
+#pragma rs java_package_name(foo)
+
+int radius;
+float big;
+
+#pragma rs specialize(radius = 2.5, big = 1e39)
+
+float __attribute__((kernel)) blur(float in) {
+  return in * (float) radius * big;
+}
@@ -0,0 +1,10 @@
+// -reflect-var-batch
+#pragma version(1)
+#pragma rs java_package_name(foo)
+
+struct frame {
+    rs_allocation src;
+    float *dst;
+} frame;
+
+float gain;
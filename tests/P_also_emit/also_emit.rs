@@ -0,0 +1,9 @@
+// -also-emit llvm -also-emit asm
+#pragma version(1)
+#pragma rs java_package_name(foo)
+
+int count;
+
+void root(const int *in, int *out) {
+  *out = *in + count;
+}
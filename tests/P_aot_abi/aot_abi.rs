@@ -0,0 +1,14 @@
+// -aot-abi armeabi-v7a -aot-abi x86
+#pragma version(1)
+#pragma rs java_package_name(foo)
+
+float scale;
+int count;
+
+void root(const float *in, float *out) {
+  *out = *in * scale;
+}
+
+void bump() {
+  count++;
+}
@@ -0,0 +1,23 @@
+#pragma version(1)
+#pragma rs java_package_name(foo)
+
+// Enough initial values to be packed into a string constant
+float gamma[32] = {
+  0.0f, 0.03f, 0.06f, 0.09f, 0.12f, 0.15f, 0.18f, 0.21f,
+  0.24f, 0.27f, 0.30f, 0.33f, 0.36f, 0.39f, 0.42f, 0.45f,
+  0.48f, 0.51f, 0.54f, 0.57f, 0.60f, 0.63f, 0.66f, 0.69f,
+};
+const uchar lut[20] = {
+  0, 10, 20, 34, 92, 13, 255, 128, 127, 1,
+  2, 3, 4, 5, 6, 7, 8, 9, 200, 250
+};
+uchar4 palette[8] = {
+  {0, 0, 0, 255}, {255, 0, 0, 255}, {0, 255, 0, 255}, {0, 0, 255, 255},
+  {255, 255, 0, 255},
+};
+long deltas[16] = {-1, 2, -3, 4, -5, 6, -7, 8, -9, 10, -11, 12, -13, 14, -15};
+bool mask[16] = {true, false, true, true, true, false, true, true,
+                 true, false, true, true, true, false, true, true};
+
+// Few enough to be set a value at a time
+int small[4] = {1, 2, 3, 4};
@@ -0,0 +1,11 @@
+// -reflect-c++
+#pragma version(1)
+#pragma rs java_package_name(foo)
+
+float gamma[32] = {
+  0.0f, 0.03f, 0.06f, 0.09f, 0.12f, 0.15f, 0.18f, 0.21f,
+  0.24f, 0.27f, 0.30f, 0.33f, 0.36f, 0.39f, 0.42f, 0.45f,
+};
+uint32_t masks[4] = {0xffffffff, 0xff00ff00, 0x00ff00ff};
+int2 offsets[3] = {{-1, 0}, {0, -1}, {1, 1}};
+const short weights[5] = {1, 4, 6, 4, 1};
@@ -0,0 +1,9 @@
+// -batch-manifest tmp/batch.manifest
+#pragma version(1)
+#pragma rs java_package_name(foo)
+
+int gScale;
+
+int RS_KERNEL scale(int in) {
+    return in * gScale;
+}
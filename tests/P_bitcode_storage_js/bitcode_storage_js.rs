@@ -0,0 +1,11 @@
+// -bitcode-storage js
+#pragma version(1)
+#pragma rs java_package_name(foo)
+
+// The bitcode is embedded in bitcode_storage_jsBitCode.java as string
+// constants, decoded in one pass into a single array.
+float gain;
+
+float RS_KERNEL scale(float in) {
+    return in * gain;
+}
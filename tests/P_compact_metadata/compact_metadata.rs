@@ -0,0 +1,27 @@
+// -target-api 18 -metadata-format compact
+#pragma version(1)
+#pragma rs java_package_name(foo)
+
+typedef struct Point {
+  float x;
+  float y;
+} Point_t;
+
+Point_t origin;
+rs_allocation points;
+int count;
+
+#pragma rs export_type(Point_t)
+
+void reset() {
+  count = 0;
+}
+
+void add(int n) {
+  count += n;
+}
+
+float __attribute__((kernel)) dist(Point_t in) {
+  return sqrt((in.x - origin.x) * (in.x - origin.x) +
+              (in.y - origin.y) * (in.y - origin.y));
+}
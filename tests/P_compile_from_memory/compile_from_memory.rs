@@ -0,0 +1,16 @@
+// -compile-from-memory
+#pragma version(1)
+#pragma rs java_package_name(foo)
+
+// Compiled by SlangRS::compileBuffer(), the bitcode, the dependency rule and
+// both reflected classes come back in memory.
+typedef struct Point {
+    float x;
+    float y;
+} Point_t;
+
+Point_t gOrigin;
+
+float2 RS_KERNEL translate(float2 in) {
+    return in + (float2){gOrigin.x, gOrigin.y};
+}
@@ -0,0 +1,13 @@
+// -reflect-c++ -reflect-c++-bitcode-blob
+#pragma version(1)
+#pragma rs java_package_name(foo)
+
+float gScale = 2.0f;
+
+void setScale(float scale) {
+    gScale = scale;
+}
+
+float RS_KERNEL scale(float in) {
+    return in * gScale;
+}
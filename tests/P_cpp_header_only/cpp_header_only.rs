@@ -0,0 +1,20 @@
+// -reflect-c++ -reflect-c++-header-only
+#pragma version(1)
+#pragma rs java_package_name(foo)
+
+typedef struct Particle {
+    float3 position;
+    float mass;
+    int2 cell;
+} Particle_t;
+
+Particle_t *gParticles;
+float gDamping = 0.5f;
+
+void setup(float damping, int2 origin, uchar4 color) {
+    gDamping = damping;
+}
+
+float RS_KERNEL damp(float in, uint32_t x) {
+    return in * gDamping;
+}
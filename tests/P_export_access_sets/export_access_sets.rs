@@ -0,0 +1,25 @@
+// -export-access-sets
+#pragma version(1)
+#pragma rs java_package_name(foo)
+
+float gain;
+float4 offset = {0.f, 0.f, 0.f, 1.f};
+int frames;
+int *history;
+
+static void record(int *slot, int value) {
+  *slot = value;
+}
+
+float4 __attribute__((kernel)) scale(float4 in) {
+  return in * gain + offset;
+}
+
+void tick() {
+  frames++;
+  record(&history[frames & 15], frames);
+}
+
+void debug() {
+  rsDebug("frames", frames);
+}
@@ -0,0 +1,28 @@
+// -export-usage export_usage.manifest
+#pragma version(1)
+#pragma rs java_package_name(foo)
+
+float gain;
+float bias;
+int unused_count;
+
+static float apply(float in) {
+  return in * gain + bias;
+}
+
+float __attribute__((kernel)) root(float in) {
+  return apply(in);
+}
+
+float __attribute__((kernel)) clamped(float in) {
+  return fmin(fmax(apply(in), 0.f), 1.f);
+}
+
+void reset() {
+  gain = 1.f;
+  bias = 0.f;
+}
+
+void count() {
+  unused_count++;
+}
@@ -0,0 +1,10 @@
+// -target-api 18
+#pragma version(1)
+#pragma rs java_package_name(foo)
+
+int __attribute__((kernel)) blur(uint32_t ain, uint32_t x, uint32_t y) {
+  return 0;
+}
+
+void root(const int *ain, int *aout, const float *usrData) {
+}
@@ -0,0 +1,47 @@
+#pragma version(1)
+#pragma rs java_package_name(foo)
+
+float gain = 1.5f;
+
+#pragma rs fuse(brighten, threshold)
+#pragma rs fuse(toFloat, scale, toUchar)
+
+uchar4 __attribute__((kernel)) brighten(uchar4 in) {
+  return convert_uchar4(clamp(convert_float4(in) * gain, 0.f, 255.f));
+}
+
+uchar4 __attribute__((kernel)) threshold(uchar4 in, uint32_t x) {
+  return (x & 1) ? in : (uchar4){0, 0, 0, 255};
+}
+
+float4 __attribute__((kernel)) toFloat(uchar4 in) {
+  return convert_float4(in);
+}
+
+float4 __attribute__((kernel)) scale(float4 in, uint32_t x, uint32_t y) {
+  return in * (float)(x + y);
+}
+
+uchar4 __attribute__((kernel)) toUchar(float4 in) {
+  return convert_uchar4(clamp(in, 0.f, 255.f));
+}
+
+// The ABI passes these cells coerced to types of another size.
+#pragma rs fuse(toFloat3, dim3)
+#pragma rs fuse(pick2, swap2)
+
+float3 __attribute__((kernel)) toFloat3(uchar4 in) {
+  return convert_float3(in.xyz);
+}
+
+float3 __attribute__((kernel)) dim3(float3 in) {
+  return in * gain;
+}
+
+uchar2 __attribute__((kernel)) pick2(uchar4 in) {
+  return in.xy;
+}
+
+uchar2 __attribute__((kernel)) swap2(uchar2 in) {
+  return in.yx;
+}
@@ -0,0 +1,13 @@
+// -O0 -gsplit
+#pragma version(1)
+#pragma rs java_package_name(foo)
+
+float scale;
+
+static float apply(float v) {
+  return v * scale;
+}
+
+void root(const float *in, float *out) {
+  *out = apply(*in);
+}
@@ -0,0 +1,9 @@
+// -M -jobs 2 -I inc
+#pragma version(1)
+#pragma rs java_package_name(foo)
+
+// Preprocessed along with header_cache_b.rs by another worker, both get the
+// content of shared.rsh from the header cache and release it when done.
+#include "shared.rsh"
+
+float gScaleA = SHARED_SCALE;
@@ -0,0 +1,15 @@
+// -instrument-kernels
+#pragma version(1)
+#pragma rs java_package_name(foo)
+
+float gain;
+
+float __attribute__((kernel)) scale(float in) {
+  if (in < 0.f)
+    return 0.f;
+  return in * gain;
+}
+
+void setGain(float g) {
+  gain = g;
+}
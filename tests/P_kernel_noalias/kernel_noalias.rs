@@ -0,0 +1,12 @@
+#pragma version(1)
+#pragma rs java_package_name(foo)
+
+float scale;
+
+void root(const float4 *in, float4 *out, uint32_t x) {
+  *out = *in * scale + (float)x;
+}
+
+void halve(const float *in, float *out) {
+  *out = *in * 0.5f;
+}
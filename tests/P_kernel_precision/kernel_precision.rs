@@ -0,0 +1,23 @@
+// -target-api 18
+#pragma version(1)
+#pragma rs java_package_name(foo)
+
+#pragma rs fp_relaxed(smooth)
+#pragma rs fp_imprecise(sharpen)
+
+static float weight(float v) {
+  return v / 3.f;
+}
+
+float __attribute__((kernel)) smooth(float in) {
+  return weight(in) * 2.f;
+}
+
+float __attribute__((kernel)) sharpen(float in) {
+  return in * 1.5f - weight(in);
+}
+
+// Full precision, as is weight() for being called from it
+float __attribute__((kernel)) exact(float in) {
+  return weight(in);
+}
@@ -0,0 +1,15 @@
+// -target-api 18 -emit-kernel-report
+#pragma version(1)
+#pragma rs java_package_name(foo)
+
+rs_allocation weights;
+float bias;
+
+float4 __attribute__((kernel)) blend(float4 in, uint32_t x, uint32_t y) {
+  float w = *(const float *) rsGetElementAt(weights, x);
+  return in * w + bias + (float) y;
+}
+
+void root(const int *in, int *out) {
+  *out = *in * 3;
+}
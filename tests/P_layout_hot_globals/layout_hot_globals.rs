@@ -0,0 +1,17 @@
+// -layout-hot-globals
+#pragma version(1)
+#pragma rs java_package_name(foo)
+
+float table[256];
+float gain;
+float4 offset = {0.f, 0.f, 0.f, 1.f};
+int frames;
+
+float4 __attribute__((kernel)) root(float4 in) {
+  return in * gain + offset;
+}
+
+void tick() {
+  frames++;
+  table[frames & 255] = gain;
+}
@@ -0,0 +1,25 @@
+// -reflect-lazy-init -reflect-preallocated-packers
+#pragma version(1)
+#pragma rs java_package_name(foo)
+
+typedef struct Pixel {
+  uchar4 color;
+  float weight;
+} Pixel_t;
+
+float4 tint = {1.0f, 0.5f, 0.25f, 1.0f};
+int lut[4] = {1, 2, 3, 4};
+Pixel_t background;
+float gain = 2.0f;
+
+void set_gain(float g) {
+  gain = g;
+}
+
+uchar4 __attribute__((kernel)) apply(uchar4 in) {
+  return in;
+}
+
+void root(const Pixel_t *in, float *out) {
+  *out = in->weight * gain;
+}
@@ -0,0 +1,20 @@
+// -reflect-preallocated-packers
+#pragma version(1)
+#pragma rs java_package_name(foo)
+
+float gain;
+
+typedef struct Params {
+  float bias;
+  int offset;
+} Params_t;
+
+Params_t defaults;
+
+void set_gain(float g, int unused) {
+  gain = g;
+}
+
+void root(const float *in, float *out, const Params_t *p) {
+  *out = *in * gain + p->bias;
+}
@@ -0,0 +1,5 @@
+# Counts of a 1000x1000 image
+function root 1000000
+branch root 0 1000 999000
+branch root 1 1000 998000
+function setWidth 1
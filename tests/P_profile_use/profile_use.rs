@@ -0,0 +1,19 @@
+// -fprofile-use=profile_use.profile
+#pragma version(1)
+#pragma rs java_package_name(foo)
+
+uint32_t width;
+
+static uchar4 shade(uchar4 in) {
+  return in >> (uchar4)1;
+}
+
+uchar4 __attribute__((kernel)) root(uchar4 in, uint32_t x) {
+  if ((x == 0) || (x == width - 1))
+    return (uchar4)0;
+  return shade(in);
+}
+
+void setWidth(uint32_t w) {
+  width = w;
+}
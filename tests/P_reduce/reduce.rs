@@ -0,0 +1,37 @@
+#pragma version(1)
+#pragma rs java_package_name(foo)
+
+// Sum of the cells, combined by the accumulator itself
+#pragma rs reduce(addint) accumulator(aiAccum)
+
+void aiAccum(int *accum, int val) {
+  *accum += val;
+}
+
+// Bounds of the cells, as (min, max)
+#pragma rs reduce(bounds) initializer(bInit) accumulator(bAccum) \
+    combiner(bCombine) outconverter(bOut)
+
+typedef struct Bounds {
+  float lo;
+  float hi;
+} Bounds_t;
+
+void bInit(Bounds_t *accum) {
+  accum->lo = 1e38f;
+  accum->hi = -1e38f;
+}
+
+void bAccum(Bounds_t *accum, float val) {
+  accum->lo = fmin(accum->lo, val);
+  accum->hi = fmax(accum->hi, val);
+}
+
+void bCombine(Bounds_t *accum, const Bounds_t *other) {
+  accum->lo = fmin(accum->lo, other->lo);
+  accum->hi = fmax(accum->hi, other->hi);
+}
+
+void bOut(float2 *result, const Bounds_t *accum) {
+  *result = (float2){accum->lo, accum->hi};
+}
@@ -0,0 +1,40 @@
+#pragma version(1)
+#pragma rs java_package_name(foo)
+
+rs_allocation gIn;
+rs_allocation gOut;
+
+int gCount;
+
+static int count(rs_allocation a) {
+    return rsAllocationGetDimX(a);
+}
+
+// Only a copy of gIn, no rsSetObject/rsClearObject is needed.
+void borrowed() {
+    rs_allocation in = gIn;
+    if (rsAllocationGetDimX(in) == 0) {
+        return;
+    }
+    gCount = rsAllocationGetDimY(in);
+}
+
+// The global is modified while the local is alive.
+void globalModified() {
+    rs_allocation in = gIn;
+    gIn = gOut;
+    gCount = rsAllocationGetDimX(in);
+}
+
+// The local is modified.
+void localModified() {
+    rs_allocation in = gIn;
+    in = gOut;
+    gCount = rsAllocationGetDimX(in);
+}
+
+// Calls to functions of the script may modify the global.
+void callsScript() {
+    rs_allocation in = gIn;
+    gCount = count(in);
+}
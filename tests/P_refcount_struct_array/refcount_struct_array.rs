@@ -0,0 +1,25 @@
+#pragma version(1)
+#pragma rs java_package_name(foo)
+
+typedef struct inner {
+    rs_allocation a;
+    rs_element e[2];
+} inner_t;
+
+typedef struct outer {
+    inner_t in;
+    inner_t ins[4];
+    rs_sampler s;
+    int i;
+} outer_t;
+
+static outer_t gOuter;
+static outer_t gOuters[64];
+static inner_t gInners[16];
+
+void copy() {
+    outer_t local[8];
+    inner_t single = gInners[0];
+    local[0].in = single;
+    gOuters[1] = local[0];
+}
@@ -0,0 +1,18 @@
+// -write-if-changed reflect_write_if_changed.rs
+#pragma version(1)
+#pragma rs java_package_name(foo)
+
+// Compiled twice, the second compile finds the classes in the manifest,
+// reflected by the same compiler from the same signatures, and leaves them
+// alone.
+typedef struct point {
+    float x;
+    float y;
+} point_t;
+
+point_t gOrigin;
+
+void translate(float dx, float dy) {
+    gOrigin.x += dx;
+    gOrigin.y += dy;
+}
@@ -0,0 +1,11 @@
+#pragma version(1)
+#pragma rs java_package_name(foo)
+
+typedef struct Layer {
+  rs_allocation image;
+  float opacity;
+  rs_sampler samplers[2];
+  rs_script blend;
+} Layer_t;
+
+Layer_t layers[4];
@@ -0,0 +1,15 @@
+// -reflect-scriptfield-buffer
+#pragma version(1)
+#pragma rs java_package_name(foo)
+
+typedef struct particle {
+  float3 position;
+  float2 velocity[2];
+  rs_matrix2x2 m;
+  bool alive;
+  uchar u8;
+  ushort u16;
+  uint u32;
+} particle_t;
+
+particle_t *particles;
@@ -0,0 +1,14 @@
+// -emit-size-report
+#pragma version(1)
+#pragma rs java_package_name(foo)
+
+const int table[8] = {1, 2, 3, 5, 8, 13, 21, 34};
+float scale;
+
+static int lookup(int i) {
+  return table[i & 7];
+}
+
+void root(const int *in, float *out) {
+  *out = lookup(*in) * scale;
+}
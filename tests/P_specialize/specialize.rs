@@ -0,0 +1,19 @@
+// -target-api 18
+#pragma version(1)
+#pragma rs java_package_name(foo)
+
+int radius;
+float scale;
+
+#pragma rs specialize(radius = 3, scale = 1.5)
+
+static float weight(int i) {
+  return scale / (float) (radius + i);
+}
+
+float __attribute__((kernel)) blur(float in, uint32_t x) {
+  float sum = 0.f;
+  for (int i = -radius; i <= radius; i++)
+    sum += in * weight(i + radius);
+  return sum;
+}
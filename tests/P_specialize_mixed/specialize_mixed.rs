@@ -0,0 +1,13 @@
+// -target-api 18
+#pragma version(1)
+#pragma rs java_package_name(foo)
+
+float scale;
+double bias;
+float gain;
+
+#pragma rs specialize(scale = 2, bias = -3, gain = 0.1)
+
+float __attribute__((kernel)) adjust(float in) {
+  return (in * scale + (float) bias) * gain;
+}
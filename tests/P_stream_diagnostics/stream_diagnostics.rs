@@ -0,0 +1,8 @@
+// -stream-diagnostics
+#pragma version(1)
+#pragma rs java_package_name(foo)
+
+void foo() {
+    rs_program_store ps;
+    rsgProgramStoreGetDepthFunc(ps);
+}
@@ -0,0 +1,16 @@
+// -strip-debug-calls -strip-call traceCell
+#pragma version(1)
+#pragma rs java_package_name(foo)
+
+float gScale;
+
+void traceCell(float in, uint32_t x) {
+    rsDebug("traced", in, x);
+}
+
+float RS_KERNEL scale(float in, uint32_t x) {
+    rsDebug("scale in", in);
+    rsDebug("scale x", x);
+    traceCell(in * 2.f, x + 1);
+    return in * gScale;
+}
@@ -0,0 +1,20 @@
+#pragma version(1)
+#pragma rs java_package_name(foo)
+
+rs_allocation table;
+rs_allocation image;
+rs_allocation out;
+
+// Gather through a table of offsets
+float4 __attribute__((kernel)) gather(uint32_t x) {
+  int offset = *(const int *) rsGetElementAt(table, x);
+  const float4 *cell = (const float4 *) rsGetElementAt(image, x + offset);
+  return *cell + *(const float4 *) rsGetElementAt(image, x, 0);
+}
+
+// Scatter into out, the cells keep their addresses as lvalues
+void __attribute__((kernel)) scatter(uchar in, uint32_t x) {
+  uchar4 v = {in, in, in, 255};
+  rsSetElementAt(out, &v, x);
+  *(uchar *) rsGetElementAt(out, x) = in;
+}
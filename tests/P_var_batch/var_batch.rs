@@ -0,0 +1,23 @@
+// -reflect-var-batch
+#pragma version(1)
+#pragma rs java_package_name(foo)
+
+struct params {
+    float2 offset;
+    int count;
+} params;
+
+float scale;
+uchar level;
+float3 color;
+rs_matrix4x4 transform;
+int weights[4];
+
+// Not batchable
+const int limit = 8;
+rs_allocation in;
+int *buffer;
+
+void root(const int *ain, int *aout) {
+    *aout = *ain * level;
+}
@@ -0,0 +1,19 @@
+// -reflect-var-batch
+#pragma version(1)
+#pragma rs java_package_name(foo)
+
+// Batchable
+float gain;
+
+// Not batchable, the structs and arrays holding RS objects are set one by one
+struct frame {
+    float scale;
+    rs_allocation src;
+} frame;
+
+struct frame frames[2];
+rs_allocation sources[3];
+
+void root(const float *ain, float *aout) {
+    *aout = *ain * gain;
+}
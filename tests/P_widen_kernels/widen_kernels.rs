@@ -0,0 +1,25 @@
+// -target-api 18 -widen-kernels
+#pragma version(1)
+#pragma rs java_package_name(foo)
+
+float gain;
+
+static float4 scale(float4 v) {
+  return v * gain;
+}
+
+float4 __attribute__((kernel)) brighten(float4 in) {
+  return scale(in) + 0.1f;
+}
+
+uchar4 __attribute__((kernel)) invert(uchar4 in, uint32_t x) {
+  uchar4 out = (uchar4) 255 - in;
+  out.a = (uchar) x;
+  return out;
+}
+
+// Not widened: it reads another allocation
+rs_allocation other;
+float4 __attribute__((kernel)) add(float4 in, uint32_t x, uint32_t y) {
+  return in + *(const float4 *) rsGetElementAt(other, x, y);
+}
@@ -0,0 +1,263 @@
+#!/usr/bin/python
+#
+# Copyright 2013 Google Inc. All Rights Reserved.
+
+"""Renderscript Compiler Benchmark.
+
+Compiles a fixed corpus of scripts a number of times and records the time of
+each compilation phase (-time-report-json), the peak RSS of llvm-rs-cc and the
+size of the resulting .bc and reflected .java files. The results are compared
+against a stored baseline, such that regressions show up before they ship.
+"""
+
+import glob
+import json
+import os
+import shutil
+import subprocess
+import sys
+
+__author__ = 'Android'
+
+
+class Options(object):
+  def __init__(self):
+    return
+  verbose = 0
+  iterations = 5
+  threshold = 5.0
+  baseline = 'bench_baseline.json'
+  updateBaseline = 0
+  output = ''
+
+
+# Directories (relative to tests/) of the scripts to compile. Each directory is
+# compiled by a single llvm-rs-cc invocation, as in test.py.
+CORPUS = [
+    'P_compute',
+    'P_refcount',
+    'P_kernel',
+    'P_kernel_cpp',
+    'P_export_types',
+    'P_array_init',
+    'P_static_struct',
+    'P_math_fp',
+    'P_root_graphics',
+    'P_fs_kernel',
+    'P_one_definition_rule',
+    '../lit-tests/P_alloc_in_struct',
+    '../lit-tests/P_array_init',
+    '../lit-tests/P_compute',
+]
+
+
+def GetCommandLineArgs(filename):
+  """Extracts command line arguments from first comment line in a file."""
+  f = open(filename, 'r')
+  line = f.readline()
+  f.close()
+  if line[0:2] == '//' and line[0:8] != '// RUN: ':
+    return line[2:].strip()
+  else:
+    return ''
+
+
+def Median(values):
+  """Returns the median of a non-empty list of numbers."""
+  values = sorted(values)
+  mid = len(values) / 2
+  if len(values) % 2:
+    return values[mid]
+  return (values[mid - 1] + values[mid]) / 2.0
+
+
+def GetFileSizes(pattern_list):
+  """Returns the total size of the files matching the patterns."""
+  size = 0
+  for pattern in pattern_list:
+    for f in glob.glob(pattern):
+      size += os.path.getsize(f)
+  return size
+
+
+def RunOnce(args):
+  """Runs llvm-rs-cc once and returns (exit code, peak RSS in KB)."""
+  devnull = open(os.devnull, 'w')
+  try:
+    p = subprocess.Popen(args, stdout=devnull, stderr=devnull)
+    (_, status, rusage) = os.wait4(p.pid, 0)
+  finally:
+    devnull.close()
+  return (os.WEXITSTATUS(status), rusage.ru_maxrss)
+
+
+def BenchScript(dirname):
+  """Compiles the scripts in dirname Options.iterations times."""
+  if Options.verbose != 0:
+    print 'Benchmarking %s' % dirname
+
+  cwd = os.getcwd()
+  os.chdir(dirname)
+
+  cmd_string = ('../../../../../out/host/linux-x86/bin/llvm-rs-cc '
+                '-o tmp/ -p tmp/ '
+                '-time-report-json tmp/time.json '
+                '-I ../../../../../frameworks/rs/scriptc/ '
+                '-I ../../../../../external/clang/lib/Headers/')
+  base_args = cmd_string.split()
+  rs_files = glob.glob('*.rs') + glob.glob('*.fs')
+  rs_files.sort()
+
+  extra_args_str = ''
+  for rs_file in rs_files:
+    extra_args_str += ' ' + GetCommandLineArgs(rs_file)
+  args = base_args + extra_args_str.split() + rs_files
+
+  phases = {}
+  peak_rss = 0
+  result = None
+  for i in range(Options.iterations):
+    shutil.rmtree('tmp/', True)
+    os.mkdir('tmp')
+    (ret, rss) = RunOnce(args)
+    if ret != 0:
+      print >> sys.stderr, '%s: llvm-rs-cc failed (%d)' % (dirname, ret)
+      break
+    peak_rss = max(peak_rss, rss)
+    times = json.load(open('tmp/time.json'))
+    for phase in times:
+      phases.setdefault(phase, []).append(times[phase]['wall'])
+  else:
+    result = {
+        'phases': dict((p, Median(t)) for (p, t) in phases.items()),
+        'peak_rss_kb': peak_rss,
+        'bc_size': GetFileSizes(['tmp/*.bc']),
+        'java_size': GetFileSizes(['tmp/*.java', 'tmp/*/*.java',
+                                   'tmp/*/*/*.java', 'tmp/*/*/*/*.java']),
+    }
+    result['total'] = sum(result['phases'].values())
+
+  shutil.rmtree('tmp/', True)
+  os.chdir(cwd)
+  return result
+
+
+def Compare(name, current, baseline):
+  """Prints the changes of current against baseline. Returns the number of
+  regressions beyond Options.threshold."""
+  regressions = 0
+  limit = 1 + Options.threshold / 100
+
+  values = [('total', current['total'], baseline['total'])]
+  for phase in sorted(current['phases']):
+    values.append((phase, current['phases'][phase],
+                   baseline['phases'].get(phase, 0)))
+  for key in ('peak_rss_kb', 'bc_size', 'java_size'):
+    values.append((key, current[key], baseline[key]))
+
+  for (key, cur, base) in values:
+    change = 0.0
+    if base:
+      change = (cur - base) * 100.0 / base
+    mark = ''
+    if base and cur > base * limit:
+      # Don't let noise in tiny phases count
+      if key in ('peak_rss_kb', 'bc_size', 'java_size') or cur - base > 0.001:
+        mark = '  <-- REGRESSION'
+        regressions += 1
+    if mark or Options.verbose:
+      print '  %-32s %-20s %12s %12s %+7.1f%%%s' % (
+          name, key, base, cur, change, mark)
+
+  return regressions
+
+
+def Usage():
+  """Print out usage information."""
+  print ('Usage: %s [OPTION]... [DIRECTORY]...\n'
+         'Renderscript Compiler Benchmark\n'
+         'Compiles the scripts in DIRECTORYs (the default corpus by default)\n'
+         'and compares the results against a baseline.\n'
+         'Available Options:\n'
+         '  -h, --help             Help message\n'
+         '  -n, --iterations <N>   Compile each directory N times (default 5)\n'
+         '  -b, --baseline <FILE>  Baseline to compare against\n'
+         '                         (default bench_baseline.json)\n'
+         '  -u, --update-baseline  Store the results as the new baseline\n'
+         '  -t, --threshold <PCT>  Report increases beyond PCT percent\n'
+         '                         as regressions (default 5)\n'
+         '  -o, --output <FILE>    Also write the results to FILE\n'
+         '  -v, --verbose          Verbose output\n'
+        ) % (sys.argv[0]),
+  return
+
+
+def main():
+  dirs = []
+
+  argv = sys.argv[1:]
+  while argv:
+    arg = argv.pop(0)
+    if arg in ('-h', '--help'):
+      Usage()
+      return 0
+    elif arg in ('-n', '--iterations') and argv:
+      Options.iterations = max(1, int(argv.pop(0)))
+    elif arg in ('-b', '--baseline') and argv:
+      Options.baseline = argv.pop(0)
+    elif arg in ('-u', '--update-baseline'):
+      Options.updateBaseline = 1
+    elif arg in ('-t', '--threshold') and argv:
+      Options.threshold = float(argv.pop(0))
+    elif arg in ('-o', '--output') and argv:
+      Options.output = argv.pop(0)
+    elif arg in ('-v', '--verbose'):
+      Options.verbose += 1
+    elif os.path.isdir(arg):
+      dirs.append(arg)
+    else:
+      print >> sys.stderr, 'Invalid directory or option: %s' % arg
+      return 1
+
+  if not dirs:
+    dirs = CORPUS
+
+  results = {}
+  failed = 0
+  for d in dirs:
+    result = BenchScript(d)
+    if result is None:
+      failed += 1
+    else:
+      results[d] = result
+
+  if Options.output:
+    json.dump(results, open(Options.output, 'w'), indent=2, sort_keys=True)
+
+  if Options.updateBaseline:
+    json.dump(results, open(Options.baseline, 'w'), indent=2, sort_keys=True)
+    print 'Baseline written to %s' % Options.baseline
+    return failed != 0
+
+  if not os.path.isfile(Options.baseline):
+    print >> sys.stderr, ('No baseline %s, create one with --update-baseline'
+                          % Options.baseline)
+    return 1
+
+  baseline = json.load(open(Options.baseline))
+  regressions = 0
+  for d in sorted(results):
+    if d not in baseline:
+      print '  %-32s not in the baseline' % d
+      continue
+    regressions += Compare(d, results[d], baseline[d])
+
+  print 'Scripts Benchmarked: %d\n' % len(results),
+  print 'Scripts Failed: %d\n' % failed,
+  print 'Regressions: %d\n' % regressions,
+
+  return (failed != 0) or (regressions != 0)
+
+
+if __name__ == '__main__':
+  sys.exit(main())
@@ -0,0 +1,301 @@
+#!/usr/bin/python
+#
+# Copyright 2013 Google Inc. All Rights Reserved.
+
+"""Renderscript Compiler Scalability Benchmark.
+
+Generates synthetic scripts that grow along one dimension at a time (exported
+globals, struct fields, nested constant arrays of rs_allocation, kernels,
+invokable parameters, input files sharing the exported structs), compiles each
+size with llvm-rs-cc and reports how the time (-time-report-json) and the peak
+RSS scale with it.
+
+The growth of each dimension is summarized by its exponent: the slope of
+log(time) over log(size) between the two largest sizes, 1 for a linear one.
+With --max-exponent, any dimension growing faster fails the run, such that a
+fixed superlinear behavior stays fixed.
+"""
+
+import json
+import math
+import os
+import shutil
+import sys
+
+import bench
+
+__author__ = 'Android'
+
+
+class Options(object):
+  def __init__(self):
+    return
+  verbose = 0
+  iterations = 3
+  sizes = [64, 128, 256, 512]
+  dimensions = []
+  maxExponent = 0.0
+  emitDir = ''
+  output = ''
+
+
+HEADER = ('#pragma version(1)\n'
+          '#pragma rs java_package_name(bench.scale)\n\n')
+
+
+def GenGlobals(n):
+  """n exported globals of mixed types."""
+  types = ['int', 'float', 'float4', 'uint2', 'double', 'rs_allocation']
+  s = HEADER
+  for i in range(n):
+    s += '%s gGlobal%d;\n' % (types[i % len(types)], i)
+  return [s]
+
+
+def GenFields(n):
+  """A single exported struct with n fields (RSReflection::genTypeClass)."""
+  types = ['int', 'float', 'float4', 'char', 'short3', 'rs_allocation']
+  s = HEADER + 'typedef struct Wide {\n'
+  for i in range(n):
+    s += '  %s f%d;\n' % (types[i % len(types)], i)
+  s += '} Wide_t;\n\nWide_t gWide;\nWide_t *gWidePtr;\n'
+  return [s]
+
+
+def GenObjectArrays(n):
+  """n nested constant arrays of rs_allocation in a struct, which an
+  invokable keeps a local of (RSObjectRefCount). Those can't be exported, or
+  copied as a whole, so a flat struct with n arrays is exported next to it."""
+  s = HEADER + 'typedef struct Holder {\n'
+  for i in range(n):
+    s += '  rs_allocation a%d[4][2];\n' % i
+  s += '} Holder_t;\n\ntypedef struct Flat {\n'
+  for i in range(n):
+    s += '  rs_allocation a%d[4];\n' % i
+  s += ('} Flat_t;\n\n'
+        'static Holder_t sHolder;\n'
+        'Flat_t gFlat;\n\n'
+        'void swap() {\n'
+        '  Holder_t tmp;\n')
+  for i in range(n):
+    s += ('  tmp.a%d[1][0] = sHolder.a%d[0][1];\n'
+          '  sHolder.a%d[3][1] = gFlat.a%d[2];\n') % (i, i, i, i)
+  s += '}\n'
+  return [s]
+
+
+def GenKernels(n):
+  """n forEach kernels, each reading an exported global."""
+  s = HEADER + 'float gScale;\n\n'
+  for i in range(n):
+    s += ('float4 RS_KERNEL kernel%d(float4 in, uint32_t x) {\n'
+          '  return in * gScale + (float) (x + %d);\n'
+          '}\n\n') % (i, i)
+  return [s]
+
+
+def GenParams(n):
+  """Invokables with n parameters each."""
+  types = ['int', 'float', 'float2', 'uchar4', 'rs_allocation']
+  params = ', '.join(['%s p%d' % (types[i % len(types)], i)
+                      for i in range(n)])
+  s = HEADER + 'int gSum;\n\n'
+  for i in range(4):
+    s += 'void invoke%d(%s) {\n  gSum += %d;\n}\n\n' % (i, params, i)
+  return [s]
+
+
+def GenFiles(n):
+  """n input files exporting the same structs (SlangRS::checkODR)."""
+  s = HEADER
+  for i in range(8):
+    s += ('typedef struct Shared%d {\n'
+          '  int i;\n  float4 v;\n  rs_allocation a;\n'
+          '} Shared%d_t;\n\n'
+          'Shared%d_t gShared%d;\n\n') % (i, i, i, i)
+  return [s] * n
+
+
+# The dimensions, by name, with the generator of the sources (one per input
+# file) of each size
+DIMENSIONS = [
+    ('globals', GenGlobals),
+    ('fields', GenFields),
+    ('object_arrays', GenObjectArrays),
+    ('kernels', GenKernels),
+    ('params', GenParams),
+    ('files', GenFiles),
+]
+
+
+def WriteScripts(dirname, name, sources):
+  """Writes sources to dirname and returns the file names."""
+  files = []
+  for (i, source) in enumerate(sources):
+    filename = '%s_%d.rs' % (name, i)
+    f = open(os.path.join(dirname, filename), 'w')
+    f.write(source)
+    f.close()
+    files.append(filename)
+  return files
+
+
+def BenchSize(name, generator, size):
+  """Compiles the scripts of the given size Options.iterations times, in the
+  working directory of main()."""
+  shutil.rmtree('tmp/', True)
+  os.mkdir('tmp')
+  rs_files = WriteScripts('tmp', name, generator(size))
+
+  cmd_string = ('../../../../../out/host/linux-x86/bin/llvm-rs-cc '
+                '-o tmp/out/ -p tmp/out/ '
+                '-time-report-json tmp/time.json '
+                '-I ../../../../../frameworks/rs/scriptc/ '
+                '-I ../../../../../external/clang/lib/Headers/')
+  args = cmd_string.split() + [os.path.join('tmp', f) for f in rs_files]
+
+  walls = []
+  peak_rss = 0
+  for i in range(Options.iterations):
+    shutil.rmtree('tmp/out/', True)
+    os.mkdir('tmp/out')
+    (ret, rss) = bench.RunOnce(args)
+    if ret != 0:
+      print >> sys.stderr, '%s %d: llvm-rs-cc failed (%d)' % (name, size, ret)
+      return None
+    peak_rss = max(peak_rss, rss)
+    times = json.load(open('tmp/time.json'))
+    walls.append(sum([t['wall'] for t in times.values()]))
+
+  shutil.rmtree('tmp/', True)
+  return {'total': bench.Median(walls), 'peak_rss_kb': peak_rss}
+
+
+def Exponent(results, key):
+  """The slope of log(key) over log(size) between the two largest sizes."""
+  sizes = sorted(results)
+  if len(sizes) < 2:
+    return 0.0
+  (s0, s1) = (sizes[-2], sizes[-1])
+  (v0, v1) = (results[s0][key], results[s1][key])
+  if v0 <= 0 or v1 <= 0:
+    return 0.0
+  return math.log(float(v1) / v0) / math.log(float(s1) / s0)
+
+
+def BenchDimension(name, generator):
+  """Benchmarks every size of a dimension, returns the results by size."""
+  results = {}
+  for size in Options.sizes:
+    result = BenchSize(name, generator, size)
+    if result is None:
+      return None
+    results[size] = result
+    if Options.verbose != 0:
+      print '  %-16s %6d %10.3fs %10d KB' % (name, size, result['total'],
+                                            result['peak_rss_kb'])
+  return results
+
+
+def Usage():
+  """Print out usage information."""
+  print ('Usage: %s [OPTION]... [DIMENSION]...\n'
+         'Renderscript Compiler Scalability Benchmark\n'
+         'Compiles synthetic scripts growing along each DIMENSION (all of\n'
+         'them by default) and reports how the compile scales:\n'
+         '  %s\n'
+         'Available Options:\n'
+         '  -h, --help               Help message\n'
+         '  -n, --iterations <N>     Compile each size N times (default 3)\n'
+         '  -s, --sizes <N,...>      Sizes of each dimension\n'
+         '                           (default 64,128,256,512)\n'
+         '  -m, --max-exponent <E>   Fail if the time of a dimension grows\n'
+         '                           faster than size^E\n'
+         '  -e, --emit <DIR>         Only write the scripts of the largest\n'
+         '                           size to DIR\n'
+         '  -o, --output <FILE>      Also write the results to FILE\n'
+         '  -v, --verbose            Verbose output\n'
+        ) % (sys.argv[0], ', '.join([d[0] for d in DIMENSIONS])),
+  return
+
+
+def main():
+  argv = sys.argv[1:]
+  while argv:
+    arg = argv.pop(0)
+    if arg in ('-h', '--help'):
+      Usage()
+      return 0
+    elif arg in ('-n', '--iterations') and argv:
+      Options.iterations = max(1, int(argv.pop(0)))
+    elif arg in ('-s', '--sizes') and argv:
+      Options.sizes = sorted([int(s) for s in argv.pop(0).split(',')])
+    elif arg in ('-m', '--max-exponent') and argv:
+      Options.maxExponent = float(argv.pop(0))
+    elif arg in ('-e', '--emit') and argv:
+      Options.emitDir = argv.pop(0)
+    elif arg in ('-o', '--output') and argv:
+      Options.output = argv.pop(0)
+    elif arg in ('-v', '--verbose'):
+      Options.verbose += 1
+    elif arg in dict(DIMENSIONS):
+      Options.dimensions.append(arg)
+    else:
+      print >> sys.stderr, 'Invalid dimension or option: %s' % arg
+      return 1
+
+  dimensions = [d for d in DIMENSIONS
+                if not Options.dimensions or d[0] in Options.dimensions]
+
+  if Options.emitDir:
+    if not os.path.isdir(Options.emitDir):
+      os.makedirs(Options.emitDir)
+    for (name, generator) in dimensions:
+      WriteScripts(Options.emitDir, name, generator(Options.sizes[-1]))
+    return 0
+
+  # The paths in BenchSize() are relative to a directory of tests/, as the
+  # ones of bench.py
+  cwd = os.getcwd()
+  shutil.rmtree('tmp_scale/', True)
+  os.mkdir('tmp_scale')
+  os.chdir('tmp_scale')
+
+  results = {}
+  failed = 0
+  superlinear = 0
+  for (name, generator) in dimensions:
+    result = BenchDimension(name, generator)
+    if result is None:
+      failed += 1
+      continue
+    results[name] = {
+        'sizes': dict((str(s), r) for (s, r) in result.items()),
+        'time_exponent': Exponent(result, 'total'),
+        'rss_exponent': Exponent(result, 'peak_rss_kb'),
+    }
+    mark = ''
+    if Options.maxExponent and (results[name]['time_exponent'] >
+                                Options.maxExponent):
+      mark = '  <-- SUPERLINEAR'
+      superlinear += 1
+    print '  %-16s time ~ size^%.2f  rss ~ size^%.2f%s' % (
+        name, results[name]['time_exponent'], results[name]['rss_exponent'],
+        mark)
+
+  os.chdir(cwd)
+  shutil.rmtree('tmp_scale/', True)
+
+  if Options.output:
+    json.dump(results, open(Options.output, 'w'), indent=2, sort_keys=True)
+
+  print 'Dimensions Benchmarked: %d\n' % len(results),
+  print 'Dimensions Failed: %d\n' % failed,
+  if Options.maxExponent:
+    print 'Superlinear: %d\n' % superlinear,
+
+  return (failed != 0) or (superlinear != 0)
+
+
+if __name__ == '__main__':
+  sys.exit(main())